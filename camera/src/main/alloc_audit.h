@@ -0,0 +1,204 @@
+#pragma once
+
+// Heap allocation audit (CONFIG_TRAIN_ALLOC_AUDIT, menu "Allocation Audit").
+//
+// The heap hooks (CONFIG_HEAP_USE_HOOKS, selected by the option) count
+// every allocation and free against the task that made it (alloc_stats.h).
+// Task names map to subsystems, which are either ours or the network and
+// BLE stacks'. lwIP copies every send into a heap pbuf in the sending
+// task, so our sends are bracketed with alloc_audit_lib_begin()/_end() and
+// counted apart.
+//
+// /alloc?window_ms= measures a window while frames flow and passes only if
+// our tasks made no allocations of their own: the stream, capture and UDP
+// paths run on fixed pools. With CONFIG_HEAP_TRACING_STANDALONE as well,
+// the window records a heap trace and dumps the allocations still live at
+// its end, with their callers. The main loop logs every task that
+// allocated in the last 30 s.
+//
+// With the option off, the calls compile to nothing.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#if CONFIG_TRAIN_ALLOC_AUDIT
+
+#include <esp_attr.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#if CONFIG_HEAP_TRACING_STANDALONE
+#include <esp_heap_trace.h>
+#endif
+
+#define ALLOC_STATS_ATTR IRAM_ATTR
+#include "alloc_stats.h"
+
+#define ALLOC_AUDIT_TRACE_RECORDS 100
+
+static const char *ALLOC_TAG = "ALLOC";
+
+typedef struct {
+    const char *task_prefix;
+    const char *subsystem;
+    bool ours;
+} alloc_audit_subsystem_t;
+
+static const alloc_audit_subsystem_t alloc_audit_subsystems[] = {
+    { "stream", "stream", true },       // stream, stream_cap
+    { "udp_stream", "udp", true },
+    { "httpd", "httpd", true },
+    { "train_hub", "train", true },
+    { "power_mon", "power", true },
+    { "detect", "detect", true },
+    { "ota", "ota", true },
+    { "main", "main", true },
+    { "tiT", "lwip", false },
+    { "wifi", "wifi", false },
+    { "nimble", "ble", false },
+    { "btController", "ble", false },
+    { "mdns", "mdns", false },
+    { "esp_timer", "timer", false },
+    { "sys_evt", "event", false },
+};
+
+static const alloc_audit_subsystem_t alloc_audit_other = { "", "other", false };
+
+typedef struct {
+    int64_t start_us;
+    uint32_t start_frames;
+    alloc_owner_t start[ALLOC_STATS_MAX_OWNERS];
+    // Filled by alloc_audit_end()
+    uint32_t window_ms;
+    uint32_t frames;
+    alloc_owner_t delta[ALLOC_STATS_MAX_OWNERS];
+} alloc_audit_window_t;
+
+static alloc_stats_t alloc_audit_stats;
+static alloc_audit_window_t alloc_audit_log_window;
+#if CONFIG_HEAP_TRACING_STANDALONE
+static heap_trace_record_t alloc_audit_trace[ALLOC_AUDIT_TRACE_RECORDS];
+#endif
+
+// Until the scheduler runs there is no task; a NULL owner would mean a free row
+static IRAM_ATTR const void *alloc_audit_owner(void) {
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    return task ? (const void *)task : (const void *)1;
+}
+
+static IRAM_ATTR const char *alloc_audit_label(void) {
+    return xTaskGetCurrentTaskHandle() ? pcTaskGetName(NULL) : "boot";
+}
+
+void IRAM_ATTR esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps) {
+    if (ptr) {
+        alloc_stats_alloc(&alloc_audit_stats, alloc_audit_owner(), alloc_audit_label(), size);
+    }
+}
+
+void IRAM_ATTR esp_heap_trace_free_hook(void *ptr) {
+    if (ptr) {
+        alloc_stats_free(&alloc_audit_stats, alloc_audit_owner(), alloc_audit_label());
+    }
+}
+
+static uint32_t alloc_audit_lib_begin(void) {
+    return alloc_stats_lib_begin(&alloc_audit_stats, alloc_audit_owner(), alloc_audit_label());
+}
+
+static void alloc_audit_lib_end(uint32_t mark) {
+    alloc_stats_lib_end(&alloc_audit_stats, alloc_audit_owner(), alloc_audit_label(), mark);
+}
+
+static const alloc_audit_subsystem_t *alloc_audit_subsystem(const char *task) {
+    for (size_t i = 0; i < sizeof(alloc_audit_subsystems) / sizeof(alloc_audit_subsystems[0]); i++) {
+        const char *prefix = alloc_audit_subsystems[i].task_prefix;
+        if (strncmp(task, prefix, strlen(prefix)) == 0) {
+            return &alloc_audit_subsystems[i];
+        }
+    }
+    return &alloc_audit_other;
+}
+
+static void alloc_audit_begin(alloc_audit_window_t *w) {
+    w->start_us = esp_timer_get_time();
+    w->start_frames = camera_frames_captured;
+    alloc_stats_snapshot(&alloc_audit_stats, w->start);
+}
+
+static void alloc_audit_end(alloc_audit_window_t *w) {
+    alloc_owner_t now[ALLOC_STATS_MAX_OWNERS];
+    alloc_stats_snapshot(&alloc_audit_stats, now);
+    alloc_stats_diff(w->start, now, w->delta);
+    w->window_ms = (uint32_t)((esp_timer_get_time() - w->start_us) / 1000);
+    w->frames = camera_frames_captured - w->start_frames;
+}
+
+// Frames flowed and none of our tasks allocated outside library calls
+static bool alloc_audit_pass(const alloc_audit_window_t *w) {
+    if (w->frames == 0) {
+        return false;
+    }
+    for (int i = 0; i < ALLOC_STATS_MAX_OWNERS; i++) {
+        const alloc_owner_t *r = &w->delta[i];
+        if (r->owner && alloc_audit_subsystem(r->label)->ours && alloc_stats_own(r) > 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Heap trace around a /alloc window, when the heap tracer is built in
+static void alloc_audit_trace_start(void) {
+#if CONFIG_HEAP_TRACING_STANDALONE
+    heap_trace_start(HEAP_TRACE_LEAKS);
+#endif
+}
+
+static void alloc_audit_trace_stop(void) {
+#if CONFIG_HEAP_TRACING_STANDALONE
+    heap_trace_stop();
+    heap_trace_dump();
+#endif
+}
+
+static void alloc_audit_init(void) {
+#if CONFIG_HEAP_TRACING_STANDALONE
+    ESP_ERROR_CHECK(heap_trace_init_standalone(alloc_audit_trace, ALLOC_AUDIT_TRACE_RECORDS));
+#endif
+    __atomic_store_n(&alloc_audit_stats.enabled, true, __ATOMIC_RELEASE);
+    alloc_audit_begin(&alloc_audit_log_window);
+    ESP_LOGI(ALLOC_TAG, "Allocation audit on");
+}
+
+// Called from the main loop: every task that allocated since the last call
+static void alloc_audit_log_stats(void) {
+    alloc_audit_window_t *w = &alloc_audit_log_window;
+    alloc_audit_end(w);
+    ESP_LOGI(ALLOC_TAG, "Last %lu ms, %lu frames: %s", (unsigned long)w->window_ms,
+        (unsigned long)w->frames, alloc_audit_pass(w) ? "no allocations on our paths" : "ALLOCATING");
+    for (int i = 0; i < ALLOC_STATS_MAX_OWNERS; i++) {
+        const alloc_owner_t *r = &w->delta[i];
+        if (r->owner && r->allocs > 0) {
+            const alloc_audit_subsystem_t *sub = alloc_audit_subsystem(r->label);
+            ESP_LOGI(ALLOC_TAG, "  %-16s %-7s %6lu allocs (%lu in lwIP sends), %6lu frees, %8lu bytes",
+                r->label, sub->subsystem, (unsigned long)r->allocs, (unsigned long)r->lib_allocs,
+                (unsigned long)r->frees, (unsigned long)r->bytes);
+        }
+    }
+    if (alloc_audit_stats.dropped) {
+        ESP_LOGW(ALLOC_TAG, "  %lu allocations from tasks beyond the table", (unsigned long)alloc_audit_stats.dropped);
+    }
+    alloc_audit_begin(w);
+}
+
+#else
+
+static inline uint32_t alloc_audit_lib_begin(void) { return 0; }
+static inline void alloc_audit_lib_end(uint32_t mark) { (void)mark; }
+static inline void alloc_audit_init(void) {}
+static inline void alloc_audit_log_stats(void) {}
+
+#endif
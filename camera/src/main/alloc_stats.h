@@ -0,0 +1,147 @@
+#pragma once
+
+// Allocation counters per owner, for the allocation audit.
+//
+// An owner is an opaque pointer: the allocating task's handle on the
+// ESP32 (alloc_audit.h), a phase tag in the host harness
+// (tools/alloc_audit_host.c). Owners claim a row on their first allocation
+// with a compare-and-swap and label it (the task name), so recording takes
+// no lock and is safe from any task. An owner that finds the table full is
+// only counted in `dropped`.
+//
+// Allocations inside library calls the owner cannot avoid (lwIP copies
+// each send into a heap pbuf) are counted separately: the owner brackets
+// the call with alloc_stats_lib_begin()/_end(), and what its row gained in
+// between goes to lib_allocs.
+//
+// Readers take a snapshot and diff two of them, so several windows (the
+// periodic log, a /alloc request) can overlap. No ESP-IDF dependencies.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef ALLOC_STATS_MAX_OWNERS
+#define ALLOC_STATS_MAX_OWNERS 32
+#endif
+
+#define ALLOC_STATS_LABEL_LEN 16
+
+// Recording runs inside the allocator; the ESP32 build puts it in IRAM
+#ifndef ALLOC_STATS_ATTR
+#define ALLOC_STATS_ATTR
+#endif
+
+typedef struct {
+    const void *owner;          // NULL = free row
+    char label[ALLOC_STATS_LABEL_LEN];
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t bytes;             // Bytes allocated
+    uint32_t lib_allocs;        // Of allocs, inside bracketed library calls
+} alloc_owner_t;
+
+typedef struct {
+    alloc_owner_t row[ALLOC_STATS_MAX_OWNERS];
+    uint32_t dropped;           // Allocations by owners that found no row
+    bool enabled;
+} alloc_stats_t;
+
+static ALLOC_STATS_ATTR alloc_owner_t *alloc_stats_row(alloc_stats_t *st, const void *owner, const char *label) {
+    for (int i = 0; i < ALLOC_STATS_MAX_OWNERS; i++) {
+        alloc_owner_t *r = &st->row[i];
+        const void *cur = __atomic_load_n(&r->owner, __ATOMIC_ACQUIRE);
+        if (cur == owner) {
+            return r;
+        }
+        if (cur == NULL) {
+            const void *expected = NULL;
+            if (__atomic_compare_exchange_n(&r->owner, &expected, owner, false, __ATOMIC_ACQ_REL,
+                                            __ATOMIC_ACQUIRE)) {
+                strncpy(r->label, label, ALLOC_STATS_LABEL_LEN - 1);
+                return r;
+            }
+            if (expected == owner) {
+                return r;
+            }
+        }
+    }
+    return NULL;
+}
+
+static ALLOC_STATS_ATTR void alloc_stats_alloc(alloc_stats_t *st, const void *owner, const char *label, uint32_t size) {
+    if (!__atomic_load_n(&st->enabled, __ATOMIC_RELAXED)) {
+        return;
+    }
+    alloc_owner_t *r = alloc_stats_row(st, owner, label);
+    if (r == NULL) {
+        __atomic_add_fetch(&st->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    __atomic_add_fetch(&r->allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&r->bytes, size, __ATOMIC_RELAXED);
+}
+
+static ALLOC_STATS_ATTR void alloc_stats_free(alloc_stats_t *st, const void *owner, const char *label) {
+    if (!__atomic_load_n(&st->enabled, __ATOMIC_RELAXED)) {
+        return;
+    }
+    alloc_owner_t *r = alloc_stats_row(st, owner, label);
+    if (r != NULL) {
+        __atomic_add_fetch(&r->frees, 1, __ATOMIC_RELAXED);
+    }
+}
+
+#define ALLOC_STATS_NO_MARK UINT32_MAX
+
+// Bracket a library call: returns a mark for alloc_stats_lib_end()
+static uint32_t alloc_stats_lib_begin(alloc_stats_t *st, const void *owner, const char *label) {
+    if (!__atomic_load_n(&st->enabled, __ATOMIC_RELAXED)) {
+        return ALLOC_STATS_NO_MARK;
+    }
+    alloc_owner_t *r = alloc_stats_row(st, owner, label);
+    return r ? __atomic_load_n(&r->allocs, __ATOMIC_RELAXED) : ALLOC_STATS_NO_MARK;
+}
+
+static void alloc_stats_lib_end(alloc_stats_t *st, const void *owner, const char *label, uint32_t mark) {
+    if (mark == ALLOC_STATS_NO_MARK) {
+        return;
+    }
+    alloc_owner_t *r = alloc_stats_row(st, owner, label);
+    if (r != NULL) {
+        uint32_t now = __atomic_load_n(&r->allocs, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&r->lib_allocs, now - mark, __ATOMIC_RELAXED);
+    }
+}
+
+// Copy the counters. Rows may be a few counts apart, which is fine for a
+// window of seconds.
+static void alloc_stats_snapshot(const alloc_stats_t *st, alloc_owner_t *out) {
+    for (int i = 0; i < ALLOC_STATS_MAX_OWNERS; i++) {
+        out[i].owner = __atomic_load_n(&st->row[i].owner, __ATOMIC_ACQUIRE);
+        memcpy(out[i].label, st->row[i].label, ALLOC_STATS_LABEL_LEN);
+        out[i].allocs = __atomic_load_n(&st->row[i].allocs, __ATOMIC_RELAXED);
+        out[i].frees = __atomic_load_n(&st->row[i].frees, __ATOMIC_RELAXED);
+        out[i].bytes = __atomic_load_n(&st->row[i].bytes, __ATOMIC_RELAXED);
+        out[i].lib_allocs = __atomic_load_n(&st->row[i].lib_allocs, __ATOMIC_RELAXED);
+    }
+}
+
+// after - before, row by row. Rows keep their owner for good, so the same
+// index is the same owner in both snapshots (or free in `before`).
+static void alloc_stats_diff(const alloc_owner_t *before, const alloc_owner_t *after, alloc_owner_t *out) {
+    for (int i = 0; i < ALLOC_STATS_MAX_OWNERS; i++) {
+        out[i] = after[i];
+        if (before[i].owner == after[i].owner) {
+            out[i].allocs -= before[i].allocs;
+            out[i].frees -= before[i].frees;
+            out[i].bytes -= before[i].bytes;
+            out[i].lib_allocs -= before[i].lib_allocs;
+        }
+    }
+}
+
+// Allocations the owner made itself, outside bracketed library calls
+static uint32_t alloc_stats_own(const alloc_owner_t *r) {
+    return r->allocs - r->lib_allocs;
+}
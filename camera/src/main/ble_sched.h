@@ -0,0 +1,275 @@
+#pragma once
+
+// Coexistence-aware BLE radio scheduling for the hub connections.
+//
+// Pure policy with no NimBLE or ESP-IDF dependencies: the BLE glue in
+// train_ble.h reports connections, commands and scan outcomes plus a
+// monotonic clock (microseconds), and the policy says which connection
+// parameters each link should run and when to scan. With software
+// coexistence every BLE radio event is time taken from WiFi, so:
+//
+//   IDLE    - long connection interval plus peripheral latency. The central
+//             still wakes every interval; the latency lets the hub sleep
+//             through events, and adds up to (latency + 1) intervals to the
+//             first command of a burst.
+//   ACTIVE  - short interval, no latency, while commands are in flight and
+//             for active_hold_ms after the last one.
+//
+// Scanning runs in bursts separated by an exponential backoff that resets
+// when a hub is lost or found, and uses a narrower window while WiFi is
+// busy. The radio duty-cycle estimate counts one connection event per
+// interval per link plus the scan window share.
+//
+// Intervals and timeouts use the BLE units (1.25 ms / 0.625 ms / 10 ms).
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef BLE_SCHED_MAX_LINKS
+#define BLE_SCHED_MAX_LINKS 4
+#endif
+
+#define BLE_SCHED_ITVL_US 1250      // Connection interval unit (us)
+
+typedef enum {
+    BLE_LINK_IDLE = 0,
+    BLE_LINK_ACTIVE,
+} ble_link_mode_t;
+
+typedef struct {
+    uint16_t itvl_min;
+    uint16_t itvl_max;
+    uint16_t latency;
+    uint16_t supervision_timeout;
+} ble_sched_conn_params_t;
+
+typedef struct {
+    ble_sched_conn_params_t active;
+    ble_sched_conn_params_t idle;
+    uint32_t active_hold_ms;        // Short intervals this long after the last command
+
+    uint16_t scan_itvl;
+    uint16_t scan_window;
+    uint16_t scan_window_busy;      // Window while WiFi is above wifi_busy_kbps
+    uint32_t scan_duration_ms;      // Length of one scan burst
+    uint32_t scan_backoff_min_ms;
+    uint32_t scan_backoff_max_ms;
+    uint32_t wifi_busy_kbps;
+
+    uint32_t conn_event_us;         // Radio time of one (mostly empty) connection event
+} ble_sched_config_t;
+
+typedef struct {
+    bool connected;
+    ble_link_mode_t mode;           // What the policy wants
+    uint16_t itvl;                  // What the controller runs (0 until known)
+    uint16_t latency;
+    uint32_t inflight;
+    int64_t last_cmd_us;
+    uint32_t switches;              // Parameter updates requested
+    uint64_t active_us;             // Time spent in ACTIVE
+} ble_sched_link_t;
+
+typedef struct {
+    ble_sched_config_t cfg;
+    ble_sched_link_t links[BLE_SCHED_MAX_LINKS];
+    int link_count;
+
+    bool scanning;
+    bool scan_busy;                 // Current burst uses the narrow window
+    uint32_t backoff_ms;            // Delay before the next burst
+    uint32_t scan_bursts;
+    uint64_t scan_us;
+
+    uint32_t wifi_kbps;
+    uint32_t wifi_last_bytes;
+    int64_t wifi_last_us;
+
+    int64_t accounted_until_us;
+    int64_t started_us;
+    uint64_t radio_us;              // Estimated BLE radio time since start
+} ble_sched_t;
+
+static const char* ble_link_mode_str(ble_link_mode_t mode) {
+    return mode == BLE_LINK_ACTIVE ? "active" : "idle";
+}
+
+static ble_sched_config_t ble_sched_default_config(void) {
+    ble_sched_config_t cfg = {
+        .active = { .itvl_min = 12, .itvl_max = 24, .latency = 0, .supervision_timeout = 400 },   // 15-30 ms
+        .idle = { .itvl_min = 64, .itvl_max = 72, .latency = 1, .supervision_timeout = 400 },     // 80-90 ms
+        .active_hold_ms = 3000,
+        .scan_itvl = 160,               // 100 ms
+        .scan_window = 80,              // 50 ms
+        .scan_window_busy = 16,         // 10 ms
+        .scan_duration_ms = 5000,
+        .scan_backoff_min_ms = 1000,
+        .scan_backoff_max_ms = 30000,
+        .wifi_busy_kbps = 1000,
+        .conn_event_us = 600,
+    };
+    return cfg;
+}
+
+static void ble_sched_init(ble_sched_t *s, const ble_sched_config_t *cfg, int link_count, int64_t now_us) {
+    *s = (ble_sched_t){0};
+    s->cfg = *cfg;
+    s->link_count = link_count > BLE_SCHED_MAX_LINKS ? BLE_SCHED_MAX_LINKS : link_count;
+    s->backoff_ms = cfg->scan_backoff_min_ms;
+    s->started_us = now_us;
+    s->accounted_until_us = now_us;
+    s->wifi_last_us = now_us;
+}
+
+// Estimated BLE radio duty cycle right now, in permille
+static uint32_t ble_sched_duty_permille(const ble_sched_t *s) {
+    uint32_t duty = 0;
+    for (int i = 0; i < s->link_count; i++) {
+        const ble_sched_link_t *l = &s->links[i];
+        if (l->connected && l->itvl > 0) {
+            duty += s->cfg.conn_event_us * 1000 / ((uint32_t)l->itvl * BLE_SCHED_ITVL_US);
+        }
+    }
+    if (s->scanning && s->cfg.scan_itvl > 0) {
+        uint16_t window = s->scan_busy ? s->cfg.scan_window_busy : s->cfg.scan_window;
+        duty += (uint32_t)window * 1000 / s->cfg.scan_itvl;
+    }
+    return duty > 1000 ? 1000 : duty;
+}
+
+// Charge elapsed time at the current duty cycle; call before any change
+static void ble_sched_account(ble_sched_t *s, int64_t now_us) {
+    int64_t dt = now_us - s->accounted_until_us;
+    if (dt <= 0) {
+        return;
+    }
+    s->radio_us += (uint64_t)dt * ble_sched_duty_permille(s) / 1000;
+    for (int i = 0; i < s->link_count; i++) {
+        if (s->links[i].connected && s->links[i].mode == BLE_LINK_ACTIVE) {
+            s->links[i].active_us += dt;
+        }
+    }
+    if (s->scanning) {
+        s->scan_us += dt;
+    }
+    s->accounted_until_us = now_us;
+}
+
+// Average estimated duty cycle since start, in permille
+static uint32_t ble_sched_avg_duty_permille(ble_sched_t *s, int64_t now_us) {
+    ble_sched_account(s, now_us);
+    int64_t elapsed = now_us - s->started_us;
+    return elapsed > 0 ? (uint32_t)(s->radio_us * 1000 / elapsed) : 0;
+}
+
+static const ble_sched_conn_params_t* ble_sched_params(const ble_sched_t *s, ble_link_mode_t mode) {
+    return mode == BLE_LINK_ACTIVE ? &s->cfg.active : &s->cfg.idle;
+}
+
+// A link came up with interval `itvl`. New links start ACTIVE so discovery
+// and the program start run at the short interval.
+static void ble_sched_connected(ble_sched_t *s, int link, uint16_t itvl, uint16_t latency, int64_t now_us) {
+    ble_sched_account(s, now_us);
+    ble_sched_link_t *l = &s->links[link];
+    *l = (ble_sched_link_t){0};
+    l->connected = true;
+    l->mode = BLE_LINK_ACTIVE;
+    l->itvl = itvl;
+    l->latency = latency;
+    l->last_cmd_us = now_us;
+    s->backoff_ms = s->cfg.scan_backoff_min_ms;
+}
+
+static void ble_sched_disconnected(ble_sched_t *s, int link, int64_t now_us) {
+    ble_sched_account(s, now_us);
+    s->links[link].connected = false;
+    s->links[link].inflight = 0;
+    s->backoff_ms = s->cfg.scan_backoff_min_ms;  // It is probably coming back
+}
+
+// The controller applied new parameters
+static void ble_sched_params_updated(ble_sched_t *s, int link, uint16_t itvl, uint16_t latency, int64_t now_us) {
+    ble_sched_account(s, now_us);
+    s->links[link].itvl = itvl;
+    s->links[link].latency = latency;
+}
+
+// A command was queued for `link`. Returns true if the link should switch
+// to the ACTIVE parameters now.
+static bool ble_sched_command(ble_sched_t *s, int link, int64_t now_us) {
+    ble_sched_link_t *l = &s->links[link];
+    l->inflight++;
+    l->last_cmd_us = now_us;
+    if (!l->connected || l->mode == BLE_LINK_ACTIVE) {
+        return false;
+    }
+    ble_sched_account(s, now_us);
+    l->mode = BLE_LINK_ACTIVE;
+    l->switches++;
+    return true;
+}
+
+static void ble_sched_command_done(ble_sched_t *s, int link, int64_t now_us) {
+    ble_sched_link_t *l = &s->links[link];
+    if (l->inflight > 0) {
+        l->inflight--;
+    }
+    l->last_cmd_us = now_us;
+}
+
+// Periodic check. Returns a bitmask of links that should drop to the IDLE
+// parameters now.
+static uint32_t ble_sched_tick(ble_sched_t *s, int64_t now_us) {
+    ble_sched_account(s, now_us);
+    uint32_t to_idle = 0;
+    for (int i = 0; i < s->link_count; i++) {
+        ble_sched_link_t *l = &s->links[i];
+        if (l->connected && l->mode == BLE_LINK_ACTIVE && l->inflight == 0 &&
+            now_us - l->last_cmd_us >= (int64_t)s->cfg.active_hold_ms * 1000) {
+            l->mode = BLE_LINK_IDLE;
+            l->switches++;
+            to_idle |= 1u << i;
+        }
+    }
+    return to_idle;
+}
+
+// Application bytes sent over WiFi so far (a free-running counter)
+static void ble_sched_wifi_sample(ble_sched_t *s, uint32_t tx_bytes, int64_t now_us) {
+    int64_t dt = now_us - s->wifi_last_us;
+    if (dt < 500000) {
+        return;
+    }
+    s->wifi_kbps = (uint32_t)((uint64_t)(uint32_t)(tx_bytes - s->wifi_last_bytes) * 8000 / dt);
+    s->wifi_last_bytes = tx_bytes;
+    s->wifi_last_us = now_us;
+}
+
+// Scan parameters for the next burst (window depends on WiFi load)
+static void ble_sched_scan_started(ble_sched_t *s, uint16_t *itvl, uint16_t *window, int64_t now_us) {
+    ble_sched_account(s, now_us);
+    s->scanning = true;
+    s->scan_busy = s->wifi_kbps >= s->cfg.wifi_busy_kbps;
+    s->scan_bursts++;
+    *itvl = s->cfg.scan_itvl;
+    *window = s->scan_busy ? s->cfg.scan_window_busy : s->cfg.scan_window;
+}
+
+// A scan burst ended, `found` if it led to a connection attempt. Returns
+// the delay before the next burst in milliseconds.
+static uint32_t ble_sched_scan_done(ble_sched_t *s, bool found, int64_t now_us) {
+    ble_sched_account(s, now_us);
+    s->scanning = false;
+    if (found) {
+        s->backoff_ms = s->cfg.scan_backoff_min_ms;
+        return 0;
+    }
+    uint32_t delay = s->backoff_ms;
+    s->backoff_ms = s->backoff_ms * 2 > s->cfg.scan_backoff_max_ms ? s->cfg.scan_backoff_max_ms : s->backoff_ms * 2;
+    return delay;
+}
+
+// Current backoff (the delay before a scan after a lost or failed link)
+static uint32_t ble_sched_backoff_ms(const ble_sched_t *s) {
+    return s->backoff_ms;
+}
@@ -1,5 +1,16 @@
 #pragma once
 
+#include <esp_camera.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <freertos/event_groups.h>
+
+#if CONFIG_TRAIN_CAMERA_SUPERVISOR
+#include "camera_health.h"
+#endif
+
 // Available frame sizes (smallest to largest):
 // FRAMESIZE_96X96    (96x96)     FRAMESIZE_QQVGA   (160x120)
 // FRAMESIZE_QCIF     (176x144)   FRAMESIZE_HQVGA   (240x176)
@@ -9,9 +20,12 @@
 // FRAMESIZE_XGA      (1024x768)  FRAMESIZE_HD      (1280x720)
 // FRAMESIZE_SXGA     (1280x1024) FRAMESIZE_UXGA    (1600x1200)
 #define IMAGE_SIZE FRAMESIZE_SVGA
+// Frame buffers are sized for this at init, so presets can switch up to it at runtime
+#define CAMERA_MAX_FRAMESIZE FRAMESIZE_UXGA
 #define IMAGE_FORMAT PIXFORMAT_JPEG 
 // Quality verbatim: 0-63, for OV series camera sensors, lower number means higher quality
 #define JPEG_QUALITY 32
+// Default capture mode; "cam_mode" on /config switches it live (runtime_config.h)
 #define CONTINUOUS_CAPTURE 1
 
 #define CAM_PIN_PWDN     -1
@@ -68,23 +82,165 @@ static camera_config_t const camera_config = {
     .ledc_channel = LEDC_CHANNEL_0,
 
     .pixel_format = IMAGE_FORMAT,
-    .frame_size = IMAGE_SIZE,    //QQVGA-UXGA, For ESP32, do not use sizes above QVGA when not JPEG. The performance of the ESP32-S series has improved a lot, but JPEG mode always gives better frame rates.
+    .frame_size = CAMERA_MAX_FRAMESIZE,    //QQVGA-UXGA, For ESP32, do not use sizes above QVGA when not JPEG. The performance of the ESP32-S series has improved a lot, but JPEG mode always gives better frame rates.
 
     .jpeg_quality = JPEG_QUALITY, //0-63, for OV series camera sensors, lower number means higher quality
     .fb_location = CAMERA_FB_IN_PSRAM,
-#if CONTINUOUS_CAPTURE
     .fb_count = 2, //When jpeg mode is used, if fb_count more than one, the driver will work in continuous mode.
     .grab_mode = CAMERA_GRAB_LATEST,
-#else // CONTINUOUS_CAPTURE
-    .fb_count = 1, //When jpeg mode is used, if fb_count more than one, the driver will work in continuous mode.
-    .grab_mode = CAMERA_GRAB_WHEN_EMPTY,
-#endif // CONTINUOUS_CAPTURE
 };
 
-static void init_camera() {
-    ESP_ERROR_CHECK(esp_camera_init(&camera_config));
+// Frame pipeline gate: every consumer grabs frames through camera_fb_get() so
+// that reconfiguration (presets, recovery) can drain in-flight frames first.
+static SemaphoreHandle_t camera_pipeline_mutex = NULL;
+static volatile int camera_fbs_in_flight = 0;
+static volatile uint32_t camera_frames_captured = 0;
+static volatile int64_t camera_last_frame_us = 0;
+static volatile uint32_t camera_frame_interval_us = 0;  // Smoothed interval between captures
+
+// H.264 mode (h264_stream.h): the sensor sends YUV422 at this size for the
+// encoder instead of JPEG. FRAMESIZE_INVALID is JPEG.
+static framesize_t camera_yuv_framesize = FRAMESIZE_INVALID;
+
+// Consumers wait on these bits instead of the driver: CAMERA_UP_BIT is
+// cleared while the camera is down (camera_supervisor.h), CAMERA_JPEG_BIT
+// while the sensor sends YUV.
+#define CAMERA_UP_BIT BIT0
+#define CAMERA_JPEG_BIT BIT1
+#define CAMERA_PARK_MS 1000
+static EventGroupHandle_t camera_events = NULL;
+
+#if CONFIG_TRAIN_CAMERA_SUPERVISOR
+// Every grab is reported to the health policy (camera_supervisor.h)
+static camera_health_t camera_health;
+static portMUX_TYPE camera_health_lock = portMUX_INITIALIZER_UNLOCKED;
+#endif
+
+// Grab a frame once all of `bits` are set, or return NULL after
+// CAMERA_PARK_MS. The bits are checked again with the pipeline held, as a
+// mode switch changes them with the pipeline held.
+static camera_fb_t *camera_fb_grab(EventBits_t bits) {
+    if ((xEventGroupWaitBits(camera_events, bits, pdFALSE, pdTRUE, pdMS_TO_TICKS(CAMERA_PARK_MS)) & bits) != bits) {
+        return NULL;
+    }
+    xSemaphoreTake(camera_pipeline_mutex, portMAX_DELAY);
+    if ((xEventGroupGetBits(camera_events) & bits) != bits) {
+        xSemaphoreGive(camera_pipeline_mutex);
+        return NULL;
+    }
+#if CONFIG_TRAIN_CAMERA_SUPERVISOR
+    int64_t start = esp_timer_get_time();
+    taskENTER_CRITICAL(&camera_health_lock);
+    camera_health_begin(&camera_health, start);
+    taskEXIT_CRITICAL(&camera_health_lock);
+    camera_fb_t *fb = esp_camera_fb_get();
+    int64_t end = esp_timer_get_time();
+    taskENTER_CRITICAL(&camera_health_lock);
+    camera_health_grab(&camera_health, end, fb != NULL, (uint32_t)(end - start));
+    taskEXIT_CRITICAL(&camera_health_lock);
+#else
+    camera_fb_t *fb = esp_camera_fb_get();
+#endif
+    if (fb) {
+        __atomic_add_fetch(&camera_fbs_in_flight, 1, __ATOMIC_ACQ_REL);
+        int64_t now = esp_timer_get_time();
+        int64_t interval = now - camera_last_frame_us;
+        if (camera_last_frame_us > 0 && interval < 1000000) {
+            camera_frame_interval_us = camera_frame_interval_us
+                ? (camera_frame_interval_us * 7 + (uint32_t)interval) / 8
+                : (uint32_t)interval;
+        }
+        camera_frames_captured++;
+        camera_last_frame_us = now;
+    }
+    xSemaphoreGive(camera_pipeline_mutex);
+    return fb;
+}
+
+// A JPEG frame. Waits, and returns NULL, while the camera is down or the
+// sensor sends YUV for the H.264 encoder.
+static camera_fb_t *camera_fb_get(void) {
+    return camera_fb_grab(CAMERA_UP_BIT | CAMERA_JPEG_BIT);
+}
+
+// A frame in whatever format the sensor is set to (fb->format)
+static camera_fb_t *camera_fb_get_any(void) {
+    return camera_fb_grab(CAMERA_UP_BIT);
+}
+
+static void camera_fb_return(camera_fb_t *fb) {
+    esp_camera_fb_return(fb);
+    __atomic_sub_fetch(&camera_fbs_in_flight, 1, __ATOMIC_ACQ_REL);
+}
+
+// Block new captures and wait for consumers to hand back their frames.
+// Returns false (still paused) if frames are not returned within the timeout.
+static bool camera_pipeline_pause(int timeout_ms) {
+    xSemaphoreTake(camera_pipeline_mutex, portMAX_DELAY);
+    while (__atomic_load_n(&camera_fbs_in_flight, __ATOMIC_ACQUIRE) > 0 && timeout_ms > 0) {
+        vTaskDelay(pdMS_TO_TICKS(1));
+        timeout_ms--;
+    }
+    return __atomic_load_n(&camera_fbs_in_flight, __ATOMIC_ACQUIRE) == 0;
+}
+
+static void camera_pipeline_resume(void) {
+    xSemaphoreGive(camera_pipeline_mutex);
+}
+
+static bool camera_continuous = CONTINUOUS_CAPTURE;
+
+static pixformat_t camera_pixformat(void) {
+    return camera_yuv_framesize != FRAMESIZE_INVALID ? PIXFORMAT_YUV422 : IMAGE_FORMAT;
+}
+
+// Framesize a fresh sensor starts at
+static framesize_t camera_default_framesize(void) {
+    return camera_yuv_framesize != FRAMESIZE_INVALID ? camera_yuv_framesize : IMAGE_SIZE;
+}
+
+// Start the driver. Continuous capture keeps two frame buffers filling;
+// single capture takes one frame when asked for it. In H.264 mode the
+// frame buffers only hold YUV422 at camera_yuv_framesize.
+static esp_err_t camera_start(bool continuous) {
+    camera_config_t config = camera_config;
+    if (!continuous) {
+        config.fb_count = 1;
+        config.grab_mode = CAMERA_GRAB_WHEN_EMPTY;
+    }
+    if (camera_yuv_framesize != FRAMESIZE_INVALID) {
+        config.pixel_format = PIXFORMAT_YUV422;
+        config.frame_size = camera_yuv_framesize;
+    }
+    esp_err_t err = esp_camera_init(&config);
+    if (err != ESP_OK) {
+        return err;
+    }
+    camera_continuous = continuous;
 
     sensor_t *sensor = esp_camera_sensor_get();
     // sensor->set_hmirror(sensor, 1);
     sensor->set_vflip(sensor, 1);
+    sensor->set_framesize(sensor, camera_default_framesize());
+    if (camera_yuv_framesize != FRAMESIZE_INVALID) {
+        xEventGroupClearBits(camera_events, CAMERA_JPEG_BIT);
+    } else {
+        xEventGroupSetBits(camera_events, CAMERA_JPEG_BIT);
+    }
+    return ESP_OK;
+}
+
+// `yuv_framesize` starts in H.264 mode; FRAMESIZE_INVALID for JPEG
+static void init_camera(bool continuous, framesize_t yuv_framesize) {
+    camera_pipeline_mutex = xSemaphoreCreateMutex();
+    camera_events = xEventGroupCreate();
+    xEventGroupSetBits(camera_events, CAMERA_UP_BIT);
+    camera_yuv_framesize = yuv_framesize;
+
+    ESP_ERROR_CHECK(camera_start(continuous));
+
+#if CONFIG_TRAIN_CAMERA_SUPERVISOR
+    camera_health_config_t cfg = camera_health_default_config();
+    camera_health_init(&camera_health, &cfg, esp_timer_get_time());
+#endif
 }
@@ -0,0 +1,404 @@
+#pragma once
+
+// Runtime camera control: preset storage in NVS, ROI windowing,
+// glitch-free switching, and the recovery steps of camera_supervisor.h.
+//
+// A switch drains the frame pipeline (camera_pipeline_pause), applies the
+// preset diff in one go, flushes frames captured with the old settings, and
+// resumes. Switch latency and the number of frames lost are recorded.
+
+#include <stdlib.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_camera.h>
+#include <nvs_flash.h>
+#include <nvs.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include "camera.h"
+#include "camera_preset.h"
+#include "camera_roi.h"
+#include "power.h"
+
+#define CAMERA_NVS_NAMESPACE "camera"
+#define CAMERA_NVS_ACTIVE_KEY "preset"
+#define CAMERA_DEFAULT_PRESET "day"
+#define CAMERA_SWITCH_DRAIN_MS 500
+#define CAMERA_SWITCH_FLUSH_FRAMES 2  // Frames in flight with the old settings (fb_count)
+
+static const char *CAMCTL_TAG = "CAMCTL";
+
+typedef struct {
+    uint32_t switches;
+    uint32_t failed_writes;
+    uint32_t last_latency_us;
+    uint32_t max_latency_us;
+    uint32_t last_frames_lost;
+    uint32_t total_frames_lost;
+} camera_switch_stats_t;
+
+static camera_preset_t camera_presets[CAMERA_PRESET_COUNT];
+static int camera_active_preset = -1;
+static camera_switch_stats_t camera_switch_stats;
+static SemaphoreHandle_t camera_control_mutex = NULL;
+
+// Region of interest on top of the active preset (see camera_roi.h)
+static bool camera_roi_active = false;
+static camera_rect_t camera_roi;
+static camera_roi_mode_t camera_roi_mode = CAMERA_ROI_CROP;
+
+// Load a stored override for a preset, if one exists and is valid
+static void camera_preset_load(nvs_handle_t nvs, camera_preset_t *preset) {
+    camera_preset_t stored;
+    size_t len = sizeof(stored);
+    if (nvs_get_blob(nvs, preset->name, &stored, &len) != ESP_OK || len != sizeof(stored)) {
+        return;
+    }
+    if (!camera_preset_valid(&stored) || strcmp(stored.name, preset->name) != 0) {
+        ESP_LOGW(CAMCTL_TAG, "Ignoring invalid stored preset '%s'", preset->name);
+        return;
+    }
+    *preset = stored;
+    ESP_LOGI(CAMCTL_TAG, "Loaded preset '%s' from NVS", preset->name);
+}
+
+static esp_err_t camera_preset_save(const camera_preset_t *preset) {
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(CAMERA_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_blob(nvs, preset->name, preset, sizeof(*preset));
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    return err;
+}
+
+static esp_err_t camera_save_active(const char *name) {
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(CAMERA_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_str(nvs, CAMERA_NVS_ACTIVE_KEY, name);
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    return err;
+}
+
+typedef int (*camera_reconfig_fn)(sensor_t *sensor, const void *arg);
+
+#define CAMERA_RECONFIG_BUSY -2  // Frames still in flight, nothing applied
+
+// Run `apply` with the pipeline drained and record latency / frames lost.
+// Register writes go ahead if a consumer is slow to return its frame, but
+// an `apply` that restarts the driver (`restart`) frees the frame buffers,
+// so it is skipped and CAMERA_RECONFIG_BUSY returned. Otherwise returns
+// the number of failed settings reported by `apply`.
+static int camera_reconfigure(camera_reconfig_fn apply, const void *arg, bool restart) {
+    sensor_t *sensor = esp_camera_sensor_get();
+    if (!sensor) {
+        return -1;
+    }
+
+    xSemaphoreTake(camera_control_mutex, portMAX_DELAY);
+
+    // Only count lost frames if someone was actually consuming them
+    bool streaming = esp_timer_get_time() - camera_last_frame_us < 1000000;
+    int64_t start = esp_timer_get_time();
+
+    if (!camera_pipeline_pause(CAMERA_SWITCH_DRAIN_MS)) {
+        if (restart) {
+            camera_pipeline_resume();
+            xSemaphoreGive(camera_control_mutex);
+            ESP_LOGW(CAMCTL_TAG, "Frames still in flight after %d ms, driver not restarted", CAMERA_SWITCH_DRAIN_MS);
+            return CAMERA_RECONFIG_BUSY;
+        }
+        ESP_LOGW(CAMCTL_TAG, "Frames still in flight after %d ms, switching anyway", CAMERA_SWITCH_DRAIN_MS);
+    }
+
+    int failed = apply(sensor, arg);
+
+    // Discard frames that were captured with the old settings. A sensor in
+    // standby sends none, and each grab would wait out the driver's timeout.
+    for (int i = 0; i < CAMERA_SWITCH_FLUSH_FRAMES && !power_sensor_standby; i++) {
+        camera_fb_t *fb = esp_camera_fb_get();
+        if (fb) {
+            esp_camera_fb_return(fb);
+        }
+    }
+
+    camera_pipeline_resume();
+
+    uint32_t latency = (uint32_t)(esp_timer_get_time() - start);
+
+    // Frames consumers would have seen at the pre-switch rate
+    uint32_t lost = 0;
+    if (streaming && camera_frame_interval_us > 0) {
+        lost = latency / camera_frame_interval_us;
+    }
+
+    camera_switch_stats.switches++;
+    camera_switch_stats.failed_writes += failed;
+    camera_switch_stats.last_latency_us = latency;
+    if (latency > camera_switch_stats.max_latency_us) {
+        camera_switch_stats.max_latency_us = latency;
+    }
+    camera_switch_stats.last_frames_lost = lost;
+    camera_switch_stats.total_frames_lost += lost;
+
+    xSemaphoreGive(camera_control_mutex);
+
+    ESP_LOGI(CAMCTL_TAG, "Reconfigured in %lu us (~%lu frames lost, %d failed writes)",
+        (unsigned long)latency, (unsigned long)lost, failed);
+    return failed;
+}
+
+// In H.264 mode the frame buffers only hold the encoder's framesize, so a
+// preset keeps its exposure settings but not its framesize or window
+static int camera_keep_yuv_framesize(sensor_t *sensor) {
+    if (camera_yuv_framesize == FRAMESIZE_INVALID || sensor->status.framesize == camera_yuv_framesize) {
+        return 0;
+    }
+    return sensor->set_framesize(sensor, camera_yuv_framesize) != 0;
+}
+
+static int camera_apply_preset_fn(sensor_t *sensor, const void *arg) {
+    int index = *(const int *)arg;
+    const camera_preset_t *cur = camera_active_preset >= 0 ? &camera_presets[camera_active_preset] : NULL;
+    int failed = camera_preset_apply(sensor, cur, &camera_presets[index]);
+    failed += camera_keep_yuv_framesize(sensor);
+    camera_active_preset = index;
+    camera_roi_active = false;  // The preset's own window replaces any ROI
+    return failed;
+}
+
+// Apply a preset with the pipeline drained. Returns ESP_OK on success.
+static esp_err_t camera_switch_preset(int index) {
+    if (index < 0 || index >= (int)CAMERA_PRESET_COUNT
+        || camera_presets[index].framesize > CAMERA_MAX_FRAMESIZE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    ESP_LOGI(CAMCTL_TAG, "Switching to preset '%s'", camera_presets[index].name);
+    return camera_reconfigure(camera_apply_preset_fn, &index, false) == 0 ? ESP_OK : ESP_FAIL;
+}
+
+typedef struct {
+    bool continuous;
+    framesize_t yuv_framesize;      // H.264 mode, or FRAMESIZE_INVALID for JPEG
+} camera_mode_t;
+
+// Restart the driver in another capture mode or format. The new sensor
+// instance starts from its defaults, so the active preset is applied in
+// full. If the new mode does not start, the old one is put back.
+static int camera_apply_mode_fn(sensor_t *sensor, const void *arg) {
+    const camera_mode_t *mode = arg;
+    camera_mode_t old = { .continuous = camera_continuous, .yuv_framesize = camera_yuv_framesize };
+    esp_camera_deinit();
+    camera_yuv_framesize = mode->yuv_framesize;
+    esp_err_t err = camera_start(mode->continuous);
+    if (err != ESP_OK) {
+        ESP_LOGE(CAMCTL_TAG, "Camera init in %s %s mode failed: %s", mode->continuous ? "continuous" : "single",
+            mode->yuv_framesize != FRAMESIZE_INVALID ? "YUV" : "JPEG", esp_err_to_name(err));
+        camera_yuv_framesize = old.yuv_framesize;
+        if (camera_start(old.continuous) != ESP_OK) {
+            ESP_LOGE(CAMCTL_TAG, "Camera did not come back");
+            return 1;
+        }
+    }
+    int failed = err != ESP_OK;
+    if (camera_active_preset >= 0) {
+        failed += camera_preset_apply(esp_camera_sensor_get(), NULL, &camera_presets[camera_active_preset]);
+        failed += camera_keep_yuv_framesize(esp_camera_sensor_get());
+    }
+    camera_roi_active = false;
+    return failed;
+}
+
+// Switch between continuous and single capture, and between JPEG and YUV
+// at `yuv_framesize` for the H.264 encoder, with the pipeline drained.
+// Returns ESP_ERR_TIMEOUT, with the old mode still running, if consumers
+// hold on to their frames.
+static esp_err_t camera_set_mode(bool continuous, framesize_t yuv_framesize) {
+    camera_mode_t mode = { .continuous = continuous, .yuv_framesize = yuv_framesize };
+    if (continuous == camera_continuous && yuv_framesize == camera_yuv_framesize) {
+        return ESP_OK;
+    }
+    ESP_LOGI(CAMCTL_TAG, "Switching to %s capture, %s", continuous ? "continuous" : "single",
+        yuv_framesize != FRAMESIZE_INVALID ? "YUV for H.264" : "JPEG");
+    int failed = camera_reconfigure(camera_apply_mode_fn, &mode, true);
+    if (failed == CAMERA_RECONFIG_BUSY) {
+        return ESP_ERR_TIMEOUT;
+    }
+    return failed == 0 ? ESP_OK : ESP_FAIL;
+}
+
+// Settings a fresh sensor needs: the active preset in full, or the defaults
+// from camera_start() if there is none
+static int camera_restore_settings(sensor_t *sensor) {
+    int failed = sensor->set_vflip(sensor, 1) != 0;
+    if (camera_active_preset >= 0) {
+        failed += camera_preset_apply(sensor, NULL, &camera_presets[camera_active_preset]);
+        failed += camera_keep_yuv_framesize(sensor);
+    } else {
+        failed += sensor->set_framesize(sensor, camera_default_framesize()) != 0;
+    }
+    camera_roi_active = false;
+    return failed;
+}
+
+// Soft-reset the sensor over SCCB and put its settings back. The pipeline
+// is not drained: a grab stuck in the driver would hold it for the DMA
+// timeout, and frames from a sensor that needs a reset are lost anyway.
+static esp_err_t camera_reset_sensor(void) {
+    sensor_t *sensor = esp_camera_sensor_get();
+    if (!sensor) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(camera_control_mutex, portMAX_DELAY);
+    int failed = sensor->reset(sensor) != 0;
+    if (!failed) {
+        failed += sensor->set_pixformat(sensor, camera_pixformat()) != 0;
+        failed += camera_restore_settings(sensor);
+    }
+    xSemaphoreGive(camera_control_mutex);
+    if (failed) {
+        ESP_LOGW(CAMCTL_TAG, "Sensor reset: %d failed writes", failed);
+    }
+    return failed ? ESP_FAIL : ESP_OK;
+}
+
+// Restart the driver in its current capture mode with the pipeline drained.
+// A consumer still holding a frame would be left with a freed buffer, so
+// the restart is abandoned with ESP_ERR_TIMEOUT; the supervisor counts it
+// as failed and retries after the backoff.
+static esp_err_t camera_restart(void) {
+    xSemaphoreTake(camera_control_mutex, portMAX_DELAY);
+    if (!camera_pipeline_pause(CAMERA_SWITCH_DRAIN_MS)) {
+        camera_pipeline_resume();
+        xSemaphoreGive(camera_control_mutex);
+        ESP_LOGE(CAMCTL_TAG, "Frames still in flight after %d ms, driver not restarted", CAMERA_SWITCH_DRAIN_MS);
+        return ESP_ERR_TIMEOUT;
+    }
+    esp_camera_deinit();
+    esp_err_t err = camera_start(camera_continuous);
+    if (err == ESP_OK && camera_restore_settings(esp_camera_sensor_get()) != 0) {
+        ESP_LOGW(CAMCTL_TAG, "Camera restarted, but not all settings were restored");
+    }
+    camera_pipeline_resume();
+    xSemaphoreGive(camera_control_mutex);
+    if (err != ESP_OK) {
+        ESP_LOGE(CAMCTL_TAG, "Camera restart failed: %s", esp_err_to_name(err));
+    }
+    return err;
+}
+
+typedef struct {
+    camera_rect_t roi;
+    camera_roi_mode_t mode;
+    bool reset;
+} camera_roi_request_t;
+
+static int camera_apply_roi_fn(sensor_t *sensor, const void *arg) {
+    const camera_roi_request_t *req = arg;
+    framesize_t framesize = camera_presets[camera_active_preset].framesize;
+
+    if (req->reset) {
+        camera_roi_active = false;
+        // Back to the preset's own window (or full FOV)
+        return camera_preset_apply_window(sensor, framesize, &camera_presets[camera_active_preset].window) != 0;
+    }
+
+    camera_roi_regs_t regs;
+    camera_rect_t applied;
+    if (!camera_roi_compute(sensor->id.PID, framesize, req->mode, req->roi, &regs, &applied)) {
+        ESP_LOGW(CAMCTL_TAG, "ROI not supported on sensor PID 0x%x", sensor->id.PID);
+        return 1;
+    }
+    if (camera_roi_apply(sensor, &regs) != 0) {
+        return 1;
+    }
+    camera_roi = applied;
+    camera_roi_mode = req->mode;
+    camera_roi_active = true;
+    return 0;
+}
+
+// Set a region of interest in the current framesize's pixel coordinates.
+// Not in H.264 mode, where the sensor runs at the encoder's framesize.
+static esp_err_t camera_set_roi(camera_rect_t roi, camera_roi_mode_t mode) {
+    if (camera_active_preset < 0 || camera_yuv_framesize != FRAMESIZE_INVALID) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    camera_roi_request_t req = { .roi = roi, .mode = mode, .reset = false };
+    return camera_reconfigure(camera_apply_roi_fn, &req, false) == 0 ? ESP_OK : ESP_FAIL;
+}
+
+static esp_err_t camera_reset_roi(void) {
+    if (camera_active_preset < 0 || camera_yuv_framesize != FRAMESIZE_INVALID) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    camera_roi_request_t req = { .reset = true };
+    return camera_reconfigure(camera_apply_roi_fn, &req, false) == 0 ? ESP_OK : ESP_FAIL;
+}
+
+// Follow a detector bounding box: pad it, and avoid reconfiguring the sensor
+// more often than once a second or for small movements.
+static void camera_roi_follow_box(camera_rect_t box) {
+    static int64_t last_follow_us = 0;
+    int64_t now = esp_timer_get_time();
+    if (now - last_follow_us < 1000000) {
+        return;
+    }
+
+    camera_rect_t padded = {
+        .x = box.x - box.w / 4,
+        .y = box.y - box.h / 4,
+        .w = box.w + box.w / 2,
+        .h = box.h + box.h / 2,
+    };
+    if (camera_roi_active
+        && abs(padded.x - camera_roi.x) < camera_roi.w / 8
+        && abs(padded.y - camera_roi.y) < camera_roi.h / 8
+        && abs(padded.w - camera_roi.w) < camera_roi.w / 8) {
+        return;
+    }
+
+    last_follow_us = now;
+    camera_set_roi(padded, CAMERA_ROI_CROP);
+}
+
+static const char *camera_active_preset_name(void) {
+    return camera_active_preset >= 0 ? camera_presets[camera_active_preset].name : "custom";
+}
+
+// Load presets from NVS and apply the stored active one. Call after init_camera().
+static void camera_control_init(void) {
+    camera_control_mutex = xSemaphoreCreateMutex();
+    memcpy(camera_presets, camera_builtin_presets, sizeof(camera_presets));
+
+    char active[CAMERA_PRESET_NAME_LEN] = CAMERA_DEFAULT_PRESET;
+    nvs_handle_t nvs;
+    if (nvs_open(CAMERA_NVS_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK) {
+        for (size_t i = 0; i < CAMERA_PRESET_COUNT; i++) {
+            camera_preset_load(nvs, &camera_presets[i]);
+        }
+        size_t len = sizeof(active);
+        if (nvs_get_str(nvs, CAMERA_NVS_ACTIVE_KEY, active, &len) != ESP_OK) {
+            strcpy(active, CAMERA_DEFAULT_PRESET);
+        }
+        nvs_close(nvs);
+    }
+
+    int index = camera_preset_find(camera_presets, CAMERA_PRESET_COUNT, active);
+    if (index < 0) {
+        ESP_LOGW(CAMCTL_TAG, "Stored preset '%s' not found, using '%s'", active, CAMERA_DEFAULT_PRESET);
+        index = camera_preset_find(camera_presets, CAMERA_PRESET_COUNT, CAMERA_DEFAULT_PRESET);
+    }
+    camera_switch_preset(index);
+}
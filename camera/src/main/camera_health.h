@@ -0,0 +1,316 @@
+#pragma once
+
+// Camera health supervisor policy.
+//
+// Pure state machine with no ESP-IDF dependencies: every frame grab reports
+// whether it got a frame and how long it waited, and camera_health_poll()
+// says which recovery step to take next. The steps themselves run in
+// camera_supervisor.h.
+//
+//   OK      - frames arrive.
+//   RESET   - the sensor was reset over SCCB; waiting for good frames.
+//   REINIT  - the driver was restarted (deinit + init); waiting again.
+//   DOWN    - the restart failed or did not help. Consumers are parked and
+//             the restart is retried with exponential backoff; they stay
+//             parked until a retry brings the driver back up.
+//
+// A fault is fail_threshold failed grabs in a row, a grab that has waited
+// timeout_us for the driver, or since the last step (a DMA timeout, caught
+// while the grab still blocks), or anomaly_threshold grabs in a row that got a frame but waited
+// far longer than usual (the driver dropping corrupt frames). Each fault
+// moves one stage on, and verify_frames good grabs in a row end the
+// recovery. Grabs that started before the last step are not judged. The
+// time to recover runs from the first bad grab to the first frame of the
+// good run.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+    CAMERA_HEALTH_OK = 0,
+    CAMERA_HEALTH_RESET,
+    CAMERA_HEALTH_REINIT,
+    CAMERA_HEALTH_DOWN,
+    CAMERA_HEALTH_STATE_COUNT
+} camera_health_state_t;
+
+typedef enum {
+    CAMERA_HEALTH_NONE = 0,
+    CAMERA_HEALTH_RESET_SENSOR,   // Soft reset over SCCB, then the settings again
+    CAMERA_HEALTH_RESTART,        // esp_camera_deinit() and init
+} camera_health_action_t;
+
+typedef struct {
+    uint32_t fail_threshold;      // Failed grabs in a row that make a fault
+    uint32_t timeout_us;          // A grab that waits this long timed out
+    uint32_t anomaly_min_us;      // A frame that took this long...
+    uint32_t anomaly_factor;      // ...and this many times the usual wait is late
+    uint32_t anomaly_threshold;   // Late frames in a row that make a fault
+    uint32_t verify_frames;       // Good grabs in a row that end a recovery
+    uint32_t idle_check_ms;       // Grab a frame to verify a step if nobody else did
+    uint32_t backoff_min_ms;      // DOWN: first retry of the restart
+    uint32_t backoff_max_ms;
+} camera_health_config_t;
+
+typedef struct {
+    camera_health_config_t cfg;
+    camera_health_state_t state;
+    uint32_t failed_run;          // Failed grabs in a row
+    uint32_t late_run;            // Late frames in a row
+    uint32_t good_run;            // Good grabs in a row
+    bool timed_out;               // A DMA timeout since the last step
+    uint32_t wait_avg_us;         // Smoothed wait of a good grab
+    int64_t last_grab_us;
+    int64_t grab_started_us;      // Grab blocked in the driver since, 0 if none
+    bool stall_counted;           // That grab already counted as a timeout
+    int64_t step_us;              // Last recovery step
+    int64_t fault_start_us;       // First bad grab of the episode, 0 if none
+    int64_t first_good_us;        // First grab of the current good run
+    int64_t retry_at_us;          // DOWN: next restart
+    uint32_t backoff_ms;
+    int64_t state_entered_us;
+    int64_t accounted_until_us;
+    uint64_t time_in_state_us[CAMERA_HEALTH_STATE_COUNT];
+
+    uint32_t grabs;
+    uint32_t failures;
+    uint32_t timeouts;
+    uint32_t late_frames;
+    uint32_t faults;
+    uint32_t sensor_resets;
+    uint32_t restarts;
+    uint32_t restart_failures;
+    uint32_t recoveries;
+    uint32_t last_recovery_us;
+    uint32_t max_recovery_us;
+    uint64_t total_recovery_us;
+} camera_health_t;
+
+static const char *camera_health_state_str(camera_health_state_t state) {
+    switch (state) {
+        case CAMERA_HEALTH_OK: return "ok";
+        case CAMERA_HEALTH_RESET: return "reset";
+        case CAMERA_HEALTH_REINIT: return "reinit";
+        case CAMERA_HEALTH_DOWN: return "down";
+        default: return "unknown";
+    }
+}
+
+static camera_health_config_t camera_health_default_config(void) {
+    camera_health_config_t cfg = {
+        .fail_threshold = 3,
+        .timeout_us = 1000000,
+        .anomaly_min_us = 300000,
+        .anomaly_factor = 4,
+        .anomaly_threshold = 3,
+        .verify_frames = 3,
+        .idle_check_ms = 200,
+        .backoff_min_ms = 1000,
+        .backoff_max_ms = 60000,
+    };
+    return cfg;
+}
+
+static void camera_health_init(camera_health_t *h, const camera_health_config_t *cfg, int64_t now_us) {
+    *h = (camera_health_t){0};
+    h->cfg = *cfg;
+    h->state = CAMERA_HEALTH_OK;
+    h->state_entered_us = now_us;
+    h->accounted_until_us = now_us;
+}
+
+static void camera_health_account(camera_health_t *h, int64_t now_us) {
+    if (now_us > h->accounted_until_us) {
+        h->time_in_state_us[h->state] += (uint64_t)(now_us - h->accounted_until_us);
+        h->accounted_until_us = now_us;
+    }
+}
+
+static void camera_health_enter(camera_health_t *h, camera_health_state_t state, int64_t now_us) {
+    camera_health_account(h, now_us);
+    h->state = state;
+    h->state_entered_us = now_us;
+}
+
+// Consumers stay away from the driver while this is true
+static bool camera_health_parked(const camera_health_t *h) {
+    return h->state == CAMERA_HEALTH_DOWN;
+}
+
+static void camera_health_bad(camera_health_t *h, int64_t start_us) {
+    h->good_run = 0;
+    if (h->fault_start_us == 0) {
+        h->fault_start_us = start_us > 0 ? start_us : 1;
+    }
+}
+
+// A grab goes into the driver
+static void camera_health_begin(camera_health_t *h, int64_t now_us) {
+    h->grab_started_us = now_us;
+    h->stall_counted = false;
+}
+
+// Report one grab: whether it returned a frame, and how long it waited for
+// the driver. now_us is when it returned.
+static void camera_health_grab(camera_health_t *h, int64_t now_us, bool ok, uint32_t wait_us) {
+    int64_t start = now_us - wait_us;
+    bool counted = h->stall_counted;  // poll() caught it stuck already
+    h->grab_started_us = 0;
+    h->grabs++;
+    h->last_grab_us = now_us;
+    if (!ok) {
+        h->failures++;
+    }
+    if (start < h->step_us) {
+        return;  // Waited through a recovery step; says nothing about it
+    }
+    if (!ok) {
+        h->failed_run++;
+        if (wait_us >= h->cfg.timeout_us && !counted) {
+            h->timeouts++;
+            h->timed_out = true;
+        }
+        camera_health_bad(h, start);
+        return;
+    }
+    h->failed_run = 0;
+
+    uint32_t late = h->wait_avg_us * h->cfg.anomaly_factor;
+    if (h->wait_avg_us && wait_us >= h->cfg.anomaly_min_us && wait_us > late) {
+        h->late_frames++;
+        h->late_run++;
+        camera_health_bad(h, start);
+        return;
+    }
+    h->late_run = 0;
+    h->wait_avg_us = h->wait_avg_us ? (h->wait_avg_us * 7 + wait_us) / 8 : wait_us;
+
+    if (h->good_run++ == 0) {
+        h->first_good_us = now_us;
+    }
+    if (h->state == CAMERA_HEALTH_OK && h->good_run >= h->cfg.verify_frames) {
+        h->fault_start_us = 0;  // A glitch that did not make a fault
+    }
+}
+
+static bool camera_health_faulty(const camera_health_t *h) {
+    return h->timed_out || h->failed_run >= h->cfg.fail_threshold || h->late_run >= h->cfg.anomaly_threshold;
+}
+
+static void camera_health_recovered(camera_health_t *h, int64_t now_us) {
+    uint32_t took = (uint32_t)(h->first_good_us - h->fault_start_us);
+    h->recoveries++;
+    h->last_recovery_us = took;
+    h->total_recovery_us += took;
+    if (took > h->max_recovery_us) {
+        h->max_recovery_us = took;
+    }
+    h->fault_start_us = 0;
+    h->backoff_ms = 0;
+    camera_health_enter(h, CAMERA_HEALTH_OK, now_us);
+}
+
+static void camera_health_down(camera_health_t *h, int64_t now_us) {
+    h->backoff_ms = h->backoff_ms ? h->backoff_ms * 2 : h->cfg.backoff_min_ms;
+    if (h->backoff_ms > h->cfg.backoff_max_ms) {
+        h->backoff_ms = h->cfg.backoff_max_ms;
+    }
+    h->retry_at_us = now_us + (int64_t)h->backoff_ms * 1000;
+    camera_health_enter(h, CAMERA_HEALTH_DOWN, now_us);
+}
+
+// Evaluate the grabs so far. Returns the step to take now, and moves to the
+// state that waits for its outcome; report it with camera_health_done().
+static camera_health_action_t camera_health_poll(camera_health_t *h, int64_t now_us) {
+    camera_health_account(h, now_us);
+    int64_t since = h->grab_started_us > h->step_us ? h->grab_started_us : h->step_us;
+    if (h->grab_started_us && !h->stall_counted && now_us - since >= h->cfg.timeout_us) {
+        // Stuck in the driver: no need to wait for its own timeout
+        h->timeouts++;
+        h->timed_out = true;
+        h->stall_counted = true;
+        camera_health_bad(h, h->grab_started_us);
+    }
+    switch (h->state) {
+        case CAMERA_HEALTH_OK:
+            if (!camera_health_faulty(h)) {
+                return CAMERA_HEALTH_NONE;
+            }
+            h->faults++;
+            camera_health_enter(h, CAMERA_HEALTH_RESET, now_us);
+            return CAMERA_HEALTH_RESET_SENSOR;
+        case CAMERA_HEALTH_RESET:
+        case CAMERA_HEALTH_REINIT:
+            if (h->good_run >= h->cfg.verify_frames) {
+                camera_health_recovered(h, now_us);
+                return CAMERA_HEALTH_NONE;
+            }
+            if (!camera_health_faulty(h)) {
+                return CAMERA_HEALTH_NONE;
+            }
+            if (h->state == CAMERA_HEALTH_REINIT) {
+                camera_health_down(h, now_us);
+                return CAMERA_HEALTH_NONE;
+            }
+            camera_health_enter(h, CAMERA_HEALTH_REINIT, now_us);
+            return CAMERA_HEALTH_RESTART;
+        case CAMERA_HEALTH_DOWN:
+            // Stays DOWN (consumers parked) until the restart is done
+            return now_us < h->retry_at_us ? CAMERA_HEALTH_NONE : CAMERA_HEALTH_RESTART;
+        default:
+            return CAMERA_HEALTH_NONE;
+    }
+}
+
+// Outcome of a step from camera_health_poll(). The grabs after it are
+// judged afresh. A sensor that did not take its reset goes on to the
+// restart at the next poll; a restart that failed goes DOWN.
+static void camera_health_done(camera_health_t *h, camera_health_action_t action, bool ok, int64_t now_us) {
+    h->failed_run = h->late_run = h->good_run = 0;
+    h->timed_out = false;
+    h->stall_counted = false;
+    h->last_grab_us = now_us;
+    h->step_us = now_us;
+    if (action == CAMERA_HEALTH_RESET_SENSOR) {
+        h->sensor_resets++;
+        h->timed_out = !ok;
+    } else if (action == CAMERA_HEALTH_RESTART) {
+        h->restarts++;
+        if (!ok) {
+            h->restart_failures++;
+            camera_health_down(h, now_us);
+        } else if (h->state == CAMERA_HEALTH_DOWN) {
+            camera_health_enter(h, CAMERA_HEALTH_REINIT, now_us);
+        }
+    }
+}
+
+// True while a step waits for frames and nobody has grabbed one lately
+// (no viewers): the supervisor then grabs one itself
+static bool camera_health_needs_frame(const camera_health_t *h, int64_t now_us) {
+    return (h->state == CAMERA_HEALTH_RESET || h->state == CAMERA_HEALTH_REINIT)
+        && now_us - h->last_grab_us >= (int64_t)h->cfg.idle_check_ms * 1000;
+}
+
+// Forget a half-built fault, e.g. grabs that failed while the sensor was
+// in standby on purpose
+static void camera_health_clear(camera_health_t *h) {
+    h->failed_run = h->late_run = 0;
+    h->timed_out = false;
+    if (h->state == CAMERA_HEALTH_OK) {
+        h->fault_start_us = 0;
+    }
+}
+
+static uint32_t camera_health_avg_recovery_us(const camera_health_t *h) {
+    return h->recoveries ? (uint32_t)(h->total_recovery_us / h->recoveries) : 0;
+}
+
+// Time not in OK, the camera was faulty or being recovered (ms)
+static uint32_t camera_health_down_ms(const camera_health_t *h) {
+    uint64_t us = 0;
+    for (int i = CAMERA_HEALTH_RESET; i < CAMERA_HEALTH_STATE_COUNT; i++) {
+        us += h->time_in_state_us[i];
+    }
+    return (uint32_t)(us / 1000);
+}
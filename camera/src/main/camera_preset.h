@@ -0,0 +1,173 @@
+#pragma once
+
+// Named sensor presets (framesize, quality, XCLK, gain ceiling, AEC and
+// windowing) and a diff-based applier.
+//
+// Only depends on the esp32-camera sensor_t interface, so the applier can be
+// driven against a fake sensor that records register writes. Switching only
+// touches settings that differ from the sensor's current status, and orders
+// the writes so the expensive reconfigurations (XCLK, framesize, window)
+// happen once, before the cheap DSP registers that they would otherwise reset.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sensor.h>
+
+#include "camera_roi.h"
+
+#define CAMERA_PRESET_NAME_LEN 16
+#define CAMERA_PRESET_VERSION 1
+
+// Sensor window in permille of the full field of view; w == 0 means no window
+typedef struct {
+    uint16_t x;
+    uint16_t y;
+    uint16_t w;
+    uint16_t h;
+} camera_window_t;
+
+typedef struct {
+    uint8_t version;
+    char name[CAMERA_PRESET_NAME_LEN];
+    framesize_t framesize;
+    uint8_t quality;          // 0-63, lower is better
+    uint8_t xclk_mhz;
+    gainceiling_t gainceiling;
+    bool aec;                 // Auto exposure
+    bool aec2;                // AEC DSP (night mode on OV2640)
+    int8_t ae_level;          // -2..2
+    uint16_t aec_value;       // Manual exposure when aec is off
+    bool agc;                 // Auto gain
+    uint8_t agc_gain;         // Manual gain when agc is off
+    camera_window_t window;
+} camera_preset_t;
+
+static const camera_preset_t camera_builtin_presets[] = {
+    {
+        .version = CAMERA_PRESET_VERSION, .name = "day",
+        .framesize = FRAMESIZE_SVGA, .quality = 32, .xclk_mhz = 20,
+        .gainceiling = GAINCEILING_2X, .aec = true, .aec2 = false, .ae_level = 0,
+        .agc = true,
+    },
+    {
+        // Slower XCLK allows longer exposures, night DSP and a high gain ceiling
+        .version = CAMERA_PRESET_VERSION, .name = "dusk",
+        .framesize = FRAMESIZE_SVGA, .quality = 28, .xclk_mhz = 10,
+        .gainceiling = GAINCEILING_32X, .aec = true, .aec2 = true, .ae_level = 1,
+        .agc = true,
+    },
+    {
+        // Small frames and biased-short exposure to freeze a passing animal
+        .version = CAMERA_PRESET_VERSION, .name = "fast-motion",
+        .framesize = FRAMESIZE_CIF, .quality = 36, .xclk_mhz = 20,
+        .gainceiling = GAINCEILING_8X, .aec = true, .aec2 = false, .ae_level = -1,
+        .agc = true,
+    },
+    {
+        .version = CAMERA_PRESET_VERSION, .name = "archive-quality",
+        .framesize = FRAMESIZE_UXGA, .quality = 10, .xclk_mhz = 20,
+        .gainceiling = GAINCEILING_4X, .aec = true, .aec2 = false, .ae_level = 0,
+        .agc = true,
+    },
+};
+
+#define CAMERA_PRESET_COUNT (sizeof(camera_builtin_presets) / sizeof(camera_builtin_presets[0]))
+
+static int camera_preset_find(const camera_preset_t *presets, size_t count, const char *name) {
+    for (size_t i = 0; i < count; i++) {
+        if (strncmp(presets[i].name, name, CAMERA_PRESET_NAME_LEN) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static bool camera_preset_valid(const camera_preset_t *p) {
+    return p->version == CAMERA_PRESET_VERSION
+        && p->name[0] != '\0'
+        && p->framesize < FRAMESIZE_INVALID
+        && p->quality <= 63
+        && p->xclk_mhz >= 5 && p->xclk_mhz <= 24
+        && p->gainceiling <= GAINCEILING_128X
+        && p->ae_level >= -2 && p->ae_level <= 2
+        && p->aec_value <= 1200
+        && p->agc_gain <= 30
+        && p->window.x + p->window.w <= 1000
+        && p->window.y + p->window.h <= 1000;
+}
+
+// Program the sensor window. The window is given in permille of the field of
+// view and the output stays at the preset's framesize (digital zoom).
+static int camera_preset_apply_window(sensor_t *s, framesize_t framesize, const camera_window_t *win) {
+    if (win->w == 0 || win->h == 0) {
+        return s->set_framesize(s, framesize);  // Restores the default full-FOV window
+    }
+
+    const int out_w = resolution[framesize].width;
+    const int out_h = resolution[framesize].height;
+    camera_rect_t roi = {
+        .x = out_w * win->x / 1000,
+        .y = out_h * win->y / 1000,
+        .w = out_w * win->w / 1000,
+        .h = out_h * win->h / 1000,
+    };
+
+    camera_roi_regs_t regs;
+    camera_rect_t applied;
+    if (!camera_roi_compute(s->id.PID, framesize, CAMERA_ROI_ZOOM, roi, &regs, &applied)) {
+        return -1;
+    }
+    // Select the framesize first so the output format registers are in place
+    if (s->status.framesize != framesize && s->set_framesize(s, framesize) != 0) {
+        return -1;
+    }
+    return camera_roi_apply(s, &regs);
+}
+
+// Bring the sensor from its current status to `next`. `cur` is the preset
+// that was last applied (NULL forces every setting to be written).
+// Returns 0 on success, or the number of settings that failed.
+static int camera_preset_apply(sensor_t *s, const camera_preset_t *cur, const camera_preset_t *next) {
+    int failed = 0;
+    bool reframed = false;
+
+    if (!cur || s->xclk_freq_hz != next->xclk_mhz * 1000000) {
+        failed += s->set_xclk(s, 0 /* LEDC_TIMER_0 */, next->xclk_mhz) != 0;
+    }
+
+    bool window_changed = !cur || memcmp(&cur->window, &next->window, sizeof(next->window)) != 0;
+    if (window_changed || s->status.framesize != next->framesize) {
+        failed += camera_preset_apply_window(s, next->framesize, &next->window) != 0;
+        reframed = true;
+    }
+
+    // A framesize change reloads the sensor's register tables, which resets quality
+    if (reframed || s->status.quality != next->quality) {
+        failed += s->set_quality(s, next->quality) != 0;
+    }
+    if (reframed || s->status.gainceiling != next->gainceiling) {
+        failed += s->set_gainceiling(s, next->gainceiling) != 0;
+    }
+    if (reframed || s->status.aec != next->aec) {
+        failed += s->set_exposure_ctrl(s, next->aec) != 0;
+    }
+    if (reframed || s->status.aec2 != next->aec2) {
+        failed += s->set_aec2(s, next->aec2) != 0;
+    }
+    if (next->aec) {
+        if (reframed || s->status.ae_level != next->ae_level) {
+            failed += s->set_ae_level(s, next->ae_level) != 0;
+        }
+    } else if (reframed || s->status.aec_value != next->aec_value) {
+        failed += s->set_aec_value(s, next->aec_value) != 0;
+    }
+    if (reframed || s->status.agc != next->agc) {
+        failed += s->set_gain_ctrl(s, next->agc) != 0;
+    }
+    if (!next->agc && (reframed || s->status.agc_gain != next->agc_gain)) {
+        failed += s->set_agc_gain(s, next->agc_gain) != 0;
+    }
+
+    return failed;
+}
@@ -0,0 +1,200 @@
+#pragma once
+
+// Region-of-interest windowing for the OV2640 and OV3660.
+//
+// Maps a rectangle given in the pixel coordinates of the current framesize
+// onto the sensor's windowing registers (the set_res_raw() parameters):
+//
+//   CROP - the sensor outputs only the window at the framesize's native
+//          scale, so JPEGs shrink and the frame rate goes up.
+//   ZOOM - the window is scaled back up to the full framesize output.
+//          The DSP can only scale down, so zoom is limited to what the
+//          readout mode has in spare resolution.
+//
+// Only depends on the esp32-camera sensor_t interface and resolution table.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sensor.h>
+
+#define CAMERA_ROI_MIN_W 64
+#define CAMERA_ROI_MIN_H 48
+
+// Native readout of the OV2640 modes and the OV3660 pixel array
+#define OV2640_UXGA_W 1600
+#define OV2640_UXGA_H 1200
+#define OV2640_SVGA_W 800
+#define OV2640_SVGA_H 600
+#define OV2640_CIF_W  400
+#define OV2640_CIF_H  296
+#define OV3660_ARRAY_W 2048
+#define OV3660_ARRAY_H 1536
+#define OV3660_OFFSET_X 16   // ISP margin on each side
+#define OV3660_OFFSET_Y 6
+#define OV3660_HTS 2300
+#define OV3660_VTS 1564
+
+typedef enum {
+    CAMERA_ROI_CROP = 0,
+    CAMERA_ROI_ZOOM,
+} camera_roi_mode_t;
+
+typedef struct {
+    int16_t x;
+    int16_t y;
+    int16_t w;
+    int16_t h;
+} camera_rect_t;
+
+// Arguments for set_res_raw(); field meaning depends on the sensor
+typedef struct {
+    int start_x, start_y, end_x, end_y;
+    int offset_x, offset_y;
+    int total_x, total_y;
+    int output_x, output_y;
+    bool scale, binning;
+} camera_roi_regs_t;
+
+static int camera_roi_clamp(int v, int lo, int hi) {
+    return v < lo ? lo : v > hi ? hi : v;
+}
+
+// Fit `roi` inside a w x h frame, honouring the minimum size and alignment
+static camera_rect_t camera_roi_clamp_rect(camera_rect_t roi, int frame_w, int frame_h, int align_w, int align_h) {
+    int w = camera_roi_clamp(roi.w, CAMERA_ROI_MIN_W, frame_w);
+    int h = camera_roi_clamp(roi.h, CAMERA_ROI_MIN_H, frame_h);
+    w -= w % align_w;
+    h -= h % align_h;
+    // Keep the ROI centred where it was requested when it had to grow or shrink
+    int x = roi.x + (roi.w - w) / 2;
+    int y = roi.y + (roi.h - h) / 2;
+    x = camera_roi_clamp(x, 0, frame_w - w);
+    y = camera_roi_clamp(y, 0, frame_h - h);
+    return (camera_rect_t){ x, y, w, h };
+}
+
+// Grow `roi` around its centre to at least w x h, in whole MCUs and within
+// the frame. Used when the sensor has too few pixels in the window to fill
+// the output, since the DSP can only scale down.
+static camera_rect_t camera_roi_grow(camera_rect_t roi, int w, int h, int frame_w, int frame_h) {
+    w = camera_roi_clamp((w + 15) & ~15, roi.w, frame_w);
+    h = camera_roi_clamp((h + 7) & ~7, roi.h, frame_h);
+    int x = camera_roi_clamp(roi.x + (roi.w - w) / 2, 0, frame_w - w);
+    int y = camera_roi_clamp(roi.y + (roi.h - h) / 2, 0, frame_h - h);
+    return (camera_rect_t){ x, y, w, h };
+}
+
+// The full-FOV window the sensor uses for a framesize: readout area cropped
+// (centred) to the framesize's aspect ratio.
+static void camera_roi_base_window(int area_w, int area_h, int out_w, int out_h,
+                                   int *base_x, int *base_y, int *base_w, int *base_h) {
+    if (area_w * out_h > area_h * out_w) {
+        *base_h = area_h;
+        *base_w = area_h * out_w / out_h;
+    } else {
+        *base_w = area_w;
+        *base_h = area_w * out_h / out_w;
+    }
+    *base_x = (area_w - *base_w) / 2;
+    *base_y = (area_h - *base_h) / 2;
+}
+
+// Compute the register parameters for `roi` (in framesize pixel coordinates).
+// `applied` receives the ROI after clamping. Returns false for unsupported sensors.
+static bool camera_roi_compute(uint16_t pid, framesize_t framesize, camera_roi_mode_t mode,
+                               camera_rect_t roi, camera_roi_regs_t *regs, camera_rect_t *applied) {
+    if (framesize >= FRAMESIZE_INVALID) {
+        return false;
+    }
+    const int out_w = resolution[framesize].width;
+    const int out_h = resolution[framesize].height;
+
+    // JPEG output wants whole MCUs (16x8 for 4:2:2)
+    roi = camera_roi_clamp_rect(roi, out_w, out_h, 16, 8);
+    *regs = (camera_roi_regs_t){0};
+
+    if (pid == OV2640_PID) {
+        // Pick the readout mode; zoom always reads UXGA to have resolution to
+        // spare, and a frame taller than the CIF readout (320x320) needs SVGA
+        int area_w, area_h, sensor_mode;
+        if (mode == CAMERA_ROI_ZOOM || framesize > FRAMESIZE_SVGA) {
+            sensor_mode = 0; area_w = OV2640_UXGA_W; area_h = OV2640_UXGA_H;
+        } else if (framesize > FRAMESIZE_CIF || out_w > OV2640_CIF_W || out_h > OV2640_CIF_H) {
+            sensor_mode = 1; area_w = OV2640_SVGA_W; area_h = OV2640_SVGA_H;
+        } else {
+            sensor_mode = 2; area_w = OV2640_CIF_W; area_h = OV2640_CIF_H;
+        }
+
+        int bx, by, bw, bh;
+        camera_roi_base_window(area_w, area_h, out_w, out_h, &bx, &by, &bw, &bh);
+
+        // Not enough pixels to zoom this far: widen the ROI
+        int dst_w = mode == CAMERA_ROI_ZOOM ? out_w : roi.w;
+        int dst_h = mode == CAMERA_ROI_ZOOM ? out_h : roi.h;
+        roi = camera_roi_grow(roi, (dst_w * out_w + bw - 1) / bw, (dst_h * out_h + bh - 1) / bh, out_w, out_h);
+        *applied = roi;
+        if (mode == CAMERA_ROI_CROP) {
+            dst_w = roi.w;
+            dst_h = roi.h;
+        }
+
+        // Window sizes are programmed in units of 4 pixels
+        int win_w = (roi.w * bw / out_w) & ~3;
+        int win_h = (roi.h * bh / out_h) & ~3;
+        int win_x = bx + roi.x * bw / out_w;
+        int win_y = by + roi.y * bh / out_h;
+
+        // ov2640 set_res_raw(): startX = mode, offset = window origin, total = window size
+        regs->start_x = sensor_mode;
+        regs->offset_x = win_x;
+        regs->offset_y = win_y;
+        regs->total_x = win_w;
+        regs->total_y = win_h;
+        regs->output_x = dst_w;
+        regs->output_y = dst_h;
+        return true;
+    }
+
+    if (pid == OV3660_PID) {
+        int bx, by, bw, bh;
+        camera_roi_base_window(OV3660_ARRAY_W, OV3660_ARRAY_H, out_w, out_h, &bx, &by, &bw, &bh);
+
+        int dst_w = mode == CAMERA_ROI_ZOOM ? out_w : roi.w;
+        int dst_h = mode == CAMERA_ROI_ZOOM ? out_h : roi.h;
+        roi = camera_roi_grow(roi, (dst_w * out_w + bw - 1) / bw, (dst_h * out_h + bh - 1) / bh, out_w, out_h);
+        *applied = roi;
+        if (mode == CAMERA_ROI_CROP) {
+            dst_w = roi.w;
+            dst_h = roi.h;
+        }
+
+        int win_w = roi.w * bw / out_w;
+        int win_h = roi.h * bh / out_h;
+        int win_x = (bx + roi.x * bw / out_w) & ~1;  // Keep the Bayer phase
+        int win_y = (by + roi.y * bh / out_h) & ~1;
+
+        regs->start_x = win_x;
+        regs->start_y = win_y;
+        regs->end_x = win_x + win_w + 2 * OV3660_OFFSET_X - 1;
+        regs->end_y = win_y + win_h + 2 * OV3660_OFFSET_Y - 1;
+        regs->offset_x = OV3660_OFFSET_X;
+        regs->offset_y = OV3660_OFFSET_Y;
+        regs->total_x = OV3660_HTS;
+        // Shorter frames for small windows: VTS only needs to cover the rows read
+        regs->total_y = camera_roi_clamp(win_h + 2 * OV3660_OFFSET_Y + 16, 0, OV3660_VTS);
+        regs->output_x = dst_w;
+        regs->output_y = dst_h;
+        regs->scale = true;
+        regs->binning = win_w >= dst_w * 2 && win_h >= dst_h * 2;
+        return true;
+    }
+
+    *applied = roi;
+    return false;
+}
+
+static int camera_roi_apply(sensor_t *s, const camera_roi_regs_t *r) {
+    return s->set_res_raw(s, r->start_x, r->start_y, r->end_x, r->end_y,
+        r->offset_x, r->offset_y, r->total_x, r->total_y,
+        r->output_x, r->output_y, r->scale, r->binning);
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+// Camera health supervisor.
+//
+// Runs the recovery steps chosen by camera_health.h: an SCCB reset of the
+// sensor first, then a full driver restart, then restarts with backoff
+// while consumers are parked in camera_fb_get(). Every grab is reported to
+// the policy from camera_fb_get(); this task polls it, takes the steps,
+// and grabs frames itself to verify a step when nobody else is. Nothing is
+// judged while the power manager has the sensor in standby.
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/event_groups.h>
+
+#include "camera.h"
+#include "camera_control.h"
+#include "power.h"
+
+#define CAMERA_SUPERVISOR_POLL_MS 100
+
+#if CONFIG_TRAIN_CAMERA_SUPERVISOR
+
+static const char *CAMSUP_TAG = "CAMSUP";
+
+// Copy of the policy state for reporting
+static void camera_health_snapshot(camera_health_t *out) {
+    taskENTER_CRITICAL(&camera_health_lock);
+    *out = camera_health;
+    taskEXIT_CRITICAL(&camera_health_lock);
+}
+
+static void camera_supervisor_task(void *param) {
+    camera_health_state_t last = CAMERA_HEALTH_OK;
+
+    while (true) {
+        vTaskDelay(pdMS_TO_TICKS(CAMERA_SUPERVISOR_POLL_MS));
+        int64_t now = esp_timer_get_time();
+
+        if (power_sensor_standby) {
+            taskENTER_CRITICAL(&camera_health_lock);
+            camera_health_clear(&camera_health);
+            taskEXIT_CRITICAL(&camera_health_lock);
+            continue;
+        }
+
+        taskENTER_CRITICAL(&camera_health_lock);
+        camera_health_action_t action = camera_health_poll(&camera_health, now);
+        bool verify = action == CAMERA_HEALTH_NONE && camera_health_needs_frame(&camera_health, now);
+        taskEXIT_CRITICAL(&camera_health_lock);
+
+        if (action != CAMERA_HEALTH_NONE) {
+            bool restart = action == CAMERA_HEALTH_RESTART;
+            ESP_LOGW(CAMSUP_TAG, "%s", restart ? "Restarting the camera driver" : "Resetting the sensor");
+            bool ok = (restart ? camera_restart() : camera_reset_sensor()) == ESP_OK;
+            taskENTER_CRITICAL(&camera_health_lock);
+            camera_health_done(&camera_health, action, ok, esp_timer_get_time());
+            taskEXIT_CRITICAL(&camera_health_lock);
+        } else if (verify) {
+            camera_fb_t *fb = camera_fb_get_any();
+            if (fb) {
+                camera_fb_return(fb);
+            }
+        }
+
+        camera_health_t h;
+        camera_health_snapshot(&h);
+        if (camera_health_parked(&h)) {
+            xEventGroupClearBits(camera_events, CAMERA_UP_BIT);
+        } else {
+            xEventGroupSetBits(camera_events, CAMERA_UP_BIT);
+        }
+        if (h.state == last) {
+            continue;
+        }
+        if (h.state == CAMERA_HEALTH_OK) {
+            ESP_LOGI(CAMSUP_TAG, "Camera recovered in %lu ms", (unsigned long)(h.last_recovery_us / 1000));
+        } else if (h.state == CAMERA_HEALTH_DOWN) {
+            ESP_LOGE(CAMSUP_TAG, "Camera down, consumers parked; next restart in %lu ms",
+                (unsigned long)h.backoff_ms);
+        } else {
+            ESP_LOGW(CAMSUP_TAG, "Camera health %s -> %s (%lu failed, %lu timeouts, %lu late frames so far)",
+                camera_health_state_str(last), camera_health_state_str(h.state),
+                (unsigned long)h.failures, (unsigned long)h.timeouts, (unsigned long)h.late_frames);
+        }
+        last = h.state;
+    }
+}
+
+static void camera_supervisor_log_stats(void) {
+    camera_health_t h;
+    camera_health_snapshot(&h);
+    ESP_LOGI(CAMSUP_TAG, "Camera %s: %lu faults, %lu resets, %lu restarts (%lu failed), "
+        "recovery avg %lu ms max %lu ms, %lu ms not ok",
+        camera_health_state_str(h.state),
+        (unsigned long)h.faults,
+        (unsigned long)h.sensor_resets,
+        (unsigned long)h.restarts,
+        (unsigned long)h.restart_failures,
+        (unsigned long)(camera_health_avg_recovery_us(&h) / 1000),
+        (unsigned long)(h.max_recovery_us / 1000),
+        (unsigned long)camera_health_down_ms(&h));
+}
+
+// Call after camera_control_init() and power_init()
+static void camera_supervisor_start(void) {
+    xTaskCreatePinnedToCore(camera_supervisor_task, "cam_sup", 3072, NULL, 4, NULL, 0);
+}
+
+#else
+
+static void camera_supervisor_log_stats(void) {}
+static void camera_supervisor_start(void) {}
+
+#endif
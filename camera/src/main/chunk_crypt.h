@@ -0,0 +1,97 @@
+#pragma once
+
+// Wire format of the encrypted chunked UDP protocol (proto=gcm).
+//
+// Each datagram is the chunk header, with the nonce prefix added, followed
+// by one AES-GCM sealed slice of the JPEG:
+//
+//   uint16 frame_id        as in the chunked protocol (jpeg_chunk_header_t)
+//   uint16 packet_id
+//   uint16 total_packets   0 = keep-alive, no payload
+//   uint16 chunk_size
+//   uint16 epoch           times frame_id wrapped since boot
+//   uint8  salt[6]         random at boot
+//   ciphertext             same length as the plaintext slice
+//   uint8  tag[16]
+//
+// All integers are little-endian. The 16 header bytes travel in the clear
+// and are authenticated as the additional data. The 96-bit nonce is
+// salt || epoch || frame_id || packet_id, with chunk_size XORed into the
+// first two salt bytes. That is unique for every packet of one boot, even
+// when receivers that probed different datagram sizes are sent the same
+// frame in different slices. A new random salt makes the next boot start
+// on fresh nonces under the same pre-shared key. A keep-alive uses
+// packet_id 0xFFFF in its nonce, which no data packet can have. So a
+// receiver that is sent the frame and one that gets a keep-alive for it
+// never share a nonce. Receivers sent the same frame in the same slices
+// get identical packets.
+//
+// No ESP-IDF dependencies.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CHUNK_CRYPT_SALT_LEN 6
+#define CHUNK_CRYPT_NONCE_LEN 12
+#define CHUNK_CRYPT_TAG_LEN 16
+#define CHUNK_CRYPT_KEY_MAX 32
+#define CHUNK_CRYPT_KEEPALIVE_ID 0xFFFF
+// Largest slice that still fits one 1500-byte Ethernet frame
+#define CHUNK_CRYPT_MAX_PAYLOAD (1472 - sizeof(chunk_crypt_header_t) - CHUNK_CRYPT_TAG_LEN)
+
+typedef struct __attribute__((packed)) {
+    uint16_t frame_id;
+    uint16_t packet_id;
+    uint16_t total_packets;
+    uint16_t chunk_size;
+    uint16_t epoch;
+    uint8_t salt[CHUNK_CRYPT_SALT_LEN];
+} chunk_crypt_header_t;
+
+_Static_assert(sizeof(chunk_crypt_header_t) == 16, "chunk_crypt_header_t must be packed");
+
+static inline void chunk_crypt_put16(uint8_t *p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+// Nonce for the packet with this header. The header fields are host order,
+// and the nonce bytes come out little-endian on any host.
+static void chunk_crypt_nonce(const chunk_crypt_header_t *h, uint8_t nonce[CHUNK_CRYPT_NONCE_LEN]) {
+    for (int i = 0; i < CHUNK_CRYPT_SALT_LEN; i++) {
+        nonce[i] = h->salt[i];
+    }
+    nonce[0] ^= h->chunk_size & 0xFF;
+    nonce[1] ^= h->chunk_size >> 8;
+    chunk_crypt_put16(nonce + 6, h->epoch);
+    chunk_crypt_put16(nonce + 8, h->frame_id);
+    chunk_crypt_put16(nonce + 10, h->total_packets ? h->packet_id : CHUNK_CRYPT_KEEPALIVE_ID);
+}
+
+static int chunk_crypt_hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Parse a 32 or 64 hex digit key (AES-128 or AES-256). Returns the key
+// length in bytes, or 0 if the string is not one.
+static size_t chunk_crypt_parse_key(const char *hex, uint8_t key[CHUNK_CRYPT_KEY_MAX]) {
+    size_t n = 0;
+    while (hex[n] && n <= 2 * CHUNK_CRYPT_KEY_MAX) {
+        n++;
+    }
+    if (n != 32 && n != 64) {
+        return 0;
+    }
+    for (size_t i = 0; i < n / 2; i++) {
+        int hi = chunk_crypt_hex_digit(hex[2 * i]), lo = chunk_crypt_hex_digit(hex[2 * i + 1]);
+        if (hi < 0 || lo < 0) {
+            return 0;
+        }
+        key[i] = (uint8_t)(hi << 4 | lo);
+    }
+    return n / 2;
+}
@@ -0,0 +1,359 @@
+#pragma once
+
+// Typed runtime configuration: a schema, and versioned snapshots that hot
+// paths read without locks.
+//
+// The schema lists every setting with its type, range and default, and
+// where it lives in the config struct (an int32_t field). Text from the
+// HTTP API and values from NVS are only ever taken through it, so a
+// snapshot always holds valid values. A change is all or nothing: one bad
+// key or value rejects the whole request.
+//
+// Snapshots are published RCU-style. The writer copies the current
+// snapshot into a free slot, changes it and swaps the current pointer.
+// A reader enters a read section, takes the pointer, reads, and leaves.
+// Entering stores the global epoch in the reader's own cell, so readers
+// never write shared state and never wait. When the writer swaps, it
+// retires the old slot at the next epoch. The slot can be reused once
+// every reader has left or entered after that epoch. A reader stalled
+// inside a read section holds up every slot retired since it entered, so
+// the writer gets CONFIG_RCU_SLOTS - 1 publishes past it and then reports
+// busy until it leaves.
+//
+// Read sections are short (one frame at most) and never nested. There is
+// one writer at a time; the caller serializes publishes.
+//
+// No ESP-IDF dependencies; uses the GCC __atomic builtins.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CONFIG_RCU_SLOTS 4
+#define CONFIG_RCU_MAX_READERS 8
+#define CONFIG_KEY_LEN 16           // NVS keys are at most 15 characters
+#define CONFIG_VALUE_LEN 16
+
+// ---------------------------------------------------------------------------
+// Schema
+
+typedef enum {
+    CONFIG_INT,
+    CONFIG_BOOL,
+    CONFIG_ENUM,                    // Stored as the index into `choices`
+} config_type_t;
+
+typedef struct {
+    const char *key;                // Also the NVS key
+    config_type_t type;
+    uint16_t offset;                // Of the int32_t field in the config struct
+    int32_t min, max, def;          // Bool: 0-1; enum: 0 to choices - 1
+    const char *const *choices;     // Enum names, NULL-terminated
+    uint32_t subsystem;             // Bit of the subsystem that applies it
+    const char *help;
+} config_field_t;
+
+typedef struct {
+    const config_field_t *fields;
+    int count;
+} config_schema_t;
+
+static inline int32_t *config_field_ptr(const config_field_t *f, void *cfg) {
+    return (int32_t *)((uint8_t *)cfg + f->offset);
+}
+
+static inline int32_t config_field_get(const config_field_t *f, const void *cfg) {
+    return *(const int32_t *)((const uint8_t *)cfg + f->offset);
+}
+
+static const char *config_type_name(config_type_t type) {
+    switch (type) {
+        case CONFIG_BOOL: return "bool";
+        case CONFIG_ENUM: return "enum";
+        default: return "int";
+    }
+}
+
+// Check the schema itself: keys fit NVS, are unique, and defaults are in range
+static bool config_schema_valid(const config_schema_t *s) {
+    for (int i = 0; i < s->count; i++) {
+        const config_field_t *f = &s->fields[i];
+        if (!f->key || strlen(f->key) >= CONFIG_KEY_LEN || f->min > f->max || f->def < f->min || f->def > f->max
+            || (f->type == CONFIG_BOOL && (f->min != 0 || f->max != 1))) {
+            return false;
+        }
+        if (f->type == CONFIG_ENUM) {
+            int n = 0;
+            while (f->choices && f->choices[n]) {
+                n++;
+            }
+            if (f->min != 0 || f->max != n - 1) {
+                return false;
+            }
+        }
+        for (int j = 0; j < i; j++) {
+            if (strcmp(s->fields[j].key, f->key) == 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static const config_field_t *config_field_find(const config_schema_t *s, const char *key, size_t key_len) {
+    for (int i = 0; i < s->count; i++) {
+        if (strlen(s->fields[i].key) == key_len && strncmp(s->fields[i].key, key, key_len) == 0) {
+            return &s->fields[i];
+        }
+    }
+    return NULL;
+}
+
+static void config_defaults(const config_schema_t *s, void *cfg) {
+    for (int i = 0; i < s->count; i++) {
+        *config_field_ptr(&s->fields[i], cfg) = s->fields[i].def;
+    }
+}
+
+static bool config_field_in_range(const config_field_t *f, int32_t v) {
+    return v >= f->min && v <= f->max;
+}
+
+// Parse one value: a decimal integer, 0/1/true/false/on/off for a bool,
+// or a choice name (or its index) for an enum. Checks the range.
+static bool config_field_parse(const config_field_t *f, const char *text, size_t len, int32_t *out) {
+    char buf[CONFIG_VALUE_LEN];
+    if (len == 0 || len >= sizeof(buf)) {
+        return false;
+    }
+    memcpy(buf, text, len);
+    buf[len] = '\0';
+
+    if (f->type == CONFIG_BOOL) {
+        if (!strcmp(buf, "true") || !strcmp(buf, "on")) {
+            *out = 1;
+            return true;
+        }
+        if (!strcmp(buf, "false") || !strcmp(buf, "off")) {
+            *out = 0;
+            return true;
+        }
+    } else if (f->type == CONFIG_ENUM) {
+        for (int32_t i = 0; f->choices[i]; i++) {
+            if (!strcmp(buf, f->choices[i])) {
+                *out = i;
+                return true;
+            }
+        }
+    }
+
+    char *end;
+    long long v = strtoll(buf, &end, 10);
+    if (*end != '\0' || end == buf || v < INT32_MIN || v > INT32_MAX || !config_field_in_range(f, (int32_t)v)) {
+        return false;
+    }
+    *out = (int32_t)v;
+    return true;
+}
+
+// Apply a query string ("key=value&key=value") to a copy of `base` in
+// `out`. Keys in `ignore` (NULL-terminated, may be NULL) are left for the
+// caller. Returns the number of values given, or -1 with a message in
+// `err` and `out` undefined.
+static int config_parse_query(const config_schema_t *s, const void *base, void *out, size_t size,
+                              const char *query, const char *const *ignore, char *err, size_t err_len) {
+    memcpy(out, base, size);
+    int given = 0;
+    const char *p = query;
+    while (p && *p) {
+        const char *amp = strchr(p, '&');
+        size_t pair_len = amp ? (size_t)(amp - p) : strlen(p);
+        const char *eq = memchr(p, '=', pair_len);
+        size_t key_len = eq ? (size_t)(eq - p) : pair_len;
+
+        bool skip = pair_len == 0;
+        for (int i = 0; ignore && ignore[i] && !skip; i++) {
+            skip = strlen(ignore[i]) == key_len && strncmp(ignore[i], p, key_len) == 0;
+        }
+        if (!skip) {
+            const config_field_t *f = config_field_find(s, p, key_len);
+            if (!f) {
+                snprintf(err, err_len, "unknown key '%.*s'", (int)(key_len < CONFIG_KEY_LEN ? key_len : CONFIG_KEY_LEN), p);
+                return -1;
+            }
+            int32_t v;
+            if (!eq || !config_field_parse(f, eq + 1, pair_len - key_len - 1, &v)) {
+                if (f->type == CONFIG_ENUM) {
+                    snprintf(err, err_len, "%s: not one of the choices", f->key);
+                } else {
+                    snprintf(err, err_len, "%s: not a %s in %ld-%ld", f->key, config_type_name(f->type),
+                        (long)f->min, (long)f->max);
+                }
+                return -1;
+            }
+            *config_field_ptr(f, out) = v;
+            given++;
+        }
+        p = amp ? amp + 1 : NULL;
+    }
+    return given;
+}
+
+// Subsystems whose settings differ between two configs
+static uint32_t config_diff(const config_schema_t *s, const void *a, const void *b) {
+    uint32_t mask = 0;
+    for (int i = 0; i < s->count; i++) {
+        if (config_field_get(&s->fields[i], a) != config_field_get(&s->fields[i], b)) {
+            mask |= s->fields[i].subsystem;
+        }
+    }
+    return mask;
+}
+
+// The values as a JSON object: {"key":value,...}. Enums by name, bools as
+// true/false. Returns the length, or -1 if it does not fit.
+static int config_json_values(const config_schema_t *s, const void *cfg, char *buf, size_t size) {
+    int len = snprintf(buf, size, "{");
+    for (int i = 0; i < s->count && len < (int)size; i++) {
+        const config_field_t *f = &s->fields[i];
+        int32_t v = config_field_get(f, cfg);
+        const char *sep = i ? "," : "";
+        if (f->type == CONFIG_BOOL) {
+            len += snprintf(buf + len, size - len, "%s\"%s\":%s", sep, f->key, v ? "true" : "false");
+        } else if (f->type == CONFIG_ENUM) {
+            len += snprintf(buf + len, size - len, "%s\"%s\":\"%s\"", sep, f->key, f->choices[v]);
+        } else {
+            len += snprintf(buf + len, size - len, "%s\"%s\":%ld", sep, f->key, (long)v);
+        }
+    }
+    if (len < (int)size) {
+        len += snprintf(buf + len, size - len, "}");
+    }
+    return len < (int)size ? len : -1;
+}
+
+// The schema as a JSON array, one object per field. Returns the length,
+// or -1 if it does not fit.
+static int config_json_schema(const config_schema_t *s, char *buf, size_t size) {
+    int len = snprintf(buf, size, "[");
+    for (int i = 0; i < s->count && len < (int)size; i++) {
+        const config_field_t *f = &s->fields[i];
+        len += snprintf(buf + len, size - len, "%s{\"key\":\"%s\",\"type\":\"%s\",", i ? "," : "", f->key,
+            config_type_name(f->type));
+        if (f->type == CONFIG_ENUM) {
+            for (int c = 0; f->choices[c] && len < (int)size; c++) {
+                len += snprintf(buf + len, size - len, "%s\"%s\"", c ? "," : "\"choices\":[", f->choices[c]);
+            }
+            if (len < (int)size) {
+                len += snprintf(buf + len, size - len, "],\"default\":\"%s\"", f->choices[f->def]);
+            }
+        } else if (f->type == CONFIG_BOOL) {
+            len += snprintf(buf + len, size - len, "\"default\":%s", f->def ? "true" : "false");
+        } else {
+            len += snprintf(buf + len, size - len, "\"min\":%ld,\"max\":%ld,\"default\":%ld", (long)f->min,
+                (long)f->max, (long)f->def);
+        }
+        if (len < (int)size) {
+            len += snprintf(buf + len, size - len, ",\"help\":\"%s\"}", f->help ? f->help : "");
+        }
+    }
+    if (len < (int)size) {
+        len += snprintf(buf + len, size - len, "]");
+    }
+    return len < (int)size ? len : -1;
+}
+
+// ---------------------------------------------------------------------------
+// Snapshots
+
+typedef struct {
+    uint32_t epoch;                 // Global epoch when its read section began, 0 outside one
+} config_reader_t;
+
+typedef struct {
+    void *slot[CONFIG_RCU_SLOTS];
+    size_t size;
+    void *current;
+    uint32_t epoch;                 // Advances on every publish; starts at 1
+    uint32_t retired[CONFIG_RCU_SLOTS];     // Epoch the slot was replaced at, 0 if free
+    config_reader_t reader[CONFIG_RCU_MAX_READERS];
+    int readers;
+    uint32_t publishes;
+    uint32_t busy;                  // Publishes refused for want of a free slot
+} config_rcu_t;
+
+// `slots` holds CONFIG_RCU_SLOTS configs of `size` bytes; the first one is
+// published with the contents of `initial`. Readers are indexed 0 to
+// `readers` - 1.
+static bool config_rcu_init(config_rcu_t *r, void *slots, size_t size, const void *initial, int readers) {
+    if (readers < 1 || readers > CONFIG_RCU_MAX_READERS) {
+        return false;
+    }
+    memset(r, 0, sizeof(*r));
+    for (int i = 0; i < CONFIG_RCU_SLOTS; i++) {
+        r->slot[i] = (uint8_t *)slots + i * size;
+    }
+    r->size = size;
+    r->readers = readers;
+    r->epoch = 1;
+    memcpy(r->slot[0], initial, size);
+    r->current = r->slot[0];
+    return true;
+}
+
+// Enter a read section and take the current snapshot. The pointer stays
+// valid until config_rcu_unlock() by the same reader.
+static inline const void *config_rcu_lock(config_rcu_t *r, int reader) {
+    // Seq_cst, so the writer's scan sees this before any swap it could miss
+    __atomic_store_n(&r->reader[reader].epoch, __atomic_load_n(&r->epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&r->current, __ATOMIC_SEQ_CST);
+}
+
+static inline void config_rcu_unlock(config_rcu_t *r, int reader) {
+    __atomic_store_n(&r->reader[reader].epoch, 0, __ATOMIC_RELEASE);
+}
+
+// The current snapshot, for the writer only
+static inline const void *config_rcu_current(const config_rcu_t *r) {
+    return r->current;
+}
+
+static bool config_rcu_reclaimable(const config_rcu_t *r, uint32_t retired) {
+    for (int i = 0; i < r->readers; i++) {
+        uint32_t e = __atomic_load_n(&r->reader[i].epoch, __ATOMIC_SEQ_CST);
+        if (e != 0 && e < retired) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Publish a copy of `cfg` as the current snapshot. Returns false if every
+// other slot is still being read; try again shortly.
+static bool config_rcu_publish(config_rcu_t *r, const void *cfg) {
+    int free_slot = -1;
+    for (int i = 0; i < CONFIG_RCU_SLOTS && free_slot < 0; i++) {
+        if (r->slot[i] != r->current && (r->retired[i] == 0 || config_rcu_reclaimable(r, r->retired[i]))) {
+            free_slot = i;
+        }
+    }
+    if (free_slot < 0) {
+        r->busy++;
+        return false;
+    }
+
+    memcpy(r->slot[free_slot], cfg, r->size);
+    r->retired[free_slot] = 0;
+    void *old = __atomic_exchange_n(&r->current, r->slot[free_slot], __ATOMIC_SEQ_CST);
+    uint32_t retired = __atomic_add_fetch(&r->epoch, 1, __ATOMIC_SEQ_CST);
+    for (int i = 0; i < CONFIG_RCU_SLOTS; i++) {
+        if (r->slot[i] == old) {
+            r->retired[i] = retired;
+        }
+    }
+    r->publishes++;
+    return true;
+}
@@ -0,0 +1,298 @@
+#pragma once
+
+// On-device animal detector (CONFIG_TRAIN_DETECT, menu "Animal Detector").
+//
+// Every detect_ms (runtime_config.h) the detect task takes a frame
+// through the pipeline gate and decodes the JPEG at 1/8 scale into RGB565
+// (100x75 for SVGA), which is a low-res frame without switching the sensor
+// out of JPEG. It shrinks that into the model input, runs the int8 model
+// (nn_model.h) and tags the frame with the top class and its confidence.
+// When a class is confirmed or gone (detector_policy.h), it logs an event
+// and acts on it: an appearance counts as motion for the power policy,
+// can stop the trains (CONFIG_TRAIN_DETECT_STOP_TRAIN) and, with a grid
+// model, can point the ROI at the animal (CONFIG_TRAIN_DETECT_FOLLOW_ROI).
+//
+// The model comes from the "model" data partition (partitions.csv), mapped
+// and run in place; desktop/detector_model.py writes it. Without a valid
+// model the detector logs why and stays off. /detect reports the latest
+// result, recent events and the time per stage and per layer.
+//
+// The task runs on core 0 below the network tasks, and skips while the
+// power policy has the sensor in standby.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#if CONFIG_TRAIN_DETECT
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <esp_partition.h>
+#include <img_converters.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+#include "detector_policy.h"
+#include "runtime_config.h"
+#include "trace.h"
+
+#define DETECT_PARTITION "model"
+#define DETECT_EVENT_LOG 16
+#define DETECT_SCALE 8          // JPEG decode scale (JPG_SCALE_8X)
+// Largest 1/8-scale frame: the frame buffers' framesize
+#define DETECT_RGB_BYTES ((1600 / DETECT_SCALE) * (1200 / DETECT_SCALE) * 2)
+
+static const char *DETECT_TAG = "DETECT";
+
+typedef struct {
+    uint32_t seq;
+    int64_t time_us;
+    uint32_t frame;
+    detect_event_t event;
+    int cls;
+    uint8_t confidence;
+} detect_event_rec_t;
+
+typedef struct {
+    bool running;
+    const char *error;          // Why the detector is off
+    // Latest result
+    detect_result_t last;
+    uint32_t last_frame;        // camera_frames_captured of the frame it came from
+    int64_t last_us;
+    int frame_w, frame_h;
+    int present;                // Class currently reported, -1 = none
+    // Counters and mean time per stage since boot
+    uint32_t runs;
+    uint32_t skipped;           // Sensor in standby, no frame, or decode failed
+    uint64_t decode_us, prepare_us, infer_us;
+    uint32_t infer_max_us;
+    uint64_t layer_us[NN_MAX_LAYERS];
+    detect_event_rec_t events[DETECT_EVENT_LOG];
+    uint32_t event_seq;         // Events so far; the newest is events[(event_seq - 1) % DETECT_EVENT_LOG]
+} detect_state_t;
+
+static nn_model_t detect_model;
+static int8_t *detect_arena = NULL;
+static uint8_t *detect_rgb = NULL;
+static int8_t detect_lut[256];
+static detect_track_t detect_track;
+static detect_state_t detect_state = { .error = "not started", .present = -1 };
+static SemaphoreHandle_t detect_mutex = NULL;   // detect_state
+
+typedef struct {
+    int64_t last;
+    uint32_t layer_us[NN_MAX_LAYERS];
+} detect_timing_t;
+
+static void detect_layer_done(int layer, void *arg) {
+    detect_timing_t *t = arg;
+    int64_t now = esp_timer_get_time();
+    t->layer_us[layer] = (uint32_t)(now - t->last);
+    t->last = now;
+}
+
+static const char *detect_class_name(int cls) {
+    return cls >= 0 ? detect_model.labels[cls] : "none";
+}
+
+// The detector's box in the pixel coordinates of the framesize, for
+// camera_roi_follow_box(): the frame it saw is the active ROI if any
+static camera_rect_t detect_box_rect(const detect_result_t *r, int frame_w, int frame_h) {
+    camera_rect_t base = camera_roi_active ? camera_roi : (camera_rect_t){ 0, 0, frame_w, frame_h };
+    return (camera_rect_t){
+        .x = (int16_t)(base.x + r->box[0] * base.w),
+        .y = (int16_t)(base.y + r->box[1] * base.h),
+        .w = (int16_t)(r->box[2] * base.w),
+        .h = (int16_t)(r->box[3] * base.h),
+    };
+}
+
+// An animal was confirmed: wake up, and stop the trains or frame it if configured
+static void detect_on_appeared(const detect_result_t *r, int frame_w, int frame_h) {
+    ESP_LOGI(DETECT_TAG, "Spotted: %s (%u%%)", detect_class_name(r->cls), r->confidence);
+    power_motion_trigger();
+#if CONFIG_TRAIN_DETECT_STOP_TRAIN
+    train_send_command(-1, "S");
+#endif
+#if CONFIG_TRAIN_DETECT_FOLLOW_ROI
+    if (r->has_box) {
+        camera_roi_follow_box(detect_box_rect(r, frame_w, frame_h));
+    }
+#endif
+}
+
+static void detect_skip(void) {
+    xSemaphoreTake(detect_mutex, portMAX_DELAY);
+    detect_state.skipped++;
+    xSemaphoreGive(detect_mutex);
+}
+
+static void detect_task(void *arg) {
+    while (true) {
+        const train_config_t *cfg = runtime_config_lock(RUNTIME_READER_DETECT);
+        int interval_ms = cfg->detect_interval_ms, threshold_pct = cfg->detect_threshold_pct;
+        runtime_config_unlock(RUNTIME_READER_DETECT);
+        vTaskDelay(pdMS_TO_TICKS(interval_ms));
+
+        // The power monitor samples frames itself while the sensor sleeps
+        if (power_policy.mode == POWER_MODE_LOW) {
+            detect_skip();
+            continue;
+        }
+        TRACE_BEGIN(trace_fb_wait, 0);
+        camera_fb_t *fb = camera_fb_get();
+        TRACE_END(trace_fb_wait, fb ? fb->len : 0);
+        if (!fb) {
+            detect_skip();
+            continue;
+        }
+        int64_t t0 = esp_timer_get_time();
+        uint32_t frame = camera_frames_captured;
+        TRACE_BEGIN(trace_detect, frame);
+        int w = fb->width / DETECT_SCALE, h = fb->height / DETECT_SCALE;
+        int frame_w = fb->width, frame_h = fb->height;
+        // The JPEG decoder allocates its work area per call
+        uint32_t mark = alloc_audit_lib_begin();
+        bool ok = fb->format == PIXFORMAT_JPEG && w * h * 2 <= DETECT_RGB_BYTES
+            && jpg2rgb565(fb->buf, fb->len, detect_rgb, JPG_SCALE_8X);
+        alloc_audit_lib_end(mark);
+        camera_fb_return(fb);
+        if (!ok) {
+            TRACE_END(trace_detect, frame);
+            detect_skip();
+            continue;
+        }
+
+        int64_t t1 = esp_timer_get_time();
+        // jpg2rgb565 writes the high byte first
+        detect_prepare(detect_rgb, w, h, true, &detect_model, detect_lut, nn_model_input(&detect_model, detect_arena));
+        int64_t t2 = esp_timer_get_time();
+        detect_timing_t timing = { .last = t2 };
+        const int8_t *out = nn_model_run(&detect_model, detect_arena, false, detect_layer_done, &timing);
+        detect_result_t r;
+        detect_decode(&detect_model, out, threshold_pct, &r);
+        int64_t t3 = esp_timer_get_time();
+        TRACE_END(trace_detect, frame);
+
+        int was_present = detect_track.present;
+        detect_event_t event = detect_track_update(&detect_track, r.cls);
+
+        xSemaphoreTake(detect_mutex, portMAX_DELAY);
+        detect_state_t *s = &detect_state;
+        s->last = r;
+        s->last_frame = frame;
+        s->last_us = t3;
+        s->frame_w = frame_w;
+        s->frame_h = frame_h;
+        s->present = detect_track.present;
+        s->runs++;
+        s->decode_us += (uint64_t)(t1 - t0);
+        s->prepare_us += (uint64_t)(t2 - t1);
+        s->infer_us += (uint64_t)(t3 - t2);
+        s->infer_max_us = (uint32_t)(t3 - t2) > s->infer_max_us ? (uint32_t)(t3 - t2) : s->infer_max_us;
+        for (int i = 0; i < detect_model.layer_count; i++) {
+            s->layer_us[i] += timing.layer_us[i];
+        }
+        if (event != DETECT_EVENT_NONE) {
+            s->events[s->event_seq % DETECT_EVENT_LOG] = (detect_event_rec_t){
+                .seq = s->event_seq + 1, .time_us = t3, .frame = frame, .event = event,
+                .cls = event == DETECT_EVENT_APPEARED ? r.cls : was_present,
+                .confidence = r.confidence,
+            };
+            s->event_seq++;
+        }
+        xSemaphoreGive(detect_mutex);
+
+        if (event == DETECT_EVENT_LEFT) {
+            ESP_LOGI(DETECT_TAG, "Gone: %s", detect_class_name(was_present));
+        } else if (event == DETECT_EVENT_APPEARED) {
+            detect_on_appeared(&r, frame_w, frame_h);
+        }
+    }
+}
+
+static void detector_snapshot(detect_state_t *out) {
+    if (!detect_mutex) {
+        *out = detect_state;
+        return;
+    }
+    xSemaphoreTake(detect_mutex, portMAX_DELAY);
+    *out = detect_state;
+    xSemaphoreGive(detect_mutex);
+}
+
+static void detector_log_stats(void) {
+    detect_state_t s;
+    detector_snapshot(&s);
+    if (!s.running) {
+        return;
+    }
+    uint32_t n = s.runs ? s.runs : 1;
+    ESP_LOGI(DETECT_TAG, "Runs: %lu (skipped %lu), decode %lu us, prepare %lu us, inference %lu us (max %lu), "
+        "present: %s", (unsigned long)s.runs, (unsigned long)s.skipped, (unsigned long)(s.decode_us / n),
+        (unsigned long)(s.prepare_us / n), (unsigned long)(s.infer_us / n), (unsigned long)s.infer_max_us,
+        detect_class_name(s.present));
+}
+
+// Map and check the model, then start the task. Call after the camera and
+// power management are up.
+static void detector_start(void) {
+    detect_mutex = xSemaphoreCreateMutex();
+    const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+        DETECT_PARTITION);
+    if (!part) {
+        detect_state.error = "no model partition";
+        ESP_LOGW(DETECT_TAG, "No \"%s\" partition, detector off", DETECT_PARTITION);
+        return;
+    }
+    const void *blob;
+    esp_partition_mmap_handle_t handle;
+    if (esp_partition_mmap(part, 0, part->size, ESP_PARTITION_MMAP_DATA, &blob, &handle) != ESP_OK) {
+        detect_state.error = "cannot map the model partition";
+        ESP_LOGE(DETECT_TAG, "Cannot map the \"%s\" partition", DETECT_PARTITION);
+        return;
+    }
+    const char *error;
+    if (!nn_model_load(&detect_model, blob, part->size, &error)) {
+        esp_partition_munmap(handle);
+        detect_state.error = error;
+        ESP_LOGW(DETECT_TAG, "Model: %s, detector off (flash one with desktop/detector_model.py)", error);
+        return;
+    }
+
+    // Buffers for good: the arena in internal RAM if it fits
+    size_t arena = nn_model_arena_size(&detect_model);
+    detect_arena = heap_caps_aligned_alloc(16, arena, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (!detect_arena) {
+        detect_arena = heap_caps_aligned_alloc(16, arena, MALLOC_CAP_SPIRAM);
+    }
+    detect_rgb = heap_caps_malloc(DETECT_RGB_BYTES, MALLOC_CAP_SPIRAM);
+    if (!detect_arena || !detect_rgb) {
+        detect_state.error = "out of memory";
+        ESP_LOGE(DETECT_TAG, "No memory for the detector (%zu byte arena)", arena);
+        return;
+    }
+    detect_input_lut(&detect_model, detect_lut);
+    detect_track_init(&detect_track, CONFIG_TRAIN_DETECT_CONFIRM, CONFIG_TRAIN_DETECT_CLEAR);
+
+    // Stack: the kernels keep two NN_MAX_CHANNELS int32 arrays on it
+    if (xTaskCreatePinnedToCore(detect_task, "detect", 6144, NULL, 2, NULL, 0) != pdPASS) {
+        detect_state.error = "cannot start the task";
+        return;
+    }
+    detect_state.running = true;
+    detect_state.error = NULL;
+    ESP_LOGI(DETECT_TAG, "Model: %d layers, %lu MACs, input %dx%dx%d, output %dx%dx%d, arena %zu bytes",
+        detect_model.layer_count, (unsigned long)detect_model.macs, detect_model.in.h, detect_model.in.w,
+        detect_model.in.c, detect_model.out.h, detect_model.out.w, detect_model.out.c, arena);
+}
+
+#else
+
+static inline void detector_start(void) {}
+static inline void detector_log_stats(void) {}
+
+#endif
@@ -0,0 +1,190 @@
+#pragma once
+
+// Animal detector: everything around the network that does not touch the
+// hardware (detector.h has the task).
+//
+//   prepare - shrink an RGB565 frame into the model input with a box
+//             filter (stretched to the input's aspect ratio), as gray or
+//             RGB, and quantize it
+//   decode  - turn the output into class scores: a softmax over a class
+//             vector, or for a grid model the best cell per class plus a
+//             box around the top class's cells. Class 0 is "nothing".
+//   track   - debounce results into events: a class must win `confirm`
+//             runs in a row to appear and miss `clear` runs to leave
+//
+// No ESP-IDF dependencies.
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "nn_model.h"
+
+typedef struct {
+    int cls;                    // Top class other than 0 above the threshold, -1 = none
+    uint8_t confidence;         // Percent, of the top class other than 0
+    uint8_t scores[NN_MAX_CLASSES];     // Percent per class
+    bool has_box;               // Grid models: cells of `cls` above the threshold
+    float box[4];               // x, y, w, h as fractions of the frame
+} detect_result_t;
+
+typedef enum {
+    DETECT_EVENT_NONE = 0,
+    DETECT_EVENT_APPEARED,
+    DETECT_EVENT_LEFT,
+} detect_event_t;
+
+typedef struct {
+    uint8_t confirm;
+    uint8_t clear;
+    int present;                // Class currently reported, -1 = none
+    int candidate;
+    uint8_t hits;
+    uint8_t misses;
+} detect_track_t;
+
+// Quantized value for each 8-bit pixel level (real = level / 255)
+static void detect_input_lut(const nn_model_t *m, int8_t lut[256]) {
+    for (int v = 0; v < 256; v++) {
+        long q = lroundf(v / 255.0f / m->in_scale) + m->in_zero;
+        lut[v] = (int8_t)(q < -128 ? -128 : q > 127 ? 127 : q);
+    }
+}
+
+static void detect_rgb565(const uint8_t *p, bool big_endian, int *r, int *g, int *b) {
+    uint16_t v = big_endian ? (uint16_t)(p[0] << 8 | p[1]) : (uint16_t)(p[1] << 8 | p[0]);
+    int r5 = v >> 11, g6 = v >> 5 & 0x3F, b5 = v & 0x1F;
+    *r = r5 << 3 | r5 >> 2;
+    *g = g6 << 2 | g6 >> 4;
+    *b = b5 << 3 | b5 >> 2;
+}
+
+// Box-filter `rgb565` (w x h) down to the model input. Every output pixel
+// averages the source pixels its area covers, so nothing aliases.
+static void detect_prepare(const uint8_t *rgb565, int w, int h, bool big_endian, const nn_model_t *m,
+                           const int8_t lut[256], int8_t *input) {
+    int oh = m->in.h, ow = m->in.w;
+    for (int oy = 0; oy < oh; oy++) {
+        int ya = oy * h / oh, yb = (oy + 1) * h / oh;
+        yb = yb > ya ? yb : ya + 1;
+        for (int ox = 0; ox < ow; ox++) {
+            int xa = ox * w / ow, xb = (ox + 1) * w / ow;
+            xb = xb > xa ? xb : xa + 1;
+            int sr = 0, sg = 0, sb = 0;
+            for (int y = ya; y < yb; y++) {
+                const uint8_t *p = rgb565 + ((size_t)y * w + xa) * 2;
+                for (int x = xa; x < xb; x++, p += 2) {
+                    int r, g, b;
+                    detect_rgb565(p, big_endian, &r, &g, &b);
+                    sr += r;
+                    sg += g;
+                    sb += b;
+                }
+            }
+            int n = (yb - ya) * (xb - xa);
+            int8_t *q = input + ((size_t)oy * ow + ox) * m->in.c;
+            if (m->in.c == 1) {
+                q[0] = lut[(77 * sr + 150 * sg + 29 * sb) / (256 * n)];
+            } else {
+                q[0] = lut[sr / n];
+                q[1] = lut[sg / n];
+                q[2] = lut[sb / n];
+            }
+        }
+    }
+}
+
+// Softmax of one output vector into probabilities
+static void detect_softmax(const nn_model_t *m, const int8_t *logits, float *p) {
+    float max = -INFINITY, sum = 0;
+    for (int c = 0; c < m->classes; c++) {
+        p[c] = (logits[c] - m->out_zero) * m->out_scale;
+        max = p[c] > max ? p[c] : max;
+    }
+    for (int c = 0; c < m->classes; c++) {
+        p[c] = expf(p[c] - max);
+        sum += p[c];
+    }
+    for (int c = 0; c < m->classes; c++) {
+        p[c] /= sum;
+    }
+}
+
+static void detect_decode(const nn_model_t *m, const int8_t *out, int threshold_pct, detect_result_t *r) {
+    float best[NN_MAX_CLASSES] = { 0 };
+    float p[NN_MAX_CLASSES];
+    int cells = m->out.h * m->out.w;
+    float threshold = threshold_pct / 100.0f;
+
+    // Per class, its most confident cell (the only cell for a class vector)
+    for (int i = 0; i < cells; i++) {
+        detect_softmax(m, out + (size_t)i * m->classes, p);
+        for (int c = 0; c < m->classes; c++) {
+            best[c] = p[c] > best[c] ? p[c] : best[c];
+        }
+    }
+    int top = 1;
+    for (int c = 1; c < m->classes; c++) {
+        r->scores[c] = (uint8_t)lroundf(best[c] * 100);
+        top = best[c] > best[top] ? c : top;
+    }
+    r->scores[0] = (uint8_t)lroundf(best[0] * 100);
+    r->confidence = r->scores[top];
+    r->cls = best[top] >= threshold ? top : -1;
+    r->has_box = false;
+    if (r->cls < 0 || cells == 1) {
+        return;
+    }
+
+    int x0 = m->out.w, y0 = m->out.h, x1 = -1, y1 = -1;
+    for (int i = 0; i < cells; i++) {
+        detect_softmax(m, out + (size_t)i * m->classes, p);
+        if (p[top] >= threshold) {
+            int x = i % m->out.w, y = i / m->out.w;
+            x0 = x < x0 ? x : x0;
+            y0 = y < y0 ? y : y0;
+            x1 = x > x1 ? x : x1;
+            y1 = y > y1 ? y : y1;
+        }
+    }
+    r->has_box = true;
+    r->box[0] = (float)x0 / m->out.w;
+    r->box[1] = (float)y0 / m->out.h;
+    r->box[2] = (float)(x1 - x0 + 1) / m->out.w;
+    r->box[3] = (float)(y1 - y0 + 1) / m->out.h;
+}
+
+static void detect_track_init(detect_track_t *t, int confirm, int clear) {
+    *t = (detect_track_t){ .confirm = (uint8_t)confirm, .clear = (uint8_t)clear, .present = -1, .candidate = -1 };
+}
+
+// Feed one result's class (-1 = none)
+static detect_event_t detect_track_update(detect_track_t *t, int cls) {
+    if (t->present < 0) {
+        if (cls < 0) {
+            t->candidate = -1;
+            t->hits = 0;
+            return DETECT_EVENT_NONE;
+        }
+        t->hits = cls == t->candidate ? t->hits + 1 : 1;
+        t->candidate = cls;
+        if (t->hits < t->confirm) {
+            return DETECT_EVENT_NONE;
+        }
+        t->present = cls;
+        t->misses = 0;
+        return DETECT_EVENT_APPEARED;
+    }
+
+    if (cls == t->present) {
+        t->misses = 0;
+        return DETECT_EVENT_NONE;
+    }
+    if (++t->misses < t->clear) {
+        return DETECT_EVENT_NONE;
+    }
+    t->present = -1;
+    t->candidate = -1;
+    t->hits = 0;
+    return DETECT_EVENT_LEFT;
+}
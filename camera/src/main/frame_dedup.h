@@ -0,0 +1,85 @@
+#pragma once
+
+// Near-duplicate frame suppression on the stream and UDP paths.
+//
+// The stream capture task and the UDP task read one change signature per
+// camera frame (jpeg_signature.h), and each receiver's jpeg_dedup_t says
+// whether that frame differs enough from the last one it was sent. An
+// MJPEG client just gets nothing for an unchanged frame and keeps showing
+// the last one. A chunked UDP receiver gets a keep-alive header with
+// total_packets = 0 instead, and an RTP receiver gets nothing. Every
+// receiver still gets a full frame at least every dedup_refresh ms. The
+// thresholds come from the caller's config snapshot (runtime_config.h),
+// with the Kconfig values as defaults.
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "jpeg_signature.h"
+#include "runtime_config.h"
+
+#if CONFIG_TRAIN_DEDUP
+
+static const char *DEDUP_TAG = "DEDUP";
+
+// Totals over every path, updated from several tasks
+typedef struct {
+    uint32_t signatures;
+    uint32_t unreadable;        // Frames without a signature (always sent)
+    uint32_t sig_us;            // Time spent reading signatures
+    uint32_t sent;
+    uint32_t suppressed;
+    uint32_t saved_kb;
+} frame_dedup_stats_t;
+
+static frame_dedup_stats_t frame_dedup_stats;
+
+static bool frame_dedup_sig(jpeg_sig_decoder_t *dec, const uint8_t *jpg, size_t len, jpeg_sig_t *sig) {
+    int64_t start = esp_timer_get_time();
+    bool ok = jpeg_sig_extract(dec, jpg, len, sig);
+    __atomic_add_fetch(&frame_dedup_stats.sig_us, (uint32_t)(esp_timer_get_time() - start), __ATOMIC_RELAXED);
+    __atomic_add_fetch(&frame_dedup_stats.signatures, 1, __ATOMIC_RELAXED);
+    if (!ok) {
+        __atomic_add_fetch(&frame_dedup_stats.unreadable, 1, __ATOMIC_RELAXED);
+    }
+    return ok;
+}
+
+// Whether receiver `d` gets this frame, with the thresholds in `cfg`
+static bool frame_dedup_check(const train_config_t *cfg, jpeg_dedup_t *d, const jpeg_sig_t *sig, size_t len,
+                              int64_t now) {
+    jpeg_dedup_cfg_t dedup = {
+        .threshold = cfg->dedup_threshold,
+        .min_cells = cfg->dedup_cells,
+        .refresh_us = (uint32_t)cfg->dedup_refresh_ms * 1000u,
+    };
+    bool send = jpeg_dedup_check(d, &dedup, sig, len, now);
+    if (send) {
+        __atomic_add_fetch(&frame_dedup_stats.sent, 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_add_fetch(&frame_dedup_stats.suppressed, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&frame_dedup_stats.saved_kb, (uint32_t)(len + 512) / 1024, __ATOMIC_RELAXED);
+    }
+    return send;
+}
+
+// Since the last call (counters wrap; the differences stay right)
+static void frame_dedup_log_stats(void) {
+    static frame_dedup_stats_t logged;
+    frame_dedup_stats_t now = frame_dedup_stats;
+    uint32_t sigs = now.signatures - logged.signatures;
+    uint32_t sent = now.sent - logged.sent, suppressed = now.suppressed - logged.suppressed;
+    if (sigs > 0) {
+        ESP_LOGI(DEDUP_TAG, "%lu of %lu frames suppressed, %lu KB saved; signature %lu us avg, %lu unreadable",
+            (unsigned long)suppressed, (unsigned long)(sent + suppressed),
+            (unsigned long)(now.saved_kb - logged.saved_kb), (unsigned long)((now.sig_us - logged.sig_us) / sigs),
+            (unsigned long)(now.unreadable - logged.unreadable));
+    }
+    logged = now;
+}
+
+#else
+
+static void frame_dedup_log_stats(void) {}
+
+#endif
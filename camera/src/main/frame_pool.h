@@ -0,0 +1,109 @@
+#pragma once
+
+// Fixed pool of JPEG frame buffers between the stream capture task and the
+// stream task (http_server.h).
+//
+// The storage is one block handed over at init and split into equal slots,
+// so streaming never allocates. A slot is free when its reference count is
+// zero:
+//
+//   acquire  - the writer gets a free slot (refs = 1) and fills it outside
+//              the lock
+//   publish  - the slot becomes the ready frame. A ready frame nobody took
+//              is replaced and freed, so readers always get the newest one
+//   take     - the reader gets the ready frame, with its reference
+//   ref/unref - one per client sending it
+//
+// Not thread-safe: callers serialize the calls (stream_pool_mutex), but
+// not the copy into an acquired slot or the sends from a referenced one.
+// No ESP-IDF dependencies.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef FRAME_POOL_MAX
+#define FRAME_POOL_MAX 8
+#endif
+
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+    uint32_t id;
+    int refs;
+} frame_slot_t;
+
+typedef struct {
+    frame_slot_t slot[FRAME_POOL_MAX];
+    int count;
+    size_t slot_size;
+    int ready;                  // Newest published frame not yet taken, -1 = none
+    uint32_t next_id;
+    uint32_t oversize;          // Frames dropped for not fitting a slot
+    uint32_t replaced;          // Ready frames nobody took
+} frame_pool_t;
+
+// Split `storage` (count * slot_size bytes) into slots. Returns false if
+// count is out of range.
+static bool frame_pool_init(frame_pool_t *p, uint8_t *storage, int count, size_t slot_size) {
+    if (count < 2 || count > FRAME_POOL_MAX) {
+        return false;
+    }
+    *p = (frame_pool_t){ .count = count, .slot_size = slot_size, .ready = -1 };
+    for (int i = 0; i < count; i++) {
+        p->slot[i].buf = storage + (size_t)i * slot_size;
+    }
+    return true;
+}
+
+// A free slot for a `len`-byte frame, or -1 (none free, or the frame does
+// not fit, which is counted in `oversize`).
+static int frame_pool_acquire(frame_pool_t *p, size_t len) {
+    if (len > p->slot_size) {
+        p->oversize++;
+        return -1;
+    }
+    for (int i = 0; i < p->count; i++) {
+        if (p->slot[i].refs == 0) {
+            p->slot[i].refs = 1;
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void frame_pool_unref(frame_pool_t *p, int i) {
+    p->slot[i].refs--;
+}
+
+static void frame_pool_ref(frame_pool_t *p, int i) {
+    p->slot[i].refs++;
+}
+
+// Make acquired slot `i`, now holding `len` bytes, the ready frame.
+// Returns its frame id.
+static uint32_t frame_pool_publish(frame_pool_t *p, int i, size_t len) {
+    if (p->ready >= 0) {
+        p->replaced++;
+        frame_pool_unref(p, p->ready);
+    }
+    p->slot[i].len = len;
+    p->slot[i].id = ++p->next_id;
+    p->ready = i;
+    return p->slot[i].id;
+}
+
+// The ready frame, whose reference passes to the caller, or -1
+static int frame_pool_take(frame_pool_t *p) {
+    int i = p->ready;
+    p->ready = -1;
+    return i;
+}
+
+static int frame_pool_in_use(const frame_pool_t *p) {
+    int n = 0;
+    for (int i = 0; i < p->count; i++) {
+        n += p->slot[i].refs > 0;
+    }
+    return n;
+}
@@ -0,0 +1,1744 @@
+#pragma once
+
+// H.264 encoder (constrained baseline profile), small enough to run on the
+// ESP32-S3 at modest resolutions.
+//
+// Our scenes are mostly static, so the encoder is built around cheap
+// P-frames rather than good intra coding:
+//
+//   - one slice per frame, CAVLC, one reference frame
+//   - macroblocks are P_Skip, P_L0_16x16 with an integer-pel motion vector,
+//     or Intra 16x16 (DC/vertical/horizontal), chosen by SAD
+//   - a P_Skip test runs before the motion search, so unchanged areas cost
+//     one SAD and a quantization pass
+//   - residual coefficients that would only code noise are dropped
+//     (per 8x8 and per macroblock), which keeps static areas skipped
+//   - in-loop deblocking filter (optional)
+//   - an IDR every `gop` frames or on request, with SPS and PPS in front
+//   - frame-level QP rate control towards `bitrate`, with a one-second
+//     buffer so IDRs are paid for by the P-frames after them
+//
+// Frames go in as I420 planes and come out as one Annex-B access unit. The
+// reference and reconstructed frames plus per-macroblock state live in one
+// block of caller storage (h264_enc_mem_size()), so encoding never
+// allocates. Not thread-safe.
+//
+// No ESP-IDF dependencies.
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define H264_NAL_SLICE 1
+#define H264_NAL_IDR 5
+#define H264_NAL_SPS 7
+#define H264_NAL_PPS 8
+
+#define H264_PROFILE_BASELINE 66
+#define H264_CONSTRAINT_FLAGS 0xC0  // constraint_set0 and 1: constrained baseline
+#define H264_LOG2_MAX_FRAME_NUM 8
+#define H264_LEVEL_MAX 2047         // Largest coefficient level; always codable with CAVLC
+#define H264_SEARCH_ITERATIONS 16   // Diamond steps per motion search
+#define H264_INTRA_MIN_COST 1024    // P-frame inter cost (about SAD) below which intra is not tried
+#define H264_IDR_BITS_RATIO 4       // IDR budget in P-frames
+#define H264_RC_START_BPP 0.6f      // Typical IDR bits per pixel at QP 30, for the first frame
+#define H264_RC_MAX_STEP 3          // QP change from one P-frame to the next
+#define H264_MAX_WIDTH 2048
+#define H264_MAX_HEIGHT 2048
+
+typedef struct {
+    uint16_t width;             // Even; the coded frame is padded to whole macroblocks
+    uint16_t height;
+    uint16_t fps;               // For rate control and the stream timing info
+    uint32_t bitrate;           // Bit/s, 0 = constant QP
+    uint16_t gop;               // Frames from one IDR to the next, 1 = intra only
+    uint8_t qp;                 // Constant QP, used when bitrate is 0
+    uint8_t qp_min;
+    uint8_t qp_max;
+    uint8_t search;             // Motion search range, pixels
+    bool deblock;
+} h264_enc_config_t;
+
+typedef struct {
+    const uint8_t *y;
+    const uint8_t *u;
+    const uint8_t *v;
+    int y_stride;
+    int uv_stride;
+} h264_picture_t;
+
+typedef struct {
+    uint32_t frames;
+    uint32_t idr_frames;
+    uint32_t dropped;           // Did not fit the output buffer
+    uint64_t bytes;
+    uint32_t skip_mbs;
+    uint32_t inter_mbs;
+    uint32_t intra_mbs;
+    uint32_t last_bytes;
+    uint8_t last_qp;
+    bool last_idr;
+} h264_enc_stats_t;
+
+typedef enum {
+    H264_MB_SKIP = 0,
+    H264_MB_INTER,
+    H264_MB_INTRA,
+} h264_mb_type_t;
+
+typedef struct {
+    uint8_t type;               // h264_mb_type_t
+    uint8_t qp;
+    int16_t mv[2];              // Quarter pixels
+    uint8_t nz[16];             // Coefficients per luma 4x4 block, raster order
+    uint8_t nz_c[2][4];         // Chroma AC, per 4x4 block
+} h264_mb_t;
+
+typedef struct {
+    h264_enc_config_t cfg;
+    int mb_w, mb_h;
+    int stride, cstride;        // Luma and chroma plane strides (whole macroblocks)
+    uint8_t *ref[3];            // Previous frame, deblocked
+    uint8_t *rec[3];            // Frame being encoded
+    h264_mb_t *mbs;
+    uint8_t level_idc;
+    uint32_t frame_num;
+    uint16_t idr_pic_id;
+    uint32_t since_idr;
+    bool have_ref;
+    bool idr_requested;
+    int qp;
+    // Rate control
+    float rc_cplx[2];           // Bits times qstep, P and IDR frames
+    int64_t rc_buffer;          // Bits sent above the target so far
+    bool rc_idle;               // Last P-frame was nearly all skipped
+    h264_enc_stats_t stats;
+} h264_enc_t;
+
+// Bitstream writer, with emulation prevention
+
+typedef struct {
+    uint8_t *buf;
+    size_t cap;
+    size_t len;
+    uint64_t acc;
+    int bits;
+    int zeros;                  // Zero bytes in a row
+    bool overflow;
+} h264_bs_t;
+
+static void h264_bs_emit(h264_bs_t *bs, uint8_t b) {
+    if (bs->len < bs->cap) {
+        bs->buf[bs->len++] = b;
+    } else {
+        bs->overflow = true;
+    }
+}
+
+static void h264_bs_byte(h264_bs_t *bs, uint8_t b) {
+    if (bs->zeros >= 2 && b <= 3) {
+        h264_bs_emit(bs, 3);
+        bs->zeros = 0;
+    }
+    h264_bs_emit(bs, b);
+    bs->zeros = b ? 0 : bs->zeros + 1;
+}
+
+static void h264_put(h264_bs_t *bs, int n, uint32_t v) {
+    if (n == 0) {
+        return;
+    }
+    bs->acc = (bs->acc << n) | (v & (uint32_t)((1ull << n) - 1));
+    bs->bits += n;
+    while (bs->bits >= 8) {
+        bs->bits -= 8;
+        h264_bs_byte(bs, (uint8_t)(bs->acc >> bs->bits));
+    }
+    bs->acc &= (1u << bs->bits) - 1;
+}
+
+static int h264_ue_bits(uint32_t v) {
+    int n = 0;
+    for (uint32_t x = v + 1; x > 1; x >>= 1) {
+        n++;
+    }
+    return 2 * n + 1;
+}
+
+static int h264_se_bits(int v) {
+    return h264_ue_bits(v > 0 ? 2 * (uint32_t)v - 1 : 2 * (uint32_t)-v);
+}
+
+static void h264_put_ue(h264_bs_t *bs, uint32_t v) {
+    int len = (h264_ue_bits(v) + 1) / 2;
+    h264_put(bs, len - 1, 0);
+    h264_put(bs, len, v + 1);
+}
+
+static void h264_put_se(h264_bs_t *bs, int v) {
+    h264_put_ue(bs, v > 0 ? 2 * (uint32_t)v - 1 : 2 * (uint32_t)-v);
+}
+
+// Start code and NAL header, written as is
+static void h264_nal_start(h264_bs_t *bs, int ref_idc, int type) {
+    static const uint8_t start[4] = { 0, 0, 0, 1 };
+    for (int i = 0; i < 4; i++) {
+        h264_bs_emit(bs, start[i]);
+    }
+    h264_bs_emit(bs, (uint8_t)(ref_idc << 5 | type));
+    bs->acc = 0;
+    bs->bits = 0;
+    bs->zeros = 0;
+}
+
+static void h264_rbsp_trailing(h264_bs_t *bs) {
+    h264_put(bs, 1, 1);
+    if (bs->bits) {
+        h264_put(bs, 8 - bs->bits, 0);
+    }
+}
+
+// CAVLC tables, indexed [total_coeff * 4 + trailing_ones]
+
+static const uint8_t h264_coeff_token_len[4][4 * 17] = {
+    {  1, 0, 0, 0,  6, 2, 0, 0,  8, 6, 3, 0,  9, 8, 7, 5, 10, 9, 8, 6,
+      11,10, 9, 7, 13,11,10, 8, 13,13,11, 9, 13,13,13,10, 14,14,13,11,
+      14,14,14,13, 15,15,14,14, 15,15,15,14, 16,15,15,15, 16,16,16,15,
+      16,16,16,16, 16,16,16,16 },
+    {  2, 0, 0, 0,  6, 2, 0, 0,  6, 5, 3, 0,  7, 6, 6, 4,  8, 6, 6, 4,
+       8, 7, 7, 5,  9, 8, 8, 6, 11, 9, 9, 6, 11,11,11, 7, 12,11,11, 9,
+      12,12,12,11, 12,12,12,11, 13,13,13,12, 13,13,13,13, 13,14,13,13,
+      14,14,14,13, 14,14,14,14 },
+    {  4, 0, 0, 0,  6, 4, 0, 0,  6, 5, 4, 0,  6, 5, 5, 4,  7, 5, 5, 4,
+       7, 5, 5, 4,  7, 6, 6, 4,  7, 6, 6, 4,  8, 7, 7, 5,  8, 8, 7, 6,
+       9, 8, 8, 7,  9, 9, 8, 8,  9, 9, 9, 8, 10, 9, 9, 9, 10,10,10,10,
+      10,10,10,10, 10,10,10,10 },
+    {  6, 0, 0, 0,  6, 6, 0, 0,  6, 6, 6, 0,  6, 6, 6, 6,  6, 6, 6, 6,
+       6, 6, 6, 6,  6, 6, 6, 6,  6, 6, 6, 6,  6, 6, 6, 6,  6, 6, 6, 6,
+       6, 6, 6, 6,  6, 6, 6, 6,  6, 6, 6, 6,  6, 6, 6, 6,  6, 6, 6, 6,
+       6, 6, 6, 6,  6, 6, 6, 6 },
+};
+
+static const uint8_t h264_coeff_token_code[4][4 * 17] = {
+    {  1, 0, 0, 0,  5, 1, 0, 0,  7, 4, 1, 0,  7, 6, 5, 3,  7, 6, 5, 3,
+       7, 6, 5, 4, 15, 6, 5, 4, 11,14, 5, 4,  8,10,13, 4, 15,14, 9, 4,
+      11,10,13,12, 15,14, 9,12, 11,10,13, 8, 15, 1, 9,12, 11,14,13, 8,
+       7,10, 9,12,  4, 6, 5, 8 },
+    {  3, 0, 0, 0, 11, 2, 0, 0,  7, 7, 3, 0,  7,10, 9, 5,  7, 6, 5, 4,
+       4, 6, 5, 6,  7, 6, 5, 8, 15, 6, 5, 4, 11,14,13, 4, 15,10, 9, 4,
+      11,14,13,12,  8,10, 9, 8, 15,14,13,12, 11,10, 9,12,  7,11, 6, 8,
+       9, 8,10, 1,  7, 6, 5, 4 },
+    { 15, 0, 0, 0, 15,14, 0, 0, 11,15,13, 0,  8,12,14,12, 15,10,11,11,
+      11, 8, 9,10,  9,14,13, 9,  8,10, 9, 8, 15,14,13,13, 11,14,10,12,
+      15,10,13,12, 11,14, 9,12,  8,10,13, 8, 13, 7, 9,12,  9,12,11,10,
+       5, 8, 7, 6,  1, 4, 3, 2 },
+    {  3, 0, 0, 0,  0, 1, 0, 0,  4, 5, 6, 0,  8, 9,10,11, 12,13,14,15,
+      16,17,18,19, 20,21,22,23, 24,25,26,27, 28,29,30,31, 32,33,34,35,
+      36,37,38,39, 40,41,42,43, 44,45,46,47, 48,49,50,51, 52,53,54,55,
+      56,57,58,59, 60,61,62,63 },
+};
+
+static const uint8_t h264_chroma_dc_token_len[4 * 5] = {
+    2, 0, 0, 0,  6, 1, 0, 0,  6, 6, 3, 0,  6, 7, 7, 6,  6, 8, 8, 7,
+};
+
+static const uint8_t h264_chroma_dc_token_code[4 * 5] = {
+    1, 0, 0, 0,  7, 1, 0, 0,  4, 6, 1, 0,  3, 3, 2, 5,  2, 3, 2, 0,
+};
+
+// [total_coeff - 1][total_zeros]
+static const uint8_t h264_total_zeros_len[15][16] = {
+    { 1, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 9 },
+    { 3, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 6, 6, 6, 6 },
+    { 4, 3, 3, 3, 4, 4, 3, 3, 4, 5, 5, 6, 5, 6 },
+    { 5, 3, 4, 4, 3, 3, 3, 4, 3, 4, 5, 5, 5 },
+    { 4, 4, 4, 3, 3, 3, 3, 3, 4, 5, 4, 5 },
+    { 6, 5, 3, 3, 3, 3, 3, 3, 4, 3, 6 },
+    { 6, 5, 3, 3, 3, 2, 3, 4, 3, 6 },
+    { 6, 4, 5, 3, 2, 2, 3, 3, 6 },
+    { 6, 6, 4, 2, 2, 3, 2, 5 },
+    { 5, 5, 3, 2, 2, 2, 4 },
+    { 4, 4, 3, 3, 1, 3 },
+    { 4, 4, 2, 1, 3 },
+    { 3, 3, 1, 2 },
+    { 2, 2, 1 },
+    { 1, 1 },
+};
+
+static const uint8_t h264_total_zeros_code[15][16] = {
+    { 1, 3, 2, 3, 2, 3, 2, 3, 2, 3, 2, 3, 2, 3, 2, 1 },
+    { 7, 6, 5, 4, 3, 5, 4, 3, 2, 3, 2, 3, 2, 1, 0 },
+    { 5, 7, 6, 5, 4, 3, 4, 3, 2, 3, 2, 1, 1, 0 },
+    { 3, 7, 5, 4, 6, 5, 4, 3, 3, 2, 2, 1, 0 },
+    { 5, 4, 3, 7, 6, 5, 4, 3, 2, 1, 1, 0 },
+    { 1, 1, 7, 6, 5, 4, 3, 2, 1, 1, 0 },
+    { 1, 1, 5, 4, 3, 3, 2, 1, 1, 0 },
+    { 1, 1, 1, 3, 3, 2, 2, 1, 0 },
+    { 1, 0, 1, 3, 2, 1, 1, 1 },
+    { 1, 0, 1, 3, 2, 1, 1 },
+    { 0, 1, 1, 2, 1, 3 },
+    { 0, 1, 1, 1, 1 },
+    { 0, 1, 1, 1 },
+    { 0, 1, 1 },
+    { 0, 1 },
+};
+
+static const uint8_t h264_chroma_dc_zeros_len[3][4] = {
+    { 1, 2, 3, 3 }, { 1, 2, 2 }, { 1, 1 },
+};
+
+static const uint8_t h264_chroma_dc_zeros_code[3][4] = {
+    { 1, 1, 1, 0 }, { 1, 1, 0 }, { 1, 0 },
+};
+
+// [min(zeros_left, 7) - 1][run_before]
+static const uint8_t h264_run_len[7][15] = {
+    { 1, 1 },
+    { 1, 2, 2 },
+    { 2, 2, 2, 2 },
+    { 2, 2, 2, 3, 3 },
+    { 2, 2, 3, 3, 3, 3 },
+    { 2, 3, 3, 3, 3, 3, 3 },
+    { 3, 3, 3, 3, 3, 3, 3, 4, 5, 6, 7, 8, 9, 10, 11 },
+};
+
+static const uint8_t h264_run_code[7][15] = {
+    { 1, 0 },
+    { 1, 1, 0 },
+    { 3, 2, 1, 0 },
+    { 3, 2, 1, 1, 0 },
+    { 3, 2, 3, 2, 1, 0 },
+    { 3, 0, 1, 3, 2, 5, 4 },
+    { 7, 6, 5, 4, 3, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1 },
+};
+
+// coded_block_pattern (luma | chroma << 4) to its inter code number
+static const uint8_t h264_inter_cbp_code[48] = {
+     0,  2,  3,  7,  4,  8, 17, 13,  5, 18,  9, 14, 10, 15, 16, 11,
+     1, 32, 33, 36, 34, 37, 44, 40, 35, 45, 38, 41, 39, 42, 43, 19,
+     6, 24, 25, 20, 26, 21, 46, 28, 27, 47, 22, 29, 23, 30, 31, 12,
+};
+
+// Zig-zag scan: scan index to raster position in the 4x4 block
+static const uint8_t h264_zigzag[16] = { 0, 1, 4, 8, 5, 2, 3, 6, 9, 12, 13, 10, 7, 11, 14, 15 };
+
+// Quantization multipliers and dequantization scales, [qp % 6][position class]
+static const uint16_t h264_quant_mf[6][3] = {
+    { 13107, 5243, 8066 }, { 11916, 4660, 7490 }, { 10082, 4194, 6554 },
+    { 9362, 3647, 5825 }, { 8192, 3355, 5243 }, { 7282, 2893, 4559 },
+};
+
+static const uint8_t h264_dequant_v[6][3] = {
+    { 10, 16, 13 }, { 11, 18, 14 }, { 13, 20, 16 }, { 14, 23, 18 }, { 16, 25, 20 }, { 18, 29, 23 },
+};
+
+static const uint8_t h264_chroma_qp[52] = {
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19,
+    20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 29, 30, 31, 32, 32, 33, 34, 34, 35, 35,
+    36, 36, 37, 37, 37, 38, 38, 38, 39, 39, 39, 39,
+};
+
+// Motion search lambda: about 0.85 * 2^((qp - 12) / 6)
+static const uint8_t h264_lambda[52] = {
+     1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  2,  2,  2,
+     2,  2,  3,  3,  3,  4,  4,  5,  5,  6,  7,  8,  9, 10, 11, 12, 14, 15, 17, 19,
+    22, 24, 27, 31, 34, 38, 43, 48, 54, 61, 69, 77,
+};
+
+// Deblocking thresholds, [indexA] and [indexA][bS - 1]
+static const uint8_t h264_alpha[52] = {
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+      4,   4,   5,   6,   7,   8,   9,  10,  12,  13,  15,  17,  20,  22,  25,  28,
+     32,  36,  40,  45,  50,  56,  63,  71,  80,  90, 101, 113, 127, 144, 162, 182,
+    203, 226, 255, 255,
+};
+
+static const uint8_t h264_beta[52] = {
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     2,  2,  2,  3,  3,  3,  3,  4,  4,  4,  6,  6,  7,  7,  8,  8,
+     9,  9, 10, 10, 11, 11, 12, 12, 13, 13, 14, 14, 15, 15, 16, 16,
+    17, 17, 18, 18,
+};
+
+static const uint8_t h264_tc0[52][3] = {
+    {0,0,0}, {0,0,0}, {0,0,0}, {0,0,0}, {0,0,0}, {0,0,0}, {0,0,0}, {0,0,0}, {0,0,0},
+    {0,0,0}, {0,0,0}, {0,0,0}, {0,0,0}, {0,0,0}, {0,0,0}, {0,0,0}, {0,0,0}, {0,0,1},
+    {0,0,1}, {0,0,1}, {0,0,1}, {0,1,1}, {0,1,1}, {1,1,1}, {1,1,1}, {1,1,1}, {1,1,1},
+    {1,1,2}, {1,1,2}, {1,1,2}, {1,1,2}, {1,2,3}, {1,2,3}, {2,2,3}, {2,2,4}, {2,3,4},
+    {2,3,4}, {3,3,5}, {3,4,6}, {3,4,6}, {4,5,7}, {4,5,8}, {4,6,9}, {5,7,10}, {6,8,11},
+    {6,8,13}, {7,10,14}, {8,11,16}, {9,12,18}, {10,13,20}, {11,15,23}, {13,17,25},
+};
+
+static int h264_clip(int v, int lo, int hi) {
+    return v < lo ? lo : v > hi ? hi : v;
+}
+
+static uint8_t h264_pixel(int v) {
+    return (uint8_t)(v < 0 ? 0 : v > 255 ? 255 : v);
+}
+
+// Position class for the quantization tables: 0 both even, 1 both odd, 2 mixed
+static int h264_pos_class(int pos) {
+    int x = pos & 1, y = (pos >> 2) & 1;
+    return x == y ? x : 2;
+}
+
+// Residual coding
+
+// One block of CAVLC: `n` levels in scan order (4, 15 or 16); nc is the
+// coefficient count predicted from the neighbours, -1 for chroma DC.
+// Returns the number of non-zero levels.
+static int h264_write_block(h264_bs_t *bs, const int16_t *lev, int n, int nc) {
+    int levels[16], runs[16];
+    int total = 0, total_zeros = 0;
+    int last = n - 1;
+    while (last >= 0 && !lev[last]) {
+        last--;
+    }
+    for (int i = last; i >= 0; i--) {
+        if (lev[i]) {
+            levels[total] = lev[i];
+            runs[total++] = 0;
+        } else {
+            runs[total - 1]++;
+            total_zeros++;
+        }
+    }
+    int t1 = 0;
+    while (t1 < total && t1 < 3 && (levels[t1] == 1 || levels[t1] == -1)) {
+        t1++;
+    }
+
+    if (nc < 0) {
+        h264_put(bs, h264_chroma_dc_token_len[total * 4 + t1], h264_chroma_dc_token_code[total * 4 + t1]);
+    } else {
+        int table = nc < 2 ? 0 : nc < 4 ? 1 : nc < 8 ? 2 : 3;
+        h264_put(bs, h264_coeff_token_len[table][total * 4 + t1], h264_coeff_token_code[table][total * 4 + t1]);
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    for (int i = 0; i < t1; i++) {
+        h264_put(bs, 1, levels[i] < 0);
+    }
+    int suffix_len = total > 10 && t1 < 3 ? 1 : 0;
+    for (int i = t1; i < total; i++) {
+        int level = levels[i];
+        int code = level > 0 ? 2 * level - 2 : -2 * level - 1;
+        if (i == t1 && t1 < 3) {
+            code -= 2;
+        }
+        if (suffix_len == 0) {
+            if (code < 14) {
+                h264_put(bs, code + 1, 1);
+            } else if (code < 30) {
+                h264_put(bs, 15, 1);
+                h264_put(bs, 4, code - 14);
+            } else {
+                h264_put(bs, 16, 1);
+                h264_put(bs, 12, code - 30);
+            }
+        } else if (code < (15 << suffix_len)) {
+            h264_put(bs, (code >> suffix_len) + 1, 1);
+            h264_put(bs, suffix_len, code);
+        } else {
+            h264_put(bs, 16, 1);
+            h264_put(bs, 12, code - (15 << suffix_len));
+        }
+        if (suffix_len == 0) {
+            suffix_len = 1;
+        }
+        int mag = level < 0 ? -level : level;
+        if (mag > (3 << (suffix_len - 1)) && suffix_len < 6) {
+            suffix_len++;
+        }
+    }
+
+    if (total < n) {
+        if (n == 4) {
+            h264_put(bs, h264_chroma_dc_zeros_len[total - 1][total_zeros], h264_chroma_dc_zeros_code[total - 1][total_zeros]);
+        } else {
+            h264_put(bs, h264_total_zeros_len[total - 1][total_zeros], h264_total_zeros_code[total - 1][total_zeros]);
+        }
+    }
+    int zeros_left = total_zeros;
+    for (int i = 0; i < total - 1 && zeros_left > 0; i++) {
+        int t = (zeros_left < 7 ? zeros_left : 7) - 1;
+        h264_put(bs, h264_run_len[t][runs[i]], h264_run_code[t][runs[i]]);
+        zeros_left -= runs[i];
+    }
+    return total;
+}
+
+// Transforms and quantization
+
+static void h264_fdct4(const int16_t *diff, int32_t *out) {
+    int32_t t[16];
+    for (int i = 0; i < 4; i++) {
+        const int16_t *d = diff + i * 4;
+        int32_t s03 = d[0] + d[3], s12 = d[1] + d[2], d03 = d[0] - d[3], d12 = d[1] - d[2];
+        t[i * 4 + 0] = s03 + s12;
+        t[i * 4 + 1] = 2 * d03 + d12;
+        t[i * 4 + 2] = s03 - s12;
+        t[i * 4 + 3] = d03 - 2 * d12;
+    }
+    for (int i = 0; i < 4; i++) {
+        int32_t s03 = t[i] + t[12 + i], s12 = t[4 + i] + t[8 + i];
+        int32_t d03 = t[i] - t[12 + i], d12 = t[4 + i] - t[8 + i];
+        out[i] = s03 + s12;
+        out[4 + i] = 2 * d03 + d12;
+        out[8 + i] = s03 - s12;
+        out[12 + i] = d03 - 2 * d12;
+    }
+}
+
+// Inverse transform of dequantized coefficients (raster), added to the prediction
+static void h264_idct4_add(int32_t *d, const uint8_t *pred, int pstride, uint8_t *dst, int dstride) {
+    for (int i = 0; i < 4; i++) {
+        int32_t *r = d + i * 4;
+        int32_t e0 = r[0] + r[2], e1 = r[0] - r[2];
+        int32_t e2 = (r[1] >> 1) - r[3], e3 = r[1] + (r[3] >> 1);
+        r[0] = e0 + e3;
+        r[1] = e1 + e2;
+        r[2] = e1 - e2;
+        r[3] = e0 - e3;
+    }
+    for (int i = 0; i < 4; i++) {
+        int32_t e0 = d[i] + d[8 + i], e1 = d[i] - d[8 + i];
+        int32_t e2 = (d[4 + i] >> 1) - d[12 + i], e3 = d[4 + i] + (d[12 + i] >> 1);
+        int32_t h[4] = { e0 + e3, e1 + e2, e1 - e2, e0 - e3 };
+        for (int y = 0; y < 4; y++) {
+            dst[y * dstride + i] = h264_pixel(pred[y * pstride + i] + ((h[y] + 32) >> 6));
+        }
+    }
+}
+
+static int16_t h264_quant(int32_t w, int mf, int shift, int32_t round) {
+    int64_t a = w < 0 ? -(int64_t)w : w;
+    int32_t z = (int32_t)((a * mf + round) >> shift);
+    if (z > H264_LEVEL_MAX) {
+        z = H264_LEVEL_MAX;
+    }
+    return (int16_t)(w < 0 ? -z : z);
+}
+
+// Walsh-Hadamard transform of the 4x4 luma DCs, in place (its own inverse up to scale)
+static void h264_hadamard4(int32_t *m) {
+    for (int i = 0; i < 4; i++) {
+        int32_t *r = m + i * 4;
+        int32_t s01 = r[0] + r[1], s23 = r[2] + r[3], d01 = r[0] - r[1], d23 = r[2] - r[3];
+        r[0] = s01 + s23;
+        r[1] = s01 - s23;
+        r[2] = d01 - d23;
+        r[3] = d01 + d23;
+    }
+    for (int i = 0; i < 4; i++) {
+        int32_t s01 = m[i] + m[4 + i], s23 = m[8 + i] + m[12 + i];
+        int32_t d01 = m[i] - m[4 + i], d23 = m[8 + i] - m[12 + i];
+        m[i] = s01 + s23;
+        m[4 + i] = s01 - s23;
+        m[8 + i] = d01 - d23;
+        m[12 + i] = d01 + d23;
+    }
+}
+
+static void h264_hadamard2(int32_t *m) {
+    int32_t a = m[0] + m[1], b = m[0] - m[1], c = m[2] + m[3], d = m[2] - m[3];
+    m[0] = a + c;
+    m[1] = b + d;
+    m[2] = a - c;
+    m[3] = b - d;
+}
+
+// How much a block of small levels is worth coding; 9 for any level above 1
+static int h264_decimate_score(const int16_t *lev, int n) {
+    static const uint8_t score_of_run[16] = { 3, 2, 2, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+    int i = n - 1, score = 0;
+    while (i >= 0 && !lev[i]) {
+        i--;
+    }
+    while (i >= 0) {
+        if (lev[i] > 1 || lev[i] < -1) {
+            return 9;
+        }
+        int run = 0;
+        for (i--; i >= 0 && !lev[i]; i--) {
+            run++;
+        }
+        score += score_of_run[run];
+    }
+    return score;
+}
+
+static int h264_count_nz(const int16_t *lev, int n) {
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        count += lev[i] != 0;
+    }
+    return count;
+}
+
+// Macroblock coding
+
+typedef struct {
+    uint8_t y[256], u[64], v[64];
+} h264_mb_pixels_t;
+
+typedef struct {
+    int16_t dc[16];             // Intra 16x16 luma DC, scan order
+    int16_t luma[16][16];       // Per 4x4 block (raster), scan order; [0] unused for intra 16x16
+    int16_t cdc[2][4];
+    int16_t cac[2][4][16];      // Scan order, [0] unused
+    int cbp_luma;               // Bit per 8x8
+    int cbp_chroma;             // 0 none, 1 DC only, 2 DC and AC
+} h264_mb_coefs_t;
+
+static void h264_diff4(const uint8_t *src, const uint8_t *pred, int stride, int16_t *diff) {
+    for (int y = 0; y < 4; y++) {
+        for (int x = 0; x < 4; x++) {
+            diff[y * 4 + x] = (int16_t)(src[y * stride + x] - pred[y * stride + x]);
+        }
+    }
+}
+
+// Luma of an inter macroblock: quantize, drop noise, reconstruct into dst
+static void h264_luma_inter(const uint8_t *src, const uint8_t *pred, int qp, h264_mb_coefs_t *c,
+                            h264_mb_t *mb, uint8_t *dst, int dstride) {
+    int q6 = qp / 6, shift = 15 + q6;
+    const uint16_t *mf = h264_quant_mf[qp % 6];
+    int32_t round = (1 << shift) / 6;
+    int score8[4] = {0};
+
+    for (int b = 0; b < 16; b++) {
+        int bx = (b & 3) * 4, by = (b >> 2) * 4;
+        int16_t diff[16];
+        int32_t w[16];
+        h264_diff4(src + by * 16 + bx, pred + by * 16 + bx, 16, diff);
+        h264_fdct4(diff, w);
+        for (int i = 0; i < 16; i++) {
+            int pos = h264_zigzag[i];
+            c->luma[b][i] = h264_quant(w[pos], mf[h264_pos_class(pos)], shift, round);
+        }
+        int s = h264_decimate_score(c->luma[b], 16);
+        score8[(by / 8) * 2 + bx / 8] += s;
+    }
+
+    int total = score8[0] + score8[1] + score8[2] + score8[3];
+    c->cbp_luma = 0;
+    for (int b = 0; b < 16; b++) {
+        int b8 = ((b >> 2) / 2) * 2 + (b & 3) / 2;
+        if (total < 6 || score8[b8] < 4) {
+            memset(c->luma[b], 0, sizeof(c->luma[b]));
+        }
+        mb->nz[b] = (uint8_t)h264_count_nz(c->luma[b], 16);
+        if (mb->nz[b]) {
+            c->cbp_luma |= 1 << b8;
+        }
+    }
+
+    const uint8_t *v = h264_dequant_v[qp % 6];
+    for (int b = 0; b < 16; b++) {
+        int bx = (b & 3) * 4, by = (b >> 2) * 4;
+        uint8_t *out = dst + by * dstride + bx;
+        const uint8_t *p = pred + by * 16 + bx;
+        if (!mb->nz[b]) {
+            for (int y = 0; y < 4; y++) {
+                memcpy(out + y * dstride, p + y * 16, 4);
+            }
+            continue;
+        }
+        int32_t d[16];
+        for (int i = 0; i < 16; i++) {
+            int pos = h264_zigzag[i];
+            d[pos] = c->luma[b][i] * v[h264_pos_class(pos)] * (1 << q6);
+        }
+        h264_idct4_add(d, p, 16, out, dstride);
+    }
+}
+
+// Luma of an intra 16x16 macroblock
+static void h264_luma_i16(const uint8_t *src, const uint8_t *pred, int qp, h264_mb_coefs_t *c,
+                          h264_mb_t *mb, uint8_t *dst, int dstride) {
+    int q6 = qp / 6, shift = 15 + q6;
+    const uint16_t *mf = h264_quant_mf[qp % 6];
+    int32_t round = (1 << shift) / 3;
+    int32_t w[16][16], dc[16];
+
+    for (int b = 0; b < 16; b++) {
+        int bx = (b & 3) * 4, by = (b >> 2) * 4;
+        int16_t diff[16];
+        h264_diff4(src + by * 16 + bx, pred + by * 16 + bx, 16, diff);
+        h264_fdct4(diff, w[b]);
+        dc[b] = w[b][0];
+    }
+    h264_hadamard4(dc);
+    for (int i = 0; i < 16; i++) {
+        c->dc[i] = h264_quant(dc[h264_zigzag[i]] / 2, mf[0], shift + 1, round * 2);
+    }
+    c->cbp_luma = 0;
+    for (int b = 0; b < 16; b++) {
+        c->luma[b][0] = 0;
+        for (int i = 1; i < 16; i++) {
+            int pos = h264_zigzag[i];
+            c->luma[b][i] = h264_quant(w[b][pos], mf[h264_pos_class(pos)], shift, round);
+        }
+        mb->nz[b] = (uint8_t)h264_count_nz(c->luma[b] + 1, 15);
+        if (mb->nz[b]) {
+            c->cbp_luma = 15;
+        }
+    }
+
+    // Reconstruct as the decoder does
+    const uint8_t *v = h264_dequant_v[qp % 6];
+    int32_t f[16];
+    for (int i = 0; i < 16; i++) {
+        f[h264_zigzag[i]] = c->dc[i];
+    }
+    h264_hadamard4(f);
+    int32_t scale = 16 * v[0];
+    for (int i = 0; i < 16; i++) {
+        f[i] = qp >= 36 ? f[i] * scale * (1 << (q6 - 6)) : (f[i] * scale + (1 << (5 - q6))) >> (6 - q6);
+    }
+    for (int b = 0; b < 16; b++) {
+        int bx = (b & 3) * 4, by = (b >> 2) * 4;
+        int32_t d[16] = {0};
+        if (c->cbp_luma) {
+            for (int i = 1; i < 16; i++) {
+                int pos = h264_zigzag[i];
+                d[pos] = c->luma[b][i] * v[h264_pos_class(pos)] * (1 << q6);
+            }
+        }
+        d[0] = f[b];
+        h264_idct4_add(d, pred + by * 16 + bx, 16, dst + by * dstride + bx, dstride);
+    }
+}
+
+// Both chroma components; inter residual that is only noise is dropped
+static void h264_chroma(const uint8_t *src[2], const uint8_t *pred[2], int qp_luma, bool intra,
+                        h264_mb_coefs_t *c, h264_mb_t *mb, uint8_t *dst[2], int dstride) {
+    int qp = h264_chroma_qp[qp_luma];
+    int q6 = qp / 6, shift = 15 + q6;
+    const uint16_t *mf = h264_quant_mf[qp % 6];
+    int32_t round = (1 << shift) / (intra ? 3 : 6);
+    bool any_dc = false, any_ac = false;
+
+    for (int ch = 0; ch < 2; ch++) {
+        int32_t dc[4];
+        int score = 0;
+        for (int b = 0; b < 4; b++) {
+            int bx = (b & 1) * 4, by = (b >> 1) * 4;
+            int16_t diff[16];
+            int32_t w[16];
+            h264_diff4(src[ch] + by * 8 + bx, pred[ch] + by * 8 + bx, 8, diff);
+            h264_fdct4(diff, w);
+            dc[b] = w[0];
+            c->cac[ch][b][0] = 0;
+            for (int i = 1; i < 16; i++) {
+                int pos = h264_zigzag[i];
+                c->cac[ch][b][i] = h264_quant(w[pos], mf[h264_pos_class(pos)], shift, round);
+            }
+            score += h264_decimate_score(c->cac[ch][b] + 1, 15);
+        }
+        if (!intra && score < 7) {
+            memset(c->cac[ch], 0, sizeof(c->cac[ch]));
+        }
+        h264_hadamard2(dc);
+        for (int i = 0; i < 4; i++) {
+            c->cdc[ch][i] = h264_quant(dc[i], mf[0], shift + 1, round * 2);
+            any_dc |= c->cdc[ch][i] != 0;
+        }
+        for (int b = 0; b < 4; b++) {
+            any_ac |= h264_count_nz(c->cac[ch][b] + 1, 15) != 0;
+        }
+    }
+    c->cbp_chroma = any_ac ? 2 : any_dc ? 1 : 0;
+
+    const uint8_t *v = h264_dequant_v[qp % 6];
+    for (int ch = 0; ch < 2; ch++) {
+        int32_t f[4];
+        for (int i = 0; i < 4; i++) {
+            f[i] = c->cbp_chroma ? c->cdc[ch][i] : 0;
+        }
+        h264_hadamard2(f);
+        for (int b = 0; b < 4; b++) {
+            int bx = (b & 1) * 4, by = (b >> 1) * 4;
+            int32_t d[16] = {0};
+            mb->nz_c[ch][b] = 0;
+            if (c->cbp_chroma == 2) {
+                for (int i = 1; i < 16; i++) {
+                    int pos = h264_zigzag[i];
+                    d[pos] = c->cac[ch][b][i] * v[h264_pos_class(pos)] * (1 << q6);
+                }
+                mb->nz_c[ch][b] = (uint8_t)h264_count_nz(c->cac[ch][b] + 1, 15);
+            }
+            d[0] = (f[b] * 16 * v[0] * (1 << q6)) >> 5;
+            h264_idct4_add(d, pred[ch] + by * 8 + bx, 8, dst[ch] + by * dstride + bx, dstride);
+        }
+    }
+}
+
+// Neighbours within the frame (one slice, so only the frame edges matter)
+
+static const h264_mb_t *h264_mb_at(const h264_enc_t *e, int mbx, int mby) {
+    if (mbx < 0 || mby < 0 || mbx >= e->mb_w) {
+        return NULL;
+    }
+    return &e->mbs[mby * e->mb_w + mbx];
+}
+
+// Coefficient count predicted for a luma block (raster index in the macroblock)
+static int h264_nc_luma(const h264_enc_t *e, int mbx, int mby, int b) {
+    const h264_mb_t *cur = &e->mbs[mby * e->mb_w + mbx];
+    int bx = b & 3, by = b >> 2;
+    int na = -1, nb = -1;
+    if (bx > 0) {
+        na = cur->nz[b - 1];
+    } else if (mbx > 0) {
+        na = cur[-1].nz[by * 4 + 3];
+    }
+    if (by > 0) {
+        nb = cur->nz[b - 4];
+    } else if (mby > 0) {
+        nb = cur[-e->mb_w].nz[12 + bx];
+    }
+    if (na >= 0 && nb >= 0) {
+        return (na + nb + 1) >> 1;
+    }
+    return na >= 0 ? na : nb >= 0 ? nb : 0;
+}
+
+static int h264_nc_chroma(const h264_enc_t *e, int mbx, int mby, int ch, int b) {
+    const h264_mb_t *cur = &e->mbs[mby * e->mb_w + mbx];
+    int bx = b & 1, by = b >> 1;
+    int na = -1, nb = -1;
+    if (bx > 0) {
+        na = cur->nz_c[ch][b - 1];
+    } else if (mbx > 0) {
+        na = cur[-1].nz_c[ch][by * 2 + 1];
+    }
+    if (by > 0) {
+        nb = cur->nz_c[ch][b - 2];
+    } else if (mby > 0) {
+        nb = cur[-e->mb_w].nz_c[ch][2 + bx];
+    }
+    if (na >= 0 && nb >= 0) {
+        return (na + nb + 1) >> 1;
+    }
+    return na >= 0 ? na : nb >= 0 ? nb : 0;
+}
+
+// Motion vector predicted for a 16x16 partition (median of left, top and
+// top-right, or top-left when top-right is outside the frame)
+static void h264_mv_pred(const h264_enc_t *e, int mbx, int mby, int16_t mvp[2]) {
+    const h264_mb_t *a = h264_mb_at(e, mbx - 1, mby);
+    const h264_mb_t *b = h264_mb_at(e, mbx, mby - 1);
+    const h264_mb_t *c = h264_mb_at(e, mbx + 1, mby - 1);
+    if (!c) {
+        c = h264_mb_at(e, mbx - 1, mby - 1);
+    }
+    if (!b && !c && a) {
+        b = c = a;
+    }
+    const h264_mb_t *n[3] = { a, b, c };
+    int16_t mv[3][2];
+    int matches = 0, match = 0;
+    for (int i = 0; i < 3; i++) {
+        bool inter = n[i] && n[i]->type != H264_MB_INTRA;
+        mv[i][0] = inter ? n[i]->mv[0] : 0;
+        mv[i][1] = inter ? n[i]->mv[1] : 0;
+        if (inter) {
+            matches++;
+            match = i;
+        }
+    }
+    if (matches == 1) {
+        mvp[0] = mv[match][0];
+        mvp[1] = mv[match][1];
+        return;
+    }
+    for (int k = 0; k < 2; k++) {
+        int x = mv[0][k], y = mv[1][k], z = mv[2][k];
+        int lo = x < y ? x : y, hi = x < y ? y : x;
+        mvp[k] = (int16_t)(z < lo ? lo : z > hi ? hi : z);
+    }
+}
+
+static void h264_mv_skip(const h264_enc_t *e, int mbx, int mby, int16_t mv[2]) {
+    const h264_mb_t *a = h264_mb_at(e, mbx - 1, mby);
+    const h264_mb_t *b = h264_mb_at(e, mbx, mby - 1);
+    if (!a || !b
+        || (a->type != H264_MB_INTRA && a->mv[0] == 0 && a->mv[1] == 0)
+        || (b->type != H264_MB_INTRA && b->mv[0] == 0 && b->mv[1] == 0)) {
+        mv[0] = mv[1] = 0;
+        return;
+    }
+    h264_mv_pred(e, mbx, mby, mv);
+}
+
+// Prediction
+
+static void h264_load_src(const h264_enc_t *e, const h264_picture_t *pic, int mbx, int mby, h264_mb_pixels_t *px) {
+    int w = e->cfg.width, h = e->cfg.height;
+    int x0 = mbx * 16, y0 = mby * 16;
+    for (int y = 0; y < 16; y++) {
+        const uint8_t *row = pic->y + (y0 + y < h ? y0 + y : h - 1) * pic->y_stride;
+        if (x0 + 16 <= w) {
+            memcpy(px->y + y * 16, row + x0, 16);
+        } else {
+            for (int x = 0; x < 16; x++) {
+                px->y[y * 16 + x] = row[x0 + x < w ? x0 + x : w - 1];
+            }
+        }
+    }
+    int cw = w / 2, ch = h / 2;
+    for (int y = 0; y < 8; y++) {
+        int sy = y0 / 2 + y < ch ? y0 / 2 + y : ch - 1;
+        const uint8_t *ru = pic->u + sy * pic->uv_stride, *rv = pic->v + sy * pic->uv_stride;
+        for (int x = 0; x < 8; x++) {
+            int sx = x0 / 2 + x < cw ? x0 / 2 + x : cw - 1;
+            px->u[y * 8 + x] = ru[sx];
+            px->v[y * 8 + x] = rv[sx];
+        }
+    }
+}
+
+// Luma block from the reference at full-pixel position (x, y), clamped to the frame
+static void h264_mc_luma(const h264_enc_t *e, int x, int y, uint8_t *dst) {
+    int w = e->mb_w * 16, h = e->mb_h * 16;
+    const uint8_t *ref = e->ref[0];
+    if (x >= 0 && y >= 0 && x + 16 <= w && y + 16 <= h) {
+        for (int j = 0; j < 16; j++) {
+            memcpy(dst + j * 16, ref + (y + j) * e->stride + x, 16);
+        }
+        return;
+    }
+    for (int j = 0; j < 16; j++) {
+        const uint8_t *row = ref + h264_clip(y + j, 0, h - 1) * e->stride;
+        for (int i = 0; i < 16; i++) {
+            dst[j * 16 + i] = row[h264_clip(x + i, 0, w - 1)];
+        }
+    }
+}
+
+// Chroma for a luma vector in quarter pixels (eighth chroma pixels), bilinear
+static void h264_mc_chroma(const h264_enc_t *e, int mbx, int mby, const int16_t mv[2], uint8_t *du, uint8_t *dv) {
+    int w = e->mb_w * 8, h = e->mb_h * 8;
+    int x0 = mbx * 8 + (mv[0] >> 3), y0 = mby * 8 + (mv[1] >> 3);
+    int fx = mv[0] & 7, fy = mv[1] & 7;
+    int wa = (8 - fx) * (8 - fy), wb = fx * (8 - fy), wc = (8 - fx) * fy, wd = fx * fy;
+    for (int ch = 0; ch < 2; ch++) {
+        const uint8_t *ref = e->ref[1 + ch];
+        uint8_t *dst = ch ? dv : du;
+        for (int j = 0; j < 8; j++) {
+            const uint8_t *r0 = ref + h264_clip(y0 + j, 0, h - 1) * e->cstride;
+            const uint8_t *r1 = ref + h264_clip(y0 + j + 1, 0, h - 1) * e->cstride;
+            for (int i = 0; i < 8; i++) {
+                int xa = h264_clip(x0 + i, 0, w - 1), xb = h264_clip(x0 + i + 1, 0, w - 1);
+                dst[j * 8 + i] = (uint8_t)((wa * r0[xa] + wb * r0[xb] + wc * r1[xa] + wd * r1[xb] + 32) >> 6);
+            }
+        }
+    }
+}
+
+static int h264_sad(const uint8_t *a, int astride, const uint8_t *b, int bstride, int w, int h) {
+    int sad = 0;
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            int d = a[y * astride + x] - b[y * bstride + x];
+            sad += d < 0 ? -d : d;
+        }
+    }
+    return sad;
+}
+
+// SAD of the source macroblock against the reference at full-pixel (x, y)
+static int h264_sad_ref(const h264_enc_t *e, const uint8_t *src, int x, int y) {
+    if (x >= 0 && y >= 0 && x + 16 <= e->mb_w * 16 && y + 16 <= e->mb_h * 16) {
+        return h264_sad(src, 16, e->ref[0] + y * e->stride + x, e->stride, 16, 16);
+    }
+    uint8_t blk[256];
+    h264_mc_luma(e, x, y, blk);
+    return h264_sad(src, 16, blk, 16, 16, 16);
+}
+
+enum { H264_I16_V = 0, H264_I16_H, H264_I16_DC };
+enum { H264_CHROMA_DC = 0, H264_CHROMA_H, H264_CHROMA_V };
+
+static void h264_pred_i16(const h264_enc_t *e, int mbx, int mby, int mode, uint8_t *pred) {
+    const uint8_t *p = e->rec[0] + mby * 16 * e->stride + mbx * 16;
+    int s = e->stride;
+    if (mode == H264_I16_V) {
+        for (int y = 0; y < 16; y++) {
+            memcpy(pred + y * 16, p - s, 16);
+        }
+    } else if (mode == H264_I16_H) {
+        for (int y = 0; y < 16; y++) {
+            memset(pred + y * 16, p[y * s - 1], 16);
+        }
+    } else {
+        int sum = 0, n = 0;
+        if (mby > 0) {
+            for (int i = 0; i < 16; i++) {
+                sum += p[i - s];
+            }
+            n++;
+        }
+        if (mbx > 0) {
+            for (int i = 0; i < 16; i++) {
+                sum += p[i * s - 1];
+            }
+            n++;
+        }
+        int dc = n == 2 ? (sum + 16) >> 5 : n == 1 ? (sum + 8) >> 4 : 128;
+        memset(pred, dc, 256);
+    }
+}
+
+static void h264_pred_chroma(const h264_enc_t *e, int mbx, int mby, int mode, uint8_t *pred[2]) {
+    int s = e->cstride;
+    bool top = mby > 0, left = mbx > 0;
+    for (int ch = 0; ch < 2; ch++) {
+        const uint8_t *p = e->rec[1 + ch] + mby * 8 * s + mbx * 8;
+        uint8_t *out = pred[ch];
+        if (mode == H264_CHROMA_V) {
+            for (int y = 0; y < 8; y++) {
+                memcpy(out + y * 8, p - s, 8);
+            }
+            continue;
+        }
+        if (mode == H264_CHROMA_H) {
+            for (int y = 0; y < 8; y++) {
+                memset(out + y * 8, p[y * s - 1], 8);
+            }
+            continue;
+        }
+        for (int b = 0; b < 4; b++) {
+            int bx = (b & 1) * 4, by = (b >> 1) * 4;
+            int st = 0, sl = 0;
+            for (int i = 0; i < 4; i++) {
+                st += top ? p[bx + i - s] : 0;
+                sl += left ? p[(by + i) * s - 1] : 0;
+            }
+            int dc;
+            if (b == 1 && top) {
+                dc = (st + 2) >> 2;     // Top-right block prefers the top
+            } else if (b == 2 && left) {
+                dc = (sl + 2) >> 2;     // Bottom-left block prefers the left
+            } else if (top && left) {
+                dc = (st + sl + 4) >> 3;
+            } else if (left) {
+                dc = (sl + 2) >> 2;
+            } else if (top) {
+                dc = (st + 2) >> 2;
+            } else {
+                dc = 128;
+            }
+            for (int y = 0; y < 4; y++) {
+                memset(out + (by + y) * 8 + bx, dc, 4);
+            }
+        }
+    }
+}
+
+// Best intra 16x16 luma mode by SAD
+static int h264_choose_i16(const h264_enc_t *e, int mbx, int mby, const uint8_t *src, uint8_t *pred, int *sad_out) {
+    int best = H264_I16_DC, best_sad;
+    h264_pred_i16(e, mbx, mby, H264_I16_DC, pred);
+    best_sad = h264_sad(src, 16, pred, 16, 16, 16);
+    uint8_t tmp[256];
+    for (int mode = H264_I16_V; mode <= H264_I16_H; mode++) {
+        if ((mode == H264_I16_V && mby == 0) || (mode == H264_I16_H && mbx == 0)) {
+            continue;
+        }
+        h264_pred_i16(e, mbx, mby, mode, tmp);
+        int sad = h264_sad(src, 16, tmp, 16, 16, 16);
+        if (sad < best_sad) {
+            best_sad = sad;
+            best = mode;
+            memcpy(pred, tmp, 256);
+        }
+    }
+    *sad_out = best_sad;
+    return best;
+}
+
+static int h264_choose_chroma(const h264_enc_t *e, int mbx, int mby, const h264_mb_pixels_t *src, uint8_t *pred[2]) {
+    int best = H264_CHROMA_DC, best_sad = -1;
+    uint8_t tu[64], tv[64];
+    uint8_t *tmp[2] = { tu, tv };
+    for (int mode = H264_CHROMA_DC; mode <= H264_CHROMA_V; mode++) {
+        if ((mode == H264_CHROMA_V && mby == 0) || (mode == H264_CHROMA_H && mbx == 0)) {
+            continue;
+        }
+        h264_pred_chroma(e, mbx, mby, mode, tmp);
+        int sad = h264_sad(src->u, 8, tu, 8, 8, 8) + h264_sad(src->v, 8, tv, 8, 8, 8);
+        if (best_sad < 0 || sad < best_sad) {
+            best_sad = sad;
+            best = mode;
+            memcpy(pred[0], tu, 64);
+            memcpy(pred[1], tv, 64);
+        }
+    }
+    return best;
+}
+
+// Integer-pixel motion search: the best of a few predictors, then a small
+// diamond. Cost is SAD plus lambda times the vector difference bits.
+static int h264_motion_search(const h264_enc_t *e, int mbx, int mby, const uint8_t *src,
+                              const int16_t mvp[2], const int16_t mv_skip[2], int lambda, int16_t best[2]) {
+    int x0 = mbx * 16, y0 = mby * 16, range = e->cfg.search;
+    int min_x = -x0 - 16, max_x = e->mb_w * 16 - x0;
+    int min_y = -y0 - 16, max_y = e->mb_h * 16 - y0;
+    if (min_x < -range) min_x = -range;
+    if (max_x > range) max_x = range;
+    if (min_y < -range) min_y = -range;
+    if (max_y > range) max_y = range;
+
+    int16_t cand[5][2] = { { 0, 0 }, { mvp[0], mvp[1] }, { mv_skip[0], mv_skip[1] } };
+    int n = 3;
+    const h264_mb_t *a = h264_mb_at(e, mbx - 1, mby), *b = h264_mb_at(e, mbx, mby - 1);
+    if (a && a->type != H264_MB_INTRA) {
+        cand[n][0] = a->mv[0];
+        cand[n++][1] = a->mv[1];
+    }
+    if (b && b->type != H264_MB_INTRA) {
+        cand[n][0] = b->mv[0];
+        cand[n++][1] = b->mv[1];
+    }
+
+    int bx = 0, by = 0, best_cost = -1;
+    for (int i = 0; i < n; i++) {
+        int cx = h264_clip(cand[i][0] >> 2, min_x, max_x), cy = h264_clip(cand[i][1] >> 2, min_y, max_y);
+        int cost = h264_sad_ref(e, src, x0 + cx, y0 + cy)
+            + lambda * (h264_se_bits(cx * 4 - mvp[0]) + h264_se_bits(cy * 4 - mvp[1]));
+        if (best_cost < 0 || cost < best_cost) {
+            best_cost = cost;
+            bx = cx;
+            by = cy;
+        }
+    }
+    static const int8_t diamond[4][2] = { { 0, -1 }, { -1, 0 }, { 1, 0 }, { 0, 1 } };
+    for (int it = 0; it < H264_SEARCH_ITERATIONS; it++) {
+        int nx = bx, ny = by;
+        for (int d = 0; d < 4; d++) {
+            int cx = bx + diamond[d][0], cy = by + diamond[d][1];
+            if (cx < min_x || cx > max_x || cy < min_y || cy > max_y) {
+                continue;
+            }
+            int cost = h264_sad_ref(e, src, x0 + cx, y0 + cy)
+                + lambda * (h264_se_bits(cx * 4 - mvp[0]) + h264_se_bits(cy * 4 - mvp[1]));
+            if (cost < best_cost) {
+                best_cost = cost;
+                nx = cx;
+                ny = cy;
+            }
+        }
+        if (nx == bx && ny == by) {
+            break;
+        }
+        bx = nx;
+        by = ny;
+    }
+    best[0] = (int16_t)(bx * 4);
+    best[1] = (int16_t)(by * 4);
+    return best_cost;
+}
+
+// Macroblock syntax
+
+static void h264_write_residual(h264_enc_t *e, h264_bs_t *bs, int mbx, int mby, const h264_mb_coefs_t *c, bool i16) {
+    h264_mb_t *mb = &e->mbs[mby * e->mb_w + mbx];
+    if (i16) {
+        h264_write_block(bs, c->dc, 16, h264_nc_luma(e, mbx, mby, 0));
+    }
+    for (int b8 = 0; b8 < 4; b8++) {
+        if (!(c->cbp_luma & (1 << b8))) {
+            continue;
+        }
+        for (int sub = 0; sub < 4; sub++) {
+            int b = ((b8 >> 1) * 2 + (sub >> 1)) * 4 + (b8 & 1) * 2 + (sub & 1);
+            int nc = h264_nc_luma(e, mbx, mby, b);
+            if (i16) {
+                h264_write_block(bs, c->luma[b] + 1, 15, nc);
+            } else {
+                h264_write_block(bs, c->luma[b], 16, nc);
+            }
+        }
+    }
+    if (c->cbp_chroma) {
+        for (int ch = 0; ch < 2; ch++) {
+            h264_write_block(bs, c->cdc[ch], 4, -1);
+        }
+    }
+    if (c->cbp_chroma == 2) {
+        for (int ch = 0; ch < 2; ch++) {
+            for (int b = 0; b < 4; b++) {
+                h264_write_block(bs, c->cac[ch][b] + 1, 15, h264_nc_chroma(e, mbx, mby, ch, b));
+            }
+        }
+    }
+    (void)mb;
+}
+
+// Sequence and picture parameter sets
+
+static uint8_t h264_level_for(const h264_enc_config_t *cfg) {
+    static const struct { uint8_t idc; uint16_t frame_mbs; uint32_t mbs_per_s; uint32_t kbps; } levels[] = {
+        { 10, 99, 1485, 64 }, { 11, 396, 3000, 192 }, { 12, 396, 6000, 384 }, { 13, 396, 11880, 768 },
+        { 20, 396, 11880, 2000 }, { 21, 792, 19800, 4000 }, { 22, 1620, 20250, 4000 },
+        { 30, 1620, 40500, 10000 }, { 31, 3600, 108000, 14000 }, { 32, 5120, 216000, 20000 },
+        { 40, 8192, 245760, 20000 },
+    };
+    uint32_t mbs = (uint32_t)((cfg->width + 15) / 16) * ((cfg->height + 15) / 16);
+    for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+        if (mbs <= levels[i].frame_mbs && mbs * cfg->fps <= levels[i].mbs_per_s
+            && cfg->bitrate <= levels[i].kbps * 1000) {
+            return levels[i].idc;
+        }
+    }
+    return 40;
+}
+
+static void h264_write_sps(const h264_enc_config_t *cfg, uint8_t level_idc, h264_bs_t *bs) {
+    int mb_w = (cfg->width + 15) / 16, mb_h = (cfg->height + 15) / 16;
+    h264_nal_start(bs, 3, H264_NAL_SPS);
+    h264_put(bs, 8, H264_PROFILE_BASELINE);
+    h264_put(bs, 8, H264_CONSTRAINT_FLAGS);
+    h264_put(bs, 8, level_idc);
+    h264_put_ue(bs, 0);                     // seq_parameter_set_id
+    h264_put_ue(bs, H264_LOG2_MAX_FRAME_NUM - 4);
+    h264_put_ue(bs, 2);                     // pic_order_cnt_type: output order is decode order
+    h264_put_ue(bs, 1);                     // max_num_ref_frames
+    h264_put(bs, 1, 0);                     // gaps_in_frame_num_value_allowed_flag
+    h264_put_ue(bs, mb_w - 1);
+    h264_put_ue(bs, mb_h - 1);
+    h264_put(bs, 1, 1);                     // frame_mbs_only_flag
+    h264_put(bs, 1, 1);                     // direct_8x8_inference_flag
+    int crop_r = (mb_w * 16 - cfg->width) / 2, crop_b = (mb_h * 16 - cfg->height) / 2;
+    h264_put(bs, 1, crop_r || crop_b);
+    if (crop_r || crop_b) {
+        h264_put_ue(bs, 0);
+        h264_put_ue(bs, crop_r);
+        h264_put_ue(bs, 0);
+        h264_put_ue(bs, crop_b);
+    }
+    // VUI: frame rate, and no reordering so decoders show frames at once
+    h264_put(bs, 1, 1);
+    h264_put(bs, 4, 0);                     // aspect ratio, overscan, signal type, chroma location
+    h264_put(bs, 1, 1);                     // timing_info_present_flag
+    h264_put(bs, 32, 1000);                 // num_units_in_tick
+    h264_put(bs, 32, 2000u * cfg->fps);     // time_scale (two ticks per frame)
+    h264_put(bs, 1, 0);                     // fixed_frame_rate_flag
+    h264_put(bs, 3, 0);                     // HRD parameters, pic_struct
+    h264_put(bs, 1, 1);                     // bitstream_restriction_flag
+    h264_put(bs, 1, 1);                     // motion_vectors_over_pic_boundaries_flag
+    h264_put_ue(bs, 0);                     // max_bytes_per_pic_denom
+    h264_put_ue(bs, 0);                     // max_bits_per_mb_denom
+    h264_put_ue(bs, 16);                    // log2_max_mv_length_horizontal
+    h264_put_ue(bs, 16);                    // log2_max_mv_length_vertical
+    h264_put_ue(bs, 0);                     // max_num_reorder_frames
+    h264_put_ue(bs, 1);                     // max_dec_frame_buffering
+    h264_rbsp_trailing(bs);
+}
+
+static void h264_write_pps(h264_bs_t *bs) {
+    h264_nal_start(bs, 3, H264_NAL_PPS);
+    h264_put_ue(bs, 0);                     // pic_parameter_set_id
+    h264_put_ue(bs, 0);                     // seq_parameter_set_id
+    h264_put(bs, 1, 0);                     // entropy_coding_mode_flag: CAVLC
+    h264_put(bs, 1, 0);                     // bottom_field_pic_order_in_frame_present_flag
+    h264_put_ue(bs, 0);                     // num_slice_groups_minus1
+    h264_put_ue(bs, 0);                     // num_ref_idx_l0_default_active_minus1
+    h264_put_ue(bs, 0);                     // num_ref_idx_l1_default_active_minus1
+    h264_put(bs, 1, 0);                     // weighted_pred_flag
+    h264_put(bs, 2, 0);                     // weighted_bipred_idc
+    h264_put_se(bs, 0);                     // pic_init_qp_minus26
+    h264_put_se(bs, 0);                     // pic_init_qs_minus26
+    h264_put_se(bs, 0);                     // chroma_qp_index_offset
+    h264_put(bs, 1, 1);                     // deblocking_filter_control_present_flag
+    h264_put(bs, 1, 0);                     // constrained_intra_pred_flag
+    h264_put(bs, 1, 0);                     // redundant_pic_cnt_present_flag
+    h264_rbsp_trailing(bs);
+}
+
+// SPS and PPS for a configuration, as Annex-B NAL units (for out-of-band
+// parameter sets). Returns the length, 0 if `cap` is too small.
+static size_t h264_param_sets(const h264_enc_config_t *cfg, uint8_t *buf, size_t cap) {
+    h264_bs_t bs = { .buf = buf, .cap = cap };
+    h264_write_sps(cfg, h264_level_for(cfg), &bs);
+    h264_write_pps(&bs);
+    return bs.overflow ? 0 : bs.len;
+}
+
+// Deblocking
+
+static void h264_filter_edge(uint8_t *q, int across, int along, int lines, const uint8_t bs[4], int qp, bool chroma) {
+    int alpha = h264_alpha[qp], beta = h264_beta[qp];
+    if (!alpha) {
+        return;
+    }
+    for (int seg = 0; seg < 4; seg++) {
+        if (!bs[seg]) {
+            continue;
+        }
+        int tc0 = bs[seg] < 4 ? h264_tc0[qp][bs[seg] - 1] : 0;
+        for (int l = seg * lines; l < (seg + 1) * lines; l++) {
+            uint8_t *px = q + l * along;
+            int p0 = px[-across], p1 = px[-2 * across], q0 = px[0], q1 = px[across];
+            if (abs(p0 - q0) >= alpha || abs(p1 - p0) >= beta || abs(q1 - q0) >= beta) {
+                continue;
+            }
+            if (chroma) {
+                if (bs[seg] < 4) {
+                    int tc = tc0 + 1;
+                    int delta = h264_clip((((q0 - p0) << 2) + (p1 - q1) + 4) >> 3, -tc, tc);
+                    px[-across] = h264_pixel(p0 + delta);
+                    px[0] = h264_pixel(q0 - delta);
+                } else {
+                    px[-across] = (uint8_t)((2 * p1 + p0 + q1 + 2) >> 2);
+                    px[0] = (uint8_t)((2 * q1 + q0 + p1 + 2) >> 2);
+                }
+                continue;
+            }
+            int p2 = px[-3 * across], q2 = px[2 * across];
+            bool ap = abs(p2 - p0) < beta, aq = abs(q2 - q0) < beta;
+            if (bs[seg] < 4) {
+                int tc = tc0 + ap + aq;
+                int delta = h264_clip((((q0 - p0) << 2) + (p1 - q1) + 4) >> 3, -tc, tc);
+                if (ap) {
+                    px[-2 * across] = (uint8_t)(p1 + h264_clip((p2 + ((p0 + q0 + 1) >> 1) - (p1 << 1)) >> 1, -tc0, tc0));
+                }
+                if (aq) {
+                    px[across] = (uint8_t)(q1 + h264_clip((q2 + ((p0 + q0 + 1) >> 1) - (q1 << 1)) >> 1, -tc0, tc0));
+                }
+                px[-across] = h264_pixel(p0 + delta);
+                px[0] = h264_pixel(q0 - delta);
+            } else {
+                int p3 = px[-4 * across], q3 = px[3 * across];
+                bool strong = abs(p0 - q0) < ((alpha >> 2) + 2);
+                if (ap && strong) {
+                    px[-across] = (uint8_t)((p2 + 2 * p1 + 2 * p0 + 2 * q0 + q1 + 4) >> 3);
+                    px[-2 * across] = (uint8_t)((p2 + p1 + p0 + q0 + 2) >> 2);
+                    px[-3 * across] = (uint8_t)((2 * p3 + 3 * p2 + p1 + p0 + q0 + 4) >> 3);
+                } else {
+                    px[-across] = (uint8_t)((2 * p1 + p0 + q1 + 2) >> 2);
+                }
+                if (aq && strong) {
+                    px[0] = (uint8_t)((p1 + 2 * p0 + 2 * q0 + 2 * q1 + q2 + 4) >> 3);
+                    px[across] = (uint8_t)((p0 + q0 + q1 + q2 + 2) >> 2);
+                    px[2 * across] = (uint8_t)((2 * q3 + 3 * q2 + q1 + q0 + p0 + 4) >> 3);
+                } else {
+                    px[0] = (uint8_t)((2 * q1 + q0 + p1 + 2) >> 2);
+                }
+            }
+        }
+    }
+}
+
+static uint8_t h264_edge_strength(const h264_mb_t *p, int pb, const h264_mb_t *q, int qb, bool mb_edge) {
+    if (p->type == H264_MB_INTRA || q->type == H264_MB_INTRA) {
+        return mb_edge ? 4 : 3;
+    }
+    if (p->nz[pb] || q->nz[qb]) {
+        return 2;
+    }
+    return abs(p->mv[0] - q->mv[0]) >= 4 || abs(p->mv[1] - q->mv[1]) >= 4;
+}
+
+static void h264_deblock(h264_enc_t *e) {
+    for (int mby = 0; mby < e->mb_h; mby++) {
+        for (int mbx = 0; mbx < e->mb_w; mbx++) {
+            const h264_mb_t *q = &e->mbs[mby * e->mb_w + mbx];
+            uint8_t *y = e->rec[0] + mby * 16 * e->stride + mbx * 16;
+            uint8_t *u = e->rec[1] + mby * 8 * e->cstride + mbx * 8;
+            uint8_t *v = e->rec[2] + mby * 8 * e->cstride + mbx * 8;
+            // dir 0: vertical edges, filtered across x; dir 1: horizontal
+            for (int dir = 0; dir < 2; dir++) {
+                const h264_mb_t *nb = dir ? h264_mb_at(e, mbx, mby - 1) : h264_mb_at(e, mbx - 1, mby);
+                int across = dir ? e->stride : 1, along = dir ? 1 : e->stride;
+                int cacross = dir ? e->cstride : 1, calong = dir ? 1 : e->cstride;
+                for (int edge = 0; edge < 4; edge++) {
+                    const h264_mb_t *p = edge ? q : nb;
+                    if (!p) {
+                        continue;
+                    }
+                    uint8_t bs[4];
+                    bool any = false;
+                    for (int k = 0; k < 4; k++) {
+                        int qb = dir ? edge * 4 + k : k * 4 + edge;
+                        int pb = edge ? (dir ? qb - 4 : qb - 1) : (dir ? 12 + k : k * 4 + 3);
+                        bs[k] = h264_edge_strength(p, pb, q, qb, edge == 0);
+                        any |= bs[k] != 0;
+                    }
+                    if (!any) {
+                        continue;
+                    }
+                    int qp = (p->qp + q->qp + 1) >> 1;
+                    h264_filter_edge(y + edge * 4 * across, across, along, 4, bs, qp, false);
+                    if (!(edge & 1)) {
+                        int cqp = (h264_chroma_qp[p->qp] + h264_chroma_qp[q->qp] + 1) >> 1;
+                        h264_filter_edge(u + edge * 2 * cacross, cacross, calong, 2, bs, cqp, true);
+                        h264_filter_edge(v + edge * 2 * cacross, cacross, calong, 2, bs, cqp, true);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Encoder
+
+// Bytes of storage h264_enc_init() needs for frames up to width x height
+static size_t h264_enc_mem_size(int width, int height) {
+    size_t mb_w = (size_t)(width + 15) / 16, mb_h = (size_t)(height + 15) / 16;
+    return mb_w * mb_h * (2 * 384 + sizeof(h264_mb_t));
+}
+
+static h264_enc_config_t h264_enc_default_config(int width, int height) {
+    return (h264_enc_config_t){
+        .width = (uint16_t)width,
+        .height = (uint16_t)height,
+        .fps = 10,
+        .bitrate = 500000,
+        .gop = 50,
+        .qp = 30,
+        .qp_min = 18,
+        .qp_max = 46,
+        .search = 16,
+        .deblock = true,
+    };
+}
+
+// Set up for cfg->width x cfg->height in `mem` (h264_enc_mem_size() bytes
+// for at least that size). The first frame is an IDR.
+static bool h264_enc_init(h264_enc_t *e, const h264_enc_config_t *cfg, void *mem, size_t mem_size) {
+    if (cfg->width < 16 || cfg->height < 16 || (cfg->width & 1) || (cfg->height & 1)
+        || cfg->width > H264_MAX_WIDTH || cfg->height > H264_MAX_HEIGHT || cfg->fps == 0
+        || cfg->qp_min > cfg->qp_max || cfg->qp_max > 51 || !mem
+        || h264_enc_mem_size(cfg->width, cfg->height) > mem_size) {
+        return false;
+    }
+    memset(e, 0, sizeof(*e));
+    e->cfg = *cfg;
+    if (e->cfg.gop == 0) {
+        e->cfg.gop = 1;
+    }
+    e->mb_w = (cfg->width + 15) / 16;
+    e->mb_h = (cfg->height + 15) / 16;
+    e->stride = e->mb_w * 16;
+    e->cstride = e->mb_w * 8;
+    size_t luma = (size_t)e->stride * e->mb_h * 16, chroma = luma / 4;
+    uint8_t *p = mem;
+    for (int f = 0; f < 2; f++) {
+        uint8_t **planes = f ? e->rec : e->ref;
+        planes[0] = p;
+        planes[1] = p + luma;
+        planes[2] = p + luma + chroma;
+        p += luma + 2 * chroma;
+    }
+    e->mbs = (h264_mb_t *)p;
+    e->level_idc = h264_level_for(cfg);
+    e->qp = cfg->qp;
+    if (cfg->bitrate) {
+        // First IDR: guess from the bits per pixel it may spend
+        float bpp = H264_IDR_BITS_RATIO * (float)cfg->bitrate / cfg->fps / ((float)cfg->width * cfg->height);
+        e->qp = (int)lrintf(30 + 6 * log2f(H264_RC_START_BPP / bpp));
+    }
+    e->qp = h264_clip(e->qp, cfg->qp_min, cfg->qp_max);
+    e->idr_requested = true;
+    return true;
+}
+
+// Next frame is an IDR (a viewer joined, or packets were lost)
+static void h264_enc_request_idr(h264_enc_t *e) {
+    e->idr_requested = true;
+}
+
+// Change the rate control targets without restarting the stream. The SPS
+// of the next IDR carries the new frame rate and level.
+static void h264_enc_set_rate(h264_enc_t *e, uint32_t bitrate, uint16_t fps, uint16_t gop) {
+    e->cfg.bitrate = bitrate;
+    e->cfg.fps = fps ? fps : 1;
+    e->cfg.gop = gop ? gop : 1;
+    e->level_idc = h264_level_for(&e->cfg);
+}
+
+static float h264_qstep(int qp) {
+    return 0.625f * exp2f(qp / 6.0f);
+}
+
+static int h264_rc_qp(h264_enc_t *e, bool idr) {
+    const h264_enc_config_t *cfg = &e->cfg;
+    if (!cfg->bitrate) {
+        return h264_clip(cfg->qp, cfg->qp_min, cfg->qp_max);
+    }
+    float target = (float)cfg->bitrate / cfg->fps;
+    float want = target - (float)e->rc_buffer / cfg->fps;
+    if (want < target / 4) {
+        want = target / 4;
+    } else if (want > target * 2) {
+        want = target * 2;
+    }
+    if (idr) {
+        want *= H264_IDR_BITS_RATIO;
+    }
+    float cplx = e->rc_cplx[idr];
+    int qp;
+    if (cplx <= 0) {
+        // Nothing measured yet: a P-frame starts a little above the IDR
+        qp = idr ? e->qp : e->qp + 2;
+    } else if (!idr && e->rc_idle) {
+        // Still scene: hold the QP, refining the picture while there is budget left
+        qp = e->rc_buffer < 0 ? e->qp - 1 : e->qp;
+    } else {
+        qp = (int)lrintf(6.0f * log2f(cplx / want / 0.625f));
+        // An IDR may be finer than the P-frames before it, but not much coarser
+        qp = h264_clip(qp, e->qp - (idr ? 2 * H264_RC_MAX_STEP : H264_RC_MAX_STEP), e->qp + H264_RC_MAX_STEP);
+    }
+    return h264_clip(qp, cfg->qp_min, cfg->qp_max);
+}
+
+static void h264_rc_update(h264_enc_t *e, bool idr, int qp, size_t bytes) {
+    if (!e->cfg.bitrate) {
+        return;
+    }
+    float bits = (float)bytes * 8;
+    float cplx = bits * h264_qstep(qp);
+    int64_t target = e->cfg.bitrate / e->cfg.fps;
+    // A mostly skipped P-frame costs about the same at any QP: it says
+    // nothing about the next frame with motion in it
+    e->rc_idle = !idr && bits < target / 8;
+    if (idr || e->rc_cplx[0] <= 0) {
+        e->rc_cplx[idr] = cplx;
+    } else if (!e->rc_idle) {
+        e->rc_cplx[0] = (e->rc_cplx[0] + cplx) / 2;
+    }
+    e->rc_buffer += (int64_t)bits - target;
+    // A second's worth either way; beyond that the scene changed
+    int64_t limit = e->cfg.bitrate;
+    e->rc_buffer = e->rc_buffer < -limit ? -limit : e->rc_buffer > limit ? limit : e->rc_buffer;
+}
+
+static void h264_write_slice_header(h264_enc_t *e, h264_bs_t *bs, bool idr, int qp) {
+    h264_nal_start(bs, idr ? 3 : 2, idr ? H264_NAL_IDR : H264_NAL_SLICE);
+    h264_put_ue(bs, 0);                     // first_mb_in_slice
+    h264_put_ue(bs, idr ? 7 : 5);           // slice_type: I or P, all slices alike
+    h264_put_ue(bs, 0);                     // pic_parameter_set_id
+    h264_put(bs, H264_LOG2_MAX_FRAME_NUM, e->frame_num);
+    if (idr) {
+        h264_put_ue(bs, e->idr_pic_id);
+    } else {
+        h264_put(bs, 1, 0);                 // num_ref_idx_active_override_flag
+        h264_put(bs, 1, 0);                 // ref_pic_list_modification_flag_l0
+    }
+    if (idr) {
+        h264_put(bs, 1, 0);                 // no_output_of_prior_pics_flag
+        h264_put(bs, 1, 0);                 // long_term_reference_flag
+    } else {
+        h264_put(bs, 1, 0);                 // adaptive_ref_pic_marking_mode_flag
+    }
+    h264_put_se(bs, qp - 26);               // slice_qp_delta
+    h264_put_ue(bs, e->cfg.deblock ? 0 : 1);    // disable_deblocking_filter_idc
+    if (e->cfg.deblock) {
+        h264_put_se(bs, 0);                 // slice_alpha_c0_offset_div2
+        h264_put_se(bs, 0);                 // slice_beta_offset_div2
+    }
+}
+
+// Code one macroblock: decide the mode, reconstruct it into e->rec, write
+// its syntax. `skip_run` counts P_Skip macroblocks not written yet.
+static void h264_encode_mb(h264_enc_t *e, h264_bs_t *bs, const h264_picture_t *pic, int mbx, int mby,
+                           bool idr, int qp, uint32_t *skip_run) {
+    h264_mb_t *mb = &e->mbs[mby * e->mb_w + mbx];
+    h264_mb_pixels_t src;
+    h264_mb_coefs_t c;
+    uint8_t pred_y[256], pred_u[64], pred_v[64];
+    uint8_t *pred_c[2] = { pred_u, pred_v };
+    const uint8_t *src_c[2] = { src.u, src.v };
+    const uint8_t *pred_cc[2] = { pred_u, pred_v };
+    uint8_t *rec_y = e->rec[0] + mby * 16 * e->stride + mbx * 16;
+    uint8_t *rec_c[2] = {
+        e->rec[1] + mby * 8 * e->cstride + mbx * 8,
+        e->rec[2] + mby * 8 * e->cstride + mbx * 8,
+    };
+    int lambda = h264_lambda[qp];
+
+    h264_load_src(e, pic, mbx, mby, &src);
+    memset(mb, 0, sizeof(*mb));
+    mb->qp = (uint8_t)qp;
+
+    if (!idr) {
+        int16_t mvp[2], mv_skip[2], mv[2];
+        h264_mv_pred(e, mbx, mby, mvp);
+        h264_mv_skip(e, mbx, mby, mv_skip);
+
+        // Early skip: the skip vector already predicts well, and nothing survives quantization
+        int x = mbx * 16 + (mv_skip[0] >> 2), y = mby * 16 + (mv_skip[1] >> 2);
+        int sad_skip = h264_sad_ref(e, src.y, x, y);
+        if (sad_skip < lambda * 64) {
+            h264_mc_luma(e, x, y, pred_y);
+            h264_mc_chroma(e, mbx, mby, mv_skip, pred_u, pred_v);
+            mb->type = H264_MB_INTER;
+            mb->mv[0] = mv_skip[0];
+            mb->mv[1] = mv_skip[1];
+            h264_luma_inter(src.y, pred_y, qp, &c, mb, rec_y, e->stride);
+            h264_chroma(src_c, pred_cc, qp, false, &c, mb, rec_c, e->cstride);
+            if (!c.cbp_luma && !c.cbp_chroma) {
+                mb->type = H264_MB_SKIP;
+                (*skip_run)++;
+                e->stats.skip_mbs++;
+                return;
+            }
+        }
+
+        int inter_cost = h264_motion_search(e, mbx, mby, src.y, mvp, mv_skip, lambda, mv);
+        // Intra only pays when motion compensation leaves a real error
+        int intra_sad = INT32_MAX / 2, i16 = H264_I16_DC;
+        uint8_t pred_i[256];
+        if (inter_cost >= H264_INTRA_MIN_COST) {
+            i16 = h264_choose_i16(e, mbx, mby, src.y, pred_i, &intra_sad);
+        }
+        if (intra_sad + lambda * 24 >= inter_cost) {
+            memset(mb, 0, sizeof(*mb));
+            mb->qp = (uint8_t)qp;
+            mb->type = H264_MB_INTER;
+            mb->mv[0] = mv[0];
+            mb->mv[1] = mv[1];
+            h264_mc_luma(e, mbx * 16 + (mv[0] >> 2), mby * 16 + (mv[1] >> 2), pred_y);
+            h264_mc_chroma(e, mbx, mby, mv, pred_u, pred_v);
+            h264_luma_inter(src.y, pred_y, qp, &c, mb, rec_y, e->stride);
+            h264_chroma(src_c, pred_cc, qp, false, &c, mb, rec_c, e->cstride);
+            int cbp = c.cbp_luma | c.cbp_chroma << 4;
+            if (!cbp && mv[0] == mv_skip[0] && mv[1] == mv_skip[1]) {
+                mb->type = H264_MB_SKIP;
+                (*skip_run)++;
+                e->stats.skip_mbs++;
+                return;
+            }
+            h264_put_ue(bs, *skip_run);
+            *skip_run = 0;
+            h264_put_ue(bs, 0);             // P_L0_16x16
+            h264_put_se(bs, mv[0] - mvp[0]);
+            h264_put_se(bs, mv[1] - mvp[1]);
+            h264_put_ue(bs, h264_inter_cbp_code[cbp]);
+            if (cbp) {
+                h264_put_se(bs, 0);         // mb_qp_delta
+                h264_write_residual(e, bs, mbx, mby, &c, false);
+            }
+            e->stats.inter_mbs++;
+            return;
+        }
+        memset(mb, 0, sizeof(*mb));
+        mb->qp = (uint8_t)qp;
+        memcpy(pred_y, pred_i, sizeof(pred_y));
+        mb->type = H264_MB_INTRA;
+        int cmode = h264_choose_chroma(e, mbx, mby, &src, pred_c);
+        h264_luma_i16(src.y, pred_y, qp, &c, mb, rec_y, e->stride);
+        h264_chroma(src_c, pred_cc, qp, true, &c, mb, rec_c, e->cstride);
+        h264_put_ue(bs, *skip_run);
+        *skip_run = 0;
+        h264_put_ue(bs, 5 + 1 + i16 + 4 * c.cbp_chroma + (c.cbp_luma ? 12 : 0));
+        h264_put_ue(bs, cmode);
+        h264_put_se(bs, 0);
+        h264_write_residual(e, bs, mbx, mby, &c, true);
+        e->stats.intra_mbs++;
+        return;
+    }
+
+    int sad;
+    mb->type = H264_MB_INTRA;
+    int i16 = h264_choose_i16(e, mbx, mby, src.y, pred_y, &sad);
+    int cmode = h264_choose_chroma(e, mbx, mby, &src, pred_c);
+    h264_luma_i16(src.y, pred_y, qp, &c, mb, rec_y, e->stride);
+    h264_chroma(src_c, pred_cc, qp, true, &c, mb, rec_c, e->cstride);
+    h264_put_ue(bs, 1 + i16 + 4 * c.cbp_chroma + (c.cbp_luma ? 12 : 0));
+    h264_put_ue(bs, cmode);
+    h264_put_se(bs, 0);                     // mb_qp_delta
+    h264_write_residual(e, bs, mbx, mby, &c, true);
+    e->stats.intra_mbs++;
+}
+
+// Encode one frame (e->cfg.width x height, I420) into `out` as an Annex-B
+// access unit: SPS, PPS and an IDR slice, or a P slice. Returns its length,
+// or 0 if it did not fit in `cap` (the frame is dropped, and the stream
+// carries on from the previous one).
+static size_t h264_enc_encode(h264_enc_t *e, const h264_picture_t *pic, uint8_t *out, size_t cap) {
+    bool idr = e->idr_requested || !e->have_ref || e->since_idr >= e->cfg.gop;
+    int qp = h264_rc_qp(e, idr);
+    h264_bs_t bs = { .buf = out, .cap = cap };
+    if (idr) {
+        h264_write_sps(&e->cfg, e->level_idc, &bs);
+        h264_write_pps(&bs);
+        e->frame_num = 0;
+    }
+    h264_write_slice_header(e, &bs, idr, qp);
+
+    uint32_t skip_run = 0;
+    for (int mby = 0; mby < e->mb_h && !bs.overflow; mby++) {
+        for (int mbx = 0; mbx < e->mb_w; mbx++) {
+            h264_encode_mb(e, &bs, pic, mbx, mby, idr, qp, &skip_run);
+        }
+    }
+    if (skip_run) {
+        h264_put_ue(&bs, skip_run);
+    }
+    h264_rbsp_trailing(&bs);
+    if (bs.overflow) {
+        e->stats.dropped++;
+        // Try the next frame much coarser
+        e->qp = h264_clip(qp + 6, e->cfg.qp_min, e->cfg.qp_max);
+        return 0;
+    }
+
+    if (e->cfg.deblock) {
+        h264_deblock(e);
+    }
+    for (int i = 0; i < 3; i++) {
+        uint8_t *t = e->ref[i];
+        e->ref[i] = e->rec[i];
+        e->rec[i] = t;
+    }
+    e->have_ref = true;
+    h264_rc_update(e, idr, qp, bs.len);
+    e->qp = qp;
+    e->frame_num = (e->frame_num + 1) & ((1u << H264_LOG2_MAX_FRAME_NUM) - 1);
+    if (idr) {
+        e->idr_requested = false;
+        e->idr_pic_id++;
+        e->since_idr = 0;
+        e->stats.idr_frames++;
+    }
+    e->since_idr++;
+    e->stats.frames++;
+    e->stats.bytes += bs.len;
+    e->stats.last_bytes = (uint32_t)bs.len;
+    e->stats.last_qp = (uint8_t)qp;
+    e->stats.last_idr = idr;
+    return bs.len;
+}
+
+// The decoded picture of the last frame encoded (what a decoder shows)
+static h264_picture_t h264_enc_recon(const h264_enc_t *e) {
+    return (h264_picture_t){ e->ref[0], e->ref[1], e->ref[2], e->stride, e->cstride };
+}
+
+// Packed YUYV (the sensor's YUV422) to I420, averaging chroma over row pairs
+static void h264_yuyv_to_i420(const uint8_t *yuyv, int width, int height, uint8_t *y, uint8_t *u, uint8_t *v) {
+    for (int row = 0; row < height; row += 2) {
+        const uint8_t *s0 = yuyv + (size_t)row * width * 2, *s1 = s0 + width * 2;
+        uint8_t *y0 = y + (size_t)row * width, *y1 = y0 + width;
+        uint8_t *pu = u + (size_t)(row / 2) * (width / 2), *pv = v + (size_t)(row / 2) * (width / 2);
+        for (int x = 0; x < width / 2; x++) {
+            y0[2 * x] = s0[4 * x];
+            y0[2 * x + 1] = s0[4 * x + 2];
+            y1[2 * x] = s1[4 * x];
+            y1[2 * x + 1] = s1[4 * x + 2];
+            pu[x] = (uint8_t)((s0[4 * x + 1] + s1[4 * x + 1] + 1) >> 1);
+            pv[x] = (uint8_t)((s0[4 * x + 3] + s1[4 * x + 3] + 1) >> 1);
+        }
+    }
+}
@@ -0,0 +1,357 @@
+#pragma once
+
+// H.264 streaming mode (CONFIG_TRAIN_H264, menu "H.264 Stream").
+//
+// With /config?codec=h264 the sensor sends YUV422 at h264_size instead of
+// JPEG (camera.h), and this task encodes it with the software encoder in
+// h264_enc.h, paced to h264_fps, while somebody is watching:
+//   - /h264 on the stream server: the Annex-B byte stream on the raw
+//     socket, one vectored send per access unit (stream_sock.h). Plays in
+//     ffplay/VLC, and ffmpeg can copy it into an MP4 without re-encoding.
+//   - UDP receivers set up with proto=h264: RTP (RFC 6184), sent by
+//     udp_send_h264() from this task.
+// A new viewer makes the next frame an IDR, and HTTP clients get nothing
+// before their first IDR. A client that takes no data for stream_timeout
+// ms is closed; a slow one holds up the others, so there are only a few
+// (CONFIG_TRAIN_H264_MAX_CLIENTS). MJPEG consumers (/stream, /capture,
+// the detector and the JPEG UDP targets) wait while the mode is on.
+//
+// The encoder, frame and bitstream buffers are taken from PSRAM the first
+// time the mode runs at a size, and kept. The task runs on core 1 below
+// the stream and UDP tasks, so their sends go first.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#if CONFIG_TRAIN_H264
+
+#include <esp_http_server.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_camera.h>
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+#include "camera.h"
+#include "h264_enc.h"
+#include "stream_sock.h"
+#include "runtime_config.h"
+#include "power.h"
+#include "trace.h"
+#include "udp.h"
+
+#define H264_LOG_INTERVAL_US 10000000
+#define H264_AU_BYTES_PER_PIXEL 1   // Access unit buffer; an IDR at qp_min fits easily
+
+static const char *H264_TAG = "H264";
+
+typedef struct {
+    int fd;                     // -1 = free
+    httpd_handle_t handle;
+    httpd_req_t *req;           // Async copy of the request, completed when the client goes
+    bool started;               // Has had an IDR; P-frames before one are useless to it
+    uint32_t frames;
+} h264_client_t;
+
+static h264_enc_t h264_enc;
+static uint8_t *h264_mem = NULL;        // Encoder storage, then I420 input, then the access unit
+static size_t h264_mem_pixels = 0;      // Frame size the buffers were taken for
+static uint8_t *h264_i420 = NULL;
+static uint8_t *h264_au = NULL;
+static size_t h264_au_cap = 0;
+static h264_client_t h264_clients[CONFIG_TRAIN_H264_MAX_CLIENTS];
+static SemaphoreHandle_t h264_clients_mutex = NULL;     // Joins; the task owns sends and closes
+static TaskHandle_t h264_task_handle = NULL;
+static stream_sock_stats_t h264_sock_stats;
+
+// Encoder settings for the runtime config at `width` x `height`
+static h264_enc_config_t h264_stream_config(const train_config_t *cfg, int width, int height) {
+    h264_enc_config_t enc = h264_enc_default_config(width, height);
+    enc.bitrate = (uint32_t)cfg->h264_kbps * 1000;
+    enc.fps = cfg->h264_fps;
+    enc.gop = cfg->h264_gop;
+    return enc;
+}
+
+// level_idc the encoder signals with the current config, for the SDP
+static uint8_t h264_stream_level_idc(void) {
+    train_config_t cfg;
+    runtime_config_get(&cfg);
+    framesize_t fs = runtime_h264_framesizes[cfg.h264_size];
+    h264_enc_config_t enc = h264_stream_config(&cfg, resolution[fs].width, resolution[fs].height);
+    return h264_level_for(&enc);
+}
+
+// Buffers for frames up to `width` x `height`, from PSRAM
+static bool h264_buffers(int width, int height) {
+    size_t pixels = (size_t)width * height;
+    if (pixels <= h264_mem_pixels) {
+        return true;
+    }
+    heap_caps_free(h264_mem);
+    size_t enc_size = h264_enc_mem_size(width, height);
+    size_t au_cap = pixels * H264_AU_BYTES_PER_PIXEL;
+    h264_mem = heap_caps_malloc(enc_size + pixels * 3 / 2 + au_cap, MALLOC_CAP_SPIRAM);
+    if (!h264_mem) {
+        h264_mem_pixels = 0;
+        return false;
+    }
+    h264_i420 = h264_mem + enc_size;
+    h264_au = h264_i420 + pixels * 3 / 2;
+    h264_au_cap = au_cap;
+    h264_mem_pixels = pixels;
+    ESP_LOGI(H264_TAG, "%u KB of PSRAM for %dx%d", (unsigned)((enc_size + pixels * 3 / 2 + au_cap) / 1024),
+        width, height);
+    return true;
+}
+
+static int h264_client_count(void) {
+    int n = 0;
+    xSemaphoreTake(h264_clients_mutex, portMAX_DELAY);
+    for (int i = 0; i < CONFIG_TRAIN_H264_MAX_CLIENTS; i++) {
+        n += h264_clients[i].fd >= 0;
+    }
+    xSemaphoreGive(h264_clients_mutex);
+    return n;
+}
+
+static void h264_client_close(int id, const char *why) {
+    xSemaphoreTake(h264_clients_mutex, portMAX_DELAY);
+    h264_client_t c = h264_clients[id];
+    h264_clients[id] = (h264_client_t){ .fd = -1 };
+    xSemaphoreGive(h264_clients_mutex);
+
+    ESP_LOGI(H264_TAG, "Client %d %s after %lu frames", id, why, (unsigned long)c.frames);
+    // httpd never saw a response on this socket; just close it
+    httpd_req_async_handler_complete(c.req);
+    httpd_sess_trigger_close(c.handle, c.fd);
+    power_client_disconnected();
+}
+
+// Send one access unit to every HTTP client that can use it
+static void h264_clients_send(const uint8_t *au, size_t len, bool idr, uint32_t timeout_ms) {
+    for (int i = 0; i < CONFIG_TRAIN_H264_MAX_CLIENTS; i++) {
+        xSemaphoreTake(h264_clients_mutex, portMAX_DELAY);
+        h264_client_t *c = &h264_clients[i];
+        bool send = c->fd >= 0 && (c->started || idr);
+        int fd = c->fd;
+        xSemaphoreGive(h264_clients_mutex);
+        if (!send) {
+            continue;
+        }
+
+        struct iovec iov = { .iov_base = (void *)au, .iov_len = len };
+        TRACE_BEGIN(trace_stream_send, len);
+        uint32_t mark = alloc_audit_lib_begin();
+        int rc = stream_sock_sendv(fd, &iov, 1, timeout_ms, &h264_sock_stats);
+        alloc_audit_lib_end(mark);
+        TRACE_END(trace_stream_send, rc == 0 ? len : 0);
+        if (rc != 0) {
+            h264_client_close(i, errno == ETIMEDOUT ? "evicted (stalled)"
+                : errno == EPIPE || errno == ECONNRESET ? "disconnected" : "send failed");
+            continue;
+        }
+        c->started = true;
+        c->frames++;
+        wifi_count_tx(len);
+    }
+}
+
+static void h264_log_stats(const h264_enc_stats_t *from, int64_t elapsed_us, int64_t encode_us) {
+    const h264_enc_stats_t *st = &h264_enc.stats;
+    uint32_t frames = st->frames - from->frames;
+    uint32_t mbs = (st->skip_mbs - from->skip_mbs) + (st->inter_mbs - from->inter_mbs)
+        + (st->intra_mbs - from->intra_mbs);
+    if (frames == 0) {
+        return;
+    }
+    ESP_LOGI(H264_TAG, "%dx%d: %.1f fps, %lu kbit/s, QP %d, %lu%% skipped, %lu%% intra, %lu ms/frame, "
+        "%lu IDR, %lu dropped",
+        h264_enc.cfg.width, h264_enc.cfg.height, frames * 1000000.0f / elapsed_us,
+        (unsigned long)((st->bytes - from->bytes) * 8000 / elapsed_us), st->last_qp,
+        (unsigned long)(mbs ? (st->skip_mbs - from->skip_mbs) * 100 / mbs : 0),
+        (unsigned long)(mbs ? (st->intra_mbs - from->intra_mbs) * 100 / mbs : 0),
+        (unsigned long)(encode_us / frames / 1000),
+        (unsigned long)(st->idr_frames - from->idr_frames), (unsigned long)(st->dropped - from->dropped));
+}
+
+static void h264_task(void *arg) {
+    uint32_t config_version = 0;
+    int64_t due = 0;
+    bool idr = false;
+    bool ready = false;                 // h264_enc set up for the current frame size
+    int64_t last_log_time = esp_timer_get_time(), encode_us = 0;
+    h264_enc_stats_t logged = {0};
+
+    while (true) {
+        // Woken by a new viewer, which needs an IDR
+        if (camera_yuv_framesize == FRAMESIZE_INVALID) {
+            for (int i = 0; i < CONFIG_TRAIN_H264_MAX_CLIENTS; i++) {
+                if (h264_clients[i].fd >= 0) {
+                    h264_client_close(i, "closed (codec changed)");
+                }
+            }
+            ready = false;              // Start over with an IDR when the mode is back
+            idr |= ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000)) > 0;
+            continue;
+        }
+        if (h264_client_count() == 0 && !udp_h264_playing()) {
+            idr |= ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000)) > 0;
+            continue;
+        }
+
+        const train_config_t *cfg = runtime_config_lock(RUNTIME_READER_H264);
+        train_config_t snap = *cfg;
+        runtime_config_unlock(RUNTIME_READER_H264);
+
+        int64_t now = esp_timer_get_time();
+        if (due > now) {
+            idr |= ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS((due - now) / 1000)) > 0;
+        } else {
+            idr |= ulTaskNotifyTake(pdTRUE, 0) > 0;
+            due = now;
+        }
+        due += 1000000 / snap.h264_fps;
+
+        TRACE_BEGIN(trace_fb_wait, 0);
+        camera_fb_t *fb = camera_fb_get_any();
+        TRACE_END(trace_fb_wait, fb ? fb->len : 0);
+        if (!fb) {
+            continue;
+        }
+        if (fb->format != PIXFORMAT_YUV422 || (fb->width & 1) || (fb->height & 1)) {
+            camera_fb_return(fb);       // A JPEG frame from before a mode switch
+            continue;
+        }
+        int w = fb->width, h = fb->height;
+        if (!ready || w != h264_enc.cfg.width || h != h264_enc.cfg.height) {
+            h264_enc_config_t enc = h264_stream_config(&snap, w, h);
+            ready = h264_buffers(w, h) && h264_enc_init(&h264_enc, &enc, h264_mem, h264_enc_mem_size(w, h));
+            if (!ready) {
+                ESP_LOGE(H264_TAG, "No encoder for %dx%d (%u KB of PSRAM free)", w, h,
+                    (unsigned)(heap_caps_get_free_size(MALLOC_CAP_SPIRAM) / 1024));
+                camera_fb_return(fb);
+                vTaskDelay(pdMS_TO_TICKS(1000));
+                continue;
+            }
+            ESP_LOGI(H264_TAG, "Encoding %dx%d, level %d.%d", w, h, h264_enc.level_idc / 10, h264_enc.level_idc % 10);
+            config_version = snap.version;
+            logged = h264_enc.stats;
+        }
+        if (snap.version != config_version) {
+            h264_enc_set_rate(&h264_enc, (uint32_t)snap.h264_kbps * 1000, snap.h264_fps, snap.h264_gop);
+            config_version = snap.version;
+        }
+
+        size_t pixels = (size_t)w * h;
+        h264_picture_t pic = {
+            .y = h264_i420, .u = h264_i420 + pixels, .v = h264_i420 + pixels * 5 / 4,
+            .y_stride = w, .uv_stride = w / 2,
+        };
+        int64_t capture_us = (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+        // Convert and hand the frame buffer back before the slow part
+        h264_yuyv_to_i420(fb->buf, w, h, h264_i420, h264_i420 + pixels, h264_i420 + pixels * 5 / 4);
+        camera_fb_return(fb);
+
+        if (idr) {
+            h264_enc_request_idr(&h264_enc);
+            idr = false;
+        }
+        int64_t t0 = esp_timer_get_time();
+        size_t len = h264_enc_encode(&h264_enc, &pic, h264_au, h264_au_cap);
+        encode_us += esp_timer_get_time() - t0;
+        if (len == 0) {
+            ESP_LOGW(H264_TAG, "Frame over %u bytes dropped", (unsigned)h264_au_cap);
+            continue;
+        }
+
+        h264_clients_send(h264_au, len, h264_enc.stats.last_idr, (uint32_t)snap.stream_timeout_ms);
+        if (!udp_send_h264(h264_au, len, capture_us)) {
+            idr = true;                 // A receiver lost part of this frame
+        }
+        power_frame_sent();
+
+        now = esp_timer_get_time();
+        if (now - last_log_time >= H264_LOG_INTERVAL_US) {
+            h264_log_stats(&logged, now - last_log_time, encode_us);
+            logged = h264_enc.stats;
+            encode_us = 0;
+            last_log_time = now;
+        }
+    }
+}
+
+// Response headers for /h264 (no chunked encoding; the socket closes when
+// the stream ends)
+#define H264_RAW_RESPONSE \
+    "HTTP/1.1 200 OK\r\n" \
+    "Content-Type: video/h264\r\n" \
+    "Access-Control-Allow-Origin: *\r\n" \
+    "Cache-Control: no-cache, no-store, must-revalidate\r\n" \
+    "Connection: close\r\n\r\n"
+
+// H.264 stream handler - runs in stream server context: /h264
+// Sends the headers, hands the socket to the encoder task and returns.
+static esp_err_t h264_stream_handler(httpd_req_t *req) {
+    if (camera_yuv_framesize == FRAMESIZE_INVALID) {
+        httpd_resp_set_status(req, "409 Conflict");
+        return httpd_resp_send(req, "Not in H.264 mode (/config?codec=h264)", HTTPD_RESP_USE_STRLEN);
+    }
+
+    xSemaphoreTake(h264_clients_mutex, portMAX_DELAY);
+    int id = -1;
+    for (int i = 0; i < CONFIG_TRAIN_H264_MAX_CLIENTS && id < 0; i++) {
+        if (h264_clients[i].fd < 0 && h264_clients[i].req == NULL) {
+            id = i;
+        }
+    }
+    if (id >= 0) {
+        h264_clients[id].req = req;     // Reserved until the headers are out
+    }
+    xSemaphoreGive(h264_clients_mutex);
+    if (id < 0) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "5");
+        return httpd_resp_send(req, "Too many H.264 clients", HTTPD_RESP_USE_STRLEN);
+    }
+
+    int fd = httpd_req_to_sockfd(req);
+    stream_sock_tune(fd, 0);
+    struct iovec iov = { .iov_base = (void *)H264_RAW_RESPONSE, .iov_len = sizeof(H264_RAW_RESPONSE) - 1 };
+    stream_sock_stats_t header_stats = {0};
+    httpd_req_t *async = NULL;
+    int timeout_ms = runtime_config_lock(RUNTIME_READER_STREAM_HTTPD)->stream_timeout_ms;
+    runtime_config_unlock(RUNTIME_READER_STREAM_HTTPD);
+    bool ok = stream_sock_sendv(fd, &iov, 1, timeout_ms, &header_stats) == 0
+        && httpd_req_async_handler_begin(req, &async) == ESP_OK;
+
+    xSemaphoreTake(h264_clients_mutex, portMAX_DELAY);
+    h264_clients[id] = ok ? (h264_client_t){ .fd = fd, .handle = req->handle, .req = async }
+                          : (h264_client_t){ .fd = -1 };
+    xSemaphoreGive(h264_clients_mutex);
+    if (!ok) {
+        httpd_sess_trigger_close(req->handle, fd);
+        return ESP_OK;
+    }
+    ESP_LOGI(H264_TAG, "Client %d started", id);
+    power_client_connected();
+    xTaskNotifyGive(h264_task_handle);
+    return ESP_OK;
+}
+
+static void h264_stream_start(void) {
+    h264_clients_mutex = xSemaphoreCreateMutex();
+    for (int i = 0; i < CONFIG_TRAIN_H264_MAX_CLIENTS; i++) {
+        h264_clients[i].fd = -1;
+    }
+    xTaskCreatePinnedToCore(h264_task, "h264", 8192, NULL, 4, &h264_task_handle, 1);
+    udp_h264_task_handle = h264_task_handle;
+}
+
+#else
+
+static void h264_stream_start(void) {}
+
+#endif
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdlib.h>
 #include <esp_http_server.h>
 #include <esp_log.h>
 #include <esp_camera.h>
@@ -7,24 +8,510 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/semphr.h>
+#include <freertos/queue.h>
+#include <esp_heap_caps.h>
+#include <esp_attr.h>
+
+#include "http_template.h"
+#include "stream_sock.h"
+#include "frame_pool.h"
+#include "frame_dedup.h"
+#include "runtime_config.h"
+#include "trace.h"
+#include "ota.h"
+#include "h264_stream.h"
+
+#define STREAM_SCHED_MAX_CLIENTS CONFIG_TRAIN_STREAM_MAX_CLIENTS
+#include "stream_sched.h"
 
 #define MJPEG_BOUNDARY "frame"
 #define MJPEG_CONTENT_TYPE "multipart/x-mixed-replace;boundary=" MJPEG_BOUNDARY
-#define MJPEG_PART_HEADER "Content-Type: image/jpeg\r\nContent-Length: %zu\r\n\r\n"
-#define MJPEG_BOUNDARY_HEADER "\r\n--" MJPEG_BOUNDARY "\r\n"
+
+_Static_assert(sizeof(HTTP_TPL_STR8 HTTP_TPL_STR8 "@") - 3 >= CAMERA_PRESET_NAME_LEN - 1, "preset slot too narrow");
+_Static_assert(sizeof(HTTP_TPL_STR14 HTTP_TPL_STR8 "@@@") - 3 >= TRAIN_HUB_NAME_LEN - 1, "hub name slot too narrow");
+_Static_assert(TRAIN_HUB_MAX <= 10, "hub id slot is one digit");
 
 static const char *HTTP_TAG = "HTTP";
 
+// Response templates, compiled in start_http_server()
+static http_templates_t http_tpl;
+
 // Forward declaration of web UI handler
 static esp_err_t index_handler(httpd_req_t *req);
 
-// MJPEG stream handler - runs in stream server context
+// ---------------------------------------------------------------------------
+// Raw-socket stream sessions.
+//
+// The stream handler sends the response headers, hands the socket to the
+// stream task and returns, so the stream server is free for the next
+// client (httpd_req_async_handler_begin keeps httpd off the socket until
+// the session ends). A capture task copies camera frames into a fixed pool
+// (frame_pool.h) only while somebody is due for one. The stream task starts each frame on
+// the clients stream_sched.h picks and writes to all sockets from one
+// select() loop: a slow client skips frames, ?fps= caps a client, and a
+// client that takes nothing for stream_timeout ms (runtime_config.h) is
+// evicted. With CONFIG_TRAIN_DEDUP, the capture task reads each frame's
+// change signature and a client is not sent frames that match the last one
+// it got (frame_dedup.h), unless it asked for ?dedup=0.
+
+// One frame in flight per client, one ready for the stream task and one
+// being filled
+#define STREAM_POOL_LEN (CONFIG_TRAIN_STREAM_MAX_CLIENTS + 2)
+#define STREAM_MAX_FPS 30
+
+_Static_assert(STREAM_POOL_LEN <= FRAME_POOL_MAX, "stream pool too small");
+
+typedef struct {
+    int fd;                     // -1 = free
+    httpd_handle_t handle;
+    httpd_req_t *req;           // Async copy of the request, completed when the session ends
+    int frame;                  // Pool index in flight, -1 = none
+    char part_header[sizeof(HTTP_TPL_MJPEG_PART(MJPEG_BOUNDARY))];
+    struct iovec iov[2];
+    struct iovec *cur;
+    int iovcnt;
+#if CONFIG_TRAIN_DEDUP
+    bool dedup;
+    jpeg_dedup_t seen;          // Last frame sent
+#endif
+} stream_session_t;
+
+typedef struct {
+    int fd;
+    httpd_req_t *req;
+    uint32_t fps;
+    bool dedup;
+} stream_join_t;
+
+static frame_pool_t stream_pool;
+static SemaphoreHandle_t stream_pool_mutex = NULL;     // stream_pool calls, stream_want_us
+static int64_t stream_want_us = INT64_MAX;             // When the next frame is wanted
+static QueueHandle_t stream_join_queue = NULL;
+static TaskHandle_t stream_task_handle = NULL;
+static TaskHandle_t stream_capture_task_handle = NULL;
+static volatile int stream_client_count = 0;           // Admitted clients, raw and chunked
+
+// Stream task only
+static stream_sched_t stream_sched;
+static stream_session_t stream_sessions[CONFIG_TRAIN_STREAM_MAX_CLIENTS];
+static stream_sock_stats_t stream_stats;
+
+#if CONFIG_TRAIN_DEDUP
+// Signature of each pool slot's frame, written by the capture task with
+// the frame. Read once per frame, so PSRAM; the decoders stay internal.
+static EXT_RAM_BSS_ATTR jpeg_sig_t stream_sig[STREAM_POOL_LEN];
+static jpeg_sig_decoder_t stream_sig_dec;
+
+// The chunked path: its handler holds the stream server, so there is only
+// ever one
+static EXT_RAM_BSS_ATTR jpeg_sig_t stream_chunked_sig;
+static jpeg_dedup_t stream_chunked_seen;
+static jpeg_sig_decoder_t stream_chunked_dec;
+#endif
+
+// Admission: the stream server is the only caller, so check-then-add is safe
+static bool stream_client_reserve(void) {
+    int limit = runtime_config_lock(RUNTIME_READER_STREAM_HTTPD)->stream_clients;
+    runtime_config_unlock(RUNTIME_READER_STREAM_HTTPD);
+    if (stream_client_count >= limit) {
+        return false;
+    }
+    __atomic_add_fetch(&stream_client_count, 1, __ATOMIC_ACQ_REL);
+    power_client_connected();
+    return true;
+}
+
+static void stream_client_release(void) {
+    __atomic_sub_fetch(&stream_client_count, 1, __ATOMIC_ACQ_REL);
+    power_client_disconnected();
+}
+
+static void stream_frame_release(int frame) {
+    xSemaphoreTake(stream_pool_mutex, portMAX_DELAY);
+    frame_pool_unref(&stream_pool, frame);
+    xSemaphoreGive(stream_pool_mutex);
+}
+
+// Capture task: grab a frame whenever a client is due, copy it into a free
+// pool slot and return the camera buffer at once, so a slow client never
+// holds one of the driver's two frame buffers.
+static void stream_capture_task(void *arg) {
+    while (true) {
+        xSemaphoreTake(stream_pool_mutex, portMAX_DELAY);
+        int64_t want = stream_want_us;
+        xSemaphoreGive(stream_pool_mutex);
+        int64_t now = esp_timer_get_time();
+        if (want > now) {
+            ulTaskNotifyTake(pdTRUE, want == INT64_MAX ? portMAX_DELAY : pdMS_TO_TICKS((want - now) / 1000 + 1));
+            continue;
+        }
+
+        TRACE_BEGIN(trace_fb_wait, 0);
+        camera_fb_t *fb = camera_fb_get();
+        TRACE_END(trace_fb_wait, fb ? fb->len : 0);
+        if (!fb) {
+            ESP_LOGE(HTTP_TAG, "Camera capture failed");
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+
+        xSemaphoreTake(stream_pool_mutex, portMAX_DELAY);
+        int slot = frame_pool_acquire(&stream_pool, fb->len);
+        uint32_t oversize = stream_pool.oversize;
+        xSemaphoreGive(stream_pool_mutex);
+        if (slot < 0) {
+            // Only a frame too big for a slot: STREAM_POOL_LEN always leaves one free
+            if (fb->len > stream_pool.slot_size && oversize % 100 == 1) {
+                ESP_LOGW(HTTP_TAG, "%zu byte frame does not fit the stream pool (%lu dropped), raise "
+                    "CONFIG_TRAIN_STREAM_FRAME_KB", fb->len, (unsigned long)oversize);
+            }
+            camera_fb_return(fb);
+            continue;
+        }
+        TRACE_BEGIN(trace_capture, fb->len);
+        memcpy(stream_pool.slot[slot].buf, fb->buf, fb->len);
+        size_t len = fb->len;
+        camera_fb_return(fb);
+#if CONFIG_TRAIN_DEDUP
+        frame_dedup_sig(&stream_sig_dec, stream_pool.slot[slot].buf, len, &stream_sig[slot]);
+#endif
+        TRACE_END(trace_capture, len);
+
+        // Replaces a ready frame the stream task has not picked up yet
+        xSemaphoreTake(stream_pool_mutex, portMAX_DELAY);
+        frame_pool_publish(&stream_pool, slot, len);
+        stream_want_us = INT64_MAX;     // Until the stream task has dispatched it
+        xSemaphoreGive(stream_pool_mutex);
+        xTaskNotifyGive(stream_task_handle);
+    }
+}
+
+static void stream_session_open(const stream_join_t *join, int64_t now) {
+    int id = stream_sched_join(&stream_sched, join->fps, now);
+    if (id < 0) {
+        // Admission control keeps this from happening
+        httpd_handle_t handle = join->req->handle;
+        httpd_req_async_handler_complete(join->req);
+        httpd_sess_trigger_close(handle, join->fd);
+        stream_client_release();
+        return;
+    }
+    stream_session_t *s = &stream_sessions[id];
+    s->fd = join->fd;
+    s->handle = join->req->handle;
+    s->req = join->req;
+    s->frame = -1;
+#if CONFIG_TRAIN_DEDUP
+    s->dedup = join->dedup;
+    jpeg_dedup_reset(&s->seen);
+#endif
+    http_tpl_begin(&http_tpl.mjpeg_part, s->part_header);
+    ESP_LOGI(HTTP_TAG, "Stream client %d started (fps cap %lu%s)", id, (unsigned long)join->fps,
+        join->dedup ? "" : ", every frame");
+}
+
+static void stream_session_close(int id, const char *why, int64_t now) {
+    stream_session_t *s = &stream_sessions[id];
+    stream_client_t *c = &stream_sched.client[id];
+    uint32_t fps_x10 = stream_sched_fps_x10(c, now);
+    ESP_LOGI(HTTP_TAG, "Stream client %d %s: %lu frames, %lu.%lu fps, %lu skipped, %lu capped, %lu suppressed",
+        id, why, (unsigned long)c->frames, (unsigned long)(fps_x10 / 10), (unsigned long)(fps_x10 % 10),
+        (unsigned long)c->skipped, (unsigned long)c->capped, (unsigned long)c->suppressed);
+
+    if (s->frame >= 0) {
+        stream_frame_release(s->frame);
+        s->frame = -1;
+    }
+    // httpd never saw a response on this socket; just close it
+    httpd_req_async_handler_complete(s->req);
+    httpd_sess_trigger_close(s->handle, s->fd);
+    s->fd = -1;
+    stream_client_release();
+}
+
+// Start pool frame `frame` on the clients in `mask`
+static void stream_dispatch(int frame, uint32_t mask, fd_set *wfds, int *maxfd) {
+    const frame_slot_t *f = &stream_pool.slot[frame];
+    size_t header_len = http_tpl.mjpeg_part.len;
+
+    for (int i = 0; i < CONFIG_TRAIN_STREAM_MAX_CLIENTS; i++) {
+        if (!(mask & (1u << i))) {
+            continue;
+        }
+        stream_session_t *s = &stream_sessions[i];
+        http_tpl_set_uint(&http_tpl.mjpeg_part, s->part_header, 0, f->len);
+        s->iov[0] = (struct iovec){ .iov_base = s->part_header, .iov_len = header_len };
+        s->iov[1] = (struct iovec){ .iov_base = f->buf, .iov_len = f->len };
+        s->cur = s->iov;
+        s->iovcnt = 2;
+        s->frame = frame;
+        xSemaphoreTake(stream_pool_mutex, portMAX_DELAY);
+        frame_pool_ref(&stream_pool, frame);
+        xSemaphoreGive(stream_pool_mutex);
+
+        // Try at once; the send buffer is usually free
+        FD_SET(s->fd, wfds);
+        if (s->fd > *maxfd) {
+            *maxfd = s->fd;
+        }
+    }
+}
+
+#if CONFIG_TRAIN_DEDUP
+// Take the clients in `mask` whose last frame matches pool frame `frame`
+// back out of it
+static uint32_t stream_dedup(const train_config_t *cfg, int frame, uint32_t mask, int64_t now) {
+    for (int i = 0; i < CONFIG_TRAIN_STREAM_MAX_CLIENTS; i++) {
+        stream_session_t *s = &stream_sessions[i];
+        if ((mask & (1u << i)) && s->dedup
+            && !frame_dedup_check(cfg, &s->seen, &stream_sig[frame], stream_pool.slot[frame].len, now)) {
+            stream_sched_suppress(&stream_sched, i);
+            mask &= ~(1u << i);
+        }
+    }
+    return mask;
+}
+#endif
+
+static void stream_log_stats(int64_t now, uint32_t frames, int64_t elapsed_us) {
+    static stream_sock_stats_t logged;
+    for (int i = 0; i < CONFIG_TRAIN_STREAM_MAX_CLIENTS; i++) {
+        const stream_client_t *c = &stream_sched.client[i];
+        if (!c->active) {
+            continue;
+        }
+        uint32_t fps_x10 = stream_sched_fps_x10(c, now);
+        ESP_LOGI(HTTP_TAG, "Stream client %d: %lu.%lu fps, %lu skipped, %lu capped, %lu suppressed, %lu bytes queued avg",
+            i, (unsigned long)(fps_x10 / 10), (unsigned long)(fps_x10 % 10), (unsigned long)c->skipped,
+            (unsigned long)c->capped, (unsigned long)c->suppressed,
+            (unsigned long)(c->occupancy_samples ? c->occupancy_sum / c->occupancy_samples : 0));
+    }
+    if (frames > 0) {
+        ESP_LOGI(HTTP_TAG, "MJPEG stream: %.1f frames/s sent, %.2f sends/frame, %lu buffer waits",
+            frames * 1000000.0f / elapsed_us, (float)(stream_stats.sends - logged.sends) / frames,
+            (unsigned long)(stream_stats.waits - logged.waits));
+    }
+    logged = stream_stats;
+}
+
+// Stream task: owns the sessions and the scheduler
+static void stream_task(void *arg) {
+    uint32_t frames = 0;
+    uint32_t config_version = 0;
+    int64_t last_log_time = esp_timer_get_time();
+
+    while (true) {
+        // Wait for room on a busy socket, or for a new frame or client
+        fd_set wfds;
+        FD_ZERO(&wfds);
+        int maxfd = -1;
+        for (int i = 0; i < CONFIG_TRAIN_STREAM_MAX_CLIENTS; i++) {
+            if (stream_sessions[i].fd >= 0 && stream_sessions[i].frame >= 0) {
+                FD_SET(stream_sessions[i].fd, &wfds);
+                if (stream_sessions[i].fd > maxfd) {
+                    maxfd = stream_sessions[i].fd;
+                }
+            }
+        }
+        if (maxfd < 0) {
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+        } else {
+            // Frames and clients only notify, so poll for them every 10 ms
+            struct timeval tv = { .tv_sec = 0, .tv_usec = 10000 };
+            if (select(maxfd + 1, NULL, &wfds, NULL, &tv) <= 0) {
+                FD_ZERO(&wfds);
+            }
+            ulTaskNotifyTake(pdTRUE, 0);
+        }
+        int64_t now = esp_timer_get_time();
+
+        // Config changes land here, between frames
+        const train_config_t *cfg = runtime_config_lock(RUNTIME_READER_STREAM);
+        if (cfg->version != config_version) {
+            stream_sched.stall_us = (uint32_t)cfg->stream_timeout_ms * 1000u;
+            config_version = cfg->version;
+        }
+
+        stream_join_t join;
+        while (xQueueReceive(stream_join_queue, &join, 0) == pdTRUE) {
+            stream_session_open(&join, now);
+        }
+
+        // Newest camera frame, with the pool's reference until dispatched
+        xSemaphoreTake(stream_pool_mutex, portMAX_DELAY);
+        int frame = frame_pool_take(&stream_pool);
+        xSemaphoreGive(stream_pool_mutex);
+        if (frame >= 0) {
+            const frame_slot_t *f = &stream_pool.slot[frame];
+            uint32_t mask = stream_sched_frame(&stream_sched, f->id, http_tpl.mjpeg_part.len + f->len, now);
+#if CONFIG_TRAIN_DEDUP
+            mask = stream_dedup(cfg, frame, mask, now);
+#endif
+            TRACE_INSTANT(trace_dispatch, mask);
+            stream_dispatch(frame, mask, &wfds, &maxfd);
+            stream_frame_release(frame);
+        }
+        runtime_config_unlock(RUNTIME_READER_STREAM);
+
+        for (int i = 0; i < CONFIG_TRAIN_STREAM_MAX_CLIENTS; i++) {
+            stream_session_t *s = &stream_sessions[i];
+            if (s->fd < 0 || s->frame < 0 || !FD_ISSET(s->fd, &wfds)) {
+                continue;
+            }
+            TRACE_BEGIN(trace_stream_send, s->cur[0].iov_len);
+            uint32_t mark = alloc_audit_lib_begin();
+            ssize_t n = stream_sock_send_some(s->fd, &s->cur, &s->iovcnt, &stream_stats);
+            alloc_audit_lib_end(mark);
+            TRACE_END(trace_stream_send, n > 0 ? n : 0);
+            if (n < 0) {
+                stream_sched_leave(&stream_sched, i);
+                stream_session_close(i, errno == EPIPE || errno == ECONNRESET ? "disconnected" : "send failed", now);
+                continue;
+            }
+            if (stream_sched_sent(&stream_sched, i, (uint32_t)n, now)) {
+                wifi_count_tx(http_tpl.mjpeg_part.len + stream_pool.slot[s->frame].len);
+                stream_frame_release(s->frame);
+                s->frame = -1;
+                power_frame_sent();
+                frames++;
+            }
+        }
+
+        uint32_t stalled = stream_sched_stalled(&stream_sched, now);
+        for (int i = 0; i < CONFIG_TRAIN_STREAM_MAX_CLIENTS; i++) {
+            if (stalled & (1u << i)) {
+                stream_sched_evict(&stream_sched, i);
+                stream_session_close(i, "evicted (stalled)", now);
+            }
+        }
+
+        // Tell the capture task when the next frame is wanted
+        int64_t want = stream_sched_next_due(&stream_sched);
+        xSemaphoreTake(stream_pool_mutex, portMAX_DELAY);
+        bool sooner = want < stream_want_us;
+        stream_want_us = want;
+        xSemaphoreGive(stream_pool_mutex);
+        if (sooner) {
+            xTaskNotifyGive(stream_capture_task_handle);
+        }
+
+        if (now - last_log_time >= 5000000) {
+            stream_log_stats(now, frames, now - last_log_time);
+            frames = 0;
+            last_log_time = now;
+        }
+    }
+}
+
+static bool stream_sessions_start(void) {
+    train_config_t cfg;
+    runtime_config_get(&cfg);
+    stream_sched_init(&stream_sched, (uint32_t)cfg.stream_timeout_ms * 1000u);
+    for (int i = 0; i < CONFIG_TRAIN_STREAM_MAX_CLIENTS; i++) {
+        stream_sessions[i].fd = -1;
+        stream_sessions[i].frame = -1;
+    }
+    // The only allocation of the stream path: every slot, once
+    size_t slot_size = CONFIG_TRAIN_STREAM_FRAME_KB * 1024;
+    uint8_t *storage = heap_caps_malloc(STREAM_POOL_LEN * slot_size, MALLOC_CAP_SPIRAM);
+    if (!storage || !frame_pool_init(&stream_pool, storage, STREAM_POOL_LEN, slot_size)) {
+        return false;
+    }
+    stream_pool_mutex = xSemaphoreCreateMutex();
+    stream_join_queue = xQueueCreate(CONFIG_TRAIN_STREAM_MAX_CLIENTS, sizeof(stream_join_t));
+    if (!stream_pool_mutex || !stream_join_queue) {
+        return false;
+    }
+    // Both on core 1 with the stream server, away from WiFi and NimBLE
+    return xTaskCreatePinnedToCore(stream_task, "stream", 4096, NULL, 5, &stream_task_handle, 1) == pdPASS
+        && xTaskCreatePinnedToCore(stream_capture_task, "stream_cap", 3072, NULL, 5,
+               &stream_capture_task_handle, 1) == pdPASS;
+}
+
+// Response headers for the raw-socket stream (no chunked encoding; the
+// socket closes when the stream ends)
+#define MJPEG_RAW_RESPONSE \
+    "HTTP/1.1 200 OK\r\n" \
+    "Content-Type: " MJPEG_CONTENT_TYPE "\r\n" \
+    "Access-Control-Allow-Origin: *\r\n" \
+    "Cache-Control: no-cache, no-store, must-revalidate\r\n" \
+    "Pragma: no-cache\r\n" \
+    "Expires: 0\r\n" \
+    "Connection: close\r\n\r\n"
+
+// MJPEG stream handler - runs in stream server context: /stream[?fps=N][&chunked=1][&dedup=0]
+// On the raw socket (stream_sock.h), the session goes to the stream task
+// above and the handler returns at once. With ?chunked=1, or when
+// CONFIG_TRAIN_STREAM_RAW_SOCKET is off, the handler streams through
+// httpd's chunked encoding itself and holds the stream server while it
+// runs. ?dedup=0 sends every frame, unchanged or not (for recording).
 static esp_err_t stream_handler(httpd_req_t *req) {
     esp_err_t res = ESP_OK;
-    char part_header[64];
+
+#if CONFIG_TRAIN_STREAM_RAW_SOCKET
+    bool raw = true;
+#else
+    bool raw = false;
+#endif
+#if CONFIG_TRAIN_DEDUP
+    bool dedup = true;
+#else
+    bool dedup = false;
+#endif
+    uint32_t fps = 0;
+    char query[48];
+    char param[4];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        if (raw && httpd_query_key_value(query, "chunked", param, sizeof(param)) == ESP_OK) {
+            raw = strcmp(param, "0") == 0;
+        }
+        if (dedup && httpd_query_key_value(query, "dedup", param, sizeof(param)) == ESP_OK) {
+            dedup = strcmp(param, "0") != 0;
+        }
+        if (httpd_query_key_value(query, "fps", param, sizeof(param)) == ESP_OK) {
+            fps = (uint32_t)atoi(param);
+            if (fps > STREAM_MAX_FPS) {
+                fps = 0;
+            }
+        }
+    }
+
+    if (camera_yuv_framesize != FRAMESIZE_INVALID) {
+        httpd_resp_set_status(req, "409 Conflict");
+        return httpd_resp_send(req, "In H.264 mode: use /h264", HTTPD_RESP_USE_STRLEN);
+    }
+    if (!stream_client_reserve()) {
+        ESP_LOGW(HTTP_TAG, "Stream refused: %d clients", stream_client_count);
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "5");
+        return httpd_resp_send(req, "Too many stream clients", HTTPD_RESP_USE_STRLEN);
+    }
+
+    int fd = httpd_req_to_sockfd(req);
+    if (raw) {
+        if (!stream_sock_tune(fd, 0)) {
+            ESP_LOGW(HTTP_TAG, "TCP_NODELAY not set: %d", errno);
+        }
+        struct iovec iov = { .iov_base = (void *)MJPEG_RAW_RESPONSE, .iov_len = sizeof(MJPEG_RAW_RESPONSE) - 1 };
+        stream_sock_stats_t header_stats = {0};
+        httpd_req_t *async = NULL;
+        int timeout_ms = runtime_config_lock(RUNTIME_READER_STREAM_HTTPD)->stream_timeout_ms;
+        runtime_config_unlock(RUNTIME_READER_STREAM_HTTPD);
+        if (stream_sock_sendv(fd, &iov, 1, timeout_ms, &header_stats) != 0
+            || httpd_req_async_handler_begin(req, &async) != ESP_OK) {
+            stream_client_release();
+            httpd_sess_trigger_close(req->handle, fd);
+            return ESP_OK;
+        }
+        stream_join_t join = { .fd = fd, .req = async, .fps = fps, .dedup = dedup };
+        xQueueSend(stream_join_queue, &join, portMAX_DELAY);  // Never full: one entry per admitted client
+        xTaskNotifyGive(stream_task_handle);
+        return ESP_OK;
+    }
 
     res = httpd_resp_set_type(req, MJPEG_CONTENT_TYPE);
     if (res != ESP_OK) {
+        stream_client_release();
         return res;
     }
 
@@ -33,57 +520,84 @@ static esp_err_t stream_handler(httpd_req_t *req) {
     httpd_resp_set_hdr(req, "Pragma", "no-cache");
     httpd_resp_set_hdr(req, "Expires", "0");
 
-    ESP_LOGI(HTTP_TAG, "MJPEG stream started");
+    ESP_LOGI(HTTP_TAG, "MJPEG stream started (chunked, fps cap %lu%s)", (unsigned long)fps,
+        dedup ? "" : ", every frame");
+#if CONFIG_TRAIN_DEDUP
+    jpeg_dedup_reset(&stream_chunked_seen);
+#endif
 
+    char part_header[sizeof(HTTP_TPL_MJPEG_PART(MJPEG_BOUNDARY))];
+    size_t header_len = http_tpl_begin(&http_tpl.mjpeg_part, part_header);
     uint32_t frame_count = 0;
     int64_t last_log_time = esp_timer_get_time();
+    int64_t due = last_log_time;
 
     while (true) {
-        camera_fb_t *fb = esp_camera_fb_get();
+        // ?fps= pacing; otherwise camera_fb_get() waits for the next frame
+        // and a full socket blocks the send (up to send_wait_timeout)
+        if (fps) {
+            int64_t wait_us = due - esp_timer_get_time();
+            if (wait_us > 0) {
+                vTaskDelay(pdMS_TO_TICKS(wait_us / 1000));
+            }
+            due += 1000000 / fps;
+        }
+
+        TRACE_BEGIN(trace_fb_wait, 0);
+        camera_fb_t *fb = camera_fb_get();
+        TRACE_END(trace_fb_wait, fb ? fb->len : 0);
         if (!fb) {
             ESP_LOGE(HTTP_TAG, "Camera capture failed");
             vTaskDelay(pdMS_TO_TICKS(100));
             continue;
         }
-
-        // Send boundary
-        res = httpd_resp_send_chunk(req, MJPEG_BOUNDARY_HEADER, strlen(MJPEG_BOUNDARY_HEADER));
-        if (res != ESP_OK) {
-            esp_camera_fb_return(fb);
-            break;
+#if CONFIG_TRAIN_DEDUP
+        if (dedup) {
+            frame_dedup_sig(&stream_chunked_dec, fb->buf, fb->len, &stream_chunked_sig);
+            const train_config_t *cfg = runtime_config_lock(RUNTIME_READER_STREAM_HTTPD);
+            bool send = frame_dedup_check(cfg, &stream_chunked_seen, &stream_chunked_sig, fb->len, esp_timer_get_time());
+            runtime_config_unlock(RUNTIME_READER_STREAM_HTTPD);
+            if (!send) {
+                camera_fb_return(fb);
+                continue;
+            }
         }
+#endif
+
+        // Boundary and part header in one piece; only the length changes
+        http_tpl_set_uint(&http_tpl.mjpeg_part, part_header, 0, fb->len);
+        size_t frame_len = fb->len;
+        size_t part_len = header_len + frame_len;
 
-        // Send part header with content length
-        size_t header_len = snprintf(part_header, sizeof(part_header), MJPEG_PART_HEADER, fb->len);
+        TRACE_BEGIN(trace_chunk_send, part_len);
+        uint32_t mark = alloc_audit_lib_begin();
         res = httpd_resp_send_chunk(req, part_header, header_len);
-        if (res != ESP_OK) {
-            esp_camera_fb_return(fb);
-            break;
+        if (res == ESP_OK) {
+            res = httpd_resp_send_chunk(req, (const char *)fb->buf, fb->len);
         }
-
-        // Send JPEG data
-        res = httpd_resp_send_chunk(req, (const char *)fb->buf, fb->len);
-        esp_camera_fb_return(fb);
+        alloc_audit_lib_end(mark);
+        TRACE_END(trace_chunk_send, res == ESP_OK ? part_len : 0);
+        camera_fb_return(fb);
 
         if (res != ESP_OK) {
             break;
         }
+        wifi_count_tx(part_len);
 
+        power_frame_sent();
         frame_count++;
 
         // Log frame rate every 5 seconds
         int64_t now = esp_timer_get_time();
         if (now - last_log_time >= 5000000) {
-            float fps = (float)frame_count / ((now - last_log_time) / 1000000.0f);
-            ESP_LOGI(HTTP_TAG, "MJPEG stream: %.1f fps, frame size: %zu bytes", fps, fb->len);
+            float achieved = (float)frame_count / ((now - last_log_time) / 1000000.0f);
+            ESP_LOGI(HTTP_TAG, "MJPEG stream: %.1f fps, frame size: %zu bytes", achieved, frame_len);
             frame_count = 0;
             last_log_time = now;
         }
-
-        // Small yield
-        vTaskDelay(pdMS_TO_TICKS(10));
     }
 
+    stream_client_release();
     ESP_LOGI(HTTP_TAG, "MJPEG stream ended");
     return res;
 }
@@ -92,9 +606,17 @@ static esp_err_t stream_handler(httpd_req_t *req) {
 static esp_err_t capture_handler(httpd_req_t *req) {
     ESP_LOGI(HTTP_TAG, "Capture handler called!");
 
-    camera_fb_t *fb = esp_camera_fb_get();
+    if (camera_yuv_framesize != FRAMESIZE_INVALID) {
+        httpd_resp_set_status(req, "409 Conflict");
+        return httpd_resp_send(req, "No JPEG in H.264 mode", HTTPD_RESP_USE_STRLEN);
+    }
+    power_client_connected();
+    TRACE_BEGIN(trace_fb_wait, 0);
+    camera_fb_t *fb = camera_fb_get();
+    TRACE_END(trace_fb_wait, fb ? fb->len : 0);
     if (!fb) {
         ESP_LOGE(HTTP_TAG, "Camera capture failed");
+        power_client_disconnected();
         httpd_resp_send_500(req);
         return ESP_FAIL;
     }
@@ -106,18 +628,23 @@ static esp_err_t capture_handler(httpd_req_t *req) {
     httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.jpg");
 
     esp_err_t res = httpd_resp_send(req, (const char *)fb->buf, fb->len);
-    esp_camera_fb_return(fb);
+    wifi_count_tx(fb->len);
+    camera_fb_return(fb);
+    power_frame_sent();
+    power_client_disconnected();
 
     ESP_LOGI(HTTP_TAG, "Capture sent, result: %d", res);
     return res;
 }
 
-// Train control endpoint
+// Train control endpoint: /train?action=forward|backward|stop|status[&id=N]
+// Without an id the command goes to every ready hub.
 static esp_err_t train_handler(httpd_req_t *req) {
     char action[32] = {0};
-    char json[128];
+    char json[sizeof(HTTP_TPL_TRAIN_HEAD) + TRAIN_HUB_MAX * sizeof(HTTP_TPL_TRAIN_HUB) + 2];
+    int id = -1;
 
-    // Parse query string for action parameter
+    // Parse query string for action and id parameters
     size_t query_len = httpd_req_get_url_query_len(req);
     if (query_len > 0) {
         char query[64];
@@ -126,6 +653,13 @@ static esp_err_t train_handler(httpd_req_t *req) {
             if (httpd_query_key_value(query, "action", param, sizeof(param)) == ESP_OK) {
                 strncpy(action, param, sizeof(action) - 1);
             }
+            if (httpd_query_key_value(query, "id", param, sizeof(param)) == ESP_OK && strcmp(param, "all") != 0) {
+                id = atoi(param);
+                if (id < 0 || id >= train_hubs.count) {
+                    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown hub id");
+                    return ESP_FAIL;
+                }
+            }
         }
     }
 
@@ -133,26 +667,55 @@ static esp_err_t train_handler(httpd_req_t *req) {
     int rc = 0;
 
     if (strcmp(action, "forward") == 0) {
-        rc = train_send_command("F");
-        result = rc == 0 ? "forward" : "error";
+        rc = train_send_command(id, "F");
+        result = rc > 0 ? "forward" : "error";
     } else if (strcmp(action, "backward") == 0) {
-        rc = train_send_command("B");
-        result = rc == 0 ? "backward" : "error";
+        rc = train_send_command(id, "B");
+        result = rc > 0 ? "backward" : "error";
     } else if (strcmp(action, "stop") == 0) {
-        rc = train_send_command("S");
-        result = rc == 0 ? "stopped" : "error";
+        rc = train_send_command(id, "S");
+        result = rc > 0 ? "stopped" : "error";
     }
 
-    snprintf(json, sizeof(json),
-        "{\"action\":\"%s\",\"result\":\"%s\",\"state\":\"%s\"}",
-        action[0] ? action : "status",
-        result,
-        train_state_str()
-    );
+    train_hub_table_t hubs;
+    train_hub_snapshot(&hubs);
+
+    // "state" is the selected hub, or the most advanced one
+    const http_tpl_t *head = &http_tpl.train_head;
+    train_ble_state_t state = id >= 0 ? train_hub_display_state(&hubs, id) : train_hub_summary_state(&hubs);
+    size_t len = http_tpl_begin(head, json);
+    http_tpl_set_str(head, json, HTTP_TRAIN_ACTION, action[0] ? action : "status");
+    http_tpl_set_str(head, json, HTTP_TRAIN_RESULT, result);
+    http_tpl_set_str(head, json, HTTP_TRAIN_STATE, train_hub_state_str(state));
+    http_tpl_set_uint(head, json, HTTP_TRAIN_READY, train_hub_ready_count(&hubs));
+
+    const http_tpl_t *row = &http_tpl.train_hub;
+    for (int i = 0; i < hubs.count; i++) {
+        const train_hub_t *hub = &hubs.hubs[i];
+        char addr[18] = "";
+        if (hub->have_addr) {
+            train_hub_format_addr(hub->addr, addr, sizeof(addr));
+        }
+        if (i > 0) {
+            json[len++] = ',';
+        }
+        char *out = json + len;
+        len += http_tpl_begin(row, out);
+        http_tpl_set_uint(row, out, HTTP_HUB_ID, i);
+        http_tpl_set_str(row, out, HTTP_HUB_NAME, hub->name);
+        http_tpl_set_str(row, out, HTTP_HUB_ADDR, addr);
+        http_tpl_set_str(row, out, HTTP_HUB_STATE, train_hub_state_str(train_hub_display_state(&hubs, i)));
+        http_tpl_set_uint(row, out, HTTP_HUB_COMMANDS, hub->commands);
+        http_tpl_set_uint(row, out, HTTP_HUB_ERRORS, hub->errors);
+        http_tpl_set_uint(row, out, HTTP_HUB_LATENCY_MS, hub->last_latency_us / 1000);
+        http_tpl_set_uint(row, out, HTTP_HUB_MAX_LATENCY_MS, hub->max_latency_us / 1000);
+    }
+    json[len++] = ']';
+    json[len++] = '}';
 
     httpd_resp_set_type(req, "application/json");
     httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-    return httpd_resp_send(req, json, strlen(json));
+    return httpd_resp_send(req, json, len);
 }
 
 // Status endpoint
@@ -160,18 +723,518 @@ static esp_err_t status_handler(httpd_req_t *req) {
     ESP_LOGI(HTTP_TAG, "Status handler called!");
     sensor_t *sensor = esp_camera_sensor_get();
 
-    char json[256];
+    const http_tpl_t *tpl = &http_tpl.status;
+    char json[sizeof(HTTP_TPL_STATUS)];
+    size_t len = http_tpl_begin(tpl, json);
+    http_tpl_set_int(tpl, json, HTTP_STATUS_FRAMESIZE, sensor->status.framesize);
+    http_tpl_set_int(tpl, json, HTTP_STATUS_QUALITY, sensor->status.quality);
+    http_tpl_set_int(tpl, json, HTTP_STATUS_BRIGHTNESS, sensor->status.brightness);
+    http_tpl_set_int(tpl, json, HTTP_STATUS_CONTRAST, sensor->status.contrast);
+    http_tpl_set_int(tpl, json, HTTP_STATUS_SATURATION, sensor->status.saturation);
+    http_tpl_set_int(tpl, json, HTTP_STATUS_SHARPNESS, sensor->status.sharpness);
+    http_tpl_set_int(tpl, json, HTTP_STATUS_VFLIP, sensor->status.vflip);
+    http_tpl_set_int(tpl, json, HTTP_STATUS_HMIRROR, sensor->status.hmirror);
+    http_tpl_set_str(tpl, json, HTTP_STATUS_PRESET, camera_active_preset_name());
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, json, len);
+}
+
+// Power management status endpoint
+static esp_err_t power_handler(httpd_req_t *req) {
+    const http_tpl_t *tpl = &http_tpl.power;
+    char json[sizeof(HTTP_TPL_POWER)];
+    size_t len = http_tpl_begin(tpl, json);
+    http_tpl_set_str(tpl, json, HTTP_POWER_MODE, power_mode_str(power_policy.mode));
+    http_tpl_set_uint(tpl, json, HTTP_POWER_CLIENTS, power_policy.clients);
+    http_tpl_set_uint(tpl, json, HTTP_POWER_AVG_MA, power_policy_avg_current_ma(&power_policy));
+    http_tpl_set_uint(tpl, json, HTTP_POWER_WAKES, power_policy.wakes);
+    http_tpl_set_uint(tpl, json, HTTP_POWER_LAST_MS, power_policy.last_wake_latency_us / 1000);
+    http_tpl_set_uint(tpl, json, HTTP_POWER_AVG_MS, power_policy_avg_wake_latency_us(&power_policy) / 1000);
+    http_tpl_set_uint(tpl, json, HTTP_POWER_MAX_MS, power_policy.max_wake_latency_us / 1000);
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, json, len);
+}
+
+// BLE radio activity next to WiFi throughput: scheduler state per hub link,
+// scan backoff and the estimated BLE duty cycle
+static esp_err_t ble_handler(httpd_req_t *req) {
+    char json[1024];
+    ble_sched_t sched;
+    train_sched_snapshot(&sched);
+    uint32_t duty = ble_sched_duty_permille(&sched);
+    uint32_t avg = ble_sched_avg_duty_permille(&sched, esp_timer_get_time());
+
+    wifi_ap_record_t ap;
+    int rssi = esp_wifi_sta_get_ap_info(&ap) == ESP_OK ? ap.rssi : 0;
+
+    int len = snprintf(json, sizeof(json),
+        "{\"duty_pct\":%lu.%lu,\"avg_duty_pct\":%lu.%lu,"
+        "\"wifi\":{\"tx_kbps\":%lu,\"rssi\":%d,\"busy\":%s},"
+        "\"scan\":{\"active\":%s,\"narrow\":%s,\"bursts\":%lu,\"backoff_ms\":%lu,\"scan_s\":%lu},\"links\":[",
+        (unsigned long)(duty / 10), (unsigned long)(duty % 10),
+        (unsigned long)(avg / 10), (unsigned long)(avg % 10),
+        (unsigned long)sched.wifi_kbps, rssi,
+        sched.wifi_kbps >= sched.cfg.wifi_busy_kbps ? "true" : "false",
+        sched.scanning ? "true" : "false",
+        sched.scan_busy ? "true" : "false",
+        (unsigned long)sched.scan_bursts,
+        (unsigned long)ble_sched_backoff_ms(&sched),
+        (unsigned long)(sched.scan_us / 1000000)
+    );
+    for (int i = 0; i < sched.link_count && len < (int)sizeof(json); i++) {
+        const ble_sched_link_t *l = &sched.links[i];
+        len += snprintf(json + len, sizeof(json) - len,
+            "%s{\"id\":%d,\"connected\":%s,\"mode\":\"%s\",\"interval_ms\":%lu.%02lu,"
+            "\"latency\":%d,\"inflight\":%lu,\"switches\":%lu,\"active_s\":%lu}",
+            i ? "," : "", i, l->connected ? "true" : "false", ble_link_mode_str(l->mode),
+            (unsigned long)(l->itvl * 125 / 100), (unsigned long)(l->itvl * 125 % 100),
+            l->latency, (unsigned long)l->inflight, (unsigned long)l->switches,
+            (unsigned long)(l->active_us / 1000000));
+    }
+    if (len < (int)sizeof(json) - 2) {
+        strcpy(json + len, "]}");
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, json, strlen(json));
+}
+
+// Read an integer query parameter, returns false if absent or malformed
+static bool query_int(const char *query, const char *key, int *out) {
+    char value[16];
+    if (httpd_query_key_value(query, key, value, sizeof(value)) != ESP_OK) {
+        return false;
+    }
+    char *end;
+    long v = strtol(value, &end, 10);
+    if (end == value || *end != '\0') {
+        return false;
+    }
+    *out = (int)v;
+    return true;
+}
+
+// One hub's latest telemetry sample as JSON ("null" if none yet)
+static int telemetry_latest_json(char *out, size_t size, int slot, int64_t now) {
+    hub_tlm_sample_t s;
+    if (!train_telemetry_latest(slot, &s)) {
+        return snprintf(out, size, "null");
+    }
+    const hub_telemetry_t *t = &s.value;
+    bool tilt = t->flags & HUB_TLM_FLAG_TILT;
+    char pitch[8] = "null", roll[8] = "null";
+    if (tilt) {
+        snprintf(pitch, sizeof(pitch), "%d", t->pitch_ddeg);
+        snprintf(roll, sizeof(roll), "%d", t->roll_ddeg);
+    }
+    return snprintf(out, size,
+        "{\"age_ms\":%lld,\"seq\":%u,\"hub_ms\":%lu,\"battery_mv\":%u,\"battery_ma\":%d,"
+        "\"duty\":%d,\"pitch_ddeg\":%s,\"roll_ddeg\":%s,\"loop_avg_ms\":%u,\"loop_max_ms\":%u}",
+        (long long)((now - s.rx_us) / 1000), t->seq, (unsigned long)t->hub_ms,
+        t->battery_mv, t->battery_ma, t->motor_duty, pitch, roll, t->loop_avg_ms, t->loop_max_ms);
+}
+
+// Hub telemetry: latest sample per hub, optional history, rate control
+//   /telemetry                      -> latest sample of every hub
+//   /telemetry?id=0&history=120     -> hub 0 with its newest 120 samples
+//   /telemetry?rate=5               -> 5 frames/s from every hub (0 = off)
+// History rows are [age_ms, battery_mv, battery_ma, duty, loop_avg_ms,
+// loop_max_ms], oldest first. The response is sent in chunks.
+static esp_err_t telemetry_handler(httpd_req_t *req) {
+    char query[64] = {0};
+    int id = -1, history = 0, rate = -1;
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        char param[8];
+        if (httpd_query_key_value(query, "id", param, sizeof(param)) == ESP_OK && strcmp(param, "all") != 0) {
+            if (!query_int(query, "id", &id) || id < 0 || id >= train_hubs.count) {
+                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown hub id");
+                return ESP_FAIL;
+            }
+        }
+        if (query_int(query, "history", &history)) {
+            history = history < 0 ? 0 : history > TRAIN_TLM_RING_LEN ? TRAIN_TLM_RING_LEN : history;
+        }
+        if (query_int(query, "rate", &rate) && train_telemetry_set_rate(id, rate) < 0) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Rate must be 0-9");
+            return ESP_FAIL;
+        }
+    }
+
+    // Handlers run one at a time on the API server task, so one buffer will do
+    static EXT_RAM_BSS_ATTR hub_tlm_sample_t samples[TRAIN_TLM_RING_LEN];
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+    char buf[512];
+    int64_t now = esp_timer_get_time();
+    esp_err_t res = httpd_resp_send_chunk(req, "{\"hubs\":[", HTTPD_RESP_USE_STRLEN);
+    bool first = true;
+    for (int i = 0; i < train_hubs.count && res == ESP_OK; i++) {
+        if (id >= 0 && i != id) {
+            continue;
+        }
+        const hub_rx_t *rx = &train_tlm[i].rx;
+        int len = snprintf(buf, sizeof(buf),
+            "%s{\"id\":%d,\"rate_hz\":%u,\"frames\":%lu,\"crc_errors\":%lu,\"bad_frames\":%lu,\"latest\":",
+            first ? "" : ",", i, train_tlm[i].rate_hz,
+            (unsigned long)rx->frames, (unsigned long)rx->crc_errors, (unsigned long)rx->bad_frames);
+        len += telemetry_latest_json(buf + len, sizeof(buf) - len, i, now);
+        first = false;
+
+        if (history > 0) {
+            uint32_t n = train_telemetry_history(i, samples, history);
+            len += snprintf(buf + len, sizeof(buf) - len, ",\"history\":[");
+            for (uint32_t j = 0; j < n && res == ESP_OK; j++) {
+                // Flush well before a row could be truncated
+                if (len > (int)sizeof(buf) - 64) {
+                    res = httpd_resp_send_chunk(req, buf, len);
+                    len = 0;
+                }
+                const hub_telemetry_t *t = &samples[j].value;
+                len += snprintf(buf + len, sizeof(buf) - len, "%s[%lld,%u,%d,%d,%u,%u]",
+                    j ? "," : "", (long long)((now - samples[j].rx_us) / 1000),
+                    t->battery_mv, t->battery_ma, t->motor_duty, t->loop_avg_ms, t->loop_max_ms);
+            }
+            len += snprintf(buf + len, sizeof(buf) - len, "]");
+        }
+        len += snprintf(buf + len, sizeof(buf) - len, "}");
+        if (res == ESP_OK) {
+            res = httpd_resp_send_chunk(req, buf, len);
+        }
+    }
+    if (res == ESP_OK) {
+        res = httpd_resp_send_chunk(req, "]}", HTTPD_RESP_USE_STRLEN);
+    }
+    if (res == ESP_OK) {
+        res = httpd_resp_send_chunk(req, NULL, 0);
+    }
+    return res;
+}
+
+#if CONFIG_TRAIN_ALLOC_AUDIT
+// Allocation audit: /alloc?window_ms=N (1000-30000, default 5000). Counts
+// heap allocations per task while frames flow (alloc_audit.h). "pass" is
+// true if frames were captured and none of our tasks allocated outside
+// lwIP sends. The API server is blocked for the window.
+static esp_err_t alloc_handler(httpd_req_t *req) {
+    static alloc_audit_window_t window;     // Too big for the handler stack
+    int window_ms = 5000;
+
+    char query[32];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        query_int(query, "window_ms", &window_ms);
+    }
+    window_ms = window_ms < 1000 ? 1000 : window_ms > 30000 ? 30000 : window_ms;
+
+    alloc_audit_trace_start();
+    alloc_audit_begin(&window);
+    vTaskDelay(pdMS_TO_TICKS(window_ms));
+    alloc_audit_end(&window);
+    alloc_audit_trace_stop();
+    bool pass = alloc_audit_pass(&window);
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+    char buf[192];
+    int len = snprintf(buf, sizeof(buf), "{\"window_ms\":%lu,\"frames\":%lu,\"pass\":%s,\"dropped\":%lu,\"tasks\":[",
+        (unsigned long)window.window_ms, (unsigned long)window.frames, pass ? "true" : "false",
+        (unsigned long)alloc_audit_stats.dropped);
+    esp_err_t res = httpd_resp_send_chunk(req, buf, len);
+    bool first = true;
+    for (int i = 0; i < ALLOC_STATS_MAX_OWNERS && res == ESP_OK; i++) {
+        const alloc_owner_t *r = &window.delta[i];
+        if (!r->owner) {
+            continue;
+        }
+        const alloc_audit_subsystem_t *sub = alloc_audit_subsystem(r->label);
+        len = snprintf(buf, sizeof(buf),
+            "%s{\"task\":\"%s\",\"subsystem\":\"%s\",\"ours\":%s,\"allocs\":%lu,\"lib_allocs\":%lu,"
+            "\"frees\":%lu,\"bytes\":%lu}",
+            first ? "" : ",", r->label, sub->subsystem, sub->ours ? "true" : "false",
+            (unsigned long)r->allocs, (unsigned long)r->lib_allocs, (unsigned long)r->frees,
+            (unsigned long)r->bytes);
+        res = httpd_resp_send_chunk(req, buf, len);
+        first = false;
+    }
+    if (res == ESP_OK) {
+        res = httpd_resp_send_chunk(req, "]}", HTTPD_RESP_USE_STRLEN);
+    }
+    if (res == ESP_OK) {
+        res = httpd_resp_send_chunk(req, NULL, 0);
+    }
+    return res;
+}
+#endif
+
+#if CONFIG_TRAIN_CAMERA_SUPERVISOR
+// Camera health (camera_supervisor.h): state, fault counters, recovery
+// steps taken and the time to recover (MTTR) from a fault
+static esp_err_t health_handler(httpd_req_t *req) {
+    camera_health_t h;
+    camera_health_snapshot(&h);
+
+    char json[512];
+    int len = snprintf(json, sizeof(json),
+        "{\"state\":\"%s\",\"parked\":%s,\"grabs\":%lu,\"failures\":%lu,\"timeouts\":%lu,"
+        "\"late_frames\":%lu,\"faults\":%lu,\"sensor_resets\":%lu,\"restarts\":%lu,"
+        "\"restart_failures\":%lu,\"backoff_ms\":%lu,\"recoveries\":%lu,"
+        "\"mttr_ms\":{\"last\":%lu,\"avg\":%lu,\"max\":%lu},\"not_ok_ms\":%lu}",
+        camera_health_state_str(h.state), camera_health_parked(&h) ? "true" : "false",
+        (unsigned long)h.grabs, (unsigned long)h.failures, (unsigned long)h.timeouts,
+        (unsigned long)h.late_frames, (unsigned long)h.faults, (unsigned long)h.sensor_resets,
+        (unsigned long)h.restarts, (unsigned long)h.restart_failures, (unsigned long)h.backoff_ms,
+        (unsigned long)h.recoveries, (unsigned long)(h.last_recovery_us / 1000),
+        (unsigned long)(camera_health_avg_recovery_us(&h) / 1000), (unsigned long)(h.max_recovery_us / 1000),
+        (unsigned long)camera_health_down_ms(&h));
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, json, len);
+}
+#endif
+
+#if CONFIG_TRAIN_DETECT
+// Animal detector (detector.h): model, latest result, events, timing
+//   /detect            -> everything, with the last DETECT_EVENT_LOG events
+//   /detect?since=12   -> only events after event 12, for pollers
+// The box is in pixels of the frame the detector saw, null for class-vector
+// models or when nothing is there.
+static esp_err_t detect_handler(httpd_req_t *req) {
+    char query[32];
+    int since = 0;
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        query_int(query, "since", &since);
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+    static detect_state_t s;     // Handlers run one at a time on the API server task
+    detector_snapshot(&s);
+    char buf[512];
+    if (!s.running) {
+        int len = snprintf(buf, sizeof(buf), "{\"running\":false,\"error\":\"%s\"}", s.error ? s.error : "");
+        return httpd_resp_send(req, buf, len);
+    }
+
+    const nn_model_t *m = &detect_model;
+    int64_t now = esp_timer_get_time();
+    int len = snprintf(buf, sizeof(buf),
+        "{\"running\":true,\"model\":{\"input\":[%d,%d,%d],\"output\":[%d,%d,%d],\"layers\":%d,\"macs\":%lu,"
+        "\"classes\":[", m->in.h, m->in.w, m->in.c, m->out.h, m->out.w, m->out.c, m->layer_count,
+        (unsigned long)m->macs);
+    for (int c = 0; c < m->classes; c++) {
+        len += snprintf(buf + len, sizeof(buf) - len, "%s\"%s\"", c ? "," : "", m->labels[c]);
+    }
+    esp_err_t res = httpd_resp_send_chunk(req, buf, len);
+
+    const detect_result_t *r = &s.last;
+    if (res == ESP_OK) {
+        len = snprintf(buf, sizeof(buf), "]},\"last\":{\"frame\":%lu,\"age_ms\":%lld,\"class\":",
+            (unsigned long)s.last_frame, (long long)(s.runs ? (now - s.last_us) / 1000 : -1));
+        len += r->cls >= 0 ? snprintf(buf + len, sizeof(buf) - len, "\"%s\"", m->labels[r->cls])
+                           : snprintf(buf + len, sizeof(buf) - len, "null");
+        len += snprintf(buf + len, sizeof(buf) - len, ",\"confidence\":%u,\"scores\":[", r->confidence);
+        for (int c = 0; c < m->classes; c++) {
+            len += snprintf(buf + len, sizeof(buf) - len, "%s%u", c ? "," : "", r->scores[c]);
+        }
+        len += r->has_box
+            ? snprintf(buf + len, sizeof(buf) - len, "],\"box\":[%d,%d,%d,%d]}",
+                (int)(r->box[0] * s.frame_w), (int)(r->box[1] * s.frame_h),
+                (int)(r->box[2] * s.frame_w), (int)(r->box[3] * s.frame_h))
+            : snprintf(buf + len, sizeof(buf) - len, "],\"box\":null}");
+        res = httpd_resp_send_chunk(req, buf, len);
+    }
+
+    if (res == ESP_OK) {
+        uint32_t n = s.runs ? s.runs : 1;
+        len = snprintf(buf, sizeof(buf), ",\"present\":");
+        len += s.present >= 0 ? snprintf(buf + len, sizeof(buf) - len, "\"%s\"", m->labels[s.present])
+                              : snprintf(buf + len, sizeof(buf) - len, "null");
+        len += snprintf(buf + len, sizeof(buf) - len,
+            ",\"runs\":%lu,\"skipped\":%lu,\"timing_us\":{\"decode\":%lu,\"prepare\":%lu,\"inference\":%lu,"
+            "\"inference_max\":%lu,\"layers\":[", (unsigned long)s.runs, (unsigned long)s.skipped,
+            (unsigned long)(s.decode_us / n), (unsigned long)(s.prepare_us / n), (unsigned long)(s.infer_us / n),
+            (unsigned long)s.infer_max_us);
+        for (int i = 0; i < m->layer_count; i++) {
+            len += snprintf(buf + len, sizeof(buf) - len, "%s%lu", i ? "," : "", (unsigned long)(s.layer_us[i] / n));
+        }
+        len += snprintf(buf + len, sizeof(buf) - len, "]},\"events\":[");
+        res = httpd_resp_send_chunk(req, buf, len);
+    }
+
+    // Oldest first
+    uint32_t first = s.event_seq > DETECT_EVENT_LOG ? s.event_seq - DETECT_EVENT_LOG : 0;
+    bool comma = false;
+    for (uint32_t i = first; i < s.event_seq && res == ESP_OK; i++) {
+        const detect_event_rec_t *e = &s.events[i % DETECT_EVENT_LOG];
+        if ((int64_t)e->seq <= since) {
+            continue;
+        }
+        len = snprintf(buf, sizeof(buf),
+            "%s{\"seq\":%lu,\"age_ms\":%lld,\"frame\":%lu,\"event\":\"%s\",\"class\":\"%s\",\"confidence\":%u}",
+            comma ? "," : "", (unsigned long)e->seq, (long long)((now - e->time_us) / 1000),
+            (unsigned long)e->frame, e->event == DETECT_EVENT_APPEARED ? "appeared" : "left",
+            e->cls >= 0 ? m->labels[e->cls] : "none", e->confidence);
+        res = httpd_resp_send_chunk(req, buf, len);
+        comma = true;
+    }
+    if (res == ESP_OK) {
+        res = httpd_resp_send_chunk(req, "]}", HTTPD_RESP_USE_STRLEN);
+    }
+    if (res == ESP_OK) {
+        res = httpd_resp_send_chunk(req, NULL, 0);
+    }
+    return res;
+}
+#endif
+
+#if CONFIG_TRAIN_TRACE
+static bool trace_send_chunk(void *arg, const char *data, size_t len) {
+    return httpd_resp_send_chunk((httpd_req_t *)arg, data, len) == ESP_OK;
+}
+
+// Execution trace (trace.h) as Chrome trace JSON, for ui.perfetto.dev
+//   /trace            -> everything the rings still hold
+//   /trace?ms=500     -> only the last 500 ms
+static esp_err_t trace_handler(httpd_req_t *req) {
+    char query[32];
+    int ms = 0;
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        query_int(query, "ms", &ms);
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=trace.json");
+    if (!trace_dump(ms > 0 ? (uint32_t)ms : 0, trace_send_chunk, req)) {
+        return ESP_FAIL;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+#endif
+
+// Camera preset endpoint: list presets, switch, and tweak/save them
+//   /preset                              -> list + switch stats
+//   /preset?name=dusk                    -> switch to "dusk" (persisted)
+//   /preset?name=dusk&quality=20&save=1  -> modify, switch and store in NVS
+static esp_err_t preset_handler(httpd_req_t *req) {
+    char query[160] = {0};
+    char name[CAMERA_PRESET_NAME_LEN] = {0};
+    esp_err_t err = ESP_OK;
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK
+        && httpd_query_key_value(query, "name", name, sizeof(name)) == ESP_OK) {
+        int index = camera_preset_find(camera_presets, CAMERA_PRESET_COUNT, name);
+        if (index < 0) {
+            httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Unknown preset");
+            return ESP_FAIL;
+        }
+
+        camera_preset_t preset = camera_presets[index];
+        int v;
+        if (query_int(query, "framesize", &v)) preset.framesize = (framesize_t)v;
+        if (query_int(query, "quality", &v)) preset.quality = v;
+        if (query_int(query, "xclk", &v)) preset.xclk_mhz = v;
+        if (query_int(query, "gainceiling", &v)) preset.gainceiling = (gainceiling_t)v;
+        if (query_int(query, "aec", &v)) preset.aec = v != 0;
+        if (query_int(query, "aec2", &v)) preset.aec2 = v != 0;
+        if (query_int(query, "ae_level", &v)) preset.ae_level = v;
+        if (query_int(query, "aec_value", &v)) preset.aec_value = v;
+        if (query_int(query, "agc", &v)) preset.agc = v != 0;
+        if (query_int(query, "agc_gain", &v)) preset.agc_gain = v;
+        char win[24];
+        if (httpd_query_key_value(query, "win", win, sizeof(win)) == ESP_OK) {
+            unsigned x, y, w, h;
+            if (sscanf(win, "%u,%u,%u,%u", &x, &y, &w, &h) == 4) {
+                preset.window = (camera_window_t){ x, y, w, h };
+            }
+        }
+        if (!camera_preset_valid(&preset) || preset.framesize > CAMERA_MAX_FRAMESIZE) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid preset settings");
+            return ESP_FAIL;
+        }
+
+        camera_presets[index] = preset;
+        err = camera_switch_preset(index);
+        camera_save_active(preset.name);
+        if (query_int(query, "save", &v) && v) {
+            camera_preset_save(&preset);
+        }
+    }
+
+    char json[512];
+    int len = snprintf(json, sizeof(json), "{\"result\":\"%s\",\"active\":\"%s\",\"presets\":[",
+        err == ESP_OK ? "ok" : "error", camera_active_preset_name());
+    for (size_t i = 0; i < CAMERA_PRESET_COUNT && len < (int)sizeof(json); i++) {
+        len += snprintf(json + len, sizeof(json) - len, "%s\"%s\"", i ? "," : "", camera_presets[i].name);
+    }
+    if (len < (int)sizeof(json)) {
+        len += snprintf(json + len, sizeof(json) - len,
+            "],\"switch\":{\"count\":%lu,\"last_us\":%lu,\"max_us\":%lu,"
+            "\"last_frames_lost\":%lu,\"total_frames_lost\":%lu,\"failed_writes\":%lu}}",
+            (unsigned long)camera_switch_stats.switches,
+            (unsigned long)camera_switch_stats.last_latency_us,
+            (unsigned long)camera_switch_stats.max_latency_us,
+            (unsigned long)camera_switch_stats.last_frames_lost,
+            (unsigned long)camera_switch_stats.total_frames_lost,
+            (unsigned long)camera_switch_stats.failed_writes);
+    }
+    if (len >= (int)sizeof(json)) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, json, len);
+}
+
+// Region of interest endpoint (coordinates in full-frame pixels)
+//   /roi                                    -> current ROI
+//   /roi?x=200&y=150&w=400&h=300&mode=crop  -> crop (or mode=zoom)
+//   /roi?reset=1                            -> back to the preset's window
+static esp_err_t roi_handler(httpd_req_t *req) {
+    char query[96] = {0};
+    esp_err_t err = ESP_OK;
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        int x, y, w, h, reset;
+        char mode[8] = "crop";
+        httpd_query_key_value(query, "mode", mode, sizeof(mode));
+
+        if (query_int(query, "reset", &reset) && reset) {
+            err = camera_reset_roi();
+        } else if (query_int(query, "x", &x) && query_int(query, "y", &y)
+                   && query_int(query, "w", &w) && query_int(query, "h", &h)) {
+            camera_rect_t roi = { x, y, w, h };
+            err = camera_set_roi(roi, strcmp(mode, "zoom") == 0 ? CAMERA_ROI_ZOOM : CAMERA_ROI_CROP);
+        } else {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Expected x, y, w, h or reset");
+            return ESP_FAIL;
+        }
+    }
+
+    framesize_t framesize = camera_active_preset >= 0
+        ? camera_presets[camera_active_preset].framesize : IMAGE_SIZE;
+
+    char json[192];
     snprintf(json, sizeof(json),
-        "{\"framesize\":%d,\"quality\":%d,\"brightness\":%d,\"contrast\":%d,"
-        "\"saturation\":%d,\"sharpness\":%d,\"vflip\":%d,\"hmirror\":%d}",
-        sensor->status.framesize,
-        sensor->status.quality,
-        sensor->status.brightness,
-        sensor->status.contrast,
-        sensor->status.saturation,
-        sensor->status.sharpness,
-        sensor->status.vflip,
-        sensor->status.hmirror
+        "{\"result\":\"%s\",\"active\":%s,\"mode\":\"%s\",\"x\":%d,\"y\":%d,\"w\":%d,\"h\":%d,"
+        "\"frame_w\":%d,\"frame_h\":%d}",
+        err == ESP_OK ? "ok" : "error",
+        camera_roi_active ? "true" : "false",
+        camera_roi_mode == CAMERA_ROI_ZOOM ? "zoom" : "crop",
+        camera_roi.x, camera_roi.y, camera_roi.w, camera_roi.h,
+        resolution[framesize].width, resolution[framesize].height
     );
 
     httpd_resp_set_type(req, "application/json");
@@ -179,69 +1242,662 @@ static esp_err_t status_handler(httpd_req_t *req) {
     return httpd_resp_send(req, json, strlen(json));
 }
 
+// IPv4 address of either end of a request's socket. The server socket is
+// dual-stack, so IPv4 peers show up as IPv4-mapped IPv6 addresses.
+static bool http_sock_ipv4(httpd_req_t *req, bool local, struct in_addr *out) {
+    int fd = httpd_req_to_sockfd(req);
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    int rc = local ? getsockname(fd, (struct sockaddr *)&addr, &len)
+                   : getpeername(fd, (struct sockaddr *)&addr, &len);
+    if (rc != 0) {
+        return false;
+    }
+    if (addr.ss_family == AF_INET) {
+        *out = ((struct sockaddr_in *)&addr)->sin_addr;
+        return true;
+    }
+#if CONFIG_LWIP_IPV6
+    if (addr.ss_family == AF_INET6) {
+        out->s_addr = ((struct sockaddr_in6 *)&addr)->sin6_addr.un.u32_addr[3];
+        return true;
+    }
+#endif
+    return false;
+}
+
+// Receiver address from ?host=&port=, defaulting the host to the requesting client
+static bool rtp_query_target(httpd_req_t *req, const char *query, struct sockaddr_in *addr) {
+    int port;
+    if (!query_int(query, "port", &port) || port <= 0 || port > 65535) {
+        return false;
+    }
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(port);
+
+    char host[16];
+    if (httpd_query_key_value(query, "host", host, sizeof(host)) == ESP_OK) {
+        return inet_aton(host, &addr->sin_addr) != 0;
+    }
+    return http_sock_ipv4(req, false, &addr->sin_addr);
+}
+
+// RTSP-lite signalling for UDP receivers. DESCRIBE returns an SDP a player
+// can open directly; SETUP registers a receiver, PLAY starts it, TEARDOWN
+// removes it.
+//   /rtp/describe?port=5004[&host=ip][&proto=h264]  -> SDP (application/sdp)
+//   /rtp/setup?port=5004[&host=ip][&proto=chunk|gcm|h264] -> {"session":N,...}
+//   /rtp/setup?host=239.255.42.1&port=5005&proto=chunk&ttl=1  (multicast group)
+//   /rtp/play?session=N
+//   /rtp/teardown?session=N
+//   /rtp/probe?session=N                            -> path probes sent to the session
+//   /rtp/probe?session=N&size=1400                  -> datagram size found (0: udp_chunk)
+//   /rtp                                            -> sessions + overhead stats
+static esp_err_t rtp_describe_handler(httpd_req_t *req) {
+    char query[96] = {0};
+    struct sockaddr_in target;
+    struct in_addr local;
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK
+        || !rtp_query_target(req, query, &target)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Expected port (and optional host)");
+        return ESP_FAIL;
+    }
+    if (!http_sock_ipv4(req, true, &local)) {
+        local.s_addr = 0;
+    }
+
+    char local_ip[16], target_ip[24];
+    inet_ntoa_r(local, local_ip, sizeof(local_ip));
+    inet_ntoa_r(target.sin_addr, target_ip, sizeof(target_ip));
+    if (udp_is_multicast(&target)) {
+        // SDP multicast connection addresses carry the TTL
+        snprintf(target_ip + strlen(target_ip), sizeof(target_ip) - strlen(target_ip), "/%d", udp_multicast_ttl);
+    }
+
+    // RTP/H.264 needs a dynamic payload type and the profile and level;
+    // SPS and PPS come in-band with every IDR
+    int pt = RTP_PT_JPEG;
+    char media[96];
+    snprintf(media, sizeof(media), "a=rtpmap:%d JPEG/%d\r\n", RTP_PT_JPEG, RTP_JPEG_CLOCK_HZ);
+#if CONFIG_TRAIN_H264
+    char proto_name[8] = "rtp";
+    httpd_query_key_value(query, "proto", proto_name, sizeof(proto_name));
+    if (strcmp(proto_name, "h264") == 0) {
+        pt = RTP_PT_H264;
+        snprintf(media, sizeof(media),
+            "a=rtpmap:%d H264/%d\r\n"
+            "a=fmtp:%d packetization-mode=1;profile-level-id=%02X%02X%02X\r\n",
+            RTP_PT_H264, RTP_H264_CLOCK_HZ, RTP_PT_H264, H264_PROFILE_BASELINE, H264_CONSTRAINT_FLAGS, h264_stream_level_idc());
+    }
+#endif
+
+    char sdp[384];
+    int len = snprintf(sdp, sizeof(sdp),
+        "v=0\r\n"
+        "o=- %lu 1 IN IP4 %s\r\n"
+        "s=" MDNS_INSTANCE "\r\n"
+        "c=IN IP4 %s\r\n"
+        "t=0 0\r\n"
+        "m=video %d RTP/AVP %d\r\n"
+        "%s"
+        "a=recvonly\r\n",
+        (unsigned long)(esp_timer_get_time() / 1000000), local_ip,
+        target_ip,
+        ntohs(target.sin_port), pt,
+        media);
+
+    httpd_resp_set_type(req, "application/sdp");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, sdp, len);
+}
+
+static esp_err_t rtp_setup_handler(httpd_req_t *req) {
+    char query[96] = {0};
+    struct sockaddr_in target;
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK
+        || !rtp_query_target(req, query, &target)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Expected port (and optional host)");
+        return ESP_FAIL;
+    }
+
+    char proto_name[8] = "rtp";
+    httpd_query_key_value(query, "proto", proto_name, sizeof(proto_name));
+    udp_proto_t proto = strcmp(proto_name, "chunk") == 0 ? UDP_PROTO_CHUNK
+        : strcmp(proto_name, "gcm") == 0 ? UDP_PROTO_GCM
+        : strcmp(proto_name, "h264") == 0 ? UDP_PROTO_H264 : UDP_PROTO_RTP;
+    if (proto == UDP_PROTO_GCM && !udp_crypt_available()) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Encryption not configured");
+        return ESP_FAIL;
+    }
+    if (proto == UDP_PROTO_H264 && camera_yuv_framesize == FRAMESIZE_INVALID) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Not in H.264 mode (/config?codec=h264)");
+        return ESP_FAIL;
+    }
+
+    int ttl;
+    if (udp_is_multicast(&target) && query_int(query, "ttl", &ttl) && ttl >= 1 && ttl <= 32) {
+        udp_set_multicast_ttl(ttl);
+    }
+
+    uint32_t session = udp_setup(&target, proto);
+    if (!session) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Too many receivers");
+        return ESP_FAIL;
+    }
+
+    char ip[16];
+    inet_ntoa_r(target.sin_addr, ip, sizeof(ip));
+    char json[128];
+    snprintf(json, sizeof(json), "{\"session\":%lu,\"proto\":\"%s\",\"host\":\"%s\",\"port\":%d}",
+        (unsigned long)session, udp_proto_str(proto), ip, ntohs(target.sin_port));
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, json, strlen(json));
+}
+
+// PLAY and TEARDOWN only differ in the action taken on the session
+static esp_err_t rtp_session_handler(httpd_req_t *req) {
+    esp_err_t (*action)(uint32_t) = req->user_ctx;
+    char query[32] = {0};
+    int session;
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK
+        || !query_int(query, "session", &session)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Expected session");
+        return ESP_FAIL;
+    }
+    if (action((uint32_t)session) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Unknown session");
+        return ESP_FAIL;
+    }
+
+    char json[48];
+    snprintf(json, sizeof(json), "{\"session\":%d,\"result\":\"ok\"}", session);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, json, strlen(json));
+}
+
+// Probing runs in two steps, as only the receiver can tell which probes
+// made it: send the ladder, then apply the size the receiver picked
+static esp_err_t rtp_probe_handler(httpd_req_t *req) {
+    char query[48] = {0};
+    int session, size;
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK
+        || !query_int(query, "session", &session)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Expected session");
+        return ESP_FAIL;
+    }
+
+    char json[96];
+    if (query_int(query, "size", &size)) {
+        esp_err_t err = udp_set_datagram((uint32_t)session, size);
+        if (err == ESP_ERR_INVALID_ARG) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Size out of range");
+            return ESP_FAIL;
+        }
+        if (err != ESP_OK) {
+            httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Unknown session");
+            return ESP_FAIL;
+        }
+        snprintf(json, sizeof(json), "{\"session\":%d,\"datagram\":%d}", session, size);
+    } else {
+        int sent = udp_probe((uint32_t)session);
+        if (sent < 0) {
+            httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Unknown session");
+            return ESP_FAIL;
+        }
+        snprintf(json, sizeof(json), "{\"session\":%d,\"probes\":%d,\"min\":%d,\"max\":%d}",
+            session, sent, UDP_DATAGRAM_MIN, UDP_DATAGRAM_MAX);
+    }
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, json, strlen(json));
+}
+
+static esp_err_t rtp_status_handler(httpd_req_t *req) {
+    char json[1536];
+    int len = snprintf(json, sizeof(json), "{\"sessions\":[");
+
+    xSemaphoreTake(udp_targets_mutex, portMAX_DELAY);
+    bool first = true;
+    for (int i = 0; i < UDP_MAX_TARGETS && len < (int)sizeof(json); i++) {
+        const udp_target_t *t = &udp_targets[i];
+        if (!t->in_use) {
+            continue;
+        }
+        char ip[16];
+        inet_ntoa_r(t->addr.sin_addr, ip, sizeof(ip));
+        len += snprintf(json + len, sizeof(json) - len,
+            "%s{\"session\":%lu,\"proto\":\"%s\",\"host\":\"%s\",\"port\":%d,\"multicast\":%s,\"playing\":%s,"
+            "\"datagram\":%d,\"frames\":%lu,\"suppressed\":%lu,\"packets\":%lu,\"errors\":%lu}",
+            first ? "" : ",", (unsigned long)t->session, udp_proto_str(t->proto), ip, ntohs(t->addr.sin_port),
+            udp_is_multicast(&t->addr) ? "true" : "false", t->playing ? "true" : "false",
+            t->datagram,
+            (unsigned long)t->frames, (unsigned long)udp_suppressed(t), (unsigned long)t->packets,
+            (unsigned long)t->errors);
+        first = false;
+    }
+
+    // Average bytes per frame on the wire vs. the JPEG itself, per protocol,
+    // and the encryption time per frame for gcm
+    for (int p = UDP_PROTO_CHUNK; p < UDP_PROTO_COUNT && len < (int)sizeof(json); p++) {
+        const udp_proto_stats_t *st = &udp_proto_stats[p];
+        uint32_t frames = st->frames ? st->frames : 1;
+        len += snprintf(json + len, sizeof(json) - len,
+            "%s\"%s\":{\"frames\":%lu,\"jpeg_bytes\":%lu,\"wire_bytes\":%lu,\"overhead_bytes\":%ld",
+            p == UDP_PROTO_CHUNK ? "]," : ",", udp_proto_str(p), (unsigned long)st->frames,
+            (unsigned long)(st->jpeg_bytes / frames), (unsigned long)(st->wire_bytes / frames),
+            (long)(((int64_t)st->wire_bytes - (int64_t)st->jpeg_bytes) / frames));
+        if (p == UDP_PROTO_GCM && len < (int)sizeof(json)) {
+            len += snprintf(json + len, sizeof(json) - len, ",\"seal_us\":%lu", (unsigned long)(st->seal_us / frames));
+        }
+        if (len < (int)sizeof(json)) {
+            json[len++] = '}';
+        }
+    }
+    xSemaphoreGive(udp_targets_mutex);
+
+    if (len + 1 >= (int)sizeof(json)) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    json[len++] = '}';
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, json, len);
+}
+
 static httpd_handle_t stream_httpd = NULL;
 static httpd_handle_t api_httpd = NULL;
 
-static void start_http_server(void) {
-    // ========== API Server (port 80) - for index, capture, status ==========
+static bool api_server_start(int sockets);
+
+// A handler cannot stop its own server: restart it from a one-shot task
+static void api_restart_task(void *arg) {
+    vTaskDelay(pdMS_TO_TICKS(200));     // Let the response go out
+    train_config_t cfg;
+    runtime_config_get(&cfg);
+    httpd_stop(api_httpd);
+    api_httpd = NULL;
+    if (!api_server_start(cfg.api_sockets)) {
+        ESP_LOGW(HTTP_TAG, "API server did not start with %ld sockets, back to 4", (long)cfg.api_sockets);
+        api_server_start(4);
+    }
+    vTaskDelete(NULL);
+}
+
+static const char *const config_subsystem_names[] = { "udp", "stream", "dedup", "detect", "camera", "api", "h264" };
+
+// Runtime configuration (runtime_config.h)
+//   /config                                  -> values, version and schema
+//   /config?udp_chunk=1200&cam_mode=single   -> validate, apply live, store in NVS
+//   /config?detect_ms=500&save=0             -> apply, but keep the stored values
+//   /config?reset=1                          -> back to the defaults (and erase NVS)
+static esp_err_t config_handler(httpd_req_t *req) {
+    static char json[3072];             // Off the API server's 4 KB stack
+    static const char *const ignore[] = { "save", "reset", NULL };
+    char query[256] = {0};
+    int changed = 0;
+    bool update = false;
+
+    esp_err_t qerr = httpd_req_get_url_query_str(req, query, sizeof(query));
+    if (qerr == ESP_ERR_HTTPD_RESULT_TRUNC) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Query too long");
+        return ESP_FAIL;
+    }
+    if (qerr == ESP_OK && query[0]) {
+        char param[4];
+        bool save = !(httpd_query_key_value(query, "save", param, sizeof(param)) == ESP_OK && strcmp(param, "0") == 0);
+        bool reset = httpd_query_key_value(query, "reset", param, sizeof(param)) == ESP_OK && strcmp(param, "0") != 0;
+        char err[64];
+        changed = runtime_config_update(query, ignore, reset, save, err, sizeof(err));
+        if (changed < 0) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, err);
+            return ESP_FAIL;
+        }
+        update = true;
+    }
+
+    train_config_t cfg;
+    runtime_config_get(&cfg);
+    int len = snprintf(json, sizeof(json), "{\"result\":\"ok\",\"version\":%lu,", (unsigned long)cfg.version);
+    if (update) {
+        len += snprintf(json + len, sizeof(json) - len, "\"changed\":[");
+        bool first = true;
+        for (int i = 0; i < (int)(sizeof(config_subsystem_names) / sizeof(config_subsystem_names[0])); i++) {
+            if (changed & (1 << i)) {
+                len += snprintf(json + len, sizeof(json) - len, "%s\"%s\"", first ? "" : ",", config_subsystem_names[i]);
+                first = false;
+            }
+        }
+        len += snprintf(json + len, sizeof(json) - len, "],");
+    }
+    len += snprintf(json + len, sizeof(json) - len, "\"config\":");
+    int n = len < (int)sizeof(json) ? config_json_values(&runtime_config_schema, &cfg, json + len, sizeof(json) - len) : -1;
+    len = n < 0 ? (int)sizeof(json) : len + n;
+    if (!update && len < (int)sizeof(json)) {
+        len += snprintf(json + len, sizeof(json) - len, ",\"schema\":");
+        n = len < (int)sizeof(json) ? config_json_schema(&runtime_config_schema, json + len, sizeof(json) - len) : -1;
+        len = n < 0 ? (int)sizeof(json) : len + n;
+    }
+    if (len < (int)sizeof(json)) {
+        len += snprintf(json + len, sizeof(json) - len, "}");
+    }
+    if (len >= (int)sizeof(json)) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    esp_err_t res = httpd_resp_send(req, json, len);
+
+    if (changed & RUNTIME_CONFIG_API) {
+        xTaskCreatePinnedToCore(api_restart_task, "api_restart", 3072, NULL, 5, NULL, 0);
+    }
+    return res;
+}
+
+// Firmware update (ota.h)
+//   GET /ota                                      -> running image, progress of the last upload
+//   curl --data-binary @app.bin "http://<ip>/ota?sha256=<hex>[&reboot=0]"
+// The upload is answered when the image is written and checked (or not).
+static esp_err_t ota_status_handler(httpd_req_t *req) {
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    const esp_partition_t *next = esp_ota_get_next_update_partition(NULL);
+    int64_t end = ota_state.end_us ? ota_state.end_us : esp_timer_get_time();
+    float seconds = ota_state.start_us ? (end - ota_state.start_us) / 1e6f : 0;
+    uint32_t received = ota_state.received;
+
+    char json[512];
+    int len = snprintf(json, sizeof(json),
+        "{\"version\":\"%s\",\"running\":\"%s\",\"next\":\"%s\",\"confirmed\":%s,\"rate_kb\":%d,"
+        "\"state\":\"%s\",\"error\":%s%s%s,\"received\":%lu,\"length\":%lu,\"seconds\":%.1f,"
+        "\"kb_per_s\":%.1f,\"sectors\":%lu,\"flash_s\":%.2f,\"throttled_s\":%.2f,\"max_sector_us\":%lu}",
+        esp_app_get_description()->version, running->label, next ? next->label : "", ota_state.confirmed ? "true" : "false",
+#if CONFIG_TRAIN_OTA
+        CONFIG_TRAIN_OTA_RATE_KB,
+#else
+        0,
+#endif
+        ota_phase_names[ota_state.phase], ota_state.error ? "\"" : "", ota_state.error ? ota_state.error : "null",
+        ota_state.error ? "\"" : "", (unsigned long)received, (unsigned long)ota_state.length, seconds,
+        seconds > 0 ? received / 1024.0f / seconds : 0, (unsigned long)ota_state.sectors, ota_state.flash_us / 1e6f,
+        ota_state.throttle_us / 1e6f, (unsigned long)ota_state.max_flash_us);
+    if (len >= (int)sizeof(json)) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, json, len);
+}
+
+static esp_err_t ota_upload_handler(httpd_req_t *req) {
+    char query[128];
+    char hex[2 * SHA256_DIGEST_LEN + 2];
+    char param[4];
+    uint8_t want[SHA256_DIGEST_LEN];
+    bool reboot = true;
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK
+        || httpd_query_key_value(query, "sha256", hex, sizeof(hex)) != ESP_OK || !sha256_parse_hex(hex, want)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "sha256=<64 hex digits> required");
+        return ESP_FAIL;
+    }
+    if (httpd_query_key_value(query, "reboot", param, sizeof(param)) == ESP_OK) {
+        reboot = strcmp(param, "0") != 0;
+    }
+
+    const char *err = ota_submit(req, want, reboot);
+    if (err) {
+        httpd_resp_set_status(req, "409 Conflict");
+        httpd_resp_set_type(req, "text/plain");
+        return httpd_resp_send(req, err, HTTPD_RESP_USE_STRLEN);
+    }
+    return ESP_OK;
+}
+
+// ========== API Server (port 80) - for index, capture, status ==========
+static bool api_server_start(int sockets) {
     httpd_config_t api_config = HTTPD_DEFAULT_CONFIG();
     api_config.server_port = 80;
     api_config.ctrl_port = 32768;
-    api_config.max_open_sockets = 4;
-    api_config.max_uri_handlers = 8;
+    api_config.max_open_sockets = sockets;
+    api_config.max_uri_handlers = 24;
     api_config.stack_size = 4096;
     api_config.core_id = 0;
     api_config.lru_purge_enable = true;
 
-    ESP_LOGI(HTTP_TAG, "Starting API server on port %d", api_config.server_port);
+    ESP_LOGI(HTTP_TAG, "Starting API server on port %d (%d sockets)", api_config.server_port, sockets);
 
-    if (httpd_start(&api_httpd, &api_config) == ESP_OK) {
-        httpd_uri_t index_uri = {
-            .uri = "/",
-            .method = HTTP_GET,
-            .handler = index_handler,
-            .user_ctx = NULL
-        };
-        httpd_register_uri_handler(api_httpd, &index_uri);
+    if (httpd_start(&api_httpd, &api_config) != ESP_OK) {
+        ESP_LOGE(HTTP_TAG, "Failed to start API server");
+        return false;
+    }
 
-        httpd_uri_t capture_uri = {
-            .uri = "/capture",
-            .method = HTTP_GET,
-            .handler = capture_handler,
-            .user_ctx = NULL
-        };
-        httpd_register_uri_handler(api_httpd, &capture_uri);
+    httpd_uri_t index_uri = {
+        .uri = "/",
+        .method = HTTP_GET,
+        .handler = index_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(api_httpd, &index_uri);
 
-        httpd_uri_t status_uri = {
-            .uri = "/status",
-            .method = HTTP_GET,
-            .handler = status_handler,
-            .user_ctx = NULL
-        };
-        httpd_register_uri_handler(api_httpd, &status_uri);
+    httpd_uri_t capture_uri = {
+        .uri = "/capture",
+        .method = HTTP_GET,
+        .handler = capture_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(api_httpd, &capture_uri);
 
-        httpd_uri_t train_uri = {
-            .uri = "/train",
-            .method = HTTP_GET,
-            .handler = train_handler,
-            .user_ctx = NULL
-        };
-        httpd_register_uri_handler(api_httpd, &train_uri);
+    httpd_uri_t status_uri = {
+        .uri = "/status",
+        .method = HTTP_GET,
+        .handler = status_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(api_httpd, &status_uri);
 
-        ESP_LOGI(HTTP_TAG, "API server started");
-    } else {
-        ESP_LOGE(HTTP_TAG, "Failed to start API server");
+    httpd_uri_t train_uri = {
+        .uri = "/train",
+        .method = HTTP_GET,
+        .handler = train_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(api_httpd, &train_uri);
+
+    httpd_uri_t power_uri = {
+        .uri = "/power",
+        .method = HTTP_GET,
+        .handler = power_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(api_httpd, &power_uri);
+
+    httpd_uri_t ble_uri = {
+        .uri = "/ble",
+        .method = HTTP_GET,
+        .handler = ble_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(api_httpd, &ble_uri);
+
+    httpd_uri_t telemetry_uri = {
+        .uri = "/telemetry",
+        .method = HTTP_GET,
+        .handler = telemetry_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(api_httpd, &telemetry_uri);
+
+#if CONFIG_TRAIN_ALLOC_AUDIT
+    httpd_uri_t alloc_uri = {
+        .uri = "/alloc",
+        .method = HTTP_GET,
+        .handler = alloc_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(api_httpd, &alloc_uri);
+#endif
+
+#if CONFIG_TRAIN_CAMERA_SUPERVISOR
+    httpd_uri_t health_uri = {
+        .uri = "/health",
+        .method = HTTP_GET,
+        .handler = health_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(api_httpd, &health_uri);
+#endif
+
+#if CONFIG_TRAIN_DETECT
+    httpd_uri_t detect_uri = {
+        .uri = "/detect",
+        .method = HTTP_GET,
+        .handler = detect_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(api_httpd, &detect_uri);
+#endif
+
+#if CONFIG_TRAIN_TRACE
+    httpd_uri_t trace_uri = {
+        .uri = "/trace",
+        .method = HTTP_GET,
+        .handler = trace_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(api_httpd, &trace_uri);
+#endif
+
+    httpd_uri_t preset_uri = {
+        .uri = "/preset",
+        .method = HTTP_GET,
+        .handler = preset_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(api_httpd, &preset_uri);
+
+    httpd_uri_t roi_uri = {
+        .uri = "/roi",
+        .method = HTTP_GET,
+        .handler = roi_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(api_httpd, &roi_uri);
+
+    httpd_uri_t rtp_uri = {
+        .uri = "/rtp",
+        .method = HTTP_GET,
+        .handler = rtp_status_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(api_httpd, &rtp_uri);
+
+    httpd_uri_t rtp_describe_uri = {
+        .uri = "/rtp/describe",
+        .method = HTTP_GET,
+        .handler = rtp_describe_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(api_httpd, &rtp_describe_uri);
+
+    httpd_uri_t rtp_setup_uri = {
+        .uri = "/rtp/setup",
+        .method = HTTP_GET,
+        .handler = rtp_setup_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(api_httpd, &rtp_setup_uri);
+
+    httpd_uri_t rtp_play_uri = {
+        .uri = "/rtp/play",
+        .method = HTTP_GET,
+        .handler = rtp_session_handler,
+        .user_ctx = udp_play
+    };
+    httpd_register_uri_handler(api_httpd, &rtp_play_uri);
+
+    httpd_uri_t rtp_teardown_uri = {
+        .uri = "/rtp/teardown",
+        .method = HTTP_GET,
+        .handler = rtp_session_handler,
+        .user_ctx = udp_teardown
+    };
+    httpd_register_uri_handler(api_httpd, &rtp_teardown_uri);
+
+    httpd_uri_t rtp_probe_uri = {
+        .uri = "/rtp/probe",
+        .method = HTTP_GET,
+        .handler = rtp_probe_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(api_httpd, &rtp_probe_uri);
+
+    httpd_uri_t config_uri = {
+        .uri = "/config",
+        .method = HTTP_GET,
+        .handler = config_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(api_httpd, &config_uri);
+
+    httpd_uri_t ota_status_uri = {
+        .uri = "/ota",
+        .method = HTTP_GET,
+        .handler = ota_status_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(api_httpd, &ota_status_uri);
+
+    httpd_uri_t ota_upload_uri = {
+        .uri = "/ota",
+        .method = HTTP_POST,
+        .handler = ota_upload_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(api_httpd, &ota_upload_uri);
+
+    ESP_LOGI(HTTP_TAG, "API server started");
+    return true;
+}
+
+static void start_http_server(void) {
+    if (!http_templates_compile(&http_tpl, HTTP_TPL_MJPEG_PART(MJPEG_BOUNDARY))) {
+        ESP_LOGE(HTTP_TAG, "Bad response template");
+        return;
     }
 
+    train_config_t cfg;
+    runtime_config_get(&cfg);
+    api_server_start(cfg.api_sockets);
+
     // ========== Stream Server (port 81) - dedicated to MJPEG streaming ==========
     httpd_config_t stream_config = HTTPD_DEFAULT_CONFIG();
     stream_config.server_port = 81;
     stream_config.ctrl_port = 32769;
-    stream_config.max_open_sockets = 2;
-    stream_config.max_uri_handlers = 2;
+#if CONFIG_TRAIN_H264
+    stream_config.max_open_sockets = CONFIG_TRAIN_STREAM_MAX_CLIENTS + CONFIG_TRAIN_H264_MAX_CLIENTS + 1;  // One spare to answer 503
+#else
+    stream_config.max_open_sockets = CONFIG_TRAIN_STREAM_MAX_CLIENTS + 1;  // One spare to answer 503
+#endif
+    stream_config.max_uri_handlers = 3;
     stream_config.stack_size = 8192;
     stream_config.core_id = 1;  // Run on different core
-    stream_config.lru_purge_enable = true;
+    // The stream task evicts stalled clients itself; LRU purging would
+    // close a session socket under it
+    stream_config.lru_purge_enable = false;
+    stream_config.send_wait_timeout = (CONFIG_TRAIN_STREAM_SEND_TIMEOUT_MS + 999) / 1000;  // Chunked path
+
+    if (!stream_sessions_start()) {
+        ESP_LOGE(HTTP_TAG, "Failed to start stream tasks");
+        return;
+    }
 
     ESP_LOGI(HTTP_TAG, "Starting stream server on port %d", stream_config.server_port);
 
@@ -263,6 +1919,16 @@ static void start_http_server(void) {
         };
         httpd_register_uri_handler(stream_httpd, &stream_root_uri);
 
+#if CONFIG_TRAIN_H264
+        httpd_uri_t h264_uri = {
+            .uri = "/h264",
+            .method = HTTP_GET,
+            .handler = h264_stream_handler,
+            .user_ctx = NULL
+        };
+        httpd_register_uri_handler(stream_httpd, &h264_uri);
+#endif
+
         ESP_LOGI(HTTP_TAG, "Stream server started");
     } else {
         ESP_LOGE(HTTP_TAG, "Failed to start stream server");
@@ -272,5 +1938,14 @@ static void start_http_server(void) {
     ESP_LOGI(HTTP_TAG, "  Web UI:  http://<ip>/");
     ESP_LOGI(HTTP_TAG, "  Capture: http://<ip>/capture");
     ESP_LOGI(HTTP_TAG, "  Status:  http://<ip>/status");
+    ESP_LOGI(HTTP_TAG, "  Power:   http://<ip>/power");
+    ESP_LOGI(HTTP_TAG, "  Presets: http://<ip>/preset");
+    ESP_LOGI(HTTP_TAG, "  ROI:     http://<ip>/roi");
+    ESP_LOGI(HTTP_TAG, "  Config:  http://<ip>/config");
+    ESP_LOGI(HTTP_TAG, "  OTA:     http://<ip>/ota");
+    ESP_LOGI(HTTP_TAG, "  RTP:     http://<ip>/rtp/describe?port=5004");
     ESP_LOGI(HTTP_TAG, "  Stream:  http://<ip>:81/stream");
+#if CONFIG_TRAIN_H264
+    ESP_LOGI(HTTP_TAG, "  H.264:   http://<ip>:81/h264 (with /config?codec=h264)");
+#endif
 }
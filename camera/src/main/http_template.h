@@ -0,0 +1,211 @@
+#pragma once
+
+// Precomputed HTTP response templates.
+//
+// A template is a constant string with fixed-width value slots. Each slot
+// is a run of marker characters, and its width is the run length:
+//
+//   $$$$  integer, left-aligned and padded with trailing spaces
+//   @@@@  string, written as "value" plus trailing spaces (quotes included
+//         in the width, value truncated to fit)
+//
+// Trailing spaces are insignificant both in JSON and after an HTTP header
+// value, so a rendered response always has the template's length, known
+// when the template is compiled. Rendering is one memcpy plus the slot
+// writes, with no format-string parsing and no strlen on the result.
+//
+// Compile templates once before their handlers can run, since the slot
+// table is shared. Rendering only reads it. No ESP-IDF dependencies.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define HTTP_TPL_INT '$'
+#define HTTP_TPL_STR '@'
+#define HTTP_TPL_MAX_SLOTS 16
+
+typedef struct {
+    uint16_t offset;
+    uint8_t width;
+    char kind;                  // HTTP_TPL_INT or HTTP_TPL_STR
+} http_tpl_slot_t;
+
+typedef struct {
+    const char *text;
+    uint16_t len;
+    uint8_t slot_count;
+    http_tpl_slot_t slots[HTTP_TPL_MAX_SLOTS];
+} http_tpl_t;
+
+// Find the slots of `text`. Returns false if there are more than
+// HTTP_TPL_MAX_SLOTS, a slot is wider than 255, or a string slot is too
+// narrow for its quotes.
+static bool http_tpl_compile(http_tpl_t *tpl, const char *text) {
+    size_t len = strlen(text);
+    if (len > UINT16_MAX) {
+        return false;
+    }
+    tpl->text = text;
+    tpl->len = (uint16_t)len;
+    tpl->slot_count = 0;
+    for (size_t i = 0; i < len;) {
+        char c = text[i];
+        if (c != HTTP_TPL_INT && c != HTTP_TPL_STR) {
+            i++;
+            continue;
+        }
+        size_t start = i;
+        while (i < len && text[i] == c) {
+            i++;
+        }
+        size_t width = i - start;
+        if (tpl->slot_count == HTTP_TPL_MAX_SLOTS || width > 255 || (c == HTTP_TPL_STR && width < 2)) {
+            return false;
+        }
+        tpl->slots[tpl->slot_count++] = (http_tpl_slot_t){
+            .offset = (uint16_t)start, .width = (uint8_t)width, .kind = c,
+        };
+    }
+    return true;
+}
+
+// Start a response: copy the template into `out` (at least tpl->len bytes).
+// Returns the rendered length.
+static size_t http_tpl_begin(const http_tpl_t *tpl, char *out) {
+    memcpy(out, tpl->text, tpl->len);
+    return tpl->len;
+}
+
+// Digits and sign into a slot. 32-bit only: 64-bit division is a library
+// call on the ESP32.
+static bool http_tpl_put_digits(char *dst, uint8_t width, bool negative, uint32_t v) {
+    char digits[10];
+    int n = 0;
+    do {
+        digits[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v != 0);
+
+    int len = n + (negative ? 1 : 0);
+    if (len > width) {
+        // Clamp to the widest value that fits, so the output stays valid
+        int i = 0;
+        if (negative && width > 1) {
+            dst[i++] = '-';
+        }
+        while (i < width) {
+            dst[i++] = '9';
+        }
+        return false;
+    }
+
+    int i = 0;
+    if (negative) {
+        dst[i++] = '-';
+    }
+    while (n > 0) {
+        dst[i++] = digits[--n];
+    }
+    memset(dst + i, ' ', width - i);
+    return true;
+}
+
+// Fill integer slot `slot`. Returns false (and writes a clamped value) if
+// the number does not fit the slot width.
+static bool http_tpl_set_uint(const http_tpl_t *tpl, char *out, int slot, uint32_t value) {
+    const http_tpl_slot_t *s = &tpl->slots[slot];
+    return http_tpl_put_digits(out + s->offset, s->width, false, value);
+}
+
+static bool http_tpl_set_int(const http_tpl_t *tpl, char *out, int slot, int32_t value) {
+    const http_tpl_slot_t *s = &tpl->slots[slot];
+    uint32_t magnitude = value < 0 ? 0u - (uint32_t)value : (uint32_t)value;
+    return http_tpl_put_digits(out + s->offset, s->width, value < 0, magnitude);
+}
+
+// Fill string slot `slot` with a JSON string. Quotes, backslashes and
+// control characters become '_'. Returns false if the value was truncated.
+static bool http_tpl_set_str(const http_tpl_t *tpl, char *out, int slot, const char *value) {
+    const http_tpl_slot_t *s = &tpl->slots[slot];
+    char *dst = out + s->offset;
+    int room = s->width - 2;
+    int i = 0;
+    *dst++ = '"';
+    for (; i < room && value[i] != '\0'; i++) {
+        char c = value[i];
+        *dst++ = ((unsigned char)c < 0x20 || c == '"' || c == '\\') ? '_' : c;
+    }
+    *dst++ = '"';
+    memset(dst, ' ', room - i);
+    return value[i] == '\0';
+}
+
+// ---------------------------------------------------------------------------
+// Slot runs for common widths. Adjacent literals merge into one run.
+
+#define HTTP_TPL_INT1 "$"
+#define HTTP_TPL_INT3 "$$$"             // -99..999
+#define HTTP_TPL_INT6 "$$$$$$"
+#define HTTP_TPL_INT7 "$$$$$$$"         // Up to 9,999,999
+#define HTTP_TPL_UINT32 "$$$$$$$$$$"    // Any uint32_t
+#define HTTP_TPL_STR8 "@@@@@@@@"        // 6 characters
+#define HTTP_TPL_STR14 "@@@@@@@@@@@@@@" // 12 characters
+
+// ---------------------------------------------------------------------------
+// Responses of http_server.h. Each rendered response has exactly the
+// template's length.
+
+// Boundary and part header in one piece, ahead of each MJPEG frame
+#define HTTP_TPL_MJPEG_PART(boundary) \
+    "\r\n--" boundary "\r\n" \
+    "Content-Type: image/jpeg\r\nContent-Length: " HTTP_TPL_INT7 "\r\n\r\n"
+
+#define HTTP_TPL_STATUS \
+    "{\"framesize\":" HTTP_TPL_INT3 ",\"quality\":" HTTP_TPL_INT3 \
+    ",\"brightness\":" HTTP_TPL_INT3 ",\"contrast\":" HTTP_TPL_INT3 \
+    ",\"saturation\":" HTTP_TPL_INT3 ",\"sharpness\":" HTTP_TPL_INT3 \
+    ",\"vflip\":" HTTP_TPL_INT1 ",\"hmirror\":" HTTP_TPL_INT1 \
+    ",\"preset\":" HTTP_TPL_STR8 HTTP_TPL_STR8 "@}"     // 15 characters
+
+#define HTTP_TPL_POWER \
+    "{\"mode\":" HTTP_TPL_STR8 ",\"clients\":" HTTP_TPL_INT3 \
+    ",\"avg_current_ma\":" HTTP_TPL_INT6 ",\"wakes\":" HTTP_TPL_UINT32 \
+    ",\"wake_latency_ms\":{\"last\":" HTTP_TPL_INT6 ",\"avg\":" HTTP_TPL_INT6 \
+    ",\"max\":" HTTP_TPL_INT6 "}}"
+
+#define HTTP_TPL_TRAIN_HEAD \
+    "{\"action\":" HTTP_TPL_STR14 ",\"result\":" HTTP_TPL_STR14 \
+    ",\"state\":" HTTP_TPL_STR14 ",\"ready\":" HTTP_TPL_INT1 ",\"hubs\":["
+
+#define HTTP_TPL_TRAIN_HUB \
+    "{\"id\":" HTTP_TPL_INT1 ",\"name\":" HTTP_TPL_STR14 HTTP_TPL_STR8 "@@@" \
+    ",\"addr\":" HTTP_TPL_STR14 "@@@@@,\"state\":" HTTP_TPL_STR14 \
+    ",\"commands\":" HTTP_TPL_UINT32 ",\"errors\":" HTTP_TPL_UINT32 \
+    ",\"latency_ms\":" HTTP_TPL_INT6 ",\"max_latency_ms\":" HTTP_TPL_INT6 "}"
+
+// Slot indexes, in template order
+enum { HTTP_STATUS_FRAMESIZE, HTTP_STATUS_QUALITY, HTTP_STATUS_BRIGHTNESS, HTTP_STATUS_CONTRAST,
+       HTTP_STATUS_SATURATION, HTTP_STATUS_SHARPNESS, HTTP_STATUS_VFLIP, HTTP_STATUS_HMIRROR,
+       HTTP_STATUS_PRESET };
+enum { HTTP_POWER_MODE, HTTP_POWER_CLIENTS, HTTP_POWER_AVG_MA, HTTP_POWER_WAKES,
+       HTTP_POWER_LAST_MS, HTTP_POWER_AVG_MS, HTTP_POWER_MAX_MS };
+enum { HTTP_TRAIN_ACTION, HTTP_TRAIN_RESULT, HTTP_TRAIN_STATE, HTTP_TRAIN_READY };
+enum { HTTP_HUB_ID, HTTP_HUB_NAME, HTTP_HUB_ADDR, HTTP_HUB_STATE, HTTP_HUB_COMMANDS,
+       HTTP_HUB_ERRORS, HTTP_HUB_LATENCY_MS, HTTP_HUB_MAX_LATENCY_MS };
+
+typedef struct {
+    http_tpl_t mjpeg_part;
+    http_tpl_t status;
+    http_tpl_t power;
+    http_tpl_t train_head;
+    http_tpl_t train_hub;
+} http_templates_t;
+
+static bool http_templates_compile(http_templates_t *t, const char *mjpeg_boundary_part) {
+    return http_tpl_compile(&t->mjpeg_part, mjpeg_boundary_part)
+        && http_tpl_compile(&t->status, HTTP_TPL_STATUS)
+        && http_tpl_compile(&t->power, HTTP_TPL_POWER)
+        && http_tpl_compile(&t->train_head, HTTP_TPL_TRAIN_HEAD)
+        && http_tpl_compile(&t->train_hub, HTTP_TPL_TRAIN_HUB);
+}
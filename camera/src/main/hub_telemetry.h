@@ -0,0 +1,279 @@
+#pragma once
+
+// Telemetry frames from the hub program (train/main.py).
+//
+// The hub writes binary frames into the same stdout stream as its text
+// replies, so the parser is a byte-at-a-time state machine that splits the
+// stream into text lines and frames, whatever the notification boundaries:
+//
+//   0xA5 0x5A  version  length  payload[length]  crc16(payload), little-endian
+//
+// CRC-16 rather than CRC-8: a frame cut short by a hub restart runs into the
+// next one, and an 8-bit check accepts 1 in 256 of those.
+//
+// Version 1 payload (little-endian, 20 bytes):
+//
+//   u16 seq          i8  motor_duty (commanded, -100..100)
+//   u32 hub_ms       u8  flags (bit 0: tilt valid)
+//   u16 battery_mv   i16 pitch, i16 roll (0.1 degree)
+//   i16 battery_ma   u16 loop_avg_ms, u16 loop_max_ms
+//
+// Also holds the stores the firmware keeps per hub: a seqlock latest-value
+// cell (one writer, any number of readers, never blocks the writer) and a
+// single-writer time-series ring that readers copy from without locking.
+// No ESP-IDF dependencies; uses the GCC __atomic builtins.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define HUB_TLM_MAGIC0 0xA5
+#define HUB_TLM_MAGIC1 0x5A
+#define HUB_TLM_VERSION 1
+#define HUB_TLM_PAYLOAD_V1 20
+#define HUB_TLM_MAX_PAYLOAD 64
+#define HUB_TLM_LINE_LEN 64
+
+#define HUB_TLM_FLAG_TILT 0x01
+
+typedef struct {
+    uint16_t seq;
+    uint32_t hub_ms;
+    uint16_t battery_mv;
+    int16_t battery_ma;
+    int8_t motor_duty;
+    uint8_t flags;
+    int16_t pitch_ddeg;
+    int16_t roll_ddeg;
+    uint16_t loop_avg_ms;
+    uint16_t loop_max_ms;
+} hub_telemetry_t;
+
+typedef enum {
+    HUB_RX_NONE = 0,
+    HUB_RX_FRAME,       // rx->frame holds a new sample
+    HUB_RX_LINE,        // rx->line holds a complete text line
+} hub_rx_event_t;
+
+typedef enum {
+    HUB_RX_TEXT = 0,
+    HUB_RX_MAGIC,
+    HUB_RX_VERSION,
+    HUB_RX_LENGTH,
+    HUB_RX_PAYLOAD,
+    HUB_RX_CRC,
+    HUB_RX_CRC_HI,
+} hub_rx_state_t;
+
+typedef struct {
+    hub_rx_state_t state;
+    uint8_t version;
+    uint8_t length;
+    uint8_t pos;
+    uint8_t crc_lo;
+    uint8_t payload[HUB_TLM_MAX_PAYLOAD];
+    char line[HUB_TLM_LINE_LEN];
+    uint8_t line_len;
+
+    hub_telemetry_t frame;
+    uint32_t frames;
+    uint32_t crc_errors;
+    uint32_t bad_frames;        // Unknown version or length
+} hub_rx_t;
+
+// CRC-16/CCITT-FALSE: polynomial 0x1021, init 0xFFFF (same as train/main.py)
+static uint16_t hub_tlm_crc16(const uint8_t *data, size_t len) {
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int b = 0; b < 8; b++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+static uint16_t hub_tlm_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static bool hub_tlm_decode(const uint8_t *p, uint8_t version, uint8_t length, hub_telemetry_t *out) {
+    if (version != HUB_TLM_VERSION || length < HUB_TLM_PAYLOAD_V1) {
+        return false;  // Longer v1 payloads carry fields we don't know yet
+    }
+    out->seq = hub_tlm_u16(p);
+    out->hub_ms = (uint32_t)hub_tlm_u16(p + 2) | ((uint32_t)hub_tlm_u16(p + 4) << 16);
+    out->battery_mv = hub_tlm_u16(p + 6);
+    out->battery_ma = (int16_t)hub_tlm_u16(p + 8);
+    out->motor_duty = (int8_t)p[10];
+    out->flags = p[11];
+    out->pitch_ddeg = (int16_t)hub_tlm_u16(p + 12);
+    out->roll_ddeg = (int16_t)hub_tlm_u16(p + 14);
+    out->loop_avg_ms = hub_tlm_u16(p + 16);
+    out->loop_max_ms = hub_tlm_u16(p + 18);
+    return true;
+}
+
+static void hub_rx_init(hub_rx_t *rx) {
+    *rx = (hub_rx_t){0};
+}
+
+// Drop a partial line or frame (new connection), keeping the counters
+static void hub_rx_resync(hub_rx_t *rx) {
+    rx->state = HUB_RX_TEXT;
+    rx->line_len = 0;
+}
+
+// Feed one byte of the hub's stdout stream
+static hub_rx_event_t hub_rx_feed(hub_rx_t *rx, uint8_t byte) {
+    switch (rx->state) {
+        case HUB_RX_TEXT:
+            if (byte == HUB_TLM_MAGIC0) {
+                rx->state = HUB_RX_MAGIC;
+            } else if (byte == '\n') {
+                rx->line[rx->line_len] = '\0';
+                rx->line_len = 0;
+                return HUB_RX_LINE;
+            } else if (byte != '\r' && rx->line_len < HUB_TLM_LINE_LEN - 1) {
+                rx->line[rx->line_len++] = (char)byte;
+            }
+            return HUB_RX_NONE;
+
+        case HUB_RX_MAGIC:
+            if (byte == HUB_TLM_MAGIC1) {
+                rx->state = HUB_RX_VERSION;
+            } else {
+                // Not a frame after all (text never contains 0xA5, so just resync)
+                rx->state = byte == HUB_TLM_MAGIC0 ? HUB_RX_MAGIC : HUB_RX_TEXT;
+            }
+            return HUB_RX_NONE;
+
+        case HUB_RX_VERSION:
+            rx->version = byte;
+            rx->state = HUB_RX_LENGTH;
+            return HUB_RX_NONE;
+
+        case HUB_RX_LENGTH:
+            if (byte == 0 || byte > HUB_TLM_MAX_PAYLOAD) {
+                rx->bad_frames++;
+                rx->state = HUB_RX_TEXT;
+                return HUB_RX_NONE;
+            }
+            rx->length = byte;
+            rx->pos = 0;
+            rx->state = HUB_RX_PAYLOAD;
+            return HUB_RX_NONE;
+
+        case HUB_RX_PAYLOAD:
+            rx->payload[rx->pos++] = byte;
+            if (rx->pos == rx->length) {
+                rx->state = HUB_RX_CRC;
+            }
+            return HUB_RX_NONE;
+
+        case HUB_RX_CRC:
+            rx->crc_lo = byte;
+            rx->state = HUB_RX_CRC_HI;
+            return HUB_RX_NONE;
+
+        case HUB_RX_CRC_HI:
+            rx->state = HUB_RX_TEXT;
+            if (hub_tlm_crc16(rx->payload, rx->length) != (uint16_t)(rx->crc_lo | (byte << 8))) {
+                rx->crc_errors++;
+                return HUB_RX_NONE;
+            }
+            if (!hub_tlm_decode(rx->payload, rx->version, rx->length, &rx->frame)) {
+                rx->bad_frames++;
+                return HUB_RX_NONE;
+            }
+            rx->frames++;
+            return HUB_RX_FRAME;
+    }
+    return HUB_RX_NONE;
+}
+
+// ---------------------------------------------------------------------------
+// Latest-value store (seqlock)
+
+typedef struct {
+    int64_t rx_us;              // Local receive time
+    hub_telemetry_t value;
+} hub_tlm_sample_t;
+
+typedef struct {
+    uint32_t seq;               // Odd while a write is in progress
+    hub_tlm_sample_t sample;
+} hub_tlm_latest_t;
+
+static void hub_tlm_latest_write(hub_tlm_latest_t *cell, const hub_tlm_sample_t *s) {
+    uint32_t seq = __atomic_load_n(&cell->seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&cell->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    cell->sample = *s;
+    __atomic_store_n(&cell->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+// Returns false if nothing was ever written
+static bool hub_tlm_latest_read(const hub_tlm_latest_t *cell, hub_tlm_sample_t *out) {
+    uint32_t before, after = 0;
+    do {
+        before = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        if (before & 1) {
+            continue;
+        }
+        *out = cell->sample;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&cell->seq, __ATOMIC_RELAXED);
+    } while ((before & 1) || before != after);
+    return before != 0;
+}
+
+// ---------------------------------------------------------------------------
+// Time-series ring (single writer)
+
+typedef struct {
+    hub_tlm_sample_t *slots;
+    uint32_t mask;              // Capacity - 1, capacity is a power of two
+    uint32_t head;              // Samples written so far
+} hub_tlm_ring_t;
+
+static void hub_tlm_ring_init(hub_tlm_ring_t *ring, hub_tlm_sample_t *slots, uint32_t capacity) {
+    ring->slots = slots;
+    ring->mask = capacity - 1;
+    ring->head = 0;
+}
+
+static void hub_tlm_ring_push(hub_tlm_ring_t *ring, const hub_tlm_sample_t *s) {
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    ring->slots[head & ring->mask] = *s;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Copy up to `max` of the newest samples, oldest first. Samples the writer
+// overwrote during the copy are dropped from the front. Returns the count.
+static uint32_t hub_tlm_ring_read(const hub_tlm_ring_t *ring, hub_tlm_sample_t *out, uint32_t max) {
+    uint32_t capacity = ring->mask + 1;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t n = head < capacity ? head : capacity;
+    if (n > max) {
+        n = max;
+    }
+    uint32_t first = head - n;
+    for (uint32_t i = 0; i < n; i++) {
+        out[i] = ring->slots[(first + i) & ring->mask];
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    // The writer may be filling slot head_now, which held sample
+    // head_now - capacity; everything older was overwritten mid-copy
+    uint32_t head_now = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    int64_t oldest = (int64_t)head_now + 1 - capacity;
+    uint32_t lost = oldest > (int64_t)first ? (uint32_t)(oldest - first) : 0;
+    if (lost >= n) {
+        return 0;
+    }
+    if (lost > 0) {
+        memmove(out, out + lost, (n - lost) * sizeof(*out));
+    }
+    return n - lost;
+}
@@ -0,0 +1,501 @@
+#pragma once
+
+// Change signature of a baseline JPEG, read from the compressed stream.
+//
+// The scan is Huffman-decoded without dequantizing the AC coefficients or
+// running an IDCT: the AC codes are only skipped. Each luma block's DC
+// coefficient (8x its mean brightness, minus 1024) is averaged into a
+// JPEG_SIG_COLS x JPEG_SIG_ROWS grid of cells, kept as grey levels. Two frames of an unchanged
+// scene give nearly the same grid; anything that moves or appears shifts
+// the cells it covers.
+//
+// jpeg_dedup_check() compares a frame's signature against the last frame
+// sent to one receiver and says whether to send it: yes if enough cells
+// moved, if the signature could not be read, or if the receiver has had
+// nothing for refresh_us.
+//
+// Handles baseline and extended sequential Huffman JPEGs with up to two
+// Huffman tables per class, 1 or 3 components, any sampling factors and
+// restart intervals (what the camera sensors produce). Progressive or
+// arithmetic-coded files are refused.
+// No ESP-IDF dependencies.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef JPEG_SIG_COLS
+#define JPEG_SIG_COLS 40
+#endif
+#ifndef JPEG_SIG_ROWS
+#define JPEG_SIG_ROWS 30
+#endif
+#define JPEG_SIG_CELLS (JPEG_SIG_COLS * JPEG_SIG_ROWS)
+
+typedef struct {
+    bool valid;
+    uint16_t width;
+    uint16_t height;
+    int8_t cell[JPEG_SIG_CELLS];    // Mean luma of the cell, minus 128
+} jpeg_sig_t;
+
+// One Huffman table: an 8-bit lookahead plus the canonical code limits of
+// JPEG Annex F.2.2.3 for the longer codes
+typedef struct {
+    uint16_t look[256];             // (length << 8) | value, 0 = longer than 8 bits
+    int32_t maxcode[18];
+    int32_t valptr[17];
+    int32_t mincode[17];
+    uint8_t val[256];
+} jpeg_huff_t;
+
+typedef struct {
+    uint8_t id;
+    uint8_t h, v;                   // Sampling factors
+    uint8_t tq;                     // Quantization table
+    uint8_t td, ta;                 // Huffman tables (from the SOS)
+    int16_t pred;                   // DC predictor
+} jpeg_comp_t;
+
+// Decoder state and tables, about 9 KB: keep one per task as a static
+// rather than on the stack
+typedef struct {
+    jpeg_huff_t dc[2];
+    jpeg_huff_t ac[2];
+    uint16_t qt[4][64];             // Natural order
+    jpeg_comp_t comp[3];
+    int ncomp;
+    int hmax, vmax;
+    uint16_t width, height;
+    uint16_t restart;               // MCUs per restart interval, 0 = none
+    uint8_t tables;                 // Huffman tables defined: DC in bits 0-1, AC in 4-5
+
+    // Bit reader
+    const uint8_t *p, *end;
+    uint32_t acc;
+    int bits;
+    bool marker;                    // Hit a marker: reads return zeros
+    int pad;                        // Zero bytes read past it
+
+    int32_t sum[JPEG_SIG_CELLS];    // Luma DC per signature cell
+} jpeg_sig_decoder_t;
+
+// Called for every block of a jpeg_sig_scan() with its dequantized
+// coefficients in natural order (host tools use it to decode pixels)
+typedef void (*jpeg_sig_block_cb_t)(void *arg, const jpeg_sig_decoder_t *d, int comp, int bx, int by, const int16_t *coef);
+
+static const uint8_t jpeg_zigzag[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+static uint16_t jpeg_rd16(const uint8_t *p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+// Annex C: code lengths to canonical codes. False if the counts overflow.
+static bool jpeg_huff_build(jpeg_huff_t *t, const uint8_t counts[16], const uint8_t *values, int nvalues) {
+    memset(t->look, 0, sizeof(t->look));
+    memcpy(t->val, values, nvalues);
+    int32_t code = 0;
+    int k = 0;
+    for (int len = 1; len <= 16; len++) {
+        t->valptr[len] = k;
+        t->mincode[len] = code;
+        for (int i = 0; i < counts[len - 1]; i++, k++, code++) {
+            if (len <= 8) {
+                int shift = 8 - len;
+                for (int fill = 0; fill < (1 << shift); fill++) {
+                    t->look[(code << shift) | fill] = (uint16_t)(len << 8 | values[k]);
+                }
+            }
+        }
+        t->maxcode[len] = counts[len - 1] ? code - 1 : -1;
+        if (code > (1 << len)) {
+            return false;
+        }
+        code <<= 1;
+    }
+    t->maxcode[17] = INT32_MAX;     // Sentinel: ends a search through bad data
+    return k == nvalues;
+}
+
+static void jpeg_bits_fill(jpeg_sig_decoder_t *d) {
+    while (d->bits <= 24) {
+        uint32_t byte = 0;
+        if (d->marker || d->p >= d->end) {
+            d->pad++;
+        } else {
+            byte = *d->p;
+            if (byte == 0xFF) {
+                uint8_t next = d->p + 1 < d->end ? d->p[1] : 0xD9;
+                if (next == 0x00) {
+                    d->p += 2;              // Stuffed zero
+                } else {
+                    d->marker = true;       // Leave the marker for the restart check
+                    d->pad++;
+                    byte = 0;
+                }
+            } else {
+                d->p++;
+            }
+        }
+        d->acc |= byte << (24 - d->bits);
+        d->bits += 8;
+    }
+}
+
+static uint32_t jpeg_bits_get(jpeg_sig_decoder_t *d, int n) {
+    if (n == 0) {
+        return 0;
+    }
+    jpeg_bits_fill(d);
+    uint32_t v = d->acc >> (32 - n);
+    d->acc <<= n;
+    d->bits -= n;
+    return v;
+}
+
+static int jpeg_huff_decode(jpeg_sig_decoder_t *d, const jpeg_huff_t *t) {
+    jpeg_bits_fill(d);
+    uint16_t e = t->look[d->acc >> 24];
+    if (e) {
+        int len = e >> 8;
+        d->acc <<= len;
+        d->bits -= len;
+        return e & 0xFF;
+    }
+    int32_t code = (int32_t)(d->acc >> 23);
+    int len = 9;
+    while (code > t->maxcode[len]) {
+        code = (int32_t)(d->acc >> (31 - len));
+        len++;
+    }
+    if (len > 16) {
+        return -1;
+    }
+    d->acc <<= len;
+    d->bits -= len;
+    return t->val[t->valptr[len] + code - t->mincode[len]];
+}
+
+// F.2.2.1 EXTEND
+static int jpeg_extend(uint32_t v, int s) {
+    return v < (1u << (s - 1)) ? (int)v - (1 << s) + 1 : (int)v;
+}
+
+// Decode one block. The DC value (dequantized) is returned in *dc; AC
+// coefficients are only stored if coef is not NULL.
+static bool jpeg_decode_block(jpeg_sig_decoder_t *d, jpeg_comp_t *c, int16_t *coef, int *dc) {
+    int t = jpeg_huff_decode(d, &d->dc[c->td]);
+    if (t < 0 || t > 11) {
+        return false;
+    }
+    c->pred += t ? jpeg_extend(jpeg_bits_get(d, t), t) : 0;
+    *dc = c->pred * d->qt[c->tq][0];
+
+    const jpeg_huff_t *ac = &d->ac[c->ta];
+    if (coef) {
+        memset(coef, 0, 64 * sizeof(*coef));
+        coef[0] = (int16_t)*dc;
+    }
+    for (int k = 1; k < 64; k++) {
+        int rs = jpeg_huff_decode(d, ac);
+        if (rs < 0) {
+            return false;
+        }
+        int r = rs >> 4, s = rs & 15;
+        if (s == 0) {
+            if (r != 15) {
+                break;              // End of block
+            }
+            k += 15;
+            continue;
+        }
+        k += r;
+        if (k > 63) {
+            return false;
+        }
+        uint32_t v = jpeg_bits_get(d, s);
+        if (coef) {
+            int z = jpeg_zigzag[k];
+            coef[z] = (int16_t)(jpeg_extend(v, s) * d->qt[c->tq][z]);
+        }
+    }
+    return true;
+}
+
+// Headers up to the start of the scan. Returns the scan data, or NULL.
+static const uint8_t *jpeg_sig_headers(jpeg_sig_decoder_t *d, const uint8_t *jpg, size_t len) {
+    const uint8_t *p = jpg, *end = jpg + len;
+    if (len < 4 || p[0] != 0xFF || p[1] != 0xD8) {
+        return NULL;
+    }
+    p += 2;
+    d->ncomp = 0;
+    d->restart = 0;
+    d->tables = 0;
+    bool have_sof = false;
+    while (p + 4 <= end) {
+        if (p[0] != 0xFF) {
+            return NULL;
+        }
+        uint8_t marker = p[1];
+        if (marker == 0xFF) {
+            p++;                    // Fill byte
+            continue;
+        }
+        size_t seg = jpeg_rd16(p + 2);
+        const uint8_t *s = p + 4, *s_end = p + 2 + seg;
+        if (seg < 2 || s_end > end) {
+            return NULL;
+        }
+        switch (marker) {
+        case 0xC0:                  // Baseline
+        case 0xC1:                  // Extended sequential, Huffman
+            if (seg < 8 || s[0] != 8) {
+                return NULL;
+            }
+            d->height = jpeg_rd16(s + 1);
+            d->width = jpeg_rd16(s + 3);
+            d->ncomp = s[5];
+            if ((d->ncomp != 1 && d->ncomp != 3) || seg < 8 + 3u * d->ncomp || !d->width || !d->height) {
+                return NULL;
+            }
+            d->hmax = d->vmax = 1;
+            for (int i = 0; i < d->ncomp; i++) {
+                jpeg_comp_t *c = &d->comp[i];
+                c->id = s[6 + 3 * i];
+                c->h = s[7 + 3 * i] >> 4;
+                c->v = s[7 + 3 * i] & 15;
+                c->tq = s[8 + 3 * i] & 3;
+                if (c->h < 1 || c->h > 4 || c->v < 1 || c->v > 4) {
+                    return NULL;
+                }
+                if (c->h > d->hmax) d->hmax = c->h;
+                if (c->v > d->vmax) d->vmax = c->v;
+            }
+            have_sof = true;
+            break;
+        case 0xC2: case 0xC3: case 0xC5: case 0xC6: case 0xC7:
+        case 0xC9: case 0xCA: case 0xCB: case 0xCD: case 0xCE: case 0xCF:
+            return NULL;            // Progressive, lossless or arithmetic
+        case 0xC4:
+            while (s + 17 <= s_end) {
+                int cls = s[0] >> 4, id = s[0] & 15;
+                int n = 0;
+                for (int i = 0; i < 16; i++) {
+                    n += s[1 + i];
+                }
+                if (cls > 1 || id > 1 || n > 256 || s + 17 + n > s_end) {
+                    return NULL;
+                }
+                if (!jpeg_huff_build(cls ? &d->ac[id] : &d->dc[id], s + 1, s + 17, n)) {
+                    return NULL;
+                }
+                d->tables |= 1 << (cls * 4 + id);
+                s += 17 + n;
+            }
+            break;
+        case 0xDB:
+            while (s < s_end) {
+                int prec = s[0] >> 4, id = s[0] & 3;
+                size_t n = prec ? 128 : 64;
+                if (s + 1 + n > s_end) {
+                    return NULL;
+                }
+                for (int i = 0; i < 64; i++) {
+                    d->qt[id][jpeg_zigzag[i]] = prec ? jpeg_rd16(s + 1 + 2 * i) : s[1 + i];
+                }
+                s += 1 + n;
+            }
+            break;
+        case 0xDD:
+            if (seg < 4) {
+                return NULL;
+            }
+            d->restart = jpeg_rd16(s);
+            break;
+        case 0xDA: {
+            if (!have_sof || seg < 6 || s[0] != d->ncomp || seg < 6 + 2u * d->ncomp) {
+                return NULL;        // Only interleaved scans of every component
+            }
+            for (int i = 0; i < d->ncomp; i++) {
+                jpeg_comp_t *c = &d->comp[i];
+                if (s[1 + 2 * i] != c->id) {
+                    return NULL;
+                }
+                c->td = s[2 + 2 * i] >> 4;
+                c->ta = s[2 + 2 * i] & 15;
+                if (c->td > 1 || c->ta > 1 || !(d->tables & 1 << c->td) || !(d->tables & 1 << (4 + c->ta))) {
+                    return NULL;
+                }
+            }
+            return s_end;
+        }
+        case 0xD9:
+            return NULL;
+        default:
+            break;                  // APPn, COM, ...
+        }
+        p = s_end;
+    }
+    return NULL;
+}
+
+// Decode the whole scan into *sig, calling cb (if not NULL) for every
+// block. Returns sig->valid.
+static bool jpeg_sig_scan(jpeg_sig_decoder_t *d, const uint8_t *jpg, size_t len, jpeg_sig_t *sig,
+                          jpeg_sig_block_cb_t cb, void *arg) {
+    sig->valid = false;
+    const uint8_t *scan = jpeg_sig_headers(d, jpg, len);
+    if (!scan) {
+        return false;
+    }
+    sig->width = d->width;
+    sig->height = d->height;
+
+    int mcu_w = 8 * d->hmax, mcu_h = 8 * d->vmax;
+    int mcus_x = (d->width + mcu_w - 1) / mcu_w;
+    int mcus_y = (d->height + mcu_h - 1) / mcu_h;
+    const jpeg_comp_t *y = &d->comp[0];
+    // Only blocks with some of the image in them count
+    int luma_x = (d->width * y->h / d->hmax + 7) / 8;
+    int luma_y = (d->height * y->v / d->vmax + 7) / 8;
+
+    memset(d->sum, 0, sizeof(d->sum));
+    d->p = scan;
+    d->end = jpg + len;
+    d->acc = 0;
+    d->bits = 0;
+    d->marker = false;
+    d->pad = 0;
+    for (int i = 0; i < d->ncomp; i++) {
+        d->comp[i].pred = 0;
+    }
+
+    int16_t coef[64];
+    int mcus = mcus_x * mcus_y;
+    for (int m = 0; m < mcus; m++) {
+        if (d->restart && m > 0 && m % d->restart == 0) {
+            // Byte-align and expect RSTn
+            d->acc = 0;
+            d->bits = 0;
+            d->marker = false;
+            d->pad = 0;
+            if (d->p + 2 > d->end || d->p[0] != 0xFF || (d->p[1] & 0xF8) != 0xD0) {
+                return false;
+            }
+            d->p += 2;
+            for (int i = 0; i < d->ncomp; i++) {
+                d->comp[i].pred = 0;
+            }
+        }
+        int mx = m % mcus_x, my = m / mcus_x;
+        for (int ci = 0; ci < d->ncomp; ci++) {
+            jpeg_comp_t *c = &d->comp[ci];
+            for (int v = 0; v < c->v; v++) {
+                for (int h = 0; h < c->h; h++) {
+                    int dc;
+                    if (!jpeg_decode_block(d, c, cb ? coef : NULL, &dc)) {
+                        return false;
+                    }
+                    int bx = mx * c->h + h, by = my * c->v + v;
+                    if (cb) {
+                        cb(arg, d, ci, bx, by, coef);
+                    }
+                    if (ci == 0 && bx < luma_x && by < luma_y) {
+                        int cell = (by * JPEG_SIG_ROWS / luma_y) * JPEG_SIG_COLS + bx * JPEG_SIG_COLS / luma_x;
+                        d->sum[cell] += dc;
+                    }
+                }
+            }
+        }
+        // The reader looks at most 4 bytes ahead; more zeros than that
+        // were decoded as data, so the scan is truncated
+        if (d->pad > 4) {
+            return false;
+        }
+    }
+
+    // Blocks per column and row of cells. Frames smaller than the grid
+    // leave cells empty; they stay 0 in both frames.
+    uint16_t cols[JPEG_SIG_COLS] = {0}, rows[JPEG_SIG_ROWS] = {0};
+    for (int bx = 0; bx < luma_x; bx++) {
+        cols[bx * JPEG_SIG_COLS / luma_x]++;
+    }
+    for (int by = 0; by < luma_y; by++) {
+        rows[by * JPEG_SIG_ROWS / luma_y]++;
+    }
+    for (int i = 0; i < JPEG_SIG_CELLS; i++) {
+        int32_t n = 8 * cols[i % JPEG_SIG_COLS] * rows[i / JPEG_SIG_COLS], sum = d->sum[i];
+        int mean = n ? (sum >= 0 ? (sum + n / 2) / n : -((-sum + n / 2) / n)) : 0;
+        sig->cell[i] = (int8_t)(mean < -128 ? -128 : mean > 127 ? 127 : mean);
+    }
+    sig->valid = true;
+    return true;
+}
+
+static bool jpeg_sig_extract(jpeg_sig_decoder_t *d, const uint8_t *jpg, size_t len, jpeg_sig_t *sig) {
+    return jpeg_sig_scan(d, jpg, len, sig, NULL, NULL);
+}
+
+// Cells of b that differ from a by more than threshold, or JPEG_SIG_CELLS
+// if the two cannot be compared
+static int jpeg_sig_diff(const jpeg_sig_t *a, const jpeg_sig_t *b, int threshold) {
+    if (!a->valid || !b->valid || a->width != b->width || a->height != b->height) {
+        return JPEG_SIG_CELLS;
+    }
+    int changed = 0;
+    for (int i = 0; i < JPEG_SIG_CELLS; i++) {
+        int delta = a->cell[i] - b->cell[i];
+        if (delta > threshold || delta < -threshold) {
+            changed++;
+        }
+    }
+    return changed;
+}
+
+// Near-duplicate suppression for one receiver
+
+typedef struct {
+    int threshold;              // Cell change, in grey levels
+    int min_cells;              // Changed cells that make a new frame
+    uint32_t refresh_us;        // Send at least this often
+} jpeg_dedup_cfg_t;
+
+typedef struct {
+    jpeg_sig_t last;            // Last frame sent
+    int64_t sent_us;
+    bool started;
+    uint32_t sent;
+    uint32_t suppressed;
+    uint32_t refreshed;         // Unchanged frames sent for the refresh interval
+    uint64_t bytes_saved;
+} jpeg_dedup_t;
+
+static void jpeg_dedup_reset(jpeg_dedup_t *d) {
+    *d = (jpeg_dedup_t){0};
+}
+
+// Whether to send a `len`-byte frame with signature `sig` at `now`
+static bool jpeg_dedup_check(jpeg_dedup_t *d, const jpeg_dedup_cfg_t *cfg, const jpeg_sig_t *sig, size_t len, int64_t now) {
+    bool changed = !d->started || jpeg_sig_diff(&d->last, sig, cfg->threshold) >= cfg->min_cells;
+    bool refresh = !changed && now - d->sent_us >= (int64_t)cfg->refresh_us;
+    if (!changed && !refresh) {
+        d->suppressed++;
+        d->bytes_saved += len;
+        return false;
+    }
+    if (refresh) {
+        d->refreshed++;
+    }
+    d->last = *sig;
+    d->sent_us = now;
+    d->started = true;
+    d->sent++;
+    return true;
+}
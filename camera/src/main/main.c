@@ -19,10 +19,20 @@
 #include <esp_http_server.h>
 
 #include "camera.h"
+#include "camera_control.h"
 #include "wifi_sta.h"
-#include "mdns_service.h"
 #include "web_ui.h"
 #include "train_ble.h"
+#include "mdns_service.h"
+#include "power.h"
+#include "alloc_audit.h"
+#include "trace.h"
+#include "runtime_config.h"
+#include "camera_supervisor.h"
+#include "ota.h"
+#include "detector.h"
+#include "udp.h"
+#include "h264_stream.h"
 #include "http_server.h"
 
 static char const *const TAG = "CAMERA-MAIN";
@@ -57,15 +67,42 @@ void app_main(void) {
     train_ble_init();
     ESP_LOGI(TAG, "Train BLE init complete. Free heap: %lu bytes", (unsigned long)esp_get_free_heap_size());
 
-    // Start mDNS service (allows access via wildlife-train.local)
+    // Start mDNS service (allows access via train-XXXXXX.local)
     ESP_LOGI(TAG, "Starting mDNS service...");
     start_mdns_service();
 
+    // Runtime configuration from NVS (set up by the WiFi init)
+    runtime_config_init();
+    train_config_t config;
+    runtime_config_get(&config);
+
     // Initialize camera:
     ESP_LOGI(TAG, "Initializing camera...");
-    init_camera();
+    init_camera(config.cam_mode == RUNTIME_CAM_CONTINUOUS, runtime_config_yuv_framesize(&config));
+    camera_control_init();
     ESP_LOGI(TAG, "Camera init complete. Free heap: %lu bytes", (unsigned long)esp_get_free_heap_size());
 
+    // Power management (needs camera + WiFi up)
+    ESP_LOGI(TAG, "Initializing power management...");
+    power_init();
+
+    // Camera fault detection and recovery (needs camera control and power up)
+    camera_supervisor_start();
+
+    // UDP / RTP streaming (receivers subscribe through the API server)
+    ESP_LOGI(TAG, "Starting UDP streaming...");
+    udp_stream_start();
+
+    // H.264 encoder (idle unless /config?codec=h264 and somebody watches)
+    h264_stream_start();
+
+    // Animal detector (needs a model in the "model" partition)
+    ESP_LOGI(TAG, "Starting animal detector...");
+    detector_start();
+
+    // Firmware updates (POST /ota); reports whether this image is on probation
+    ota_init();
+
     // Start HTTP server with MJPEG streaming:
     ESP_LOGI(TAG, "Starting HTTP server...");
     start_http_server();
@@ -73,12 +110,25 @@ void app_main(void) {
 
     ESP_LOGI(TAG, "System ready!");
 
-    // Main loop - just keep the task alive and log memory stats periodically
+    // From here on, streaming should not allocate (CONFIG_TRAIN_ALLOC_AUDIT)
+    alloc_audit_init();
+
+    // Main loop - just keep the task alive and log memory/power/radio stats periodically
     while (1) {
         vTaskDelay(pdMS_TO_TICKS(30000)); // Every 30 seconds
 
+        // A new image stays only if it got the camera and WiFi up
+        ota_check_boot(esp_camera_sensor_get() != NULL && wifi_wait_connected(0));
+
         ESP_LOGI(TAG, "Free heap: %lu bytes, min free: %lu bytes",
             (unsigned long)esp_get_free_heap_size(),
             (unsigned long)esp_get_minimum_free_heap_size());
+        power_log_stats();
+        camera_supervisor_log_stats();
+        train_ble_log_stats();
+        detector_log_stats();
+        frame_dedup_log_stats();
+        alloc_audit_log_stats();
+        trace_log_stats();
     }
 }
@@ -1,13 +1,141 @@
 #pragma once
 
+// mDNS hostname and DNS-SD services.
+//
+//   _http._tcp     port 80  web UI / API
+//   _http._tcp     port 81  MJPEG stream, for browsers
+//   _mjpeg._tcp    port 81  MJPEG stream, with capability TXT records
+//   _wstrain._udp  UDP stream (chunked / RTP), with capability TXT records
+//
+// TXT records are refreshed every few seconds from the live camera, stream
+// and BLE state; only changed keys are re-announced.
+
 #include <mdns.h>
 #include <esp_log.h>
+#include <esp_mac.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include "camera.h"
+#include "camera_control.h"
+#include "train_ble.h"
 
 #define MDNS_HOSTNAME "train"
 #define MDNS_INSTANCE "Wildlife Spotter Train Camera"
+#define MDNS_STREAM_INSTANCE "Wildlife Train Stream"
+#define MDNS_PROTOCOL_VERSION "1"  // Bump when the UDP stream formats change
+#define MDNS_UDP_PORT 5005
+#define MDNS_TXT_REFRESH_MS 5000
 
 static const char *MDNS_TAG = "MDNS";
 
+static char mdns_hostname[32] = MDNS_HOSTNAME;
+static char mdns_instance[64] = MDNS_INSTANCE;
+static char mdns_stream_instance[64] = MDNS_STREAM_INSTANCE;
+static SemaphoreHandle_t mdns_txt_mutex = NULL;
+static esp_timer_handle_t mdns_txt_timer = NULL;
+
+typedef struct {
+    const char *key;
+    bool on_mjpeg;      // Also published on _mjpeg._tcp (otherwise _wstrain._udp only)
+    char value[24];     // Last published value, "" = not published
+} mdns_txt_entry_t;
+
+static mdns_txt_entry_t mdns_txt_entries[] = {
+    { "framesize", true },
+    { "fps", true },
+    { "quality", true },
+    { "preset", false },
+    { "ble", false },
+    { "hubs", false },
+    { "mcast", false },
+    { "mcast_ttl", false },
+    { "mcast_proto", false },
+};
+
+// Publish a TXT key on our services if its value changed. An empty value
+// removes the key.
+static void mdns_set_txt(const char *key, const char *value) {
+    if (!mdns_txt_mutex) {
+        return;
+    }
+    xSemaphoreTake(mdns_txt_mutex, portMAX_DELAY);
+    for (size_t i = 0; i < sizeof(mdns_txt_entries) / sizeof(mdns_txt_entries[0]); i++) {
+        mdns_txt_entry_t *item = &mdns_txt_entries[i];
+        if (strcmp(item->key, key) != 0) {
+            continue;
+        }
+        if (strcmp(item->value, value) == 0) {
+            break;
+        }
+        strlcpy(item->value, value, sizeof(item->value));
+        if (value[0]) {
+            mdns_service_txt_item_set_for_host(mdns_instance, "_wstrain", "_udp", NULL, key, value);
+            if (item->on_mjpeg) {
+                mdns_service_txt_item_set_for_host(mdns_instance, "_mjpeg", "_tcp", NULL, key, value);
+            }
+        } else {
+            mdns_service_txt_item_remove_for_host(mdns_instance, "_wstrain", "_udp", NULL, key);
+            if (item->on_mjpeg) {
+                mdns_service_txt_item_remove_for_host(mdns_instance, "_mjpeg", "_tcp", NULL, key);
+            }
+        }
+        break;
+    }
+    xSemaphoreGive(mdns_txt_mutex);
+}
+
+// Re-read the camera and BLE state into the TXT records
+static void mdns_refresh_txt(void *arg) {
+    char value[24];
+
+    sensor_t *sensor = esp_camera_sensor_get();
+    if (sensor && sensor->status.framesize < FRAMESIZE_INVALID) {
+        int w = resolution[sensor->status.framesize].width;
+        int h = resolution[sensor->status.framesize].height;
+        if (camera_roi_active && camera_roi_mode == CAMERA_ROI_CROP) {
+            w = camera_roi.w;
+            h = camera_roi.h;
+        }
+        snprintf(value, sizeof(value), "%dx%d", w, h);
+        mdns_set_txt("framesize", value);
+        snprintf(value, sizeof(value), "%d", sensor->status.quality);
+        mdns_set_txt("quality", value);
+    }
+
+    // Measured capture rate; 0 when nobody is pulling frames
+    uint32_t interval = camera_frame_interval_us;
+    bool capturing = esp_timer_get_time() - camera_last_frame_us < 2000000;
+    snprintf(value, sizeof(value), "%lu", (unsigned long)(capturing && interval ? (1000000 + interval / 2) / interval : 0));
+    mdns_set_txt("fps", value);
+
+    mdns_set_txt("preset", camera_active_preset_name());
+    mdns_set_txt("ble", train_state_str());
+    snprintf(value, sizeof(value), "%d/%d", train_hub_ready_count(&train_hubs), train_hubs.count);
+    mdns_set_txt("hubs", value);
+}
+
+// Announce (or withdraw, with group NULL) the multicast stream so receivers
+// can find the group without configuration.
+static void mdns_announce_multicast(const char *group, int port, int ttl, const char *proto) {
+    char value[24];
+    if (!group) {
+        mdns_set_txt("mcast", "");
+        mdns_set_txt("mcast_ttl", "");
+        mdns_set_txt("mcast_proto", "");
+        ESP_LOGI(MDNS_TAG, "Multicast announcement withdrawn");
+        return;
+    }
+
+    snprintf(value, sizeof(value), "%s:%d", group, port);
+    mdns_set_txt("mcast", value);
+    snprintf(value, sizeof(value), "%d", ttl);
+    mdns_set_txt("mcast_ttl", value);
+    mdns_set_txt("mcast_proto", proto);
+    ESP_LOGI(MDNS_TAG, "Announcing multicast stream %s:%d (ttl %d)", group, port, ttl);
+}
+
 static void start_mdns_service(void) {
     // Initialize mDNS
     esp_err_t err = mdns_init();
@@ -16,31 +144,73 @@ static void start_mdns_service(void) {
         return;
     }
 
-    // Set hostname (will be accessible as wildlife-train.local)
-    err = mdns_hostname_set(MDNS_HOSTNAME);
+#if CONFIG_TRAIN_MDNS_UNIQUE_HOSTNAME
+    // Suffix the WiFi MAC so several trains can share a network
+    uint8_t mac[6];
+    if (esp_read_mac(mac, ESP_MAC_WIFI_STA) == ESP_OK) {
+        snprintf(mdns_hostname, sizeof(mdns_hostname), "%s-%02x%02x%02x", MDNS_HOSTNAME, mac[3], mac[4], mac[5]);
+        snprintf(mdns_instance, sizeof(mdns_instance), "%s %02X%02X%02X", MDNS_INSTANCE, mac[3], mac[4], mac[5]);
+        snprintf(mdns_stream_instance, sizeof(mdns_stream_instance), "%s %02X%02X%02X", MDNS_STREAM_INSTANCE, mac[3], mac[4], mac[5]);
+    }
+#endif
+
+    // Set hostname (will be accessible as <hostname>.local)
+    err = mdns_hostname_set(mdns_hostname);
     if (err != ESP_OK) {
         ESP_LOGE(MDNS_TAG, "mDNS hostname set failed: %s", esp_err_to_name(err));
         return;
     }
 
     // Set instance name (friendly name for service browsers)
-    err = mdns_instance_name_set(MDNS_INSTANCE);
+    err = mdns_instance_name_set(mdns_instance);
     if (err != ESP_OK) {
         ESP_LOGE(MDNS_TAG, "mDNS instance name set failed: %s", esp_err_to_name(err));
         return;
     }
 
     // Advertise HTTP service on port 80 (API server)
-    err = mdns_service_add(MDNS_INSTANCE, "_http", "_tcp", 80, NULL, 0);
+    err = mdns_service_add(mdns_instance, "_http", "_tcp", 80, NULL, 0);
     if (err != ESP_OK) {
         ESP_LOGE(MDNS_TAG, "mDNS service add (port 80) failed: %s", esp_err_to_name(err));
     }
 
     // Advertise HTTP service on port 81 (stream server)
-    mdns_service_add("Wildlife Train Stream", "_http", "_tcp", 81, NULL, 0);
+    mdns_service_add(mdns_stream_instance, "_http", "_tcp", 81, NULL, 0);
+
+    // Typed services for tooling; dynamic keys are added by mdns_refresh_txt()
+    mdns_txt_item_t mjpeg_txt[] = {
+        { "path", "/stream" },
+        { "pv", MDNS_PROTOCOL_VERSION },
+    };
+    err = mdns_service_add(mdns_instance, "_mjpeg", "_tcp", 81,
+        mjpeg_txt, sizeof(mjpeg_txt) / sizeof(mjpeg_txt[0]));
+    if (err != ESP_OK) {
+        ESP_LOGE(MDNS_TAG, "mDNS service add (_mjpeg) failed: %s", esp_err_to_name(err));
+    }
+
+    mdns_txt_item_t udp_txt[] = {
+        { "pv", MDNS_PROTOCOL_VERSION },
+        { "proto", "chunk,rtp" },
+        { "api", "80" },
+        { "stream", "81" },
+    };
+    err = mdns_service_add(mdns_instance, "_wstrain", "_udp", MDNS_UDP_PORT,
+        udp_txt, sizeof(udp_txt) / sizeof(udp_txt[0]));
+    if (err != ESP_OK) {
+        ESP_LOGE(MDNS_TAG, "mDNS service add (_wstrain) failed: %s", esp_err_to_name(err));
+    }
+
+    mdns_txt_mutex = xSemaphoreCreateMutex();
+    const esp_timer_create_args_t timer_args = {
+        .callback = mdns_refresh_txt,
+        .name = "mdns_txt",
+    };
+    if (esp_timer_create(&timer_args, &mdns_txt_timer) == ESP_OK) {
+        esp_timer_start_periodic(mdns_txt_timer, MDNS_TXT_REFRESH_MS * 1000);
+    }
 
     ESP_LOGI(MDNS_TAG, "mDNS service started");
-    ESP_LOGI(MDNS_TAG, "  Hostname: %s.local", MDNS_HOSTNAME);
-    ESP_LOGI(MDNS_TAG, "  Web UI:   http://%s.local/", MDNS_HOSTNAME);
-    ESP_LOGI(MDNS_TAG, "  Stream:   http://%s.local:81/stream", MDNS_HOSTNAME);
+    ESP_LOGI(MDNS_TAG, "  Hostname: %s.local", mdns_hostname);
+    ESP_LOGI(MDNS_TAG, "  Web UI:   http://%s.local/", mdns_hostname);
+    ESP_LOGI(MDNS_TAG, "  Stream:   http://%s.local:81/stream", mdns_hostname);
 }
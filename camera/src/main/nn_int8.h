@@ -0,0 +1,473 @@
+#pragma once
+
+// Int8 neural network kernels for the animal detector (detector.h).
+//
+// Quantization is TensorFlow Lite's int8 scheme, real = scale * (q - zero),
+// with the same rounding, so the results match TFLite's reference kernels:
+//
+//   - weights are symmetric per output channel (zero point 0)
+//   - biases are int32 at input_scale * weight_scale[c]
+//   - each output channel is requantized with a Q31 multiplier and a shift
+//   - the fused activation is a clamp in output units
+//
+// Tensors are HWC (channels innermost). Weights are OHWI for convolution,
+// HWC for depthwise (multiplier 1) and [out][in] for fully connected.
+//
+// Every kernel comes twice. nn_ref_*() follows the definition one output
+// at a time and is what tools/nn_bench.c checks the others against. The
+// fast versions give the same results bit for bit: they fold the input
+// zero point into the bias, so the inner loops are plain int8 x int8 ->
+// int32 multiply-accumulates over contiguous bytes (a row of taps times
+// channels, or a channel vector), which is the shape the ESP32-S3 vector
+// MACs and esp-nn work on. Outputs whose window hangs over a padded border
+// take the reference path.
+//
+// No ESP-IDF dependencies.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef NN_MAX_CHANNELS
+#define NN_MAX_CHANNELS 256
+#endif
+
+typedef struct {
+    int h, w, c;
+} nn_shape_t;
+
+typedef enum {
+    NN_CONV = 1,
+    NN_DWCONV,          // Depthwise, one filter per channel
+    NN_MAXPOOL,
+    NN_AVGPOOL,         // Output quantization = input's
+    NN_FC,              // Fully connected over the flattened input
+} nn_op_t;
+
+typedef enum {
+    NN_PAD_VALID = 0,
+    NN_PAD_SAME,        // TFLite SAME: the extra row/column goes at the end
+} nn_pad_t;
+
+typedef struct {
+    nn_op_t op;
+    uint8_t kh, kw, stride;
+    nn_pad_t pad;
+    uint16_t out_c;             // NN_CONV and NN_FC; the others keep the channels
+    int32_t in_zero;
+    int32_t out_zero;
+    int8_t act_min, act_max;
+    const int8_t *weights;
+    const int32_t *bias;        // Per output channel, may be NULL
+    const int32_t *mult;        // Per output channel, Q31
+    const int32_t *shift;       // Per output channel, > 0 = left
+} nn_layer_t;
+
+static int nn_elems(nn_shape_t s) {
+    return s.h * s.w * s.c;
+}
+
+static int nn_out_dim(int in, int k, int stride, nn_pad_t pad) {
+    return pad == NN_PAD_SAME ? (in + stride - 1) / stride : (in - k) / stride + 1;
+}
+
+static nn_shape_t nn_out_shape(const nn_layer_t *l, nn_shape_t in) {
+    if (l->op == NN_FC) {
+        return (nn_shape_t){ 1, 1, l->out_c };
+    }
+    return (nn_shape_t){
+        nn_out_dim(in.h, l->kh, l->stride, l->pad),
+        nn_out_dim(in.w, l->kw, l->stride, l->pad),
+        l->op == NN_CONV ? l->out_c : in.c,
+    };
+}
+
+static int nn_pad_before(int in, int out, int k, int stride, nn_pad_t pad) {
+    int total = (out - 1) * stride + k - in;
+    return pad == NN_PAD_SAME && total > 0 ? total / 2 : 0;
+}
+
+// ---------------------------------------------------------------------------
+// Requantization (gemmlowp fixed point, as TFLite)
+
+static int32_t nn_srdhm(int32_t a, int32_t b) {
+    if (a == INT32_MIN && b == INT32_MIN) {
+        return INT32_MAX;
+    }
+    int64_t ab = (int64_t)a * b;
+    int64_t nudge = ab >= 0 ? (1 << 30) : (1 - (1 << 30));
+    return (int32_t)((ab + nudge) / ((int64_t)1 << 31));
+}
+
+static int32_t nn_rdbpot(int32_t x, int exponent) {
+    int32_t mask = (int32_t)(((int64_t)1 << exponent) - 1);
+    int32_t remainder = x & mask;
+    int32_t threshold = (mask >> 1) + (x < 0);
+    return (x >> exponent) + (remainder > threshold);
+}
+
+static int32_t nn_requant(int32_t acc, int32_t mult, int32_t shift) {
+    int left = shift > 0 ? shift : 0;
+    int right = shift > 0 ? 0 : -shift;
+    return nn_rdbpot(nn_srdhm((int32_t)((uint32_t)acc << left), mult), right);
+}
+
+static int8_t nn_clamp(int32_t v, const nn_layer_t *l) {
+    return (int8_t)(v < l->act_min ? l->act_min : v > l->act_max ? l->act_max : v);
+}
+
+static int8_t nn_output(const nn_layer_t *l, int oc, int32_t acc) {
+    return nn_clamp(nn_requant(acc, l->mult[oc], l->shift[oc]) + l->out_zero, l);
+}
+
+static int32_t nn_dot(const int8_t *a, const int8_t *b, int n) {
+    int32_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    for (; i < n; i++) {
+        s0 += a[i] * b[i];
+    }
+    return s0 + s1 + s2 + s3;
+}
+
+// ---------------------------------------------------------------------------
+// Reference kernels
+
+// One convolution output, skipping taps in the padding
+static int32_t nn_conv_acc(const nn_layer_t *l, nn_shape_t in, const int8_t *x, int iy0, int ix0, int oc) {
+    int32_t acc = l->bias ? l->bias[oc] : 0;
+    const int8_t *w = l->weights + (size_t)oc * l->kh * l->kw * in.c;
+    for (int ky = 0; ky < l->kh; ky++) {
+        int iy = iy0 + ky;
+        for (int kx = 0; kx < l->kw; kx++) {
+            int ix = ix0 + kx;
+            if (iy < 0 || iy >= in.h || ix < 0 || ix >= in.w) {
+                continue;
+            }
+            const int8_t *xp = x + ((size_t)iy * in.w + ix) * in.c;
+            const int8_t *wp = w + ((size_t)ky * l->kw + kx) * in.c;
+            for (int ic = 0; ic < in.c; ic++) {
+                acc += (xp[ic] - l->in_zero) * wp[ic];
+            }
+        }
+    }
+    return acc;
+}
+
+static void nn_ref_conv(const nn_layer_t *l, nn_shape_t in, const int8_t *x, int8_t *y) {
+    nn_shape_t out = nn_out_shape(l, in);
+    int pt = nn_pad_before(in.h, out.h, l->kh, l->stride, l->pad);
+    int pl = nn_pad_before(in.w, out.w, l->kw, l->stride, l->pad);
+    for (int oy = 0; oy < out.h; oy++) {
+        for (int ox = 0; ox < out.w; ox++) {
+            for (int oc = 0; oc < out.c; oc++) {
+                int32_t acc = nn_conv_acc(l, in, x, oy * l->stride - pt, ox * l->stride - pl, oc);
+                *y++ = nn_output(l, oc, acc);
+            }
+        }
+    }
+}
+
+static int32_t nn_dwconv_acc(const nn_layer_t *l, nn_shape_t in, const int8_t *x, int iy0, int ix0, int c) {
+    int32_t acc = l->bias ? l->bias[c] : 0;
+    for (int ky = 0; ky < l->kh; ky++) {
+        int iy = iy0 + ky;
+        for (int kx = 0; kx < l->kw; kx++) {
+            int ix = ix0 + kx;
+            if (iy < 0 || iy >= in.h || ix < 0 || ix >= in.w) {
+                continue;
+            }
+            acc += (x[((size_t)iy * in.w + ix) * in.c + c] - l->in_zero)
+                * l->weights[((size_t)ky * l->kw + kx) * in.c + c];
+        }
+    }
+    return acc;
+}
+
+static void nn_ref_dwconv(const nn_layer_t *l, nn_shape_t in, const int8_t *x, int8_t *y) {
+    nn_shape_t out = nn_out_shape(l, in);
+    int pt = nn_pad_before(in.h, out.h, l->kh, l->stride, l->pad);
+    int pl = nn_pad_before(in.w, out.w, l->kw, l->stride, l->pad);
+    for (int oy = 0; oy < out.h; oy++) {
+        for (int ox = 0; ox < out.w; ox++) {
+            for (int c = 0; c < out.c; c++) {
+                int32_t acc = nn_dwconv_acc(l, in, x, oy * l->stride - pt, ox * l->stride - pl, c);
+                *y++ = nn_output(l, c, acc);
+            }
+        }
+    }
+}
+
+// TFLite int8 average: round half away from zero, over the taps inside the input
+static int8_t nn_average(int32_t sum, int count, const nn_layer_t *l) {
+    int32_t avg = sum > 0 ? (sum + count / 2) / count : (sum - count / 2) / count;
+    return nn_clamp(avg, l);
+}
+
+static void nn_ref_pool(const nn_layer_t *l, nn_shape_t in, const int8_t *x, int8_t *y) {
+    nn_shape_t out = nn_out_shape(l, in);
+    int pt = nn_pad_before(in.h, out.h, l->kh, l->stride, l->pad);
+    int pl = nn_pad_before(in.w, out.w, l->kw, l->stride, l->pad);
+    for (int oy = 0; oy < out.h; oy++) {
+        for (int ox = 0; ox < out.w; ox++) {
+            for (int c = 0; c < out.c; c++) {
+                int32_t sum = 0, max = INT8_MIN;
+                int count = 0;
+                for (int ky = 0; ky < l->kh; ky++) {
+                    for (int kx = 0; kx < l->kw; kx++) {
+                        int iy = oy * l->stride - pt + ky;
+                        int ix = ox * l->stride - pl + kx;
+                        if (iy < 0 || iy >= in.h || ix < 0 || ix >= in.w) {
+                            continue;
+                        }
+                        int8_t v = x[((size_t)iy * in.w + ix) * in.c + c];
+                        sum += v;
+                        max = v > max ? v : max;
+                        count++;
+                    }
+                }
+                *y++ = l->op == NN_MAXPOOL ? nn_clamp(max, l) : nn_average(sum, count, l);
+            }
+        }
+    }
+}
+
+static void nn_ref_fc(const nn_layer_t *l, nn_shape_t in, const int8_t *x, int8_t *y) {
+    int n = nn_elems(in);
+    for (int o = 0; o < l->out_c; o++) {
+        int32_t acc = l->bias ? l->bias[o] : 0;
+        const int8_t *w = l->weights + (size_t)o * n;
+        for (int i = 0; i < n; i++) {
+            acc += (x[i] - l->in_zero) * w[i];
+        }
+        y[o] = nn_output(l, o, acc);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Fast kernels
+
+// First and last output index (inclusive) whose window lies inside the input
+static void nn_interior(int in, int out, int k, int stride, int pad, int *lo, int *hi) {
+    *lo = (pad + stride - 1) / stride;
+    int last = in - k + pad;
+    *hi = last < 0 ? -1 : last / stride;
+    if (*hi > out - 1) {
+        *hi = out - 1;
+    }
+}
+
+static bool nn_is_interior(int oy, int ox, int y0, int y1, int x0, int x1) {
+    return oy >= y0 && oy <= y1 && ox >= x0 && ox <= x1;
+}
+
+static void nn_conv(const nn_layer_t *l, nn_shape_t in, const int8_t *x, int8_t *y) {
+    nn_shape_t out = nn_out_shape(l, in);
+    int pt = nn_pad_before(in.h, out.h, l->kh, l->stride, l->pad);
+    int pl = nn_pad_before(in.w, out.w, l->kw, l->stride, l->pad);
+    int y0, y1, x0, x1;
+    nn_interior(in.h, out.h, l->kh, l->stride, pt, &y0, &y1);
+    nn_interior(in.w, out.w, l->kw, l->stride, pl, &x0, &x1);
+
+    // bias - in_zero * sum(w): what the zero point takes off a full window
+    int row = l->kw * in.c;
+    int taps = l->kh * row;
+    int32_t folded[NN_MAX_CHANNELS];
+    for (int oc = 0; oc < out.c; oc++) {
+        const int8_t *w = l->weights + (size_t)oc * taps;
+        int32_t sum = 0;
+        for (int i = 0; i < taps; i++) {
+            sum += w[i];
+        }
+        folded[oc] = (l->bias ? l->bias[oc] : 0) - l->in_zero * sum;
+    }
+
+    for (int oy = 0; oy < out.h; oy++) {
+        int iy0 = oy * l->stride - pt;
+        for (int ox = 0; ox < out.w; ox++) {
+            int ix0 = ox * l->stride - pl;
+            if (!nn_is_interior(oy, ox, y0, y1, x0, x1)) {
+                for (int oc = 0; oc < out.c; oc++) {
+                    *y++ = nn_output(l, oc, nn_conv_acc(l, in, x, iy0, ix0, oc));
+                }
+                continue;
+            }
+            // Each kernel row is kw * in.c contiguous input bytes. Four
+            // output channels per pass share the input loads.
+            const int8_t *xp = x + ((size_t)iy0 * in.w + ix0) * in.c;
+            int oc = 0;
+            for (; oc + 4 <= out.c; oc += 4) {
+                const int8_t *w0 = l->weights + (size_t)oc * taps;
+                int32_t a0 = folded[oc], a1 = folded[oc + 1], a2 = folded[oc + 2], a3 = folded[oc + 3];
+                for (int ky = 0; ky < l->kh; ky++) {
+                    const int8_t *xr = xp + (size_t)ky * in.w * in.c;
+                    const int8_t *wr = w0 + ky * row;
+                    for (int i = 0; i < row; i++) {
+                        int32_t v = xr[i];
+                        a0 += v * wr[i];
+                        a1 += v * wr[taps + i];
+                        a2 += v * wr[2 * taps + i];
+                        a3 += v * wr[3 * taps + i];
+                    }
+                }
+                *y++ = nn_output(l, oc, a0);
+                *y++ = nn_output(l, oc + 1, a1);
+                *y++ = nn_output(l, oc + 2, a2);
+                *y++ = nn_output(l, oc + 3, a3);
+            }
+            for (; oc < out.c; oc++) {
+                const int8_t *w = l->weights + (size_t)oc * taps;
+                int32_t acc = folded[oc];
+                for (int ky = 0; ky < l->kh; ky++) {
+                    acc += nn_dot(xp + (size_t)ky * in.w * in.c, w + ky * row, row);
+                }
+                *y++ = nn_output(l, oc, acc);
+            }
+        }
+    }
+}
+
+static void nn_dwconv(const nn_layer_t *l, nn_shape_t in, const int8_t *x, int8_t *y) {
+    nn_shape_t out = nn_out_shape(l, in);
+    int pt = nn_pad_before(in.h, out.h, l->kh, l->stride, l->pad);
+    int pl = nn_pad_before(in.w, out.w, l->kw, l->stride, l->pad);
+    int y0, y1, x0, x1;
+    nn_interior(in.h, out.h, l->kh, l->stride, pt, &y0, &y1);
+    nn_interior(in.w, out.w, l->kw, l->stride, pl, &x0, &x1);
+    int taps = l->kh * l->kw;
+    int c_n = in.c;
+
+    int32_t folded[NN_MAX_CHANNELS];
+    for (int c = 0; c < c_n; c++) {
+        int32_t sum = 0;
+        for (int t = 0; t < taps; t++) {
+            sum += l->weights[t * c_n + c];
+        }
+        folded[c] = (l->bias ? l->bias[c] : 0) - l->in_zero * sum;
+    }
+
+    int32_t acc[NN_MAX_CHANNELS];
+    for (int oy = 0; oy < out.h; oy++) {
+        int iy0 = oy * l->stride - pt;
+        for (int ox = 0; ox < out.w; ox++) {
+            int ix0 = ox * l->stride - pl;
+            if (!nn_is_interior(oy, ox, y0, y1, x0, x1)) {
+                for (int c = 0; c < c_n; c++) {
+                    *y++ = nn_output(l, c, nn_dwconv_acc(l, in, x, iy0, ix0, c));
+                }
+                continue;
+            }
+            // Channel vectors: one tap of every channel per pass
+            for (int c = 0; c < c_n; c++) {
+                acc[c] = folded[c];
+            }
+            for (int ky = 0; ky < l->kh; ky++) {
+                for (int kx = 0; kx < l->kw; kx++) {
+                    const int8_t *xp = x + ((size_t)(iy0 + ky) * in.w + ix0 + kx) * c_n;
+                    const int8_t *wp = l->weights + (size_t)(ky * l->kw + kx) * c_n;
+                    for (int c = 0; c < c_n; c++) {
+                        acc[c] += xp[c] * wp[c];
+                    }
+                }
+            }
+            for (int c = 0; c < c_n; c++) {
+                *y++ = nn_output(l, c, acc[c]);
+            }
+        }
+    }
+}
+
+// Channel vectors over the window clipped to the input
+static void nn_pool(const nn_layer_t *l, nn_shape_t in, const int8_t *x, int8_t *y) {
+    nn_shape_t out = nn_out_shape(l, in);
+    int pt = nn_pad_before(in.h, out.h, l->kh, l->stride, l->pad);
+    int pl = nn_pad_before(in.w, out.w, l->kw, l->stride, l->pad);
+    int c_n = in.c;
+    int32_t acc[NN_MAX_CHANNELS];
+    for (int oy = 0; oy < out.h; oy++) {
+        int ya = oy * l->stride - pt;
+        int yb = ya + l->kh;
+        ya = ya < 0 ? 0 : ya;
+        yb = yb > in.h ? in.h : yb;
+        for (int ox = 0; ox < out.w; ox++) {
+            int xa = ox * l->stride - pl;
+            int xb = xa + l->kw;
+            xa = xa < 0 ? 0 : xa;
+            xb = xb > in.w ? in.w : xb;
+            for (int c = 0; c < c_n; c++) {
+                acc[c] = l->op == NN_MAXPOOL ? INT8_MIN : 0;
+            }
+            for (int iy = ya; iy < yb; iy++) {
+                for (int ix = xa; ix < xb; ix++) {
+                    const int8_t *xp = x + ((size_t)iy * in.w + ix) * c_n;
+                    if (l->op == NN_MAXPOOL) {
+                        for (int c = 0; c < c_n; c++) {
+                            acc[c] = xp[c] > acc[c] ? xp[c] : acc[c];
+                        }
+                    } else {
+                        for (int c = 0; c < c_n; c++) {
+                            acc[c] += xp[c];
+                        }
+                    }
+                }
+            }
+            int count = (yb - ya) * (xb - xa);
+            for (int c = 0; c < c_n; c++) {
+                *y++ = l->op == NN_MAXPOOL ? nn_clamp(acc[c], l) : nn_average(acc[c], count, l);
+            }
+        }
+    }
+}
+
+static void nn_fc(const nn_layer_t *l, nn_shape_t in, const int8_t *x, int8_t *y) {
+    int n = nn_elems(in);
+    for (int o = 0; o < l->out_c; o++) {
+        const int8_t *w = l->weights + (size_t)o * n;
+        int32_t sum = 0;
+        for (int i = 0; i < n; i++) {
+            sum += w[i];
+        }
+        int32_t acc = (l->bias ? l->bias[o] : 0) - l->in_zero * sum + nn_dot(x, w, n);
+        y[o] = nn_output(l, o, acc);
+    }
+}
+
+// Run one layer; `x` and `y` must not overlap
+static void nn_layer_run(const nn_layer_t *l, nn_shape_t in, const int8_t *x, int8_t *y, bool reference) {
+    switch (l->op) {
+    case NN_CONV:
+        (reference ? nn_ref_conv : nn_conv)(l, in, x, y);
+        break;
+    case NN_DWCONV:
+        (reference ? nn_ref_dwconv : nn_dwconv)(l, in, x, y);
+        break;
+    case NN_MAXPOOL:
+    case NN_AVGPOOL:
+        (reference ? nn_ref_pool : nn_pool)(l, in, x, y);
+        break;
+    case NN_FC:
+        (reference ? nn_ref_fc : nn_fc)(l, in, x, y);
+        break;
+    }
+}
+
+// Multiply-accumulates of a layer, for the benchmarks
+static uint32_t nn_layer_macs(const nn_layer_t *l, nn_shape_t in) {
+    nn_shape_t out = nn_out_shape(l, in);
+    switch (l->op) {
+    case NN_CONV:
+        return (uint32_t)nn_elems(out) * l->kh * l->kw * in.c;
+    case NN_DWCONV:
+    case NN_MAXPOOL:
+    case NN_AVGPOOL:
+        return (uint32_t)nn_elems(out) * l->kh * l->kw;
+    case NN_FC:
+        return (uint32_t)nn_elems(in) * l->out_c;
+    }
+    return 0;
+}
@@ -0,0 +1,284 @@
+#pragma once
+
+// Int8 model blobs and the runner for the animal detector (detector.h).
+//
+// A model is a chain of nn_int8.h layers in one little-endian blob, as
+// written by desktop/detector_model.py and flashed to the "model"
+// partition. The firmware maps the partition and runs the weights in
+// place; loading only checks the blob and points the layers into it.
+//
+//   0   "NNQ8", u16 version (1), u16 layer count
+//   8   u16 input h, w, c, class count
+//   16  f32 input scale, i32 input zero point
+//   24  f32 output scale, i32 output zero point (of the last layer)
+//   32  u32 blob size, including the CRC, u32 reserved
+//   40  class labels, 16 bytes each, NUL-padded. Class 0 is "nothing".
+//       layers, 36 bytes each:
+//         u8 op, kh, kw, stride, pad, i8 act_min, act_max, u8 reserved
+//         u16 out_c, u16 reserved, i32 in_zero, i32 out_zero
+//         u32 offsets of weights, bias, mult, shift (0 = none)
+//       weight and int32 arrays, each at a 4-byte aligned offset
+//   end CRC-32 (IEEE) of everything before it
+//
+// The last layer's output is either a class vector (1x1xclasses) or a
+// grid of class scores per cell (HxWxclasses), decoded by
+// detector_policy.h. Runs use two arena buffers of the largest tensor and
+// ping-pong between them. No ESP-IDF dependencies.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "nn_int8.h"
+
+#define NN_MODEL_MAGIC "NNQ8"
+#define NN_MODEL_VERSION 1
+#define NN_MODEL_HEADER 40
+#define NN_MODEL_LAYER 36
+#define NN_MAX_LAYERS 24
+#define NN_MAX_CLASSES 8
+#define NN_LABEL_LEN 16
+
+typedef struct {
+    nn_shape_t in;
+    float in_scale;
+    int32_t in_zero;
+    float out_scale;
+    int32_t out_zero;
+    nn_shape_t out;
+    int classes;
+    char labels[NN_MAX_CLASSES][NN_LABEL_LEN];
+    int layer_count;
+    nn_layer_t layer[NN_MAX_LAYERS];
+    nn_shape_t shape[NN_MAX_LAYERS + 1];    // shape[i] = input of layer i
+    size_t tensor_max;                      // Largest tensor, bytes
+    uint32_t macs;
+} nn_model_t;
+
+static uint16_t nn_rd16(const uint8_t *p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t nn_rd32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static float nn_rdf32(const uint8_t *p) {
+    uint32_t u = nn_rd32(p);
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+static uint32_t nn_crc32(const uint8_t *p, size_t len) {
+    uint32_t crc = 0xFFFFFFFF;
+    while (len--) {
+        crc ^= *p++;
+        for (int i = 0; i < 8; i++) {
+            crc = crc >> 1 ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+// `count` elements of `size` bytes at `off`, inside the blob and aligned
+static bool nn_array(const uint8_t *blob, size_t len, uint32_t off, size_t count, size_t size, const void **out) {
+    if (off == 0 || off % size != 0 || off > len || count * size > len - off
+        || ((uintptr_t)(blob + off) & (size - 1)) != 0) {
+        return false;
+    }
+    *out = blob + off;
+    return true;
+}
+
+// Fill in shapes, sizes and MACs from the layers, checking they chain up
+static bool nn_model_plan(nn_model_t *m, const char **error) {
+    m->shape[0] = m->in;
+    m->tensor_max = (size_t)nn_elems(m->in);
+    m->macs = 0;
+    int32_t zero = m->in_zero;
+    for (int i = 0; i < m->layer_count; i++) {
+        const nn_layer_t *l = &m->layer[i];
+        nn_shape_t in = m->shape[i];
+        if (l->op < NN_CONV || l->op > NN_FC || l->kh == 0 || l->kw == 0 || l->stride == 0
+            || l->pad > NN_PAD_SAME || l->act_min > l->act_max) {
+            *error = "bad layer parameters";
+            return false;
+        }
+        if (l->in_zero != zero || ((l->op == NN_MAXPOOL || l->op == NN_AVGPOOL) && l->out_zero != zero)) {
+            *error = "zero points do not chain";
+            return false;
+        }
+        if (l->op != NN_FC && l->pad == NN_PAD_VALID && (in.h < l->kh || in.w < l->kw)) {
+            *error = "kernel larger than its input";
+            return false;
+        }
+        nn_shape_t out = nn_out_shape(l, in);
+        if (out.c <= 0 || out.c > NN_MAX_CHANNELS || in.c > NN_MAX_CHANNELS) {
+            *error = "too many channels";
+            return false;
+        }
+        m->shape[i + 1] = out;
+        if ((size_t)nn_elems(out) > m->tensor_max) {
+            m->tensor_max = (size_t)nn_elems(out);
+        }
+        m->macs += nn_layer_macs(l, in);
+        zero = l->out_zero;
+    }
+    m->out = m->shape[m->layer_count];
+    if (m->out.c != m->classes || zero != m->out_zero) {
+        *error = "last layer does not match the classes";
+        return false;
+    }
+    return true;
+}
+
+// Check a blob and point the model's layers into it. The blob must stay
+// mapped while the model is used. On failure, *error says why.
+static bool nn_model_load(nn_model_t *m, const uint8_t *blob, size_t len, const char **error) {
+    *error = "too short";
+    if (len < NN_MODEL_HEADER + 4) {
+        return false;
+    }
+    if (memcmp(blob, NN_MODEL_MAGIC, 4) != 0) {
+        *error = "no model (bad magic)";
+        return false;
+    }
+    if (nn_rd16(blob + 4) != NN_MODEL_VERSION) {
+        *error = "unsupported version";
+        return false;
+    }
+    size_t size = nn_rd32(blob + 32);
+    if (size > len || size < NN_MODEL_HEADER + 4) {
+        *error = "truncated";
+        return false;
+    }
+    len = size - 4;
+    if (nn_crc32(blob, len) != nn_rd32(blob + len)) {
+        *error = "CRC mismatch";
+        return false;
+    }
+
+    memset(m, 0, sizeof(*m));
+    m->layer_count = nn_rd16(blob + 6);
+    m->in = (nn_shape_t){ nn_rd16(blob + 8), nn_rd16(blob + 10), nn_rd16(blob + 12) };
+    m->classes = nn_rd16(blob + 14);
+    m->in_scale = nn_rdf32(blob + 16);
+    m->in_zero = (int32_t)nn_rd32(blob + 20);
+    m->out_scale = nn_rdf32(blob + 24);
+    m->out_zero = (int32_t)nn_rd32(blob + 28);
+    size_t layers_at = NN_MODEL_HEADER + (size_t)m->classes * NN_LABEL_LEN;
+    if (m->layer_count < 1 || m->layer_count > NN_MAX_LAYERS || m->classes < 2 || m->classes > NN_MAX_CLASSES
+        || nn_elems(m->in) <= 0 || layers_at + (size_t)m->layer_count * NN_MODEL_LAYER > len) {
+        *error = "bad header";
+        return false;
+    }
+    for (int i = 0; i < m->classes; i++) {
+        memcpy(m->labels[i], blob + NN_MODEL_HEADER + i * NN_LABEL_LEN, NN_LABEL_LEN - 1);
+    }
+
+    for (int i = 0; i < m->layer_count; i++) {
+        const uint8_t *r = blob + layers_at + (size_t)i * NN_MODEL_LAYER;
+        m->layer[i] = (nn_layer_t){
+            .op = (nn_op_t)r[0], .kh = r[1], .kw = r[2], .stride = r[3], .pad = (nn_pad_t)r[4],
+            .act_min = (int8_t)r[5], .act_max = (int8_t)r[6],
+            .out_c = nn_rd16(r + 8),
+            .in_zero = (int32_t)nn_rd32(r + 12), .out_zero = (int32_t)nn_rd32(r + 16),
+        };
+    }
+    if (!nn_model_plan(m, error)) {
+        return false;
+    }
+
+    *error = "weights out of bounds";
+    for (int i = 0; i < m->layer_count; i++) {
+        const uint8_t *r = blob + layers_at + (size_t)i * NN_MODEL_LAYER;
+        nn_layer_t *l = &m->layer[i];
+        nn_shape_t in = m->shape[i];
+        size_t weights;
+        switch (l->op) {
+        case NN_CONV:
+            weights = (size_t)l->out_c * l->kh * l->kw * in.c;
+            break;
+        case NN_DWCONV:
+            weights = (size_t)l->kh * l->kw * in.c;
+            break;
+        case NN_FC:
+            weights = (size_t)l->out_c * nn_elems(in);
+            break;
+        default:
+            continue;           // Pools have no arrays
+        }
+        size_t channels = (size_t)m->shape[i + 1].c;
+        const void *p;
+        if (!nn_array(blob, len, nn_rd32(r + 20), weights, 1, &p)) {
+            return false;
+        }
+        l->weights = p;
+        if (nn_rd32(r + 24) != 0) {
+            if (!nn_array(blob, len, nn_rd32(r + 24), channels, 4, &p)) {
+                return false;
+            }
+            l->bias = p;
+        }
+        if (!nn_array(blob, len, nn_rd32(r + 28), channels, 4, &p)) {
+            return false;
+        }
+        l->mult = p;
+        if (!nn_array(blob, len, nn_rd32(r + 32), channels, 4, &p)) {
+            return false;
+        }
+        l->shift = p;
+        for (size_t c = 0; c < channels; c++) {
+            if (l->shift[c] > 31 || l->shift[c] < -31) {
+                *error = "shift out of range";
+                return false;
+            }
+        }
+    }
+    *error = NULL;
+    return true;
+}
+
+static size_t nn_model_buffer(const nn_model_t *m) {
+    return (m->tensor_max + 15) & ~(size_t)15;
+}
+
+// Two buffers of the largest tensor
+static size_t nn_model_arena_size(const nn_model_t *m) {
+    return 2 * nn_model_buffer(m);
+}
+
+// Where the caller writes the quantized input
+static int8_t *nn_model_input(const nn_model_t *m, int8_t *arena) {
+    (void)m;
+    return arena;
+}
+
+// Called after each layer, for per-layer timing
+typedef void (*nn_layer_cb_t)(int layer, void *arg);
+
+// Run the model on the input in the arena. Returns the output tensor (in
+// the arena). `reference` selects the nn_ref_* kernels.
+static const int8_t *nn_model_run(const nn_model_t *m, int8_t *arena, bool reference, nn_layer_cb_t done, void *arg) {
+    int8_t *buf[2] = { arena, arena + nn_model_buffer(m) };
+    for (int i = 0; i < m->layer_count; i++) {
+        nn_layer_run(&m->layer[i], m->shape[i], buf[i & 1], buf[(i + 1) & 1], reference);
+        if (done) {
+            done(i, arg);
+        }
+    }
+    return buf[m->layer_count & 1];
+}
+
+static const char *nn_op_str(nn_op_t op) {
+    switch (op) {
+    case NN_CONV: return "conv";
+    case NN_DWCONV: return "dwconv";
+    case NN_MAXPOOL: return "maxpool";
+    case NN_AVGPOOL: return "avgpool";
+    case NN_FC: return "fc";
+    }
+    return "?";
+}
@@ -0,0 +1,277 @@
+#pragma once
+
+// Firmware updates over WiFi, with video and train control running.
+//
+// POST /ota?sha256=<hex> with the app image (build/<project>.bin) as the
+// body. The handler checks the request and hands it to the OTA task
+// (httpd_req_async_handler_begin), so the API server is free again at
+// once. The OTA task runs at the lowest priority on core 0. It reads the
+// body and writes the image into the partition that is not running
+// (ota_0 / ota_1), a sector at a time at CONFIG_TRAIN_OTA_RATE_KB
+// (ota_writer.h). TCP flow control slows the upload down to that rate.
+// The image is hashed as it arrives and every sector is read back. Only
+// if the length and the SHA-256 match, and the bootloader accepts the
+// image (esp_ota_set_boot_partition verifies it), does the next boot go
+// to the new partition. The task then answers and, unless ?reboot=0,
+// restarts.
+//
+// A new image boots on probation (CONFIG_BOOTLOADER_APP_ROLLBACK_ENABLE).
+// If it resets before the main loop confirms it, the bootloader goes back
+// to the previous one. The main loop confirms it once the camera is up
+// and WiFi is connected (ota_check_boot). If they are still not up after
+// OTA_CONFIRM_CHECKS checks, it rolls back itself. No new upload is
+// taken until the running image is confirmed.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <esp_log.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <esp_app_desc.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <esp_http_server.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+#include "ota_writer.h"
+
+static const char *OTA_TAG = "OTA";
+
+#define OTA_CONFIRM_CHECKS 4        // Main loop checks (30 s apart) before a rollback
+#define OTA_RECV_RETRIES 3          // Receive timeouts in a row before giving up
+#define OTA_BURST (4 * OTA_SECTOR)  // Sectors that may go out back to back
+#define OTA_REBOOT_DELAY_MS 1000    // Let the response go out
+
+typedef enum {
+    OTA_IDLE = 0,
+    OTA_RECEIVING,
+    OTA_VERIFYING,                  // Bootloader checks on the written image
+    OTA_DONE,                       // Boots the new image next time
+    OTA_FAILED,
+} ota_phase_t;
+
+static const char *const ota_phase_names[] = { "idle", "receiving", "verifying", "done", "failed" };
+
+typedef struct {
+    httpd_req_t *req;               // Async copy, the OTA task completes it
+    uint8_t want[SHA256_DIGEST_LEN];
+    bool reboot;
+} ota_job_t;
+
+// Progress of the current or last upload, for /ota
+static struct {
+    volatile ota_phase_t phase;
+    const char *error;
+    const esp_partition_t *target;
+    volatile uint32_t received;
+    uint32_t length;
+    uint32_t sectors;
+    int64_t start_us;
+    int64_t end_us;
+    int64_t flash_us;
+    int64_t throttle_us;
+    uint32_t max_flash_us;
+    int confirm_checks;
+    bool confirmed;                 // The running image is not on probation
+} ota_state;
+
+#if CONFIG_TRAIN_OTA
+
+static QueueHandle_t ota_queue = NULL;
+static uint8_t ota_sector[OTA_SECTOR];      // Internal RAM: written straight to flash
+static char ota_recv_buf[1460];
+
+static bool ota_flash_erase(void *ctx, uint32_t offset, uint32_t len) {
+    return esp_partition_erase_range((const esp_partition_t *)ctx, offset, len) == ESP_OK;
+}
+
+static bool ota_flash_write(void *ctx, uint32_t offset, const void *data, uint32_t len) {
+    return esp_partition_write((const esp_partition_t *)ctx, offset, data, len) == ESP_OK;
+}
+
+static bool ota_flash_read(void *ctx, uint32_t offset, void *data, uint32_t len) {
+    return esp_partition_read((const esp_partition_t *)ctx, offset, data, len) == ESP_OK;
+}
+
+static int64_t ota_flash_now(void *ctx) {
+    return esp_timer_get_time();
+}
+
+static void ota_flash_sleep(void *ctx, uint32_t us) {
+    vTaskDelay(pdMS_TO_TICKS((us + 999) / 1000));
+}
+
+static void ota_state_update(const ota_writer_t *w) {
+    ota_state.received = w->received;
+    ota_state.sectors = w->sectors;
+    ota_state.flash_us = w->flash_us;
+    ota_state.throttle_us = w->throttle_us;
+    ota_state.max_flash_us = w->max_flash_us;
+}
+
+static void ota_fail(httpd_req_t *req, httpd_err_code_t code, const char *error) {
+    ota_state.error = error;
+    ota_state.end_us = esp_timer_get_time();
+    ota_state.phase = OTA_FAILED;
+    ESP_LOGE(OTA_TAG, "Update failed after %lu bytes: %s", (unsigned long)ota_state.received, error);
+    httpd_resp_send_err(req, code, error);
+    // The rest of the body is still on the socket
+    httpd_sess_trigger_close(req->handle, httpd_req_to_sockfd(req));
+    httpd_req_async_handler_complete(req);
+}
+
+static void ota_run(const ota_job_t *job) {
+    static ota_writer_t w;
+    httpd_req_t *req = job->req;
+    const esp_partition_t *part = ota_state.target;
+    ota_flash_t flash = {
+        .erase = ota_flash_erase, .write = ota_flash_write, .read = ota_flash_read,
+        .now_us = ota_flash_now, .sleep_us = ota_flash_sleep, .ctx = (void *)part, .size = part->size,
+    };
+    ESP_LOGI(OTA_TAG, "Writing %lu bytes to %s at %d KB/s", (unsigned long)ota_state.length, part->label,
+        CONFIG_TRAIN_OTA_RATE_KB);
+    ota_writer_begin(&w, &flash, ota_sector, ota_state.length, job->want, CONFIG_TRAIN_OTA_RATE_KB * 1024, OTA_BURST);
+
+    int timeouts = 0;
+    while (w.received < w.length && w.status == OTA_OK) {
+        uint32_t want = w.length - w.received;
+        int n = httpd_req_recv(req, ota_recv_buf, want < sizeof(ota_recv_buf) ? want : sizeof(ota_recv_buf));
+        if (n == HTTPD_SOCK_ERR_TIMEOUT && ++timeouts < OTA_RECV_RETRIES) {
+            continue;
+        }
+        if (n <= 0) {
+            ota_state_update(&w);
+            ota_fail(req, HTTPD_400_BAD_REQUEST, "upload interrupted");
+            return;
+        }
+        timeouts = 0;
+        ota_writer_feed(&w, ota_recv_buf, n);
+        ota_state_update(&w);
+    }
+    if (ota_writer_finish(&w) != OTA_OK) {
+        ota_state_update(&w);
+        ota_fail(req, w.status == OTA_ERR_FLASH || w.status == OTA_ERR_VERIFY ? HTTPD_500_INTERNAL_SERVER_ERROR
+            : HTTPD_400_BAD_REQUEST, ota_status_name(w.status));
+        return;
+    }
+    ota_state_update(&w);
+
+    ota_state.phase = OTA_VERIFYING;
+    esp_err_t err = esp_ota_set_boot_partition(part);
+    if (err != ESP_OK) {
+        ota_fail(req, HTTPD_400_BAD_REQUEST, err == ESP_ERR_OTA_VALIDATE_FAILED ? "image rejected" : "boot switch failed");
+        return;
+    }
+    ota_state.end_us = esp_timer_get_time();
+    ota_state.phase = OTA_DONE;
+
+    char hex[2 * SHA256_DIGEST_LEN + 1];
+    sha256_hex(w.digest, hex);
+    float seconds = (ota_state.end_us - ota_state.start_us) / 1e6f;
+    ESP_LOGI(OTA_TAG, "Image %s written to %s in %.1f s (flash %.1f s, longest sector %lu us)%s", hex, part->label,
+        seconds, w.flash_us / 1e6f, (unsigned long)w.max_flash_us, job->reboot ? ", restarting" : "");
+
+    char json[256];
+    int len = snprintf(json, sizeof(json),
+        "{\"result\":\"ok\",\"partition\":\"%s\",\"bytes\":%lu,\"sha256\":\"%s\",\"seconds\":%.1f,\"reboot\":%s}",
+        part->label, (unsigned long)w.received, hex, seconds, job->reboot ? "true" : "false");
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_send(req, json, len);
+    httpd_req_async_handler_complete(req);
+
+    if (job->reboot) {
+        vTaskDelay(pdMS_TO_TICKS(OTA_REBOOT_DELAY_MS));
+        esp_restart();
+    }
+}
+
+static void ota_task(void *arg) {
+    ota_job_t job;
+    while (true) {
+        if (xQueueReceive(ota_queue, &job, portMAX_DELAY) == pdTRUE) {
+            ota_run(&job);
+        }
+    }
+}
+
+// Take an upload from the API server. Returns NULL if the OTA task has it,
+// otherwise why not (and req is still the handler's to answer).
+static const char *ota_submit(httpd_req_t *req, const uint8_t want[SHA256_DIGEST_LEN], bool reboot) {
+    if (!ota_queue) {
+        return "OTA not running";
+    }
+    if (ota_state.phase == OTA_RECEIVING || ota_state.phase == OTA_VERIFYING) {
+        return "an update is in progress";
+    }
+    if (!ota_state.confirmed) {
+        return "running image not confirmed yet";
+    }
+    const esp_partition_t *part = esp_ota_get_next_update_partition(NULL);
+    if (!part) {
+        return "no OTA partition";
+    }
+    if (req->content_len == 0 || req->content_len > part->size) {
+        return "image size does not fit the partition";
+    }
+
+    ota_job_t job = { .reboot = reboot };
+    memcpy(job.want, want, SHA256_DIGEST_LEN);
+    if (httpd_req_async_handler_begin(req, &job.req) != ESP_OK) {
+        return "out of memory";
+    }
+    ota_state.error = NULL;
+    ota_state.target = part;
+    ota_state.received = 0;
+    ota_state.sectors = 0;
+    ota_state.end_us = 0;
+    ota_state.flash_us = 0;
+    ota_state.throttle_us = 0;
+    ota_state.max_flash_us = 0;
+    ota_state.length = req->content_len;
+    ota_state.start_us = esp_timer_get_time();
+    ota_state.phase = OTA_RECEIVING;
+    xQueueSend(ota_queue, &job, portMAX_DELAY);    // Never full: one upload at a time
+    return NULL;
+}
+
+#else
+
+static const char *ota_submit(httpd_req_t *req, const uint8_t want[SHA256_DIGEST_LEN], bool reboot) {
+    return "OTA disabled";
+}
+
+#endif
+
+// Confirm a new image once the camera and WiFi are up, or roll it back.
+// Call from the main loop.
+static void ota_check_boot(bool healthy) {
+    if (ota_state.confirmed) {
+        return;
+    }
+    if (healthy) {
+        esp_ota_mark_app_valid_cancel_rollback();
+        ota_state.confirmed = true;
+        ESP_LOGI(OTA_TAG, "Image %s confirmed", esp_app_get_description()->version);
+    } else if (++ota_state.confirm_checks >= OTA_CONFIRM_CHECKS) {
+        ESP_LOGE(OTA_TAG, "New image not healthy after %d checks, rolling back", ota_state.confirm_checks);
+        esp_ota_mark_app_invalid_rollback_and_reboot();
+    }
+}
+
+static void ota_init(void) {
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    esp_ota_img_states_t state = ESP_OTA_IMG_UNDEFINED;
+    esp_ota_get_state_partition(running, &state);
+    ota_state.confirmed = state != ESP_OTA_IMG_PENDING_VERIFY;
+    ESP_LOGI(OTA_TAG, "Running %s from %s%s", esp_app_get_description()->version, running->label,
+        ota_state.confirmed ? "" : " (on probation)");
+
+#if CONFIG_TRAIN_OTA
+    ota_queue = xQueueCreate(1, sizeof(ota_job_t));
+    // Lowest priority: the upload only gets the time nothing else wants
+    xTaskCreatePinnedToCore(ota_task, "ota", 4096, NULL, tskIDLE_PRIORITY + 1, NULL, 0);
+#endif
+}
@@ -0,0 +1,208 @@
+#pragma once
+
+// Firmware image writer for OTA updates (ota.h).
+//
+// The image arrives in pieces of any size. Each piece is hashed (SHA-256)
+// and copied into a one-sector buffer. A full sector is erased, written
+// and read back to check the write, then the buffer is reused. The last,
+// partial sector is written by ota_writer_finish, which then compares the
+// length and the digest with the ones the uploader announced. Nothing
+// marks the image bootable here: the caller does that once finish
+// returns OTA_OK.
+//
+// Erasing and writing flash stalls the cache, and with it PSRAM, on both
+// cores. So the sectors go out at a limited rate: a token bucket holds up
+// to `burst` bytes and refills at `bytes_per_s`. Each sector costs its
+// full size, and the writer sleeps until the bucket has it. The rest of
+// the time the flash is free for the camera and the stream.
+//
+// No ESP-IDF dependencies; flash access, the clock and sleeping go
+// through ota_flash_t.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sha256.h"
+
+#define OTA_SECTOR 4096             // Erase unit
+#define OTA_WRITE_ALIGN 16          // Flash encryption writes 16-byte blocks
+#define OTA_VERIFY_CHUNK 256        // Read-back piece, on the stack
+#define OTA_IMAGE_MAGIC 0xE9        // First byte of an ESP app image
+
+typedef struct {
+    bool (*erase)(void *ctx, uint32_t offset, uint32_t len);
+    bool (*write)(void *ctx, uint32_t offset, const void *data, uint32_t len);
+    bool (*read)(void *ctx, uint32_t offset, void *data, uint32_t len);
+    int64_t (*now_us)(void *ctx);
+    void (*sleep_us)(void *ctx, uint32_t us);
+    void *ctx;
+    uint32_t size;                  // Partition size, a multiple of OTA_SECTOR
+} ota_flash_t;
+
+typedef enum {
+    OTA_OK = 0,
+    OTA_ERR_SIZE,                   // Bigger than the partition, or not the announced length
+    OTA_ERR_MAGIC,                  // Not an app image
+    OTA_ERR_FLASH,                  // Erase, write or read failed
+    OTA_ERR_VERIFY,                 // Read back differs from what was written
+    OTA_ERR_DIGEST,                 // SHA-256 differs from the announced one
+} ota_status_t;
+
+static const char *ota_status_name(ota_status_t s) {
+    static const char *const names[] = {
+        "ok", "wrong size", "not an app image", "flash error", "flash verify failed", "sha256 mismatch",
+    };
+    return (unsigned)s < sizeof(names) / sizeof(names[0]) ? names[s] : "?";
+}
+
+typedef struct {
+    uint32_t bytes_per_s;           // 0: no limit
+    uint32_t burst;
+    int64_t credit;                 // Bytes x 1e6, so short refills are not rounded away
+    int64_t last_us;
+} ota_rate_t;
+
+// The bucket starts full. burst is at least one sector.
+static void ota_rate_init(ota_rate_t *r, uint32_t bytes_per_s, uint32_t burst, int64_t now_us) {
+    r->bytes_per_s = bytes_per_s;
+    r->burst = burst < OTA_SECTOR ? OTA_SECTOR : burst;
+    r->credit = (int64_t)r->burst * 1000000;
+    r->last_us = now_us;
+}
+
+// Take n bytes (at most burst). Returns 0 if they were taken, otherwise
+// the microseconds until they will be there; nothing is taken then.
+static uint32_t ota_rate_take(ota_rate_t *r, uint32_t n, int64_t now_us) {
+    if (r->bytes_per_s == 0) {
+        return 0;
+    }
+    int64_t cap = (int64_t)r->burst * 1000000;
+    int64_t elapsed = now_us - r->last_us;
+    r->last_us = now_us;
+    if (elapsed > 0) {
+        // An idle minute refills any bucket; this also bounds the product
+        r->credit += (elapsed < 60000000 ? elapsed : 60000000) * (int64_t)r->bytes_per_s;
+        r->credit = r->credit > cap ? cap : r->credit;
+    }
+    int64_t cost = (int64_t)n * 1000000;
+    if (r->credit >= cost) {
+        r->credit -= cost;
+        return 0;
+    }
+    return (uint32_t)((cost - r->credit + r->bytes_per_s - 1) / r->bytes_per_s);
+}
+
+typedef struct {
+    ota_flash_t flash;
+    ota_rate_t rate;
+    uint8_t *sector;                // OTA_SECTOR bytes
+    uint32_t fill;                  // Bytes in sector
+    uint32_t offset;                // Flash offset of sector
+    uint32_t received;
+    uint32_t length;                // Announced image length
+    uint8_t want[SHA256_DIGEST_LEN];
+    uint8_t digest[SHA256_DIGEST_LEN];  // Set by ota_writer_finish
+    sha256_t sha;
+    ota_status_t status;            // The first error sticks
+    // Stats
+    uint32_t sectors;
+    int64_t start_us;
+    int64_t flash_us;               // Erasing, writing and reading back
+    int64_t throttle_us;            // Sleeping for the rate limit
+    uint32_t max_flash_us;          // Longest sector
+} ota_writer_t;
+
+// Start an image of `length` bytes whose SHA-256 should be `want`
+static ota_status_t ota_writer_begin(ota_writer_t *w, const ota_flash_t *flash, uint8_t *sector, uint32_t length,
+                                     const uint8_t want[SHA256_DIGEST_LEN], uint32_t bytes_per_s, uint32_t burst) {
+    memset(w, 0, sizeof(*w));
+    w->flash = *flash;
+    w->sector = sector;
+    w->length = length;
+    memcpy(w->want, want, SHA256_DIGEST_LEN);
+    sha256_init(&w->sha);
+    w->start_us = flash->now_us(flash->ctx);
+    ota_rate_init(&w->rate, bytes_per_s, burst, w->start_us);
+    w->status = length == 0 || length > flash->size ? OTA_ERR_SIZE : OTA_OK;
+    return w->status;
+}
+
+// Write the buffered sector: wait for the rate limit, erase, write, read back
+static ota_status_t ota_writer_flush(ota_writer_t *w) {
+    const ota_flash_t *f = &w->flash;
+    uint32_t wait;
+    while ((wait = ota_rate_take(&w->rate, OTA_SECTOR, f->now_us(f->ctx))) != 0) {
+        f->sleep_us(f->ctx, wait);
+        w->throttle_us += wait;
+    }
+
+    uint32_t len = (w->fill + OTA_WRITE_ALIGN - 1) & ~(uint32_t)(OTA_WRITE_ALIGN - 1);
+    memset(w->sector + w->fill, 0xFF, len - w->fill);
+    int64_t t0 = f->now_us(f->ctx);
+    if (!f->erase(f->ctx, w->offset, OTA_SECTOR) || !f->write(f->ctx, w->offset, w->sector, len)) {
+        return w->status = OTA_ERR_FLASH;
+    }
+    uint8_t back[OTA_VERIFY_CHUNK];
+    for (uint32_t i = 0; i < len; i += OTA_VERIFY_CHUNK) {
+        uint32_t n = len - i < OTA_VERIFY_CHUNK ? len - i : OTA_VERIFY_CHUNK;
+        if (!f->read(f->ctx, w->offset + i, back, n)) {
+            return w->status = OTA_ERR_FLASH;
+        }
+        if (memcmp(back, w->sector + i, n) != 0) {
+            return w->status = OTA_ERR_VERIFY;
+        }
+    }
+    uint32_t took = (uint32_t)(f->now_us(f->ctx) - t0);
+    w->flash_us += took;
+    w->max_flash_us = took > w->max_flash_us ? took : w->max_flash_us;
+    w->sectors++;
+    w->offset += OTA_SECTOR;
+    w->fill = 0;
+    return OTA_OK;
+}
+
+// The next piece of the image, any size
+static ota_status_t ota_writer_feed(ota_writer_t *w, const void *data, uint32_t len) {
+    if (w->status != OTA_OK) {
+        return w->status;
+    }
+    const uint8_t *p = (const uint8_t *)data;
+    if (len > w->length - w->received) {
+        return w->status = OTA_ERR_SIZE;
+    }
+    if (w->received == 0 && len > 0 && p[0] != OTA_IMAGE_MAGIC) {
+        return w->status = OTA_ERR_MAGIC;
+    }
+    sha256_update(&w->sha, p, len);
+    w->received += len;
+    while (len > 0) {
+        uint32_t n = OTA_SECTOR - w->fill < len ? OTA_SECTOR - w->fill : len;
+        memcpy(w->sector + w->fill, p, n);
+        w->fill += n;
+        p += n;
+        len -= n;
+        if (w->fill == OTA_SECTOR && ota_writer_flush(w) != OTA_OK) {
+            return w->status;
+        }
+    }
+    return OTA_OK;
+}
+
+// Write what is left and check the length and the digest
+static ota_status_t ota_writer_finish(ota_writer_t *w) {
+    if (w->status != OTA_OK) {
+        return w->status;
+    }
+    if (w->received != w->length) {
+        return w->status = OTA_ERR_SIZE;
+    }
+    if (w->fill > 0 && ota_writer_flush(w) != OTA_OK) {
+        return w->status;
+    }
+    sha256_final(&w->sha, w->digest);
+    if (memcmp(w->digest, w->want, SHA256_DIGEST_LEN) != 0) {
+        return w->status = OTA_ERR_DIGEST;
+    }
+    return OTA_OK;
+}
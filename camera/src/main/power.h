@@ -0,0 +1,232 @@
+#pragma once
+
+// Duty-cycled low-power monitoring mode.
+//
+// Applies the decisions of power_policy.h to the hardware: sensor standby,
+// WiFi modem sleep, and CPU DFS / light sleep through PM locks. While in LOW
+// mode a monitor task briefly wakes the sensor every few seconds, grabs one
+// frame, and raises a motion trigger if the JPEG size jumps (a cheap proxy
+// for scene change).
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_wifi.h>
+#include <esp_camera.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#if CONFIG_PM_ENABLE
+#include <esp_pm.h>
+#endif
+
+#include "power_policy.h"
+
+#define POWER_MONITOR_MOTION_PCT 15  // JPEG size change that counts as motion
+
+static const char *POWER_TAG = "POWER";
+
+static power_policy_t power_policy;
+static SemaphoreHandle_t power_mutex = NULL;
+static bool power_sensor_standby = false;
+
+#if CONFIG_PM_ENABLE
+static esp_pm_lock_handle_t power_cpu_lock = NULL;
+static esp_pm_lock_handle_t power_sleep_lock = NULL;
+#endif
+
+// Put the sensor into (or out of) standby via its power-down register
+static void power_set_sensor_standby(bool standby) {
+    sensor_t *sensor = esp_camera_sensor_get();
+    if (!sensor || power_sensor_standby == standby) {
+        return;
+    }
+
+    int rc;
+    switch (sensor->id.PID) {
+        case OV2640_PID:
+            // COM2 (sensor bank 0x09), bit 4: standby
+            rc = sensor->set_reg(sensor, 0x100 | 0x09, 0x10, standby ? 0x10 : 0x00);
+            break;
+        case OV3660_PID:
+        case OV5640_PID:
+            // SYSTEM_CTROL0 (0x3008), bit 6: software power down
+            rc = sensor->set_reg(sensor, 0x3008, 0x40, standby ? 0x40 : 0x00);
+            break;
+        default:
+            ESP_LOGW(POWER_TAG, "No standby support for sensor PID 0x%x", sensor->id.PID);
+            return;
+    }
+
+    if (rc < 0) {
+        ESP_LOGW(POWER_TAG, "Sensor standby write failed: %d", rc);
+        return;
+    }
+    power_sensor_standby = standby;
+
+    if (!standby) {
+        // The first frame after wake-up is usually from before standby; drop it
+        camera_fb_t *fb = camera_fb_get_any();
+        if (fb) {
+            camera_fb_return(fb);
+        }
+    }
+}
+
+// Hold (or release) the PM locks that keep the CPU at 240 MHz and block light sleep
+static void power_set_full_rate(bool full_rate) {
+#if CONFIG_PM_ENABLE
+    if (full_rate) {
+        esp_pm_lock_acquire(power_cpu_lock);
+        esp_pm_lock_acquire(power_sleep_lock);
+    } else {
+        esp_pm_lock_release(power_sleep_lock);
+        esp_pm_lock_release(power_cpu_lock);
+    }
+#endif
+}
+
+static void power_apply_mode(power_mode_t from, power_mode_t to) {
+    ESP_LOGI(POWER_TAG, "Power mode %s -> %s", power_mode_str(from), power_mode_str(to));
+
+    if (to == POWER_MODE_LOW) {
+        power_set_sensor_standby(true);
+        esp_wifi_set_ps(WIFI_PS_MAX_MODEM);  // Wake only every listen_interval DTIMs
+        power_set_full_rate(false);
+    } else if (from == POWER_MODE_LOW) {
+        power_set_full_rate(true);
+        esp_wifi_set_ps(WIFI_PS_MIN_MODEM);  // Coexistence requires at least min modem sleep
+        power_set_sensor_standby(false);
+    }
+}
+
+static void power_update(bool (*event)(power_policy_t *, int64_t)) {
+    xSemaphoreTake(power_mutex, portMAX_DELAY);
+    power_mode_t from = power_policy.mode;
+    int64_t now = esp_timer_get_time();
+    bool changed = event ? event(&power_policy, now) : power_policy_update(&power_policy, now);
+#if CONFIG_TRAIN_POWER_SAVE
+    if (changed) {
+        power_apply_mode(from, power_policy.mode);
+    }
+#else
+    (void)from;     // Statistics only: the hardware stays at full rate
+    (void)changed;
+#endif
+    xSemaphoreGive(power_mutex);
+}
+
+// Hooks for stream consumers and triggers
+static void power_client_connected(void) {
+    power_update(power_policy_client_connected);
+}
+
+static void power_client_disconnected(void) {
+    power_update(power_policy_client_disconnected);
+}
+
+static void power_motion_trigger(void) {
+    power_update(power_policy_motion);
+}
+
+static void power_frame_sent(void) {
+    if (!power_policy.awaiting_first_frame) {
+        return;
+    }
+    xSemaphoreTake(power_mutex, portMAX_DELAY);
+    power_policy_frame_sent(&power_policy, esp_timer_get_time());
+    xSemaphoreGive(power_mutex);
+}
+
+// Low-power monitor: wake the sensor, sample a frame, go back to sleep
+static void power_monitor_task(void *param) {
+    size_t last_len = 0;
+
+    while (true) {
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_TRAIN_POWER_MONITOR_INTERVAL_MS));
+
+        power_update(NULL);  // Let idle timeouts expire
+
+        // Motion shows as a change in JPEG size, so there is nothing to
+        // compare while the sensor sends YUV for the H.264 encoder
+        xSemaphoreTake(power_mutex, portMAX_DELAY);
+        if (power_policy.mode != POWER_MODE_LOW || camera_yuv_framesize != FRAMESIZE_INVALID) {
+            xSemaphoreGive(power_mutex);
+            last_len = 0;
+            continue;
+        }
+
+        power_set_full_rate(true);
+        power_set_sensor_standby(false);
+        camera_fb_t *fb = camera_fb_get();
+        size_t len = fb ? fb->len : 0;
+        if (fb) {
+            camera_fb_return(fb);
+        }
+        power_set_sensor_standby(true);
+        power_set_full_rate(false);
+        xSemaphoreGive(power_mutex);
+
+        if (len == 0) {
+            continue;
+        }
+        if (last_len > 0) {
+            size_t diff = len > last_len ? len - last_len : last_len - len;
+            if (diff * 100 > last_len * POWER_MONITOR_MOTION_PCT) {
+                ESP_LOGI(POWER_TAG, "Monitor frame changed %zu -> %zu bytes, waking", last_len, len);
+                power_motion_trigger();
+            }
+        }
+        last_len = len;
+    }
+}
+
+static void power_log_stats(void) {
+    ESP_LOGI(POWER_TAG, "Mode: %s, clients: %lu, avg current: ~%lu mA, wake->frame: last %lu ms, max %lu ms",
+        power_mode_str(power_policy.mode),
+        (unsigned long)power_policy.clients,
+        (unsigned long)power_policy_avg_current_ma(&power_policy),
+        (unsigned long)(power_policy.last_wake_latency_us / 1000),
+        (unsigned long)(power_policy.max_wake_latency_us / 1000));
+}
+
+// Must be called after the camera and WiFi are initialized
+static void power_init(void) {
+    power_mutex = xSemaphoreCreateMutex();
+
+    power_policy_config_t cfg = power_policy_default_config();
+    cfg.idle_timeout_ms = CONFIG_TRAIN_POWER_IDLE_TIMEOUT_MS;
+    cfg.motion_hold_ms = CONFIG_TRAIN_POWER_MOTION_HOLD_MS;
+    power_policy_init(&power_policy, &cfg, esp_timer_get_time());
+
+#if CONFIG_PM_ENABLE
+    ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "power_cpu", &power_cpu_lock));
+    ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "power_sleep", &power_sleep_lock));
+    power_set_full_rate(true);  // Start at full rate, the policy drops us once idle
+
+    esp_pm_config_t pm_config = {
+        .max_freq_mhz = 240,
+        .min_freq_mhz = 80,   // Keeps APB at 80 MHz so the LEDC XCLK stays stable
+#if CONFIG_TRAIN_POWER_SAVE
+        .light_sleep_enable = true,
+#else
+        .light_sleep_enable = false,
+#endif
+    };
+    esp_err_t err = esp_pm_configure(&pm_config);
+    if (err != ESP_OK) {
+        ESP_LOGW(POWER_TAG, "esp_pm_configure failed: %s", esp_err_to_name(err));
+    }
+#else
+    ESP_LOGW(POWER_TAG, "CONFIG_PM_ENABLE is off, DFS and light sleep unavailable");
+#endif
+
+#if CONFIG_TRAIN_POWER_SAVE
+    xTaskCreatePinnedToCore(power_monitor_task, "power_mon", 3072, NULL, 3, NULL, 0);
+    ESP_LOGI(POWER_TAG, "Power management enabled (idle timeout %d ms)", CONFIG_TRAIN_POWER_IDLE_TIMEOUT_MS);
+#else
+    // Keep the policy for statistics only. It never asks for LOW, and
+    // power_update() leaves the hardware alone whatever it decides.
+    power_policy.cfg.idle_timeout_ms = POWER_IDLE_NEVER;
+    ESP_LOGI(POWER_TAG, "Power management disabled");
+#endif
+}
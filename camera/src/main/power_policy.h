@@ -0,0 +1,179 @@
+#pragma once
+
+// Power-management policy for the camera module.
+//
+// Pure state machine with no ESP-IDF dependencies: callers feed it stream
+// client and motion events plus a monotonic clock (microseconds), and it
+// decides which power mode the hardware should be in. The hardware side
+// lives in power.h.
+//
+//   ACTIVE  - at least one viewer, or a recent motion trigger. Full rate.
+//   IDLE    - nobody watching, waiting out the idle timeout at full rate
+//             so a page reload doesn't bounce the sensor.
+//   LOW     - sensor in standby, WiFi max modem sleep, CPU dropped via DFS
+//             and light sleep allowed between monitor captures.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Rough bench estimates for the XIAO ESP32-S3 Sense (mA at 5 V input)
+#define POWER_EST_ACTIVE_MA 260
+#define POWER_EST_IDLE_MA   190
+#define POWER_EST_LOW_MA    45
+
+// Idle timeout that never expires: the policy keeps its statistics but
+// never asks for LOW (CONFIG_TRAIN_POWER_SAVE off)
+#define POWER_IDLE_NEVER UINT32_MAX
+
+typedef enum {
+    POWER_MODE_ACTIVE = 0,
+    POWER_MODE_IDLE,
+    POWER_MODE_LOW,
+    POWER_MODE_COUNT
+} power_mode_t;
+
+typedef struct {
+    uint32_t idle_timeout_ms;   // No clients/motion for this long -> LOW, or POWER_IDLE_NEVER
+    uint32_t motion_hold_ms;    // A motion trigger keeps full rate this long
+    uint16_t est_ma[POWER_MODE_COUNT];
+} power_policy_config_t;
+
+typedef struct {
+    power_policy_config_t cfg;
+    power_mode_t mode;
+    uint32_t clients;
+    int64_t last_activity_us;   // Last client disconnect or motion trigger
+    int64_t motion_until_us;
+    int64_t mode_entered_us;
+    int64_t accounted_until_us;
+
+    // Time spent in each mode, used for the average current estimate
+    uint64_t time_in_mode_us[POWER_MODE_COUNT];
+
+    // Wake-to-first-frame latency (LOW -> ACTIVE until a frame goes out)
+    int64_t wake_started_us;
+    bool awaiting_first_frame;
+    uint32_t wakes;
+    uint32_t last_wake_latency_us;
+    uint32_t max_wake_latency_us;
+    uint64_t total_wake_latency_us;
+} power_policy_t;
+
+static const char* power_mode_str(power_mode_t mode) {
+    switch (mode) {
+        case POWER_MODE_ACTIVE: return "active";
+        case POWER_MODE_IDLE: return "idle";
+        case POWER_MODE_LOW: return "low";
+        default: return "unknown";
+    }
+}
+
+static power_policy_config_t power_policy_default_config(void) {
+    power_policy_config_t cfg = {
+        .idle_timeout_ms = 60000,
+        .motion_hold_ms = 30000,
+        .est_ma = { POWER_EST_ACTIVE_MA, POWER_EST_IDLE_MA, POWER_EST_LOW_MA },
+    };
+    return cfg;
+}
+
+static void power_policy_init(power_policy_t *p, const power_policy_config_t *cfg, int64_t now_us) {
+    *p = (power_policy_t){0};
+    p->cfg = *cfg;
+    p->mode = POWER_MODE_IDLE;
+    p->last_activity_us = now_us;
+    p->mode_entered_us = now_us;
+    p->accounted_until_us = now_us;
+}
+
+static void power_policy_account(power_policy_t *p, int64_t now_us) {
+    if (now_us > p->accounted_until_us) {
+        p->time_in_mode_us[p->mode] += (uint64_t)(now_us - p->accounted_until_us);
+        p->accounted_until_us = now_us;
+    }
+}
+
+// Evaluate the policy. Returns true if the mode changed.
+static bool power_policy_update(power_policy_t *p, int64_t now_us) {
+    power_policy_account(p, now_us);
+
+    power_mode_t next;
+    if (p->clients > 0 || now_us < p->motion_until_us) {
+        next = POWER_MODE_ACTIVE;
+    } else if (p->cfg.idle_timeout_ms == POWER_IDLE_NEVER ||
+               now_us - p->last_activity_us < (int64_t)p->cfg.idle_timeout_ms * 1000) {
+        // Only linger at full rate if we were already up; LOW stays LOW
+        next = p->mode == POWER_MODE_LOW ? POWER_MODE_LOW : POWER_MODE_IDLE;
+    } else {
+        next = POWER_MODE_LOW;
+    }
+
+    if (next == p->mode) {
+        return false;
+    }
+
+    if (p->mode == POWER_MODE_LOW && next == POWER_MODE_ACTIVE) {
+        p->wake_started_us = now_us;
+        p->awaiting_first_frame = true;
+    } else if (next == POWER_MODE_LOW) {
+        p->awaiting_first_frame = false;
+    }
+
+    p->mode = next;
+    p->mode_entered_us = now_us;
+    return true;
+}
+
+static bool power_policy_client_connected(power_policy_t *p, int64_t now_us) {
+    p->clients++;
+    p->last_activity_us = now_us;
+    return power_policy_update(p, now_us);
+}
+
+static bool power_policy_client_disconnected(power_policy_t *p, int64_t now_us) {
+    if (p->clients > 0) {
+        p->clients--;
+    }
+    p->last_activity_us = now_us;
+    return power_policy_update(p, now_us);
+}
+
+static bool power_policy_motion(power_policy_t *p, int64_t now_us) {
+    p->last_activity_us = now_us;
+    p->motion_until_us = now_us + (int64_t)p->cfg.motion_hold_ms * 1000;
+    return power_policy_update(p, now_us);
+}
+
+// Called when a frame has been delivered to a client
+static void power_policy_frame_sent(power_policy_t *p, int64_t now_us) {
+    if (!p->awaiting_first_frame) {
+        return;
+    }
+    p->awaiting_first_frame = false;
+
+    uint32_t latency = (uint32_t)(now_us - p->wake_started_us);
+    p->wakes++;
+    p->last_wake_latency_us = latency;
+    p->total_wake_latency_us += latency;
+    if (latency > p->max_wake_latency_us) {
+        p->max_wake_latency_us = latency;
+    }
+}
+
+// Time-weighted average current estimate since init (mA)
+static uint32_t power_policy_avg_current_ma(const power_policy_t *p) {
+    uint64_t total_us = 0;
+    uint64_t weighted = 0;
+    for (int i = 0; i < POWER_MODE_COUNT; i++) {
+        total_us += p->time_in_mode_us[i];
+        weighted += p->time_in_mode_us[i] * p->cfg.est_ma[i];
+    }
+    if (total_us == 0) {
+        return p->cfg.est_ma[p->mode];
+    }
+    return (uint32_t)(weighted / total_us);
+}
+
+static uint32_t power_policy_avg_wake_latency_us(const power_policy_t *p) {
+    return p->wakes ? (uint32_t)(p->total_wake_latency_us / p->wakes) : 0;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+// RTP payload format for H.264 (RFC 6184), packetization-mode 1.
+//
+// The encoder's Annex-B access unit is split at its start codes. A NAL unit
+// that fits in one datagram goes as a single NAL unit packet; a larger one
+// is cut into FU-A fragments, which carry its header byte in two bytes of
+// their own instead. The marker bit ends the access unit. SPS and PPS go
+// in-band in front of every IDR, so the SDP needs no sprop-parameter-sets.
+//
+// Like rtp_jpeg.h, packets are built as a header buffer plus a slice of the
+// access unit, for sendmsg() without copying. The stream state (SSRC,
+// sequence number, timestamp offset) is the same rtp_jpeg_stream_t.
+//
+// No ESP-IDF dependencies.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rtp_jpeg.h"
+
+#define RTP_PT_H264 96              // Dynamic payload type, as announced in the SDP
+#define RTP_H264_CLOCK_HZ 90000
+#define RTP_H264_FU_A 28
+#define RTP_H264_MAX_HEADERS (RTP_HEADER_SIZE + 2)
+
+// Find the next NAL unit of an Annex-B stream at or after `*pos`: sets
+// `*nal` and `*nal_len` (without the start code) and moves `*pos` past it.
+// Returns false at the end.
+static bool rtp_h264_next_nal(const uint8_t *au, size_t len, size_t *pos, const uint8_t **nal, size_t *nal_len) {
+    size_t i = *pos;
+    while (i + 3 <= len && !(au[i] == 0 && au[i + 1] == 0 && au[i + 2] == 1)) {
+        i++;
+    }
+    if (i + 3 > len) {
+        *pos = len;
+        return false;
+    }
+    size_t start = i + 3, end = start;
+    while (end + 3 <= len && !(au[end] == 0 && au[end + 1] == 0 && (au[end + 2] == 1 || au[end + 2] == 0))) {
+        end++;
+    }
+    if (end + 3 > len) {
+        end = len;
+    }
+    *nal = au + start;
+    *nal_len = end - start;
+    *pos = end;
+    return *nal_len > 0;
+}
+
+// Build the headers of the packet that carries `nal` from `offset` on, into
+// `hdr` (RTP_H264_MAX_HEADERS bytes). The packet is the returned number of
+// header bytes followed by `*data_len` bytes of nal + `*data_start`; the
+// whole datagram stays within `max_packet`. Start at offset 0 and continue
+// at *data_start + *data_len until that reaches nal_len. `last` is set for
+// the last NAL unit of the access unit. Advances the sequence number.
+static size_t rtp_h264_packet(rtp_jpeg_stream_t *st, const uint8_t *nal, size_t nal_len, bool last,
+                              uint32_t timestamp, size_t offset, size_t max_packet, uint8_t *hdr,
+                              size_t *data_start, size_t *data_len) {
+    bool single = offset == 0 && RTP_HEADER_SIZE + nal_len <= max_packet;
+    size_t hlen = single ? RTP_HEADER_SIZE : RTP_HEADER_SIZE + 2;
+    size_t room = max_packet > hlen ? max_packet - hlen : 0;
+    if (!single && offset == 0) {
+        offset = 1;                 // The FU header stands in for the NAL header byte
+    }
+    size_t remaining = nal_len - offset;
+    *data_start = offset;
+    *data_len = remaining < room ? remaining : room;
+    bool end = offset + *data_len >= nal_len;
+
+    uint8_t *p = hdr;
+    *p++ = 0x80;
+    *p++ = (last && end ? 0x80 : 0x00) | RTP_PT_H264;
+    *p++ = st->seq >> 8;
+    *p++ = st->seq & 0xFF;
+    *p++ = timestamp >> 24;
+    *p++ = timestamp >> 16;
+    *p++ = timestamp >> 8;
+    *p++ = timestamp & 0xFF;
+    *p++ = st->ssrc >> 24;
+    *p++ = st->ssrc >> 16;
+    *p++ = st->ssrc >> 8;
+    *p++ = st->ssrc & 0xFF;
+    st->seq++;
+
+    if (!single) {
+        // FU indicator: F and NRI of the NAL unit; FU header: start, end, type
+        *p++ = (nal[0] & 0xE0) | RTP_H264_FU_A;
+        *p++ = (offset == 1 ? 0x80 : 0x00) | (end ? 0x40 : 0x00) | (nal[0] & 0x1F);
+    }
+    return (size_t)(p - hdr);
+}
+
@@ -0,0 +1,233 @@
+#pragma once
+
+// RTP payload format for JPEG (RFC 2435).
+//
+// The JPEG is parsed once per frame: its headers are stripped and only the
+// entropy-coded scan is sent, prefixed per packet by the 12-byte RTP header
+// and the 8-byte JPEG header. The quantization tables travel in-band in the
+// first packet (Q = 255); receivers rebuild the rest of the JFIF headers,
+// assuming the standard Huffman tables, which is what the OV sensors emit.
+//
+// Packets are built as a header buffer plus a slice of the frame buffer, so
+// they can be sent with sendmsg() without copying the scan.
+//
+// No ESP-IDF dependencies.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define RTP_HEADER_SIZE 12
+#define RTP_JPEG_HEADER_SIZE 8
+#define RTP_JPEG_RESTART_HEADER_SIZE 4
+#define RTP_JPEG_QTABLE_HEADER_SIZE 4
+#define RTP_JPEG_MAX_QTABLES 2
+#define RTP_JPEG_MAX_HEADERS (RTP_HEADER_SIZE + RTP_JPEG_HEADER_SIZE + RTP_JPEG_RESTART_HEADER_SIZE \
+                              + RTP_JPEG_QTABLE_HEADER_SIZE + 64 * RTP_JPEG_MAX_QTABLES)
+#define RTP_PT_JPEG 26
+#define RTP_JPEG_CLOCK_HZ 90000
+#define RTP_JPEG_Q_DYNAMIC 255  // Tables are sent in-band with every frame
+
+typedef struct {
+    uint16_t width;
+    uint16_t height;
+    uint8_t type;               // 0 = 4:2:2, 1 = 4:2:0; +64 when restart markers are used
+    uint16_t restart_interval;
+    uint8_t qtable_count;
+    uint8_t qtables[64 * RTP_JPEG_MAX_QTABLES];  // 8-bit tables in zig-zag order
+    const uint8_t *scan;        // Entropy-coded data, up to (not including) EOI
+    size_t scan_len;
+} rtp_jpeg_frame_t;
+
+typedef struct {
+    uint32_t ssrc;
+    uint16_t seq;
+    uint32_t ts_offset;         // Random start, as recommended by RFC 3550
+} rtp_jpeg_stream_t;
+
+static uint16_t rtp_jpeg_be16(const uint8_t *p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+// Parse a baseline JPEG into what RFC 2435 needs. Returns false for
+// anything the payload format cannot carry (progressive, 12-bit, greyscale,
+// unusual sampling, sizes that are not a multiple of 8 or above 2040
+// pixels).
+static bool rtp_jpeg_parse(const uint8_t *jpeg, size_t len, rtp_jpeg_frame_t *f) {
+    memset(f, 0, sizeof(*f));
+    if (len < 4 || jpeg[0] != 0xFF || jpeg[1] != 0xD8) {
+        return false;
+    }
+
+    bool have_sof = false;
+    size_t i = 2;
+    while (i + 4 <= len) {
+        if (jpeg[i] != 0xFF) {
+            return false;
+        }
+        uint8_t marker = jpeg[i + 1];
+        if (marker == 0xFF) {  // Fill byte
+            i++;
+            continue;
+        }
+        size_t seg_len = rtp_jpeg_be16(jpeg + i + 2);
+        const uint8_t *seg = jpeg + i + 4;
+        if (seg_len < 2 || i + 2 + seg_len > len) {
+            return false;
+        }
+        size_t body_len = seg_len - 2;
+
+        switch (marker) {
+            case 0xDB: {  // DQT, possibly several tables per segment
+                size_t j = 0;
+                while (j < body_len) {
+                    uint8_t precision = seg[j] >> 4, id = seg[j] & 0x0F;
+                    if (precision != 0 || id >= RTP_JPEG_MAX_QTABLES || j + 65 > body_len) {
+                        return false;
+                    }
+                    memcpy(f->qtables + 64 * id, seg + j + 1, 64);
+                    if (id + 1 > f->qtable_count) {
+                        f->qtable_count = id + 1;
+                    }
+                    j += 65;
+                }
+                break;
+            }
+            case 0xC0: {  // SOF0 (baseline)
+                if (body_len < 15 || seg[0] != 8 || seg[5] != 3) {
+                    return false;
+                }
+                f->height = rtp_jpeg_be16(seg + 1);
+                f->width = rtp_jpeg_be16(seg + 3);
+                // The size travels in units of 8 pixels
+                if (f->width == 0 || f->height == 0 || f->width > 2040 || f->height > 2040 ||
+                    (f->width | f->height) & 7) {
+                    return false;
+                }
+                // Chroma must be 1x1 and luma 2x1 (4:2:2) or 2x2 (4:2:0)
+                if (seg[6 + 3 + 1] != 0x11 || seg[6 + 6 + 1] != 0x11) {
+                    return false;
+                }
+                if (seg[6 + 1] == 0x21) {
+                    f->type = 0;
+                } else if (seg[6 + 1] == 0x22) {
+                    f->type = 1;
+                } else {
+                    return false;
+                }
+                have_sof = true;
+                break;
+            }
+            case 0xC1: case 0xC2: case 0xC3: case 0xC5: case 0xC6: case 0xC7:
+            case 0xC9: case 0xCA: case 0xCB: case 0xCD: case 0xCE: case 0xCF:
+                return false;  // Not baseline
+            case 0xDD:  // DRI
+                if (body_len < 2) {
+                    return false;
+                }
+                f->restart_interval = rtp_jpeg_be16(seg);
+                break;
+            case 0xDA: {  // SOS: the scan runs from here to EOI
+                if (!have_sof || f->qtable_count == 0) {
+                    return false;
+                }
+                size_t start = i + 2 + seg_len;
+                size_t end = len;
+                // The frame buffer can carry padding after EOI
+                while (end >= start + 2 && !(jpeg[end - 2] == 0xFF && jpeg[end - 1] == 0xD9)) {
+                    end--;
+                }
+                if (end < start + 2) {
+                    return false;
+                }
+                f->scan = jpeg + start;
+                f->scan_len = end - 2 - start;
+                if (f->restart_interval) {
+                    f->type += 64;
+                }
+                return true;
+            }
+            default:  // APPn, COM, DHT (standard tables assumed)
+                break;
+        }
+        i += 2 + seg_len;
+    }
+    return false;
+}
+
+// RTP timestamp (90 kHz) from a capture time in microseconds
+static uint32_t rtp_jpeg_timestamp(const rtp_jpeg_stream_t *st, int64_t capture_us) {
+    return st->ts_offset + (uint32_t)(capture_us * 9 / 100);
+}
+
+// Headers that precede the scan slice in every packet of this frame
+static size_t rtp_jpeg_header_len(const rtp_jpeg_frame_t *f, size_t offset) {
+    size_t len = RTP_HEADER_SIZE + RTP_JPEG_HEADER_SIZE;
+    if (f->type >= 64) {
+        len += RTP_JPEG_RESTART_HEADER_SIZE;
+    }
+    if (offset == 0) {
+        len += RTP_JPEG_QTABLE_HEADER_SIZE + 64 * f->qtable_count;
+    }
+    return len;
+}
+
+// Build the headers of the packet that starts at scan `offset`, into `hdr`
+// (at least RTP_JPEG_MAX_HEADERS bytes). The packet is the returned number
+// of header bytes followed by `*data_len` bytes of f->scan + offset; the
+// whole datagram stays within `max_packet`. Advances the sequence number.
+static size_t rtp_jpeg_packet(rtp_jpeg_stream_t *st, const rtp_jpeg_frame_t *f, uint32_t timestamp,
+                              size_t offset, size_t max_packet, uint8_t *hdr, size_t *data_len) {
+    size_t hlen = rtp_jpeg_header_len(f, offset);
+    size_t room = max_packet > hlen ? max_packet - hlen : 0;
+    size_t remaining = f->scan_len - offset;
+    *data_len = remaining < room ? remaining : room;
+    bool last = offset + *data_len >= f->scan_len;
+
+    uint8_t *p = hdr;
+    // RTP: V=2, no padding/extension/CSRC; marker on the last packet of a frame
+    *p++ = 0x80;
+    *p++ = (last ? 0x80 : 0x00) | RTP_PT_JPEG;
+    *p++ = st->seq >> 8;
+    *p++ = st->seq & 0xFF;
+    *p++ = timestamp >> 24;
+    *p++ = timestamp >> 16;
+    *p++ = timestamp >> 8;
+    *p++ = timestamp & 0xFF;
+    *p++ = st->ssrc >> 24;
+    *p++ = st->ssrc >> 16;
+    *p++ = st->ssrc >> 8;
+    *p++ = st->ssrc & 0xFF;
+    st->seq++;
+
+    // JPEG header: type-specific, 24-bit fragment offset, type, Q, size in 8-pixel blocks
+    *p++ = 0;
+    *p++ = offset >> 16;
+    *p++ = offset >> 8;
+    *p++ = offset & 0xFF;
+    *p++ = f->type;
+    *p++ = RTP_JPEG_Q_DYNAMIC;
+    *p++ = f->width / 8;
+    *p++ = f->height / 8;
+
+    if (f->type >= 64) {
+        // Packets are not aligned to restart intervals: F = L = 1, count = 0x3FFF
+        *p++ = f->restart_interval >> 8;
+        *p++ = f->restart_interval & 0xFF;
+        *p++ = 0xFF;
+        *p++ = 0xFF;
+    }
+
+    if (offset == 0) {
+        uint16_t qlen = 64 * f->qtable_count;
+        *p++ = 0;  // MBZ
+        *p++ = 0;  // 8-bit precision for all tables
+        *p++ = qlen >> 8;
+        *p++ = qlen & 0xFF;
+        memcpy(p, f->qtables, qlen);
+        p += qlen;
+    }
+
+    return (size_t)(p - hdr);
+}
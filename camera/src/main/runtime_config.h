@@ -0,0 +1,309 @@
+#pragma once
+
+// Runtime configuration: settings that used to be compile-time defines,
+// stored in NVS and changed live through /config.
+//
+// Every setting is in the schema below (config_store.h) with its range and
+// default. The defaults are the old defines and the Kconfig values. The
+// hot paths read the current snapshot through a read section each frame.
+// The stream task and stream server, the UDP task and the detect task each
+// have their own reader cell. A change takes effect on the next frame,
+// with no lock on the frame path and no restart:
+//   - udp_chunk: payload per chunked UDP packet, and the RTP packet size,
+//     for receivers that did not set their own after probing (udp.h);
+//   - stream_clients, stream_timeout: admission and stall eviction (the
+//     limit is checked on join; clients over a lowered limit keep their
+//     stream);
+//   - dedup_*: the near-duplicate thresholds (frame_dedup.h);
+//   - detect_*: the detector interval and confidence threshold;
+//   - h264_kbps, h264_fps, h264_gop: the encoder's rate control and GOP
+//     (h264_stream.h).
+// Two kinds of settings need their subsystem reconfigured, and only that
+// one is:
+//   - cam_mode, codec and h264_size reinitialize the camera driver with
+//     the pipeline drained, then put back the active preset and the
+//     sensor's standby state;
+//   - api_sockets restarts the API server (http_server.h).
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <esp_log.h>
+#include <nvs_flash.h>
+#include <nvs.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include "config_store.h"
+#include "camera_control.h"
+#include "power.h"
+
+#define RUNTIME_CONFIG_NAMESPACE "config"
+#define RUNTIME_CONFIG_PUBLISH_TRIES 50     // 1 ms apart, while a reader finishes a frame
+
+static const char *RTCFG_TAG = "CONFIG";
+
+// Subsystems, for what a change has to reconfigure
+#define RUNTIME_CONFIG_UDP      (1u << 0)
+#define RUNTIME_CONFIG_STREAM   (1u << 1)
+#define RUNTIME_CONFIG_DEDUP    (1u << 2)
+#define RUNTIME_CONFIG_DETECT   (1u << 3)
+#define RUNTIME_CONFIG_CAMERA   (1u << 4)
+#define RUNTIME_CONFIG_API      (1u << 5)
+#define RUNTIME_CONFIG_H264     (1u << 6)
+
+#define RUNTIME_CAM_CONTINUOUS 0
+#define RUNTIME_CAM_SINGLE 1
+
+#define RUNTIME_CODEC_MJPEG 0
+#define RUNTIME_CODEC_H264 1
+
+typedef struct {
+    uint32_t version;               // Publishes since boot; 1 is the loaded config
+    int32_t udp_chunk;
+    int32_t stream_clients;
+    int32_t stream_timeout_ms;
+    int32_t dedup_threshold;
+    int32_t dedup_cells;
+    int32_t dedup_refresh_ms;
+    int32_t detect_interval_ms;
+    int32_t detect_threshold_pct;
+    int32_t cam_mode;
+    int32_t api_sockets;
+    int32_t codec;
+    int32_t h264_size;
+    int32_t h264_kbps;
+    int32_t h264_fps;
+    int32_t h264_gop;
+} train_config_t;
+
+// Reader cells, one per task that reads the config per frame
+typedef enum {
+    RUNTIME_READER_STREAM = 0,      // Stream task
+    RUNTIME_READER_STREAM_HTTPD,    // Stream server: admission and the chunked path
+    RUNTIME_READER_UDP,
+    RUNTIME_READER_DETECT,
+    RUNTIME_READER_H264,
+    RUNTIME_READER_COUNT,
+} runtime_reader_t;
+
+static const char *const runtime_cam_modes[] = { "continuous", "single", NULL };
+static const char *const runtime_codecs[] = { "mjpeg", "h264", NULL };
+// Sensor framesizes for the encoder, in the order of runtime_h264_sizes
+static const char *const runtime_h264_sizes[] = { "qvga", "hvga", "vga", NULL };
+static const framesize_t runtime_h264_framesizes[] = { FRAMESIZE_QVGA, FRAMESIZE_HVGA, FRAMESIZE_VGA };
+
+#define RUNTIME_FIELD(key, type, field, min, max, def, choices, sub, help) \
+    { key, type, offsetof(train_config_t, field), min, max, def, choices, sub, help }
+
+static const config_field_t runtime_config_fields[] = {
+    RUNTIME_FIELD("udp_chunk", CONFIG_INT, udp_chunk, 256, 1464, 1400, NULL, RUNTIME_CONFIG_UDP,
+        "JPEG bytes per UDP packet"),
+    RUNTIME_FIELD("stream_clients", CONFIG_INT, stream_clients, 1, CONFIG_TRAIN_STREAM_MAX_CLIENTS,
+        CONFIG_TRAIN_STREAM_MAX_CLIENTS, NULL, RUNTIME_CONFIG_STREAM, "MJPEG clients admitted"),
+    RUNTIME_FIELD("stream_timeout", CONFIG_INT, stream_timeout_ms, 500, 60000, CONFIG_TRAIN_STREAM_SEND_TIMEOUT_MS,
+        NULL, RUNTIME_CONFIG_STREAM, "Evict a stalled stream client after this many ms"),
+#if CONFIG_TRAIN_DEDUP
+    RUNTIME_FIELD("dedup_thresh", CONFIG_INT, dedup_threshold, 1, 64, CONFIG_TRAIN_DEDUP_THRESHOLD, NULL,
+        RUNTIME_CONFIG_DEDUP, "Cell change in grey levels"),
+    RUNTIME_FIELD("dedup_cells", CONFIG_INT, dedup_cells, 1, 1200, CONFIG_TRAIN_DEDUP_MIN_CELLS, NULL,
+        RUNTIME_CONFIG_DEDUP, "Changed cells for a new frame"),
+    RUNTIME_FIELD("dedup_refresh", CONFIG_INT, dedup_refresh_ms, 100, 60000, CONFIG_TRAIN_DEDUP_REFRESH_MS, NULL,
+        RUNTIME_CONFIG_DEDUP, "Send a full frame at least every this many ms"),
+#endif
+#if CONFIG_TRAIN_DETECT
+    RUNTIME_FIELD("detect_ms", CONFIG_INT, detect_interval_ms, 100, 60000, CONFIG_TRAIN_DETECT_INTERVAL_MS, NULL,
+        RUNTIME_CONFIG_DETECT, "Time between detector runs"),
+    RUNTIME_FIELD("detect_pct", CONFIG_INT, detect_threshold_pct, 1, 100, CONFIG_TRAIN_DETECT_THRESHOLD_PCT, NULL,
+        RUNTIME_CONFIG_DETECT, "Confidence threshold"),
+#endif
+    RUNTIME_FIELD("cam_mode", CONFIG_ENUM, cam_mode, 0, 1, CONTINUOUS_CAPTURE ? RUNTIME_CAM_CONTINUOUS : RUNTIME_CAM_SINGLE,
+        runtime_cam_modes, RUNTIME_CONFIG_CAMERA, "Two frame buffers filling, or one frame on request"),
+    RUNTIME_FIELD("api_sockets", CONFIG_INT, api_sockets, 2, 8, 4, NULL, RUNTIME_CONFIG_API,
+        "Open sockets on the API server"),
+#if CONFIG_TRAIN_H264
+    RUNTIME_FIELD("codec", CONFIG_ENUM, codec, 0, 1, RUNTIME_CODEC_MJPEG, runtime_codecs, RUNTIME_CONFIG_CAMERA,
+        "JPEG from the sensor, or YUV encoded to H.264"),
+    RUNTIME_FIELD("h264_size", CONFIG_ENUM, h264_size, 0, 2, 0, runtime_h264_sizes, RUNTIME_CONFIG_CAMERA,
+        "Frame size in H.264 mode"),
+    RUNTIME_FIELD("h264_kbps", CONFIG_INT, h264_kbps, 32, 4000, CONFIG_TRAIN_H264_KBPS, NULL, RUNTIME_CONFIG_H264,
+        "H.264 bitrate ceiling"),
+    RUNTIME_FIELD("h264_fps", CONFIG_INT, h264_fps, 1, 30, CONFIG_TRAIN_H264_FPS, NULL, RUNTIME_CONFIG_H264,
+        "H.264 frames per second"),
+    RUNTIME_FIELD("h264_gop", CONFIG_INT, h264_gop, 1, 600, CONFIG_TRAIN_H264_GOP, NULL, RUNTIME_CONFIG_H264,
+        "Frames from one IDR frame to the next"),
+#endif
+};
+
+static const config_schema_t runtime_config_schema = {
+    .fields = runtime_config_fields,
+    .count = sizeof(runtime_config_fields) / sizeof(runtime_config_fields[0]),
+};
+
+static train_config_t runtime_config_slots[CONFIG_RCU_SLOTS];
+static config_rcu_t runtime_config_rcu;
+static SemaphoreHandle_t runtime_config_mutex = NULL;   // Serializes writers
+
+// Read sections: hold the pointer for one frame at most, and do not nest
+static inline const train_config_t *runtime_config_lock(runtime_reader_t reader) {
+    return config_rcu_lock(&runtime_config_rcu, reader);
+}
+
+static inline void runtime_config_unlock(runtime_reader_t reader) {
+    config_rcu_unlock(&runtime_config_rcu, reader);
+}
+
+// The writer's view; only with runtime_config_mutex held
+static const train_config_t *runtime_config_current(void) {
+    return config_rcu_current(&runtime_config_rcu);
+}
+
+// A copy of the current config, for code off the frame path
+static void runtime_config_get(train_config_t *out) {
+    xSemaphoreTake(runtime_config_mutex, portMAX_DELAY);
+    *out = *runtime_config_current();
+    xSemaphoreGive(runtime_config_mutex);
+}
+
+// Load the stored values over the defaults; an invalid one keeps its default
+static void runtime_config_load(train_config_t *cfg) {
+    config_defaults(&runtime_config_schema, cfg);
+    nvs_handle_t nvs;
+    if (nvs_open(RUNTIME_CONFIG_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return;
+    }
+    for (int i = 0; i < runtime_config_schema.count; i++) {
+        const config_field_t *f = &runtime_config_fields[i];
+        int32_t v;
+        if (nvs_get_i32(nvs, f->key, &v) != ESP_OK) {
+            continue;
+        }
+        if (!config_field_in_range(f, v)) {
+            ESP_LOGW(RTCFG_TAG, "Ignoring stored %s = %ld (out of range)", f->key, (long)v);
+            continue;
+        }
+        *config_field_ptr(f, cfg) = v;
+    }
+    nvs_close(nvs);
+}
+
+// Store every value, or erase them all to go back to the defaults
+static esp_err_t runtime_config_save(const train_config_t *cfg, bool erase) {
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(RUNTIME_CONFIG_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (erase) {
+        err = nvs_erase_all(nvs);
+    }
+    for (int i = 0; i < runtime_config_schema.count && err == ESP_OK && !erase; i++) {
+        const config_field_t *f = &runtime_config_fields[i];
+        err = nvs_set_i32(nvs, f->key, config_field_get(f, cfg));
+    }
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    return err;
+}
+
+// Load the stored config and publish it. Call after NVS is up
+// (wifi_init_sta) and before anything reads it.
+static void runtime_config_init(void) {
+    runtime_config_mutex = xSemaphoreCreateMutex();
+    if (!config_schema_valid(&runtime_config_schema)) {
+        ESP_LOGE(RTCFG_TAG, "Invalid config schema");
+    }
+    train_config_t cfg;
+    runtime_config_load(&cfg);
+    cfg.version = 1;
+    config_rcu_init(&runtime_config_rcu, runtime_config_slots, sizeof(train_config_t), &cfg, RUNTIME_READER_COUNT);
+}
+
+// Sensor framesize for the H.264 encoder, or FRAMESIZE_INVALID for MJPEG
+static framesize_t runtime_config_yuv_framesize(const train_config_t *cfg) {
+#if CONFIG_TRAIN_H264
+    if (cfg->codec == RUNTIME_CODEC_H264) {
+        return runtime_h264_framesizes[cfg->h264_size];
+    }
+#endif
+    return FRAMESIZE_INVALID;
+}
+
+// Switch between continuous and single capture, or JPEG and YUV. The new
+// driver instance wakes the sensor, so standby is put back afterwards. A
+// switch refused because frames were still in flight leaves the old driver
+// and its standby state alone and returns ESP_ERR_TIMEOUT.
+static esp_err_t runtime_config_apply_camera(const train_config_t *cfg) {
+    xSemaphoreTake(power_mutex, portMAX_DELAY);
+    bool standby = power_sensor_standby;
+    esp_err_t err = camera_set_mode(cfg->cam_mode == RUNTIME_CAM_CONTINUOUS, runtime_config_yuv_framesize(cfg));
+    if (err != ESP_ERR_TIMEOUT) {
+        power_sensor_standby = false;
+        if (standby) {
+            power_set_sensor_standby(true);
+        }
+    }
+    xSemaphoreGive(power_mutex);
+    if (err == ESP_ERR_TIMEOUT) {
+        ESP_LOGE(RTCFG_TAG, "Camera mode not changed: frames still in flight");
+    } else if (err != ESP_OK) {
+        ESP_LOGE(RTCFG_TAG, "Camera mode change failed");
+    }
+    return err;
+}
+
+// Validate `query` ("key=value&..."; keys in `ignore` are skipped),
+// reconfigure the camera if its settings changed and publish the result.
+// With `reset`, start from the defaults instead of the current values. With
+// `save`, store the result in NVS. Returns the subsystems that changed, or -1 with a message
+// in `err`. The caller applies RUNTIME_CONFIG_API.
+static int runtime_config_update(const char *query, const char *const *ignore, bool reset, bool save,
+                                 char *err, size_t err_len) {
+    xSemaphoreTake(runtime_config_mutex, portMAX_DELAY);
+    const train_config_t *cur = runtime_config_current();
+    train_config_t base = *cur, next;
+    if (reset) {
+        config_defaults(&runtime_config_schema, &base);
+    }
+    int given = config_parse_query(&runtime_config_schema, &base, &next, sizeof(next), query, ignore, err, err_len);
+    if (given < 0) {
+        xSemaphoreGive(runtime_config_mutex);
+        return -1;
+    }
+
+    uint32_t changed = config_diff(&runtime_config_schema, cur, &next);
+    // The camera goes first: a mode switch that cannot drain the pipeline
+    // fails the whole update, so the config never names a mode not running
+    if ((changed & RUNTIME_CONFIG_CAMERA) && runtime_config_apply_camera(&next) == ESP_ERR_TIMEOUT) {
+        snprintf(err, err_len, "camera busy, try again");
+        xSemaphoreGive(runtime_config_mutex);
+        return -1;
+    }
+    if (changed) {
+        next.version = cur->version + 1;
+        bool published = false;
+        for (int i = 0; i < RUNTIME_CONFIG_PUBLISH_TRIES && !published; i++) {
+            published = config_rcu_publish(&runtime_config_rcu, &next);
+            if (!published) {
+                vTaskDelay(pdMS_TO_TICKS(1));
+            }
+        }
+        if (!published) {
+            if (changed & RUNTIME_CONFIG_CAMERA) {
+                runtime_config_apply_camera(cur);
+            }
+            snprintf(err, err_len, "readers busy, try again");
+            xSemaphoreGive(runtime_config_mutex);
+            return -1;
+        }
+        ESP_LOGI(RTCFG_TAG, "Config version %lu, changed subsystems 0x%lx", (unsigned long)next.version,
+            (unsigned long)changed);
+    }
+
+    if (save && runtime_config_save(&next, reset && given == 0) != ESP_OK) {
+        ESP_LOGW(RTCFG_TAG, "Config not saved");
+    }
+    xSemaphoreGive(runtime_config_mutex);
+    return (int)changed;
+}
@@ -0,0 +1,207 @@
+#pragma once
+
+// Per-client pacing for the MJPEG stream sessions.
+//
+// Pure policy with no ESP-IDF or socket dependencies: the stream task in
+// http_server.h reports new camera frames and how much of the frame in
+// flight each client's socket took, with a monotonic clock (microseconds).
+// The policy says which clients start each new frame and which to evict.
+//
+//   - A client starts a frame only when it has finished the previous one.
+//     A slow consumer skips frames instead of queueing them, and its next
+//     frame is always the newest one, so its latency does not grow.
+//   - ?fps= caps a client with a due time that advances by the frame
+//     interval. A cap that does not divide the camera rate still averages
+//     out right, and camera jitter inside `slack` does not cost a frame.
+//   - Send-queue occupancy is the part of the frame in flight that the
+//     socket has not taken yet. A client with data queued that takes
+//     nothing for stall_us is evicted, freeing its socket.
+//
+// Clients are slots 0..STREAM_SCHED_MAX_CLIENTS-1, and frame masks are bit
+// masks of slots.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef STREAM_SCHED_MAX_CLIENTS
+#define STREAM_SCHED_MAX_CLIENTS 4
+#endif
+
+_Static_assert(STREAM_SCHED_MAX_CLIENTS <= 32, "client masks are 32-bit");
+
+typedef struct {
+    bool active;
+    uint32_t interval_us;       // 1 s / fps cap, 0 = every frame
+    int64_t due_us;             // The next frame may start from here (minus slack)
+    int64_t joined_us;
+    int64_t frame_start_us;     // When the frame in flight started
+    int64_t progress_us;        // Last time the socket took data
+    uint32_t frame_id;          // Frame in flight (while queued > 0)
+    uint32_t queued;            // Bytes of it the socket has not taken
+
+    // Statistics
+    uint32_t frames;            // Frames delivered
+    uint32_t skipped;           // Frames missed while the previous one was in flight
+    uint32_t capped;            // Frames held back by the fps cap
+    uint32_t suppressed;        // Frames not sent for matching the last one
+    uint32_t blocked;           // Send attempts that found the socket full
+    uint64_t bytes;
+    uint64_t latency_us_sum;    // Frame start to last byte taken
+    uint32_t latency_us_max;
+    uint64_t occupancy_sum;     // Queued bytes, sampled at each camera frame
+    uint32_t occupancy_samples;
+} stream_client_t;
+
+typedef struct {
+    uint32_t stall_us;          // Evict a client that takes nothing for this long
+    uint32_t clients;           // Active clients
+    uint32_t evictions;
+    stream_client_t client[STREAM_SCHED_MAX_CLIENTS];
+} stream_sched_t;
+
+static void stream_sched_init(stream_sched_t *s, uint32_t stall_us) {
+    *s = (stream_sched_t){ .stall_us = stall_us };
+}
+
+// Add a client capped at `fps` (0 = camera rate). Returns its slot, or -1
+// if all slots are taken.
+static int stream_sched_join(stream_sched_t *s, uint32_t fps, int64_t now) {
+    for (int i = 0; i < STREAM_SCHED_MAX_CLIENTS; i++) {
+        stream_client_t *c = &s->client[i];
+        if (!c->active) {
+            *c = (stream_client_t){
+                .active = true,
+                .interval_us = fps ? 1000000 / fps : 0,
+                .due_us = now,
+                .joined_us = now,
+                .progress_us = now,
+            };
+            s->clients++;
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void stream_sched_leave(stream_sched_t *s, int id) {
+    if (s->client[id].active) {
+        s->client[id].active = false;
+        s->clients--;
+    }
+}
+
+// Earliness allowed against the due time: a quarter of the interval
+static int64_t stream_sched_slack(const stream_client_t *c) {
+    return c->interval_us / 4;
+}
+
+// A new camera frame of `len` bytes. Returns the mask of clients that
+// start sending it now.
+static uint32_t stream_sched_frame(stream_sched_t *s, uint32_t frame_id, uint32_t len, int64_t now) {
+    uint32_t mask = 0;
+    for (int i = 0; i < STREAM_SCHED_MAX_CLIENTS; i++) {
+        stream_client_t *c = &s->client[i];
+        if (!c->active) {
+            continue;
+        }
+        c->occupancy_sum += c->queued;
+        c->occupancy_samples++;
+        if (c->queued > 0) {
+            c->skipped++;
+            continue;
+        }
+        if (c->interval_us) {
+            if (now < c->due_us - stream_sched_slack(c)) {
+                c->capped++;
+                continue;
+            }
+            // Keep up to one interval of lag so the average holds; beyond
+            // that (a slow link) start over from now
+            if (c->due_us + c->interval_us < now) {
+                c->due_us = now;
+            }
+            c->due_us += c->interval_us;
+        }
+        c->frame_id = frame_id;
+        c->queued = len;
+        c->frame_start_us = now;
+        c->progress_us = now;
+        mask |= 1u << i;
+    }
+    return mask;
+}
+
+// The frame client `id` just started matches the last one it got and is
+// not sent: done at once, and not counted as delivered
+static void stream_sched_suppress(stream_sched_t *s, int id) {
+    s->client[id].queued = 0;
+    s->client[id].suppressed++;
+}
+
+// The socket of client `id` took `accepted` bytes of the frame in flight
+// (0: it was full). Returns true when that completes the frame.
+static bool stream_sched_sent(stream_sched_t *s, int id, uint32_t accepted, int64_t now) {
+    stream_client_t *c = &s->client[id];
+    if (accepted == 0) {
+        c->blocked++;
+        return false;
+    }
+    if (accepted > c->queued) {
+        accepted = c->queued;
+    }
+    c->progress_us = now;
+    c->bytes += accepted;
+    c->queued -= accepted;
+    if (c->queued > 0) {
+        return false;
+    }
+    uint32_t latency = (uint32_t)(now - c->frame_start_us);
+    c->frames++;
+    c->latency_us_sum += latency;
+    if (latency > c->latency_us_max) {
+        c->latency_us_max = latency;
+    }
+    return true;
+}
+
+// Clients with data queued that took nothing for stall_us. The caller
+// closes them and calls stream_sched_evict().
+static uint32_t stream_sched_stalled(const stream_sched_t *s, int64_t now) {
+    uint32_t mask = 0;
+    for (int i = 0; i < STREAM_SCHED_MAX_CLIENTS; i++) {
+        const stream_client_t *c = &s->client[i];
+        if (c->active && c->queued > 0 && now - c->progress_us >= s->stall_us) {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+}
+
+static void stream_sched_evict(stream_sched_t *s, int id) {
+    if (s->client[id].active) {
+        s->evictions++;
+        stream_sched_leave(s, id);
+    }
+}
+
+// Earliest time a new frame would go to anybody, or INT64_MAX if every
+// client is busy (or there are none). The capture side can sleep until then.
+static int64_t stream_sched_next_due(const stream_sched_t *s) {
+    int64_t next = INT64_MAX;
+    for (int i = 0; i < STREAM_SCHED_MAX_CLIENTS; i++) {
+        const stream_client_t *c = &s->client[i];
+        if (c->active && c->queued == 0) {
+            int64_t due = c->due_us - stream_sched_slack(c);
+            if (due < next) {
+                next = due;
+            }
+        }
+    }
+    return next;
+}
+
+// Delivered frames per second x10 since the client joined
+static uint32_t stream_sched_fps_x10(const stream_client_t *c, int64_t now) {
+    int64_t elapsed = now - c->joined_us;
+    return elapsed > 0 ? (uint32_t)((uint64_t)c->frames * 10000000 / elapsed) : 0;
+}
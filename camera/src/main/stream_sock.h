@@ -0,0 +1,133 @@
+#pragma once
+
+// Raw-socket send path for the MJPEG stream.
+//
+// Once the response headers are out, each frame is one vectored send of
+// [boundary + part header, JPEG]. esp_http_server's chunked encoding takes
+// three send() calls per chunk (size line, data, CRLF). The socket runs
+// with TCP_NODELAY, so the tail of a frame goes out at once instead of
+// waiting for the ACK of the previous segment.
+//
+// Sends are non-blocking (MSG_DONTWAIT). stream_sock_send_some() makes one
+// attempt, for the stream task that serves several clients from one
+// select() loop. stream_sock_sendv() waits in select() until everything is
+// out, giving up if the peer takes no data for timeout_ms.
+//
+// Plain POSIX sockets: lwIP on the ESP32, or the host for
+// tools/stream_send_bench.c.
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#ifdef MSG_NOSIGNAL
+#define STREAM_SOCK_FLAGS (MSG_DONTWAIT | MSG_NOSIGNAL)
+#else
+#define STREAM_SOCK_FLAGS MSG_DONTWAIT
+#endif
+
+typedef struct {
+    uint32_t sends;             // sendmsg() calls
+    uint32_t partial;           // Calls that took only part of the data
+    uint32_t waits;             // Times the send buffer was full
+    uint64_t bytes;
+} stream_sock_stats_t;
+
+static int64_t stream_sock_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// TCP_NODELAY, plus a send buffer size where the stack supports SO_SNDBUF
+// (lwIP does not; there it is CONFIG_LWIP_TCP_SND_BUF_DEFAULT). Returns
+// false if TCP_NODELAY could not be set.
+static bool stream_sock_tune(int fd, int sndbuf) {
+    int one = 1;
+    bool ok = setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) == 0;
+    if (sndbuf > 0) {
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    }
+    return ok;
+}
+
+// One non-blocking sendmsg of (*iov)[0..*iovcnt). Entries the socket took
+// are dropped from the front by advancing *iov and *iovcnt. Returns the
+// bytes taken (0 if the send buffer was full), or -1 with errno set.
+static ssize_t stream_sock_send_some(int fd, struct iovec **iov, int *iovcnt, stream_sock_stats_t *st) {
+    while (*iovcnt > 0 && (*iov)[0].iov_len == 0) {
+        (*iov)++;
+        (*iovcnt)--;
+    }
+    if (*iovcnt == 0) {
+        return 0;
+    }
+    struct msghdr msg = { .msg_iov = *iov, .msg_iovlen = *iovcnt };
+    ssize_t n = sendmsg(fd, &msg, STREAM_SOCK_FLAGS);
+    st->sends++;
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            st->waits++;
+            return 0;
+        }
+        return -1;
+    }
+
+    st->bytes += n;
+    size_t left = (size_t)n;
+    while (*iovcnt > 0 && left >= (*iov)[0].iov_len) {
+        left -= (*iov)[0].iov_len;
+        (*iov)++;
+        (*iovcnt)--;
+    }
+    if (*iovcnt > 0) {
+        (*iov)[0].iov_base = (char *)(*iov)[0].iov_base + left;
+        (*iov)[0].iov_len -= left;
+        st->partial++;
+    }
+    return n;
+}
+
+// Send everything in iov[0..iovcnt). The array is consumed in place.
+// Returns 0, or -1 with errno set (ETIMEDOUT if the peer took nothing for
+// timeout_ms).
+static int stream_sock_sendv(int fd, struct iovec *iov, int iovcnt, uint32_t timeout_ms,
+                             stream_sock_stats_t *st) {
+    int64_t deadline = stream_sock_now_ms() + timeout_ms;
+
+    while (true) {
+        ssize_t n = stream_sock_send_some(fd, &iov, &iovcnt, st);
+        if (n < 0) {
+            return -1;
+        }
+        if (iovcnt == 0) {
+            return 0;
+        }
+        if (n > 0) {
+            deadline = stream_sock_now_ms() + timeout_ms;  // Progress: the peer is reading
+            continue;
+        }
+
+        // Send buffer full: wait for room
+        int64_t wait_ms = deadline - stream_sock_now_ms();
+        if (wait_ms <= 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        fd_set wfds;
+        FD_ZERO(&wfds);
+        FD_SET(fd, &wfds);
+        struct timeval tv = { .tv_sec = wait_ms / 1000, .tv_usec = (wait_ms % 1000) * 1000 };
+        if (select(fd + 1, NULL, &wfds, NULL, &tv) < 0 && errno != EINTR) {
+            return -1;
+        }
+    }
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+// Execution tracer (CONFIG_TRAIN_TRACE, menu "Tracing").
+//
+// TRACE_BEGIN and TRACE_END bracket a stretch of work, and TRACE_INSTANT
+// marks a moment. Each event carries one 32-bit argument and goes into
+// the ring of the core the task is on (trace_ring.h). The points below
+// cover:
+//   - the wait for the camera's next JPEG frame, which is sensor exposure,
+//     encode and DMA;
+//   - the copy into the stream pool;
+//   - every stream and UDP send, and the AES-GCM sealing of UDP packets;
+//   - BLE writes until their ack, and BLE notifications;
+//   - detector runs.
+// Between them they show where a frame stalls and which tasks held the
+// cores meanwhile.
+//
+// /trace on the API server returns the newest events as Chrome trace JSON.
+// The tasks are grouped by the core they are pinned to, with the names
+// and priorities from the scheduler. Open the file in ui.perfetto.dev.
+// The export also reports what one event costs on this chip (event_ns).
+// That cost is about an esp_timer read and a few stores, so the option is
+// on by default. With it off, the macros compile to nothing.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#if CONFIG_TRAIN_TRACE
+
+#include <esp_attr.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "trace_ring.h"
+
+_Static_assert((CONFIG_TRAIN_TRACE_EVENTS & (CONFIG_TRAIN_TRACE_EVENTS - 1)) == 0,
+    "CONFIG_TRAIN_TRACE_EVENTS must be a power of two");
+_Static_assert(portNUM_PROCESSORS <= TRACE_MAX_CORES, "more cores than trace_ring.h handles");
+
+static const char *TRACE_TAG = "TRACE";
+
+// Trace points: name, category, argument
+static const trace_point_t trace_fb_wait = { "fb_wait", "camera", "bytes" };
+static const trace_point_t trace_capture = { "capture", "camera", "bytes" };
+static const trace_point_t trace_dispatch = { "dispatch", "stream", "clients" };
+static const trace_point_t trace_stream_send = { "stream_send", "stream", "bytes" };
+static const trace_point_t trace_chunk_send = { "chunk_send", "stream", "bytes" };
+static const trace_point_t trace_udp_frame = { "udp_frame", "udp", "bytes" };
+static const trace_point_t trace_udp_send = { "udp_send", "udp", "bytes" };
+static const trace_point_t trace_udp_seal = { "udp_seal", "udp", "bytes" };
+static const trace_point_t trace_ble_write = { "ble_write", "ble", "bytes" };
+static const trace_point_t trace_ble_notify = { "ble_notify", "ble", "bytes" };
+static const trace_point_t trace_detect = { "detect", "detect", "frame" };
+
+// Slots in PSRAM; the heads stay in internal RAM for the atomic add
+static EXT_RAM_BSS_ATTR trace_event_t trace_events[portNUM_PROCESSORS][CONFIG_TRAIN_TRACE_EVENTS];
+static EXT_RAM_BSS_ATTR trace_event_t trace_snap[portNUM_PROCESSORS * CONFIG_TRAIN_TRACE_EVENTS];
+
+#define TRACE_RING_INIT(core) { .head = 0, .mask = CONFIG_TRAIN_TRACE_EVENTS - 1, .ev = trace_events[core] }
+static trace_ring_t trace_rings[portNUM_PROCESSORS] = {
+    TRACE_RING_INIT(0),
+#if portNUM_PROCESSORS > 1
+    TRACE_RING_INIT(1),
+#endif
+};
+
+static inline void trace_event(char phase, const trace_point_t *point, uint32_t arg) {
+    trace_ring_put(&trace_rings[xPortGetCoreID()], (uint64_t)esp_timer_get_time(), phase, point,
+        xTaskGetCurrentTaskHandle(), arg);
+}
+
+#define TRACE_BEGIN(point, arg) trace_event(TRACE_PH_BEGIN, &(point), (uint32_t)(arg))
+#define TRACE_END(point, arg) trace_event(TRACE_PH_END, &(point), (uint32_t)(arg))
+#define TRACE_INSTANT(point, arg) trace_event(TRACE_PH_INSTANT, &(point), (uint32_t)(arg))
+
+// Time a batch of events on a scratch ring in the same memory as the real ones
+static uint32_t trace_event_ns(void) {
+    static EXT_RAM_BSS_ATTR trace_event_t scratch_ev[256];
+    static trace_ring_t scratch;
+    trace_ring_init(&scratch, scratch_ev, 256);
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < 1024; i++) {
+        trace_ring_put(&scratch, (uint64_t)esp_timer_get_time(), TRACE_PH_INSTANT, &trace_dispatch,
+            xTaskGetCurrentTaskHandle(), i);
+    }
+    return (uint32_t)((esp_timer_get_time() - start) * 1000 / 1024);
+}
+
+// Write the events of the last `window_ms` (0 for all) as Chrome trace
+// JSON through `write`. Runs on one task at a time (the API server).
+static bool trace_dump(uint32_t window_ms, bool (*write)(void *, const char *, size_t), void *arg) {
+    static TaskStatus_t status[TRACE_MAX_TASKS];
+    static trace_task_t tasks[TRACE_MAX_TASKS];
+    static trace_out_t out;
+
+    uint64_t now = (uint64_t)esp_timer_get_time();
+    uint64_t since = window_ms && now > window_ms * 1000ull ? now - window_ms * 1000ull : 0;
+    trace_snapshot_info_t info;
+    uint32_t n = trace_snapshot(trace_rings, portNUM_PROCESSORS, since, trace_snap,
+        sizeof(trace_snap) / sizeof(trace_snap[0]), &info);
+    trace_sort(trace_snap, n);
+
+    // Zero if there are more tasks than fit; the export then shows no names
+    UBaseType_t task_count = uxTaskGetSystemState(status, TRACE_MAX_TASKS, NULL);
+    for (UBaseType_t i = 0; i < task_count; i++) {
+        BaseType_t core = xTaskGetCoreID(status[i].xHandle);
+        tasks[i].task = status[i].xHandle;
+        strlcpy(tasks[i].name, status[i].pcTaskName, sizeof(tasks[i].name));
+        tasks[i].core = core == tskNO_AFFINITY ? -1 : (int)core;
+        tasks[i].priority = (int)status[i].uxCurrentPriority;
+    }
+
+    trace_out_init(&out, write, arg);
+    trace_export(&out, trace_snap, n, tasks, (int)task_count, portNUM_PROCESSORS, &info, trace_event_ns());
+    ESP_LOGI(TRACE_TAG, "Exported %lu events over %llu ms (%lu skipped), %lu bytes", (unsigned long)n,
+        (unsigned long long)((info.last_us - info.first_us) / 1000), (unsigned long)info.skipped,
+        (unsigned long)out.bytes);
+    return !out.failed;
+}
+
+// Event rate since the last call, and how far back the rings reach at it
+static void trace_log_stats(void) {
+    static uint32_t logged[portNUM_PROCESSORS];
+    static int64_t logged_us;
+    int64_t now = esp_timer_get_time();
+    for (int c = 0; c < portNUM_PROCESSORS; c++) {
+        uint32_t head = __atomic_load_n(&trace_rings[c].head, __ATOMIC_RELAXED);
+        uint32_t events = head - logged[c];
+        if (logged_us && events > 0) {
+            uint32_t per_s = (uint32_t)(events * 1000000ull / (now - logged_us));
+            ESP_LOGI(TRACE_TAG, "Core %d: %lu events/s, ring holds the last %lu ms", c, (unsigned long)per_s,
+                (unsigned long)(per_s ? CONFIG_TRAIN_TRACE_EVENTS * 1000ull / per_s : 0));
+        }
+        logged[c] = head;
+    }
+    logged_us = now;
+}
+
+#else
+
+#define TRACE_BEGIN(point, arg) ((void)(arg))
+#define TRACE_END(point, arg) ((void)(arg))
+#define TRACE_INSTANT(point, arg) ((void)(arg))
+
+static void trace_log_stats(void) {}
+
+#endif
@@ -0,0 +1,307 @@
+#pragma once
+
+// Execution trace: per-core event rings and their Chrome trace export.
+//
+// Every event is a begin, end or instant of a trace point, with the time,
+// the task and one 32-bit argument. Each core has its own ring, which
+// keeps the newest events and overwrites the oldest. Writers never block
+// and never wait for one another. A writer reserves a slot with one atomic
+// add on the ring's head and fills it. It publishes the slot by storing
+// the slot's sequence number last. Any task may write to any ring, since a
+// task can be preempted or move cores between picking a ring and writing
+// to it. The reader checks each slot's sequence number before and after
+// copying it, and skips slots that are still being written or were
+// overwritten meanwhile. A slot can only tear if its writer stalls for a
+// whole lap of the ring.
+//
+// The exporter first copies the rings out (trace_snapshot), because the
+// writers keep going while the JSON is sent. It then orders the copy by
+// time and writes Chrome trace_event JSON, which ui.perfetto.dev and
+// chrome://tracing open. Tasks become threads, grouped into one process
+// per core they are pinned to, plus one for tasks that run on either core.
+// An end whose begin was overwritten is dropped. A begin with no end yet
+// shows as a slice that has not finished.
+//
+// No ESP-IDF dependencies; uses the GCC __atomic builtins.
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACE_MAX_CORES 2
+#define TRACE_MAX_TASKS 48          // Distinct tasks in one export
+#define TRACE_TASK_NAME_LEN 16
+#define TRACE_OUT_LEN 1024
+
+#define TRACE_PH_BEGIN 'B'
+#define TRACE_PH_END 'E'
+#define TRACE_PH_INSTANT 'i'
+
+typedef struct {
+    const char *name;
+    const char *cat;            // Category, for filtering in the viewer
+    const char *arg;            // Name of the argument, NULL if it has none
+} trace_point_t;
+
+typedef struct {
+    uint32_t seq;               // Reservation index + 1 once written, 0 while being written
+    uint32_t arg;
+    uint64_t ts_us;
+    const trace_point_t *point;
+    const void *task;
+    char phase;
+    uint8_t core;               // Ring the event came from, set by the snapshot
+} trace_event_t;
+
+typedef struct {
+    uint32_t head;              // Events ever reserved
+    uint32_t mask;              // Slots - 1; the slot count is a power of two
+    trace_event_t *ev;
+} trace_ring_t;
+
+static bool trace_ring_init(trace_ring_t *r, trace_event_t *ev, uint32_t len) {
+    if (len == 0 || (len & (len - 1)) != 0) {
+        return false;
+    }
+    memset(ev, 0, len * sizeof(*ev));
+    *r = (trace_ring_t){ .head = 0, .mask = len - 1, .ev = ev };
+    return true;
+}
+
+static inline void trace_ring_put(trace_ring_t *r, uint64_t ts_us, char phase, const trace_point_t *point,
+                                  const void *task, uint32_t arg) {
+    uint32_t i = __atomic_fetch_add(&r->head, 1, __ATOMIC_RELAXED);
+    trace_event_t *e = &r->ev[i & r->mask];
+    __atomic_store_n(&e->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    e->ts_us = ts_us;
+    e->point = point;
+    e->task = task;
+    e->arg = arg;
+    e->phase = phase;
+    __atomic_store_n(&e->seq, i + 1, __ATOMIC_RELEASE);
+}
+
+// ---------------------------------------------------------------------------
+// Snapshot
+
+typedef struct {
+    uint32_t events;            // Copied out
+    uint32_t skipped;           // Being written, or overwritten while copying
+    uint32_t overwritten;       // Lost to newer events since boot
+    uint64_t first_us, last_us; // Time span of the copied events
+} trace_snapshot_info_t;
+
+// Copy the events at or after `since_us` from `cores` rings into `out`
+// (room for `max`), oldest first within each ring. For one lap after a
+// head wraps at 2^32 events, only the events since the wrap are seen.
+static uint32_t trace_snapshot(const trace_ring_t *rings, int cores, uint64_t since_us,
+                               trace_event_t *out, uint32_t max, trace_snapshot_info_t *info) {
+    *info = (trace_snapshot_info_t){ .first_us = UINT64_MAX };
+    uint32_t n = 0;
+    for (int c = 0; c < cores; c++) {
+        const trace_ring_t *r = &rings[c];
+        uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        uint32_t len = r->mask + 1;
+        uint32_t count = head < len ? head : len;
+        info->overwritten += head - count;
+        for (uint32_t i = head - count; i != head && n < max; i++) {
+            const trace_event_t *e = &r->ev[i & r->mask];
+            uint32_t seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+            if (seq != i + 1) {
+                info->skipped++;
+                continue;
+            }
+            trace_event_t copy = *e;
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) != seq) {
+                info->skipped++;
+                continue;
+            }
+            if (copy.ts_us < since_us) {
+                continue;
+            }
+            copy.core = (uint8_t)c;
+            out[n++] = copy;
+            if (copy.ts_us < info->first_us) info->first_us = copy.ts_us;
+            if (copy.ts_us > info->last_us) info->last_us = copy.ts_us;
+        }
+    }
+    info->events = n;
+    if (n == 0) {
+        info->first_us = 0;
+    }
+    return n;
+}
+
+// Time order. Ties keep ring order, so a zero-length slice stays begin-then-end.
+static int trace_event_cmp(const void *a, const void *b) {
+    const trace_event_t *x = a, *y = b;
+    if (x->ts_us != y->ts_us) return x->ts_us < y->ts_us ? -1 : 1;
+    if (x->core != y->core) return x->core < y->core ? -1 : 1;
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static void trace_sort(trace_event_t *ev, uint32_t n) {
+    qsort(ev, n, sizeof(*ev), trace_event_cmp);
+}
+
+// ---------------------------------------------------------------------------
+// Chrome trace_event JSON
+
+// Task table from the scheduler, for names and pinning
+typedef struct {
+    const void *task;
+    char name[TRACE_TASK_NAME_LEN];
+    int core;                   // Pinned core, -1 for either
+    int priority;
+} trace_task_t;
+
+typedef struct {
+    char buf[TRACE_OUT_LEN];
+    size_t len;
+    bool (*write)(void *arg, const char *data, size_t len);    // false stops the export
+    void *arg;
+    bool failed;
+    uint32_t bytes;
+} trace_out_t;
+
+static void trace_out_init(trace_out_t *o, bool (*write)(void *, const char *, size_t), void *arg) {
+    o->len = 0;
+    o->write = write;
+    o->arg = arg;
+    o->failed = false;
+    o->bytes = 0;
+}
+
+static void trace_out_flush(trace_out_t *o) {
+    if (o->len > 0 && !o->failed) {
+        o->failed = !o->write(o->arg, o->buf, o->len);
+        o->bytes += o->len;
+    }
+    o->len = 0;
+}
+
+static void trace_out_printf(trace_out_t *o, const char *fmt, ...) {
+    for (int attempt = 0; attempt < 2 && !o->failed; attempt++) {
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(o->buf + o->len, sizeof(o->buf) - o->len, fmt, ap);
+        va_end(ap);
+        if (n >= 0 && (size_t)n < sizeof(o->buf) - o->len) {
+            o->len += n;
+            return;
+        }
+        // Did not fit: send what is there and try again in an empty buffer
+        trace_out_flush(o);
+    }
+}
+
+// Names come from the scheduler; keep them valid inside a JSON string
+static void trace_json_name(char *dst, const char *src) {
+    size_t i = 0;
+    for (; src[i] && i < TRACE_TASK_NAME_LEN - 1; i++) {
+        char ch = src[i];
+        dst[i] = ch < 0x20 || ch > 0x7e || ch == '"' || ch == '\\' ? '_' : ch;
+    }
+    dst[i] = '\0';
+}
+
+typedef struct {
+    const void *task;
+    int pid;
+    int depth;                  // Open begins
+} trace_thread_t;
+
+// Export `n` sorted events. `tasks` may be NULL; tasks that are not in it
+// (ended since) export as "task <n>" on the either-core process.
+// `event_ns`, the measured cost of one event, goes into otherData. One
+// export at a time.
+static bool trace_export(trace_out_t *o, const trace_event_t *ev, uint32_t n, const trace_task_t *tasks,
+                         int task_count, int cores, const trace_snapshot_info_t *info, uint32_t event_ns) {
+    static trace_thread_t threads[TRACE_MAX_TASKS];     // Off the caller's stack
+    int thread_count = 0;
+    int any_pid = cores;
+
+    trace_out_printf(o, "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"events\":%lu,\"skipped\":%lu,"
+        "\"overwritten\":%lu,\"span_us\":%llu,\"event_ns\":%lu},\"traceEvents\":[", (unsigned long)info->events,
+        (unsigned long)info->skipped, (unsigned long)info->overwritten,
+        (unsigned long long)(info->last_us - info->first_us), (unsigned long)event_ns);
+
+    // Processes: one per core, and one for unpinned or unknown tasks
+    for (int p = 0; p <= cores; p++) {
+        char pname[16];
+        if (p < cores) {
+            snprintf(pname, sizeof(pname), "core %d", p);
+        } else {
+            snprintf(pname, sizeof(pname), "either core");
+        }
+        trace_out_printf(o, "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}},"
+            "{\"name\":\"process_sort_index\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"sort_index\":%d}}",
+            p ? "," : "", p, pname, p, p);
+    }
+
+    for (uint32_t i = 0; i < n && !o->failed; i++) {
+        const trace_event_t *e = &ev[i];
+
+        // Thread for the task, named on first sight
+        int t = 0;
+        while (t < thread_count && threads[t].task != e->task) {
+            t++;
+        }
+        if (t == thread_count) {
+            if (thread_count == TRACE_MAX_TASKS) {
+                continue;
+            }
+            const trace_task_t *info_task = NULL;
+            for (int k = 0; k < task_count; k++) {
+                if (tasks[k].task == e->task) {
+                    info_task = &tasks[k];
+                    break;
+                }
+            }
+            char tname[TRACE_TASK_NAME_LEN];
+            int pid = any_pid, priority = 0;
+            if (info_task) {
+                trace_json_name(tname, info_task->name);
+                pid = info_task->core >= 0 && info_task->core < cores ? info_task->core : any_pid;
+                priority = info_task->priority;
+            } else {
+                snprintf(tname, sizeof(tname), "task %d", t + 1);
+            }
+            threads[t] = (trace_thread_t){ .task = e->task, .pid = pid, .depth = 0 };
+            thread_count++;
+            // Higher priority first within a process
+            trace_out_printf(o, ",{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}},"
+                "{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"sort_index\":%d}}",
+                pid, t + 1, tname, pid, t + 1, -priority);
+        }
+
+        trace_thread_t *th = &threads[t];
+        if (e->phase == TRACE_PH_END) {
+            if (th->depth == 0) {
+                continue;       // Its begin was overwritten
+            }
+            th->depth--;
+        } else if (e->phase == TRACE_PH_BEGIN) {
+            th->depth++;
+        }
+
+        const trace_point_t *p = e->point;
+        trace_out_printf(o, ",{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",%s\"ts\":%llu,\"pid\":%d,\"tid\":%d,"
+            "\"args\":{\"core\":%u", p->name, p->cat, e->phase, e->phase == TRACE_PH_INSTANT ? "\"s\":\"t\"," : "",
+            (unsigned long long)e->ts_us, th->pid, t + 1, (unsigned)e->core);
+        if (p->arg) {
+            trace_out_printf(o, ",\"%s\":%lu}}", p->arg, (unsigned long)e->arg);
+        } else {
+            trace_out_printf(o, "}}");
+        }
+    }
+
+    trace_out_printf(o, "]}");
+    trace_out_flush(o);
+    return !o->failed;
+}
@@ -1,16 +1,43 @@
 #pragma once
 
+// NimBLE central for one or more Pybricks hubs.
+//
+// Each hub gets a slot in the connection table (train_hub_table.h) and a
+// FreeRTOS task with a one-deep command queue. The task runs the hub's init
+// sequence and its writes, so a slow or stalled hub only delays itself, and a
+// newer command replaces one that has not gone out yet instead of queueing
+// behind it. GAP/GATT events from the NimBLE host task only update the table.
+//
+// Connection parameters and scan timing come from the coexistence policy in
+// ble_sched.h: short intervals only while commands are in flight, long
+// intervals with peripheral latency otherwise, and backed-off scan bursts.
+//
+// Telemetry frames from the hub program (hub_telemetry.h) arrive on the
+// stdout notifications and are parsed in the host task into a per-hub
+// latest-value cell and a history ring that HTTP handlers read lock-free.
+
 #include <string.h>
 #include <esp_log.h>
 #include <esp_bt.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
 #include <nimble/nimble_port.h>
 #include <nimble/nimble_port_freertos.h>
 #include <host/ble_hs.h>
 #include <host/util/util.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <freertos/queue.h>
 #include <freertos/semphr.h>
 
+#define TRAIN_HUB_MAX CONFIG_TRAIN_BLE_MAX_HUBS
+#include "train_hub_table.h"
+#define BLE_SCHED_MAX_LINKS TRAIN_HUB_MAX
+#include "ble_sched.h"
+#include "hub_telemetry.h"
+#include "trace.h"
+#include "wifi_sta.h"
+
 static const char *BLE_TAG = "TRAIN_BLE";
 
 // Pybricks Service UUID: c5f50001-8280-46da-89f4-6d8051e4aeef (little-endian)
@@ -25,103 +52,165 @@ static const ble_uuid128_t pybricks_chr_uuid = BLE_UUID128_INIT(
     0xda, 0x46, 0x80, 0x82, 0x02, 0x00, 0xf5, 0xc5
 );
 
-// Connection state
-typedef enum {
-    TRAIN_BLE_DISCONNECTED = 0,
-    TRAIN_BLE_SCANNING,
-    TRAIN_BLE_CONNECTING,
-    TRAIN_BLE_DISCOVERING,
-    TRAIN_BLE_INITIALIZING,
-    TRAIN_BLE_READY
-} train_ble_state_t;
-
-static train_ble_state_t train_state = TRAIN_BLE_DISCONNECTED;
-static uint16_t train_conn_handle = 0;
-static uint16_t train_chr_val_handle = 0;
-static uint16_t train_cccd_handle = 0;
-static bool motor_initialized = false;
-static volatile bool repl_prompt_received = false;
+#define TRAIN_HUB_CMD_START 0x01        // Internal: run the program start sequence
+#define TRAIN_HUB_CMD_RATE 0x02         // Internal: wake the task to send the telemetry rate
+#define TRAIN_TLM_RING_LEN 256          // Telemetry history per hub (power of two)
+#define TRAIN_BLE_WRITE_TIMEOUT_MS 3000 // Long, for WiFi/BLE coexistence
+#define TRAIN_BLE_SCHED_TICK_MS 500
+
+typedef struct {
+    char cmd;
+    int64_t queued_us;
+} train_hub_cmd_t;
+
+// FreeRTOS side of a hub slot
+typedef struct {
+    TaskHandle_t task;
+    QueueHandle_t queue;            // Depth 1, written with xQueueOverwrite
+    volatile int write_status;
+} train_hub_ctx_t;
+
+// Telemetry side of a hub slot. The NimBLE host task is the only writer of
+// rx, latest and ring. It runs above httpd on core 0, so a reader it
+// interrupts mid-copy retries once the (short) write is done.
+typedef struct {
+    hub_rx_t rx;
+    hub_tlm_latest_t latest;
+    hub_tlm_ring_t ring;
+    volatile uint8_t rate_hz;       // Wanted frames per second
+    volatile bool rate_dirty;       // rate_hz not sent to the hub yet
+} train_hub_tlm_t;
+
+static train_hub_table_t train_hubs;
+static train_hub_ctx_t train_hub_ctx[TRAIN_HUB_MAX];
+static train_hub_tlm_t train_tlm[TRAIN_HUB_MAX];
+static ble_sched_t train_sched;                 // Guarded by train_hubs_mutex too
+static SemaphoreHandle_t train_hubs_mutex = NULL;
+static esp_timer_handle_t train_rescan_timer = NULL;
+static esp_timer_handle_t train_sched_timer = NULL;
 
 // Forward declarations
 static void train_ble_scan_start(void);
 static int train_ble_gap_event(struct ble_gap_event *event, void *arg);
-static void train_init_task(void *param);
-static void train_subscribe_notifications(uint16_t conn_handle);
 
-// Get state as string
+// Overall state as string (the most advanced hub)
 static const char* train_state_str(void) {
-    switch (train_state) {
-        case TRAIN_BLE_DISCONNECTED: return "disconnected";
-        case TRAIN_BLE_SCANNING: return "scanning";
-        case TRAIN_BLE_CONNECTING: return "connecting";
-        case TRAIN_BLE_DISCOVERING: return "discovering";
-        case TRAIN_BLE_INITIALIZING: return "initializing";
-        case TRAIN_BLE_READY: return "ready";
-        default: return "unknown";
+    return train_hub_state_str(train_hub_summary_state(&train_hubs));
+}
+
+// Consistent copy of the table for status reporting
+static void train_hub_snapshot(train_hub_table_t *out) {
+    xSemaphoreTake(train_hubs_mutex, portMAX_DELAY);
+    *out = train_hubs;
+    xSemaphoreGive(train_hubs_mutex);
+}
+
+// Consistent copy of the scheduler state, with time accounted up to now
+static void train_sched_snapshot(ble_sched_t *out) {
+    xSemaphoreTake(train_hubs_mutex, portMAX_DELAY);
+    ble_sched_account(&train_sched, esp_timer_get_time());
+    *out = train_sched;
+    xSemaphoreGive(train_hubs_mutex);
+}
+
+// Ask the controller for the policy's parameters on a hub link
+static void train_ble_apply_params(int slot, ble_link_mode_t mode) {
+    uint16_t conn_handle = train_hubs.hubs[slot].conn_handle;
+    if (conn_handle == TRAIN_HUB_CONN_NONE) {
+        return;
+    }
+    const ble_sched_conn_params_t *p = ble_sched_params(&train_sched, mode);
+    struct ble_gap_upd_params params = {
+        .itvl_min = p->itvl_min,
+        .itvl_max = p->itvl_max,
+        .latency = p->latency,
+        .supervision_timeout = p->supervision_timeout,
+    };
+    int rc = ble_gap_update_params(conn_handle, &params);
+    if (rc != 0) {
+        ESP_LOGW(BLE_TAG, "[hub %d] Parameter update (%s) failed: %d", slot, ble_link_mode_str(mode), rc);
+    }
+}
+
+// Apply a bitmask of links to one mode
+static void train_ble_apply_mask(uint32_t mask, ble_link_mode_t mode) {
+    for (int i = 0; i < train_hubs.count; i++) {
+        if (mask & (1u << i)) {
+            train_ble_apply_params(i, mode);
+        }
     }
 }
 
-// Write with acknowledgment callback
-static volatile bool write_complete = false;
-static int write_cb(uint16_t conn_handle, const struct ble_gatt_error *error,
-                    struct ble_gatt_attr *attr, void *arg) {
+// Periodic scheduler tick: WiFi throughput sample, drop idle links to long intervals
+static void train_sched_tick_cb(void *arg) {
+    int64_t now = esp_timer_get_time();
+    xSemaphoreTake(train_hubs_mutex, portMAX_DELAY);
+    ble_sched_wifi_sample(&train_sched, __atomic_load_n(&wifi_tx_bytes, __ATOMIC_RELAXED), now);
+    uint32_t to_idle = ble_sched_tick(&train_sched, now);
+    xSemaphoreGive(train_hubs_mutex);
+    train_ble_apply_mask(to_idle, BLE_LINK_IDLE);
+}
+
+// One-line summary for the periodic log
+static void train_ble_log_stats(void) {
+    ble_sched_t sched;
+    train_sched_snapshot(&sched);
+    uint32_t duty = ble_sched_duty_permille(&sched);
+    uint32_t avg = ble_sched_avg_duty_permille(&sched, esp_timer_get_time());
+    ESP_LOGI(BLE_TAG, "Hubs ready: %d/%d, BLE duty ~%lu.%lu%% (avg %lu.%lu%%), scan backoff %lu ms, WiFi tx %lu kbit/s",
+        train_hub_ready_count(&train_hubs), train_hubs.count,
+        (unsigned long)(duty / 10), (unsigned long)(duty % 10),
+        (unsigned long)(avg / 10), (unsigned long)(avg % 10),
+        (unsigned long)ble_sched_backoff_ms(&sched), (unsigned long)sched.wifi_kbps);
+}
+
+// Write with acknowledgment callback; wakes the hub task that issued it
+static int train_write_cb(uint16_t conn_handle, const struct ble_gatt_error *error,
+                          struct ble_gatt_attr *attr, void *arg) {
+    train_hub_ctx_t *ctx = (train_hub_ctx_t *)arg;
     if (error->status != 0) {
         ESP_LOGE(BLE_TAG, "Write callback error: %d", error->status);
     }
-    write_complete = true;
+    ctx->write_status = error->status;
+    xTaskNotifyGive(ctx->task);
     return 0;
 }
 
-// Send data and wait for completion
-static int train_write_wait(const uint8_t *data, size_t len) {
-    if (train_chr_val_handle == 0 || train_conn_handle == 0) {
-        ESP_LOGW(BLE_TAG, "Cannot write: not connected");
-        return -1;
-    }
+// Send data to a hub and wait for completion (called from its hub task)
+static int train_write_wait(int slot, const uint8_t *data, size_t len) {
+    train_hub_ctx_t *ctx = &train_hub_ctx[slot];
 
-    write_complete = false;
+    xSemaphoreTake(train_hubs_mutex, portMAX_DELAY);
+    uint16_t conn_handle = train_hubs.hubs[slot].conn_handle;
+    uint16_t chr_val_handle = train_hubs.hubs[slot].chr_val_handle;
+    xSemaphoreGive(train_hubs_mutex);
 
-    int rc = ble_gattc_write_flat(train_conn_handle, train_chr_val_handle,
-                                   data, len, write_cb, NULL);
-    if (rc != 0) {
-        ESP_LOGE(BLE_TAG, "Write failed to initiate: %d", rc);
+    if (chr_val_handle == 0 || conn_handle == TRAIN_HUB_CONN_NONE) {
+        ESP_LOGW(BLE_TAG, "[hub %d] Cannot write: not connected", slot);
         return -1;
     }
 
-    // Wait for write to complete (with longer timeout for WiFi/BLE coex)
-    int timeout = 300;  // 3 seconds
-    while (!write_complete && timeout > 0) {
-        vTaskDelay(pdMS_TO_TICKS(10));
-        timeout--;
-    }
-
-    if (!write_complete) {
-        ESP_LOGW(BLE_TAG, "Write timeout");
+    ulTaskNotifyTake(pdTRUE, 0);  // Drop a late ack from a write that timed out
+    TRACE_BEGIN(trace_ble_write, len);
+    int rc = ble_gattc_write_flat(conn_handle, chr_val_handle, data, len, train_write_cb, ctx);
+    if (rc != 0) {
+        TRACE_END(trace_ble_write, 0);
+        ESP_LOGE(BLE_TAG, "[hub %d] Write failed to initiate: %d", slot, rc);
         return -1;
     }
 
-    return 0;
-}
-
-// Wait for REPL prompt with timeout
-static bool train_wait_for_prompt(int timeout_ms) {
-    int waited = 0;
-    while (!repl_prompt_received && waited < timeout_ms) {
-        vTaskDelay(pdMS_TO_TICKS(50));
-        waited += 50;
+    // Until the hub acks: the connection interval and coexistence show here
+    bool acked = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(TRAIN_BLE_WRITE_TIMEOUT_MS)) != 0;
+    TRACE_END(trace_ble_write, acked && ctx->write_status == 0 ? len : 0);
+    if (!acked) {
+        ESP_LOGW(BLE_TAG, "[hub %d] Write timeout", slot);
+        return -1;
     }
-    bool got_it = repl_prompt_received;
-    repl_prompt_received = false;  // Reset for next command
-    return got_it;
+    return ctx->write_status == 0 ? 0 : -1;
 }
 
 // Send stdin data to running program (single char, no line ending)
-static int train_send_stdin(const char *data) {
-    if (train_chr_val_handle == 0 || train_conn_handle == 0) {
-        ESP_LOGW(BLE_TAG, "Cannot write stdin: not connected");
-        return -1;
-    }
-
+static int train_send_stdin(int slot, const char *data) {
     size_t len = strlen(data);
     uint8_t buf[128];
 
@@ -133,120 +222,248 @@ static int train_send_stdin(const char *data) {
     memcpy(&buf[1], data, len);
     // No line ending needed - program reads single chars with stdin.read(1)
 
-    ESP_LOGI(BLE_TAG, "Sending stdin (%d bytes): [0x06] + '%s'", len + 1, data);
+    ESP_LOGI(BLE_TAG, "[hub %d] Sending stdin (%d bytes): [0x06] + '%s'", slot, len + 1, data);
 
     // Use write-with-response for reliability with WiFi/BLE coexistence
-    return train_write_wait(buf, len + 1);
+    return train_write_wait(slot, buf, len + 1);
 }
 
-// Flag for program ready signal
-static volatile bool program_ready_received = false;
-
-// Initialize by starting pre-installed user program (runs in separate task)
-static void train_init_task(void *param) {
-    ESP_LOGI(BLE_TAG, "Starting train program...");
+// Start the pre-installed user program and wait for it to print "RDY"
+static void train_hub_start_program(int slot) {
+    xSemaphoreTake(train_hubs_mutex, portMAX_DELAY);
+    uint32_t generation = train_hubs.hubs[slot].generation;
+    uint16_t conn_handle = train_hubs.hubs[slot].conn_handle;
+    xSemaphoreGive(train_hubs_mutex);
 
-    // Start user program (must be pre-installed with: pybricksdev install ble train/main.py)
-    ESP_LOGI(BLE_TAG, "Sending start program command (0x01)...");
-    program_ready_received = false;
+    // Must be pre-installed with: pybricksdev install ble train/main.py
+    ESP_LOGI(BLE_TAG, "[hub %d] Sending start program command (0x01)...", slot);
     uint8_t start_program = 0x01;
-    if (train_write_wait(&start_program, 1) != 0) {
-        ESP_LOGE(BLE_TAG, "Failed to start program");
-        train_state = TRAIN_BLE_DISCONNECTED;
-        vTaskDelete(NULL);
+    if (train_write_wait(slot, &start_program, 1) != 0) {
+        ESP_LOGE(BLE_TAG, "[hub %d] Failed to start program, dropping connection", slot);
+        ble_gap_terminate(conn_handle, BLE_ERR_REM_USER_CONN_TERM);
         return;
     }
 
-    // Wait for program to signal ready (it prints "RDY")
-    ESP_LOGI(BLE_TAG, "Waiting for program ready signal...");
+    ESP_LOGI(BLE_TAG, "[hub %d] Waiting for program ready signal...", slot);
+    // Stop waiting once the link drops: the one-deep queue may already hold
+    // the start of the next connection
     int waited = 0;
-    while (!program_ready_received && waited < 5000) {
+    while (!train_hubs.hubs[slot].program_ready && waited < 5000 &&
+           train_hub_init_current(&train_hubs, slot, generation)) {
         vTaskDelay(pdMS_TO_TICKS(100));
         waited += 100;
     }
-
-    if (program_ready_received) {
-        ESP_LOGI(BLE_TAG, "Program ready!");
-    } else {
-        ESP_LOGW(BLE_TAG, "No ready signal, but continuing...");
+    if (!train_hub_init_current(&train_hubs, slot, generation)) {
+        ESP_LOGW(BLE_TAG, "[hub %d] Link dropped during the program start", slot);
+        return;
+    }
+    if (!train_hubs.hubs[slot].program_ready) {
+        ESP_LOGW(BLE_TAG, "[hub %d] No ready signal, but continuing...", slot);
     }
 
-    motor_initialized = true;
-    train_state = TRAIN_BLE_READY;
-    ESP_LOGI(BLE_TAG, "Train BLE READY - use F/B/S commands");
+    xSemaphoreTake(train_hubs_mutex, portMAX_DELAY);
+    bool ready = train_hub_init_done(&train_hubs, slot, generation, esp_timer_get_time());
+    xSemaphoreGive(train_hubs_mutex);
 
-    vTaskDelete(NULL);
+    if (ready) {
+        ESP_LOGI(BLE_TAG, "[hub %d] READY - use F/B/S commands", slot);
+        train_tlm[slot].rate_dirty = true;  // A fresh program starts at its default rate
+    }
 }
 
-// Send motor command (single character: F=forward, B=backward, S=stop)
-static int train_write_command(const char *cmd) {
-    if (train_state != TRAIN_BLE_READY || !motor_initialized) {
-        ESP_LOGW(BLE_TAG, "Cannot write: not ready (state=%s, motor=%d)",
-            train_state_str(), motor_initialized);
-        return -1;
+// Tell the hub program how many telemetry frames per second to send ("T<n>")
+static void train_hub_send_rate(int slot) {
+    train_tlm[slot].rate_dirty = false;
+    char text[3] = { 'T', (char)('0' + train_tlm[slot].rate_hz), '\0' };
+    if (train_send_stdin(slot, text) != 0) {
+        train_tlm[slot].rate_dirty = true;  // Retry on the next wakeup
+    }
+}
+
+// Per-hub worker: init sequence and command writes
+static void train_hub_task(void *param) {
+    int slot = (int)(intptr_t)param;
+    train_hub_cmd_t cmd;
+
+    while (1) {
+        if (train_tlm[slot].rate_dirty && train_hubs.hubs[slot].state == TRAIN_BLE_READY) {
+            train_hub_send_rate(slot);
+        }
+        if (xQueueReceive(train_hub_ctx[slot].queue, &cmd, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        if (cmd.cmd == TRAIN_HUB_CMD_START) {
+            train_hub_start_program(slot);
+            continue;
+        }
+        if (cmd.cmd == TRAIN_HUB_CMD_RATE) {
+            continue;
+        }
+        if (train_hubs.hubs[slot].state != TRAIN_BLE_READY) {
+            xSemaphoreTake(train_hubs_mutex, portMAX_DELAY);
+            ble_sched_command_done(&train_sched, slot, esp_timer_get_time());
+            xSemaphoreGive(train_hubs_mutex);
+            continue;
+        }
+
+        char text[2] = { cmd.cmd, '\0' };
+        int rc = train_send_stdin(slot, text);
+        uint32_t latency = (uint32_t)(esp_timer_get_time() - cmd.queued_us);
+
+        xSemaphoreTake(train_hubs_mutex, portMAX_DELAY);
+        ble_sched_command_done(&train_sched, slot, esp_timer_get_time());
+        train_hub_t *hub = &train_hubs.hubs[slot];
+        hub->last_cmd = cmd.cmd;
+        if (rc == 0) {
+            hub->commands++;
+            hub->last_latency_us = latency;
+            if (latency > hub->max_latency_us) {
+                hub->max_latency_us = latency;
+            }
+        } else {
+            hub->errors++;
+        }
+        xSemaphoreGive(train_hubs_mutex);
     }
+}
 
-    // Send single character command to the running program
+// Public API: queue a motor command (F=forward, B=backward, S=stop) for hub
+// `id`, or for every ready hub if id < 0. Returns the number of hubs it was
+// queued for, or -1 if none.
+static int train_send_command(int id, const char *cmd) {
     if (strcmp(cmd, "F") != 0 && strcmp(cmd, "B") != 0 && strcmp(cmd, "S") != 0) {
         ESP_LOGW(BLE_TAG, "Unknown command: %s (use F/B/S)", cmd);
         return -1;
     }
 
-    return train_send_stdin(cmd);
+    train_hub_cmd_t item = { .cmd = cmd[0], .queued_us = esp_timer_get_time() };
+    int queued = 0;
+    uint32_t to_active = 0;
+
+    xSemaphoreTake(train_hubs_mutex, portMAX_DELAY);
+    for (int i = 0; i < train_hubs.count; i++) {
+        if ((id >= 0 && i != id) || train_hubs.hubs[i].state != TRAIN_BLE_READY) {
+            continue;
+        }
+        // A replaced command never completes, so only count a new one in flight
+        if (uxQueueMessagesWaiting(train_hub_ctx[i].queue) == 0) {
+            if (ble_sched_command(&train_sched, i, item.queued_us)) {
+                to_active |= 1u << i;
+            }
+        } else {
+            train_sched.links[i].last_cmd_us = item.queued_us;
+        }
+        xQueueOverwrite(train_hub_ctx[i].queue, &item);
+        queued++;
+    }
+    xSemaphoreGive(train_hubs_mutex);
+
+    // Shorten the interval for the rest of the burst; this command goes out
+    // on the current one
+    train_ble_apply_mask(to_active, BLE_LINK_ACTIVE);
+
+    ESP_LOGI(BLE_TAG, "train_send_command: %s -> %s: queued for %d hub(s)",
+        cmd, id >= 0 ? "one hub" : "all hubs", queued);
+    return queued > 0 ? queued : -1;
+}
+
+// Public API: set the telemetry rate (0-9 frames/s) for hub `id`, or every
+// hub if id < 0. Hubs that are not ready get it once their program starts.
+// Returns the number of hubs updated, or -1.
+static int train_telemetry_set_rate(int id, int hz) {
+    if (hz < 0 || hz > 9 || id >= train_hubs.count) {
+        return -1;
+    }
+    int updated = 0;
+    train_hub_cmd_t item = { .cmd = TRAIN_HUB_CMD_RATE, .queued_us = esp_timer_get_time() };
+    for (int i = 0; i < train_hubs.count; i++) {
+        if (id >= 0 && i != id) {
+            continue;
+        }
+        train_tlm[i].rate_hz = (uint8_t)hz;
+        train_tlm[i].rate_dirty = true;
+        // Only wake an idle task; a queued command must not be replaced
+        xQueueSend(train_hub_ctx[i].queue, &item, 0);
+        updated++;
+    }
+    ESP_LOGI(BLE_TAG, "Telemetry rate %d/s for %d hub(s)", hz, updated);
+    return updated;
+}
+
+// Latest telemetry sample of a hub; false if it never sent one
+static bool train_telemetry_latest(int slot, hub_tlm_sample_t *out) {
+    return hub_tlm_latest_read(&train_tlm[slot].latest, out);
+}
+
+// Up to `max` of the newest samples of a hub, oldest first
+static uint32_t train_telemetry_history(int slot, hub_tlm_sample_t *out, uint32_t max) {
+    if (train_tlm[slot].ring.slots == NULL) {
+        return 0;
+    }
+    return hub_tlm_ring_read(&train_tlm[slot].ring, out, max);
+}
+
+// Hand the hub to its task for the program start sequence
+static void train_hub_begin_init(int slot) {
+    xSemaphoreTake(train_hubs_mutex, portMAX_DELAY);
+    train_hub_set_state(&train_hubs, slot, TRAIN_BLE_INITIALIZING, esp_timer_get_time());
+    xSemaphoreGive(train_hubs_mutex);
+
+    train_hub_cmd_t item = { .cmd = TRAIN_HUB_CMD_START, .queued_us = esp_timer_get_time() };
+    xQueueOverwrite(train_hub_ctx[slot].queue, &item);
 }
 
 // Subscribe to notifications callback
 static int train_subscribe_cb(uint16_t conn_handle, const struct ble_gatt_error *error,
-                               struct ble_gatt_attr *attr, void *arg) {
+                              struct ble_gatt_attr *attr, void *arg) {
+    int slot = (int)(intptr_t)arg;
     if (error->status == 0) {
-        ESP_LOGI(BLE_TAG, "Subscribed to notifications");
-        // Now start motor initialization
-        train_state = TRAIN_BLE_INITIALIZING;
-        motor_initialized = false;
-        xTaskCreate(train_init_task, "train_init", 4096, NULL, 5, NULL);
+        ESP_LOGI(BLE_TAG, "[hub %d] Subscribed to notifications", slot);
+        train_hub_begin_init(slot);
     } else {
-        ESP_LOGE(BLE_TAG, "Subscribe failed: %d", error->status);
+        ESP_LOGE(BLE_TAG, "[hub %d] Subscribe failed: %d", slot, error->status);
     }
     return 0;
 }
 
 // Subscribe to notifications
-static void train_subscribe_notifications(uint16_t conn_handle) {
+static void train_subscribe_notifications(int slot, uint16_t conn_handle, uint16_t chr_val_handle) {
     // CCCD handle is usually val_handle + 1 for characteristics with notify property
-    train_cccd_handle = train_chr_val_handle + 1;
-
+    uint16_t cccd_handle = chr_val_handle + 1;
     uint8_t value[2] = {0x01, 0x00};  // Enable notifications (0x0001)
 
-    ESP_LOGI(BLE_TAG, "Subscribing to notifications (CCCD handle: %d)...", train_cccd_handle);
-    int rc = ble_gattc_write_flat(conn_handle, train_cccd_handle, value, sizeof(value),
-                                   train_subscribe_cb, NULL);
+    ESP_LOGI(BLE_TAG, "[hub %d] Subscribing to notifications (CCCD handle: %d)...", slot, cccd_handle);
+    int rc = ble_gattc_write_flat(conn_handle, cccd_handle, value, sizeof(value),
+                                  train_subscribe_cb, (void *)(intptr_t)slot);
     if (rc != 0) {
-        ESP_LOGE(BLE_TAG, "Failed to subscribe: %d", rc);
+        ESP_LOGE(BLE_TAG, "[hub %d] Failed to subscribe: %d", slot, rc);
         // Still try to initialize without notifications
-        train_state = TRAIN_BLE_INITIALIZING;
-        motor_initialized = false;
-        xTaskCreate(train_init_task, "train_init", 4096, NULL, 5, NULL);
+        train_hub_begin_init(slot);
     }
 }
 
 // Characteristic discovery callback
 static int train_on_chr_disc_complete(uint16_t conn_handle,
-                                       const struct ble_gatt_error *error,
-                                       const struct ble_gatt_chr *chr,
-                                       void *arg) {
+                                      const struct ble_gatt_error *error,
+                                      const struct ble_gatt_chr *chr,
+                                      void *arg) {
+    int slot = (int)(intptr_t)arg;
     if (error->status == 0 && chr != NULL) {
         if (ble_uuid_cmp(&chr->uuid.u, &pybricks_chr_uuid.u) == 0) {
-            train_chr_val_handle = chr->val_handle;
-            ESP_LOGI(BLE_TAG, "Found Pybricks characteristic! Handle: %d", train_chr_val_handle);
+            xSemaphoreTake(train_hubs_mutex, portMAX_DELAY);
+            train_hubs.hubs[slot].chr_val_handle = chr->val_handle;
+            xSemaphoreGive(train_hubs_mutex);
+            ESP_LOGI(BLE_TAG, "[hub %d] Found Pybricks characteristic! Handle: %d", slot, chr->val_handle);
         }
     } else if (error->status == BLE_HS_EDONE) {
-        ESP_LOGI(BLE_TAG, "Characteristic discovery complete");
+        ESP_LOGI(BLE_TAG, "[hub %d] Characteristic discovery complete", slot);
 
-        if (train_chr_val_handle != 0) {
+        uint16_t chr_val_handle = train_hubs.hubs[slot].chr_val_handle;
+        if (chr_val_handle != 0) {
             // Subscribe to notifications first, then initialize
-            train_subscribe_notifications(conn_handle);
+            train_subscribe_notifications(slot, conn_handle, chr_val_handle);
         } else {
-            ESP_LOGE(BLE_TAG, "Pybricks characteristic not found!");
+            ESP_LOGE(BLE_TAG, "[hub %d] Pybricks characteristic not found!", slot);
             ble_gap_terminate(conn_handle, BLE_ERR_REM_USER_CONN_TERM);
         }
     }
@@ -254,147 +471,246 @@ static int train_on_chr_disc_complete(uint16_t conn_handle,
 }
 
 // Start characteristic discovery
-static void train_discover_characteristics(uint16_t conn_handle) {
-    train_state = TRAIN_BLE_DISCOVERING;
-    ESP_LOGI(BLE_TAG, "Starting characteristic discovery...");
+static void train_discover_characteristics(int slot, uint16_t conn_handle) {
+    ESP_LOGI(BLE_TAG, "[hub %d] Starting characteristic discovery...", slot);
 
     int rc = ble_gattc_disc_chrs_by_uuid(conn_handle, 1, 0xFFFF,
-                                          &pybricks_chr_uuid.u,
-                                          train_on_chr_disc_complete, NULL);
+                                         &pybricks_chr_uuid.u,
+                                         train_on_chr_disc_complete, (void *)(intptr_t)slot);
     if (rc != 0) {
-        ESP_LOGE(BLE_TAG, "Failed to start characteristic discovery: %d", rc);
+        ESP_LOGE(BLE_TAG, "[hub %d] Failed to start characteristic discovery: %d", slot, rc);
+        ble_gap_terminate(conn_handle, BLE_ERR_REM_USER_CONN_TERM);
     }
 }
 
-// GAP event handler
-static int train_ble_gap_event(struct ble_gap_event *event, void *arg) {
-    switch (event->type) {
-        case BLE_GAP_EVENT_DISC: {
-            struct ble_hs_adv_fields fields;
-            int rc = ble_hs_adv_parse_fields(&fields, event->disc.data,
-                                              event->disc.length_data);
-            if (rc != 0) break;
-
-            bool has_pybricks = false;
-
-            // Check 128-bit UUIDs
-            if (fields.uuids128 != NULL) {
-                for (int i = 0; i < fields.num_uuids128; i++) {
-                    if (ble_uuid_cmp(&fields.uuids128[i].u, &pybricks_svc_uuid.u) == 0) {
-                        has_pybricks = true;
-                        break;
-                    }
-                }
-            }
+// Restart scanning after `delay_ms` without blocking the host task
+static void train_ble_rescan_after(uint32_t delay_ms) {
+    if (!train_rescan_timer) {
+        return;
+    }
+    esp_timer_stop(train_rescan_timer);
+    esp_timer_start_once(train_rescan_timer, (uint64_t)delay_ms * 1000);
+}
 
-            // Check device name
-            if (!has_pybricks && fields.name != NULL && fields.name_len > 0) {
-                char name[32] = {0};
-                int len = fields.name_len < 31 ? fields.name_len : 31;
-                memcpy(name, fields.name, len);
-
-                if (strstr(name, "Pybricks") != NULL ||
-                    strstr(name, "train") != NULL ||
-                    strstr(name, "City") != NULL) {
-                    has_pybricks = true;
-                    ESP_LOGI(BLE_TAG, "Found hub: %s", name);
-                }
+static void train_ble_rescan_cb(void *arg) {
+    train_ble_scan_start();
+}
+
+// Advertisement: connect if it belongs in a free slot
+static void train_ble_on_adv(const struct ble_gap_disc_desc *disc) {
+    struct ble_hs_adv_fields fields;
+    if (ble_hs_adv_parse_fields(&fields, disc->data, disc->length_data) != 0) {
+        return;
+    }
+
+    bool has_service = false;
+    if (fields.uuids128 != NULL) {
+        for (int i = 0; i < fields.num_uuids128; i++) {
+            if (ble_uuid_cmp(&fields.uuids128[i].u, &pybricks_svc_uuid.u) == 0) {
+                has_service = true;
+                break;
             }
+        }
+    }
 
-            if (has_pybricks) {
-                ESP_LOGI(BLE_TAG, "Found Pybricks hub! Connecting...");
-                ble_gap_disc_cancel();
-                train_state = TRAIN_BLE_CONNECTING;
-                rc = ble_gap_connect(BLE_OWN_ADDR_PUBLIC, &event->disc.addr,
-                                      10000, NULL, train_ble_gap_event, NULL);
-                if (rc != 0) {
-                    ESP_LOGE(BLE_TAG, "Failed to connect: %d", rc);
-                    train_state = TRAIN_BLE_DISCONNECTED;
-                    train_ble_scan_start();
+    // Keep the name JSON-safe, it ends up in /train responses
+    char name[TRAIN_HUB_NAME_LEN] = {0};
+    if (fields.name != NULL && fields.name_len > 0) {
+        int len = fields.name_len < (int)sizeof(name) - 1 ? fields.name_len : (int)sizeof(name) - 1;
+        for (int i = 0; i < len; i++) {
+            char c = (char)fields.name[i];
+            name[i] = (c < 0x20 || c == '"' || c == '\\') ? '_' : c;
+        }
+    }
+
+    int64_t now = esp_timer_get_time();
+    xSemaphoreTake(train_hubs_mutex, portMAX_DELAY);
+    int slot = train_hub_match(&train_hubs, name[0] ? name : NULL, disc->addr.val, has_service);
+    if (slot >= 0) {
+        train_hub_connect_started(&train_hubs, slot, name, disc->addr.val, now);
+        train_hubs.scanning = false;
+        ble_sched_scan_done(&train_sched, true, now);
+    }
+    xSemaphoreGive(train_hubs_mutex);
+    if (slot < 0) {
+        return;
+    }
+
+    char addr[18];
+    train_hub_format_addr(disc->addr.val, addr, sizeof(addr));
+    ESP_LOGI(BLE_TAG, "[hub %d] Found %s (%s), connecting...", slot, name[0] ? name : "Pybricks hub", addr);
+
+    // Connect at the short interval so discovery and the program start are quick
+    const ble_sched_conn_params_t *p = ble_sched_params(&train_sched, BLE_LINK_ACTIVE);
+    struct ble_gap_conn_params conn_params = {
+        .scan_itvl = 16,
+        .scan_window = 16,
+        .itvl_min = p->itvl_min,
+        .itvl_max = p->itvl_max,
+        .latency = p->latency,
+        .supervision_timeout = p->supervision_timeout,
+    };
+
+    ble_gap_disc_cancel();
+    int rc = ble_gap_connect(BLE_OWN_ADDR_PUBLIC, &disc->addr, 10000, &conn_params, train_ble_gap_event, NULL);
+    if (rc != 0) {
+        ESP_LOGE(BLE_TAG, "[hub %d] Failed to connect: %d", slot, rc);
+        xSemaphoreTake(train_hubs_mutex, portMAX_DELAY);
+        train_hub_connect_done(&train_hubs, false, TRAIN_HUB_CONN_NONE, esp_timer_get_time());
+        uint32_t delay = ble_sched_backoff_ms(&train_sched);
+        xSemaphoreGive(train_hubs_mutex);
+        train_ble_rescan_after(delay);
+    }
+}
+
+// Notification from a hub (stdout/stderr from the program)
+static void train_ble_on_notify(uint16_t conn_handle, struct os_mbuf *om) {
+    int slot = train_hub_by_conn(&train_hubs, conn_handle);
+    uint16_t len = OS_MBUF_PKTLEN(om);
+    if (slot < 0 || len == 0) {
+        return;
+    }
+    TRACE_INSTANT(trace_ble_notify, len);
+
+    uint8_t buf[256];
+    if (len > sizeof(buf) - 1) len = sizeof(buf) - 1;
+    os_mbuf_copydata(om, 0, len, buf);
+    buf[len] = '\0';
+
+    // First byte is the event type (Pybricks protocol)
+    // 0x00 = Status report, 0x01 = Stdout
+    uint8_t event_type = buf[0];
+    if (event_type == 0x00 && len > 1) {
+        // Status report - flags indicate hub state
+        // Bit 6 (0x40) = REPL running
+        uint8_t flags = buf[1];
+        ESP_LOGI(BLE_TAG, "[hub %d] Hub status: 0x%02x%s%s",
+            slot, flags,
+            (flags & 0x40) ? " [REPL]" : "",
+            (flags & 0x02) ? " [PROG]" : "");
+    } else if (event_type == 0x01 && len > 1) {
+        // Stdout data from program: text lines and telemetry frames, which
+        // can be split across notifications
+        train_hub_tlm_t *tlm = &train_tlm[slot];
+        for (uint16_t i = 1; i < len; i++) {
+            hub_rx_event_t ev = hub_rx_feed(&tlm->rx, buf[i]);
+            if (ev == HUB_RX_FRAME) {
+                hub_tlm_sample_t sample = { .rx_us = esp_timer_get_time(), .value = tlm->rx.frame };
+                hub_tlm_latest_write(&tlm->latest, &sample);
+                if (tlm->ring.slots != NULL) {
+                    hub_tlm_ring_push(&tlm->ring, &sample);
+                }
+            } else if (ev == HUB_RX_LINE && tlm->rx.line[0] != '\0') {
+                ESP_LOGI(BLE_TAG, "[hub %d] Hub>>> %s", slot, tlm->rx.line);
+                if (strstr(tlm->rx.line, "RDY") != NULL) {
+                    train_hubs.hubs[slot].program_ready = true;
+                    ESP_LOGI(BLE_TAG, "[hub %d] Program ready signal received!", slot);
                 }
             }
-            break;
         }
+    } else {
+        ESP_LOGI(BLE_TAG, "[hub %d] Hub event: type=0x%02x len=%d", slot, event_type, len);
+    }
+}
+
+// GAP event handler
+static int train_ble_gap_event(struct ble_gap_event *event, void *arg) {
+    switch (event->type) {
+        case BLE_GAP_EVENT_DISC:
+            train_ble_on_adv(&event->disc);
+            break;
+
+        case BLE_GAP_EVENT_CONNECT: {
+            bool ok = event->connect.status == 0;
+            struct ble_gap_conn_desc desc = {0};
+            if (ok) {
+                ble_gap_conn_find(event->connect.conn_handle, &desc);
+            }
+            int64_t now = esp_timer_get_time();
+            xSemaphoreTake(train_hubs_mutex, portMAX_DELAY);
+            int slot = train_hub_connect_done(&train_hubs, ok, event->connect.conn_handle, now);
+            if (ok && slot >= 0) {
+                ble_sched_connected(&train_sched, slot, desc.conn_itvl, desc.conn_latency, now);
+            }
+            uint32_t delay = ble_sched_backoff_ms(&train_sched);
+            xSemaphoreGive(train_hubs_mutex);
+
+            if (ok) {
+                ESP_LOGI(BLE_TAG, "[hub %d] Connected! (handle %d)", slot, event->connect.conn_handle);
+                if (slot < 0) {
+                    ble_gap_terminate(event->connect.conn_handle, BLE_ERR_REM_USER_CONN_TERM);
+                    break;
+                }
 
-        case BLE_GAP_EVENT_CONNECT:
-            if (event->connect.status == 0) {
-                ESP_LOGI(BLE_TAG, "Connected!");
-                train_conn_handle = event->connect.conn_handle;
-                train_chr_val_handle = 0;
+                hub_rx_resync(&train_tlm[slot].rx);
 
                 // Request larger MTU for longer messages (import statements can be 40+ bytes)
-                int rc = ble_gattc_exchange_mtu(train_conn_handle, NULL, NULL);
+                int rc = ble_gattc_exchange_mtu(event->connect.conn_handle, NULL, NULL);
                 if (rc != 0) {
-                    ESP_LOGW(BLE_TAG, "MTU exchange failed: %d", rc);
+                    ESP_LOGW(BLE_TAG, "[hub %d] MTU exchange failed: %d", slot, rc);
                 }
 
-                train_discover_characteristics(train_conn_handle);
+                train_discover_characteristics(slot, event->connect.conn_handle);
+                train_ble_scan_start();  // Look for the remaining hubs
             } else {
-                ESP_LOGE(BLE_TAG, "Connection failed: %d", event->connect.status);
-                train_state = TRAIN_BLE_DISCONNECTED;
-                train_ble_scan_start();
+                ESP_LOGE(BLE_TAG, "[hub %d] Connection failed: %d", slot, event->connect.status);
+                train_ble_rescan_after(delay);
             }
             break;
+        }
 
-        case BLE_GAP_EVENT_DISCONNECT:
-            ESP_LOGI(BLE_TAG, "Disconnected");
-            train_state = TRAIN_BLE_DISCONNECTED;
-            train_conn_handle = 0;
-            train_chr_val_handle = 0;
-            motor_initialized = false;
-            vTaskDelay(pdMS_TO_TICKS(2000));
-            train_ble_scan_start();
-            break;
-
-        case BLE_GAP_EVENT_DISC_COMPLETE:
-            if (train_state == TRAIN_BLE_SCANNING) {
-                train_state = TRAIN_BLE_DISCONNECTED;
-                vTaskDelay(pdMS_TO_TICKS(500));
-                train_ble_scan_start();
+        case BLE_GAP_EVENT_DISCONNECT: {
+            int64_t now = esp_timer_get_time();
+            xSemaphoreTake(train_hubs_mutex, portMAX_DELAY);
+            int slot = train_hub_disconnected(&train_hubs, event->disconnect.conn.conn_handle, now);
+            if (slot >= 0) {
+                ble_sched_disconnected(&train_sched, slot, now);
+                xQueueReset(train_hub_ctx[slot].queue);
             }
+            uint32_t delay = ble_sched_backoff_ms(&train_sched);
+            xSemaphoreGive(train_hubs_mutex);
+
+            ESP_LOGI(BLE_TAG, "[hub %d] Disconnected (reason %d), rescanning in %lu ms",
+                slot, event->disconnect.reason, (unsigned long)delay);
+            train_ble_rescan_after(delay);
             break;
+        }
 
-        case BLE_GAP_EVENT_MTU: {
-            ESP_LOGI(BLE_TAG, "MTU updated: %d", event->mtu.value);
+        case BLE_GAP_EVENT_DISC_COMPLETE: {
+            // A burst ended without finding a hub: back off before the next one
+            xSemaphoreTake(train_hubs_mutex, portMAX_DELAY);
+            train_hubs.scanning = false;
+            uint32_t delay = ble_sched_scan_done(&train_sched, false, esp_timer_get_time());
+            xSemaphoreGive(train_hubs_mutex);
+            train_ble_rescan_after(delay);
             break;
         }
 
-        case BLE_GAP_EVENT_NOTIFY_RX: {
-            // Handle notifications from hub (stdout/stderr from REPL)
-            struct os_mbuf *om = event->notify_rx.om;
-            uint16_t len = OS_MBUF_PKTLEN(om);
-            if (len > 0) {
-                uint8_t buf[256];
-                if (len > sizeof(buf) - 1) len = sizeof(buf) - 1;
-                os_mbuf_copydata(om, 0, len, buf);
-                buf[len] = '\0';
-
-                // First byte is the event type (Pybricks protocol)
-                // 0x00 = Status report, 0x01 = Stdout
-                uint8_t event_type = buf[0];
-                if (event_type == 0x00 && len > 1) {
-                    // Status report - flags indicate hub state
-                    // Bit 6 (0x40) = REPL running
-                    uint8_t flags = buf[1];
-                    ESP_LOGI(BLE_TAG, "Hub status: 0x%02x%s%s",
-                        flags,
-                        (flags & 0x40) ? " [REPL]" : "",
-                        (flags & 0x02) ? " [PROG]" : "");
-                } else if (event_type == 0x01 && len > 1) {
-                    // Stdout data from program
-                    ESP_LOGI(BLE_TAG, "Hub>>> %.*s", len - 1, &buf[1]);
-                    // Check for program ready signal or command acknowledgments
-                    if (strstr((char*)&buf[1], "RDY") != NULL) {
-                        program_ready_received = true;
-                        ESP_LOGI(BLE_TAG, "Program ready signal received!");
-                    }
-                } else {
-                    ESP_LOGI(BLE_TAG, "Hub event: type=0x%02x len=%d", event_type, len);
-                }
+        case BLE_GAP_EVENT_CONN_UPDATE: {
+            struct ble_gap_conn_desc desc;
+            if (event->conn_update.status != 0 ||
+                ble_gap_conn_find(event->conn_update.conn_handle, &desc) != 0) {
+                break;
+            }
+            xSemaphoreTake(train_hubs_mutex, portMAX_DELAY);
+            int slot = train_hub_by_conn(&train_hubs, event->conn_update.conn_handle);
+            if (slot >= 0) {
+                ble_sched_params_updated(&train_sched, slot, desc.conn_itvl, desc.conn_latency, esp_timer_get_time());
             }
+            xSemaphoreGive(train_hubs_mutex);
+            ESP_LOGI(BLE_TAG, "[hub %d] Connection interval %d.%02d ms, latency %d",
+                slot, desc.conn_itvl * 125 / 100, desc.conn_itvl * 125 % 100, desc.conn_latency);
             break;
         }
 
+        case BLE_GAP_EVENT_MTU:
+            ESP_LOGI(BLE_TAG, "MTU updated: %d (handle %d)", event->mtu.value, event->mtu.conn_handle);
+            break;
+
+        case BLE_GAP_EVENT_NOTIFY_RX:
+            train_ble_on_notify(event->notify_rx.conn_handle, event->notify_rx.om);
+            break;
+
         default:
             break;
     }
@@ -402,35 +718,44 @@ static int train_ble_gap_event(struct ble_gap_event *event, void *arg) {
     return 0;
 }
 
-// Start BLE scanning
+// Start a scan burst if a slot is free and no connection attempt is in flight
 static void train_ble_scan_start(void) {
-    if (train_state != TRAIN_BLE_DISCONNECTED) return;
-
-    train_state = TRAIN_BLE_SCANNING;
+    uint16_t itvl = 0, window = 0;
+    xSemaphoreTake(train_hubs_mutex, portMAX_DELAY);
+    int free_slots = train_hub_free_slots(&train_hubs);
+    bool start = !train_hubs.scanning && train_hubs.connecting < 0 && free_slots > 0;
+    if (start) {
+        train_hubs.scanning = true;
+        ble_sched_scan_started(&train_sched, &itvl, &window, esp_timer_get_time());
+    }
+    xSemaphoreGive(train_hubs_mutex);
+    if (!start) {
+        return;
+    }
 
     struct ble_gap_disc_params disc_params = {
-        .itvl = 160,
-        .window = 80,
+        .itvl = itvl,
+        .window = window,
         .filter_policy = 0,
         .limited = 0,
         .passive = 0,
         .filter_duplicates = 1,
     };
 
-    ESP_LOGI(BLE_TAG, "Scanning for Pybricks hub...");
-    int rc = ble_gap_disc(BLE_OWN_ADDR_PUBLIC, 10000, &disc_params,
+    ESP_LOGI(BLE_TAG, "Scanning for Pybricks hubs (%d of %d slots free, window %d/%d)...",
+        free_slots, train_hubs.count, window, itvl);
+    int rc = ble_gap_disc(BLE_OWN_ADDR_PUBLIC, train_sched.cfg.scan_duration_ms, &disc_params,
                           train_ble_gap_event, NULL);
-    if (rc != 0) {
-        train_state = TRAIN_BLE_DISCONNECTED;
+    if (rc != 0 && rc != BLE_HS_EALREADY) {
+        ESP_LOGW(BLE_TAG, "Scan start failed: %d", rc);
+        xSemaphoreTake(train_hubs_mutex, portMAX_DELAY);
+        train_hubs.scanning = false;
+        uint32_t delay = ble_sched_scan_done(&train_sched, false, esp_timer_get_time());
+        xSemaphoreGive(train_hubs_mutex);
+        train_ble_rescan_after(delay);
     }
 }
 
-// Public API: Send command to train
-static int train_send_command(const char *cmd) {
-    ESP_LOGI(BLE_TAG, "train_send_command: %s (state=%s)", cmd, train_state_str());
-    return train_write_command(cmd);
-}
-
 // NimBLE host task
 static void train_ble_host_task(void *param) {
     nimble_port_run();
@@ -440,7 +765,6 @@ static void train_ble_host_task(void *param) {
 // Called when BLE stack is synced
 static void train_ble_on_sync(void) {
     ESP_LOGI(BLE_TAG, "BLE ready, starting scan...");
-    train_state = TRAIN_BLE_DISCONNECTED;
     train_ble_scan_start();
 }
 
@@ -448,6 +772,52 @@ static void train_ble_on_sync(void) {
 static void train_ble_init(void) {
     ESP_LOGI(BLE_TAG, "Initializing train BLE...");
 
+    train_hubs_mutex = xSemaphoreCreateMutex();
+    int count = train_hub_table_init(&train_hubs, CONFIG_TRAIN_BLE_HUBS, CONFIG_TRAIN_BLE_MAX_HUBS, esp_timer_get_time());
+    ble_sched_config_t sched_cfg = ble_sched_default_config();
+    ble_sched_init(&train_sched, &sched_cfg, count, esp_timer_get_time());
+    for (int i = 0; i < count; i++) {
+        char task_name[16];
+        snprintf(task_name, sizeof(task_name), "train_hub%d", i);
+        train_hub_ctx[i].queue = xQueueCreate(1, sizeof(train_hub_cmd_t));
+
+        // History lives in PSRAM when there is some
+        size_t ring_bytes = TRAIN_TLM_RING_LEN * sizeof(hub_tlm_sample_t);
+        hub_tlm_sample_t *ring = heap_caps_malloc(ring_bytes, MALLOC_CAP_SPIRAM);
+        if (ring == NULL) {
+            ring = heap_caps_malloc(ring_bytes, MALLOC_CAP_8BIT);
+        }
+        if (ring != NULL) {
+            hub_tlm_ring_init(&train_tlm[i].ring, ring, TRAIN_TLM_RING_LEN);
+        } else {
+            ESP_LOGW(BLE_TAG, "  hub %d: no memory for telemetry history", i);
+        }
+        train_tlm[i].rate_hz = CONFIG_TRAIN_TELEMETRY_RATE_HZ;
+
+        xTaskCreate(train_hub_task, task_name, 4096, (void *)(intptr_t)i, 5, &train_hub_ctx[i].task);
+
+        if (train_hubs.filter_count > 0) {
+            char addr[18];
+            train_hub_format_addr(train_hubs.filters[i].addr, addr, sizeof(addr));
+            ESP_LOGI(BLE_TAG, "  hub %d: %s", i, train_hubs.filters[i].by_addr ? addr : train_hubs.filters[i].name);
+        }
+    }
+    ESP_LOGI(BLE_TAG, "%d hub slot(s)%s", count, train_hubs.filter_count > 0 ? "" : ", any Pybricks hub");
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = train_ble_rescan_cb,
+        .name = "ble_rescan",
+    };
+    esp_timer_create(&timer_args, &train_rescan_timer);
+
+    const esp_timer_create_args_t sched_args = {
+        .callback = train_sched_tick_cb,
+        .name = "ble_sched",
+    };
+    if (esp_timer_create(&sched_args, &train_sched_timer) == ESP_OK) {
+        esp_timer_start_periodic(train_sched_timer, TRAIN_BLE_SCHED_TICK_MS * 1000);
+    }
+
     int rc = nimble_port_init();
     if (rc != ESP_OK) {
         ESP_LOGE(BLE_TAG, "Failed to init NimBLE: %d", rc);
@@ -0,0 +1,329 @@
+#pragma once
+
+// Connection table for several Pybricks hubs.
+//
+// Pure bookkeeping with no NimBLE or ESP-IDF dependencies: the BLE glue in
+// train_ble.h feeds it advertisements and GAP/GATT outcomes plus a monotonic
+// clock (microseconds), and it decides which slot an advertiser goes into and
+// tracks each hub's connection state on its own.
+//
+// Slots are the hub ids used by /train?id=N. With a hub list configured
+// ("City Hub,90:84:2b:01:02:03") entry N is pinned to slot N and only those
+// hubs are connected; with an empty list any Pybricks hub takes the first
+// free slot. Only one connection attempt is in flight at a time, which is
+// what the controller allows while scanning.
+//
+// Addresses are stored in NimBLE's ble_addr_t.val order (least significant
+// byte first) and printed most significant byte first.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#ifndef TRAIN_HUB_MAX
+#define TRAIN_HUB_MAX 4
+#endif
+
+#define TRAIN_HUB_NAME_LEN 24
+#define TRAIN_HUB_CONN_NONE 0xFFFF
+
+// Connection state of one hub
+typedef enum {
+    TRAIN_BLE_DISCONNECTED = 0,
+    TRAIN_BLE_SCANNING,
+    TRAIN_BLE_CONNECTING,
+    TRAIN_BLE_DISCOVERING,
+    TRAIN_BLE_INITIALIZING,
+    TRAIN_BLE_READY
+} train_ble_state_t;
+
+typedef struct {
+    char name[TRAIN_HUB_NAME_LEN];  // Exact advertised name, "" if matching by address
+    uint8_t addr[6];
+    bool by_addr;
+} train_hub_filter_t;
+
+typedef struct {
+    train_ble_state_t state;
+    uint16_t conn_handle;
+    uint16_t chr_val_handle;
+    uint8_t addr[6];
+    bool have_addr;
+    char name[TRAIN_HUB_NAME_LEN];
+    bool program_ready;         // Hub program printed "RDY"
+    uint32_t generation;        // Bumped on every connect and disconnect, so stale init work can tell
+    int64_t state_since_us;
+
+    // Command path
+    char last_cmd;
+    uint32_t commands;
+    uint32_t errors;
+    uint32_t last_latency_us;   // Queued -> write acknowledged
+    uint32_t max_latency_us;
+} train_hub_t;
+
+typedef struct {
+    train_hub_t hubs[TRAIN_HUB_MAX];
+    train_hub_filter_t filters[TRAIN_HUB_MAX];
+    int count;                  // Slots in use: the filter count, or TRAIN_HUB_MAX
+    int filter_count;
+    int connecting;             // Slot with a connection attempt in flight, -1 if none
+    bool scanning;
+} train_hub_table_t;
+
+static const char* train_hub_state_str(train_ble_state_t state) {
+    switch (state) {
+        case TRAIN_BLE_DISCONNECTED: return "disconnected";
+        case TRAIN_BLE_SCANNING: return "scanning";
+        case TRAIN_BLE_CONNECTING: return "connecting";
+        case TRAIN_BLE_DISCOVERING: return "discovering";
+        case TRAIN_BLE_INITIALIZING: return "initializing";
+        case TRAIN_BLE_READY: return "ready";
+        default: return "unknown";
+    }
+}
+
+// "90:84:2b:01:02:03" -> ble_addr_t.val order
+static bool train_hub_parse_addr(const char *str, uint8_t out[6]) {
+    unsigned int b[6];
+    char tail;
+    if (sscanf(str, "%2x:%2x:%2x:%2x:%2x:%2x%c", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5], &tail) != 6) {
+        return false;
+    }
+    for (int i = 0; i < 6; i++) {
+        out[i] = (uint8_t)b[5 - i];
+    }
+    return true;
+}
+
+static void train_hub_format_addr(const uint8_t addr[6], char *out, size_t len) {
+    snprintf(out, len, "%02x:%02x:%02x:%02x:%02x:%02x",
+        addr[5], addr[4], addr[3], addr[2], addr[1], addr[0]);
+}
+
+// Advertised names the firmware accepts when no hub list is configured
+static bool train_hub_name_is_pybricks(const char *name) {
+    return strstr(name, "Pybricks") != NULL ||
+           strstr(name, "train") != NULL ||
+           strstr(name, "City") != NULL;
+}
+
+static void train_hub_reset(train_hub_t *hub, int64_t now_us) {
+    hub->state = TRAIN_BLE_DISCONNECTED;
+    hub->conn_handle = TRAIN_HUB_CONN_NONE;
+    hub->chr_val_handle = 0;
+    hub->program_ready = false;
+    hub->state_since_us = now_us;
+}
+
+// Set up `max_hubs` slots, or one per entry of the comma-separated hub list
+// `spec` (names or addresses). Returns the number of slots.
+static int train_hub_table_init(train_hub_table_t *t, const char *spec, int max_hubs, int64_t now_us) {
+    *t = (train_hub_table_t){0};
+    t->connecting = -1;
+    if (max_hubs > TRAIN_HUB_MAX) {
+        max_hubs = TRAIN_HUB_MAX;
+    }
+
+    while (spec && *spec && t->filter_count < max_hubs) {
+        const char *end = strchr(spec, ',');
+        size_t len = end ? (size_t)(end - spec) : strlen(spec);
+        while (len > 0 && isspace((unsigned char)*spec)) {
+            spec++;
+            len--;
+        }
+        while (len > 0 && isspace((unsigned char)spec[len - 1])) {
+            len--;
+        }
+        if (len > 0) {
+            train_hub_filter_t *f = &t->filters[t->filter_count++];
+            if (len >= TRAIN_HUB_NAME_LEN) {
+                len = TRAIN_HUB_NAME_LEN - 1;
+            }
+            memcpy(f->name, spec, len);
+            f->name[len] = '\0';
+            f->by_addr = train_hub_parse_addr(f->name, f->addr);
+            if (f->by_addr) {
+                f->name[0] = '\0';
+            }
+        }
+        spec = end ? end + 1 : NULL;
+    }
+
+    t->count = t->filter_count > 0 ? t->filter_count : max_hubs;
+    for (int i = 0; i < t->count; i++) {
+        train_hub_reset(&t->hubs[i], now_us);
+        if (t->filter_count > 0) {
+            train_hub_filter_t *f = &t->filters[i];
+            snprintf(t->hubs[i].name, sizeof(t->hubs[i].name), "%s", f->name);
+            if (f->by_addr) {
+                memcpy(t->hubs[i].addr, f->addr, 6);
+                t->hubs[i].have_addr = true;
+            }
+        }
+    }
+    return t->count;
+}
+
+static bool train_hub_is_free(const train_hub_t *hub) {
+    return hub->state == TRAIN_BLE_DISCONNECTED || hub->state == TRAIN_BLE_SCANNING;
+}
+
+static int train_hub_free_slots(const train_hub_table_t *t) {
+    int n = 0;
+    for (int i = 0; i < t->count; i++) {
+        if (train_hub_is_free(&t->hubs[i])) {
+            n++;
+        }
+    }
+    return n;
+}
+
+// Decide whether an advertiser should be connected, and into which slot.
+// `name` may be NULL when the report carried none; `has_service` is true
+// when it advertised the Pybricks service UUID. Returns the slot or -1.
+static int train_hub_match(const train_hub_table_t *t, const char *name,
+                           const uint8_t addr[6], bool has_service) {
+    if (t->connecting >= 0) {
+        return -1;
+    }
+
+    // Already connected (or connecting) to this hub
+    for (int i = 0; i < t->count; i++) {
+        const train_hub_t *hub = &t->hubs[i];
+        if (!train_hub_is_free(hub) && hub->have_addr && memcmp(hub->addr, addr, 6) == 0) {
+            return -1;
+        }
+    }
+
+    if (t->filter_count > 0) {
+        for (int i = 0; i < t->filter_count; i++) {
+            const train_hub_filter_t *f = &t->filters[i];
+            if (!train_hub_is_free(&t->hubs[i])) {
+                continue;
+            }
+            if (f->by_addr ? memcmp(f->addr, addr, 6) == 0
+                           : (name != NULL && strcmp(f->name, name) == 0)) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    if (!has_service && (name == NULL || !train_hub_name_is_pybricks(name))) {
+        return -1;
+    }
+    for (int i = 0; i < t->count; i++) {
+        if (train_hub_is_free(&t->hubs[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void train_hub_set_state(train_hub_table_t *t, int slot, train_ble_state_t state, int64_t now_us) {
+    t->hubs[slot].state = state;
+    t->hubs[slot].state_since_us = now_us;
+}
+
+static void train_hub_connect_started(train_hub_table_t *t, int slot, const char *name,
+                                      const uint8_t addr[6], int64_t now_us) {
+    train_hub_t *hub = &t->hubs[slot];
+    memcpy(hub->addr, addr, 6);
+    hub->have_addr = true;
+    if (name && name[0]) {
+        snprintf(hub->name, sizeof(hub->name), "%s", name);
+    }
+    t->connecting = slot;
+    train_hub_set_state(t, slot, TRAIN_BLE_CONNECTING, now_us);
+}
+
+// Outcome of the in-flight attempt. Returns its slot, or -1 if none.
+static int train_hub_connect_done(train_hub_table_t *t, bool ok, uint16_t conn_handle, int64_t now_us) {
+    int slot = t->connecting;
+    t->connecting = -1;
+    if (slot < 0) {
+        return -1;
+    }
+    train_hub_t *hub = &t->hubs[slot];
+    if (ok) {
+        hub->conn_handle = conn_handle;
+        hub->chr_val_handle = 0;
+        hub->program_ready = false;
+        hub->generation++;
+        train_hub_set_state(t, slot, TRAIN_BLE_DISCOVERING, now_us);
+    } else {
+        train_hub_reset(hub, now_us);
+    }
+    return slot;
+}
+
+static int train_hub_by_conn(const train_hub_table_t *t, uint16_t conn_handle) {
+    for (int i = 0; i < t->count; i++) {
+        if (!train_hub_is_free(&t->hubs[i]) && t->hubs[i].conn_handle == conn_handle) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Link lost. Returns the slot that held the connection, or -1.
+static int train_hub_disconnected(train_hub_table_t *t, uint16_t conn_handle, int64_t now_us) {
+    int slot = train_hub_by_conn(t, conn_handle);
+    if (slot >= 0) {
+        train_hub_reset(&t->hubs[slot], now_us);
+        t->hubs[slot].generation++;
+        if (t->filter_count == 0) {
+            t->hubs[slot].have_addr = false;
+        }
+    }
+    return slot;
+}
+
+// Whether init work begun on connection `generation` still has its link
+static bool train_hub_init_current(const train_hub_table_t *t, int slot, uint32_t generation) {
+    const train_hub_t *hub = &t->hubs[slot];
+    return hub->generation == generation && hub->state == TRAIN_BLE_INITIALIZING;
+}
+
+// Program start finished on connection `generation`. Returns false if the
+// hub dropped (or reconnected) while the init sequence was running.
+static bool train_hub_init_done(train_hub_table_t *t, int slot, uint32_t generation, int64_t now_us) {
+    if (!train_hub_init_current(t, slot, generation)) {
+        return false;
+    }
+    train_hub_set_state(t, slot, TRAIN_BLE_READY, now_us);
+    return true;
+}
+
+// State shown for a slot: free slots read "scanning" while the scanner runs
+static train_ble_state_t train_hub_display_state(const train_hub_table_t *t, int slot) {
+    train_ble_state_t state = t->hubs[slot].state;
+    if (state == TRAIN_BLE_DISCONNECTED && t->scanning) {
+        return TRAIN_BLE_SCANNING;
+    }
+    return state;
+}
+
+// Most advanced state across all slots (the single-hub view)
+static train_ble_state_t train_hub_summary_state(const train_hub_table_t *t) {
+    train_ble_state_t best = t->scanning ? TRAIN_BLE_SCANNING : TRAIN_BLE_DISCONNECTED;
+    for (int i = 0; i < t->count; i++) {
+        if (t->hubs[i].state > best) {
+            best = t->hubs[i].state;
+        }
+    }
+    return best;
+}
+
+static int train_hub_ready_count(const train_hub_table_t *t) {
+    int n = 0;
+    for (int i = 0; i < t->count; i++) {
+        if (t->hubs[i].state == TRAIN_BLE_READY) {
+            n++;
+        }
+    }
+    return n;
+}
@@ -1,31 +1,171 @@
 #pragma once
 
+// UDP streaming to subscribed receivers.
+//
+// Receivers subscribe over the API server (see the /rtp handlers in
+// http_server.h) instead of a compiled-in address. Each target gets either
+// the original chunked JPEG protocol (jpeg_chunk_header_t, understood by the
+// desktop scripts) or RTP/JPEG (RFC 2435, rtp_jpeg.h) for standard players.
+// A single task captures each frame once and sends it to every playing target.
+//
+// A target may be a multicast group: the frame then goes out once no matter
+// how many receivers have joined, and the group is announced over mDNS.
+//
+// With CONFIG_TRAIN_DEDUP, a frame that matches the last one a target was
+// sent is replaced by a keep-alive (chunked: a lone header with
+// total_packets = 0) or skipped (RTP); see frame_dedup.h.
+//
+// The chunk size is udp_chunk in the runtime config (runtime_config.h),
+// read once per frame, so every packet of a frame has the same size, and
+// the header carries it. A receiver can find the largest datagram that
+// reaches it whole with /rtp/probe (udp_probe()) and set it for its
+// target, which then overrides udp_chunk.
+//
+// With CONFIG_TRAIN_UDP_CRYPT a target can ask for the chunked protocol
+// sealed with AES-GCM under the pre-shared key (proto=gcm, chunk_crypt.h).
+// mbedTLS runs the cipher on the AES accelerator. Each slice is sealed
+// straight from the frame buffer into the payload of the send iovec, so
+// the frame itself is never copied. The default target and the multicast
+// group then get the sealed stream too.
+//
+// In H.264 mode (h264_stream.h), targets set up with proto=h264 get each
+// encoded access unit as RTP (RFC 6184, rtp_h264.h) from udp_send_h264(),
+// called by the encoder task. This task only serves the JPEG protocols.
+
 #include <esp_wifi.h>
 #include <esp_netif.h>
+#include <esp_log.h>
+#include <esp_random.h>
+#include <esp_timer.h>
+#include <esp_camera.h>
+#include <esp_attr.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
 
 #include <lwip/err.h>
 #include <lwip/sockets.h>
 #include <lwip/sys.h>
 #include <lwip/netdb.h>
 
-#define SERVER_ADDR "192.168.1.248"
-#define SERVER_PORT 5005 // 12345
-#define CHUNK_SIZE 1400
+#include "rtp_jpeg.h"
+#include "rtp_h264.h"
+#include "frame_dedup.h"
+#include "runtime_config.h"
+#include "trace.h"
+#include "chunk_crypt.h"
+
+#if CONFIG_TRAIN_UDP_CRYPT
+#include <mbedtls/gcm.h>
+#endif
+
+#define UDP_MAX_TARGETS 4
+
+static const char *UDP_TAG = "UDP";
 
 typedef uint16_t frame_id_t; // TODO: u8 & wrap i.e. let overflow
 
 typedef struct __attribute__((packed)) {
     frame_id_t frame_id;     // Frame ID: same for ALL chunks
     uint16_t packet_id;      // Current chunk index
-    uint16_t total_packets;  // Total number of chunks
+    uint16_t total_packets;  // Total number of chunks, 0 = keep-alive (frame unchanged) or probe
+    uint16_t chunk_size;     // JPEG bytes in every chunk of the frame but the last; probe: datagram size
 } jpeg_chunk_header_t;
 
+#define UDP_DATAGRAM_MAX 1472   // Largest UDP payload in one 1500-byte Ethernet frame
+#define UDP_DATAGRAM_MIN 508    // Fits the 576-byte IPv4 minimum, never fragmented
+#define UDP_PROBE_ID 0xFFFF     // packet_id of a path probe
+#define UDP_PROBE_ROUNDS 2      // Times the probe ladder is sent
+
+typedef enum {
+    UDP_PROTO_CHUNK = 0,
+    UDP_PROTO_RTP,
+    UDP_PROTO_GCM,          // Chunked, sealed with AES-GCM
+    UDP_PROTO_H264,         // RTP/H.264, in H.264 mode
+    UDP_PROTO_COUNT,
+} udp_proto_t;
+
+#if CONFIG_TRAIN_UDP_CRYPT
+#define UDP_DEFAULT_PROTO UDP_PROTO_GCM
+#else
+#define UDP_DEFAULT_PROTO UDP_PROTO_CHUNK
+#endif
+
+typedef struct {
+    bool in_use;
+    bool playing;
+    uint32_t session;
+    udp_proto_t proto;
+    struct sockaddr_in addr;
+    rtp_jpeg_stream_t rtp;
+    uint16_t datagram;      // Largest datagram the receiver set after probing, 0: udp_chunk
+    uint32_t frames;
+    uint32_t packets;
+    uint32_t errors;
+#if CONFIG_TRAIN_DEDUP
+    jpeg_dedup_t seen;      // Last frame sent
+#endif
+} udp_target_t;
+
+// Bytes on the wire per protocol, to compare header overhead
+typedef struct {
+    uint32_t frames;
+    uint64_t jpeg_bytes;     // Size of the camera's JPEGs (h264: of the access units)
+    uint64_t wire_bytes;     // UDP payload actually sent
+    uint64_t seal_us;        // Time spent encrypting (gcm)
+} udp_proto_stats_t;
+
 static int udp_sock = -1;
-static struct sockaddr_in server_addr;
+static udp_target_t udp_targets[UDP_MAX_TARGETS];
+static udp_proto_stats_t udp_proto_stats[UDP_PROTO_COUNT];
+static SemaphoreHandle_t udp_targets_mutex = NULL;
+static TaskHandle_t udp_task_handle = NULL;
+static TaskHandle_t udp_h264_task_handle = NULL;    // Woken when an h264 target starts (h264_stream.h)
+static uint32_t udp_next_session = 1;
+static int udp_multicast_ttl = CONFIG_TRAIN_UDP_MULTICAST_TTL;
+static uint8_t udp_probe_buf[UDP_DATAGRAM_MAX];
+#if CONFIG_TRAIN_DEDUP
+static EXT_RAM_BSS_ATTR jpeg_sig_t udp_sig;
+static jpeg_sig_decoder_t udp_sig_dec;
+#endif
+#if CONFIG_TRAIN_UDP_CRYPT
+static mbedtls_gcm_context udp_gcm;
+static bool udp_gcm_ready = false;      // The key parsed
+static uint8_t udp_crypt_salt[CHUNK_CRYPT_SALT_LEN];
+static uint16_t udp_crypt_epoch = 0;
+// Ciphertext and tag of one packet, in internal RAM for the AES DMA
+static uint8_t udp_sealed[CHUNK_CRYPT_MAX_PAYLOAD + CHUNK_CRYPT_TAG_LEN];
+#endif
+
+static const char *udp_proto_str(udp_proto_t proto) {
+    return proto == UDP_PROTO_RTP ? "rtp" : proto == UDP_PROTO_GCM ? "gcm" : proto == UDP_PROTO_H264 ? "h264" : "chunk";
+}
+
+// Whether targets can ask for proto=gcm
+static bool udp_crypt_available(void) {
+#if CONFIG_TRAIN_UDP_CRYPT
+    return udp_gcm_ready;
+#else
+    return false;
+#endif
+}
+
+static bool udp_is_multicast(const struct sockaddr_in *addr) {
+    return (ntohl(addr->sin_addr.s_addr) & 0xF0000000) == 0xE0000000;  // 224.0.0.0/4
+}
+
+static void udp_set_multicast_ttl(int ttl) {
+    uint8_t value = ttl;
+    if (setsockopt(udp_sock, IPPROTO_IP, IP_MULTICAST_TTL, &value, sizeof(value)) == 0) {
+        udp_multicast_ttl = ttl;
+    } else {
+        ESP_LOGW(UDP_TAG, "Failed to set multicast TTL %d: %s", ttl, strerror(errno));
+    }
+}
 
 static void udp_init() {
     while ((udp_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP)) < 0) {
-        ESP_LOGE("UDP", "Failed to create socket: %s", strerror(errno));
+        ESP_LOGE(UDP_TAG, "Failed to create socket: %s", strerror(errno));
         vTaskDelay(pdMS_TO_TICKS(1000));
     }
 
@@ -34,63 +174,673 @@ static void udp_init() {
         setsockopt(udp_sock, SOL_SOCKET, SO_BROADCAST, &enable_broadcast, sizeof(enable_broadcast));
     }
 
+    {
+        // Don't loop our own multicast back into lwIP
+        uint8_t loop = 0;
+        setsockopt(udp_sock, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+        udp_set_multicast_ttl(udp_multicast_ttl);
+    }
+
+#if CONFIG_TRAIN_UDP_CRYPT
+    {
+        uint8_t key[CHUNK_CRYPT_KEY_MAX];
+        size_t key_len = chunk_crypt_parse_key(CONFIG_TRAIN_UDP_KEY, key);
+        mbedtls_gcm_init(&udp_gcm);
+        if (key_len && mbedtls_gcm_setkey(&udp_gcm, MBEDTLS_CIPHER_ID_AES, key, key_len * 8) == 0) {
+            esp_fill_random(udp_crypt_salt, sizeof(udp_crypt_salt));
+            udp_gcm_ready = true;
+            ESP_LOGI(UDP_TAG, "AES-%d-GCM ready", (int)key_len * 8);
+        } else {
+            ESP_LOGE(UDP_TAG, "CONFIG_TRAIN_UDP_KEY must be 32 or 64 hex digits, encryption off");
+        }
+        memset(key, 0, sizeof(key));
+    }
+#endif
+
     // fcntl(udp_broadcast_sock, F_SETFL, O_NONBLOCK); // Non-blocking socket
 
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(SERVER_PORT);
-    server_addr.sin_addr.s_addr = inet_addr(SERVER_ADDR);  // AP mode broadcast address
-    printf("UDP broadcast socket initialized on port %d\n", SERVER_PORT);
+    printf("UDP socket initialized\n");
 }
 
-static int send_chunked_jpeg(camera_fb_t const *const fb) {
-    static jpeg_chunk_header_t header = { .frame_id = 0 };
+static int udp_send_iov(const struct sockaddr_in *dest, struct iovec *iov, int iovcnt) {
+    struct msghdr const msg = {
+        .msg_name = (void *)dest,
+        .msg_namelen = sizeof(*dest),
+        .msg_iov = iov,
+        .msg_iovlen = iovcnt,
+        .msg_control = NULL,
+        .msg_controllen = 0,
+        .msg_flags = 0
+    };
+    // lwIP copies the datagram into a heap pbuf; the audit counts that apart
+    TRACE_BEGIN(trace_udp_send, 0);
+    uint32_t mark = alloc_audit_lib_begin();
+    int n = sendmsg(udp_sock, &msg, 0);
+    alloc_audit_lib_end(mark);
+    TRACE_END(trace_udp_send, n > 0 ? n : 0);
+    return n;
+}
+
+// Returns the number of packets sent (adding their size to *wire), or -1 if
+// the stack ran out of buffers
+static int send_chunked_jpeg(camera_fb_t const *const fb, frame_id_t frame_id, size_t chunk_max,
+                             const struct sockaddr_in *dest, size_t *wire) {
+    jpeg_chunk_header_t header = { .frame_id = frame_id, .chunk_size = chunk_max };
 
-    header.total_packets = (fb->len + CHUNK_SIZE - 1) / CHUNK_SIZE;
-    ESP_LOGD("UDP", "Sending frame ID #%i (a %i-byte JPEG) in %i %i-byte chunks", header.frame_id + 1, fb->len, header.total_packets, CHUNK_SIZE);
+    header.total_packets = (fb->len + chunk_max - 1) / chunk_max;
+    ESP_LOGD(UDP_TAG, "Sending frame ID #%i (a %i-byte JPEG) in %i %i-byte chunks", header.frame_id + 1, fb->len, header.total_packets, (int)chunk_max);
     if (header.total_packets == 0) {
         return 0;
     }
 
-    int err_code = 0;
     size_t offset = 0;
     header.packet_id = 0;
     do {
-        ESP_LOGD("UDP", "Sending chunk #%i/%i", header.packet_id + 1, header.total_packets);
+        ESP_LOGD(UDP_TAG, "Sending chunk #%i/%i", header.packet_id + 1, header.total_packets);
 
         size_t chunk_size = fb->len - offset;
-        if (chunk_size > CHUNK_SIZE) { chunk_size = CHUNK_SIZE; }
+        if (chunk_size > chunk_max) { chunk_size = chunk_max; }
 
         struct iovec iov[2] = {
             { .iov_base = &header, .iov_len = sizeof(header) },
             { .iov_base = (void *)(fb->buf + offset), .iov_len = chunk_size }
         };
 
-        struct msghdr const msg = {
-            .msg_name = &server_addr,
-            .msg_namelen = sizeof(server_addr),
-            .msg_iov = iov,
-            .msg_iovlen = 2,
-            .msg_control = NULL,
-            .msg_controllen = 0,
-            .msg_flags = 0
+        if (udp_send_iov(dest, iov, 2) < 0) {
+            if (errno == ENOMEM) {
+                return -1;
+            }
+            // Otherwise, UDP is inherently lossy, so
+            // don't return an error (which would decrease the frame rate):
+            ESP_LOGW(UDP_TAG, "sendmsg failed on chunk %u/%u with errno %i: %s", header.packet_id + 1, header.total_packets, errno, strerror(errno));
+            break; // Drop the rest of this frame
+        }
+
+        *wire += sizeof(header) + chunk_size;
+        offset += chunk_max;
+    } while (++(header.packet_id) < header.total_packets);
+
+    return header.packet_id;
+}
+
+#if CONFIG_TRAIN_DEDUP
+// Stands in for a frame the receiver already has: one header with
+// total_packets = 0, so the frame id still advances. Returns like
+// send_chunked_jpeg().
+static int send_chunked_keepalive(frame_id_t frame_id, const struct sockaddr_in *dest, size_t *wire) {
+    jpeg_chunk_header_t header = { .frame_id = frame_id };
+    struct iovec iov = { .iov_base = &header, .iov_len = sizeof(header) };
+    if (udp_send_iov(dest, &iov, 1) < 0) {
+        return errno == ENOMEM ? -1 : 0;
+    }
+    *wire += sizeof(header);
+    return 1;
+}
+#endif
+
+#if CONFIG_TRAIN_UDP_CRYPT
+// send_chunked_jpeg() with every slice sealed (chunk_crypt.h). Returns like
+// it, adding the time spent in the cipher to *seal_us.
+static int send_sealed_jpeg(camera_fb_t const *const fb, frame_id_t frame_id, size_t chunk_max,
+                            const struct sockaddr_in *dest, size_t *wire, int64_t *seal_us) {
+    if (chunk_max > CHUNK_CRYPT_MAX_PAYLOAD) { chunk_max = CHUNK_CRYPT_MAX_PAYLOAD; }
+    chunk_crypt_header_t header = { .frame_id = frame_id, .chunk_size = chunk_max, .epoch = udp_crypt_epoch };
+    memcpy(header.salt, udp_crypt_salt, sizeof(header.salt));
+
+    header.total_packets = (fb->len + chunk_max - 1) / chunk_max;
+    if (header.total_packets == 0) {
+        return 0;
+    }
+
+    uint8_t nonce[CHUNK_CRYPT_NONCE_LEN];
+    size_t offset = 0;
+    header.packet_id = 0;
+    do {
+        size_t chunk_size = fb->len - offset;
+        if (chunk_size > chunk_max) { chunk_size = chunk_max; }
+
+        chunk_crypt_nonce(&header, nonce);
+        int64_t start = esp_timer_get_time();
+        TRACE_BEGIN(trace_udp_seal, chunk_size);
+        int err = mbedtls_gcm_crypt_and_tag(&udp_gcm, MBEDTLS_GCM_ENCRYPT, chunk_size, nonce, sizeof(nonce),
+            (const uint8_t *)&header, sizeof(header), fb->buf + offset, udp_sealed,
+            CHUNK_CRYPT_TAG_LEN, udp_sealed + chunk_size);
+        TRACE_END(trace_udp_seal, chunk_size);
+        *seal_us += esp_timer_get_time() - start;
+        if (err != 0) {
+            ESP_LOGW(UDP_TAG, "GCM failed on chunk %u/%u: -0x%04x", header.packet_id + 1, header.total_packets, -err);
+            break;
+        }
+
+        struct iovec iov[2] = {
+            { .iov_base = &header, .iov_len = sizeof(header) },
+            { .iov_base = udp_sealed, .iov_len = chunk_size + CHUNK_CRYPT_TAG_LEN }
+        };
+        if (udp_send_iov(dest, iov, 2) < 0) {
+            if (errno == ENOMEM) {
+                return -1;
+            }
+            ESP_LOGW(UDP_TAG, "sendmsg failed on sealed chunk %u/%u with errno %i: %s", header.packet_id + 1, header.total_packets, errno, strerror(errno));
+            break;
+        }
+
+        *wire += sizeof(header) + chunk_size + CHUNK_CRYPT_TAG_LEN;
+        offset += chunk_max;
+    } while (++(header.packet_id) < header.total_packets);
+
+    return header.packet_id;
+}
+
+#if CONFIG_TRAIN_DEDUP
+// send_chunked_keepalive() for gcm: the header and a tag over it
+static int send_sealed_keepalive(frame_id_t frame_id, const struct sockaddr_in *dest, size_t *wire) {
+    chunk_crypt_header_t header = { .frame_id = frame_id, .epoch = udp_crypt_epoch };
+    memcpy(header.salt, udp_crypt_salt, sizeof(header.salt));
+    uint8_t nonce[CHUNK_CRYPT_NONCE_LEN], tag[CHUNK_CRYPT_TAG_LEN];
+    chunk_crypt_nonce(&header, nonce);
+    if (mbedtls_gcm_crypt_and_tag(&udp_gcm, MBEDTLS_GCM_ENCRYPT, 0, nonce, sizeof(nonce),
+            (const uint8_t *)&header, sizeof(header), NULL, NULL, sizeof(tag), tag) != 0) {
+        return 0;
+    }
+    struct iovec iov[2] = {
+        { .iov_base = &header, .iov_len = sizeof(header) },
+        { .iov_base = tag, .iov_len = sizeof(tag) }
+    };
+    if (udp_send_iov(dest, iov, 2) < 0) {
+        return errno == ENOMEM ? -1 : 0;
+    }
+    *wire += sizeof(header) + sizeof(tag);
+    return 1;
+}
+#endif
+
+#else
+
+// Never called: udp_setup() refuses gcm targets without the option
+static int send_sealed_jpeg(camera_fb_t const *const fb, frame_id_t frame_id, size_t chunk_max,
+                            const struct sockaddr_in *dest, size_t *wire, int64_t *seal_us) {
+    return 0;
+}
+
+#if CONFIG_TRAIN_DEDUP
+static int send_sealed_keepalive(frame_id_t frame_id, const struct sockaddr_in *dest, size_t *wire) {
+    return 0;
+}
+#endif
+
+#endif
+
+static int send_rtp_jpeg(const rtp_jpeg_frame_t *frame, rtp_jpeg_stream_t *st, uint32_t timestamp,
+                         size_t packet_max, const struct sockaddr_in *dest, size_t *wire) {
+    uint8_t hdr[RTP_JPEG_MAX_HEADERS];
+    int packets = 0;
+    size_t offset = 0;
+    do {
+        size_t data_len;
+        size_t hlen = rtp_jpeg_packet(st, frame, timestamp, offset, packet_max, hdr, &data_len);
+
+        struct iovec iov[2] = {
+            { .iov_base = hdr, .iov_len = hlen },
+            { .iov_base = (void *)(frame->scan + offset), .iov_len = data_len }
         };
 
-        if (sendmsg(udp_sock, &msg, 0) < 0) {
-            if (errno == 12) {
-                err_code = -1;
+        if (udp_send_iov(dest, iov, 2) < 0) {
+            if (errno == ENOMEM) {
+                return -1;
+            }
+            ESP_LOGW(UDP_TAG, "RTP sendmsg failed at offset %u with errno %i: %s", (unsigned)offset, errno, strerror(errno));
+            break;
+        }
+        packets++;
+        *wire += hlen + data_len;
+        offset += data_len;
+    } while (offset < frame->scan_len);
+
+    return packets;
+}
+
+// Frames replaced by a keep-alive or skipped for target t
+static uint32_t udp_suppressed(const udp_target_t *t) {
+#if CONFIG_TRAIN_DEDUP
+    return t->seen.suppressed;
+#else
+    (void)t;
+    return 0;
+#endif
+}
+
+static int send_rtp_h264(const uint8_t *au, size_t len, rtp_jpeg_stream_t *st, uint32_t timestamp,
+                         size_t packet_max, const struct sockaddr_in *dest, size_t *wire) {
+    uint8_t hdr[RTP_H264_MAX_HEADERS];
+    int packets = 0;
+    size_t pos = 0;
+    const uint8_t *nal;
+    size_t nal_len;
+    bool more = rtp_h264_next_nal(au, len, &pos, &nal, &nal_len);
+    while (more) {
+        const uint8_t *next_nal;
+        size_t next_len;
+        more = rtp_h264_next_nal(au, len, &pos, &next_nal, &next_len);
+        size_t offset = 0;
+        do {
+            size_t start, data_len;
+            size_t hlen = rtp_h264_packet(st, nal, nal_len, !more, timestamp, offset, packet_max, hdr,
+                &start, &data_len);
+
+            struct iovec iov[2] = {
+                { .iov_base = hdr, .iov_len = hlen },
+                { .iov_base = (void *)(nal + start), .iov_len = data_len }
+            };
+            if (udp_send_iov(dest, iov, 2) < 0) {
+                if (errno == ENOMEM) {
+                    return -1;
+                }
+                ESP_LOGW(UDP_TAG, "RTP sendmsg failed in NAL type %d with errno %i: %s", nal[0] & 0x1F, errno, strerror(errno));
+                return packets;
+            }
+            packets++;
+            *wire += hlen + data_len;
+            offset = start + data_len;
+        } while (offset < nal_len);
+        nal = next_nal;
+        nal_len = next_len;
+    }
+    return packets;
+}
+
+// Whether a target of the JPEG protocols (or, with `h264`, of proto=h264)
+// is playing. With udp_targets_mutex held.
+static bool udp_any_playing(bool h264) {
+    for (int i = 0; i < UDP_MAX_TARGETS; i++) {
+        if (udp_targets[i].in_use && udp_targets[i].playing && (udp_targets[i].proto == UDP_PROTO_H264) == h264) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool udp_h264_playing(void) {
+    xSemaphoreTake(udp_targets_mutex, portMAX_DELAY);
+    bool playing = udp_any_playing(true);
+    xSemaphoreGive(udp_targets_mutex);
+    return playing;
+}
+
+// Send an H.264 access unit to every playing h264 target. Returns false if
+// a target did not get all of it, so the encoder can start over with an IDR.
+static bool udp_send_h264(const uint8_t *au, size_t len, int64_t capture_us) {
+    bool complete = true;
+    const train_config_t *cfg = runtime_config_lock(RUNTIME_READER_H264);
+    size_t default_datagram = (size_t)cfg->udp_chunk + sizeof(jpeg_chunk_header_t);
+    runtime_config_unlock(RUNTIME_READER_H264);
+
+    xSemaphoreTake(udp_targets_mutex, portMAX_DELAY);
+    for (int i = 0; i < UDP_MAX_TARGETS; i++) {
+        udp_target_t *t = &udp_targets[i];
+        if (!t->in_use || !t->playing || t->proto != UDP_PROTO_H264) {
+            continue;
+        }
+        size_t wire = 0;
+        int sent = send_rtp_h264(au, len, &t->rtp, rtp_jpeg_timestamp(&t->rtp, capture_us),
+            t->datagram ? t->datagram : default_datagram, &t->addr, &wire);
+        wifi_count_tx(wire);
+        if (sent < 0) {
+            t->errors++;
+            complete = false;
+            continue;
+        }
+        t->frames++;
+        t->packets += sent;
+        udp_proto_stats[t->proto].frames++;
+        udp_proto_stats[t->proto].jpeg_bytes += len;
+        udp_proto_stats[t->proto].wire_bytes += wire;
+    }
+    xSemaphoreGive(udp_targets_mutex);
+    return complete;
+}
+
+static void udp_stream_task(void *arg) {
+    frame_id_t frame_id = 0;
+
+    while (true) {
+        xSemaphoreTake(udp_targets_mutex, portMAX_DELAY);
+        bool playing = udp_any_playing(false);
+        xSemaphoreGive(udp_targets_mutex);
+        if (!playing) {
+            // Woken by udp_play()
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        TRACE_BEGIN(trace_fb_wait, 0);
+        camera_fb_t *fb = camera_fb_get();
+        TRACE_END(trace_fb_wait, fb ? fb->len : 0);
+        if (!fb) {
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+        TRACE_BEGIN(trace_udp_frame, fb->len);
+        const train_config_t *cfg = runtime_config_lock(RUNTIME_READER_UDP);
+        size_t chunk_max = (size_t)cfg->udp_chunk;
+        size_t default_datagram = chunk_max + sizeof(jpeg_chunk_header_t);
+
+        int64_t capture_us = (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+        rtp_jpeg_frame_t frame;
+        bool frame_parsed = false, frame_valid = false;
+        bool out_of_buffers = false;
+#if CONFIG_TRAIN_DEDUP
+        bool signed_frame = false;
+#endif
+
+        xSemaphoreTake(udp_targets_mutex, portMAX_DELAY);
+        for (int i = 0; i < UDP_MAX_TARGETS; i++) {
+            udp_target_t *t = &udp_targets[i];
+            if (!t->in_use || !t->playing || t->proto == UDP_PROTO_H264) {
+                continue;
+            }
+
+            int sent;
+            size_t wire = 0;
+            size_t datagram = t->datagram ? t->datagram : default_datagram;
+#if CONFIG_TRAIN_DEDUP
+            if (!signed_frame) {
+                frame_dedup_sig(&udp_sig_dec, fb->buf, fb->len, &udp_sig);
+                signed_frame = true;
+            }
+            if (!frame_dedup_check(cfg, &t->seen, &udp_sig, fb->len, esp_timer_get_time())) {
+                if (t->proto != UDP_PROTO_RTP) {
+                    sent = t->proto == UDP_PROTO_GCM ? send_sealed_keepalive(frame_id, &t->addr, &wire)
+                        : send_chunked_keepalive(frame_id, &t->addr, &wire);
+                    if (sent < 0) {
+                        t->errors++;
+                        out_of_buffers = true;
+                    }
+                    t->packets += sent > 0;
+                    wifi_count_tx(wire);
+                }
+                continue;
+            }
+#endif
+            if (t->proto == UDP_PROTO_RTP) {
+                if (!frame_parsed) {
+                    frame_valid = rtp_jpeg_parse(fb->buf, fb->len, &frame);
+                    frame_parsed = true;
+                    if (!frame_valid) {
+                        ESP_LOGW(UDP_TAG, "Frame cannot be sent as RTP/JPEG, skipping");
+                    }
+                }
+                if (!frame_valid) {
+                    continue;
+                }
+                // Same datagram size as the chunked protocol
+                sent = send_rtp_jpeg(&frame, &t->rtp, rtp_jpeg_timestamp(&t->rtp, capture_us),
+                    datagram, &t->addr, &wire);
+            } else if (t->proto == UDP_PROTO_GCM) {
+                int64_t seal_us = 0;
+                sent = send_sealed_jpeg(fb, frame_id, datagram - sizeof(chunk_crypt_header_t) - CHUNK_CRYPT_TAG_LEN,
+                    &t->addr, &wire, &seal_us);
+                udp_proto_stats[t->proto].seal_us += seal_us;
             } else {
-                // Otherwise, UDP is inherently lossy, so
-                // don't return an error (which would decrease the frame rate):
-                ESP_LOGW("UDP", "sendmsg failed on chunk %u/%u with errno %i: %s", header.packet_id + 1, header.total_packets, errno, strerror(errno));
+                sent = send_chunked_jpeg(fb, frame_id, datagram - sizeof(jpeg_chunk_header_t), &t->addr, &wire);
             }
-            break; // Drop the rest of this frame
+
+            if (sent < 0) {
+                t->errors++;
+                out_of_buffers = true;
+#if CONFIG_TRAIN_DEDUP
+                t->seen.started = false;    // It never got this frame: send the next one
+#endif
+                continue;
+            }
+            t->frames++;
+            t->packets += sent;
+            udp_proto_stats[t->proto].frames++;
+            udp_proto_stats[t->proto].jpeg_bytes += fb->len;
+            udp_proto_stats[t->proto].wire_bytes += wire;
+            wifi_count_tx(wire);
         }
+        xSemaphoreGive(udp_targets_mutex);
+        runtime_config_unlock(RUNTIME_READER_UDP);
 
-        offset += CHUNK_SIZE;
-    } while (++(header.packet_id) < header.total_packets);
+        TRACE_END(trace_udp_frame, fb->len);
+        camera_fb_return(fb);
+        ++frame_id;
+#if CONFIG_TRAIN_UDP_CRYPT
+        if (frame_id == 0) {
+            udp_crypt_epoch++;      // New nonces for the next 65536 frames
+        }
+#endif
+        power_frame_sent();
 
-    ++header.frame_id;
+        if (out_of_buffers) {
+            // Let lwIP drain its TX queue before the next frame
+            vTaskDelay(pdMS_TO_TICKS(10));
+        }
+    }
+}
 
-    return err_code;
+// Add a target (not yet playing). Returns its session id, or 0 if the table
+// is full or the protocol is not available.
+static uint32_t udp_setup(const struct sockaddr_in *addr, udp_proto_t proto) {
+    uint32_t session = 0;
+    if (proto == UDP_PROTO_GCM && !udp_crypt_available()) {
+        return 0;
+    }
+#if !CONFIG_TRAIN_H264
+    if (proto == UDP_PROTO_H264) {
+        return 0;
+    }
+#endif
+    xSemaphoreTake(udp_targets_mutex, portMAX_DELAY);
+    for (int i = 0; i < UDP_MAX_TARGETS; i++) {
+        udp_target_t *t = &udp_targets[i];
+        if (t->in_use) {
+            continue;
+        }
+        *t = (udp_target_t){
+            .in_use = true,
+            .session = udp_next_session++,
+            .proto = proto,
+            .addr = *addr,
+            .rtp = {
+                .ssrc = esp_random(),
+                .seq = (uint16_t)esp_random(),
+                .ts_offset = esp_random(),
+            },
+        };
+        session = t->session;
+        break;
+    }
+    xSemaphoreGive(udp_targets_mutex);
+    return session;
+}
+
+static udp_target_t *udp_find(uint32_t session) {
+    for (int i = 0; i < UDP_MAX_TARGETS; i++) {
+        if (udp_targets[i].in_use && udp_targets[i].session == session) {
+            return &udp_targets[i];
+        }
+    }
+    return NULL;
+}
+
+static esp_err_t udp_play(uint32_t session) {
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    bool started = false;
+    udp_target_t target;
+    xSemaphoreTake(udp_targets_mutex, portMAX_DELAY);
+    udp_target_t *t = udp_find(session);
+    if (t) {
+        started = !t->playing;
+        t->playing = true;
+        target = *t;
+        err = ESP_OK;
+    }
+    xSemaphoreGive(udp_targets_mutex);
+
+    if (started) {
+        char ip[16];
+        inet_ntoa_r(target.addr.sin_addr, ip, sizeof(ip));
+        ESP_LOGI(UDP_TAG, "Session %lu: %s to %s:%d%s", (unsigned long)session,
+            udp_proto_str(target.proto), ip, ntohs(target.addr.sin_port),
+            udp_is_multicast(&target.addr) ? " (multicast)" : "");
+        if (udp_is_multicast(&target.addr)) {
+            mdns_announce_multicast(ip, ntohs(target.addr.sin_port), udp_multicast_ttl, udp_proto_str(target.proto));
+        }
+        power_client_connected();
+        if (target.proto != UDP_PROTO_H264) {
+            xTaskNotifyGive(udp_task_handle);
+        } else if (udp_h264_task_handle) {
+            xTaskNotifyGive(udp_h264_task_handle);     // Starts with an IDR
+        }
+    }
+    return err;
+}
+
+// Next rung of the probe ladder below `size`: 8-byte steps down to 1280
+// (where tunnels and PPPoE land), 64-byte steps below and UDP_DATAGRAM_MIN
+// last. 0 after that.
+static size_t udp_probe_next(size_t size) {
+    if (size <= UDP_DATAGRAM_MIN) {
+        return 0;
+    }
+    size -= size > 1280 ? 8 : 64;
+    return size > UDP_DATAGRAM_MIN ? size : UDP_DATAGRAM_MIN;
+}
+
+// Path probe for a target: datagrams from UDP_DATAGRAM_MAX down to
+// UDP_DATAGRAM_MIN bytes (udp_probe_next). The whole ladder goes out
+// UDP_PROBE_ROUNDS times, paced so the probes are not lost to queueing.
+// Each probe is a chunk header with packet_id UDP_PROBE_ID and
+// total_packets 0, and chunk_size says how long it is. The receiver picks
+// the largest that arrived whole and unfragmented and hands it to
+// udp_set_datagram(). lwIP cannot set DF, so a hop may fragment a probe
+// on the way; the receiver has to spot that (IP_RECVFRAGSIZE on Linux).
+// Returns the number of probes sent, or -1 for an unknown session.
+static int udp_probe(uint32_t session) {
+    struct sockaddr_in addr;
+    xSemaphoreTake(udp_targets_mutex, portMAX_DELAY);
+    udp_target_t *t = udp_find(session);
+    if (t) {
+        addr = t->addr;
+    }
+    xSemaphoreGive(udp_targets_mutex);
+    if (!t) {
+        return -1;
+    }
+
+    int sent = 0;
+    size_t wire = 0;
+    jpeg_chunk_header_t header = { .packet_id = UDP_PROBE_ID };
+    for (int round = 0; round < UDP_PROBE_ROUNDS; round++) {
+        for (size_t size = UDP_DATAGRAM_MAX; size; size = udp_probe_next(size)) {
+            header.chunk_size = size;
+            struct iovec iov[2] = {
+                { .iov_base = &header, .iov_len = sizeof(header) },
+                { .iov_base = udp_probe_buf, .iov_len = size - sizeof(header) }
+            };
+            if (udp_send_iov(&addr, iov, 2) >= 0) {
+                sent++;
+                wire += size;
+            }
+            header.frame_id++;
+            if (header.frame_id % 4 == 0) {
+                vTaskDelay(1);
+            }
+        }
+    }
+    wifi_count_tx(wire);
+    ESP_LOGI(UDP_TAG, "Session %lu: %d path probes sent", (unsigned long)session, sent);
+    return sent;
+}
+
+// Largest datagram for a target, as found by probing, or 0 to go back to
+// udp_chunk
+static esp_err_t udp_set_datagram(uint32_t session, int size) {
+    if (size != 0 && (size < UDP_DATAGRAM_MIN || size > UDP_DATAGRAM_MAX)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    xSemaphoreTake(udp_targets_mutex, portMAX_DELAY);
+    udp_target_t *t = udp_find(session);
+    if (t) {
+        t->datagram = size;
+        err = ESP_OK;
+    }
+    xSemaphoreGive(udp_targets_mutex);
+    if (err == ESP_OK) {
+        ESP_LOGI(UDP_TAG, "Session %lu: datagrams of %d bytes", (unsigned long)session, size);
+    }
+    return err;
+}
+
+// End a session. The mDNS announcement is withdrawn with the last playing
+// multicast target, or moved to one that is still playing.
+static esp_err_t udp_teardown(uint32_t session) {
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    bool was_playing = false, multicast = false;
+    udp_target_t other = {0};
+    xSemaphoreTake(udp_targets_mutex, portMAX_DELAY);
+    udp_target_t *t = udp_find(session);
+    if (t) {
+        was_playing = t->playing;
+        multicast = udp_is_multicast(&t->addr);
+        t->in_use = false;
+        t->playing = false;
+        err = ESP_OK;
+    }
+    for (int i = 0; multicast && i < UDP_MAX_TARGETS; i++) {
+        if (udp_targets[i].in_use && udp_targets[i].playing && udp_is_multicast(&udp_targets[i].addr)) {
+            other = udp_targets[i];
+            break;
+        }
+    }
+    xSemaphoreGive(udp_targets_mutex);
+
+    if (was_playing) {
+        ESP_LOGI(UDP_TAG, "Session %lu ended", (unsigned long)session);
+        power_client_disconnected();
+        if (multicast && other.in_use) {
+            char ip[16];
+            inet_ntoa_r(other.addr.sin_addr, ip, sizeof(ip));
+            mdns_announce_multicast(ip, ntohs(other.addr.sin_port), udp_multicast_ttl, udp_proto_str(other.proto));
+        } else if (multicast) {
+            mdns_announce_multicast(NULL, 0, 0, NULL);
+        }
+    }
+    return err;
+}
+
+// Parse "a.b.c.d:port" into a socket address
+static bool udp_parse_target(const char *str, struct sockaddr_in *addr) {
+    char host[16];
+    unsigned port;
+    if (sscanf(str, "%15[0-9.]:%u", host, &port) != 2 || port == 0 || port > 65535) {
+        return false;
+    }
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(port);
+    return inet_aton(host, &addr->sin_addr) != 0;
+}
+
+static void udp_stream_start(void) {
+    udp_targets_mutex = xSemaphoreCreateMutex();
+    udp_init();
+    xTaskCreatePinnedToCore(udp_stream_task, "udp_stream", 4096, NULL, 5, &udp_task_handle, 1);
+
+    // Optional fixed receiver, for setups without a subscribing client
+    struct sockaddr_in addr;
+    if (CONFIG_TRAIN_UDP_DEFAULT_TARGET[0] && udp_parse_target(CONFIG_TRAIN_UDP_DEFAULT_TARGET, &addr)) {
+        udp_play(udp_setup(&addr, UDP_DEFAULT_PROTO));
+    }
+
+#if CONFIG_TRAIN_UDP_MULTICAST
+    // Multicast group that viewers join instead of subscribing one by one
+    if (udp_parse_target(CONFIG_TRAIN_UDP_MULTICAST_GROUP, &addr) && udp_is_multicast(&addr)) {
+        udp_play(udp_setup(&addr, UDP_DEFAULT_PROTO));
+    } else {
+        ESP_LOGE(UDP_TAG, "Invalid multicast group '%s'", CONFIG_TRAIN_UDP_MULTICAST_GROUP);
+    }
+#endif
 }
@@ -1,7 +1,7 @@
 #pragma once
 
 // Embedded web UI for Wildlife Spotter Train
-// Displays MJPEG stream and (future) train controls
+// Displays MJPEG stream, drag-to-zoom ROI selection and train controls
 
 static const char INDEX_HTML[] = R"rawliteral(
 <!DOCTYPE html>
@@ -44,11 +44,21 @@ static const char INDEX_HTML[] = R"rawliteral(
             align-items: center;
         }
         .video-container {
+            position: relative;
             background: #000;
             border-radius: 8px;
             overflow: hidden;
             box-shadow: 0 4px 20px rgba(0,0,0,0.5);
             max-width: 100%;
+            cursor: crosshair;
+            touch-action: none;
+        }
+        #roi-box {
+            position: absolute;
+            border: 2px dashed #facc15;
+            background: rgba(250, 204, 21, 0.1);
+            pointer-events: none;
+            display: none;
         }
         #stream {
             display: block;
@@ -120,6 +130,28 @@ static const char INDEX_HTML[] = R"rawliteral(
             background: #374151;
             font-size: 0.85rem;
         }
+        .train-hub {
+            width: 100%;
+            margin-bottom: 15px;
+            padding: 6px;
+            background: #374151;
+            color: white;
+            border: none;
+            border-radius: 4px;
+        }
+        .train-telemetry {
+            margin-top: 15px;
+            font-size: 0.8rem;
+            color: #aaa;
+            text-align: left;
+            line-height: 1.5;
+        }
+        .train-telemetry canvas {
+            width: 100%;
+            height: 40px;
+            background: #0f172a;
+            border-radius: 4px;
+        }
         .train-status.connected { background: #166534; }
         .train-status.scanning { background: #854d0e; }
         .train-status.error { background: #991b1b; }
@@ -164,7 +196,8 @@ static const char INDEX_HTML[] = R"rawliteral(
     <div class="main-content">
         <div class="video-section">
             <div class="video-container">
-                <img id="stream" src="" alt="Camera Stream">
+                <img id="stream" src="" alt="Camera Stream" draggable="false">
+                <div id="roi-box"></div>
             </div>
 
             <div id="status" class="status">Connecting...</div>
@@ -172,6 +205,11 @@ static const char INDEX_HTML[] = R"rawliteral(
             <div class="controls">
                 <button class="btn-primary" onclick="startStream()">Start Stream</button>
                 <button class="btn-secondary" onclick="captureImage()">Capture</button>
+                <select id="roi-mode" class="btn-secondary" title="Drag on the video to select a region">
+                    <option value="crop">Crop</option>
+                    <option value="zoom">Zoom</option>
+                </select>
+                <button class="btn-secondary" onclick="resetRoi()">Reset View</button>
             </div>
 
             <div class="stats" id="stats"></div>
@@ -180,6 +218,9 @@ static const char INDEX_HTML[] = R"rawliteral(
         <div class="train-controls">
             <h2>Train</h2>
             <div id="train-status" class="train-status">Checking...</div>
+            <select id="train-hub" class="train-hub" style="display: none;">
+                <option value="all">All hubs</option>
+            </select>
             <div class="train-buttons">
                 <button class="btn-train btn-forward"
                         onmousedown="trainControl('forward')"
@@ -201,6 +242,10 @@ static const char INDEX_HTML[] = R"rawliteral(
                     &#9660; Back
                 </button>
             </div>
+            <div id="train-telemetry" class="train-telemetry" style="display: none;">
+                <div id="telemetry-text"></div>
+                <canvas id="telemetry-chart" width="180" height="40"></canvas>
+            </div>
         </div>
     </div>
 
@@ -245,21 +290,102 @@ static const char INDEX_HTML[] = R"rawliteral(
         window.onload = function() {
             startStream();
             updateTrainStatus();
+            refreshRoi();
         };
 
+        // Drag-to-zoom: select a region on the video, mapped to full-frame
+        // coordinates through the currently applied ROI
+        const videoContainer = document.querySelector('.video-container');
+        const roiBox = document.getElementById('roi-box');
+        let roiState = null;
+        let dragStart = null;
+
+        async function refreshRoi(query) {
+            try {
+                const response = await fetch('/roi' + (query || ''));
+                roiState = await response.json();
+            } catch (err) {
+                statusDiv.textContent = 'ROI request failed';
+                statusDiv.className = 'status error';
+            }
+        }
+
+        function resetRoi() {
+            refreshRoi('?reset=1');
+        }
+
+        function imagePoint(e) {
+            const rect = streamImg.getBoundingClientRect();
+            return {
+                x: Math.min(Math.max(e.clientX - rect.left, 0), rect.width),
+                y: Math.min(Math.max(e.clientY - rect.top, 0), rect.height),
+                w: rect.width,
+                h: rect.height
+            };
+        }
+
+        videoContainer.addEventListener('pointerdown', (e) => {
+            dragStart = imagePoint(e);
+            videoContainer.setPointerCapture(e.pointerId);
+            roiBox.style.display = 'block';
+            roiBox.style.left = dragStart.x + 'px';
+            roiBox.style.top = dragStart.y + 'px';
+            roiBox.style.width = '0px';
+            roiBox.style.height = '0px';
+        });
+
+        videoContainer.addEventListener('pointermove', (e) => {
+            if (!dragStart) return;
+            const p = imagePoint(e);
+            roiBox.style.left = Math.min(p.x, dragStart.x) + 'px';
+            roiBox.style.top = Math.min(p.y, dragStart.y) + 'px';
+            roiBox.style.width = Math.abs(p.x - dragStart.x) + 'px';
+            roiBox.style.height = Math.abs(p.y - dragStart.y) + 'px';
+        });
+
+        videoContainer.addEventListener('pointerup', async (e) => {
+            if (!dragStart) return;
+            const p = imagePoint(e);
+            const start = dragStart;
+            dragStart = null;
+            roiBox.style.display = 'none';
+
+            const w = Math.abs(p.x - start.x), h = Math.abs(p.y - start.y);
+            if (w < 10 || h < 10) return;  // A click, not a drag
+
+            if (!roiState) await refreshRoi();
+            if (!roiState) return;
+            // The displayed image shows the current ROI (or the full frame)
+            const base = roiState.active
+                ? roiState
+                : { x: 0, y: 0, w: roiState.frame_w, h: roiState.frame_h };
+            const x = Math.round(base.x + Math.min(p.x, start.x) / p.w * base.w);
+            const y = Math.round(base.y + Math.min(p.y, start.y) / p.h * base.h);
+            const rw = Math.round(w / p.w * base.w);
+            const rh = Math.round(h / p.h * base.h);
+            const mode = document.getElementById('roi-mode').value;
+            refreshRoi('?x=' + x + '&y=' + y + '&w=' + rw + '&h=' + rh + '&mode=' + mode);
+        });
+
         // Train control
         const trainStatusDiv = document.getElementById('train-status');
+        const trainHubSelect = document.getElementById('train-hub');
         let lastAction = null;
 
+        function trainQuery(action) {
+            const hub = trainHubSelect.value;
+            return '/train?action=' + action + (hub === 'all' ? '' : '&id=' + hub);
+        }
+
         async function trainControl(action) {
             // Debounce repeated stop commands
             if (action === lastAction) return;
             lastAction = action;
 
             try {
-                const response = await fetch('/train?action=' + action);
+                const response = await fetch(trainQuery(action));
                 const data = await response.json();
-                updateTrainStatusUI(data.state, data.result);
+                updateTrainStatusUI(data, data.result);
             } catch (err) {
                 trainStatusDiv.textContent = 'Connection error';
                 trainStatusDiv.className = 'train-status error';
@@ -271,12 +397,30 @@ static const char INDEX_HTML[] = R"rawliteral(
             }
         }
 
-        function updateTrainStatusUI(state, result) {
+        // One entry per hub slot; the selector only shows with several hubs
+        function updateHubSelect(hubs) {
+            if (!hubs) return;
+            if (trainHubSelect.options.length !== hubs.length + 1) {
+                trainHubSelect.length = 1;
+                hubs.forEach(hub => trainHubSelect.add(new Option('', hub.id)));
+            }
+            hubs.forEach((hub, i) => {
+                trainHubSelect.options[i + 1].text = 'Hub ' + hub.id + (hub.name ? ' - ' + hub.name : '') + ' (' + hub.state + ')';
+            });
+            trainHubSelect.style.display = hubs.length > 1 ? '' : 'none';
+        }
+
+        function updateTrainStatusUI(data, result) {
+            const state = data.state;
             let statusText = state;
             let statusClass = 'train-status';
+            updateHubSelect(data.hubs);
 
             if (state === 'ready') {
                 statusText = 'Connected - ' + (result || 'Ready');
+                if (data.hubs && data.hubs.length > 1 && trainHubSelect.value === 'all') {
+                    statusText = data.ready + '/' + data.hubs.length + ' hubs - ' + (result || 'Ready');
+                }
                 statusClass += ' connected';
             } else if (state === 'scanning' || state === 'connecting' || state === 'discovering') {
                 statusText = 'Connecting to train...';
@@ -292,15 +436,63 @@ static const char INDEX_HTML[] = R"rawliteral(
 
         async function updateTrainStatus() {
             try {
-                const response = await fetch('/train?action=status');
+                const response = await fetch(trainQuery('status'));
                 const data = await response.json();
-                updateTrainStatusUI(data.state, null);
+                updateTrainStatusUI(data, null);
+                if (data.ready > 0) updateTelemetry();
             } catch (err) {
                 trainStatusDiv.textContent = 'Connection error';
                 trainStatusDiv.className = 'train-status error';
             }
         }
 
+        // Hub telemetry: the selected hub (or hub 0), with a battery current
+        // sparkline over the last minute
+        const telemetryDiv = document.getElementById('train-telemetry');
+        const telemetryText = document.getElementById('telemetry-text');
+        const telemetryChart = document.getElementById('telemetry-chart');
+
+        async function updateTelemetry() {
+            const hub = trainHubSelect.value === 'all' ? 0 : trainHubSelect.value;
+            try {
+                const response = await fetch('/telemetry?id=' + hub + '&history=120');
+                const t = (await response.json()).hubs[0];
+                if (!t || !t.latest) {
+                    telemetryDiv.style.display = 'none';
+                    return;
+                }
+                const l = t.latest;
+                let text = (l.battery_mv / 1000).toFixed(2) + ' V, ' + l.battery_ma + ' mA, duty ' + l.duty + '%';
+                text += '<br>Loop ' + l.loop_avg_ms + '/' + l.loop_max_ms + ' ms';
+                if (l.pitch_ddeg !== null) {
+                    text += ', tilt ' + (l.pitch_ddeg / 10).toFixed(1) + '/' + (l.roll_ddeg / 10).toFixed(1) + '&deg;';
+                }
+                if (l.age_ms > 5000) text += ' (stale)';
+                telemetryText.innerHTML = text;
+                drawTelemetry(t.history.filter(row => row[0] <= 60000));
+                telemetryDiv.style.display = '';
+            } catch (err) {
+                telemetryDiv.style.display = 'none';
+            }
+        }
+
+        function drawTelemetry(rows) {
+            const ctx = telemetryChart.getContext('2d');
+            const w = telemetryChart.width, h = telemetryChart.height;
+            ctx.clearRect(0, 0, w, h);
+            if (rows.length < 2) return;
+            const values = rows.map(row => row[2]);
+            const max = Math.max(100, ...values);
+            ctx.strokeStyle = '#22c55e';
+            ctx.beginPath();
+            rows.forEach((row, i) => {
+                const x = w - row[0] / 60000 * w;
+                const y = h - 2 - row[2] / max * (h - 4);
+                if (i === 0) ctx.moveTo(x, y); else ctx.lineTo(x, y);
+            });
+            ctx.stroke();
+        }
+
         // Poll train status every 3 seconds
         setInterval(updateTrainStatus, 3000);
     </script>
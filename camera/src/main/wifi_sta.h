@@ -11,6 +11,14 @@
 static esp_netif_t *s_sta_netif = NULL;
 static EventGroupHandle_t s_wifi_event_group = NULL;
 
+// Stream and snapshot payload handed to the network stack, free-running.
+// Sampled by the BLE scheduler to report WiFi throughput next to BLE activity.
+static uint32_t wifi_tx_bytes = 0;
+
+static inline void wifi_count_tx(size_t bytes) {
+    __atomic_fetch_add(&wifi_tx_bytes, (uint32_t)bytes, __ATOMIC_RELAXED);
+}
+
 // Forward declaration:
 static void wifi_sta_disconnect(void);
 
@@ -83,6 +91,7 @@ static void wifi_sta_connect(void) {
             .sort_method = WIFI_CONNECT_AP_BY_SIGNAL, // WIFI_CONNECT_AP_BY_SECURITY,
             .threshold.rssi = 0, // or set higher
             .threshold.authmode = WIFI_AUTH_WPA2_PSK,
+            .listen_interval = CONFIG_TRAIN_POWER_LISTEN_INTERVAL, // DTIMs between wakes in max modem sleep
         },
     };
 
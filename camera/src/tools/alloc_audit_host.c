@@ -0,0 +1,401 @@
+// Host allocation audit of the per-frame paths (main/alloc_stats.h).
+//
+// Replaces malloc/calloc/realloc/free with counting versions that forward
+// to glibc and record each call against the current phase, then runs the
+// firmware's portable per-frame code through the capture, stream, UDP and
+// JSON paths:
+//
+//   capture  frame_pool.h: acquire a slot, copy the JPEG in, publish
+//   stream   frame_pool.h take/ref/unref, stream_sched.h, the part header
+//            template and stream_sock.h sends to two clients over
+//            non-blocking socketpairs
+//   udp      rtp_jpeg.h parse and packetize plus chunked-protocol packets,
+//            sent with sendmsg() over loopback UDP
+//   api      the /status, /power and /train templates (http_template.h)
+//
+// The first frames may set things up; after that, every path must run
+// STEADY_FRAMES frames with no allocation at all. A self-check first makes
+// sure the counters see an allocation, and that one inside
+// alloc_stats_lib_begin()/_end() is counted as a library allocation.
+//
+//   cc -O2 -Imain tools/alloc_audit_host.c -o alloc_audit_host   (from camera/src)
+//   ./alloc_audit_host
+//
+// Needs glibc (__libc_malloc and friends). Exits non-zero if a steady-state
+// path allocates.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "alloc_stats.h"
+#include "frame_pool.h"
+#include "http_template.h"
+#include "rtp_jpeg.h"
+#include "stream_sock.h"
+#define STREAM_SCHED_MAX_CLIENTS 2
+#include "stream_sched.h"
+
+#define WARMUP_FRAMES 4
+#define STEADY_FRAMES 2000
+#define FRAME_SLOT 65536
+#define POOL_SLOTS (STREAM_SCHED_MAX_CLIENTS + 2)
+#define UDP_CHUNK 1400
+
+// ---------------------------------------------------------------------------
+// Counting allocator
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static alloc_stats_t stats;
+static const char *phase;       // Owner and label of allocations; NULL = not counting
+
+void *malloc(size_t size) {
+    void *p = __libc_malloc(size);
+    if (phase && p) {
+        alloc_stats_alloc(&stats, phase, phase, (uint32_t)size);
+    }
+    return p;
+}
+
+void *calloc(size_t n, size_t size) {
+    void *p = __libc_calloc(n, size);
+    if (phase && p) {
+        alloc_stats_alloc(&stats, phase, phase, (uint32_t)(n * size));
+    }
+    return p;
+}
+
+void *realloc(void *ptr, size_t size) {
+    void *p = __libc_realloc(ptr, size);
+    if (phase && p) {
+        alloc_stats_alloc(&stats, phase, phase, (uint32_t)size);
+    }
+    return p;
+}
+
+void free(void *ptr) {
+    if (phase && ptr) {
+        alloc_stats_free(&stats, phase, phase);
+    }
+    __libc_free(ptr);
+}
+
+static const alloc_owner_t *phase_row(const char *name) {
+    for (int i = 0; i < ALLOC_STATS_MAX_OWNERS; i++) {
+        if (stats.row[i].owner == name) {
+            return &stats.row[i];
+        }
+    }
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Paths
+
+static const char PHASE_CAPTURE[] = "capture";
+static const char PHASE_STREAM[] = "stream";
+static const char PHASE_UDP[] = "udp";
+static const char PHASE_API[] = "api";
+static const char PHASE_SELF[] = "self-check";
+
+static uint8_t jpeg[40000];
+static size_t jpeg_len;
+static uint8_t pool_storage[POOL_SLOTS * FRAME_SLOT];
+static frame_pool_t pool;
+static stream_sched_t sched;
+static http_templates_t tpl;
+
+typedef struct {
+    int fd;                     // Our end
+    int peer;                   // The client's end, drained by the harness
+    int frame;
+    char part_header[sizeof(HTTP_TPL_MJPEG_PART("frame"))];
+    struct iovec iov[2];
+    struct iovec *cur;
+    int iovcnt;
+} client_t;
+
+static client_t clients[STREAM_SCHED_MAX_CLIENTS];
+static stream_sock_stats_t sock_stats;
+static int udp_tx, udp_rx;
+static struct sockaddr_in udp_dest;
+static rtp_jpeg_stream_t rtp = { .ssrc = 0x12345678 };
+static uint64_t udp_packets, stream_frames;
+
+// Baseline JPEG with two quantization tables, 4:2:0, and a scan of
+// pseudo-random bytes (no 0xFF, so no marker inside)
+static void make_jpeg(void) {
+    uint8_t *p = jpeg;
+    *p++ = 0xFF; *p++ = 0xD8;
+    *p++ = 0xFF; *p++ = 0xDB; *p++ = 0; *p++ = 2 + 2 * 65;
+    for (int t = 0; t < 2; t++) {
+        *p++ = (uint8_t)t;
+        for (int i = 0; i < 64; i++) {
+            *p++ = (uint8_t)(1 + i + t);
+        }
+    }
+    const uint8_t sof[] = { 0xFF, 0xC0, 0, 17, 8, 0x01, 0xE0, 0x02, 0x80, 3,
+                            1, 0x22, 0, 2, 0x11, 1, 3, 0x11, 1 };
+    memcpy(p, sof, sizeof(sof));
+    p += sizeof(sof);
+    const uint8_t sos[] = { 0xFF, 0xDA, 0, 12, 3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0 };
+    memcpy(p, sos, sizeof(sos));
+    p += sizeof(sos);
+    uint32_t x = 1;
+    while (p < jpeg + sizeof(jpeg) - 2) {
+        x = x * 1103515245 + 12345;
+        *p++ = (uint8_t)(x >> 16) % 0xFF;
+    }
+    *p++ = 0xFF; *p++ = 0xD9;
+    jpeg_len = (size_t)(p - jpeg);
+}
+
+static void capture_frame(void) {
+    phase = PHASE_CAPTURE;
+    int slot = frame_pool_acquire(&pool, jpeg_len);
+    if (slot >= 0) {
+        memcpy(pool.slot[slot].buf, jpeg, jpeg_len);
+        frame_pool_publish(&pool, slot, jpeg_len);
+    }
+    phase = NULL;
+}
+
+static void drain(int fd) {
+    static uint8_t sink[65536];
+    while (read(fd, sink, sizeof(sink)) > 0) {
+    }
+}
+
+// Dispatch the ready frame and push every client's frame out completely
+static void stream_frame(int64_t now) {
+    phase = PHASE_STREAM;
+    int frame = frame_pool_take(&pool);
+    if (frame >= 0) {
+        const frame_slot_t *f = &pool.slot[frame];
+        uint32_t mask = stream_sched_frame(&sched, f->id, tpl.mjpeg_part.len + f->len, now);
+        for (int i = 0; i < STREAM_SCHED_MAX_CLIENTS; i++) {
+            if (!(mask & (1u << i))) {
+                continue;
+            }
+            client_t *c = &clients[i];
+            http_tpl_set_uint(&tpl.mjpeg_part, c->part_header, 0, f->len);
+            c->iov[0] = (struct iovec){ .iov_base = c->part_header, .iov_len = tpl.mjpeg_part.len };
+            c->iov[1] = (struct iovec){ .iov_base = f->buf, .iov_len = f->len };
+            c->cur = c->iov;
+            c->iovcnt = 2;
+            c->frame = frame;
+            frame_pool_ref(&pool, frame);
+        }
+        frame_pool_unref(&pool, frame);
+    }
+
+    bool busy = true;
+    while (busy) {
+        busy = false;
+        for (int i = 0; i < STREAM_SCHED_MAX_CLIENTS; i++) {
+            client_t *c = &clients[i];
+            if (c->frame < 0) {
+                continue;
+            }
+            ssize_t n = stream_sock_send_some(c->fd, &c->cur, &c->iovcnt, &sock_stats);
+            if (n < 0) {
+                printf("stream send failed: %s\n", strerror(errno));
+                exit(1);
+            }
+            if (stream_sched_sent(&sched, i, (uint32_t)n, now)) {
+                frame_pool_unref(&pool, c->frame);
+                c->frame = -1;
+                stream_frames++;
+            } else {
+                busy = true;
+            }
+            drain(c->peer);
+        }
+    }
+    phase = NULL;
+}
+
+// Same layout as jpeg_chunk_header_t in udp.h
+typedef struct __attribute__((packed)) {
+    uint16_t frame_id;
+    uint16_t packet_id;
+    uint16_t total_packets;
+    uint16_t chunk_size;
+} chunk_header_t;
+
+static void udp_send(struct iovec *iov, int iovcnt) {
+    struct msghdr msg = { .msg_name = &udp_dest, .msg_namelen = sizeof(udp_dest), .msg_iov = iov, .msg_iovlen = iovcnt };
+    if (sendmsg(udp_tx, &msg, 0) < 0 && errno != ENOBUFS && errno != EAGAIN) {
+        printf("udp send failed: %s\n", strerror(errno));
+        exit(1);
+    }
+    udp_packets++;
+    drain(udp_rx);
+}
+
+static void udp_frame(uint16_t frame_id, int64_t now) {
+    phase = PHASE_UDP;
+    rtp_jpeg_frame_t frame;
+    if (!rtp_jpeg_parse(jpeg, jpeg_len, &frame)) {
+        printf("test JPEG does not parse\n");
+        exit(1);
+    }
+    uint8_t hdr[RTP_JPEG_MAX_HEADERS];
+    size_t offset = 0;
+    uint32_t ts = rtp_jpeg_timestamp(&rtp, now);
+    do {
+        size_t data_len;
+        size_t hlen = rtp_jpeg_packet(&rtp, &frame, ts, offset, UDP_CHUNK + sizeof(chunk_header_t), hdr, &data_len);
+        struct iovec iov[2] = {
+            { .iov_base = hdr, .iov_len = hlen },
+            { .iov_base = (void *)(frame.scan + offset), .iov_len = data_len },
+        };
+        udp_send(iov, 2);
+        offset += data_len;
+    } while (offset < frame.scan_len);
+
+    chunk_header_t header = { .frame_id = frame_id, .total_packets = (jpeg_len + UDP_CHUNK - 1) / UDP_CHUNK,
+        .chunk_size = UDP_CHUNK };
+    for (size_t off = 0; off < jpeg_len; off += UDP_CHUNK, header.packet_id++) {
+        size_t n = jpeg_len - off < UDP_CHUNK ? jpeg_len - off : UDP_CHUNK;
+        struct iovec iov[2] = {
+            { .iov_base = &header, .iov_len = sizeof(header) },
+            { .iov_base = jpeg + off, .iov_len = n },
+        };
+        udp_send(iov, 2);
+    }
+    phase = NULL;
+}
+
+static void api_response(uint32_t i) {
+    phase = PHASE_API;
+    char status[sizeof(HTTP_TPL_STATUS)];
+    http_tpl_begin(&tpl.status, status);
+    http_tpl_set_int(&tpl.status, status, HTTP_STATUS_FRAMESIZE, (int32_t)(i % 14));
+    http_tpl_set_int(&tpl.status, status, HTTP_STATUS_QUALITY, 12);
+    http_tpl_set_str(&tpl.status, status, HTTP_STATUS_PRESET, "daylight");
+
+    char power[sizeof(HTTP_TPL_POWER)];
+    http_tpl_begin(&tpl.power, power);
+    http_tpl_set_str(&tpl.power, power, HTTP_POWER_MODE, "active");
+    http_tpl_set_uint(&tpl.power, power, HTTP_POWER_WAKES, i);
+
+    char train[sizeof(HTTP_TPL_TRAIN_HEAD) + sizeof(HTTP_TPL_TRAIN_HUB)];
+    size_t len = http_tpl_begin(&tpl.train_head, train);
+    http_tpl_set_str(&tpl.train_head, train, HTTP_TRAIN_ACTION, "forward");
+    http_tpl_begin(&tpl.train_hub, train + len);
+    http_tpl_set_uint(&tpl.train_hub, train + len, HTTP_HUB_COMMANDS, i);
+    phase = NULL;
+}
+
+// ---------------------------------------------------------------------------
+
+static void setup(void) {
+    make_jpeg();
+    frame_pool_init(&pool, pool_storage, POOL_SLOTS, FRAME_SLOT);
+    stream_sched_init(&sched, 5000000);
+    if (!http_templates_compile(&tpl, HTTP_TPL_MJPEG_PART("frame"))) {
+        printf("template compile failed\n");
+        exit(1);
+    }
+    for (int i = 0; i < STREAM_SCHED_MAX_CLIENTS; i++) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv) != 0) {
+            perror("socketpair");
+            exit(1);
+        }
+        clients[i] = (client_t){ .fd = sv[0], .peer = sv[1], .frame = -1 };
+        http_tpl_begin(&tpl.mjpeg_part, clients[i].part_header);
+        stream_sched_join(&sched, 0, 0);
+    }
+
+    udp_rx = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    udp_tx = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t addr_len = sizeof(addr);
+    if (bind(udp_rx, (struct sockaddr *)&addr, sizeof(addr)) != 0
+        || getsockname(udp_rx, (struct sockaddr *)&udp_dest, &addr_len) != 0) {
+        perror("udp socket");
+        exit(1);
+    }
+}
+
+static int failures = 0;
+
+static void self_check(void) {
+    phase = PHASE_SELF;
+    void *volatile p = malloc(100);
+    uint32_t mark = alloc_stats_lib_begin(&stats, PHASE_SELF, PHASE_SELF);
+    void *volatile q = malloc(50);
+    alloc_stats_lib_end(&stats, PHASE_SELF, PHASE_SELF, mark);
+    free(q);
+    free(p);
+    phase = NULL;
+
+    const alloc_owner_t *r = phase_row(PHASE_SELF);
+    if (!r || r->allocs != 2 || r->frees != 2 || r->lib_allocs != 1 || alloc_stats_own(r) != 1 || r->bytes != 150) {
+        printf("FAIL: counting allocator self-check\n");
+        failures++;
+    }
+}
+
+int main(void) {
+    __atomic_store_n(&stats.enabled, true, __ATOMIC_RELEASE);
+    self_check();
+    setup();
+
+    const char *phases[] = { PHASE_CAPTURE, PHASE_STREAM, PHASE_UDP, PHASE_API };
+    alloc_owner_t warm[ALLOC_STATS_MAX_OWNERS], steady[ALLOC_STATS_MAX_OWNERS], delta[ALLOC_STATS_MAX_OWNERS];
+    int64_t now = 0;
+    for (int i = 0; i < WARMUP_FRAMES + STEADY_FRAMES; i++) {
+        if (i == WARMUP_FRAMES) {
+            alloc_stats_snapshot(&stats, warm);
+        }
+        capture_frame();
+        stream_frame(now);
+        udp_frame((uint16_t)i, now);
+        api_response((uint32_t)i);
+        now += 66667;
+    }
+    alloc_stats_snapshot(&stats, steady);
+    alloc_stats_diff(warm, steady, delta);
+
+    printf("%-10s %14s %14s %12s\n", "path", "warm-up allocs", "steady allocs", "per frame");
+    for (size_t p = 0; p < sizeof(phases) / sizeof(phases[0]); p++) {
+        uint32_t warm_allocs = 0, steady_allocs = 0;
+        for (int i = 0; i < ALLOC_STATS_MAX_OWNERS; i++) {
+            if (warm[i].owner == phases[p]) {
+                warm_allocs = warm[i].allocs;
+            }
+            if (delta[i].owner == phases[p]) {
+                steady_allocs = delta[i].allocs;
+            }
+        }
+        printf("%-10s %14lu %14lu %12.3f\n", phases[p], (unsigned long)warm_allocs,
+            (unsigned long)steady_allocs, (double)steady_allocs / STEADY_FRAMES);
+        if (steady_allocs != 0) {
+            printf("FAIL: %s path allocates in steady state\n", phases[p]);
+            failures++;
+        }
+    }
+    printf("%lu stream frames to %d clients (%.2f sends/frame), %lu UDP packets\n",
+        (unsigned long)stream_frames, STREAM_SCHED_MAX_CLIENTS, (double)sock_stats.sends / stream_frames,
+        (unsigned long)udp_packets);
+    if (stream_frames < (uint64_t)STEADY_FRAMES * STREAM_SCHED_MAX_CLIENTS) {
+        printf("FAIL: only %lu stream frames delivered\n", (unsigned long)stream_frames);
+        failures++;
+    }
+    if (frame_pool_in_use(&pool) != 0) {
+        printf("FAIL: %d pool slots still referenced\n", frame_pool_in_use(&pool));
+        failures++;
+    }
+    printf("%s\n", failures ? "FAILED" : "all checks passed");
+    return failures ? 1 : 0;
+}
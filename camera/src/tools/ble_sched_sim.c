@@ -0,0 +1,316 @@
+// Host simulation of the BLE coexistence scheduler (main/ble_sched.h).
+//
+// Replays a script of hub and command events through the real policy code
+// and prints the estimated BLE radio duty cycle, how long links spent on
+// short intervals, command delivery delay and hub reconnect time. The same
+// script is also run through a "fixed" configuration that mimics the old
+// behavior (short interval always, 10 s scans every 0.5 s), for comparison.
+//
+//   cc -O2 -Imain tools/ble_sched_sim.c -o ble_sched_sim   (from camera/src)
+//   ./ble_sched_sim              # built-in scenario
+//   ./ble_sched_sim script.txt   # one event per line, see below
+//
+// Script lines ("#" starts a comment), time in seconds:
+//   <t> hubs <n>                  number of hub slots (default: highest id + 1)
+//   <t> appear <hub>              hub powers on and advertises
+//   <t> vanish <hub>              hub switched off or out of range
+//   <t> burst <hub> <n> <gap_s>   n commands, gap_s apart
+//   <t> wifi <kbps>               WiFi stream throughput from now on
+//   <t> end                       stop the simulation
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BLE_SCHED_MAX_LINKS 4
+#include "ble_sched.h"
+
+#define STEP_US 10000
+#define TICK_US 500000
+#define UPDATE_INSTANT_EVENTS 6     // Parameter updates take effect this many intervals later
+#define MAX_EVENTS 256
+#define MAX_CMDS 1024
+
+typedef struct {
+    double t;
+    char what[16];
+    int hub;
+    int n;
+    double gap;
+} sim_event_t;
+
+typedef struct {
+    int64_t at_us;
+    int hub;
+} sim_cmd_t;
+
+static const char *builtin_script =
+    "0    wifi 4000\n"
+    "0    appear 0\n"
+    "0    appear 1\n"
+    "5    burst 0 10 0.3\n"
+    "5    burst 1 10 0.3\n"
+    "30   burst 0 3 1\n"
+    "45   vanish 1\n"
+    "80   appear 1\n"
+    "100  burst 1 5 0.2\n"
+    "100  wifi 200\n"
+    "120  end\n";
+
+static sim_event_t events[MAX_EVENTS];
+static int event_count;
+static int hub_slots;
+
+static void parse_script(const char *text) {
+    const char *line = text;
+    int max_hub = 0;
+    while (line && *line && event_count < MAX_EVENTS) {
+        sim_event_t e = {0};
+        int fields = sscanf(line, "%lf %15s %d %d %lf", &e.t, e.what, &e.hub, &e.n, &e.gap);
+        if (fields >= 2 && line[0] != '#') {
+            if (strcmp(e.what, "hubs") == 0) {
+                hub_slots = e.hub;
+            } else if (strcmp(e.what, "wifi") == 0) {
+                e.n = e.hub;
+                e.hub = 0;
+            }
+            if (e.hub > max_hub && strcmp(e.what, "hubs") != 0) {
+                max_hub = e.hub;
+            }
+            events[event_count++] = e;
+        }
+        line = strchr(line, '\n');
+        line = line ? line + 1 : NULL;
+    }
+    if (hub_slots == 0) {
+        hub_slots = max_hub + 1;
+    }
+    if (hub_slots > BLE_SCHED_MAX_LINKS) {
+        hub_slots = BLE_SCHED_MAX_LINKS;
+    }
+}
+
+typedef struct {
+    uint32_t avg_duty;          // permille
+    uint32_t peak_duty;
+    double active_s[BLE_SCHED_MAX_LINKS];
+    uint32_t switches;
+    int commands;
+    double delay_avg_ms;
+    double delay_max_ms;
+    double reconnect_max_s;
+    uint32_t scan_bursts;
+    double scan_s;
+} sim_result_t;
+
+static sim_result_t run(const ble_sched_config_t *cfg, bool verbose) {
+    ble_sched_t s;
+    ble_sched_init(&s, cfg, hub_slots, 0);
+
+    bool present[BLE_SCHED_MAX_LINKS] = {0};
+    int64_t appeared_us[BLE_SCHED_MAX_LINKS] = {0};
+    int64_t update_at_us[BLE_SCHED_MAX_LINKS];
+    ble_link_mode_t update_mode[BLE_SCHED_MAX_LINKS];
+    sim_cmd_t cmds[MAX_CMDS];
+    int cmd_count = 0;
+    int64_t done_at_us[MAX_CMDS];
+    int64_t next_scan_us = 0, scan_end_us = 0;
+    int64_t end_us = 0;
+    uint32_t wifi_bytes = 0, wifi_kbps = 0;
+    sim_result_t r = {0};
+    double delay_sum_ms = 0;
+
+    for (int i = 0; i < BLE_SCHED_MAX_LINKS; i++) {
+        update_at_us[i] = -1;
+    }
+
+    // Expand bursts into individual commands
+    for (int i = 0; i < event_count; i++) {
+        sim_event_t *e = &events[i];
+        if (strcmp(e->what, "burst") == 0) {
+            for (int k = 0; k < e->n && cmd_count < MAX_CMDS; k++) {
+                cmds[cmd_count].at_us = (int64_t)((e->t + k * e->gap) * 1e6);
+                cmds[cmd_count].hub = e->hub;
+                done_at_us[cmd_count] = -1;
+                cmd_count++;
+            }
+        } else if (strcmp(e->what, "end") == 0) {
+            end_us = (int64_t)(e->t * 1e6);
+        }
+    }
+    if (end_us == 0) {
+        end_us = 120000000;
+    }
+
+    int next_event = 0;
+    for (int64_t now = 0; now <= end_us; now += STEP_US) {
+        for (; next_event < event_count && (int64_t)(events[next_event].t * 1e6) <= now; next_event++) {
+            sim_event_t *e = &events[next_event];
+            if (strcmp(e->what, "appear") == 0 && e->hub < hub_slots) {
+                present[e->hub] = true;
+                appeared_us[e->hub] = now;
+            } else if (strcmp(e->what, "vanish") == 0 && e->hub < hub_slots) {
+                present[e->hub] = false;
+                if (s.links[e->hub].connected) {
+                    ble_sched_disconnected(&s, e->hub, now);
+                    next_scan_us = now + ble_sched_backoff_ms(&s) * 1000LL;
+                }
+            } else if (strcmp(e->what, "wifi") == 0) {
+                wifi_kbps = e->n;
+            }
+        }
+        wifi_bytes += (uint32_t)((uint64_t)wifi_kbps * STEP_US / 8000);
+
+        // Pending parameter updates reach their instant
+        for (int i = 0; i < hub_slots; i++) {
+            if (update_at_us[i] >= 0 && now >= update_at_us[i]) {
+                const ble_sched_conn_params_t *p = ble_sched_params(&s, update_mode[i]);
+                ble_sched_params_updated(&s, i, p->itvl_max, p->latency, now);
+                update_at_us[i] = -1;
+            }
+        }
+
+        // Commands: queued now, delivered when the hub next listens, acked one event later
+        for (int c = 0; c < cmd_count; c++) {
+            int hub = cmds[c].hub;
+            if (cmds[c].at_us == now && hub < hub_slots && s.links[hub].connected) {
+                ble_sched_link_t *l = &s.links[hub];
+                int64_t itvl_us = (int64_t)l->itvl * BLE_SCHED_ITVL_US;
+                int64_t delay = itvl_us * (l->latency + 1) + itvl_us;
+                if (ble_sched_command(&s, hub, now)) {
+                    update_mode[hub] = BLE_LINK_ACTIVE;
+                    update_at_us[hub] = now + itvl_us * UPDATE_INSTANT_EVENTS;
+                }
+                done_at_us[c] = now + delay;
+                delay_sum_ms += delay / 1000.0;
+                if (delay / 1000.0 > r.delay_max_ms) {
+                    r.delay_max_ms = delay / 1000.0;
+                }
+                r.commands++;
+            }
+            if (done_at_us[c] >= 0 && now >= done_at_us[c]) {
+                ble_sched_command_done(&s, hub, now);
+                done_at_us[c] = -1;
+            }
+        }
+
+        // Scanner: bursts while a slot is free
+        int free_slots = 0;
+        for (int i = 0; i < hub_slots; i++) {
+            free_slots += !s.links[i].connected;
+        }
+        if (s.scanning) {
+            int found = -1;
+            for (int i = 0; i < hub_slots && found < 0; i++) {
+                if (!s.links[i].connected && present[i]) {
+                    found = i;
+                }
+            }
+            if (found >= 0) {
+                ble_sched_scan_done(&s, true, now);
+                ble_sched_connected(&s, found, cfg->active.itvl_max, cfg->active.latency, now);
+                double took = (now - appeared_us[found]) / 1e6;
+                if (took > r.reconnect_max_s) {
+                    r.reconnect_max_s = took;
+                }
+                if (verbose) {
+                    printf("%7.2f  hub %d connected after %.1f s\n", now / 1e6, found, took);
+                }
+                next_scan_us = now;
+            } else if (now >= scan_end_us) {
+                next_scan_us = now + ble_sched_scan_done(&s, false, now) * 1000LL;
+            }
+        } else if (free_slots > 0 && now >= next_scan_us) {
+            uint16_t itvl, window;
+            ble_sched_scan_started(&s, &itvl, &window, now);
+            scan_end_us = now + cfg->scan_duration_ms * 1000LL;
+        }
+
+        if (now % TICK_US == 0) {
+            ble_sched_wifi_sample(&s, wifi_bytes, now);
+            uint32_t to_idle = ble_sched_tick(&s, now);
+            for (int i = 0; i < hub_slots; i++) {
+                if (to_idle & (1u << i)) {
+                    update_mode[i] = BLE_LINK_IDLE;
+                    update_at_us[i] = now + (int64_t)s.links[i].itvl * BLE_SCHED_ITVL_US * UPDATE_INSTANT_EVENTS;
+                }
+            }
+            uint32_t duty = ble_sched_duty_permille(&s);
+            if (duty > r.peak_duty) {
+                r.peak_duty = duty;
+            }
+            if (verbose && now % 5000000 == 0) {
+                printf("%7.2f  duty %4.1f%%  wifi %5lu kbit/s  scan %-3s", now / 1e6, duty / 10.0,
+                    (unsigned long)s.wifi_kbps, s.scanning ? (s.scan_busy ? "nar" : "on") : "off");
+                for (int i = 0; i < hub_slots; i++) {
+                    const ble_sched_link_t *l = &s.links[i];
+                    if (l->connected) {
+                        printf("  hub%d %-6s %5.1fms/L%d", i, ble_link_mode_str(l->mode), l->itvl * 1.25, l->latency);
+                    } else {
+                        printf("  hub%d %-18s", i, "-");
+                    }
+                }
+                printf("\n");
+            }
+        }
+    }
+
+    r.avg_duty = ble_sched_avg_duty_permille(&s, end_us);
+    for (int i = 0; i < hub_slots; i++) {
+        r.active_s[i] = s.links[i].active_us / 1e6;
+        r.switches += s.links[i].switches;
+    }
+    r.delay_avg_ms = r.commands ? delay_sum_ms / r.commands : 0;
+    r.scan_bursts = s.scan_bursts;
+    r.scan_s = s.scan_us / 1e6;
+    return r;
+}
+
+static void print_result(const char *name, const sim_result_t *r) {
+    double active = 0;
+    for (int i = 0; i < hub_slots; i++) {
+        active += r->active_s[i];
+    }
+    printf("%-8s %8.1f%% %8.1f%% %9.1f %8lu %6d %8.0f/%-6.0f %9.1f %6lu %7.1f\n",
+        name, r->avg_duty / 10.0, r->peak_duty / 10.0, active, (unsigned long)r->switches,
+        r->commands, r->delay_avg_ms, r->delay_max_ms, r->reconnect_max_s,
+        (unsigned long)r->scan_bursts, r->scan_s);
+}
+
+int main(int argc, char **argv) {
+    static char text[65536];
+    if (argc > 1) {
+        FILE *f = fopen(argv[1], "r");
+        if (!f) {
+            perror(argv[1]);
+            return 1;
+        }
+        size_t n = fread(text, 1, sizeof(text) - 1, f);
+        text[n] = '\0';
+        fclose(f);
+    } else {
+        strcpy(text, builtin_script);
+    }
+    parse_script(text);
+
+    ble_sched_config_t policy = ble_sched_default_config();
+
+    // The firmware before the scheduler: short interval always, 10 s scans
+    // with a 0.5 s gap, 2 s after a disconnect
+    ble_sched_config_t fixed = policy;
+    fixed.idle = fixed.active;
+    fixed.scan_window_busy = fixed.scan_window;
+    fixed.scan_duration_ms = 10000;
+    fixed.scan_backoff_min_ms = 500;
+    fixed.scan_backoff_max_ms = 500;
+
+    printf("policy timeline (%d hub slots)\n", hub_slots);
+    sim_result_t r_policy = run(&policy, true);
+    sim_result_t r_fixed = run(&fixed, false);
+
+    printf("\n%-8s %9s %9s %9s %8s %6s %15s %9s %6s %7s\n",
+        "config", "avg duty", "peak", "active s", "updates", "cmds", "delay avg/max", "reconn s", "scans", "scan s");
+    print_result("policy", &r_policy);
+    print_result("fixed", &r_fixed);
+    return 0;
+}
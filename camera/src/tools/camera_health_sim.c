@@ -0,0 +1,284 @@
+// Host simulation of the camera health supervisor (main/camera_health.h).
+//
+// A fault-injecting fake camera runs in simulated time with one stream
+// viewer grabbing frames the way stream_handler does (retry 100 ms after a
+// failed grab) and the supervisor task polling the real policy code every
+// 100 ms. Grabs are serialized as they are by camera_pipeline_mutex, and a
+// driver restart waits for the grab in flight like camera_pipeline_pause().
+// A restart that cannot drain a frame another consumer holds is abandoned
+// and counts as failed, as camera_restart() does.
+// Each scenario injects one kind of fault:
+//
+//   glitch    two failed grabs; no recovery should start
+//   brownout  sensor stops sending frames (DMA timeouts); an SCCB reset fixes it
+//   stuck     DMA stuck until the driver is restarted
+//   dead      sensor off the bus for 10 s: resets and restarts fail, viewers
+//             are parked, restarts retried with backoff
+//   corrupt   every frame takes 600 ms (the driver drops corrupt ones); a
+//             reset fixes it
+//   idle      brownout while the viewer leaves; the supervisor grabs frames
+//             itself to verify the recovery
+//   held      stuck DMA while a second consumer (a client on a stalled
+//             socket) holds its last frame for 8 s; restarts wait for it
+//
+// and checks the steps taken and the time to recover.
+//
+//   cc -O2 -Imain tools/camera_health_sim.c -o camera_health_sim   (from camera/src)
+//   ./camera_health_sim        # add -v for the state transitions
+//
+// Exits non-zero if a scenario does not recover as expected.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "camera_health.h"
+
+#define STEP_US 10000
+#define POLL_US 100000
+#define FRAME_US 40000          // Wait for the next frame when all is well
+#define DRIVER_TIMEOUT_US 4000000
+#define RETRY_US 100000         // stream_handler after a failed grab
+#define SLOW_FRAME_US 600000
+#define RESET_US 100000         // SCCB reset plus the preset
+#define RESTART_US 800000       // esp_camera_deinit() + camera_start() + preset
+#define RESTART_FAIL_US 300000  // Sensor probe failing
+#define DRAIN_US 500000         // CAMERA_SWITCH_DRAIN_MS
+#define FAULT_AT_US 5000000
+#define RUN_US 60000000
+
+typedef enum { FAULT_GLITCH, FAULT_STUCK, FAULT_DEAD, FAULT_SLOW } fault_kind_t;
+typedef enum { CURE_NONE, CURE_RESET, CURE_RESTART } cure_t;
+
+typedef struct {
+    const char *name;
+    fault_kind_t kind;
+    cure_t cure;                // Weakest step that clears the fault
+    int64_t dead_us;            // FAULT_DEAD: sensor back after this long
+    bool viewer_leaves;         // Viewer gone 500 ms into the fault
+    int64_t hold_us;            // A frame held from the fault on this long
+    // Expected outcome
+    uint32_t recoveries;
+    uint32_t restarts;          // Exact number of restarts, or...
+    bool restarts_at_least;     // ...at least that many
+    uint32_t max_mttr_ms;
+} scenario_t;
+
+static const scenario_t scenarios[] = {
+    { "glitch",   FAULT_GLITCH, CURE_NONE,    0,        false, 0,       0, 0, false, 0 },
+    { "brownout", FAULT_STUCK,  CURE_RESET,   0,        false, 0,       1, 0, false, 2000 },
+    { "stuck",    FAULT_STUCK,  CURE_RESTART, 0,        false, 0,       1, 1, false, 6000 },
+    { "dead",     FAULT_DEAD,   CURE_RESTART, 10000000, false, 0,       1, 3, true,  20000 },
+    { "corrupt",  FAULT_SLOW,   CURE_RESET,   0,        false, 0,       1, 0, false, 5000 },
+    { "idle",     FAULT_STUCK,  CURE_RESET,   0,        true,  0,       1, 0, false, 2000 },
+    { "held",     FAULT_STUCK,  CURE_RESTART, 0,        false, 8000000, 1, 2, true,  12000 },
+};
+
+// The fake camera
+typedef struct {
+    const scenario_t *sc;
+    bool faulty;
+    int glitches;               // Failed grabs left for FAULT_GLITCH
+} fake_camera_t;
+
+static bool camera_dead(const fake_camera_t *cam, int64_t now) {
+    return cam->faulty && cam->sc->kind == FAULT_DEAD && now < FAULT_AT_US + cam->sc->dead_us;
+}
+
+// A grab in the driver
+typedef struct {
+    bool busy;
+    bool mine;                  // Supervisor's own verification grab
+    int64_t start;
+    int64_t done;               // When it returns
+    bool ok;
+} grab_t;
+
+static void grab_start(grab_t *g, fake_camera_t *cam, camera_health_t *h, int64_t now, bool mine) {
+    camera_health_begin(h, now);
+    g->busy = true;
+    g->mine = mine;
+    g->start = now;
+    g->ok = true;
+    g->done = now + FRAME_US;
+    if (!cam->faulty) {
+        return;
+    }
+    switch (cam->sc->kind) {
+        case FAULT_GLITCH:
+            if (cam->glitches > 0) {
+                cam->glitches--;
+                g->ok = false;
+                g->done = now + STEP_US;
+            }
+            break;
+        case FAULT_STUCK:
+        case FAULT_DEAD:
+            g->ok = false;
+            g->done = now + DRIVER_TIMEOUT_US;
+            break;
+        case FAULT_SLOW:
+            g->done = now + SLOW_FRAME_US;
+            break;
+    }
+}
+
+typedef struct {
+    uint32_t frames;
+    uint32_t parked_grabs;      // Grabs that went into the driver while DOWN
+    uint32_t freed_held;        // Restarts that freed a frame still held
+    int64_t parked_us;
+} sim_result_t;
+
+static bool verbose;
+
+static void run(const scenario_t *sc, camera_health_t *h, sim_result_t *r) {
+    camera_health_config_t cfg = camera_health_default_config();
+    camera_health_init(h, &cfg, 0);
+    fake_camera_t cam = { .sc = sc };
+    grab_t grab = {0};
+    int64_t viewer_next = 0;
+    int64_t step_busy_until = 0;    // Supervisor busy with a recovery step
+    camera_health_action_t step = CAMERA_HEALTH_NONE;
+    bool step_ok = false;
+    bool step_needs_pipeline = false;
+    int64_t next_poll = 0;
+    camera_health_state_t last = CAMERA_HEALTH_OK;
+    memset(r, 0, sizeof(*r));
+
+    for (int64_t now = 0; now < RUN_US; now += STEP_US) {
+        if (!cam.faulty && now == FAULT_AT_US && h->recoveries == 0) {
+            cam.faulty = true;
+            cam.glitches = 2;
+        }
+        if (cam.faulty && sc->kind == FAULT_GLITCH && cam.glitches == 0) {
+            cam.faulty = false;
+        }
+        bool viewer = !(sc->viewer_leaves && now >= FAULT_AT_US + 500000);
+
+        // Grab in flight
+        if (grab.busy && now >= grab.done) {
+            grab.busy = false;
+            camera_health_grab(h, now, grab.ok, (uint32_t)(now - grab.start));
+            if (grab.ok && !grab.mine) {
+                r->frames++;
+            }
+            if (!grab.mine) {
+                viewer_next = now + (grab.ok ? 0 : RETRY_US);
+            }
+        }
+
+        // Recovery step in progress; a restart first waits for the pipeline,
+        // then up to DRAIN_US for a held frame
+        int64_t held_until = sc->hold_us ? FAULT_AT_US + sc->hold_us : 0;
+        if (step != CAMERA_HEALTH_NONE && step_needs_pipeline && !grab.busy) {
+            step_needs_pipeline = false;
+            if (now < held_until && held_until - now > DRAIN_US) {
+                step_ok = false;
+                step_busy_until = now + DRAIN_US;
+            } else {
+                int64_t drained = now < held_until ? held_until : now;
+                bool dead = camera_dead(&cam, drained);
+                step_ok = !dead;
+                step_busy_until = drained + (dead ? RESTART_FAIL_US : RESTART_US);
+                if (step_ok && drained < held_until) {
+                    r->freed_held++;
+                }
+            }
+        }
+        if (step != CAMERA_HEALTH_NONE && !step_needs_pipeline && now >= step_busy_until) {
+            if (step_ok && cam.faulty && (sc->cure == CURE_RESET || step == CAMERA_HEALTH_RESTART)) {
+                cam.faulty = false;
+                if (grab.busy && grab.done > now + FRAME_US) {
+                    grab.ok = true;     // The blocked grab gets the first new frame
+                    grab.done = now + FRAME_US;
+                }
+            }
+            camera_health_done(h, step, step_ok, now);
+            step = CAMERA_HEALTH_NONE;
+        }
+
+        // Supervisor task
+        if (step == CAMERA_HEALTH_NONE && now >= next_poll) {
+            next_poll = now + POLL_US;
+            step = camera_health_poll(h, now);
+            if (step == CAMERA_HEALTH_RESET_SENSOR) {
+                step_ok = !camera_dead(&cam, now);
+                step_busy_until = now + RESET_US;
+            } else if (step == CAMERA_HEALTH_RESTART) {
+                step_needs_pipeline = true;
+            } else if (!grab.busy && camera_health_needs_frame(h, now)) {
+                grab_start(&grab, &cam, h, now, true);
+            }
+        }
+        if (h->state != last) {
+            if (verbose) {
+                printf("  %7.2f s  %s -> %s\n", now / 1e6, camera_health_state_str(last),
+                    camera_health_state_str(h->state));
+            }
+            last = h->state;
+        }
+
+        // Viewer: parked while DOWN, blocked while a restart holds the pipeline
+        bool pipeline_held = step == CAMERA_HEALTH_RESTART && !step_needs_pipeline;
+        if (camera_health_parked(h)) {
+            r->parked_us += STEP_US;
+        } else if (viewer && !grab.busy && !pipeline_held && now >= viewer_next) {
+            grab_start(&grab, &cam, h, now, false);
+            if (camera_health_parked(h)) {
+                r->parked_grabs++;
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+    int failed = 0;
+
+    printf("%-9s %6s %6s %9s %10s %6s %8s %8s %8s %7s\n", "scenario", "faults", "resets", "restarts",
+        "recovered", "MTTR", "max", "down", "parked", "frames");
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        const scenario_t *sc = &scenarios[i];
+        camera_health_t h;
+        sim_result_t r;
+        if (verbose) {
+            printf("%s\n", sc->name);
+        }
+        run(sc, &h, &r);
+
+        char restarts[24];
+        snprintf(restarts, sizeof(restarts), "%lu/%lu", (unsigned long)h.restarts,
+            (unsigned long)h.restart_failures);
+        printf("%-9s %6lu %6lu %9s %10lu %4lu ms %5lu ms %5lu ms %5lu ms %7lu\n", sc->name,
+            (unsigned long)h.faults, (unsigned long)h.sensor_resets, restarts, (unsigned long)h.recoveries,
+            (unsigned long)(camera_health_avg_recovery_us(&h) / 1000), (unsigned long)(h.max_recovery_us / 1000),
+            (unsigned long)camera_health_down_ms(&h), (unsigned long)(r.parked_us / 1000), (unsigned long)r.frames);
+
+        const char *why = NULL;
+        if (h.recoveries != sc->recoveries) {
+            why = "wrong number of recoveries";
+        } else if (sc->restarts_at_least ? h.restarts < sc->restarts : h.restarts != sc->restarts) {
+            why = "wrong number of restarts";
+        } else if (sc->recoveries && h.max_recovery_us > sc->max_mttr_ms * 1000) {
+            why = "recovery too slow";
+        } else if (h.state != CAMERA_HEALTH_OK) {
+            why = "did not end up OK";
+        } else if (r.parked_grabs) {
+            why = "a viewer grabbed while the camera was down";
+        } else if (sc->kind == FAULT_DEAD && r.parked_us == 0) {
+            why = "viewers were not parked";
+        } else if (sc->kind == FAULT_GLITCH && h.faults) {
+            why = "a glitch started a recovery";
+        } else if (r.freed_held) {
+            why = "a restart freed a frame still held";
+        } else if (sc->hold_us && h.restart_failures == 0) {
+            why = "a restart did not wait for the held frame";
+        }
+        if (why) {
+            printf("  FAIL: %s\n", why);
+            failed++;
+        }
+    }
+    printf("%s\n", failed ? "FAILED" : "all scenarios recovered as expected");
+    return failed ? 1 : 0;
+}
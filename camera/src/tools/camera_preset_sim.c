@@ -0,0 +1,367 @@
+// Host checks of the preset applier (main/camera_preset.h) against a fake
+// sensor.
+//
+// The fake sensor_t records every setter call in order, with the time it
+// would take on the sensor: SCCB writes at 100 kHz for the registers each
+// setter touches, plus the PLL settling after an XCLK change. As on the
+// real sensors, a framesize or window change reloads the register tables
+// and undoes the DSP settings (quality, gain, exposure), so a setting
+// written before the reframe is lost. For both supported sensors it checks:
+//
+//   - the exact write order for each built-in preset from a fresh sensor
+//   - the exact writes for a set of switches between presets, including
+//     presets with a sensor window and with manual exposure and gain
+//   - for every pair of presets: XCLK first, then framesize or window,
+//     then the DSP registers; no setting written twice; nothing written
+//     when switching to the preset that is already active; and the sensor
+//     ends up with every setting of the new preset
+//   - that a failed write is counted and does not stop the others
+//
+// and prints the writes and modelled time of each switch.
+//
+//   cc -O2 -Itools/host -Imain tools/camera_preset_sim.c -o camera_preset_sim   (from camera/src)
+//   ./camera_preset_sim        # add -v for every switch between presets
+//
+// Exits non-zero if a check fails.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "camera_preset.h"
+
+#define MAX_WRITES 32
+#define SCCB_WRITE_US 400       // One register write at 100 kHz, with start and stop
+#define PLL_SETTLE_US 5000
+#define LOST -1                 // DSP setting undone by a table reload
+
+typedef enum { RANK_CLOCK, RANK_FRAME, RANK_DSP } write_rank_t;
+
+typedef struct {
+    const char *op;
+    write_rank_t rank;
+    int regs;                   // SCCB writes the setter makes
+} op_info_t;
+
+static const op_info_t ops[] = {
+    { "xclk", RANK_CLOCK, 0 },
+    { "framesize", RANK_FRAME, 40 },    // Mode table, output size and DSP scaler
+    { "res_raw", RANK_FRAME, 24 },
+    { "quality", RANK_DSP, 1 },
+    { "gainceiling", RANK_DSP, 2 },
+    { "exposure_ctrl", RANK_DSP, 1 },
+    { "aec2", RANK_DSP, 1 },
+    { "ae_level", RANK_DSP, 6 },        // AE target window registers
+    { "aec_value", RANK_DSP, 3 },
+    { "gain_ctrl", RANK_DSP, 1 },
+    { "agc_gain", RANK_DSP, 2 },
+};
+
+// What the sensor is actually doing, as opposed to sensor_t.status
+typedef struct {
+    int xclk_mhz;
+    int framesize;
+    bool windowed;
+    int quality, gainceiling, aec, aec2, ae_level, aec_value, agc, agc_gain;
+} fake_hw_t;
+
+typedef struct {
+    sensor_t s;                 // First, so a sensor_t * is a fake_sensor_t *
+    fake_hw_t hw;
+    const char *log[MAX_WRITES];
+    int count;
+    int64_t clock_us;
+    const char *fail_op;        // Setter that reports an error
+} fake_sensor_t;
+
+static const op_info_t *op_info(const char *op) {
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        if (!strcmp(ops[i].op, op)) {
+            return &ops[i];
+        }
+    }
+    return NULL;
+}
+
+static int record(sensor_t *s, const char *op) {
+    fake_sensor_t *f = (fake_sensor_t *)s;
+    if (f->count < MAX_WRITES) {
+        f->log[f->count] = op;
+    }
+    f->count++;
+    const op_info_t *info = op_info(op);
+    f->clock_us += info->regs * SCCB_WRITE_US + (info->rank == RANK_CLOCK ? PLL_SETTLE_US : 0);
+    return f->fail_op && !strcmp(f->fail_op, op) ? -1 : 0;
+}
+
+static void reload_tables(fake_sensor_t *f) {
+    f->hw.quality = f->hw.gainceiling = f->hw.aec = f->hw.aec2 = LOST;
+    f->hw.ae_level = f->hw.aec_value = f->hw.agc = f->hw.agc_gain = LOST;
+}
+
+static int fake_set_xclk(sensor_t *s, int timer, int xclk) {
+    fake_sensor_t *f = (fake_sensor_t *)s;
+    s->xclk_freq_hz = xclk * 1000000;
+    f->hw.xclk_mhz = xclk;
+    return record(s, "xclk");
+}
+
+static int fake_set_framesize(sensor_t *s, framesize_t framesize) {
+    fake_sensor_t *f = (fake_sensor_t *)s;
+    s->status.framesize = framesize;
+    f->hw.framesize = framesize;
+    f->hw.windowed = false;
+    reload_tables(f);
+    return record(s, "framesize");
+}
+
+static int fake_set_res_raw(sensor_t *s, int start_x, int start_y, int end_x, int end_y, int offset_x, int offset_y,
+                            int total_x, int total_y, int output_x, int output_y, bool scale, bool binning) {
+    fake_sensor_t *f = (fake_sensor_t *)s;
+    f->hw.windowed = true;
+    reload_tables(f);
+    s->status.scale = scale;
+    s->status.binning = binning;
+    // The output stays at the framesize: the window is zoomed, not cropped
+    bool ok = output_x == resolution[f->hw.framesize].width && output_y == resolution[f->hw.framesize].height;
+    return record(s, "res_raw") || !ok ? -1 : 0;
+}
+
+#define FAKE_SETTER(name, field, type)                          \
+    static int fake_set_##name(sensor_t *s, type value) {       \
+        fake_sensor_t *f = (fake_sensor_t *)s;                  \
+        s->status.field = value;                                \
+        f->hw.field = value;                                    \
+        return record(s, #name);                                \
+    }
+
+FAKE_SETTER(quality, quality, int)
+FAKE_SETTER(gainceiling, gainceiling, gainceiling_t)
+FAKE_SETTER(exposure_ctrl, aec, int)
+FAKE_SETTER(aec2, aec2, int)
+FAKE_SETTER(ae_level, ae_level, int)
+FAKE_SETTER(aec_value, aec_value, int)
+FAKE_SETTER(gain_ctrl, agc, int)
+FAKE_SETTER(agc_gain, agc_gain, int)
+
+// A sensor fresh from camera_start(): 20 MHz XCLK at the largest framesize
+static void fake_sensor_init(fake_sensor_t *f, uint16_t pid) {
+    *f = (fake_sensor_t){0};
+    f->s.id.PID = pid;
+    f->s.set_xclk = fake_set_xclk;
+    f->s.set_framesize = fake_set_framesize;
+    f->s.set_res_raw = fake_set_res_raw;
+    f->s.set_quality = fake_set_quality;
+    f->s.set_gainceiling = fake_set_gainceiling;
+    f->s.set_exposure_ctrl = fake_set_exposure_ctrl;
+    f->s.set_aec2 = fake_set_aec2;
+    f->s.set_ae_level = fake_set_ae_level;
+    f->s.set_aec_value = fake_set_aec_value;
+    f->s.set_gain_ctrl = fake_set_gain_ctrl;
+    f->s.set_agc_gain = fake_set_agc_gain;
+    f->s.xclk_freq_hz = 20000000;
+    f->s.status = (camera_status_t){ .framesize = FRAMESIZE_UXGA, .quality = 12, .aec = 1, .agc = 1 };
+    f->hw = (fake_hw_t){ .xclk_mhz = 20, .framesize = FRAMESIZE_UXGA, .quality = 12, .aec = 1, .agc = 1 };
+}
+
+static void fake_sensor_clear_log(fake_sensor_t *f) {
+    f->count = 0;
+    f->clock_us = 0;
+}
+
+static void log_str(const fake_sensor_t *f, char *buf, size_t cap) {
+    buf[0] = '\0';
+    for (int i = 0; i < f->count && i < MAX_WRITES; i++) {
+        size_t len = strlen(buf);
+        snprintf(buf + len, cap - len, "%s%s", i ? " " : "", f->log[i]);
+    }
+}
+
+// Presets beyond the built-in ones: a zoom window, and manual exposure and gain
+static const camera_preset_t window_preset = {
+    .version = CAMERA_PRESET_VERSION, .name = "bridge",
+    .framesize = FRAMESIZE_SVGA, .quality = 20, .xclk_mhz = 20,
+    .gainceiling = GAINCEILING_4X, .aec = false, .aec2 = false, .aec_value = 300,
+    .agc = false, .agc_gain = 5, .window = { 250, 250, 500, 500 },
+};
+static const camera_preset_t manual_preset = {
+    .version = CAMERA_PRESET_VERSION, .name = "tunnel",
+    .framesize = FRAMESIZE_VGA, .quality = 24, .xclk_mhz = 10,
+    .gainceiling = GAINCEILING_16X, .aec = false, .aec2 = false, .aec_value = 800,
+    .agc = false, .agc_gain = 12,
+};
+
+#define PRESET_COUNT (CAMERA_PRESET_COUNT + 2)
+
+static const camera_preset_t *preset_at(size_t i) {
+    return i < CAMERA_PRESET_COUNT ? &camera_builtin_presets[i]
+        : i == CAMERA_PRESET_COUNT ? &window_preset : &manual_preset;
+}
+
+static const camera_preset_t *preset_named(const char *name) {
+    for (size_t i = 0; i < PRESET_COUNT; i++) {
+        if (!strcmp(preset_at(i)->name, name)) {
+            return preset_at(i);
+        }
+    }
+    return NULL;
+}
+
+static int failures = 0;
+
+static void check(bool ok, uint16_t pid, const char *what) {
+    if (!ok) {
+        fprintf(stderr, "FAIL: sensor 0x%x: %s\n", pid, what);
+        failures++;
+    }
+}
+
+// The sensor is doing exactly what `p` asks for
+static bool fake_matches(const fake_sensor_t *f, const camera_preset_t *p) {
+    const fake_hw_t *hw = &f->hw;
+    bool ok = hw->xclk_mhz == p->xclk_mhz && hw->framesize == (int)p->framesize
+        && hw->windowed == (p->window.w != 0)
+        && hw->quality == p->quality && hw->gainceiling == (int)p->gainceiling
+        && hw->aec == p->aec && hw->aec2 == p->aec2 && hw->agc == p->agc;
+    ok = ok && (p->aec ? hw->ae_level == p->ae_level : hw->aec_value == p->aec_value);
+    return ok && (p->agc || hw->agc_gain == p->agc_gain);
+}
+
+// Write order and coverage that hold for any switch
+static void check_switch(const fake_sensor_t *f, const camera_preset_t *cur, const camera_preset_t *next, int failed) {
+    char what[160];
+    snprintf(what, sizeof(what), "%s -> %s", cur ? cur->name : "(fresh)", next->name);
+    check(failed == 0, f->s.id.PID, what);
+    check(f->count <= MAX_WRITES, f->s.id.PID, what);
+    int last_rank = RANK_CLOCK;
+    for (int i = 0; i < f->count && i < MAX_WRITES; i++) {
+        const op_info_t *info = op_info(f->log[i]);
+        snprintf(what, sizeof(what), "%s -> %s: %s out of order", cur ? cur->name : "(fresh)", next->name,
+            f->log[i]);
+        check(info->rank >= last_rank, f->s.id.PID, what);
+        last_rank = info->rank;
+        for (int j = 0; j < i; j++) {
+            snprintf(what, sizeof(what), "%s -> %s: %s written twice", cur ? cur->name : "(fresh)", next->name,
+                f->log[i]);
+            check(strcmp(f->log[i], f->log[j]) != 0, f->s.id.PID, what);
+        }
+    }
+    snprintf(what, sizeof(what), "%s -> %s: sensor does not match the preset", cur ? cur->name : "(fresh)",
+        next->name);
+    check(fake_matches(f, next), f->s.id.PID, what);
+}
+
+typedef struct {
+    const char *from;           // NULL: fresh sensor, every setting written
+    const char *to;
+    const char *writes;
+} expected_switch_t;
+
+static const expected_switch_t expected[] = {
+    { NULL, "day", "xclk framesize quality gainceiling exposure_ctrl aec2 ae_level gain_ctrl" },
+    { NULL, "dusk", "xclk framesize quality gainceiling exposure_ctrl aec2 ae_level gain_ctrl" },
+    { NULL, "fast-motion", "xclk framesize quality gainceiling exposure_ctrl aec2 ae_level gain_ctrl" },
+    // From UXGA the framesize is already right, but a fresh preset still writes it
+    { NULL, "archive-quality", "xclk framesize quality gainceiling exposure_ctrl aec2 ae_level gain_ctrl" },
+    { NULL, "bridge", "xclk framesize res_raw quality gainceiling exposure_ctrl aec2 aec_value gain_ctrl agc_gain" },
+    { NULL, "tunnel", "xclk framesize quality gainceiling exposure_ctrl aec2 aec_value gain_ctrl agc_gain" },
+    { "day", "day", "" },
+    // Same framesize: only the settings that differ
+    { "day", "dusk", "xclk quality gainceiling aec2 ae_level" },
+    { "dusk", "day", "xclk quality gainceiling aec2 ae_level" },
+    { "dusk", "fast-motion", "xclk framesize quality gainceiling exposure_ctrl aec2 ae_level gain_ctrl" },
+    { "day", "archive-quality", "framesize quality gainceiling exposure_ctrl aec2 ae_level gain_ctrl" },
+    // A window at the current framesize needs no framesize write
+    { "day", "bridge", "res_raw quality gainceiling exposure_ctrl aec2 aec_value gain_ctrl agc_gain" },
+    { "bridge", "day", "framesize quality gainceiling exposure_ctrl aec2 ae_level gain_ctrl" },
+    { "fast-motion", "bridge", "framesize res_raw quality gainceiling exposure_ctrl aec2 aec_value gain_ctrl agc_gain" },
+    { "tunnel", "day", "xclk framesize quality gainceiling exposure_ctrl aec2 ae_level gain_ctrl" },
+};
+
+// Bring a fake sensor to `p` as camera_control.h would at boot
+static void fake_sensor_at(fake_sensor_t *f, uint16_t pid, const camera_preset_t *p) {
+    fake_sensor_init(f, pid);
+    if (p) {
+        camera_preset_apply(&f->s, NULL, p);
+    }
+    fake_sensor_clear_log(f);
+}
+
+static void run_sensor(uint16_t pid, const char *name, bool verbose) {
+    printf("\n%s (PID 0x%x)\n", name, pid);
+    printf("  %-34s %6s %8s  %s\n", "switch", "writes", "time", "order");
+    fake_sensor_t f;
+
+    for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) {
+        const camera_preset_t *cur = expected[i].from ? preset_named(expected[i].from) : NULL;
+        const camera_preset_t *next = preset_named(expected[i].to);
+        fake_sensor_at(&f, pid, cur);
+        int failed = camera_preset_apply(&f.s, cur, next);
+        check_switch(&f, cur, next, failed);
+        char got[512], label[48];
+        log_str(&f, got, sizeof(got));
+        if (strcmp(got, expected[i].writes) != 0) {
+            char what[1200];
+            snprintf(what, sizeof(what), "%s -> %s wrote \"%s\", expected \"%s\"", cur ? cur->name : "(fresh)",
+                next->name, got, expected[i].writes);
+            check(false, pid, what);
+        }
+        snprintf(label, sizeof(label), "%s -> %s", cur ? cur->name : "(fresh)", next->name);
+        printf("  %-34s %6d %5.1f ms  %s\n", label, f.count, f.clock_us / 1000.0, got);
+    }
+
+    // Every pair, and each preset again over itself
+    int64_t dsp_max = 0, reframe_min = INT64_MAX;
+    for (size_t a = 0; a < PRESET_COUNT; a++) {
+        for (size_t b = 0; b < PRESET_COUNT; b++) {
+            fake_sensor_at(&f, pid, preset_at(a));
+            int failed = camera_preset_apply(&f.s, preset_at(a), preset_at(b));
+            check_switch(&f, preset_at(a), preset_at(b), failed);
+            bool reframed = false;
+            for (int i = 0; i < f.count && i < MAX_WRITES; i++) {
+                reframed |= op_info(f.log[i])->rank == RANK_FRAME;
+            }
+            if (reframed && f.clock_us < reframe_min) {
+                reframe_min = f.clock_us;
+            } else if (!reframed && f.clock_us > dsp_max) {
+                dsp_max = f.clock_us;
+            }
+            if (verbose) {
+                char got[512], label[48];
+                log_str(&f, got, sizeof(got));
+                snprintf(label, sizeof(label), "%s -> %s", preset_at(a)->name, preset_at(b)->name);
+                printf("  %-34s %6d %5.1f ms  %s\n", label, f.count, f.clock_us / 1000.0, got);
+            }
+
+            int before = f.count;
+            camera_preset_apply(&f.s, preset_at(b), preset_at(b));
+            check(f.count == before, pid, "applying the active preset again wrote something");
+        }
+    }
+    check(dsp_max < reframe_min, pid, "a switch without a reframe took as long as one with");
+    printf("  slowest switch without a reframe %.1f ms, fastest with one %.1f ms\n", dsp_max / 1000.0,
+        reframe_min / 1000.0);
+
+    // A failing setter is counted and the rest still go out
+    fake_sensor_at(&f, pid, preset_named("day"));
+    f.fail_op = "gainceiling";
+    int failed = camera_preset_apply(&f.s, preset_named("day"), preset_named("dusk"));
+    char got[512];
+    log_str(&f, got, sizeof(got));
+    check(failed == 1, pid, "failed write not counted");
+    check(!strcmp(got, "xclk quality gainceiling aec2 ae_level"), pid, "writes stopped after a failure");
+}
+
+int main(int argc, char **argv) {
+    bool verbose = argc > 1 && !strcmp(argv[1], "-v");
+    for (size_t i = 0; i < PRESET_COUNT; i++) {
+        check(camera_preset_valid(preset_at(i)), 0, "preset does not validate");
+    }
+    run_sensor(OV3660_PID, "OV3660", verbose);
+    run_sensor(OV2640_PID, "OV2640", verbose);
+    if (failures) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("\nall checks ok\n");
+    return 0;
+}
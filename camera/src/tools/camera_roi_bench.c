@@ -0,0 +1,255 @@
+// Host checks of the ROI to sensor-window mapping (main/camera_roi.h).
+//
+// For every framesize each sensor supports (OV2640 up to UXGA, OV3660 up to
+// QXGA), in crop and zoom mode, a grid of requested ROIs is mapped to
+// set_res_raw() parameters: windows inside the frame, at and past its edges,
+// with negative origins, zero, odd and sub-minimum sizes, and windows
+// larger than the frame or the whole sensor. Each result must:
+//
+//   - lie inside the frame, at least 64x48, and for crop output whole JPEG
+//     MCUs (16x8) at the requested size after clamping
+//   - for zoom, output the full framesize
+//   - program a window that lies inside the sensor's readout area, in the
+//     units the sensor wants (multiples of 4 on the OV2640, an even Bayer
+//     origin on the OV3660), with at least as many pixels as it outputs,
+//     since the DSP only scales down
+//   - map an already clamped ROI to itself, so asking again for the ROI
+//     the response reported changes nothing
+//   - only grow the clamped ROI, around itself, when the sensor lacks the
+//     pixels to fill the output from it
+//
+// A full-frame crop must program the framesize's own full-FOV window.
+// Unknown sensors and framesizes must be refused. The tool also times
+// camera_roi_compute().
+//
+//   cc -O2 -Itools/host -Imain tools/camera_roi_bench.c -o camera_roi_bench   (from camera/src)
+//   ./camera_roi_bench         # add -v to list every failure
+//
+// Exits non-zero if a check fails.
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "camera_roi.h"
+
+typedef struct {
+    const char *name;
+    uint16_t pid;
+    framesize_t max_framesize;
+} sensor_info_t;
+
+static const sensor_info_t sensors[] = {
+    { "OV2640", OV2640_PID, FRAMESIZE_UXGA },
+    { "OV3660", OV3660_PID, FRAMESIZE_QXGA },
+};
+
+static const char *const framesize_names[FRAMESIZE_INVALID] = {
+    "96X96", "QQVGA", "128X128", "QCIF", "HQVGA", "240X240", "QVGA", "320X320", "CIF", "HVGA", "VGA", "SVGA",
+    "XGA", "HD", "SXGA", "UXGA", "FHD", "P_HD", "P_3MP", "QXGA", "QHD", "WQXGA", "P_FHD", "QSXGA",
+};
+
+static bool verbose = false;
+static int failures = 0;
+static int checks = 0;
+
+static void check(bool ok, const sensor_info_t *sn, framesize_t fs, camera_roi_mode_t mode, camera_rect_t roi,
+                  const char *what) {
+    checks++;
+    if (ok) {
+        return;
+    }
+    if (verbose || failures < 20) {
+        fprintf(stderr, "FAIL: %s %s %s roi %d,%d %dx%d: %s\n", sn->name, framesize_names[fs],
+            mode == CAMERA_ROI_ZOOM ? "zoom" : "crop", roi.x, roi.y, roi.w, roi.h, what);
+    }
+    failures++;
+}
+
+static bool rect_eq(camera_rect_t a, camera_rect_t b) {
+    return a.x == b.x && a.y == b.y && a.w == b.w && a.h == b.h;
+}
+
+// Readout area of an OV2640 sensor mode (regs.start_x)
+static void ov2640_area(int sensor_mode, int *w, int *h) {
+    *w = sensor_mode == 0 ? OV2640_UXGA_W : sensor_mode == 1 ? OV2640_SVGA_W : OV2640_CIF_W;
+    *h = sensor_mode == 0 ? OV2640_UXGA_H : sensor_mode == 1 ? OV2640_SVGA_H : OV2640_CIF_H;
+}
+
+// Sensor window of a result, in readout pixels
+static void sensor_window(uint16_t pid, const camera_roi_regs_t *r, int *x, int *y, int *w, int *h) {
+    if (pid == OV2640_PID) {
+        *x = r->offset_x;
+        *y = r->offset_y;
+        *w = r->total_x;
+        *h = r->total_y;
+    } else {
+        *x = r->start_x;
+        *y = r->start_y;
+        *w = r->end_x - r->start_x + 1 - 2 * r->offset_x;
+        *h = r->end_y - r->start_y + 1 - 2 * r->offset_y;
+    }
+}
+
+static void check_one(const sensor_info_t *sn, framesize_t fs, camera_roi_mode_t mode, camera_rect_t roi) {
+    const int out_w = resolution[fs].width, out_h = resolution[fs].height;
+    camera_roi_regs_t regs;
+    camera_rect_t applied;
+    bool ok = camera_roi_compute(sn->pid, fs, mode, roi, &regs, &applied);
+    check(ok, sn, fs, mode, roi, "refused");
+    if (!ok) {
+        return;
+    }
+
+    camera_rect_t a = applied;
+    check(a.x >= 0 && a.y >= 0 && a.x + a.w <= out_w && a.y + a.h <= out_h, sn, fs, mode, roi,
+        "applied ROI outside the frame");
+    check(a.w >= CAMERA_ROI_MIN_W && a.h >= CAMERA_ROI_MIN_H, sn, fs, mode, roi, "applied ROI below the minimum");
+    check(a.w % 16 == 0 && a.h % 8 == 0, sn, fs, mode, roi, "applied ROI is not whole MCUs");
+
+    camera_rect_t clamped = camera_roi_clamp_rect(roi, out_w, out_h, 16, 8);
+    if (mode == CAMERA_ROI_ZOOM) {
+        check(regs.output_x == out_w && regs.output_y == out_h, sn, fs, mode, roi, "zoom output is not the framesize");
+    } else {
+        check(regs.output_x == clamped.w && regs.output_y == clamped.h, sn, fs, mode, roi,
+            "crop output is not the clamped ROI");
+        check(regs.output_x % 16 == 0 && regs.output_y % 8 == 0, sn, fs, mode, roi,
+            "crop output is not whole MCUs");
+    }
+
+    int wx, wy, ww, wh;
+    sensor_window(sn->pid, &regs, &wx, &wy, &ww, &wh);
+    check(ww >= regs.output_x && wh >= regs.output_y, sn, fs, mode, roi, "window smaller than the output");
+    if (sn->pid == OV2640_PID) {
+        int area_w, area_h;
+        check(regs.start_x >= 0 && regs.start_x <= 2, sn, fs, mode, roi, "bad OV2640 sensor mode");
+        ov2640_area(regs.start_x, &area_w, &area_h);
+        check(wx >= 0 && wy >= 0 && wx + ww <= area_w && wy + wh <= area_h, sn, fs, mode, roi,
+            "window outside the OV2640 readout area");
+        check(ww % 4 == 0 && wh % 4 == 0, sn, fs, mode, roi, "OV2640 window not in units of 4");
+        if (mode == CAMERA_ROI_ZOOM) {
+            check(regs.start_x == 0, sn, fs, mode, roi, "OV2640 zoom not read out at UXGA");
+        }
+    } else {
+        check(wx >= 0 && wy >= 0 && wx + ww <= OV3660_ARRAY_W && wy + wh <= OV3660_ARRAY_H, sn, fs, mode, roi,
+            "window outside the OV3660 pixel array");
+        check(wx % 2 == 0 && wy % 2 == 0, sn, fs, mode, roi, "OV3660 window origin breaks the Bayer phase");
+        check(regs.total_y <= OV3660_VTS && regs.total_y >= wh + 2 * OV3660_OFFSET_Y, sn, fs, mode, roi,
+            "OV3660 VTS does not cover the window");
+        check(!regs.binning || (ww >= 2 * regs.output_x && wh >= 2 * regs.output_y), sn, fs, mode, roi,
+            "OV3660 binning without the pixels for it");
+    }
+
+    // Asking for the reported ROI again changes nothing
+    camera_roi_regs_t regs2;
+    camera_rect_t again;
+    camera_roi_compute(sn->pid, fs, mode, applied, &regs2, &again);
+    check(rect_eq(again, applied), sn, fs, mode, roi, "the reported ROI does not map to itself");
+
+    // The clamped request only grows when the sensor lacks the pixels for
+    // it, and then around it
+    if (!rect_eq(applied, clamped)) {
+        int area_w = OV3660_ARRAY_W, area_h = OV3660_ARRAY_H, bx, by, bw, bh;
+        if (sn->pid == OV2640_PID) {
+            ov2640_area(regs.start_x, &area_w, &area_h);
+        }
+        camera_roi_base_window(area_w, area_h, out_w, out_h, &bx, &by, &bw, &bh);
+        int dst_w = mode == CAMERA_ROI_ZOOM ? out_w : clamped.w;
+        int dst_h = mode == CAMERA_ROI_ZOOM ? out_h : clamped.h;
+        check(clamped.w * bw < dst_w * out_w || clamped.h * bh < dst_h * out_h, sn, fs, mode, roi,
+            "ROI grown although the sensor had the pixels");
+        check(a.w >= clamped.w && a.h >= clamped.h && a.x <= clamped.x && a.y <= clamped.y
+            && a.x + a.w >= clamped.x + clamped.w && a.y + a.h >= clamped.y + clamped.h, sn, fs, mode, roi,
+            "grown ROI does not cover the request");
+    }
+}
+
+static int abs_diff(int a, int b) {
+    return a > b ? a - b : b - a;
+}
+
+static void check_full_frame(const sensor_info_t *sn, framesize_t fs) {
+    const int out_w = resolution[fs].width, out_h = resolution[fs].height;
+    camera_rect_t full = { 0, 0, out_w, out_h };
+    camera_roi_regs_t regs;
+    camera_rect_t applied;
+    camera_roi_compute(sn->pid, fs, CAMERA_ROI_CROP, full, &regs, &applied);
+    if (out_w % 16 || out_h % 8) {
+        return;                 // Trimmed to whole MCUs, so not the full window
+    }
+    check(rect_eq(applied, full), sn, fs, CAMERA_ROI_CROP, full, "full-frame crop changed");
+
+    int area_w = OV3660_ARRAY_W, area_h = OV3660_ARRAY_H;
+    if (sn->pid == OV2640_PID) {
+        ov2640_area(regs.start_x, &area_w, &area_h);
+    }
+    int bx, by, bw, bh, wx, wy, ww, wh;
+    camera_roi_base_window(area_w, area_h, out_w, out_h, &bx, &by, &bw, &bh);
+    sensor_window(sn->pid, &regs, &wx, &wy, &ww, &wh);
+    int align = sn->pid == OV2640_PID ? 4 : 2;
+    check(ww >= bw - align && ww <= bw && wh >= bh - align && wh <= bh && abs_diff(wx, bx) < align
+        && abs_diff(wy, by) < align, sn, fs, CAMERA_ROI_CROP, full, "full-frame crop is not the full-FOV window");
+}
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    verbose = argc > 1 && !strcmp(argv[1], "-v");
+
+    for (size_t si = 0; si < sizeof(sensors) / sizeof(sensors[0]); si++) {
+        const sensor_info_t *sn = &sensors[si];
+        int before = failures, tried = 0;
+        for (framesize_t fs = 0; fs <= sn->max_framesize; fs++) {
+            const int out_w = resolution[fs].width, out_h = resolution[fs].height;
+            const int xs[] = { -200, -1, 0, 1, 17, out_w / 3, out_w / 2 + 7, out_w - 64, out_w - 1, out_w, out_w + 40 };
+            const int ys[] = { -150, -1, 0, 3, out_h / 4, out_h / 2 + 5, out_h - 48, out_h - 1, out_h + 30 };
+            const int ws[] = { -5, 0, 1, 63, 64, 65, 97, out_w / 4, out_w / 2 + 1, out_w - 16, out_w, out_w + 1,
+                               3 * out_w, 4000 };
+            const int hs[] = { -5, 0, 1, 47, 48, 49, 99, out_h / 4, out_h / 2 + 1, out_h - 8, out_h, out_h + 1,
+                               3 * out_h, 4000 };
+            for (int mode = CAMERA_ROI_CROP; mode <= CAMERA_ROI_ZOOM; mode++) {
+                for (size_t xi = 0; xi < sizeof(xs) / sizeof(xs[0]); xi++)
+                for (size_t yi = 0; yi < sizeof(ys) / sizeof(ys[0]); yi++)
+                for (size_t wi = 0; wi < sizeof(ws) / sizeof(ws[0]); wi++)
+                for (size_t hi = 0; hi < sizeof(hs) / sizeof(hs[0]); hi++) {
+                    camera_rect_t roi = { xs[xi], ys[yi], ws[wi], hs[hi] };
+                    check_one(sn, fs, (camera_roi_mode_t)mode, roi);
+                    tried++;
+                }
+            }
+            check_full_frame(sn, fs);
+        }
+        printf("%s: %d framesizes (96X96 to %s), %d ROIs, %d failed\n", sn->name, sn->max_framesize + 1,
+            framesize_names[sn->max_framesize], tried, failures - before);
+    }
+
+    camera_roi_regs_t regs;
+    camera_rect_t applied;
+    camera_rect_t any = { 0, 0, 320, 240 };
+    checks += 3;
+    failures += camera_roi_compute(OV5640_PID, FRAMESIZE_VGA, CAMERA_ROI_CROP, any, &regs, &applied);
+    failures += camera_roi_compute(OV2640_PID, FRAMESIZE_INVALID, CAMERA_ROI_CROP, any, &regs, &applied);
+    failures += camera_roi_compute(OV3660_PID, FRAMESIZE_INVALID, CAMERA_ROI_ZOOM, any, &regs, &applied);
+
+    int runs = 1000000;
+    volatile int sink = 0;
+    double start = now_s();
+    for (int i = 0; i < runs; i++) {
+        camera_rect_t roi = { (int16_t)(i % 400), (int16_t)(i % 300), (int16_t)(64 + i % 500), (int16_t)(48 + i % 400) };
+        camera_roi_compute(i & 1 ? OV3660_PID : OV2640_PID, FRAMESIZE_SVGA, (camera_roi_mode_t)((i >> 1) & 1), roi,
+            &regs, &applied);
+        sink += regs.total_x;
+    }
+    printf("bench: camera_roi_compute %.0f ns\n", (now_s() - start) / runs * 1e9);
+
+    if (failures) {
+        fprintf(stderr, "%d of %d checks failed\n", failures, checks);
+        return 1;
+    }
+    printf("all %d checks ok\n", checks);
+    return 0;
+}
@@ -0,0 +1,511 @@
+// Host checks and benchmark for the encrypted chunked UDP protocol
+// (main/chunk_crypt.h).
+//
+// The camera seals packets with mbedTLS on the AES accelerator. Here a
+// small software AES-GCM stands in for it. It must first pass the test
+// cases of the GCM specification. The test frame of desktop/chunk_protocol.py
+// is then sealed the way send_sealed_jpeg() does it, and the datagrams must
+// hash to the same SHA-256 that Python's cryptography package gives. The
+// desktop receiver therefore opens what the camera sends, and the
+// reverse. Opening must undo sealing and turn away every flipped bit, a
+// wrong key and a keep-alive replayed as data. Nonces must stay unique
+// across frame_id wraps and between data packets and keep-alives. Exits
+// non-zero on any mismatch, then prints the encryption cost per frame in
+// software. /rtp on the camera reports the hardware figure (seal_us).
+//
+//   cc -O2 -Imain tools/chunk_crypt_bench.c -o chunk_crypt_bench   (from camera/src)
+//   ./chunk_crypt_bench
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chunk_crypt.h"
+#include "sha256.h"
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { failures++; printf("FAIL: " __VA_ARGS__); printf("\n"); } \
+} while (0)
+
+static int64_t real_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// ---------------------------------------------------------------------------
+// Software AES (FIPS 197, encryption only) and GCM (SP 800-38D, 96-bit IVs)
+
+static const uint8_t aes_sbox[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+};
+
+typedef struct {
+    uint8_t rk[15][16];         // Round keys
+    int rounds;
+    uint64_t hh[16], hl[16];    // GHASH multiples of H, 4 bits at a time
+} gcm_t;
+
+static uint8_t aes_xtime(uint8_t x) {
+    return (uint8_t)(x << 1) ^ (x & 0x80 ? 0x1b : 0);
+}
+
+static void aes_block(const gcm_t *g, const uint8_t in[16], uint8_t out[16]) {
+    uint8_t s[16], t[16];
+    for (int i = 0; i < 16; i++) {
+        s[i] = in[i] ^ g->rk[0][i];
+    }
+    for (int r = 1; r <= g->rounds; r++) {
+        // SubBytes and ShiftRows (column-major state)
+        for (int c = 0; c < 4; c++) {
+            for (int row = 0; row < 4; row++) {
+                t[4 * c + row] = aes_sbox[s[4 * ((c + row) & 3) + row]];
+            }
+        }
+        if (r < g->rounds) {
+            for (int c = 0; c < 4; c++) {
+                uint8_t *p = t + 4 * c, a = p[0] ^ p[1] ^ p[2] ^ p[3], p0 = p[0];
+                p[0] ^= a ^ aes_xtime(p[0] ^ p[1]);
+                p[1] ^= a ^ aes_xtime(p[1] ^ p[2]);
+                p[2] ^= a ^ aes_xtime(p[2] ^ p[3]);
+                p[3] ^= a ^ aes_xtime(p[3] ^ p0);
+            }
+        }
+        for (int i = 0; i < 16; i++) {
+            s[i] = t[i] ^ g->rk[r][i];
+        }
+    }
+    memcpy(out, s, 16);
+}
+
+static uint64_t get64(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) {
+        v = v << 8 | p[i];
+    }
+    return v;
+}
+
+static void put64(uint8_t *p, uint64_t v) {
+    for (int i = 7; i >= 0; i--, v >>= 8) {
+        p[i] = (uint8_t)v;
+    }
+}
+
+static void gcm_setkey(gcm_t *g, const uint8_t *key, size_t key_len) {
+    int nk = (int)key_len / 4;
+    g->rounds = nk + 6;
+    uint8_t w[240];
+    memcpy(w, key, key_len);
+    uint8_t rcon = 1;
+    for (int i = nk; i < 4 * (g->rounds + 1); i++) {
+        uint8_t t[4] = { w[4 * i - 4], w[4 * i - 3], w[4 * i - 2], w[4 * i - 1] };
+        if (i % nk == 0) {
+            uint8_t t0 = t[0];
+            t[0] = aes_sbox[t[1]] ^ rcon;
+            t[1] = aes_sbox[t[2]];
+            t[2] = aes_sbox[t[3]];
+            t[3] = aes_sbox[t0];
+            rcon = aes_xtime(rcon);
+        } else if (nk > 6 && i % nk == 4) {
+            for (int j = 0; j < 4; j++) {
+                t[j] = aes_sbox[t[j]];
+            }
+        }
+        for (int j = 0; j < 4; j++) {
+            w[4 * i + j] = w[4 * (i - nk) + j] ^ t[j];
+        }
+    }
+    memcpy(g->rk, w, 16 * (g->rounds + 1));
+
+    // H = E(K, 0), and its products with every 4-bit value
+    uint8_t h[16] = {0};
+    aes_block(g, h, h);
+    uint64_t vh = get64(h), vl = get64(h + 8);
+    g->hh[0] = g->hl[0] = 0;
+    g->hh[8] = vh;
+    g->hl[8] = vl;
+    for (int i = 4; i > 0; i >>= 1) {
+        uint64_t carry = (vl & 1) ? 0xe100000000000000ULL : 0;
+        vl = (vh << 63) | (vl >> 1);
+        vh = (vh >> 1) ^ carry;
+        g->hh[i] = vh;
+        g->hl[i] = vl;
+    }
+    for (int i = 2; i <= 8; i *= 2) {
+        for (int j = 1; j < i; j++) {
+            g->hh[i + j] = g->hh[i] ^ g->hh[j];
+            g->hl[i + j] = g->hl[i] ^ g->hl[j];
+        }
+    }
+}
+
+static const uint16_t ghash_last4[16] = {
+    0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+    0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0,
+};
+
+// x = x * H in GF(2^128)
+static void ghash_mult(const gcm_t *g, uint8_t x[16]) {
+    uint8_t lo = x[15] & 0xf;
+    uint64_t zh = g->hh[lo], zl = g->hl[lo];
+    for (int i = 15; i >= 0; i--) {
+        lo = x[i] & 0xf;
+        uint8_t hi = x[i] >> 4;
+        if (i != 15) {
+            uint8_t rem = zl & 0xf;
+            zl = (zh << 60) | (zl >> 4);
+            zh = (zh >> 4) ^ ((uint64_t)ghash_last4[rem] << 48) ^ g->hh[lo];
+            zl ^= g->hl[lo];
+        }
+        uint8_t rem = zl & 0xf;
+        zl = (zh << 60) | (zl >> 4);
+        zh = (zh >> 4) ^ ((uint64_t)ghash_last4[rem] << 48) ^ g->hh[hi];
+        zl ^= g->hl[hi];
+    }
+    put64(x, zh);
+    put64(x + 8, zl);
+}
+
+static void ghash_update(const gcm_t *g, uint8_t y[16], const uint8_t *data, size_t len) {
+    for (size_t off = 0; off < len; off += 16) {
+        size_t n = len - off < 16 ? len - off : 16;
+        for (size_t i = 0; i < n; i++) {
+            y[i] ^= data[off + i];
+        }
+        ghash_mult(g, y);
+    }
+}
+
+// Seals (encrypt) or opens in place. Opening returns false if the tag does
+// not match, sealing writes the tag.
+static bool gcm_crypt(const gcm_t *g, bool encrypt, const uint8_t nonce[CHUNK_CRYPT_NONCE_LEN],
+                      const uint8_t *aad, size_t aad_len, const uint8_t *in, uint8_t *out, size_t len,
+                      uint8_t tag[CHUNK_CRYPT_TAG_LEN]) {
+    uint8_t y[16] = {0}, ctr[16], ks[16], lens[16];
+    ghash_update(g, y, aad, aad_len);
+    if (!encrypt) {
+        ghash_update(g, y, in, len);
+    }
+    memcpy(ctr, nonce, CHUNK_CRYPT_NONCE_LEN);
+    uint32_t counter = 1;
+    for (size_t off = 0; off < len; off += 16) {
+        ++counter;
+        ctr[12] = counter >> 24; ctr[13] = counter >> 16; ctr[14] = counter >> 8; ctr[15] = counter;
+        aes_block(g, ctr, ks);
+        size_t n = len - off < 16 ? len - off : 16;
+        for (size_t i = 0; i < n; i++) {
+            out[off + i] = in[off + i] ^ ks[i];
+        }
+    }
+    if (encrypt) {
+        ghash_update(g, y, out, len);
+    }
+    put64(lens, (uint64_t)aad_len * 8);
+    put64(lens + 8, (uint64_t)len * 8);
+    ghash_update(g, y, lens, 16);
+
+    ctr[12] = ctr[13] = ctr[14] = 0;
+    ctr[15] = 1;
+    aes_block(g, ctr, ks);
+    uint8_t diff = 0;
+    for (int i = 0; i < CHUNK_CRYPT_TAG_LEN; i++) {
+        uint8_t t = y[i] ^ ks[i];
+        if (encrypt) {
+            tag[i] = t;
+        } else {
+            diff |= t ^ tag[i];
+        }
+    }
+    return diff == 0;
+}
+
+// ---------------------------------------------------------------------------
+// The camera's sealing loop (send_sealed_jpeg() in main/udp.h) with the
+// datagrams going into a buffer instead of sendmsg
+
+#define MAX_DATAGRAM 1472
+
+typedef struct {
+    uint8_t data[256][MAX_DATAGRAM];
+    size_t len[256];
+    int count;
+} packets_t;
+
+static int seal_frame(const gcm_t *g, const uint8_t *jpeg, size_t jpeg_len, uint16_t frame_id, uint16_t epoch,
+                      const uint8_t salt[CHUNK_CRYPT_SALT_LEN], size_t chunk_max, packets_t *out) {
+    if (chunk_max > CHUNK_CRYPT_MAX_PAYLOAD) { chunk_max = CHUNK_CRYPT_MAX_PAYLOAD; }
+    chunk_crypt_header_t header = { .frame_id = frame_id, .epoch = epoch };
+    memcpy(header.salt, salt, sizeof(header.salt));
+    header.total_packets = (jpeg_len + chunk_max - 1) / chunk_max;
+    header.chunk_size = header.total_packets ? chunk_max : 0;
+
+    uint8_t nonce[CHUNK_CRYPT_NONCE_LEN];
+    if (header.total_packets == 0) {
+        // Keep-alive: the header and a tag over it
+        uint8_t *p = out->data[out->count];
+        chunk_crypt_nonce(&header, nonce);
+        memcpy(p, &header, sizeof(header));
+        gcm_crypt(g, true, nonce, p, sizeof(header), NULL, NULL, 0, p + sizeof(header));
+        out->len[out->count++] = sizeof(header) + CHUNK_CRYPT_TAG_LEN;
+        return 1;
+    }
+    size_t offset = 0;
+    for (header.packet_id = 0; header.packet_id < header.total_packets; header.packet_id++, offset += chunk_max) {
+        size_t chunk_size = jpeg_len - offset < chunk_max ? jpeg_len - offset : chunk_max;
+        uint8_t *p = out->data[out->count];
+        chunk_crypt_nonce(&header, nonce);
+        memcpy(p, &header, sizeof(header));
+        gcm_crypt(g, true, nonce, p, sizeof(header), jpeg + offset, p + sizeof(header), chunk_size,
+            p + sizeof(header) + chunk_size);
+        out->len[out->count++] = sizeof(header) + chunk_size + CHUNK_CRYPT_TAG_LEN;
+    }
+    return header.total_packets;
+}
+
+// What the desktop receiver does: check the tag and decrypt in place.
+// Returns the plaintext length, or -1.
+static int open_packet(const gcm_t *g, uint8_t *p, size_t len) {
+    if (len < sizeof(chunk_crypt_header_t) + CHUNK_CRYPT_TAG_LEN) {
+        return -1;
+    }
+    chunk_crypt_header_t header;
+    memcpy(&header, p, sizeof(header));
+    uint8_t nonce[CHUNK_CRYPT_NONCE_LEN];
+    chunk_crypt_nonce(&header, nonce);
+    size_t n = len - sizeof(header) - CHUNK_CRYPT_TAG_LEN;
+    uint8_t *body = p + sizeof(header);
+    return gcm_crypt(g, false, nonce, p, sizeof(header), body, body, n, body + n) ? (int)n : -1;
+}
+
+// ---------------------------------------------------------------------------
+
+static size_t unhex(const char *hex, uint8_t *out) {
+    size_t n = strlen(hex) / 2;
+    for (size_t i = 0; i < n; i++) {
+        out[i] = (uint8_t)(chunk_crypt_hex_digit(hex[2 * i]) << 4 | chunk_crypt_hex_digit(hex[2 * i + 1]));
+    }
+    return n;
+}
+
+typedef struct {
+    const char *name, *key, *iv, *plain, *aad, *cipher, *tag;
+} gcm_vector_t;
+
+#define GCM_P "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72" \
+              "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39"
+#define GCM_K "feffe9928665731c6d6a8f9467308308"
+#define GCM_IV "cafebabefacedbaddecaf888"
+#define GCM_A "feedfacedeadbeeffeedfacedeadbeefabaddad2"
+
+// Test cases 1-4 and 16 of the GCM specification (McGrew and Viega)
+static const gcm_vector_t gcm_vectors[] = {
+    { "case 1", "00000000000000000000000000000000", "000000000000000000000000", "", "", "",
+      "58e2fccefa7e3061367f1d57a4e7455a" },
+    { "case 2", "00000000000000000000000000000000", "000000000000000000000000",
+      "00000000000000000000000000000000", "", "0388dace60b6a392f328c2b971b2fe78",
+      "ab6e47d42cec13bdf53a67b21257bddf" },
+    { "case 3", GCM_K, GCM_IV, GCM_P "1aafd255", "",
+      "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e"
+      "21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091473f5985",
+      "4d5c2af327cd64a62cf35abd2ba6fab4" },
+    { "case 4", GCM_K, GCM_IV, GCM_P, GCM_A,
+      "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e"
+      "21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091",
+      "5bc94fbc3221a5db94fae95ae7121a47" },
+    { "case 16", GCM_K GCM_K, GCM_IV, GCM_P, GCM_A,
+      "522dc1f099567d07f47f37a32a84427d643a8cdcbfe5c0c97598a2bd2555d1aa"
+      "8cb08e48590dbb3da7b08b1056828838c5f61e6393ba7a0abcc9f662",
+      "76fc6ece0f4e1768cddf8853bb2d551b" },
+};
+
+static void check_gcm_vectors(void) {
+    for (size_t v = 0; v < sizeof(gcm_vectors) / sizeof(gcm_vectors[0]); v++) {
+        const gcm_vector_t *t = &gcm_vectors[v];
+        uint8_t key[32], iv[12], plain[64], aad[20], want[64], want_tag[16], out[64], tag[16];
+        size_t key_len = unhex(t->key, key), aad_len = unhex(t->aad, aad), len = unhex(t->plain, plain);
+        unhex(t->iv, iv);
+        unhex(t->cipher, want);
+        unhex(t->tag, want_tag);
+        gcm_t g;
+        gcm_setkey(&g, key, key_len);
+        gcm_crypt(&g, true, iv, aad, aad_len, plain, out, len, tag);
+        CHECK(memcmp(out, want, len) == 0 && memcmp(tag, want_tag, 16) == 0, "GCM %s", t->name);
+        CHECK(gcm_crypt(&g, false, iv, aad, aad_len, out, out, len, tag) && memcmp(out, plain, len) == 0,
+            "GCM %s opens", t->name);
+    }
+}
+
+static void check_key_parse(void) {
+    uint8_t key[CHUNK_CRYPT_KEY_MAX];
+    CHECK(chunk_crypt_parse_key("000102030405060708090a0b0c0d0E0F", key) == 16 && key[15] == 0x0f, "AES-128 key");
+    CHECK(chunk_crypt_parse_key(GCM_K GCM_K, key) == 32 && key[16] == 0xfe, "AES-256 key");
+    CHECK(chunk_crypt_parse_key("", key) == 0, "empty key accepted");
+    CHECK(chunk_crypt_parse_key("000102030405060708090a0b0c0d0e", key) == 0, "short key accepted");
+    CHECK(chunk_crypt_parse_key("000102030405060708090a0b0c0d0e0f00", key) == 0, "long key accepted");
+    CHECK(chunk_crypt_parse_key("000102030405060708090a0b0c0d0e0g", key) == 0, "non-hex key accepted");
+}
+
+// desktop/chunk_protocol.py: TEST_KEY, TEST_SALT, ... and TEST_SHA256
+#define TEST_FRAME_LEN 5000
+#define TEST_FRAME_ID 0xFFFE
+#define TEST_EPOCH 1
+#define TEST_SHA256 "da4bdb670d55fcc198c19f184b8e3e98aded2fb4c49289709c7590c320465322"
+
+static packets_t packets;
+
+static void check_interop(void) {
+    uint8_t key[16], salt[CHUNK_CRYPT_SALT_LEN], frame[TEST_FRAME_LEN];
+    for (int i = 0; i < 16; i++) key[i] = i;
+    for (int i = 0; i < CHUNK_CRYPT_SALT_LEN; i++) salt[i] = 0xA0 + i;
+    for (int i = 0; i < TEST_FRAME_LEN; i++) frame[i] = (uint8_t)(i * 7 + 3);
+    gcm_t g;
+    gcm_setkey(&g, key, sizeof(key));
+
+    packets.count = 0;
+    CHECK(seal_frame(&g, frame, sizeof(frame), TEST_FRAME_ID, TEST_EPOCH, salt, 1460, &packets) == 4,
+        "test frame not in 4 packets");
+    seal_frame(&g, NULL, 0, TEST_FRAME_ID + 1, TEST_EPOCH, salt, 1460, &packets);
+    sha256_t sha;
+    sha256_init(&sha);
+    for (int i = 0; i < packets.count; i++) {
+        CHECK(packets.len[i] <= MAX_DATAGRAM, "packet %d is %zu bytes", i, packets.len[i]);
+        sha256_update(&sha, packets.data[i], packets.len[i]);
+    }
+    uint8_t digest[SHA256_DIGEST_LEN];
+    char hex[2 * SHA256_DIGEST_LEN + 1];
+    sha256_final(&sha, digest);
+    sha256_hex(digest, hex);
+    CHECK(strcmp(hex, TEST_SHA256) == 0, "sealed test frame %s, chunk_protocol.py has %s", hex, TEST_SHA256);
+
+    // Open everything again
+    size_t offset = 0;
+    for (int i = 0; i < packets.count; i++) {
+        uint8_t p[MAX_DATAGRAM];
+        memcpy(p, packets.data[i], packets.len[i]);
+        int n = open_packet(&g, p, packets.len[i]);
+        CHECK(n >= 0 && (i == packets.count - 1 ? n == 0
+            : memcmp(p + sizeof(chunk_crypt_header_t), frame + offset, n) == 0), "packet %d does not open", i);
+        offset += n > 0 ? n : 0;
+    }
+    CHECK(offset == sizeof(frame), "opened %zu of %zu bytes", offset, sizeof(frame));
+
+    // Every flipped bit, in the clear header too, must be caught
+    int caught = 0, total = 0;
+    for (size_t bit = 0; bit < packets.len[0] * 8; bit += 3, total++) {
+        uint8_t p[MAX_DATAGRAM];
+        memcpy(p, packets.data[0], packets.len[0]);
+        p[bit / 8] ^= 1 << (bit % 8);
+        caught += open_packet(&g, p, packets.len[0]) < 0;
+    }
+    CHECK(caught == total, "%d of %d flipped bits caught", caught, total);
+
+    // A keep-alive header with total_packets set is a different nonce
+    uint8_t p[MAX_DATAGRAM];
+    memcpy(p, packets.data[packets.count - 1], packets.len[packets.count - 1]);
+    ((chunk_crypt_header_t *)p)->total_packets = 1;
+    CHECK(open_packet(&g, p, packets.len[packets.count - 1]) < 0, "keep-alive opened as data");
+
+    gcm_t other;
+    key[0] ^= 1;
+    gcm_setkey(&other, key, sizeof(key));
+    memcpy(p, packets.data[0], packets.len[0]);
+    CHECK(open_packet(&other, p, packets.len[0]) < 0, "wrong key opened a packet");
+}
+
+// Walk the camera's counters over two frame_id wraps, with receivers on
+// different chunk sizes and keep-alives: no nonce may come up twice
+static int nonce_cmp(const void *a, const void *b) {
+    return memcmp(a, b, CHUNK_CRYPT_NONCE_LEN);
+}
+
+static void check_nonces(void) {
+    enum { FRAMES = 3 * 65536 / 2, PER_FRAME = 5 };
+    uint8_t (*nonces)[CHUNK_CRYPT_NONCE_LEN] = malloc((size_t)FRAMES * PER_FRAME * CHUNK_CRYPT_NONCE_LEN);
+    chunk_crypt_header_t h = { .epoch = 0 };
+    memset(h.salt, 0x5A, sizeof(h.salt));
+    size_t n = 0;
+    uint16_t frame_id = 0xFF00, epoch = 0;
+    for (int f = 0; f < FRAMES; f++) {
+        h.frame_id = frame_id;
+        h.epoch = epoch;
+        // Data packets for two receivers on different chunk sizes, a
+        // keep-alive for a third
+        h.total_packets = 2;
+        for (h.chunk_size = 1400; h.chunk_size <= 1440; h.chunk_size += 40) {
+            for (h.packet_id = 0; h.packet_id < 2; h.packet_id++) {
+                chunk_crypt_nonce(&h, nonces[n++]);
+            }
+        }
+        h.total_packets = h.chunk_size = 0;
+        h.packet_id = 0;
+        chunk_crypt_nonce(&h, nonces[n++]);
+        if (++frame_id == 0) {
+            epoch++;
+        }
+    }
+    qsort(nonces, n, CHUNK_CRYPT_NONCE_LEN, nonce_cmp);
+    int repeats = 0;
+    for (size_t i = 1; i < n; i++) {
+        repeats += memcmp(nonces[i - 1], nonces[i], CHUNK_CRYPT_NONCE_LEN) == 0;
+    }
+    CHECK(repeats == 0, "%d nonces repeated over %zu packets", repeats, n);
+    free(nonces);
+}
+
+static void bench(void) {
+    static const size_t sizes[] = { 15 * 1024, 30 * 1024, 60 * 1024 };
+    uint8_t key[16] = {1}, salt[CHUNK_CRYPT_SALT_LEN] = {2};
+    gcm_t g;
+    gcm_setkey(&g, key, sizeof(key));
+    uint8_t *frame = malloc(60 * 1024);
+    for (int i = 0; i < 60 * 1024; i++) frame[i] = rand();
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        int frames = 0;
+        int64_t t0 = real_us(), elapsed;
+        do {
+            packets.count = 0;
+            seal_frame(&g, frame, sizes[s], (uint16_t)frames, 0, salt, 1460, &packets);
+            frames++;
+        } while ((elapsed = real_us() - t0) < 300000);
+        double per_frame = (double)elapsed / frames;
+        printf("bench: %2zu KB frame, %d packets: %.0f us to seal in software (%.1f MB/s), "
+            "+%zu bytes on the wire\n", sizes[s] / 1024, packets.count, per_frame,
+            sizes[s] / per_frame / 1.048576, packets.count * (sizeof(chunk_crypt_header_t) - 8 + CHUNK_CRYPT_TAG_LEN));
+    }
+    free(frame);
+}
+
+int main(void) {
+    srand(1);
+    check_gcm_vectors();
+    check_key_parse();
+    check_interop();
+    check_nonces();
+    bench();
+    if (failures) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,366 @@
+// Host checks and benchmark for the runtime config store (main/config_store.h).
+//
+// Checks the schema: validation of the schema itself, parsing of query
+// strings (types, ranges, unknown keys, all-or-nothing), the subsystem
+// diff and the JSON output. Then races reader threads against a writer
+// that publishes new snapshots as fast as it can. Every reader checks that
+// its snapshot stays intact for the whole read section (a reused slot
+// would change under it) and that versions never go back. A stuck reader
+// must hold up reclaim until it leaves. Exits non-zero on any mismatch,
+// then prints timings.
+//
+//   cc -O2 -Imain tools/config_store_bench.c -o config_store_bench -lpthread   (from camera/src)
+//   ./config_store_bench
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "config_store.h"
+
+#define RACE_SECONDS 1
+#define RACE_READERS 3
+#define RACE_FIELDS 16
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { failures++; printf("FAIL: " __VA_ARGS__); printf("\n"); } \
+} while (0)
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// ---------------------------------------------------------------------------
+// Schema
+
+typedef struct {
+    uint32_t version;
+    int32_t chunk;
+    int32_t enabled;
+    int32_t mode;
+    int32_t interval;
+} test_config_t;
+
+#define SUB_UDP 1u
+#define SUB_CAMERA 2u
+#define SUB_DETECT 4u
+
+static const char *const modes[] = { "continuous", "single", NULL };
+
+static const config_field_t fields[] = {
+    { "chunk", CONFIG_INT, offsetof(test_config_t, chunk), 256, 1460, 1400, NULL, SUB_UDP, "Bytes per packet" },
+    { "enabled", CONFIG_BOOL, offsetof(test_config_t, enabled), 0, 1, 1, NULL, SUB_DETECT, NULL },
+    { "mode", CONFIG_ENUM, offsetof(test_config_t, mode), 0, 1, 0, modes, SUB_CAMERA, "Capture mode" },
+    { "interval", CONFIG_INT, offsetof(test_config_t, interval), -5, 60000, 1000, NULL, SUB_DETECT, "ms" },
+};
+
+static const config_schema_t schema = { fields, sizeof(fields) / sizeof(fields[0]) };
+
+static int parse(const test_config_t *base, test_config_t *out, const char *query, char *err) {
+    static const char *const ignore[] = { "save", "reset", NULL };
+    return config_parse_query(&schema, base, out, sizeof(*out), query, ignore, err, 64);
+}
+
+static void check_schema_valid(void) {
+    CHECK(config_schema_valid(&schema), "test schema valid");
+
+    config_field_t bad[2] = { fields[0], fields[0] };
+    config_schema_t s = { bad, 2 };
+    CHECK(!config_schema_valid(&s), "duplicate key rejected");
+
+    bad[1] = fields[1];
+    bad[1].key = "sixteen_chars_xx";
+    CHECK(!config_schema_valid(&s), "key longer than NVS allows rejected");
+
+    bad[1] = fields[0];
+    bad[1].key = "other";
+    bad[1].def = 100;
+    CHECK(!config_schema_valid(&s), "default out of range rejected");
+
+    bad[1] = fields[2];
+    bad[1].max = 2;
+    CHECK(!config_schema_valid(&s), "enum range must match its choices");
+
+    bad[1] = fields[1];
+    bad[1].max = 2;
+    CHECK(!config_schema_valid(&s), "bool range must be 0-1");
+}
+
+static void check_parse(void) {
+    test_config_t base = { .version = 7 }, out;
+    char err[64] = "";
+    config_defaults(&schema, &base);
+    CHECK(base.chunk == 1400 && base.enabled == 1 && base.mode == 0 && base.interval == 1000 && base.version == 7,
+        "defaults");
+
+    CHECK(parse(&base, &out, "", err) == 0 && memcmp(&out, &base, sizeof(out)) == 0, "empty query is a copy");
+    CHECK(parse(&base, &out, "chunk=1200&mode=single&enabled=off", err) == 3
+        && out.chunk == 1200 && out.mode == 1 && out.enabled == 0 && out.interval == 1000 && out.version == 7,
+        "int, enum by name and bool");
+    CHECK(parse(&base, &out, "mode=1&enabled=true&interval=-5", err) == 3 && out.mode == 1 && out.enabled == 1
+        && out.interval == -5, "enum by index, bool word, negative int");
+    CHECK(parse(&base, &out, "chunk=300&chunk=400", err) == 2 && out.chunk == 400, "last value wins");
+    CHECK(parse(&base, &out, "save=0&chunk=300&reset=1&&", err) == 1 && out.chunk == 300, "ignored keys and empty pairs");
+
+    test_config_t before = base;
+    CHECK(parse(&base, &out, "chunk=1200&bogus=1", err) < 0 && strstr(err, "bogus"), "unknown key: %s", err);
+    CHECK(parse(&base, &out, "chunk=2000", err) < 0 && strstr(err, "256-1460"), "out of range: %s", err);
+    CHECK(parse(&base, &out, "chunk=12a", err) < 0, "trailing junk");
+    CHECK(parse(&base, &out, "chunk=", err) < 0, "empty value");
+    CHECK(parse(&base, &out, "chunk", err) < 0, "missing value");
+    CHECK(parse(&base, &out, "chunk=99999999999999999999", err) < 0, "overflow");
+    CHECK(parse(&base, &out, "enabled=2", err) < 0, "bool out of range");
+    CHECK(parse(&base, &out, "enabled=yes", err) < 0, "bool word not known");
+    CHECK(parse(&base, &out, "mode=2", err) < 0 && strstr(err, "choices"), "enum index out of range: %s", err);
+    CHECK(parse(&base, &out, "mode=Single", err) < 0, "enum names are case sensitive");
+    CHECK(parse(&base, &out, "ch=1", err) < 0 && parse(&base, &out, "chunky=1", err) < 0, "key prefixes do not match");
+    CHECK(memcmp(&before, &base, sizeof(base)) == 0, "base untouched by failed parses");
+
+    parse(&base, &out, "chunk=1200&interval=5", err);
+    CHECK(config_diff(&schema, &base, &out) == (SUB_UDP | SUB_DETECT), "diff: udp and detect");
+    CHECK(config_diff(&schema, &base, &base) == 0, "diff: nothing");
+    out = base;
+    out.version = 99;
+    CHECK(config_diff(&schema, &base, &out) == 0, "diff ignores fields outside the schema");
+}
+
+static void check_json(void) {
+    test_config_t cfg;
+    config_defaults(&schema, &cfg);
+    char buf[512];
+    int n = config_json_values(&schema, &cfg, buf, sizeof(buf));
+    const char *want = "{\"chunk\":1400,\"enabled\":true,\"mode\":\"continuous\",\"interval\":1000}";
+    CHECK(n == (int)strlen(want) && strcmp(buf, want) == 0, "values JSON: %s", buf);
+    CHECK(config_json_values(&schema, &cfg, buf, strlen(want)) < 0, "values JSON that does not fit");
+    CHECK(config_json_values(&schema, &cfg, buf, strlen(want) + 1) == n, "values JSON that just fits");
+
+    n = config_json_schema(&schema, buf, sizeof(buf));
+    want = "[{\"key\":\"chunk\",\"type\":\"int\",\"min\":256,\"max\":1460,\"default\":1400,\"help\":\"Bytes per packet\"},"
+        "{\"key\":\"enabled\",\"type\":\"bool\",\"default\":true,\"help\":\"\"},"
+        "{\"key\":\"mode\",\"type\":\"enum\",\"choices\":[\"continuous\",\"single\"],\"default\":\"continuous\","
+        "\"help\":\"Capture mode\"},"
+        "{\"key\":\"interval\",\"type\":\"int\",\"min\":-5,\"max\":60000,\"default\":1000,\"help\":\"ms\"}]";
+    CHECK(n == (int)strlen(want) && strcmp(buf, want) == 0, "schema JSON: %s", buf);
+    for (size_t size = 1; size <= strlen(want); size++) {
+        if (config_json_schema(&schema, buf, size) >= 0) {
+            CHECK(0, "schema JSON fits in %zu bytes", size);
+            break;
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Snapshots
+
+// Every field follows from the version, so a reader can tell a snapshot
+// that changed under it
+typedef struct {
+    uint32_t version;
+    uint32_t field[RACE_FIELDS];
+} race_config_t;
+
+static void race_fill(race_config_t *c, uint32_t version) {
+    c->version = version;
+    for (int i = 0; i < RACE_FIELDS; i++) {
+        c->field[i] = version * 2654435761u + i;
+    }
+}
+
+static bool race_intact(const race_config_t *c) {
+    for (int i = 0; i < RACE_FIELDS; i++) {
+        if (c->field[i] != c->version * 2654435761u + i) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static config_rcu_t race_rcu;
+static race_config_t race_slots[CONFIG_RCU_SLOTS];
+static volatile int race_stop;
+
+typedef struct {
+    int id;
+    uint64_t reads;
+    uint64_t torn;              // Changed during the read section
+    uint64_t backwards;         // Older than a version seen before
+    uint32_t versions_seen;
+} race_reader_t;
+
+static void *race_reader(void *arg) {
+    race_reader_t *r = arg;
+    uint32_t last = 0;
+    while (!race_stop) {
+        const race_config_t *c = config_rcu_lock(&race_rcu, r->id);
+        race_config_t first = *c;
+        // Stay in the section a little, as a frame would
+        for (volatile int spin = 0; spin < 50; spin++) {
+        }
+        bool same = memcmp(&first, (const void *)c, sizeof(first)) == 0;
+        config_rcu_unlock(&race_rcu, r->id);
+
+        r->torn += !same || !race_intact(&first);
+        r->backwards += first.version < last;
+        r->versions_seen += first.version != last;
+        last = first.version;
+        r->reads++;
+    }
+    return NULL;
+}
+
+static void *race_writer(void *arg) {
+    uint64_t *stats = arg;      // Publishes, busy
+    uint32_t version = 1;
+    race_config_t next;
+    while (!race_stop) {
+        race_fill(&next, version + 1);
+        if (config_rcu_publish(&race_rcu, &next)) {
+            version++;
+            stats[0]++;
+        } else {
+            stats[1]++;
+            sched_yield();      // As the device waits a tick for readers to finish
+        }
+    }
+    return NULL;
+}
+
+static void check_race(void) {
+    race_config_t initial;
+    race_fill(&initial, 1);
+    CHECK(config_rcu_init(&race_rcu, race_slots, sizeof(race_config_t), &initial, RACE_READERS), "rcu init");
+
+    pthread_t writer, readers[RACE_READERS];
+    race_reader_t results[RACE_READERS] = {0};
+    uint64_t stats[2] = {0};
+    race_stop = 0;
+    for (int i = 0; i < RACE_READERS; i++) {
+        results[i].id = i;
+        pthread_create(&readers[i], NULL, race_reader, &results[i]);
+    }
+    pthread_create(&writer, NULL, race_writer, stats);
+    struct timespec ts = { .tv_sec = RACE_SECONDS };
+    nanosleep(&ts, NULL);
+    race_stop = 1;
+    pthread_join(writer, NULL);
+
+    uint64_t reads = 0, torn = 0, backwards = 0, seen = 0;
+    for (int i = 0; i < RACE_READERS; i++) {
+        pthread_join(readers[i], NULL);
+        reads += results[i].reads;
+        torn += results[i].torn;
+        backwards += results[i].backwards;
+        seen += results[i].versions_seen;
+    }
+    const race_config_t *cur = config_rcu_current(&race_rcu);
+    CHECK(torn == 0, "%llu snapshots changed inside a read section", (unsigned long long)torn);
+    CHECK(backwards == 0, "%llu versions went backwards", (unsigned long long)backwards);
+    CHECK(stats[0] > 100 && cur->version == stats[0] + 1 && race_intact(cur), "writer made progress");
+    CHECK(seen > RACE_READERS, "readers saw new versions");
+    printf("race: %llu publishes (%llu busy), %llu reads by %d readers, %llu version changes seen, %llu torn\n",
+        (unsigned long long)stats[0], (unsigned long long)stats[1], (unsigned long long)reads, RACE_READERS,
+        (unsigned long long)seen, (unsigned long long)torn);
+}
+
+static void check_stuck_reader(void) {
+    static config_rcu_t rcu;
+    static race_config_t slots[CONFIG_RCU_SLOTS];
+    race_config_t c;
+    race_fill(&c, 1);
+    config_rcu_init(&rcu, slots, sizeof(c), &c, 2);
+
+    const race_config_t *held = config_rcu_lock(&rcu, 0);
+    int published = 0;
+    for (uint32_t v = 2; v < 10; v++) {
+        race_fill(&c, v);
+        published += config_rcu_publish(&rcu, &c);
+    }
+    CHECK(published == CONFIG_RCU_SLOTS - 1, "stuck reader: %d publishes, want %d", published, CONFIG_RCU_SLOTS - 1);
+    CHECK(rcu.busy == 8u - published, "busy counted");
+    CHECK(held->version == 1 && race_intact(held), "held snapshot untouched");
+
+    // Another reader coming and going does not block anything
+    const race_config_t *other = config_rcu_lock(&rcu, 1);
+    CHECK(other->version == (uint32_t)published + 1, "new reader sees the newest version");
+    config_rcu_unlock(&rcu, 1);
+
+    config_rcu_unlock(&rcu, 0);
+    race_fill(&c, 100);
+    CHECK(config_rcu_publish(&rcu, &c), "publish once the reader left");
+    const race_config_t *now = config_rcu_lock(&rcu, 0);
+    CHECK(now->version == 100 && race_intact(now), "reader sees the new snapshot");
+
+    // Holding the newest snapshot still leaves room to publish past it
+    published = 0;
+    for (uint32_t v = 101; v < 110; v++) {
+        race_fill(&c, v);
+        published += config_rcu_publish(&rcu, &c);
+    }
+    CHECK(published == CONFIG_RCU_SLOTS - 1 && now->version == 100, "reader on the newest: %d publishes", published);
+    config_rcu_unlock(&rcu, 0);
+
+    CHECK(!config_rcu_init(&rcu, slots, sizeof(c), &c, 0)
+        && !config_rcu_init(&rcu, slots, sizeof(c), &c, CONFIG_RCU_MAX_READERS + 1), "reader count checked");
+}
+
+// ---------------------------------------------------------------------------
+
+static void bench(void) {
+    static config_rcu_t rcu;
+    static test_config_t slots[CONFIG_RCU_SLOTS];
+    test_config_t c;
+    config_defaults(&schema, &c);
+    config_rcu_init(&rcu, slots, sizeof(c), &c, 1);
+
+    enum { N = 10000000 };
+    uint64_t sink = 0;
+    double t0 = now_s();
+    for (int i = 0; i < N; i++) {
+        const test_config_t *cfg = config_rcu_lock(&rcu, 0);
+        sink += cfg->chunk;
+        config_rcu_unlock(&rcu, 0);
+    }
+    double read = (now_s() - t0) / N * 1e9;
+
+    enum { P = 1000000 };
+    t0 = now_s();
+    for (int i = 0; i < P; i++) {
+        c.interval = i % 60000;
+        sink += config_rcu_publish(&rcu, &c);
+    }
+    double publish = (now_s() - t0) / P * 1e9;
+
+    enum { Q = 1000000 };
+    char err[64];
+    test_config_t out;
+    t0 = now_s();
+    for (int i = 0; i < Q; i++) {
+        sink += parse(&c, &out, "chunk=1200&mode=single&enabled=off&interval=500", err);
+    }
+    double query = (now_s() - t0) / Q * 1e9;
+
+    printf("bench: read section %.1f ns, publish %.1f ns, parse of 4 keys %.0f ns (%llu)\n", read, publish, query,
+        (unsigned long long)(sink & 1));
+}
+
+int main(void) {
+    check_schema_valid();
+    check_parse();
+    check_json();
+    check_stuck_reader();
+    check_race();
+    bench();
+    if (failures) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,742 @@
+// Host benchmark of the H.264 encoder (main/h264_enc.h) against MJPEG.
+//
+// Recorded MJPEG sequences are split into their JPEGs (a raw /stream
+// recording, concatenated JPEGs or single .jpg files all work) and decoded
+// with libjpeg; without files a synthetic trackside scene is used: a static
+// textured background with sensor noise and a train crossing the middle
+// third of the sequence. For each resolution the frames are scaled (area
+// average) and then:
+//
+//   - re-encoded as JPEG at --quality, the MJPEG baseline at that size
+//   - encoded as H.264 at each --kbps target and --fps
+//   - encoded as H.264 at the coarsest constant QP that matches the MJPEG
+//     PSNR, for the airtime saved at equal quality
+//
+// and the tool prints bit rate, PSNR (luma, against the scaled source) and
+// encoder frames per second on this machine, and for recorded sequences
+// the bit rate the camera actually sent. H.264 PSNR is measured on the
+// encoder's reconstruction, which a decoder reproduces exactly; --out
+// writes the streams and reconstructions to check that with ffmpeg:
+//
+//   ffmpeg -i out/h264_320x240_500k.h264 -f rawvideo -pix_fmt yuv420p dec.yuv
+//   cmp dec.yuv out/h264_320x240_500k.yuv
+//
+// Also checks that the CAVLC tables are prefix codes, that the rate
+// control stays under its target (it is a ceiling: still stretches come in
+// below it), that a still scene codes as skipped macroblocks, and that every
+// access unit comes back intact through RTP packetization (main/rtp_h264.h),
+// single NAL units and FU-A fragments both.
+//
+//   cc -O2 -Imain tools/h264_bench.c -o h264_bench -ljpeg -lm   (from camera/src)
+//   curl -s --max-time 30 "http://train.local:81/stream" > trackside.mjpeg
+//   ./h264_bench [--fps N] [--gop N] [--kbps 250,500,1000] [--sizes qvga,hvga,vga]
+//                [--quality N] [--frames N] [--out DIR] [trackside.mjpeg ...]
+//
+// Exits non-zero if a check fails.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <jpeglib.h>
+
+#include "h264_enc.h"
+#include "rtp_h264.h"
+
+#define MAX_RATES 8
+#define MAX_SIZES 4
+#define STILL_FRAMES 20
+
+typedef struct {
+    const uint8_t *buf;
+    size_t len;
+} frame_t;
+
+typedef struct {
+    int w, h;
+    uint8_t *y, *u, *v;         // I420, packed
+} yuv_t;
+
+typedef struct {
+    const char *name;
+    int w, h;
+} size_t_entry;
+
+static const size_t_entry known_sizes[] = {
+    { "qqvga", 160, 120 }, { "qvga", 320, 240 }, { "cif", 400, 296 }, { "hvga", 480, 320 },
+    { "vga", 640, 480 }, { "svga", 800, 600 },
+};
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint8_t *read_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *buf = malloc(n > 0 ? n : 1);
+    if (buf && fread(buf, 1, n, f) != (size_t)n) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    *len = (size_t)n;
+    return buf;
+}
+
+static size_t rd16(const uint8_t *p) {
+    return (size_t)(p[0] << 8 | p[1]);
+}
+
+// End of the JPEG starting at p: walk the segments to the scan, then find
+// the first marker other than a stuffed byte or RSTn
+static size_t jpeg_length(const uint8_t *p, size_t avail) {
+    size_t i = 2;
+    while (i + 4 <= avail) {
+        if (p[i] != 0xFF) {
+            return 0;
+        }
+        uint8_t marker = p[i + 1];
+        if (marker == 0xFF) {
+            i++;
+            continue;
+        }
+        i += 2 + rd16(p + i + 2);
+        if (marker == 0xDA) {
+            for (; i + 1 < avail; i++) {
+                if (p[i] == 0xFF && p[i + 1] != 0x00 && (p[i + 1] & 0xF8) != 0xD0) {
+                    return p[i + 1] == 0xD9 ? i + 2 : 0;
+                }
+            }
+            return 0;
+        }
+    }
+    return 0;
+}
+
+static int split_frames(const uint8_t *buf, size_t len, frame_t **frames, int count) {
+    for (size_t i = 0; i + 3 < len;) {
+        if (buf[i] == 0xFF && buf[i + 1] == 0xD8 && buf[i + 2] == 0xFF) {
+            size_t n = jpeg_length(buf + i, len - i);
+            if (n) {
+                *frames = realloc(*frames, (count + 1) * sizeof(frame_t));
+                (*frames)[count++] = (frame_t){ buf + i, n };
+                i += n;
+                continue;
+            }
+        }
+        i++;
+    }
+    return count;
+}
+
+static void yuv_alloc(yuv_t *f, int w, int h) {
+    f->w = w;
+    f->h = h;
+    f->y = malloc((size_t)w * h * 3 / 2);
+    f->u = f->y + (size_t)w * h;
+    f->v = f->u + (size_t)w * h / 4;
+}
+
+static h264_picture_t yuv_picture(const yuv_t *f) {
+    return (h264_picture_t){ f->y, f->u, f->v, f->w, f->w / 2 };
+}
+
+// Area-average scaling of one plane
+static void scale_plane(const uint8_t *src, int sw, int sh, int sstride, int step,
+                        uint8_t *dst, int dw, int dh) {
+    for (int y = 0; y < dh; y++) {
+        int y0 = y * sh / dh, y1 = (y + 1) * sh / dh;
+        if (y1 <= y0) {
+            y1 = y0 + 1;
+        }
+        for (int x = 0; x < dw; x++) {
+            int x0 = x * sw / dw, x1 = (x + 1) * sw / dw;
+            if (x1 <= x0) {
+                x1 = x0 + 1;
+            }
+            int sum = 0;
+            for (int j = y0; j < y1; j++) {
+                for (int i = x0; i < x1; i++) {
+                    sum += src[j * sstride + i * step];
+                }
+            }
+            int n = (y1 - y0) * (x1 - x0);
+            dst[y * dw + x] = (uint8_t)((sum + n / 2) / n);
+        }
+    }
+}
+
+// Decode a JPEG (as YCbCr) and scale it into `out`
+static bool decode_scaled(const frame_t *f, yuv_t *out, int *src_w, int *src_h) {
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, f->buf, f->len);
+    if (jpeg_read_header(&cinfo, TRUE) != JPEG_HEADER_OK) {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+    cinfo.out_color_space = JCS_YCbCr;
+    jpeg_start_decompress(&cinfo);
+    int w = cinfo.output_width, h = cinfo.output_height;
+    uint8_t *pix = malloc((size_t)w * h * 3);
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW row = pix + (size_t)cinfo.output_scanline * w * 3;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    scale_plane(pix, w, h, w * 3, 3, out->y, out->w, out->h);
+    scale_plane(pix + 1, w, h, w * 3, 3, out->u, out->w / 2, out->h / 2);
+    scale_plane(pix + 2, w, h, w * 3, 3, out->v, out->w / 2, out->h / 2);
+    free(pix);
+    *src_w = w;
+    *src_h = h;
+    return true;
+}
+
+// Synthetic trackside scene
+
+static uint32_t hash3(uint32_t x, uint32_t y, uint32_t z) {
+    uint32_t h = x * 0x8da6b343u ^ y * 0xd8163841u ^ z * 0xcb1ab31fu;
+    h ^= h >> 13;
+    h *= 0x5bd1e995u;
+    return h ^ (h >> 15);
+}
+
+static void synthetic_frame(yuv_t *f, int index, int count) {
+    // Train front position, across the middle third of the sequence
+    float t = (index - count / 3.0f) / (count / 3.0f);
+    float front = -0.2f + 1.6f * t;
+    for (int y = 0; y < f->h; y++) {
+        float fy = (y + 0.5f) / f->h;
+        for (int x = 0; x < f->w; x++) {
+            float fx = (x + 0.5f) / f->w;
+            // Scene coordinates on a 640x480 grid, so every size sees the same texture
+            uint32_t sx = (uint32_t)(fx * 640), sy = (uint32_t)(fy * 480);
+            int luma, cb = 128, cr = 128;
+            if (fy < 0.35f) {
+                luma = 200 - (int)(fy * 120);           // Sky
+                cb = 150;
+                cr = 118;
+            } else if (fy < 0.45f) {
+                luma = 90 + (int)(hash3(sx / 6, sy / 4, 1) % 40);   // Trees
+                cb = 110;
+                cr = 120;
+            } else {
+                luma = 110 + (int)(hash3(sx / 2, sy / 2, 2) % 50);  // Ballast
+                if (fy > 0.62f && fy < 0.65f) {
+                    luma = 170;                                      // Rails
+                } else if (fy > 0.55f && fy < 0.72f && (sx / 24) % 2 == 0) {
+                    luma = 75;                                       // Sleepers
+                    cr = 140;
+                }
+            }
+            if (t > 0 && t < 1 && fx < front && fx > front - 1.2f && fy > 0.38f && fy < 0.64f) {
+                luma = 70;                                           // Train
+                cr = 180;
+                cb = 100;
+                if (fy > 0.43f && fy < 0.5f && (int)((front - fx) * 40) % 3 == 1) {
+                    luma = 210;                                      // Windows
+                    cr = 128;
+                    cb = 136;
+                }
+            }
+            int noise = (int)(hash3(x, y, (uint32_t)index + 7) % 5) - 2;
+            f->y[y * f->w + x] = h264_pixel(luma + noise);
+            if (!(x & 1) && !(y & 1)) {
+                f->u[(y / 2) * (f->w / 2) + x / 2] = (uint8_t)cb;
+                f->v[(y / 2) * (f->w / 2) + x / 2] = (uint8_t)cr;
+            }
+        }
+    }
+}
+
+static double psnr(double sse, double n) {
+    return sse <= 0 ? 99.0 : 10 * log10(255.0 * 255.0 * n / sse);
+}
+
+static double plane_sse(const uint8_t *a, int astride, const uint8_t *b, int bstride, int w, int h) {
+    double sse = 0;
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            int d = a[y * astride + x] - b[y * bstride + x];
+            sse += d * d;
+        }
+    }
+    return sse;
+}
+
+// MJPEG baseline: libjpeg at `quality`, decoded back for the PSNR
+
+typedef struct {
+    double bytes;
+    double sse;
+    double seconds;
+} mjpeg_result_t;
+
+static void mjpeg_frame(const yuv_t *f, int quality, mjpeg_result_t *r) {
+    struct jpeg_compress_struct c;
+    struct jpeg_error_mgr jerr;
+    c.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&c);
+    unsigned char *jpg = NULL;
+    unsigned long jpg_len = 0;
+    jpeg_mem_dest(&c, &jpg, &jpg_len);
+    c.image_width = f->w;
+    c.image_height = f->h;
+    c.input_components = 3;
+    c.in_color_space = JCS_YCbCr;
+    jpeg_set_defaults(&c);
+    jpeg_set_quality(&c, quality, TRUE);
+    uint8_t *row = malloc((size_t)f->w * 3);
+    double start = now_s();
+    jpeg_start_compress(&c, TRUE);
+    while (c.next_scanline < c.image_height) {
+        int y = c.next_scanline;
+        for (int x = 0; x < f->w; x++) {
+            row[3 * x] = f->y[y * f->w + x];
+            row[3 * x + 1] = f->u[(y / 2) * (f->w / 2) + x / 2];
+            row[3 * x + 2] = f->v[(y / 2) * (f->w / 2) + x / 2];
+        }
+        jpeg_write_scanlines(&c, &row, 1);
+    }
+    jpeg_finish_compress(&c);
+    r->seconds += now_s() - start;
+    jpeg_destroy_compress(&c);
+    r->bytes += jpg_len;
+
+    struct jpeg_decompress_struct d;
+    d.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&d);
+    jpeg_mem_src(&d, jpg, jpg_len);
+    jpeg_read_header(&d, TRUE);
+    d.out_color_space = JCS_YCbCr;
+    jpeg_start_decompress(&d);
+    while (d.output_scanline < d.output_height) {
+        int y = d.output_scanline;
+        jpeg_read_scanlines(&d, &row, 1);
+        for (int x = 0; x < f->w; x++) {
+            int e = row[3 * x] - f->y[y * f->w + x];
+            r->sse += e * e;
+        }
+    }
+    jpeg_finish_decompress(&d);
+    jpeg_destroy_decompress(&d);
+    free(row);
+    free(jpg);
+}
+
+// One H.264 run over the sequence
+
+typedef struct {
+    double bytes;
+    double idr_bytes;
+    int idr_frames;
+    double sse;
+    double seconds;
+    double qp_sum;
+    int at_qp_max;              // Frames the rate control could not make smaller
+    uint32_t dropped;
+    uint32_t skip_mbs, total_mbs;
+    bool rtp_ok;                // Every access unit survived RTP packetization
+} h264_result_t;
+
+// Packetize an access unit as udp.h does and depacketize it as a receiver
+// would: single NAL units get their start code back, FU-A fragments are
+// joined under the NAL header they carry. The result must be the access
+// unit again, with the marker on its last packet only.
+static bool rtp_roundtrip(const uint8_t *au, size_t len, size_t max_packet) {
+    rtp_jpeg_stream_t st = { .ssrc = 0x54524149, .seq = 0xFFF0 };
+    uint8_t *out = malloc(len + 64);
+    size_t out_len = 0, pos = 0;
+    const uint8_t *nal;
+    size_t nal_len;
+    bool ok = true, marker = false;
+    uint16_t seq = st.seq;
+    while (ok && rtp_h264_next_nal(au, len, &pos, &nal, &nal_len)) {
+        size_t after = pos;
+        const uint8_t *next;
+        size_t next_len;
+        bool last = !rtp_h264_next_nal(au, len, &after, &next, &next_len);
+        size_t offset = 0;
+        do {
+            uint8_t hdr[RTP_H264_MAX_HEADERS];
+            size_t data_start, data_len;
+            size_t hlen = rtp_h264_packet(&st, nal, nal_len, last, 1234, offset, max_packet, hdr,
+                &data_start, &data_len);
+            ok = ok && !marker && hlen + data_len <= max_packet && data_len > 0;
+            ok = ok && (hdr[1] & 0x7F) == RTP_PT_H264 && ((hdr[2] << 8) | hdr[3]) == seq++;
+            marker = hdr[1] & 0x80;
+            if (hlen == RTP_HEADER_SIZE) {
+                memcpy(out + out_len, "\0\0\0\1", 4);
+                out_len += 4;
+            } else {
+                bool s = hdr[RTP_HEADER_SIZE + 1] & 0x80, e = hdr[RTP_HEADER_SIZE + 1] & 0x40;
+                ok = ok && (hdr[RTP_HEADER_SIZE] & 0x1F) == RTP_H264_FU_A && s == (data_start == 1) &&
+                    e == (data_start + data_len == nal_len);
+                if (s) {
+                    memcpy(out + out_len, "\0\0\0\1", 4);
+                    out[out_len + 4] = (hdr[RTP_HEADER_SIZE] & 0xE0) | (hdr[RTP_HEADER_SIZE + 1] & 0x1F);
+                    out_len += 5;
+                }
+            }
+            if (!ok || out_len + data_len > len) {
+                ok = false;
+                break;
+            }
+            memcpy(out + out_len, nal + data_start, data_len);
+            out_len += data_len;
+            offset = data_start + data_len;
+        } while (offset < nal_len);
+    }
+    ok = ok && marker && out_len == len && !memcmp(out, au, len);
+    free(out);
+    return ok;
+}
+
+static bool h264_run(const yuv_t *frames, int count, const h264_enc_config_t *cfg, const char *out_dir,
+                     h264_result_t *r) {
+    memset(r, 0, sizeof(*r));
+    r->rtp_ok = true;
+    size_t mem_size = h264_enc_mem_size(cfg->width, cfg->height);
+    void *mem = malloc(mem_size);
+    size_t cap = (size_t)cfg->width * cfg->height * 2;
+    uint8_t *au = malloc(cap);
+    h264_enc_t enc;
+    if (!h264_enc_init(&enc, cfg, mem, mem_size)) {
+        free(mem);
+        free(au);
+        return false;
+    }
+    FILE *es = NULL, *rec = NULL;
+    if (out_dir) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/h264_%dx%d_%luk.h264", out_dir, cfg->width, cfg->height,
+            (unsigned long)(cfg->bitrate / 1000));
+        es = fopen(path, "wb");
+        snprintf(path, sizeof(path), "%s/h264_%dx%d_%luk.yuv", out_dir, cfg->width, cfg->height,
+            (unsigned long)(cfg->bitrate / 1000));
+        rec = fopen(path, "wb");
+    }
+
+    for (int i = 0; i < count; i++) {
+        h264_picture_t pic = yuv_picture(&frames[i]);
+        double start = now_s();
+        size_t len = h264_enc_encode(&enc, &pic, au, cap);
+        r->seconds += now_s() - start;
+        if (!len) {
+            continue;
+        }
+        r->bytes += len;
+        r->rtp_ok = r->rtp_ok && rtp_roundtrip(au, len, 1400) && rtp_roundtrip(au, len, 508);
+        if (enc.stats.last_idr) {
+            r->idr_bytes += len;
+            r->idr_frames++;
+        }
+        r->qp_sum += enc.stats.last_qp;
+        r->at_qp_max += enc.stats.last_qp >= cfg->qp_max;
+        h264_picture_t dec = h264_enc_recon(&enc);
+        r->sse += plane_sse(dec.y, dec.y_stride, pic.y, pic.y_stride, cfg->width, cfg->height);
+        if (es) {
+            fwrite(au, 1, len, es);
+        }
+        if (rec) {
+            for (int y = 0; y < cfg->height; y++) {
+                fwrite(dec.y + y * dec.y_stride, 1, cfg->width, rec);
+            }
+            for (int p = 0; p < 2; p++) {
+                const uint8_t *plane = p ? dec.v : dec.u;
+                for (int y = 0; y < cfg->height / 2; y++) {
+                    fwrite(plane + y * dec.uv_stride, 1, cfg->width / 2, rec);
+                }
+            }
+        }
+    }
+    r->dropped = enc.stats.dropped;
+    r->skip_mbs = enc.stats.skip_mbs;
+    r->total_mbs = enc.stats.skip_mbs + enc.stats.inter_mbs + enc.stats.intra_mbs;
+    if (es) {
+        fclose(es);
+    }
+    if (rec) {
+        fclose(rec);
+    }
+    free(mem);
+    free(au);
+    return true;
+}
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+// A VLC table is usable if no code is a prefix of another (Kraft sum <= 1
+// and no clashes)
+static bool prefix_code(const uint8_t *len, const uint8_t *code, int n) {
+    double kraft = 0;
+    for (int i = 0; i < n; i++) {
+        if (!len[i]) {
+            continue;
+        }
+        kraft += 1.0 / (1u << len[i]);
+        for (int j = 0; j < n; j++) {
+            if (j == i || !len[j] || len[j] < len[i]) {
+                continue;
+            }
+            if ((code[j] >> (len[j] - len[i])) == code[i] && (len[j] > len[i] || j < i)) {
+                return false;
+            }
+        }
+    }
+    return kraft <= 1.0 + 1e-9;
+}
+
+static void check_tables(void) {
+    for (int t = 0; t < 3; t++) {
+        check(prefix_code(h264_coeff_token_len[t], h264_coeff_token_code[t], 4 * 17), "coeff_token table");
+    }
+    check(prefix_code(h264_chroma_dc_token_len, h264_chroma_dc_token_code, 4 * 5), "chroma DC coeff_token table");
+    for (int t = 0; t < 15; t++) {
+        check(prefix_code(h264_total_zeros_len[t], h264_total_zeros_code[t], 16 - t), "total_zeros table");
+    }
+    for (int t = 0; t < 3; t++) {
+        check(prefix_code(h264_chroma_dc_zeros_len[t], h264_chroma_dc_zeros_code[t], 4 - t), "chroma DC total_zeros table");
+    }
+    for (int t = 0; t < 7; t++) {
+        check(prefix_code(h264_run_len[t], h264_run_code[t], t < 6 ? t + 2 : 15), "run_before table");
+    }
+    bool seen[48] = {0};
+    for (int i = 0; i < 48; i++) {
+        seen[h264_inter_cbp_code[i]] = true;
+    }
+    for (int i = 0; i < 48; i++) {
+        check(seen[i], "inter coded_block_pattern mapping");
+    }
+}
+
+static int parse_list(const char *s, int *out, int max) {
+    int n = 0;
+    while (*s && n < max) {
+        out[n++] = atoi(s);
+        s = strchr(s, ',');
+        if (!s) {
+            break;
+        }
+        s++;
+    }
+    return n;
+}
+
+int main(int argc, char **argv) {
+    int fps = 10, gop = 50, quality = 80, max_frames = 150;
+    int rates[MAX_RATES] = { 250, 500, 1000 }, rate_count = 3;
+    const char *sizes_arg = "qvga,hvga,vga";
+    const char *out_dir = NULL;
+    frame_t *frames = NULL;
+    int count = 0;
+    double recorded_bytes = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--fps") && i + 1 < argc) {
+            fps = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--gop") && i + 1 < argc) {
+            gop = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--kbps") && i + 1 < argc) {
+            rate_count = parse_list(argv[++i], rates, MAX_RATES);
+        } else if (!strcmp(argv[i], "--sizes") && i + 1 < argc) {
+            sizes_arg = argv[++i];
+        } else if (!strcmp(argv[i], "--quality") && i + 1 < argc) {
+            quality = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+            max_frames = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--out") && i + 1 < argc) {
+            out_dir = argv[++i];
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "usage: %s [--fps N] [--gop N] [--kbps 250,500,1000] [--sizes qvga,hvga,vga] "
+                "[--quality N] [--frames N] [--out DIR] [sequence.mjpeg ...]\n", argv[0]);
+            return 2;
+        } else {
+            size_t len;
+            uint8_t *buf = read_file(argv[i], &len);
+            if (!buf) {
+                fprintf(stderr, "%s: cannot read\n", argv[i]);
+                return 2;
+            }
+            int before = count;
+            count = split_frames(buf, len, &frames, count);
+            printf("%s: %d frames\n", argv[i], count - before);
+        }
+    }
+    if (fps <= 0 || rate_count == 0) {
+        fprintf(stderr, "bad --fps or --kbps\n");
+        return 2;
+    }
+    bool synthetic = count == 0;
+    if (count > max_frames) {
+        count = max_frames;
+    }
+    if (synthetic) {
+        count = max_frames;
+        printf("synthetic trackside scene: %d frames\n", count);
+    } else {
+        for (int i = 0; i < count; i++) {
+            recorded_bytes += frames[i].len;
+        }
+    }
+
+    check_tables();
+
+    size_t_entry sizes[MAX_SIZES];
+    int size_count = 0;
+    for (const char *s = sizes_arg; *s && size_count < MAX_SIZES;) {
+        size_t n = strcspn(s, ",");
+        for (size_t k = 0; k < sizeof(known_sizes) / sizeof(known_sizes[0]); k++) {
+            if (strlen(known_sizes[k].name) == n && !strncmp(s, known_sizes[k].name, n)) {
+                sizes[size_count++] = known_sizes[k];
+            }
+        }
+        s += n + (s[n] == ',');
+    }
+
+    for (int si = 0; si < size_count; si++) {
+        int w = sizes[si].w, h = sizes[si].h;
+        yuv_t *seq = calloc(count, sizeof(yuv_t));
+        int src_w = w, src_h = h, usable = 0;
+        for (int i = 0; i < count; i++) {
+            yuv_alloc(&seq[usable], w, h);
+            if (synthetic) {
+                synthetic_frame(&seq[usable], i, count);
+            } else if (!decode_scaled(&frames[i], &seq[usable], &src_w, &src_h)) {
+                free(seq[usable].y);
+                continue;
+            }
+            usable++;
+        }
+        if (usable == 0) {
+            free(seq);
+            continue;
+        }
+        double seconds = (double)usable / fps;
+        printf("\n%s %dx%d, %d frames at %d fps, IDR every %d frames\n", sizes[si].name, w, h, usable, fps, gop);
+        printf("  %-12s %8s %9s %7s %8s %8s %8s %6s %6s\n", "codec", "kbit/s", "KB/frame", "PSNR-Y",
+            "enc fps", "IDR KB", "vs MJPEG", "avg QP", "skip");
+        if (!synthetic && si == 0) {
+            printf("  %-12s %8.0f %9.1f %7s %8s %8s %8s %6s %6s   (%dx%d as sent by the camera)\n", "recorded",
+                recorded_bytes * 8 / 1000 / ((double)count / fps), recorded_bytes / 1024 / count,
+                "-", "-", "-", "-", "-", "-", src_w, src_h);
+        }
+
+        mjpeg_result_t mj = {0};
+        for (int i = 0; i < usable; i++) {
+            mjpeg_frame(&seq[i], quality, &mj);
+        }
+        double mjpeg_kbps = mj.bytes * 8 / 1000 / seconds;
+        char label[24];
+        snprintf(label, sizeof(label), "mjpeg q%d", quality);
+        printf("  %-12s %8.0f %9.1f %7.2f %8.0f %8s %8s %6s %6s\n", label, mjpeg_kbps, mj.bytes / 1024 / usable,
+            psnr(mj.sse, (double)w * h * usable), usable / mj.seconds, "-", "1.0x", "-", "-");
+
+        for (int ri = 0; ri < rate_count; ri++) {
+            h264_enc_config_t cfg = h264_enc_default_config(w, h);
+            cfg.fps = (uint16_t)fps;
+            cfg.gop = (uint16_t)gop;
+            cfg.bitrate = (uint32_t)rates[ri] * 1000;
+            h264_result_t r;
+            if (!h264_run(seq, usable, &cfg, out_dir, &r)) {
+                check(false, "encoder init");
+                continue;
+            }
+            double kbps = r.bytes * 8 / 1000 / seconds;
+            snprintf(label, sizeof(label), "h264 %dk", rates[ri]);
+            printf("  %-12s %8.0f %9.1f %7.2f %8.0f %8.1f %7.1fx %6.1f %5.0f%%\n", label, kbps,
+                r.bytes / 1024 / usable, psnr(r.sse, (double)w * h * usable), usable / r.seconds,
+                r.idr_frames ? r.idr_bytes / 1024 / r.idr_frames : 0.0, mjpeg_kbps / kbps,
+                r.qp_sum / usable, 100.0 * r.skip_mbs / r.total_mbs);
+
+            char what[96];
+            snprintf(what, sizeof(what), "%dx%d at %d kbit/s: frames dropped", w, h, rates[ri]);
+            check(r.dropped == 0, what);
+            snprintf(what, sizeof(what), "%dx%d at %d kbit/s: RTP packetization roundtrip", w, h, rates[ri]);
+            check(r.rtp_ok, what);
+            // The target is a ceiling: still stretches come in below it
+            snprintf(what, sizeof(what), "%dx%d at %d kbit/s: rate control overshot (%.0f kbit/s)", w, h,
+                rates[ri], kbps);
+            check(kbps <= rates[ri] * 1.2 || r.at_qp_max >= usable / 4, what);
+        }
+
+        // Airtime at equal quality: the coarsest constant QP that matches MJPEG's PSNR
+        double mjpeg_psnr = psnr(mj.sse, (double)w * h * usable);
+        int lo = 0, hi = 51, best_qp = -1;
+        h264_result_t best;
+        while (lo <= hi) {
+            int qp = (lo + hi) / 2;
+            h264_enc_config_t cfg = h264_enc_default_config(w, h);
+            cfg.fps = (uint16_t)fps;
+            cfg.gop = (uint16_t)gop;
+            cfg.bitrate = 0;
+            cfg.qp = (uint8_t)qp;
+            cfg.qp_min = 0;
+            cfg.qp_max = 51;
+            h264_result_t r;
+            h264_run(seq, usable, &cfg, NULL, &r);
+            if (psnr(r.sse, (double)w * h * usable) >= mjpeg_psnr) {
+                best_qp = qp;
+                best = r;
+                lo = qp + 1;
+            } else {
+                hi = qp - 1;
+            }
+        }
+        if (best_qp >= 0) {
+            double kbps = best.bytes * 8 / 1000 / seconds;
+            snprintf(label, sizeof(label), "h264 qp%d", best_qp);
+            printf("  %-12s %8.0f %9.1f %7.2f %8.0f %8.1f %7.1fx %6d %5.0f%%   (same PSNR as MJPEG)\n", label,
+                kbps, best.bytes / 1024 / usable, psnr(best.sse, (double)w * h * usable), usable / best.seconds,
+                best.idr_frames ? best.idr_bytes / 1024 / best.idr_frames : 0.0, mjpeg_kbps / kbps, best_qp,
+                100.0 * best.skip_mbs / best.total_mbs);
+        }
+
+        // A still scene: after the IDR nearly every macroblock is skipped
+        yuv_t *still = malloc(STILL_FRAMES * sizeof(yuv_t));
+        for (int i = 0; i < STILL_FRAMES; i++) {
+            still[i] = seq[0];
+        }
+        h264_enc_config_t cfg = h264_enc_default_config(w, h);
+        cfg.fps = (uint16_t)fps;
+        cfg.bitrate = 0;
+        h264_result_t r;
+        h264_run(still, STILL_FRAMES, &cfg, NULL, &r);
+        int mbs = ((w + 15) / 16) * ((h + 15) / 16);
+        double p_bytes = (r.bytes - r.idr_bytes) / (STILL_FRAMES - 1);
+        printf("  still scene: IDR %.1f KB, P-frames %.0f bytes, %.1f%% skipped\n", r.idr_bytes / 1024, p_bytes,
+            100.0 * r.skip_mbs / ((STILL_FRAMES - 1) * mbs));
+        check(r.skip_mbs >= (uint32_t)((STILL_FRAMES - 1) * mbs * 95 / 100), "still scene not skipped");
+        free(still);
+
+        for (int i = 0; i < usable; i++) {
+            free(seq[i].y);
+        }
+        free(seq);
+    }
+
+    if (failures) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+// Host stand-in for esp32-camera's sensor.h, for the tools that drive
+// main/camera_preset.h and main/camera_roi.h against a fake sensor.
+//
+// Only the parts those headers use: framesize_t and the resolution table
+// (same order and sizes as the component), gainceiling_t, the sensor IDs,
+// the status fields and the sensor_t setters. Build with -Itools/host.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define OV2640_PID 0x26
+#define OV3660_PID 0x3660
+#define OV5640_PID 0x5640
+
+typedef enum {
+    FRAMESIZE_96X96,    // 96x96
+    FRAMESIZE_QQVGA,    // 160x120
+    FRAMESIZE_128X128,  // 128x128
+    FRAMESIZE_QCIF,     // 176x144
+    FRAMESIZE_HQVGA,    // 240x176
+    FRAMESIZE_240X240,  // 240x240
+    FRAMESIZE_QVGA,     // 320x240
+    FRAMESIZE_320X320,  // 320x320
+    FRAMESIZE_CIF,      // 400x296
+    FRAMESIZE_HVGA,     // 480x320
+    FRAMESIZE_VGA,      // 640x480
+    FRAMESIZE_SVGA,     // 800x600
+    FRAMESIZE_XGA,      // 1024x768
+    FRAMESIZE_HD,       // 1280x720
+    FRAMESIZE_SXGA,     // 1280x1024
+    FRAMESIZE_UXGA,     // 1600x1200
+    FRAMESIZE_FHD,      // 1920x1080
+    FRAMESIZE_P_HD,     // 720x1280
+    FRAMESIZE_P_3MP,    // 864x1536
+    FRAMESIZE_QXGA,     // 2048x1536
+    FRAMESIZE_QHD,      // 2560x1440
+    FRAMESIZE_WQXGA,    // 2560x1600
+    FRAMESIZE_P_FHD,    // 1080x1920
+    FRAMESIZE_QSXGA,    // 2560x1920
+    FRAMESIZE_INVALID
+} framesize_t;
+
+typedef struct {
+    const uint16_t width;
+    const uint16_t height;
+} resolution_info_t;
+
+static const resolution_info_t resolution[FRAMESIZE_INVALID] = {
+    {   96,   96 }, {  160,  120 }, {  128,  128 }, {  176,  144 }, {  240,  176 }, {  240,  240 },
+    {  320,  240 }, {  320,  320 }, {  400,  296 }, {  480,  320 }, {  640,  480 }, {  800,  600 },
+    { 1024,  768 }, { 1280,  720 }, { 1280, 1024 }, { 1600, 1200 }, { 1920, 1080 }, {  720, 1280 },
+    {  864, 1536 }, { 2048, 1536 }, { 2560, 1440 }, { 2560, 1600 }, { 1080, 1920 }, { 2560, 1920 },
+};
+
+typedef enum {
+    GAINCEILING_2X,
+    GAINCEILING_4X,
+    GAINCEILING_8X,
+    GAINCEILING_16X,
+    GAINCEILING_32X,
+    GAINCEILING_64X,
+    GAINCEILING_128X,
+} gainceiling_t;
+
+typedef struct {
+    uint8_t MIDH;
+    uint8_t MIDL;
+    uint16_t PID;
+    uint8_t VER;
+} sensor_id_t;
+
+typedef struct {
+    framesize_t framesize;
+    bool scale;
+    bool binning;
+    uint8_t quality;
+    uint8_t gainceiling;
+    uint8_t aec;
+    uint8_t aec2;
+    int8_t ae_level;
+    uint16_t aec_value;
+    uint8_t agc;
+    uint8_t agc_gain;
+} camera_status_t;
+
+typedef struct _sensor sensor_t;
+typedef struct _sensor {
+    sensor_id_t id;
+    camera_status_t status;
+    int xclk_freq_hz;
+
+    int (*set_framesize)(sensor_t *sensor, framesize_t framesize);
+    int (*set_quality)(sensor_t *sensor, int quality);
+    int (*set_gainceiling)(sensor_t *sensor, gainceiling_t gainceiling);
+    int (*set_exposure_ctrl)(sensor_t *sensor, int enable);
+    int (*set_aec2)(sensor_t *sensor, int enable);
+    int (*set_ae_level)(sensor_t *sensor, int level);
+    int (*set_aec_value)(sensor_t *sensor, int gain);
+    int (*set_gain_ctrl)(sensor_t *sensor, int enable);
+    int (*set_agc_gain)(sensor_t *sensor, int gain);
+    int (*set_res_raw)(sensor_t *sensor, int startX, int startY, int endX, int endY, int offsetX, int offsetY,
+                       int totalX, int totalY, int outputX, int outputY, bool scale, bool binning);
+    int (*set_xclk)(sensor_t *sensor, int timer, int xclk);
+} sensor_t;
@@ -0,0 +1,339 @@
+// Host checks and benchmark for the response templates (main/http_template.h).
+//
+// Renders the MJPEG part header and the /status, /power and /train bodies
+// with random values through both the templates and the snprintf formats
+// they replaced. Both outputs must match once insignificant spaces are
+// removed, and must have the template's length. Also checks clamping,
+// truncation and escaping, then times both paths. Exits non-zero on any
+// mismatch.
+//
+//   cc -O2 -Imain tools/http_template_bench.c -o http_template_bench   (from camera/src)
+//   ./http_template_bench
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "http_template.h"
+
+#define BOUNDARY "frame"
+#define ROUNDS 100000
+#define BENCH_N 2000000
+
+// The formats used before the templates
+#define OLD_BOUNDARY_HEADER "\r\n--" BOUNDARY "\r\n"
+#define OLD_PART_HEADER "Content-Type: image/jpeg\r\nContent-Length: %zu\r\n\r\n"
+#define OLD_STATUS "{\"framesize\":%d,\"quality\":%d,\"brightness\":%d,\"contrast\":%d," \
+    "\"saturation\":%d,\"sharpness\":%d,\"vflip\":%d,\"hmirror\":%d,\"preset\":\"%s\"}"
+#define OLD_POWER "{\"mode\":\"%s\",\"clients\":%lu,\"avg_current_ma\":%lu," \
+    "\"wakes\":%lu,\"wake_latency_ms\":{\"last\":%lu,\"avg\":%lu,\"max\":%lu}}"
+#define OLD_TRAIN_HEAD "{\"action\":\"%s\",\"result\":\"%s\",\"state\":\"%s\",\"ready\":%d,\"hubs\":["
+#define OLD_TRAIN_HUB "%s{\"id\":%d,\"name\":\"%s\",\"addr\":\"%s\",\"state\":\"%s\"," \
+    "\"commands\":%lu,\"errors\":%lu,\"latency_ms\":%lu,\"max_latency_ms\":%lu}"
+
+static const char *presets[] = { "day", "dusk", "night", "fast", "custom", "fifteen_chars_x" };
+static const char *modes[] = { "active", "idle", "low" };
+static const char *states[] = { "disconnected", "scanning", "connecting", "discovering", "initializing", "ready" };
+static const char *actions[] = { "status", "forward", "backward", "stop" };
+static const char *names[] = { "Pybricks Hub", "", "Loco-2", "twenty_three_characters" };
+
+static http_templates_t tpl;
+static int failures = 0;
+static volatile size_t sink;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { failures++; printf("FAIL: " __VA_ARGS__); printf("\n"); } \
+} while (0)
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int rnd(int lo, int hi) {
+    return lo + rand() % (hi - lo + 1);
+}
+
+// Drop spaces outside JSON strings (header text has no quotes)
+static size_t squeeze(const char *in, size_t len, char *out) {
+    size_t n = 0;
+    bool in_string = false;
+    for (size_t i = 0; i < len; i++) {
+        if (in[i] == '"') in_string = !in_string;
+        if (in[i] != ' ' || in_string) out[n++] = in[i];
+    }
+    out[n] = '\0';
+    return n;
+}
+
+static void compare(const char *what, const char *a, size_t a_len, const char *b, size_t b_len, size_t want_len) {
+    char sa[2048], sb[2048];
+    squeeze(a, a_len, sa);
+    squeeze(b, b_len, sb);
+    if (strcmp(sa, sb) != 0 || a_len != want_len) {
+        failures++;
+        if (failures < 5) {
+            printf("FAIL: %s (len %zu, want %zu)\n  template: %s\n  snprintf: %s\n", what, a_len, want_len, sa, sb);
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// The two render paths for each response
+
+typedef struct {
+    int framesize, quality, brightness, contrast, saturation, sharpness, vflip, hmirror;
+    const char *preset;
+} status_t;
+
+typedef struct {
+    const char *mode;
+    uint32_t clients, avg_ma, wakes, last_ms, avg_ms, max_ms;
+} power_t;
+
+typedef struct {
+    const char *name, *addr, *state;
+    uint32_t commands, errors, latency_ms, max_latency_ms;
+} hub_t;
+
+static size_t part_old(char *out, size_t jpeg_len) {
+    // Two sends before: the constant boundary, then the formatted header
+    size_t n = strlen(OLD_BOUNDARY_HEADER);
+    memcpy(out, OLD_BOUNDARY_HEADER, n);
+    return n + snprintf(out + n, 128, OLD_PART_HEADER, jpeg_len);
+}
+
+static size_t part_new(char *out, size_t jpeg_len) {
+    size_t n = http_tpl_begin(&tpl.mjpeg_part, out);
+    http_tpl_set_uint(&tpl.mjpeg_part, out, 0, jpeg_len);
+    return n;
+}
+
+// The stream handler keeps the rendered header between frames
+static size_t part_new_reuse(char *out, size_t jpeg_len) {
+    http_tpl_set_uint(&tpl.mjpeg_part, out, 0, jpeg_len);
+    return tpl.mjpeg_part.len;
+}
+
+static size_t status_old(char *out, const status_t *s) {
+    snprintf(out, 256, OLD_STATUS, s->framesize, s->quality, s->brightness, s->contrast,
+        s->saturation, s->sharpness, s->vflip, s->hmirror, s->preset);
+    return strlen(out);
+}
+
+static size_t status_new(char *out, const status_t *s) {
+    const http_tpl_t *t = &tpl.status;
+    size_t len = http_tpl_begin(t, out);
+    http_tpl_set_int(t, out, HTTP_STATUS_FRAMESIZE, s->framesize);
+    http_tpl_set_int(t, out, HTTP_STATUS_QUALITY, s->quality);
+    http_tpl_set_int(t, out, HTTP_STATUS_BRIGHTNESS, s->brightness);
+    http_tpl_set_int(t, out, HTTP_STATUS_CONTRAST, s->contrast);
+    http_tpl_set_int(t, out, HTTP_STATUS_SATURATION, s->saturation);
+    http_tpl_set_int(t, out, HTTP_STATUS_SHARPNESS, s->sharpness);
+    http_tpl_set_int(t, out, HTTP_STATUS_VFLIP, s->vflip);
+    http_tpl_set_int(t, out, HTTP_STATUS_HMIRROR, s->hmirror);
+    http_tpl_set_str(t, out, HTTP_STATUS_PRESET, s->preset);
+    return len;
+}
+
+static size_t power_old(char *out, const power_t *p) {
+    snprintf(out, 256, OLD_POWER, p->mode, (unsigned long)p->clients, (unsigned long)p->avg_ma,
+        (unsigned long)p->wakes, (unsigned long)p->last_ms, (unsigned long)p->avg_ms, (unsigned long)p->max_ms);
+    return strlen(out);
+}
+
+static size_t power_new(char *out, const power_t *p) {
+    const http_tpl_t *t = &tpl.power;
+    size_t len = http_tpl_begin(t, out);
+    http_tpl_set_str(t, out, HTTP_POWER_MODE, p->mode);
+    http_tpl_set_uint(t, out, HTTP_POWER_CLIENTS, p->clients);
+    http_tpl_set_uint(t, out, HTTP_POWER_AVG_MA, p->avg_ma);
+    http_tpl_set_uint(t, out, HTTP_POWER_WAKES, p->wakes);
+    http_tpl_set_uint(t, out, HTTP_POWER_LAST_MS, p->last_ms);
+    http_tpl_set_uint(t, out, HTTP_POWER_AVG_MS, p->avg_ms);
+    http_tpl_set_uint(t, out, HTTP_POWER_MAX_MS, p->max_ms);
+    return len;
+}
+
+static size_t train_old(char *out, size_t size, const char *action, const char *state, int ready,
+                        const hub_t *hubs, int count) {
+    int len = snprintf(out, size, OLD_TRAIN_HEAD, action, "ok", state, ready);
+    for (int i = 0; i < count && len < (int)size; i++) {
+        const hub_t *h = &hubs[i];
+        len += snprintf(out + len, size - len, OLD_TRAIN_HUB, i ? "," : "", i, h->name, h->addr, h->state,
+            (unsigned long)h->commands, (unsigned long)h->errors,
+            (unsigned long)h->latency_ms, (unsigned long)h->max_latency_ms);
+    }
+    if (len < (int)size - 2) {
+        strcpy(out + len, "]}");
+    }
+    return strlen(out);
+}
+
+static size_t train_new(char *out, const char *action, const char *state, int ready,
+                        const hub_t *hubs, int count) {
+    const http_tpl_t *head = &tpl.train_head;
+    size_t len = http_tpl_begin(head, out);
+    http_tpl_set_str(head, out, HTTP_TRAIN_ACTION, action);
+    http_tpl_set_str(head, out, HTTP_TRAIN_RESULT, "ok");
+    http_tpl_set_str(head, out, HTTP_TRAIN_STATE, state);
+    http_tpl_set_uint(head, out, HTTP_TRAIN_READY, ready);
+
+    const http_tpl_t *row = &tpl.train_hub;
+    for (int i = 0; i < count; i++) {
+        const hub_t *h = &hubs[i];
+        if (i > 0) {
+            out[len++] = ',';
+        }
+        char *o = out + len;
+        len += http_tpl_begin(row, o);
+        http_tpl_set_uint(row, o, HTTP_HUB_ID, i);
+        http_tpl_set_str(row, o, HTTP_HUB_NAME, h->name);
+        http_tpl_set_str(row, o, HTTP_HUB_ADDR, h->addr);
+        http_tpl_set_str(row, o, HTTP_HUB_STATE, h->state);
+        http_tpl_set_uint(row, o, HTTP_HUB_COMMANDS, h->commands);
+        http_tpl_set_uint(row, o, HTTP_HUB_ERRORS, h->errors);
+        http_tpl_set_uint(row, o, HTTP_HUB_LATENCY_MS, h->latency_ms);
+        http_tpl_set_uint(row, o, HTTP_HUB_MAX_LATENCY_MS, h->max_latency_ms);
+    }
+    out[len++] = ']';
+    out[len++] = '}';
+    return len;
+}
+
+static status_t random_status(void) {
+    status_t s = {
+        .framesize = rnd(0, 23), .quality = rnd(0, 63), .brightness = rnd(-2, 2), .contrast = rnd(-2, 2),
+        .saturation = rnd(-2, 2), .sharpness = rnd(-2, 2), .vflip = rnd(0, 1), .hmirror = rnd(0, 1),
+        .preset = presets[rnd(0, 5)],
+    };
+    return s;
+}
+
+static power_t random_power(void) {
+    power_t p = {
+        .mode = modes[rnd(0, 2)], .clients = rnd(0, 4), .avg_ma = rnd(0, 400),
+        .wakes = rand() % 2 ? (uint32_t)rand() * 2u + 1 : (uint32_t)rnd(0, 9),
+        .last_ms = rnd(0, 99999), .avg_ms = rnd(0, 9999), .max_ms = rnd(0, 999999),
+    };
+    return p;
+}
+
+static void random_hubs(hub_t *hubs, int count) {
+    static char addrs[4][18];
+    for (int i = 0; i < count; i++) {
+        snprintf(addrs[i], sizeof(addrs[i]), "90:84:2b:%02x:%02x:%02x", rnd(0, 255), rnd(0, 255), rnd(0, 255));
+        hubs[i] = (hub_t){
+            .name = names[rnd(0, 3)], .addr = rand() % 4 ? addrs[i] : "", .state = states[rnd(0, 5)],
+            .commands = (uint32_t)rand(), .errors = rnd(0, 1000), .latency_ms = rnd(0, 3000),
+            .max_latency_ms = rnd(0, 999999),
+        };
+    }
+}
+
+// ---------------------------------------------------------------------------
+
+static void check_random(void) {
+    char a[2048], b[2048];
+    for (int r = 0; r < ROUNDS; r++) {
+        size_t jpeg_len = rand() % 2 ? (size_t)rnd(0, 9) : (size_t)rnd(0, 9999999);
+        compare("mjpeg part", a, part_new(a, jpeg_len), b, part_old(b, jpeg_len), tpl.mjpeg_part.len);
+
+        status_t s = random_status();
+        compare("status", a, status_new(a, &s), b, status_old(b, &s), tpl.status.len);
+
+        power_t p = random_power();
+        compare("power", a, power_new(a, &p), b, power_old(b, &p), tpl.power.len);
+
+        hub_t hubs[4];
+        int count = rnd(0, 4);
+        random_hubs(hubs, count);
+        const char *action = actions[rnd(0, 3)];
+        const char *state = states[rnd(0, 5)];
+        int ready = rnd(0, count);
+        size_t want = tpl.train_head.len + count * (tpl.train_hub.len + 1) - (count ? 1 : 0) + 2;
+        compare("train", a, train_new(a, action, state, ready, hubs, count),
+            b, train_old(b, sizeof(b), action, state, ready, hubs, count), want);
+    }
+}
+
+static void check_edges(void) {
+    http_tpl_t t;
+    char out[64];
+
+    CHECK(http_tpl_compile(&t, "{\"a\":$$$,\"b\":@@@@@@}") && t.slot_count == 2 &&
+        t.slots[0].offset == 5 && t.slots[0].width == 3 && t.slots[1].width == 6, "compile slots");
+    CHECK(!http_tpl_compile(&t, "{\"s\":@}"), "one-character string slot rejected");
+
+    http_tpl_compile(&t, "[$$$]");
+    http_tpl_begin(&t, out);
+    CHECK(http_tpl_set_int(&t, out, 0, -12) && memcmp(out, "[-12]", 5) == 0, "negative fits");
+    CHECK(!http_tpl_set_int(&t, out, 0, -123) && memcmp(out, "[-99]", 5) == 0, "negative clamps");
+    CHECK(!http_tpl_set_uint(&t, out, 0, 1234) && memcmp(out, "[999]", 5) == 0, "positive clamps");
+    CHECK(http_tpl_set_uint(&t, out, 0, 0) && memcmp(out, "[0  ]", 5) == 0, "zero is padded");
+
+    http_tpl_compile(&t, "[" HTTP_TPL_UINT32 "|$$$$$$$$$$$]");
+    http_tpl_begin(&t, out);
+    http_tpl_set_uint(&t, out, 0, UINT32_MAX);
+    http_tpl_set_int(&t, out, 1, INT32_MIN);
+    CHECK(memcmp(out, "[4294967295|-2147483648]", 24) == 0, "32-bit extremes");
+
+    http_tpl_compile(&t, "[@@@@@@]");
+    http_tpl_begin(&t, out);
+    CHECK(!http_tpl_set_str(&t, out, 0, "abcdef") && memcmp(out, "[\"abcd\"]", 8) == 0, "string truncates");
+    CHECK(http_tpl_set_str(&t, out, 0, "a\"\\\n") && memcmp(out, "[\"a___\"]", 8) == 0, "string escapes");
+    CHECK(http_tpl_set_str(&t, out, 0, "") && memcmp(out, "[\"\"    ]", 8) == 0, "empty string");
+}
+
+#define BENCH(label, expr) do { \
+    double t0 = now_s(); \
+    for (int i = 0; i < BENCH_N; i++) { sink += (expr); } \
+    times[n_times++] = (now_s() - t0) / BENCH_N * 1e9; \
+    (void)label; \
+} while (0)
+
+static void bench(void) {
+    char out[2048];
+    double times[8];
+    int n_times = 0;
+    status_t s = random_status();
+    power_t p = random_power();
+    hub_t hubs[4];
+    random_hubs(hubs, 4);
+    part_new(out, 0);
+
+    BENCH("part old", part_old(out, 40000 + (i & 1023)));
+    BENCH("part new", part_new_reuse(out, 40000 + (i & 1023)));
+    BENCH("status old", status_old(out, &s));
+    BENCH("status new", status_new(out, &s));
+    BENCH("power old", power_old(out, &p));
+    BENCH("power new", power_new(out, &p));
+    BENCH("train old", train_old(out, sizeof(out), "status", "ready", 4, hubs, 4));
+    BENCH("train new", train_new(out, "status", "ready", 4, hubs, 4));
+
+    const char *rows[] = { "MJPEG part header", "/status", "/power", "/train (4 hubs)" };
+    printf("%-20s %12s %12s %8s\n", "render", "snprintf ns", "template ns", "speedup");
+    for (int r = 0; r < 4; r++) {
+        printf("%-20s %12.1f %12.1f %7.1fx\n", rows[r], times[2 * r], times[2 * r + 1], times[2 * r] / times[2 * r + 1]);
+    }
+    printf("part header sends per frame: 2 -> 1 (%u bytes)\n", tpl.mjpeg_part.len);
+}
+
+int main(void) {
+    if (!http_templates_compile(&tpl, HTTP_TPL_MJPEG_PART(BOUNDARY))) {
+        printf("FAIL: templates do not compile\n");
+        return 1;
+    }
+    srand(1);
+    check_edges();
+    check_random();
+    bench();
+    if (failures) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,352 @@
+// Host benchmark of near-duplicate frame suppression (main/jpeg_signature.h)
+// over recorded MJPEG sequences.
+//
+// Each file is split into its JPEGs (a raw /stream recording, concatenated
+// JPEGs or single .jpg files all work). The frames are replayed at --fps
+// through jpeg_dedup_check() for a sweep of cell thresholds and minimum
+// changed cells, and for each setting the tool prints the bytes saved and
+// the false-suppression rate.
+//
+// Ground truth comes from the pixels, not the signature: every frame's
+// luma is fully decoded (IDCT in this tool, fed by jpeg_sig_scan()'s block
+// callback) and compared with the frame the receiver is showing, i.e. the
+// last one sent. A frame visibly differs if some 16x16 tile has at least
+// TILE_PIXELS pixels more than PIXEL_DELTA grey levels apart. A suppressed
+// frame that visibly differs is a false suppression; a sent frame that
+// does not (and is not a refresh) is a needless send. "Stale" is the
+// longest time a receiver showed a visibly outdated frame.
+//
+// Also checks that the DC-only signature matches the one taken with full
+// coefficients, and that a truncated frame gives no signature (so it is
+// sent), and times the signature extraction.
+//
+//   cc -O2 -Imain tools/jpeg_sig_bench.c -o jpeg_sig_bench -lm   (from camera/src)
+//   curl -s --max-time 60 "http://train.local:81/stream?dedup=0" > parked.mjpeg
+//   ./jpeg_sig_bench [--fps N] [--refresh-ms N] [--threshold N --cells N] parked.mjpeg ...
+//
+// Exits non-zero if a check fails.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "jpeg_signature.h"
+
+#define PIXEL_DELTA 24
+#define TILE 16
+#define TILE_PIXELS 16
+
+typedef struct {
+    const uint8_t *buf;
+    size_t len;
+} frame_t;
+
+typedef struct {
+    int w, h;                   // Padded to whole blocks
+    int width, height;          // Image
+    uint8_t *y;
+} plane_t;
+
+static jpeg_sig_decoder_t dec;
+static float idct_cos[8][8];
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint8_t *read_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *buf = malloc(n > 0 ? n : 1);
+    if (buf && fread(buf, 1, n, f) != (size_t)n) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    *len = (size_t)n;
+    return buf;
+}
+
+// End of the JPEG starting at p: walk the segments to the scan, then find
+// the first marker other than a stuffed byte or RSTn
+static size_t jpeg_length(const uint8_t *p, size_t avail) {
+    size_t i = 2;
+    while (i + 4 <= avail) {
+        if (p[i] != 0xFF) {
+            return 0;
+        }
+        uint8_t marker = p[i + 1];
+        if (marker == 0xFF) {
+            i++;
+            continue;
+        }
+        size_t seg = jpeg_rd16(p + i + 2);
+        i += 2 + seg;
+        if (marker == 0xDA) {
+            for (; i + 1 < avail; i++) {
+                if (p[i] == 0xFF && p[i + 1] != 0x00 && (p[i + 1] & 0xF8) != 0xD0) {
+                    return p[i + 1] == 0xD9 ? i + 2 : 0;
+                }
+            }
+            return 0;
+        }
+    }
+    return 0;
+}
+
+static int split_frames(const uint8_t *buf, size_t len, frame_t **frames, int count) {
+    for (size_t i = 0; i + 3 < len;) {
+        if (buf[i] == 0xFF && buf[i + 1] == 0xD8 && buf[i + 2] == 0xFF) {
+            size_t n = jpeg_length(buf + i, len - i);
+            if (n) {
+                *frames = realloc(*frames, (count + 1) * sizeof(frame_t));
+                (*frames)[count++] = (frame_t){ buf + i, n };
+                i += n;
+                continue;
+            }
+        }
+        i++;
+    }
+    return count;
+}
+
+// Full luma decode, for the ground truth
+
+static void idct_init(void) {
+    for (int x = 0; x < 8; x++) {
+        for (int u = 0; u < 8; u++) {
+            idct_cos[x][u] = (u ? 1.0f : (float)M_SQRT1_2) * cosf((2 * x + 1) * u * (float)M_PI / 16) / 2;
+        }
+    }
+}
+
+static void luma_block(void *arg, const jpeg_sig_decoder_t *d, int comp, int bx, int by, const int16_t *coef) {
+    (void)d;
+    plane_t *pl = arg;
+    if (comp != 0 || (bx + 1) * 8 > pl->w || (by + 1) * 8 > pl->h) {
+        return;
+    }
+    float tmp[8][8];
+    for (int v = 0; v < 8; v++) {
+        for (int x = 0; x < 8; x++) {
+            float s = 0;
+            for (int u = 0; u < 8; u++) {
+                s += idct_cos[x][u] * coef[v * 8 + u];
+            }
+            tmp[v][x] = s;
+        }
+    }
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) {
+            float s = 128;
+            for (int v = 0; v < 8; v++) {
+                s += idct_cos[y][v] * tmp[v][x];
+            }
+            int p = (int)lrintf(s);
+            pl->y[(by * 8 + y) * pl->w + bx * 8 + x] = (uint8_t)(p < 0 ? 0 : p > 255 ? 255 : p);
+        }
+    }
+}
+
+static bool decode_luma(const frame_t *f, plane_t *pl, jpeg_sig_t *sig) {
+    if (!jpeg_sig_headers(&dec, f->buf, f->len)) {
+        return false;
+    }
+    const jpeg_comp_t *c = &dec.comp[0];
+    int mcus_x = (dec.width + 8 * dec.hmax - 1) / (8 * dec.hmax);
+    int mcus_y = (dec.height + 8 * dec.vmax - 1) / (8 * dec.vmax);
+    int w = mcus_x * c->h * 8, h = mcus_y * c->v * 8;
+    if (w != pl->w || h != pl->h) {
+        free(pl->y);
+        pl->y = calloc((size_t)w * h, 1);
+        pl->w = w;
+        pl->h = h;
+    }
+    pl->width = dec.width * c->h / dec.hmax;
+    pl->height = dec.height * c->v / dec.vmax;
+    return jpeg_sig_scan(&dec, f->buf, f->len, sig, luma_block, pl);
+}
+
+static bool visibly_differs(const plane_t *a, const plane_t *b) {
+    if (a->w != b->w || a->h != b->h || a->width != b->width || a->height != b->height) {
+        return true;
+    }
+    for (int ty = 0; ty < a->height; ty += TILE) {
+        for (int tx = 0; tx < a->width; tx += TILE) {
+            int moved = 0;
+            for (int y = ty; y < ty + TILE && y < a->height; y++) {
+                for (int x = tx; x < tx + TILE && x < a->width; x++) {
+                    int d = a->y[y * a->w + x] - b->y[y * b->w + x];
+                    moved += d > PIXEL_DELTA || d < -PIXEL_DELTA;
+                }
+            }
+            if (moved >= TILE_PIXELS) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// One replay of the sequence
+
+typedef struct {
+    int frames;
+    int sent;
+    int suppressed;
+    int refreshed;
+    int false_suppressed;
+    int needless;
+    int stale_frames;           // Longest run of false suppressions
+    uint64_t bytes;
+    uint64_t bytes_sent;
+} replay_t;
+
+static replay_t replay(const frame_t *frames, int count, const jpeg_dedup_cfg_t *cfg, int fps) {
+    replay_t r = {0};
+    jpeg_dedup_t dd;
+    jpeg_dedup_reset(&dd);
+    plane_t cur = {0}, shown = {0};
+    jpeg_sig_t sig;
+    int run = 0;
+    for (int i = 0; i < count; i++) {
+        bool decoded = decode_luma(&frames[i], &cur, &sig);
+        int64_t t = (int64_t)i * 1000000 / fps;
+        uint32_t refreshed = dd.refreshed;
+        bool send = jpeg_dedup_check(&dd, cfg, &sig, frames[i].len, t);
+        bool differs = !decoded || !shown.y || visibly_differs(&cur, &shown);
+
+        r.frames++;
+        r.bytes += frames[i].len;
+        if (send) {
+            r.sent++;
+            r.bytes_sent += frames[i].len;
+            if (dd.refreshed != refreshed) {
+                r.refreshed++;
+            } else if (!differs) {
+                r.needless++;
+            }
+            run = 0;
+            plane_t keep = shown;
+            shown = cur;
+            cur = keep;
+        } else {
+            r.suppressed++;
+            r.false_suppressed += differs;
+            run = differs ? run + 1 : 0;
+            if (run > r.stale_frames) {
+                r.stale_frames = run;
+            }
+        }
+    }
+    free(cur.y);
+    free(shown.y);
+    return r;
+}
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+int main(int argc, char **argv) {
+    int fps = 20, refresh_ms = 2000;
+    int threshold = -1, cells = -1;
+    frame_t *frames = NULL;
+    int count = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--fps") && i + 1 < argc) {
+            fps = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--refresh-ms") && i + 1 < argc) {
+            refresh_ms = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--threshold") && i + 1 < argc) {
+            threshold = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--cells") && i + 1 < argc) {
+            cells = atoi(argv[++i]);
+        } else {
+            size_t len;
+            uint8_t *buf = read_file(argv[i], &len);
+            if (!buf) {
+                fprintf(stderr, "%s: cannot read\n", argv[i]);
+                return 2;
+            }
+            int before = count;
+            count = split_frames(buf, len, &frames, count);
+            printf("%s: %d frames\n", argv[i], count - before);
+        }
+    }
+    if (count == 0 || fps <= 0) {
+        fprintf(stderr, "usage: %s [--fps N] [--refresh-ms N] [--threshold N --cells N] sequence.mjpeg ...\n", argv[0]);
+        return 2;
+    }
+    idct_init();
+
+    // Signature cost, and the DC-only path against the full decode
+    jpeg_sig_t sig, full;
+    plane_t pl = {0};
+    int valid = 0;
+    uint64_t bytes = 0;
+    double start = now_s();
+    for (int i = 0; i < count; i++) {
+        valid += jpeg_sig_extract(&dec, frames[i].buf, frames[i].len, &sig);
+        bytes += frames[i].len;
+    }
+    double elapsed = now_s() - start;
+    for (int i = 0; i < count; i++) {
+        bool a = jpeg_sig_extract(&dec, frames[i].buf, frames[i].len, &sig);
+        bool b = decode_luma(&frames[i], &pl, &full);
+        if (a != b || (a && memcmp(sig.cell, full.cell, sizeof(sig.cell)) != 0)) {
+            check(false, "DC-only signature differs from the full decode");
+            break;
+        }
+    }
+    check(!jpeg_sig_extract(&dec, frames[0].buf, frames[0].len / 2, &sig), "truncated frame gave a signature");
+    free(pl.y);
+    jpeg_sig_extract(&dec, frames[0].buf, frames[0].len, &sig);
+    printf("%d x %d, %d of %d frames readable, %.1f KB/frame\n", sig.width, sig.height, valid, count,
+        bytes / 1024.0 / count);
+    printf("signature: %.0f us/frame, %.1f MB/s (this machine)\n\n", elapsed * 1e6 / count, bytes / elapsed / 1e6);
+
+    static const int thresholds[] = { 1, 2, 3, 4, 6, 8 };
+    static const int min_cells[] = { 1, 2, 4 };
+    printf("threshold cells   sent  suppr  refresh  needless  false  false %%  stale ms  bytes saved\n");
+    for (size_t t = 0; t < sizeof(thresholds) / sizeof(thresholds[0]); t++) {
+        for (size_t c = 0; c < sizeof(min_cells) / sizeof(min_cells[0]); c++) {
+            jpeg_dedup_cfg_t cfg = {
+                .threshold = threshold >= 0 ? threshold : thresholds[t],
+                .min_cells = cells >= 0 ? cells : min_cells[c],
+                .refresh_us = (uint32_t)refresh_ms * 1000,
+            };
+            replay_t r = replay(frames, count, &cfg, fps);
+            printf("%9d %5d  %5d  %5d  %7d  %8d  %5d  %6.2f%%  %8d  %10.1f%%\n", cfg.threshold, cfg.min_cells,
+                r.sent, r.suppressed, r.refreshed, r.needless, r.false_suppressed,
+                r.suppressed ? 100.0 * r.false_suppressed / r.suppressed : 0.0,
+                r.stale_frames * 1000 / fps, 100.0 * (r.bytes - r.bytes_sent) / r.bytes);
+            if (cells >= 0) {
+                break;
+            }
+        }
+        if (threshold >= 0) {
+            break;
+        }
+    }
+
+    if (failures) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,412 @@
+// Host checks and per-layer benchmark of the detector's int8 kernels
+// (main/nn_int8.h, main/nn_model.h, main/detector_policy.h).
+//
+//   1. The requantization helpers on values with known TFLite results.
+//   2. The fast kernels against nn_ref_* on random layers: every op, kernel
+//      sizes 1-5, strides 1-2, SAME and VALID, odd channel counts and zero
+//      points. Outputs must match bit for bit.
+//   3. A model run with both kernel sets, timed per layer. Without
+//      arguments it is the default architecture of desktop/detector_model.py
+//      with random weights; otherwise the given blob, which must load, and
+//      must not load once a byte is flipped.
+//   4. With test vectors from `detector_model.py --vectors`, both kernel
+//      sets must reproduce the exporter's own int8 reference exactly.
+//   5. Preprocessing and event debouncing on small cases.
+//
+//   cc -O2 -Imain tools/nn_bench.c -o nn_bench -lm   (from camera/src)
+//   ./nn_bench [model.bin [vectors.bin]]
+//
+// Exits non-zero on any mismatch.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "detector_policy.h"
+
+#define RANDOM_LAYERS 3000
+#define BENCH_RUNS 20
+
+static int failures = 0;
+static uint32_t rng = 2024;
+
+static uint32_t rnd(void) {
+    rng = rng * 1664525 + 1013904223;
+    return rng >> 8;
+}
+
+static int rnd_range(int lo, int hi) {
+    return lo + (int)(rnd() % (uint32_t)(hi - lo + 1));
+}
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+// ---------------------------------------------------------------------------
+
+static void test_requant(void) {
+    check(nn_srdhm(INT32_MIN, INT32_MIN) == INT32_MAX, "srdhm saturates");
+    check(nn_srdhm(1 << 30, 1 << 30) == 1 << 29, "srdhm of halves");
+    check(nn_srdhm(-3, 1 << 30) == -1, "srdhm rounds -1.5 away from zero");
+    check(nn_rdbpot(5, 1) == 3 && nn_rdbpot(-5, 1) == -3, "rdbpot rounds halves away from zero");
+    check(nn_rdbpot(4, 1) == 2 && nn_rdbpot(-6, 2) == -2 && nn_rdbpot(-5, 2) == -1, "rdbpot");
+    // 0.75 as Q31 with shift 0, then x 2^-3
+    check(nn_requant(1000, 0x60000000, 0) == 750, "requant by 0.75");
+    check(nn_requant(1000, 0x60000000, -3) == 94, "requant by 0.75 / 8");
+    check(nn_requant(-1000, 0x60000000, 1) == -1500, "requant with a left shift");
+}
+
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    int8_t *weights;
+    int32_t *bias, *mult, *shift;
+} layer_arrays_t;
+
+// Random parameters whose outputs mostly land inside the int8 range
+static void random_params(nn_layer_t *l, nn_shape_t in, layer_arrays_t *a) {
+    nn_shape_t out = nn_out_shape(l, in);
+    size_t weights = l->op == NN_CONV ? (size_t)out.c * l->kh * l->kw * in.c
+        : l->op == NN_DWCONV ? (size_t)l->kh * l->kw * in.c
+        : l->op == NN_FC ? (size_t)out.c * nn_elems(in) : 0;
+    a->weights = malloc(weights + 1);
+    a->bias = malloc(sizeof(int32_t) * out.c);
+    a->mult = malloc(sizeof(int32_t) * out.c);
+    a->shift = malloc(sizeof(int32_t) * out.c);
+    for (size_t i = 0; i < weights; i++) {
+        a->weights[i] = (int8_t)rnd_range(-127, 127);
+    }
+    int taps = l->op == NN_CONV ? l->kh * l->kw * in.c : l->op == NN_DWCONV ? l->kh * l->kw : nn_elems(in);
+    int bits = 6 + (int)(log2(sqrt((double)taps)) + 0.5);
+    for (int c = 0; c < out.c; c++) {
+        a->bias[c] = rnd_range(-5000, 5000);
+        a->mult[c] = (int32_t)(0x40000000 + rnd() % 0x3FFFFFFF);
+        a->shift[c] = -bits + rnd_range(-1, 2);
+    }
+    l->weights = a->weights;
+    l->bias = rnd() % 4 ? a->bias : NULL;
+    l->mult = a->mult;
+    l->shift = a->shift;
+}
+
+static void free_params(layer_arrays_t *a) {
+    free(a->weights);
+    free(a->bias);
+    free(a->mult);
+    free(a->shift);
+}
+
+static void test_random_layers(void) {
+    static const nn_op_t ops[] = { NN_CONV, NN_DWCONV, NN_MAXPOOL, NN_AVGPOOL, NN_FC };
+    uint64_t outputs = 0, saturated = 0;
+    int mismatched_layers = 0;
+    for (int t = 0; t < RANDOM_LAYERS; t++) {
+        nn_layer_t l = {
+            .op = ops[t % 5],
+            .kh = (uint8_t)rnd_range(1, 5),
+            .kw = (uint8_t)rnd_range(1, 5),
+            .stride = (uint8_t)rnd_range(1, 2),
+            .pad = rnd() % 2 ? NN_PAD_SAME : NN_PAD_VALID,
+            .in_zero = rnd_range(-128, 127),
+            .act_min = -128,
+            .act_max = 127,
+        };
+        nn_shape_t in = { rnd_range(1, 14), rnd_range(1, 14), rnd_range(1, 40) };
+        if (l.op == NN_FC) {
+            l.kh = l.kw = l.stride = 1;
+            l.pad = NN_PAD_VALID;
+        }
+        if (l.pad == NN_PAD_VALID && (in.h < l.kh || in.w < l.kw)) {
+            in.h = in.h < l.kh ? l.kh : in.h;
+            in.w = in.w < l.kw ? l.kw : in.w;
+        }
+        l.out_c = (uint16_t)rnd_range(1, 40);
+        if (l.op == NN_MAXPOOL || l.op == NN_AVGPOOL) {
+            l.out_zero = l.in_zero;
+        } else {
+            l.out_zero = rnd_range(-128, 127);
+        }
+        if (rnd() % 3 == 0) {
+            l.act_min = (int8_t)(l.out_zero > -128 ? l.out_zero : -128);     // ReLU
+        }
+
+        layer_arrays_t a;
+        random_params(&l, in, &a);
+        nn_shape_t out = nn_out_shape(&l, in);
+        size_t n = (size_t)nn_elems(out);
+        int8_t *x = malloc((size_t)nn_elems(in));
+        int8_t *ref = malloc(n), *fast = malloc(n);
+        for (int i = 0; i < nn_elems(in); i++) {
+            x[i] = (int8_t)rnd_range(-128, 127);
+        }
+        nn_layer_run(&l, in, x, ref, true);
+        nn_layer_run(&l, in, x, fast, false);
+        if (memcmp(ref, fast, n) != 0) {
+            if (mismatched_layers++ < 5) {
+                printf("FAIL: %s k%dx%d s%d %s in %dx%dx%d: fast differs from reference\n", nn_op_str(l.op), l.kh,
+                    l.kw, l.stride, l.pad == NN_PAD_SAME ? "same" : "valid", in.h, in.w, in.c);
+            }
+            failures++;
+        }
+        for (size_t i = 0; i < n; i++) {
+            saturated += ref[i] == -128 || ref[i] == 127 || ref[i] == l.act_min;
+        }
+        outputs += n;
+        free(x);
+        free(ref);
+        free(fast);
+        free_params(&a);
+    }
+    printf("random layers: %d layers, %llu outputs, %.0f%% at a clamp, %d mismatched\n", RANDOM_LAYERS,
+        (unsigned long long)outputs, 100.0 * saturated / outputs, mismatched_layers);
+}
+
+// ---------------------------------------------------------------------------
+
+// desktop/detector_model.py DEFAULT_ARCH with random weights
+static void synthetic_model(nn_model_t *m, layer_arrays_t *arrays) {
+    static const struct { nn_op_t op; int k, stride, out_c; } arch[] = {
+        { NN_CONV, 3, 2, 8 }, { NN_DWCONV, 3, 1, 0 }, { NN_CONV, 1, 1, 16 }, { NN_DWCONV, 3, 2, 0 },
+        { NN_CONV, 1, 1, 32 }, { NN_DWCONV, 3, 2, 0 }, { NN_CONV, 1, 1, 32 }, { NN_CONV, 1, 1, 2 },
+    };
+    memset(m, 0, sizeof(*m));
+    m->in = (nn_shape_t){ 96, 96, 1 };
+    m->in_scale = 1 / 255.0f;
+    m->in_zero = -128;
+    m->classes = 2;
+    strcpy(m->labels[0], "nothing");
+    strcpy(m->labels[1], "animal");
+    m->layer_count = sizeof(arch) / sizeof(arch[0]);
+    nn_shape_t in = m->in;
+    int32_t zero = m->in_zero;
+    for (int i = 0; i < m->layer_count; i++) {
+        nn_layer_t *l = &m->layer[i];
+        bool last = i == m->layer_count - 1;
+        *l = (nn_layer_t){
+            .op = arch[i].op, .kh = (uint8_t)arch[i].k, .kw = (uint8_t)arch[i].k, .stride = (uint8_t)arch[i].stride,
+            .pad = NN_PAD_SAME, .out_c = (uint16_t)arch[i].out_c, .in_zero = zero,
+            .out_zero = last ? 3 : -128, .act_min = last ? -128 : -128, .act_max = 127,
+        };
+        random_params(l, in, &arrays[i]);
+        in = nn_out_shape(l, in);
+        zero = l->out_zero;
+    }
+    m->out_scale = 0.1f;
+    m->out_zero = zero;
+    const char *error;
+    check(nn_model_plan(m, &error), "synthetic model plans");
+}
+
+typedef struct {
+    int64_t last;
+    int64_t *layer_ns;
+} timing_t;
+
+static void layer_done(int layer, void *arg) {
+    timing_t *t = arg;
+    int64_t now = now_ns();
+    t->layer_ns[layer] += now - t->last;
+    t->last = now;
+}
+
+static void bench_model(const nn_model_t *m, int8_t *arena) {
+    int64_t ref_ns[NN_MAX_LAYERS] = { 0 }, fast_ns[NN_MAX_LAYERS] = { 0 };
+    size_t out_len = (size_t)nn_elems(m->out);
+    int8_t *ref_out = malloc(out_len);
+    int8_t *input = malloc((size_t)nn_elems(m->in));
+    for (int i = 0; i < nn_elems(m->in); i++) {
+        input[i] = (int8_t)rnd_range(-128, 127);
+    }
+
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        for (int reference = 1; reference >= 0; reference--) {
+            memcpy(nn_model_input(m, arena), input, (size_t)nn_elems(m->in));
+            timing_t t = { now_ns(), reference ? ref_ns : fast_ns };
+            const int8_t *out = nn_model_run(m, arena, reference, layer_done, &t);
+            if (reference) {
+                memcpy(ref_out, out, out_len);
+            } else if (memcmp(ref_out, out, out_len) != 0) {
+                printf("FAIL: model output of fast and reference kernels differs\n");
+                failures++;
+                run = BENCH_RUNS;
+                break;
+            }
+        }
+    }
+
+    printf("\nper-layer latency, mean of %d runs (this machine)\n", BENCH_RUNS);
+    printf("  %-3s %-8s %-5s %-12s %9s %10s %10s %8s\n", "#", "op", "k/s", "output", "MACs", "ref us",
+        "fast us", "speedup");
+    int64_t ref_total = 0, fast_total = 0;
+    for (int i = 0; i < m->layer_count; i++) {
+        const nn_layer_t *l = &m->layer[i];
+        nn_shape_t o = m->shape[i + 1];
+        char out[16], ks[8];
+        snprintf(out, sizeof(out), "%dx%dx%d", o.h, o.w, o.c);
+        snprintf(ks, sizeof(ks), "%d/%d", l->kh, l->stride);
+        double r = ref_ns[i] / 1e3 / BENCH_RUNS, f = fast_ns[i] / 1e3 / BENCH_RUNS;
+        printf("  %-3d %-8s %-5s %-12s %9lu %10.1f %10.1f %7.1fx\n", i, nn_op_str(l->op), ks, out,
+            (unsigned long)nn_layer_macs(l, m->shape[i]), r, f, f > 0 ? r / f : 0);
+        ref_total += ref_ns[i];
+        fast_total += fast_ns[i];
+    }
+    printf("  total %lu MACs: reference %.2f ms, fast %.2f ms, arena %zu bytes\n", (unsigned long)m->macs,
+        ref_total / 1e6 / BENCH_RUNS, fast_total / 1e6 / BENCH_RUNS, nn_model_arena_size(m));
+    free(ref_out);
+    free(input);
+}
+
+static uint8_t *read_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        exit(2);
+    }
+    fseek(f, 0, SEEK_END);
+    *len = (size_t)ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *buf = malloc(*len);
+    if (fread(buf, 1, *len, f) != *len) {
+        perror(path);
+        exit(2);
+    }
+    fclose(f);
+    return buf;
+}
+
+static void test_vectors(const nn_model_t *m, int8_t *arena, const char *path) {
+    size_t len;
+    uint8_t *v = read_file(path, &len);
+    uint32_t count = nn_rd32(v + 4), in_len = nn_rd32(v + 8), out_len = nn_rd32(v + 12);
+    if (memcmp(v, "NNV1", 4) != 0 || in_len != (uint32_t)nn_elems(m->in) || out_len != (uint32_t)nn_elems(m->out)
+        || 16 + (size_t)count * (in_len + out_len) > len) {
+        printf("FAIL: %s does not fit the model\n", path);
+        failures++;
+        free(v);
+        return;
+    }
+    int matched = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t *in = v + 16 + (size_t)i * (in_len + out_len);
+        bool ok = true;
+        for (int reference = 0; reference < 2; reference++) {
+            memcpy(nn_model_input(m, arena), in, in_len);
+            ok &= memcmp(nn_model_run(m, arena, reference, NULL, NULL), in + in_len, out_len) == 0;
+        }
+        matched += ok;
+    }
+    printf("test vectors: %d of %lu outputs match the exporter's reference exactly\n", matched, (unsigned long)count);
+    check(matched == (int)count, "test vectors");
+    free(v);
+}
+
+// ---------------------------------------------------------------------------
+
+static void test_policy(const nn_model_t *m) {
+    // A flat mid-gray frame is the same input level everywhere
+    int w = 100, h = 75;
+    uint8_t *rgb = malloc((size_t)w * h * 2);
+    for (int i = 0; i < w * h; i++) {
+        uint16_t v = (uint16_t)(16 << 11 | 32 << 5 | 16);
+        rgb[2 * i] = (uint8_t)(v >> 8);
+        rgb[2 * i + 1] = (uint8_t)v;
+    }
+    int8_t lut[256];
+    detect_input_lut(m, lut);
+    int8_t *input = malloc((size_t)nn_elems(m->in));
+    detect_prepare(rgb, w, h, true, m, lut, input);
+    bool flat = true;
+    for (int i = 0; i < nn_elems(m->in); i++) {
+        flat &= input[i] == input[0];
+    }
+    check(flat && input[0] == lut[130], "flat frame prepares to one level");
+    free(rgb);
+    free(input);
+
+    // confirm 2, clear 3
+    detect_track_t t;
+    detect_track_init(&t, 2, 3);
+    static const int seq[] = { -1, 1, -1, 1, 1, 1, -1, 1, -1, -1, -1, 2 };
+    static const detect_event_t want[] = {
+        DETECT_EVENT_NONE, DETECT_EVENT_NONE, DETECT_EVENT_NONE, DETECT_EVENT_NONE, DETECT_EVENT_APPEARED,
+        DETECT_EVENT_NONE, DETECT_EVENT_NONE, DETECT_EVENT_NONE, DETECT_EVENT_NONE, DETECT_EVENT_NONE,
+        DETECT_EVENT_LEFT, DETECT_EVENT_NONE,
+    };
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(seq) / sizeof(seq[0]); i++) {
+        ok &= detect_track_update(&t, seq[i]) == want[i];
+    }
+    check(ok, "event debouncing");
+
+    // Grid decode: one confident cell of class 1 gives a one-cell box
+    nn_model_t g = { .classes = 2, .out = { 4, 4, 2 }, .out_scale = 0.1f, .out_zero = 0 };
+    int8_t out[32] = { 0 };
+    for (int i = 0; i < 16; i++) {
+        out[2 * i] = 40;        // Background wins everywhere...
+    }
+    out[2 * 6] = 0;             // ...but cell (2, 1)
+    out[2 * 6 + 1] = 60;
+    detect_result_t r;
+    detect_decode(&g, out, 60, &r);
+    check(r.cls == 1 && r.has_box && r.box[0] == 0.5f && r.box[1] == 0.25f && r.box[2] == 0.25f,
+        "grid decode and box");
+    detect_decode(&g, out, 100, &r);
+    check(r.cls == -1 && !r.has_box, "grid decode below threshold");
+}
+
+int main(int argc, char **argv) {
+    test_requant();
+    test_random_layers();
+
+    nn_model_t model;
+    layer_arrays_t arrays[NN_MAX_LAYERS] = { 0 };
+    uint8_t *blob = NULL;
+    if (argc > 1) {
+        size_t len;
+        blob = read_file(argv[1], &len);
+        const char *error;
+        if (!nn_model_load(&model, blob, len, &error)) {
+            printf("FAIL: %s: %s\n", argv[1], error);
+            return 1;
+        }
+        printf("%s: %d layers, input %dx%dx%d, output %dx%dx%d, %d classes (%s", argv[1], model.layer_count,
+            model.in.h, model.in.w, model.in.c, model.out.h, model.out.w, model.out.c, model.classes, model.labels[0]);
+        for (int i = 1; i < model.classes; i++) {
+            printf(", %s", model.labels[i]);
+        }
+        printf(")\n");
+        nn_model_t copy;
+        blob[len / 2] ^= 0x10;
+        check(!nn_model_load(&copy, blob, len, &error), "corrupted blob is rejected");
+        blob[len / 2] ^= 0x10;
+    } else {
+        synthetic_model(&model, arrays);
+    }
+
+    int8_t *arena = aligned_alloc(16, nn_model_arena_size(&model));
+    if (argc > 2) {
+        test_vectors(&model, arena, argv[2]);
+    }
+    test_policy(&model);
+    bench_model(&model, arena);
+
+    free(arena);
+    free(blob);
+    for (int i = 0; i < NN_MAX_LAYERS; i++) {
+        free_params(&arrays[i]);
+    }
+    printf("%s\n", failures ? "FAILED" : "all checks passed");
+    return failures ? 1 : 0;
+}
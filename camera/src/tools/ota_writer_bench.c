@@ -0,0 +1,412 @@
+// Host checks and benchmark for the OTA image writer (main/ota_writer.h).
+//
+// The flash is a file with NOR semantics: erase sets a sector to 0xFF and
+// a write can only clear bits, so a sector written without its erase
+// shows up as a mismatch. Checks SHA-256 against the FIPS test vectors,
+// then writes images fed in random piece sizes over an old image and
+// compares the file with them. Every error path must stop the writer:
+// wrong digest, short or long upload, oversized image, not an app image,
+// and flash faults. The rate limiter runs on a simulated clock and must
+// hold the configured rate within 1%, with no second seeing more than
+// rate + burst. Exits non-zero on any mismatch, then prints throughput on
+// the real clock.
+//
+//   cc -O2 -Imain tools/ota_writer_bench.c -o ota_writer_bench   (from camera/src)
+//   ./ota_writer_bench
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ota_writer.h"
+
+#define PARTITION_SIZE (0x1F0000)
+#define IMAGE_SIZE (1500 * 1024 + 123)  // Not a whole number of sectors
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { failures++; printf("FAIL: " __VA_ARGS__); printf("\n"); } \
+} while (0)
+
+static int64_t real_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// ---------------------------------------------------------------------------
+// File-backed flash
+
+#define MAX_SECTORS (PARTITION_SIZE / OTA_SECTOR)
+
+typedef struct {
+    FILE *file;
+    bool simulated;                 // Simulated clock: sleeping advances it
+    int64_t now;
+    uint32_t erases, writes;
+    uint32_t nor_violations;        // Bits a write tried to set
+    int fail_erase_at;              // Fail the Nth erase (1-based), 0: never
+    int stuck_bit_at;               // Clear a bit in the Nth write, 0: never
+    int64_t erase_at[MAX_SECTORS];  // When each erase happened
+} flash_file_t;
+
+static bool ff_erase(void *ctx, uint32_t off, uint32_t len) {
+    flash_file_t *f = ctx;
+    if (off % OTA_SECTOR || len % OTA_SECTOR || off + len > PARTITION_SIZE) {
+        return false;
+    }
+    if (f->erases < MAX_SECTORS) {
+        f->erase_at[f->erases] = f->simulated ? f->now : real_us();
+    }
+    if (++f->erases == (uint32_t)f->fail_erase_at) {
+        return false;
+    }
+    static uint8_t ones[OTA_SECTOR];
+    memset(ones, 0xFF, sizeof(ones));
+    fseek(f->file, off, SEEK_SET);
+    for (uint32_t i = 0; i < len; i += OTA_SECTOR) {
+        fwrite(ones, 1, OTA_SECTOR, f->file);
+    }
+    return true;
+}
+
+static bool ff_write(void *ctx, uint32_t off, const void *data, uint32_t len) {
+    flash_file_t *f = ctx;
+    if (off + len > PARTITION_SIZE || len > OTA_SECTOR) {
+        return false;
+    }
+    uint8_t old[OTA_SECTOR], next[OTA_SECTOR];
+    fseek(f->file, off, SEEK_SET);
+    if (fread(old, 1, len, f->file) != len) {
+        return false;
+    }
+    const uint8_t *p = data;
+    for (uint32_t i = 0; i < len; i++) {
+        f->nor_violations += (p[i] & ~old[i]) != 0;
+        next[i] = p[i] & old[i];
+    }
+    if (++f->writes == (uint32_t)f->stuck_bit_at) {
+        next[len / 2] &= 0xFE;      // A bit stuck at 0
+    }
+    fseek(f->file, off, SEEK_SET);
+    return fwrite(next, 1, len, f->file) == len;
+}
+
+static bool ff_read(void *ctx, uint32_t off, void *data, uint32_t len) {
+    flash_file_t *f = ctx;
+    fseek(f->file, off, SEEK_SET);
+    return fread(data, 1, len, f->file) == len;
+}
+
+static int64_t ff_now(void *ctx) {
+    flash_file_t *f = ctx;
+    return f->simulated ? f->now : real_us();
+}
+
+static void ff_sleep(void *ctx, uint32_t us) {
+    flash_file_t *f = ctx;
+    if (f->simulated) {
+        f->now += us;
+    } else {
+        usleep(us);
+    }
+}
+
+static ota_flash_t flash_open(flash_file_t *f, bool simulated) {
+    memset(f, 0, sizeof(*f));
+    f->file = tmpfile();
+    f->simulated = simulated;
+    // An old image: random bits everywhere, as if a previous update were there
+    uint8_t junk[OTA_SECTOR];
+    for (uint32_t off = 0; off < PARTITION_SIZE; off += OTA_SECTOR) {
+        for (int i = 0; i < OTA_SECTOR; i++) {
+            junk[i] = (uint8_t)rand();
+        }
+        fwrite(junk, 1, OTA_SECTOR, f->file);
+    }
+    ota_flash_t flash = { ff_erase, ff_write, ff_read, ff_now, ff_sleep, f, PARTITION_SIZE };
+    return flash;
+}
+
+// ---------------------------------------------------------------------------
+// Images
+
+static uint8_t *make_image(uint32_t len, uint8_t digest[SHA256_DIGEST_LEN]) {
+    uint8_t *img = malloc(len);
+    for (uint32_t i = 0; i < len; i++) {
+        img[i] = (uint8_t)(rand() >> 7);
+    }
+    img[0] = OTA_IMAGE_MAGIC;
+    sha256_t s;
+    sha256_init(&s);
+    sha256_update(&s, img, len);
+    sha256_final(&s, digest);
+    return img;
+}
+
+// Feed img in random pieces of 1..max bytes; returns the first error
+static ota_status_t feed_random(ota_writer_t *w, const uint8_t *img, uint32_t len, uint32_t max) {
+    for (uint32_t off = 0; off < len;) {
+        uint32_t n = 1 + (uint32_t)rand() % max;
+        n = n < len - off ? n : len - off;
+        ota_status_t st = ota_writer_feed(w, img + off, n);
+        if (st != OTA_OK) {
+            return st;
+        }
+        off += n;
+    }
+    return OTA_OK;
+}
+
+static bool flash_matches(flash_file_t *f, const uint8_t *img, uint32_t len) {
+    uint8_t *back = malloc(len);
+    fseek(f->file, 0, SEEK_SET);
+    bool ok = fread(back, 1, len, f->file) == len && memcmp(back, img, len) == 0;
+    free(back);
+    return ok;
+}
+
+// ---------------------------------------------------------------------------
+// Checks
+
+static void digest_of(const char *msg, size_t len, size_t piece, char hex[65]) {
+    sha256_t s;
+    uint8_t d[SHA256_DIGEST_LEN];
+    sha256_init(&s);
+    for (size_t off = 0; off < len; off += piece) {
+        sha256_update(&s, msg + off, len - off < piece ? len - off : piece);
+    }
+    sha256_final(&s, d);
+    sha256_hex(d, hex);
+}
+
+static void check_sha256(void) {
+    static const struct { const char *msg; const char *hex; } vectors[] = {
+        { "", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+        { "abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+        { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+          "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+        { "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrs"
+          "mnopqrstnopqrstu", "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1" },
+    };
+    char hex[65];
+    for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+        size_t len = strlen(vectors[i].msg);
+        for (size_t piece = 1; piece <= 65; piece += 7) {
+            digest_of(vectors[i].msg, len, piece, hex);
+            CHECK(strcmp(hex, vectors[i].hex) == 0, "sha256 vector %zu in pieces of %zu: %s", i, piece, hex);
+        }
+    }
+    char *million = malloc(1000000);
+    memset(million, 'a', 1000000);
+    digest_of(million, 1000000, 999, hex);
+    CHECK(strcmp(hex, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0") == 0,
+        "sha256 of a million a: %s", hex);
+    free(million);
+
+    uint8_t d[SHA256_DIGEST_LEN];
+    CHECK(sha256_parse_hex(vectors[1].hex, d) && d[0] == 0xba && d[31] == 0xad, "parse hex");
+    CHECK(sha256_parse_hex("BA7816BF8F01CFEA414140DE5DAE2223B00361A396177A9CB410FF61F20015AD", d), "parse upper hex");
+    CHECK(!sha256_parse_hex("ba7816", d), "short hex accepted");
+    CHECK(!sha256_parse_hex("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad0", d), "long hex accepted");
+    CHECK(!sha256_parse_hex("zz7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad", d), "bad hex accepted");
+}
+
+static void check_write(void) {
+    flash_file_t f;
+    ota_flash_t flash = flash_open(&f, true);
+    uint8_t want[SHA256_DIGEST_LEN];
+    uint8_t *img = make_image(IMAGE_SIZE, want);
+    static uint8_t sector[OTA_SECTOR];
+    ota_writer_t w;
+
+    CHECK(ota_writer_begin(&w, &flash, sector, IMAGE_SIZE, want, 0, 0) == OTA_OK, "begin");
+    CHECK(feed_random(&w, img, IMAGE_SIZE, 3000) == OTA_OK, "feed: %s", ota_status_name(w.status));
+    CHECK(ota_writer_finish(&w) == OTA_OK, "finish: %s", ota_status_name(w.status));
+    CHECK(memcmp(w.digest, want, SHA256_DIGEST_LEN) == 0, "digest");
+    CHECK(flash_matches(&f, img, IMAGE_SIZE), "flash differs from the image");
+    uint32_t sectors = (IMAGE_SIZE + OTA_SECTOR - 1) / OTA_SECTOR;
+    CHECK(w.sectors == sectors && f.erases == sectors, "%u sectors, %u erases, want %u", w.sectors, f.erases, sectors);
+    CHECK(f.nor_violations == 0, "%u writes over unerased bits", f.nor_violations);
+    fclose(f.file);
+    free(img);
+}
+
+static ota_status_t run_image(ota_flash_t *flash, const uint8_t *img, uint32_t feed_len,
+                              uint32_t length, const uint8_t *want) {
+    static uint8_t sector[OTA_SECTOR];
+    ota_writer_t w;
+    if (ota_writer_begin(&w, flash, sector, length, want, 0, 0) != OTA_OK) {
+        return w.status;
+    }
+    ota_status_t st = feed_random(&w, img, feed_len, 1460);
+    ota_status_t fin = ota_writer_finish(&w);
+    CHECK(st == OTA_OK || fin == st, "error %s did not stick (%s)", ota_status_name(st), ota_status_name(fin));
+    return fin;
+}
+
+static void check_errors(void) {
+    uint8_t want[SHA256_DIGEST_LEN], bad[SHA256_DIGEST_LEN];
+    uint32_t len = 64 * 1024 + 100;
+    uint8_t *img = make_image(len + 10, want);
+    sha256_t s;
+    sha256_init(&s);
+    sha256_update(&s, img, len);
+    sha256_final(&s, want);
+    memcpy(bad, want, sizeof(bad));
+    bad[5] ^= 1;
+
+    flash_file_t f;
+    ota_flash_t flash = flash_open(&f, true);
+    ota_status_t st;
+
+    CHECK((st = run_image(&flash, img, len, len, want)) == OTA_OK, "good image: %s", ota_status_name(st));
+    CHECK((st = run_image(&flash, img, len, len, bad)) == OTA_ERR_DIGEST, "wrong digest: %s", ota_status_name(st));
+    CHECK((st = run_image(&flash, img, len - 1, len, want)) == OTA_ERR_SIZE, "short upload: %s",
+        ota_status_name(st));
+    CHECK((st = run_image(&flash, img, len + 10, len, want)) == OTA_ERR_SIZE, "long upload: %s",
+        ota_status_name(st));
+    CHECK((st = run_image(&flash, img, len, PARTITION_SIZE + 1, want)) == OTA_ERR_SIZE, "oversized: %s",
+        ota_status_name(st));
+    CHECK((st = run_image(&flash, img, 0, 0, want)) == OTA_ERR_SIZE, "empty: %s", ota_status_name(st));
+    img[0] = 0x7F;
+    CHECK((st = run_image(&flash, img, len, len, want)) == OTA_ERR_MAGIC, "not an image: %s",
+        ota_status_name(st));
+    img[0] = OTA_IMAGE_MAGIC;
+
+    f.erases = 0;
+    f.fail_erase_at = 3;
+    CHECK((st = run_image(&flash, img, len, len, want)) == OTA_ERR_FLASH, "erase failure: %s",
+        ota_status_name(st));
+    CHECK(f.erases == 3, "kept writing after a failed erase (%u erases)", f.erases);
+    f.fail_erase_at = 0;
+
+    f.writes = 0;
+    f.stuck_bit_at = 5;
+    memset(img + 4 * OTA_SECTOR, 0xFF, OTA_SECTOR);     // The 5th sector all ones, so the stuck bit shows
+    sha256_init(&s);
+    sha256_update(&s, img, len);
+    sha256_final(&s, want);
+    CHECK((st = run_image(&flash, img, len, len, want)) == OTA_ERR_VERIFY, "stuck bit: %s", ota_status_name(st));
+    CHECK(f.nor_violations == 0, "%u writes over unerased bits", f.nor_violations);
+
+    fclose(f.file);
+    free(img);
+}
+
+static void check_rate_take(void) {
+    ota_rate_t r;
+    ota_rate_init(&r, 0, 0, 0);
+    CHECK(ota_rate_take(&r, 1000000, 0) == 0, "no limit still waits");
+
+    ota_rate_init(&r, 100000, 1000, 0);             // Burst below a sector is raised to one
+    CHECK(r.burst == OTA_SECTOR, "burst %u", r.burst);
+    CHECK(ota_rate_take(&r, OTA_SECTOR, 0) == 0, "full bucket refused a sector");
+    uint32_t wait = ota_rate_take(&r, OTA_SECTOR, 0);
+    CHECK(wait == (OTA_SECTOR * 1000000u + 99999) / 100000, "wait %u us", wait);
+    CHECK(ota_rate_take(&r, OTA_SECTOR, wait - 1) != 0, "taken early");
+    CHECK(ota_rate_take(&r, OTA_SECTOR, wait) == 0, "not taken on time");
+    CHECK(ota_rate_take(&r, OTA_SECTOR, 3600000000LL) == 0 && ota_rate_take(&r, OTA_SECTOR, 3600000000LL) != 0,
+        "idle refill above burst");
+}
+
+// Write an image at `rate` with `burst` on the simulated clock
+static void check_rate(uint32_t rate, uint32_t burst) {
+    flash_file_t f;
+    ota_flash_t flash = flash_open(&f, true);
+    f.now = 1000000;
+    uint8_t want[SHA256_DIGEST_LEN];
+    uint8_t *img = make_image(IMAGE_SIZE, want);
+    static uint8_t sector[OTA_SECTOR];
+    ota_writer_t w;
+
+    ota_writer_begin(&w, &flash, sector, IMAGE_SIZE, want, rate, burst);
+    feed_random(&w, img, IMAGE_SIZE, 2920);
+    CHECK(ota_writer_finish(&w) == OTA_OK, "rate %u: %s", rate, ota_status_name(w.status));
+
+    // The first burst goes at once, the rest at the rate
+    double want_s = (double)((int64_t)w.sectors * OTA_SECTOR - w.rate.burst) / rate;
+    double took_s = (f.now - 1000000) / 1e6;
+    CHECK(took_s >= want_s * 0.99 && took_s <= want_s * 1.01 + 0.001, "rate %u: %.3f s, want %.3f s", rate, took_s,
+        want_s);
+
+    // No one-second window holds more than rate + burst bytes
+    uint32_t most = 0;
+    for (uint32_t i = 0, j = 0; i < f.erases; i++) {
+        while (f.erase_at[i] - f.erase_at[j] >= 1000000) {
+            j++;
+        }
+        most = i - j + 1 > most ? i - j + 1 : most;
+    }
+    CHECK((uint64_t)most * OTA_SECTOR <= (uint64_t)rate + w.rate.burst, "rate %u: %u bytes in one second", rate,
+        most * OTA_SECTOR);
+    printf("rate %4u KB/s, burst %2u KB: %.2f s for %u KB (want %.2f s), at most %u KB in any second\n",
+        rate / 1024, w.rate.burst / 1024, took_s, IMAGE_SIZE / 1024, want_s, most * OTA_SECTOR / 1024);
+    fclose(f.file);
+    free(img);
+}
+
+// ---------------------------------------------------------------------------
+// Throughput on the real clock
+
+static void bench(void) {
+    uint8_t want[SHA256_DIGEST_LEN];
+    uint8_t *img = make_image(IMAGE_SIZE, want);
+    static uint8_t sector[OTA_SECTOR];
+
+    sha256_t s;
+    uint8_t d[SHA256_DIGEST_LEN];
+    int64_t t0 = real_us();
+    for (int i = 0; i < 8; i++) {
+        sha256_init(&s);
+        sha256_update(&s, img, IMAGE_SIZE);
+        sha256_final(&s, d);
+    }
+    double sha_mbs = 8.0 * IMAGE_SIZE / (real_us() - t0);
+
+    flash_file_t f;
+    ota_flash_t flash = flash_open(&f, false);
+    ota_writer_t w;
+    t0 = real_us();
+    ota_writer_begin(&w, &flash, sector, IMAGE_SIZE, want, 0, 0);
+    feed_random(&w, img, IMAGE_SIZE, 1460);
+    ota_writer_finish(&w);
+    double free_mbs = (double)IMAGE_SIZE / (real_us() - t0);
+    CHECK(w.status == OTA_OK, "unlimited: %s", ota_status_name(w.status));
+
+    uint32_t rate = 1024 * 1024;
+    t0 = real_us();
+    ota_writer_begin(&w, &flash, sector, IMAGE_SIZE, want, rate, 16 * 1024);
+    feed_random(&w, img, IMAGE_SIZE, 1460);
+    ota_writer_finish(&w);
+    double limited_s = (real_us() - t0) / 1e6;
+    CHECK(w.status == OTA_OK, "limited: %s", ota_status_name(w.status));
+    fclose(f.file);
+
+    printf("bench: sha256 %.1f MB/s, writer to file %.1f MB/s unlimited (%.1f us per sector), "
+        "%.2f MB/s limited to 1 MB/s (%.2f s, %.2f s asleep)\n",
+        sha_mbs, free_mbs, (double)w.flash_us / w.sectors, IMAGE_SIZE / limited_s / 1048576, limited_s,
+        w.throttle_us / 1e6);
+    free(img);
+}
+
+int main(void) {
+    srand(1);
+    check_sha256();
+    check_write();
+    check_errors();
+    check_rate_take();
+    check_rate(128 * 1024, 16 * 1024);
+    check_rate(64 * 1024, 4 * 1024);
+    check_rate(512 * 1024, 64 * 1024);
+    bench();
+    if (failures) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,222 @@
+// Host simulation of the power policy (main/power_policy.h).
+//
+// Each scenario is a script of stream client and motion events. It runs
+// through the real policy code in simulated time, with the monitor task's
+// tick every 5 s calling power_policy_update() as power.h does. A `frame`
+// event is the first frame reaching a client after a wake. The tool checks:
+//
+//   - the mode transitions and when they happen
+//   - hysteresis: LOW is only entered once the idle timeout has passed
+//     since the last client or motion event, and no later than one tick
+//     after that; a viewer coming back within the timeout never sees LOW
+//   - wake-to-first-frame latency, counted only for wakes from LOW
+//   - that the time in each mode adds up to the run, for the current estimate
+//   - that with power save off (POWER_IDLE_NEVER) LOW never comes, however
+//     long the camera sits idle
+//
+//   cc -O2 -Imain tools/power_policy_sim.c -o power_policy_sim   (from camera/src)
+//   ./power_policy_sim        # add -v for every event and transition
+//
+// Script: "<t> <event>; ..." with t in seconds and event one of connect,
+// disconnect, motion, frame or end. Exits non-zero if a check fails.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "power_policy.h"
+
+#define TICK_US 5000000         // CONFIG_TRAIN_POWER_MONITOR_INTERVAL_MS
+#define IDLE_TIMEOUT_MS 60000   // CONFIG_TRAIN_POWER_IDLE_TIMEOUT_MS
+#define MOTION_HOLD_MS 30000    // CONFIG_TRAIN_POWER_MOTION_HOLD_MS
+#define MAX_EVENTS 32
+
+typedef struct {
+    const char *name;
+    const char *script;
+    const char *expect;         // Transitions, "<t> <mode>; ..."
+    uint32_t wakes;
+    uint32_t max_wake_ms;
+    uint32_t idle_timeout_ms;   // 0: IDLE_TIMEOUT_MS
+} scenario_t;
+
+static const scenario_t scenarios[] = {
+    { "boot", "120 end",
+      "60 low", 0, 0 },
+    { "viewer", "100 connect; 100.3 frame; 160 disconnect; 300 end",
+      "60 low; 100 active; 160 idle; 220 low", 1, 300 },
+    // A page reload inside the idle timeout keeps the sensor up
+    { "reload", "100 connect; 100.2 frame; 130 disconnect; 131 connect; 140 disconnect; 260 end",
+      "60 low; 100 active; 130 idle; 131 active; 140 idle; 200 low", 1, 200 },
+    { "two viewers", "10 connect; 20 connect; 30 disconnect; 50 disconnect; 150 end",
+      "10 active; 50 idle; 110 low", 0, 0 },
+    // Motion holds full rate, then the idle timeout runs from the trigger
+    { "motion", "70 motion; 70.4 frame; 200 end",
+      "60 low; 70 active; 100 idle; 130 low", 1, 400 },
+    { "motion again", "70 motion; 70.3 frame; 90 motion; 250 end",
+      "60 low; 70 active; 120 idle; 150 low", 1, 300 },
+    // A viewer joining while already up is not a wake
+    { "motion+viewer", "70 motion; 70.3 frame; 80 connect; 80.1 frame; 90 disconnect; 200 end",
+      "60 low; 70 active; 100 idle; 150 low", 1, 300 },
+    // A stray disconnect must not leave the client count wrapped
+    { "stray disconnect", "10 disconnect; 20 connect; 30 disconnect; 100 end",
+      "20 active; 30 idle; 90 low", 0, 0 },
+    // A wake that never delivers a frame is not counted, and does not
+    // stretch the next one
+    { "wake no frame", "100 connect; 101 disconnect; 170 motion; 170.2 frame; 240 end",
+      "60 low; 100 active; 101 idle; 165 low; 170 active; 200 idle; 230 low", 1, 200 },
+    // CONFIG_TRAIN_POWER_SAVE off: a day without viewers never reaches LOW,
+    // well past the 71.6 minutes a timeout in ms scaled to us could hold
+    { "power save off", "100 connect; 100.3 frame; 160 disconnect; 170 motion; 90000 end",
+      "100 active; 160 idle; 170 active; 200 idle", 0, 0, POWER_IDLE_NEVER },
+};
+
+typedef struct {
+    int64_t at_us;
+    char what[16];
+} sim_event_t;
+
+static int parse_script(const char *script, sim_event_t *events) {
+    int n = 0;
+    const char *s = script;
+    while (*s && n < MAX_EVENTS) {
+        double t;
+        int used;
+        if (sscanf(s, " %lf %15[a-z]%n", &t, events[n].what, &used) != 2) {
+            break;
+        }
+        events[n++].at_us = (int64_t)(t * 1e6 + 0.5);
+        s += used;
+        s += strspn(s, "; ");
+    }
+    return n;
+}
+
+static int failures = 0;
+
+static void fail(const scenario_t *sc, const char *what) {
+    fprintf(stderr, "FAIL: %s: %s\n", sc->name, what);
+    failures++;
+}
+
+static void append(char *buf, size_t cap, int64_t at_us, power_mode_t mode) {
+    size_t len = strlen(buf);
+    snprintf(buf + len, cap - len, "%s%g %s", len ? "; " : "", at_us / 1e6, power_mode_str(mode));
+}
+
+static void run(const scenario_t *sc, bool verbose) {
+    sim_event_t events[MAX_EVENTS];
+    int count = parse_script(sc->script, events);
+    if (count == 0 || strcmp(events[count - 1].what, "end") != 0) {
+        fail(sc, "script must finish with an end event");
+        return;
+    }
+    int64_t end_us = events[count - 1].at_us;
+
+    power_policy_config_t cfg = power_policy_default_config();
+    cfg.idle_timeout_ms = sc->idle_timeout_ms ? sc->idle_timeout_ms : IDLE_TIMEOUT_MS;
+    cfg.motion_hold_ms = MOTION_HOLD_MS;
+    power_policy_t p;
+    power_policy_init(&p, &cfg, 0);
+
+    char got[512] = "";
+    int64_t next_tick = TICK_US;
+    int next_event = 0;
+    while (true) {
+        // Events at a tick's time come first, as a connect would race the monitor
+        bool is_event = next_event < count && events[next_event].at_us <= next_tick;
+        int64_t now = is_event ? events[next_event].at_us : next_tick;
+        if (now > end_us) {
+            break;
+        }
+        const char *what = is_event ? events[next_event++].what : "tick";
+        power_mode_t from = p.mode;
+        int64_t activity_before = p.last_activity_us;
+        bool changed = false;
+        if (!strcmp(what, "connect")) {
+            changed = power_policy_client_connected(&p, now);
+        } else if (!strcmp(what, "disconnect")) {
+            changed = power_policy_client_disconnected(&p, now);
+        } else if (!strcmp(what, "motion")) {
+            changed = power_policy_motion(&p, now);
+        } else if (!strcmp(what, "frame")) {
+            power_policy_frame_sent(&p, now);
+        } else if (!strcmp(what, "tick") || !strcmp(what, "end")) {
+            changed = power_policy_update(&p, now);
+            if (!is_event) {
+                next_tick += TICK_US;
+            }
+        } else {
+            fail(sc, "unknown event in script");
+            return;
+        }
+
+        if (changed != (p.mode != from)) {
+            fail(sc, "update result does not match the mode change");
+        }
+        if (p.clients > (uint32_t)count) {
+            fail(sc, "client count wrapped");
+        }
+        if (changed) {
+            append(got, sizeof(got), now, p.mode);
+            if (p.mode == POWER_MODE_LOW) {
+                int64_t quiet = now - activity_before;
+                if (cfg.idle_timeout_ms == POWER_IDLE_NEVER) {
+                    fail(sc, "entered low with power save off");
+                }
+                if (quiet < (int64_t)cfg.idle_timeout_ms * 1000) {
+                    fail(sc, "entered low before the idle timeout");
+                }
+                if (quiet >= (int64_t)cfg.idle_timeout_ms * 1000 + TICK_US) {
+                    fail(sc, "entered low more than a tick after the idle timeout");
+                }
+            }
+        }
+        if (verbose && (changed || is_event)) {
+            printf("  %8.1f s  %-10s %s%s\n", now / 1e6, what, power_mode_str(p.mode), changed ? " *" : "");
+        }
+        if (!strcmp(what, "end")) {
+            break;
+        }
+    }
+
+    if (strcmp(got, sc->expect) != 0) {
+        char what[1200];
+        snprintf(what, sizeof(what), "transitions \"%s\", expected \"%s\"", got, sc->expect);
+        fail(sc, what);
+    }
+    if (p.wakes != sc->wakes) {
+        fail(sc, "wrong number of wakes counted");
+    }
+    if (sc->max_wake_ms && p.max_wake_latency_us / 1000 != sc->max_wake_ms) {
+        fail(sc, "wrong wake-to-frame latency");
+    }
+    uint64_t total = 0;
+    for (int i = 0; i < POWER_MODE_COUNT; i++) {
+        total += p.time_in_mode_us[i];
+    }
+    if (total != (uint64_t)end_us) {
+        fail(sc, "time in modes does not add up to the run");
+    }
+
+    printf("%-17s %5.0f %5.0f %5.0f %6lu %6lu %7lu %7lu\n", sc->name,
+        p.time_in_mode_us[POWER_MODE_ACTIVE] / 1e6, p.time_in_mode_us[POWER_MODE_IDLE] / 1e6,
+        p.time_in_mode_us[POWER_MODE_LOW] / 1e6, (unsigned long)power_policy_avg_current_ma(&p),
+        (unsigned long)p.wakes, (unsigned long)(power_policy_avg_wake_latency_us(&p) / 1000),
+        (unsigned long)(p.max_wake_latency_us / 1000));
+}
+
+int main(int argc, char **argv) {
+    bool verbose = argc > 1 && !strcmp(argv[1], "-v");
+    printf("%-17s %5s %5s %5s %6s %6s %7s %7s\n", "scenario", "act s", "idl s", "low s", "avg mA", "wakes",
+        "avg ms", "max ms");
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        run(&scenarios[i], verbose);
+    }
+    if (failures) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all scenarios ok\n");
+    return 0;
+}
@@ -0,0 +1,718 @@
+// Host round trip of the RTP/JPEG packetizer (main/rtp_jpeg.h).
+//
+// Real JPEGs go through rtp_jpeg_parse() and rtp_jpeg_packet() as udp.h
+// sends them, at the default datagram size and at the smallest udp_chunk
+// allows. Recorded MJPEG sequences and .jpg files are split into their
+// frames. Without files, libjpeg makes test frames in the layouts the
+// sensors emit: 4:2:2 and 4:2:0, one or two quantization tables, with and
+// without restart markers, and sizes the payload format cannot carry.
+// For every frame the tool checks:
+//
+//   - the scan boundaries: the scan ends at EOI, holds only stuffed bytes
+//     and RSTn markers, and has as many RSTn as the restart interval gives
+//   - every header field, the sequence and timestamp wrap, the marker on
+//     the last packet only, the fragment offsets tiling the scan, datagrams
+//     within the limit and full up to the last one
+//   - the depacketized frame: rebuilt from the packets alone as RFC 2435
+//     Appendix B says, it must decode to the same pixels as the original
+//
+// Frames that rtp_jpeg_parse() must refuse (progressive, greyscale, other
+// sampling, sizes that are not a multiple of 8 or above 2040) have to be
+// refused. --dump writes the frames, the packets at the default size and
+// the rebuilt JPEGs for the desktop receiver to check against its own
+// packetizer and depacketizer, so the two cannot drift apart:
+//
+//   cc -O2 -Imain tools/rtp_jpeg_bench.c -o rtp_jpeg_bench -ljpeg   (from camera/src)
+//   ./rtp_jpeg_bench --dump rtp.bin [trackside.mjpeg frame.jpg ...]
+//   python ../../desktop/rtp_jpeg.py check rtp.bin
+//
+// Exits non-zero if a check fails, then prints the packets and header bytes
+// per frame and the cost of parsing and building the headers.
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <jpeglib.h>
+
+#include "rtp_jpeg.h"
+
+#define DEFAULT_PACKET (1400 + 8)   // udp_chunk default plus the chunk header
+#define SMALL_PACKET (256 + 8)      // udp_chunk minimum
+
+typedef struct {
+    const uint8_t *buf;
+    size_t len;
+    const char *name;
+    bool sendable;              // What rtp_jpeg_parse() must decide
+} frame_t;
+
+typedef struct {
+    const char *name;
+    int w, h;
+    int luma_h;                 // Horizontal luma sampling: 2 for 4:2:2 and 4:2:0
+    int luma_v;                 // 1 for 4:2:2, 2 for 4:2:0
+    int quality;
+    int restart_interval;       // In MCUs
+    bool one_table;             // Chroma shares the luma table
+    bool progressive;
+    bool grey;
+} synthetic_t;
+
+static const synthetic_t synthetic[] = {
+    { "96x96 4:2:0",            96,   96, 2, 2, 80, 0, false, false, false },
+    { "qvga 4:2:2",            320,  240, 2, 1, 12, 0, false, false, false },
+    { "cif 4:2:2",             400,  296, 2, 1, 80, 0, false, false, false },
+    { "vga 4:2:0 dri 4",       640,  480, 2, 2, 60, 4, false, false, false },
+    { "vga 4:2:2 one table",   640,  480, 2, 1, 90, 0, true,  false, false },
+    { "svga 4:2:2 dri 1",      800,  600, 2, 1, 30, 1, false, false, false },
+    { "uxga 4:2:2 q95",       1600, 1200, 2, 1, 95, 0, false, false, false },
+    { "2040x1528 4:2:0 dri 7", 2040, 1528, 2, 2, 50, 7, false, false, false },
+    // Refused: the size travels in units of 8 pixels and up to 2040
+    { "100x75 4:2:0",          100,   75, 2, 2, 80, 0, false, false, false },
+    { "2048x1536 4:2:0",      2048, 1536, 2, 2, 80, 0, false, false, false },
+    // Refused: only baseline YUV with 2x1 or 2x2 luma
+    { "qvga 4:4:4",            320,  240, 1, 1, 80, 0, false, false, false },
+    { "qvga progressive",      320,  240, 2, 2, 80, 0, false, true,  false },
+    { "qvga grey",             320,  240, 1, 1, 80, 0, false, false, true  },
+};
+
+static int failures = 0;
+static bool verbose = false;
+
+static void fail(const frame_t *f, size_t max_packet, const char *what) {
+    fprintf(stderr, "FAIL: %s (%zu B datagrams): %s\n", f->name, max_packet, what);
+    failures++;
+}
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint8_t *read_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *buf = malloc(n > 0 ? n : 1);
+    if (buf && fread(buf, 1, n, f) != (size_t)n) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    *len = (size_t)n;
+    return buf;
+}
+
+static size_t rd16(const uint8_t *p) {
+    return (size_t)(p[0] << 8 | p[1]);
+}
+
+// End of the JPEG starting at p: walk the segments to the scan, then find
+// the first marker other than a stuffed byte or RSTn
+static size_t jpeg_length(const uint8_t *p, size_t avail) {
+    size_t i = 2;
+    while (i + 4 <= avail) {
+        if (p[i] != 0xFF) {
+            return 0;
+        }
+        uint8_t marker = p[i + 1];
+        if (marker == 0xFF) {
+            i++;
+            continue;
+        }
+        i += 2 + rd16(p + i + 2);
+        if (marker == 0xDA) {
+            for (; i + 1 < avail; i++) {
+                if (p[i] == 0xFF && p[i + 1] != 0x00 && (p[i + 1] & 0xF8) != 0xD0) {
+                    return p[i + 1] == 0xD9 ? i + 2 : 0;
+                }
+            }
+            return 0;
+        }
+    }
+    return 0;
+}
+
+static int split_frames(const uint8_t *buf, size_t len, const char *name, frame_t **frames, int count) {
+    for (size_t i = 0; i + 3 < len;) {
+        if (buf[i] == 0xFF && buf[i + 1] == 0xD8 && buf[i + 2] == 0xFF) {
+            size_t n = jpeg_length(buf + i, len - i);
+            if (n) {
+                *frames = realloc(*frames, (count + 1) * sizeof(frame_t));
+                (*frames)[count++] = (frame_t){ buf + i, n, name, true };
+                i += n;
+                continue;
+            }
+        }
+        i++;
+    }
+    return count;
+}
+
+// ---------------------------------------------------------------------------
+// libjpeg: test frames, the standard Huffman tables and decoding
+
+typedef struct {
+    struct jpeg_error_mgr mgr;
+    jmp_buf jump;
+} jpeg_error_t;
+
+static void jpeg_error_exit(j_common_ptr cinfo) {
+    longjmp(((jpeg_error_t *)cinfo->err)->jump, 1);
+}
+
+static void jpeg_quiet(j_common_ptr cinfo) {
+    (void)cinfo;
+}
+
+static uint32_t hash3(uint32_t x, uint32_t y, uint32_t z) {
+    uint32_t h = x * 0x9E3779B1u ^ y * 0x85EBCA77u ^ z * 0xC2B2AE3Du;
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    return h ^ h >> 12;
+}
+
+// A textured scene with edges and noise, so the scan has long runs of
+// stuffed 0xFF bytes and every Huffman code length in use
+static frame_t make_frame(const synthetic_t *s, int index) {
+    int comps = s->grey ? 1 : 3;
+    uint8_t *pixels = malloc((size_t)s->w * s->h * comps);
+    for (int y = 0; y < s->h; y++) {
+        for (int x = 0; x < s->w; x++) {
+            uint8_t *px = pixels + ((size_t)y * s->w + x) * comps;
+            uint32_t n = hash3(x, y, index) & 0x3F;
+            int stripe = ((x / 24 + y / 16) & 1) * 90;
+            px[0] = (uint8_t)((x * 255 / s->w + stripe + n) & 0xFF);
+            if (comps == 3) {
+                px[1] = (uint8_t)((y * 255 / s->h + n / 2) & 0xFF);
+                px[2] = (uint8_t)(((x ^ y) + stripe) & 0xFF);
+            }
+        }
+    }
+
+    struct jpeg_compress_struct c;
+    struct jpeg_error_mgr jerr;
+    c.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&c);
+    unsigned char *jpg = NULL;
+    unsigned long jpg_len = 0;
+    jpeg_mem_dest(&c, &jpg, &jpg_len);
+    c.image_width = s->w;
+    c.image_height = s->h;
+    c.input_components = comps;
+    c.in_color_space = s->grey ? JCS_GRAYSCALE : JCS_RGB;
+    jpeg_set_defaults(&c);
+    jpeg_set_quality(&c, s->quality, TRUE);
+    c.comp_info[0].h_samp_factor = s->luma_h;
+    c.comp_info[0].v_samp_factor = s->luma_v;
+    c.restart_interval = s->restart_interval;
+    if (s->one_table) {
+        c.comp_info[1].quant_tbl_no = 0;
+        c.comp_info[2].quant_tbl_no = 0;
+    }
+    if (s->progressive) {
+        jpeg_simple_progression(&c);
+    }
+    jpeg_start_compress(&c, TRUE);
+    while (c.next_scanline < c.image_height) {
+        JSAMPROW row = pixels + (size_t)c.next_scanline * s->w * comps;
+        jpeg_write_scanlines(&c, &row, 1);
+    }
+    jpeg_finish_compress(&c);
+    jpeg_destroy_compress(&c);
+    free(pixels);
+
+    bool sendable = !s->grey && !s->progressive && s->luma_h == 2 && s->w % 8 == 0 && s->h % 8 == 0 &&
+        s->w <= 2040 && s->h <= 2040;
+    return (frame_t){ jpg, jpg_len, s->name, sendable };
+}
+
+// Annex K tables as libjpeg's defaults, in DHT order: luma DC, luma AC,
+// chroma DC, chroma AC
+static uint8_t std_dht[4][17 + 256];
+static size_t std_dht_len[4];
+
+static void load_std_huffman(void) {
+    struct jpeg_compress_struct c;
+    struct jpeg_error_mgr jerr;
+    c.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&c);
+    c.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&c);
+    JHUFF_TBL *tables[4] = { c.dc_huff_tbl_ptrs[0], c.ac_huff_tbl_ptrs[0], c.dc_huff_tbl_ptrs[1],
+                             c.ac_huff_tbl_ptrs[1] };
+    for (int t = 0; t < 4; t++) {
+        size_t symbols = 0;
+        std_dht[t][0] = (uint8_t)((t & 1) << 4 | t >> 1);
+        for (int i = 1; i <= 16; i++) {
+            std_dht[t][i] = tables[t]->bits[i];
+            symbols += tables[t]->bits[i];
+        }
+        memcpy(std_dht[t] + 17, tables[t]->huffval, symbols);
+        std_dht_len[t] = 17 + symbols;
+    }
+    jpeg_destroy_compress(&c);
+}
+
+// Whether every DHT of the frame is one of the standard tables. RFC 2435
+// cannot carry others: the sensors never use them, but saved files may.
+static bool std_huffman(const uint8_t *jpeg, size_t len) {
+    for (size_t i = 2; i + 4 <= len && jpeg[i + 1] != 0xDA; i += 2 + rd16(jpeg + i + 2)) {
+        if (jpeg[i + 1] != 0xC4) {
+            continue;
+        }
+        const uint8_t *seg = jpeg + i + 4;
+        size_t body_len = rd16(jpeg + i + 2) - 2;
+        for (size_t j = 0; j + 17 <= body_len;) {
+            size_t symbols = 0;
+            for (int k = 1; k <= 16; k++) {
+                symbols += seg[j + k];
+            }
+            bool found = false;
+            for (int t = 0; t < 4; t++) {
+                found |= std_dht_len[t] == 17 + symbols && !memcmp(std_dht[t], seg + j, 17 + symbols);
+            }
+            if (!found) {
+                return false;
+            }
+            j += 17 + symbols;
+        }
+    }
+    return true;
+}
+
+// RGB pixels, or NULL when libjpeg rejects the data
+static uint8_t *decode(const uint8_t *jpeg, size_t len, int *w, int *h) {
+    struct jpeg_decompress_struct d;
+    jpeg_error_t jerr;
+    uint8_t *volatile pixels = NULL;
+    d.err = jpeg_std_error(&jerr.mgr);
+    jerr.mgr.error_exit = jpeg_error_exit;
+    jerr.mgr.output_message = jpeg_quiet;
+    jpeg_create_decompress(&d);
+    if (setjmp(jerr.jump)) {
+        jpeg_destroy_decompress(&d);
+        free(pixels);
+        return NULL;
+    }
+    jpeg_mem_src(&d, jpeg, len);
+    jpeg_read_header(&d, TRUE);
+    d.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&d);
+    *w = d.output_width;
+    *h = d.output_height;
+    pixels = malloc((size_t)*w * *h * 3);
+    while (d.output_scanline < d.output_height) {
+        JSAMPROW row = pixels + (size_t)d.output_scanline * *w * 3;
+        jpeg_read_scanlines(&d, &row, 1);
+    }
+    // Corrupt entropy data only warns, so a broken rebuild must not pass as clean
+    bool clean = jerr.mgr.num_warnings == 0;
+    jpeg_finish_decompress(&d);
+    jpeg_destroy_decompress(&d);
+    if (!clean) {
+        free(pixels);
+        return NULL;
+    }
+    return pixels;
+}
+
+// ---------------------------------------------------------------------------
+// Receiver: what a player does with the packets, and nothing from the parser
+
+typedef struct {
+    uint8_t *jpeg;              // Rebuilt frame, headers + scan + EOI
+    size_t len;
+    size_t cap;
+    uint8_t type, q, w8, h8;
+    uint16_t dri;
+    uint8_t qtables[64 * RTP_JPEG_MAX_QTABLES];
+    size_t qtables_len;
+    uint8_t *scan;
+    size_t scan_len;
+} receiver_t;
+
+static void put_segment(receiver_t *r, uint8_t marker, const uint8_t *body, size_t body_len) {
+    uint8_t *p = r->jpeg + r->len;
+    p[0] = 0xFF;
+    p[1] = marker;
+    p[2] = (uint8_t)((body_len + 2) >> 8);
+    p[3] = (uint8_t)(body_len + 2);
+    memcpy(p + 4, body, body_len);
+    r->len += 4 + body_len;
+}
+
+// RFC 2435 Appendix B: the JFIF headers the sender stripped
+static void rebuild(receiver_t *r) {
+    r->cap = 1024 + r->scan_len;
+    r->jpeg = malloc(r->cap);
+    r->jpeg[0] = 0xFF;
+    r->jpeg[1] = 0xD8;
+    r->len = 2;
+    for (size_t i = 0; i < r->qtables_len / 64; i++) {
+        uint8_t dqt[65] = { (uint8_t)i };
+        memcpy(dqt + 1, r->qtables + 64 * i, 64);
+        put_segment(r, 0xDB, dqt, sizeof(dqt));
+    }
+    if (r->dri) {
+        uint8_t dri[2] = { r->dri >> 8, r->dri & 0xFF };
+        put_segment(r, 0xDD, dri, sizeof(dri));
+    }
+    int w = r->w8 * 8, h = r->h8 * 8;
+    uint8_t chroma_table = r->qtables_len >= 128 ? 1 : 0;
+    uint8_t sof[15] = { 8, h >> 8, h & 0xFF, w >> 8, w & 0xFF, 3,
+                        1, (r->type & 0x3F) == 0 ? 0x21 : 0x22, 0,
+                        2, 0x11, chroma_table,
+                        3, 0x11, chroma_table };
+    put_segment(r, 0xC0, sof, sizeof(sof));
+    for (int t = 0; t < 4; t++) {
+        put_segment(r, 0xC4, std_dht[t], std_dht_len[t]);
+    }
+    static const uint8_t sos[10] = { 3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0 };
+    put_segment(r, 0xDA, sos, sizeof(sos));
+    memcpy(r->jpeg + r->len, r->scan, r->scan_len);
+    r->len += r->scan_len;
+    r->jpeg[r->len++] = 0xFF;
+    r->jpeg[r->len++] = 0xD9;
+}
+
+// ---------------------------------------------------------------------------
+// Checks
+
+// The scan as the parser cut it: EOI right after, only stuffed bytes and
+// RSTn inside, RSTn counting up modulo 8, one between each restart interval
+static bool scan_ok(const frame_t *fr, const rtp_jpeg_frame_t *f, const char **why) {
+    const uint8_t *end = f->scan + f->scan_len;
+    if (f->scan < fr->buf || end + 2 > fr->buf + fr->len || end[0] != 0xFF || end[1] != 0xD9) {
+        *why = "scan does not end at EOI";
+        return false;
+    }
+    size_t i = 2;
+    while (i + 4 <= fr->len && fr->buf[i + 1] != 0xDA) {
+        i += fr->buf[i + 1] == 0xFF ? 1 : 2 + rd16(fr->buf + i + 2);
+    }
+    if (i + 4 > fr->len || f->scan != fr->buf + i + 2 + rd16(fr->buf + i + 2) || f->scan_len == 0) {
+        *why = "scan does not start after SOS";
+        return false;
+    }
+    size_t restarts = 0;
+    for (i = 0; i + 1 < f->scan_len; i++) {
+        if (f->scan[i] != 0xFF) {
+            continue;
+        }
+        uint8_t m = f->scan[i + 1];
+        if (m == 0x00) {
+            i++;
+        } else if ((m & 0xF8) == 0xD0 && m == (0xD0 | (restarts & 7))) {
+            restarts++;
+            i++;
+        } else {
+            *why = "marker inside the scan";
+            return false;
+        }
+    }
+    if (f->scan[f->scan_len - 1] == 0xFF) {
+        *why = "scan ends in the middle of a marker";
+        return false;
+    }
+    size_t mcu_w = 16, mcu_h = (f->type & 0x3F) == 0 ? 8 : 16;
+    size_t mcus = ((f->width + mcu_w - 1) / mcu_w) * ((f->height + mcu_h - 1) / mcu_h);
+    size_t expected = f->restart_interval ? (mcus + f->restart_interval - 1) / f->restart_interval - 1 : 0;
+    if (restarts != expected) {
+        *why = "wrong number of restart markers for the interval";
+        return false;
+    }
+    return true;
+}
+
+typedef struct {
+    uint64_t frames;
+    uint64_t packets;
+    uint64_t header_bytes;
+    uint64_t scan_bytes;
+} totals_t;
+
+// Packetize as send_rtp_jpeg() does, check each datagram, and hand it to
+// the receiver. Returns false after the first failure.
+static bool send_frame(const frame_t *fr, const rtp_jpeg_frame_t *f, rtp_jpeg_stream_t *st, uint32_t timestamp,
+                       size_t max_packet, receiver_t *r, FILE *dump, totals_t *tot) {
+    uint8_t datagram[RTP_JPEG_MAX_HEADERS + 2048];
+    uint16_t seq = st->seq;
+    size_t offset = 0;
+    bool marker = false;
+    r->scan = malloc(f->scan_len + 1);
+    r->scan_len = 0;
+    r->qtables_len = 0;
+    do {
+        size_t data_len;
+        size_t hlen = rtp_jpeg_packet(st, f, timestamp, offset, max_packet, datagram, &data_len);
+        size_t len = hlen + data_len;
+        if (hlen != rtp_jpeg_header_len(f, offset) || len > max_packet || data_len == 0) {
+            fail(fr, max_packet, "datagram over the limit or without data");
+            return false;
+        }
+        memcpy(datagram + hlen, f->scan + offset, data_len);
+        if (dump) {
+            uint8_t rec[5] = { 'P', len >> 24, len >> 16, len >> 8, len & 0xFF };
+            fwrite(rec, 1, sizeof(rec), dump);
+            fwrite(datagram, 1, len, dump);
+        }
+        tot->packets++;
+        tot->header_bytes += hlen;
+        tot->scan_bytes += data_len;
+
+        // RTP header
+        const uint8_t *p = datagram;
+        uint32_t ts = (uint32_t)p[4] << 24 | p[5] << 16 | p[6] << 8 | p[7];
+        uint32_t ssrc = (uint32_t)p[8] << 24 | p[9] << 16 | p[10] << 8 | p[11];
+        if (p[0] != 0x80 || (p[1] & 0x7F) != RTP_PT_JPEG || rd16(p + 2) != seq++ || ts != timestamp ||
+            ssrc != st->ssrc) {
+            fail(fr, max_packet, "bad RTP header");
+            return false;
+        }
+        if (marker) {
+            fail(fr, max_packet, "packet after the marker");
+            return false;
+        }
+        marker = p[1] & 0x80;
+
+        // JPEG header, then the restart and quantization table headers
+        p += RTP_HEADER_SIZE;
+        size_t frag = (size_t)p[1] << 16 | p[2] << 8 | p[3];
+        if (frag != r->scan_len || p[0] != 0) {
+            fail(fr, max_packet, "fragment offsets do not tile the scan");
+            return false;
+        }
+        if (frag == 0) {
+            r->type = p[4];
+            r->q = p[5];
+            r->w8 = p[6];
+            r->h8 = p[7];
+        } else if (p[4] != r->type || p[5] != r->q || p[6] != r->w8 || p[7] != r->h8) {
+            fail(fr, max_packet, "JPEG header changed within the frame");
+            return false;
+        }
+        p += RTP_JPEG_HEADER_SIZE;
+        if (r->type >= 64) {
+            uint16_t count = (uint16_t)rd16(p + 2);
+            r->dri = (uint16_t)rd16(p);
+            if (r->dri == 0 || count != 0xFFFF) {
+                fail(fr, max_packet, "bad restart marker header");
+                return false;
+            }
+            p += RTP_JPEG_RESTART_HEADER_SIZE;
+        } else {
+            r->dri = 0;
+        }
+        if (frag == 0) {
+            if (r->q < 128 || p[0] != 0 || p[1] != 0) {
+                fail(fr, max_packet, "first packet without 8-bit in-band tables");
+                return false;
+            }
+            r->qtables_len = rd16(p + 2);
+            if (r->qtables_len == 0 || r->qtables_len > sizeof(r->qtables) || r->qtables_len % 64) {
+                fail(fr, max_packet, "bad quantization table length");
+                return false;
+            }
+            memcpy(r->qtables, p + 4, r->qtables_len);
+            p += RTP_JPEG_QTABLE_HEADER_SIZE + r->qtables_len;
+        }
+        if ((size_t)(p - datagram) != hlen) {
+            fail(fr, max_packet, "headers longer than the packetizer said");
+            return false;
+        }
+        memcpy(r->scan + r->scan_len, datagram + hlen, data_len);
+        r->scan_len += data_len;
+        if (!marker && len != max_packet) {
+            fail(fr, max_packet, "datagram short of the limit before the last");
+            return false;
+        }
+        offset += data_len;
+    } while (offset < f->scan_len);
+
+    if (!marker) {
+        fail(fr, max_packet, "no marker on the last packet");
+        return false;
+    }
+    tot->frames++;
+    return true;
+}
+
+static void check_frame(const frame_t *fr, size_t max_packet, rtp_jpeg_stream_t *st, uint32_t timestamp,
+                        FILE *dump, totals_t *tot, int *custom_huffman) {
+    rtp_jpeg_frame_t f;
+    bool parsed = rtp_jpeg_parse(fr->buf, fr->len, &f);
+    if (parsed != fr->sendable) {
+        fail(fr, max_packet, parsed ? "parser took a frame RFC 2435 cannot carry" : "parser refused the frame");
+        return;
+    }
+    if (!parsed) {
+        return;
+    }
+    const char *why;
+    if (!scan_ok(fr, &f, &why)) {
+        fail(fr, max_packet, why);
+        return;
+    }
+    if (dump) {
+        uint8_t rec[5] = { 'J', fr->len >> 24, fr->len >> 16, fr->len >> 8, fr->len & 0xFF };
+        fwrite(rec, 1, sizeof(rec), dump);
+        fwrite(fr->buf, 1, fr->len, dump);
+    }
+
+    receiver_t r = {0};
+    if (!send_frame(fr, &f, st, timestamp, max_packet, &r, dump, tot)) {
+        free(r.scan);
+        return;
+    }
+    rebuild(&r);
+    if (dump) {
+        uint8_t rec[5] = { 'R', r.len >> 24, r.len >> 16, r.len >> 8, r.len & 0xFF };
+        fwrite(rec, 1, sizeof(rec), dump);
+        fwrite(r.jpeg, 1, r.len, dump);
+    }
+    if (r.scan_len != f.scan_len || memcmp(r.scan, f.scan, f.scan_len)) {
+        fail(fr, max_packet, "depacketized scan differs");
+    } else if (r.w8 * 8 != f.width || r.h8 * 8 != f.height) {
+        fail(fr, max_packet, "frame size lost on the way");
+    } else if (!std_huffman(fr->buf, fr->len)) {
+        // Sent as it is, a player decodes it with the wrong tables
+        if (max_packet == DEFAULT_PACKET) {
+            (*custom_huffman)++;
+        }
+    } else {
+        int ow, oh, rw, rh;
+        uint8_t *orig = decode(fr->buf, fr->len, &ow, &oh);
+        uint8_t *back = decode(r.jpeg, r.len, &rw, &rh);
+        if (!orig) {
+            fail(fr, max_packet, "libjpeg cannot decode the original");
+        } else if (!back) {
+            fail(fr, max_packet, "libjpeg cannot decode the rebuilt frame");
+        } else if (ow != rw || oh != rh || memcmp(orig, back, (size_t)ow * oh * 3)) {
+            fail(fr, max_packet, "rebuilt frame decodes to other pixels");
+        } else if (verbose && max_packet == DEFAULT_PACKET) {
+            printf("  %-24s %4dx%-4d type %3d, %d table(s), %6zu B scan: same pixels\n", fr->name, ow, oh,
+                f.type, f.qtable_count, f.scan_len);
+        }
+        free(orig);
+        free(back);
+    }
+    free(r.scan);
+    free(r.jpeg);
+}
+
+int main(int argc, char **argv) {
+    const char *dump_path = NULL;
+    frame_t *frames = NULL;
+    int count = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-v")) {
+            verbose = true;
+        } else if (!strcmp(argv[i], "--dump") && i + 1 < argc) {
+            dump_path = argv[++i];
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "usage: %s [-v] [--dump FILE] [sequence.mjpeg frame.jpg ...]\n", argv[0]);
+            return 2;
+        } else {
+            size_t len;
+            uint8_t *buf = read_file(argv[i], &len);
+            if (!buf) {
+                fprintf(stderr, "%s: cannot read\n", argv[i]);
+                return 2;
+            }
+            int before = count;
+            count = split_frames(buf, len, argv[i], &frames, count);
+            printf("%s: %d frames\n", argv[i], count - before);
+        }
+    }
+    load_std_huffman();
+
+    bool recorded = count > 0;
+    if (!recorded) {
+        for (size_t i = 0; i < sizeof(synthetic) / sizeof(synthetic[0]); i++) {
+            frames = realloc(frames, (count + 1) * sizeof(frame_t));
+            frames[count++] = make_frame(&synthetic[i], (int)i);
+        }
+        printf("%d test frames\n", count);
+    } else {
+        // Recorded frames came from the camera or a player: all must be sendable
+        // unless the parser says otherwise, which is then reported, not failed
+        for (int i = 0; i < count; i++) {
+            rtp_jpeg_frame_t f;
+            frames[i].sendable = rtp_jpeg_parse(frames[i].buf, frames[i].len, &f);
+        }
+    }
+
+    FILE *dump = NULL;
+    if (dump_path && !(dump = fopen(dump_path, "wb"))) {
+        fprintf(stderr, "%s: cannot write\n", dump_path);
+        return 2;
+    }
+
+    static const size_t sizes[] = { DEFAULT_PACKET, SMALL_PACKET };
+    totals_t tot[2] = {{0}};
+    int custom_huffman = 0, refused = 0;
+    for (int s = 0; s < 2; s++) {
+        // Sequence numbers and timestamps wrap within the first few frames
+        rtp_jpeg_stream_t st = { .ssrc = 0x54524149, .seq = 0xFFF0, .ts_offset = 0xFFFFF000 };
+        for (int i = 0; i < count; i++) {
+            uint32_t timestamp = rtp_jpeg_timestamp(&st, (int64_t)i * 66667);
+            check_frame(&frames[i], sizes[s], &st, timestamp, s == 0 ? dump : NULL, &tot[s], &custom_huffman);
+            refused += s == 0 && !frames[i].sendable;
+        }
+    }
+    if (dump) {
+        fclose(dump);
+    }
+    if (recorded && refused) {
+        printf("%d frame(s) refused by rtp_jpeg_parse()\n", refused);
+    }
+    if (custom_huffman) {
+        printf("%d frame(s) with their own Huffman tables: a player would decode them wrongly\n", custom_huffman);
+    }
+
+    // Per frame: parse once, then build the headers of every packet
+    printf("\n%-10s %7s %9s %9s %11s\n", "datagram", "frames", "pkts/fr", "hdr B/fr", "us/frame");
+    for (int s = 0; s < 2; s++) {
+        if (tot[s].frames == 0) {
+            continue;
+        }
+        int reps = 0;
+        double start = now_s(), elapsed;
+        volatile size_t sink = 0;
+        do {
+            for (int i = 0; i < count; i++) {
+                rtp_jpeg_frame_t f;
+                if (!frames[i].sendable || !rtp_jpeg_parse(frames[i].buf, frames[i].len, &f)) {
+                    continue;
+                }
+                rtp_jpeg_stream_t st = { .ssrc = 1 };
+                uint8_t hdr[RTP_JPEG_MAX_HEADERS];
+                size_t offset = 0, data_len;
+                do {
+                    sink += rtp_jpeg_packet(&st, &f, 0, offset, sizes[s], hdr, &data_len);
+                    offset += data_len;
+                } while (offset < f.scan_len);
+            }
+            reps++;
+        } while ((elapsed = now_s() - start) < 0.3);
+        printf("%6zu B %9lu %9.1f %9.1f %11.2f\n", sizes[s], (unsigned long)tot[s].frames,
+            (double)tot[s].packets / tot[s].frames, (double)tot[s].header_bytes / tot[s].frames,
+            elapsed * 1e6 / reps / tot[s].frames);
+    }
+
+    if (failures) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all frames ok\n");
+    return 0;
+}
@@ -0,0 +1,247 @@
+// Host simulation of the MJPEG stream session scheduler (main/stream_sched.h).
+//
+// Streams a 15 fps camera to a mix of simulated clients through the real
+// policy code. Each client has a socket send buffer the size of lwIP's
+// (CONFIG_LWIP_TCP_SND_BUF_DEFAULT) that drains at its link rate. The
+// sender writes whatever fits each millisecond, like the firmware's
+// select() loop. For every client it prints the fps achieved, frames
+// skipped and held back by the cap, mean send-queue occupancy and frame
+// latency, plus Jain's fairness index over the clients' fps relative to
+// what each could take (min of cap, camera rate and link rate).
+//
+// The same clients are also run in "lockstep": every client gets every
+// frame and the next frame waits for the slowest. That is what serving
+// them from one blocking loop amounts to, for comparison.
+//
+//   cc -O2 -Imain tools/stream_sched_sim.c -o stream_sched_sim   (from camera/src)
+//   ./stream_sched_sim
+//
+// Exits non-zero if a client misses its expected rate, the stalled client
+// is not evicted on time, or stream_sched_next_due() disagrees with the
+// clients a frame goes to.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STREAM_SCHED_MAX_CLIENTS 4
+#include "stream_sched.h"
+
+#define STEP_US 1000
+#define SIM_US 30000000
+#define CAMERA_FPS 15
+#define FRAME_MIN 20000             // JPEG sizes, bytes
+#define FRAME_MAX 35000
+#define PART_HEADER 64              // Boundary and part header per frame
+#define SNDBUF 11680
+#define STALL_US 5000000            // CONFIG_TRAIN_STREAM_SEND_TIMEOUT_MS
+
+typedef struct {
+    const char *name;
+    uint32_t fps_cap;
+    uint32_t rate;                  // Link drain rate, bytes/s
+    int64_t stall_at_us;            // Stops reading from here (0 = never)
+    // Expected fps window; 0 = derive from the link rate
+    double min_fps;
+    double max_fps;
+} sim_client_t;
+
+static const sim_client_t clients[] = {
+    { "fast",          0, 2000000, 0,        13.5, 15.1 },
+    { "fast, fps=5",   5, 2000000, 0,        4.8,  5.05 },
+    { "slow 120 KB/s", 0, 120000,  0,        0,    0    },
+    { "stalls at 10s", 0, 1000000, 10000000, 0,    0    },
+};
+#define CLIENT_COUNT (int)(sizeof(clients) / sizeof(clients[0]))
+
+typedef struct {
+    uint32_t buffered;              // Bytes in the socket send buffer
+    double drain_carry;
+    int64_t evicted_us;
+    uint32_t fps_x10;
+} sim_sock_t;
+
+// Camera frames and how many of them any client took. The firmware only
+// grabs a frame when stream_sched_next_due() says somebody wants it.
+static uint32_t frames_total, frames_wanted, due_mismatches;
+
+static uint32_t rng = 12345;
+
+static uint32_t frame_size(void) {
+    rng = rng * 1103515245 + 12345;
+    return FRAME_MIN + (rng >> 8) % (FRAME_MAX - FRAME_MIN);
+}
+
+static double mean_frame(void) {
+    return (FRAME_MIN + FRAME_MAX) / 2.0 + PART_HEADER;
+}
+
+// What a client could take: its cap, the camera rate and its link
+static double demand_fps(const sim_client_t *c) {
+    double fps = CAMERA_FPS;
+    if (c->fps_cap && c->fps_cap < fps) {
+        fps = c->fps_cap;
+    }
+    double link = c->rate / mean_frame();
+    return link < fps ? link : fps;
+}
+
+static int run(bool lockstep, stream_sched_t *s, sim_sock_t *sock) {
+    stream_sched_init(s, STALL_US);
+    memset(sock, 0, sizeof(sim_sock_t) * CLIENT_COUNT);
+    rng = 12345;
+    frames_total = frames_wanted = due_mismatches = 0;
+    for (int i = 0; i < CLIENT_COUNT; i++) {
+        stream_sched_join(s, clients[i].fps_cap, 0);
+    }
+
+    int64_t next_frame = 0;
+    uint32_t frame_id = 0;
+    for (int64_t now = 0; now < SIM_US; now += STEP_US) {
+        if (now >= next_frame) {
+            next_frame += 1000000 / CAMERA_FPS;
+            uint32_t len = frame_size() + PART_HEADER;
+            frame_id++;
+            bool busy = false;
+            for (int i = 0; i < CLIENT_COUNT; i++) {
+                busy |= s->client[i].active && s->client[i].queued > 0;
+            }
+            if (lockstep && busy) {
+                // Everybody waits for the slowest client
+                for (int i = 0; i < CLIENT_COUNT; i++) {
+                    if (s->client[i].active) {
+                        s->client[i].skipped++;
+                    }
+                }
+            } else {
+                bool due = stream_sched_next_due(s) <= now;
+                uint32_t mask = stream_sched_frame(s, frame_id, len, now);
+                due_mismatches += due != (mask != 0);
+                frames_wanted += mask != 0;
+            }
+            frames_total++;
+        }
+
+        for (int i = 0; i < CLIENT_COUNT; i++) {
+            stream_client_t *c = &s->client[i];
+            sim_sock_t *k = &sock[i];
+            if (!c->active) {
+                continue;
+            }
+            if (c->queued > 0) {
+                uint32_t room = SNDBUF - k->buffered;
+                uint32_t n = c->queued < room ? c->queued : room;
+                k->buffered += n;
+                stream_sched_sent(s, i, n, now);
+            }
+            bool stalled = clients[i].stall_at_us && now >= clients[i].stall_at_us;
+            if (!stalled) {
+                k->drain_carry += (double)clients[i].rate * STEP_US / 1e6;
+                uint32_t d = (uint32_t)k->drain_carry;
+                if (d > k->buffered) {
+                    d = k->buffered;
+                }
+                k->buffered -= d;
+                k->drain_carry -= (uint32_t)k->drain_carry;
+            }
+        }
+
+        uint32_t stalled = stream_sched_stalled(s, now);
+        for (int i = 0; i < CLIENT_COUNT; i++) {
+            if (stalled & (1u << i)) {
+                sock[i].fps_x10 = stream_sched_fps_x10(&s->client[i], now);
+                sock[i].evicted_us = now;
+                stream_sched_evict(s, i);
+            }
+        }
+    }
+    for (int i = 0; i < CLIENT_COUNT; i++) {
+        if (s->client[i].active) {
+            sock[i].fps_x10 = stream_sched_fps_x10(&s->client[i], SIM_US);
+        }
+    }
+    return 0;
+}
+
+// Jain's index over fps / demand of the clients that were never evicted
+static double fairness(const sim_sock_t *sock) {
+    double sum = 0, sq = 0;
+    int n = 0;
+    for (int i = 0; i < CLIENT_COUNT; i++) {
+        if (sock[i].evicted_us) {
+            continue;
+        }
+        double x = sock[i].fps_x10 / 10.0 / demand_fps(&clients[i]);
+        sum += x;
+        sq += x * x;
+        n++;
+    }
+    return n ? sum * sum / (n * sq) : 0;
+}
+
+static void report(const char *title, const stream_sched_t *s, const sim_sock_t *sock) {
+    printf("%s\n", title);
+    printf("  %-14s %6s %7s %7s %7s %9s %9s %9s  %s\n", "client", "fps", "demand", "skipped",
+        "capped", "queue KB", "lat ms", "max ms", "evicted");
+    for (int i = 0; i < CLIENT_COUNT; i++) {
+        const stream_client_t *c = &s->client[i];
+        double occ = c->occupancy_samples ? (double)c->occupancy_sum / c->occupancy_samples / 1024 : 0;
+        double lat = c->frames ? (double)c->latency_us_sum / c->frames / 1000 : 0;
+        printf("  %-14s %6.1f %7.1f %7lu %7lu %9.1f %9.1f %9.1f  ", clients[i].name, sock[i].fps_x10 / 10.0,
+            demand_fps(&clients[i]), (unsigned long)c->skipped, (unsigned long)c->capped, occ, lat,
+            c->latency_us_max / 1000.0);
+        if (sock[i].evicted_us) {
+            printf("at %.1f s\n", sock[i].evicted_us / 1e6);
+        } else {
+            printf("-\n");
+        }
+    }
+    printf("  fairness (Jain, fps/demand): %.3f\n", fairness(sock));
+    printf("  camera frames sent to anybody: %lu of %lu\n\n", (unsigned long)frames_wanted,
+        (unsigned long)frames_total);
+}
+
+int main(void) {
+    static stream_sched_t sched, lock;
+    static sim_sock_t sched_sock[CLIENT_COUNT], lock_sock[CLIENT_COUNT];
+
+    run(false, &sched, sched_sock);
+    report("per-client sessions (stream_sched.h)", &sched, sched_sock);
+    uint32_t mismatches = due_mismatches;
+    run(true, &lock, lock_sock);
+    report("lockstep (one blocking loop)", &lock, lock_sock);
+
+    int failures = 0;
+    for (int i = 0; i < CLIENT_COUNT; i++) {
+        const sim_client_t *c = &clients[i];
+        double fps = sched_sock[i].fps_x10 / 10.0;
+        if (c->stall_at_us) {
+            int64_t late = sched_sock[i].evicted_us - c->stall_at_us;
+            if (!sched_sock[i].evicted_us || late < STALL_US || late > STALL_US + 1000000) {
+                printf("FAIL: %s evicted %.1f s after it stalled\n", c->name, late / 1e6);
+                failures++;
+            }
+            continue;
+        }
+        double lo = c->min_fps ? c->min_fps : demand_fps(c) * 0.85;
+        double hi = c->max_fps ? c->max_fps : demand_fps(c) * 1.05;
+        if (fps < lo || fps > hi) {
+            printf("FAIL: %s got %.1f fps, expected %.1f-%.1f\n", c->name, fps, lo, hi);
+            failures++;
+        }
+    }
+    if (fairness(sched_sock) < 0.95) {
+        printf("FAIL: fairness %.3f\n", fairness(sched_sock));
+        failures++;
+    }
+    if (mismatches) {
+        printf("FAIL: next_due disagreed with the frame mask %lu times\n", (unsigned long)mismatches);
+        failures++;
+    }
+    if (sched.evictions != 1) {
+        printf("FAIL: %lu evictions\n", (unsigned long)sched.evictions);
+        failures++;
+    }
+    printf("%s\n", failures ? "FAILED" : "all checks passed");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,420 @@
+// Host harness for the MJPEG send paths (main/stream_sock.h).
+//
+// Streams synthetic JPEG frames over a loopback TCP connection in three
+// ways and compares them:
+//
+//   chunked x3  boundary, part header and JPEG as three httpd chunks (the
+//               original handler); httpd sends size line, data and CRLF
+//               separately, so 9 send() calls per frame
+//   chunked x2  boundary + header template as one chunk (6 sends)
+//   raw         one sendmsg() of [header, JPEG] on a TCP_NODELAY socket
+//
+// A reader thread records when the data arrives. Afterwards the stream is
+// parsed (de-chunked where needed) and every frame is checked byte for
+// byte. The harness reports syscalls and wire bytes per frame, bulk
+// throughput, and per-frame latency with frames paced like the camera.
+// Two more runs check the raw path against a slow reader (partial writes,
+// buffer waits) and a reader that stops (the send timeout must fire).
+// Exits non-zero on any mismatch.
+//
+//   cc -O2 -Imain tools/stream_send_bench.c -o stream_send_bench -lpthread   (from camera/src)
+//   ./stream_send_bench
+
+#define _GNU_SOURCE  // memmem(), before any system header
+
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "http_template.h"
+#include "stream_sock.h"
+
+#define BOUNDARY "frame"
+#define BULK_FRAMES 400
+#define PACED_FRAMES 200
+#define PACE_US 20000
+#define MIN_JPEG 15000
+#define MAX_JPEG 45000
+#define MAX_RECVS (1 << 20)
+
+typedef enum { MODE_CHUNKED3, MODE_CHUNKED2, MODE_RAW } send_mode_t;
+static const char *mode_names[] = { "chunked x3", "chunked x2", "raw" };
+
+static http_tpl_t part_tpl;
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { failures++; printf("FAIL: " __VA_ARGS__); printf("\n"); } \
+} while (0)
+
+static int64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static size_t frame_size(int f) {
+    return MIN_JPEG + (size_t)((f * 7919u) % (MAX_JPEG - MIN_JPEG));
+}
+
+static uint8_t frame_byte(int f, size_t i) {
+    return (uint8_t)(f * 31 + i * 7 + (i >> 8));
+}
+
+// ---------------------------------------------------------------------------
+// Reader: drain the socket, log (total bytes, time) after every recv
+
+typedef struct {
+    int fd;
+    int rcvbuf;
+    int read_delay_us;          // Sleep between reads (slow client)
+    size_t read_size;
+    uint8_t *data;
+    size_t cap;
+    size_t len;
+    size_t *log_bytes;
+    int64_t *log_us;
+    int log_count;
+} reader_t;
+
+static void *reader_main(void *arg) {
+    reader_t *r = arg;
+    while (r->len < r->cap) {
+        size_t want = r->cap - r->len < r->read_size ? r->cap - r->len : r->read_size;
+        ssize_t n = recv(r->fd, r->data + r->len, want, 0);
+        if (n <= 0) {
+            break;
+        }
+        r->len += n;
+        if (r->log_count < MAX_RECVS) {
+            r->log_bytes[r->log_count] = r->len;
+            r->log_us[r->log_count] = now_us();
+            r->log_count++;
+        }
+        if (r->read_delay_us) {
+            usleep(r->read_delay_us);
+        }
+    }
+    return NULL;
+}
+
+static void connect_pair(int *client, int *server, int rcvbuf) {
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t alen = sizeof(addr);
+    bind(lfd, (struct sockaddr *)&addr, sizeof(addr));
+    listen(lfd, 1);
+    getsockname(lfd, (struct sockaddr *)&addr, &alen);
+    *client = socket(AF_INET, SOCK_STREAM, 0);
+    if (rcvbuf > 0) {
+        setsockopt(*client, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+    connect(*client, (struct sockaddr *)&addr, sizeof(addr));
+    *server = accept(lfd, NULL, NULL);
+    close(lfd);
+}
+
+// ---------------------------------------------------------------------------
+// Writers
+
+typedef struct {
+    uint32_t syscalls;
+    uint32_t waits;
+    uint32_t partial;
+    uint64_t wire_bytes;
+    uint64_t jpeg_bytes;
+} send_stats_t;
+
+// httpd_send_all(): blocking send() until everything is out
+static int send_all(int fd, const void *buf, size_t len, send_stats_t *st) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        st->syscalls++;
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+        st->wire_bytes += n;
+    }
+    return 0;
+}
+
+// httpd_resp_send_chunk(): size line, data, CRLF
+static int send_chunk(int fd, const void *buf, size_t len, send_stats_t *st) {
+    char size_line[16];
+    int n = snprintf(size_line, sizeof(size_line), "%zx\r\n", len);
+    if (send_all(fd, size_line, n, st) != 0 || send_all(fd, buf, len, st) != 0) {
+        return -1;
+    }
+    return send_all(fd, "\r\n", 2, st);
+}
+
+static uint8_t *make_frame(int f) {
+    size_t len = frame_size(f);
+    uint8_t *buf = malloc(len);
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = frame_byte(f, i);
+    }
+    return buf;
+}
+
+static int send_frame(send_mode_t mode, int fd, int f, const uint8_t *jpeg, send_stats_t *st,
+                      uint32_t timeout_ms) {
+    size_t len = frame_size(f);
+    st->jpeg_bytes += len;
+    char header[128];
+    if (mode == MODE_CHUNKED3) {
+        static const char boundary[] = "\r\n--" BOUNDARY "\r\n";
+        int n = snprintf(header, sizeof(header), "Content-Type: image/jpeg\r\nContent-Length: %zu\r\n\r\n", len);
+        if (send_chunk(fd, boundary, sizeof(boundary) - 1, st) != 0 || send_chunk(fd, header, n, st) != 0) {
+            return -1;
+        }
+        return send_chunk(fd, jpeg, len, st);
+    }
+
+    size_t header_len = http_tpl_begin(&part_tpl, header);
+    http_tpl_set_uint(&part_tpl, header, 0, len);
+    if (mode == MODE_CHUNKED2) {
+        if (send_chunk(fd, header, header_len, st) != 0) {
+            return -1;
+        }
+        return send_chunk(fd, jpeg, len, st);
+    }
+
+    struct iovec iov[2] = {
+        { .iov_base = header, .iov_len = header_len },
+        { .iov_base = (void *)jpeg, .iov_len = len },
+    };
+    stream_sock_stats_t ss = {0};
+    int rc = stream_sock_sendv(fd, iov, 2, timeout_ms, &ss);
+    st->syscalls += ss.sends;
+    st->waits += ss.waits;
+    st->partial += ss.partial;
+    st->wire_bytes += ss.bytes;
+    return rc;
+}
+
+// ---------------------------------------------------------------------------
+// Parse what the reader got: de-chunk if needed, then walk the multipart
+// parts. Records the wire offset where each frame ends.
+
+static bool parse_stream(send_mode_t mode, const uint8_t *wire, size_t wire_len, int frames,
+                         size_t *frame_end) {
+    uint8_t *body = malloc(wire_len);
+    size_t *body_to_wire = malloc(wire_len * sizeof(size_t));
+    size_t body_len = 0;
+
+    if (mode == MODE_RAW) {
+        memcpy(body, wire, wire_len);
+        for (size_t i = 0; i < wire_len; i++) body_to_wire[i] = i;
+        body_len = wire_len;
+    } else {
+        size_t pos = 0;
+        while (pos < wire_len) {
+            char *end;
+            unsigned long n = strtoul((const char *)wire + pos, &end, 16);
+            pos = (const uint8_t *)end - wire;
+            if (pos + 2 > wire_len || memcmp(wire + pos, "\r\n", 2) != 0 || pos + 2 + n + 2 > wire_len) {
+                break;
+            }
+            pos += 2;
+            for (size_t i = 0; i < n; i++) {
+                body_to_wire[body_len] = pos + i;
+                body[body_len++] = wire[pos + i];
+            }
+            pos += n + 2;
+        }
+    }
+
+    static const char delim[] = "\r\n--" BOUNDARY "\r\n";
+    size_t pos = 0;
+    bool ok = true;
+    for (int f = 0; f < frames && ok; f++) {
+        ok = pos + sizeof(delim) - 1 <= body_len && memcmp(body + pos, delim, sizeof(delim) - 1) == 0;
+        if (!ok) break;
+        pos += sizeof(delim) - 1;
+        const uint8_t *hdr_end = memmem(body + pos, body_len - pos, "\r\n\r\n", 4);
+        const uint8_t *cl = memmem(body + pos, body_len - pos, "Content-Length:", 15);
+        ok = hdr_end != NULL && cl != NULL && cl < hdr_end;
+        if (!ok) break;
+        size_t len = strtoul((const char *)cl + 15, NULL, 10);  // Skips the padding
+        pos = hdr_end + 4 - body;
+        ok = len == frame_size(f) && pos + len <= body_len;
+        for (size_t i = 0; ok && i < len; i++) {
+            ok = body[pos + i] == frame_byte(f, i);
+        }
+        if (ok) {
+            pos += len;
+            frame_end[f] = body_to_wire[pos - 1] + 1;
+        }
+    }
+    free(body);
+    free(body_to_wire);
+    return ok;
+}
+
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    send_stats_t st;
+    double mb_per_s;
+    double lat_avg_us;
+    double lat_max_us;
+    bool ok;
+} run_result_t;
+
+static run_result_t run(send_mode_t mode, int frames, int pace_us, uint8_t **jpegs) {
+    int client, server;
+    connect_pair(&client, &server, 0);
+    if (mode == MODE_RAW) {
+        stream_sock_tune(server, 0);
+    }
+
+    size_t cap = 0;
+    for (int f = 0; f < frames; f++) cap += frame_size(f) + 256;
+    reader_t r = {
+        .fd = client, .read_size = 65536, .data = malloc(cap), .cap = cap,
+        .log_bytes = malloc(MAX_RECVS * sizeof(size_t)), .log_us = malloc(MAX_RECVS * sizeof(int64_t)),
+    };
+    pthread_t reader;
+    pthread_create(&reader, NULL, reader_main, &r);
+
+    run_result_t res = {0};
+    int64_t *sent_us = malloc(frames * sizeof(int64_t));
+    int64_t t0 = now_us();
+    for (int f = 0; f < frames; f++) {
+        if (pace_us) {
+            while (now_us() < t0 + (int64_t)f * pace_us) usleep(100);
+        }
+        sent_us[f] = now_us();
+        if (send_frame(mode, server, f, jpegs[f], &res.st, 5000) != 0) {
+            printf("FAIL: %s send of frame %d: %s\n", mode_names[mode], f, strerror(errno));
+            failures++;
+            break;
+        }
+    }
+    shutdown(server, SHUT_WR);
+    pthread_join(reader, NULL);
+    double secs = (now_us() - t0) / 1e6;
+    res.mb_per_s = r.len / secs / 1e6;
+
+    size_t *frame_end = calloc(frames, sizeof(size_t));
+    res.ok = r.len == res.st.wire_bytes && parse_stream(mode, r.data, r.len, frames, frame_end);
+
+    // Latency: from the send call to the recv that completed the frame
+    int k = 0;
+    double total = 0;
+    for (int f = 0; f < frames && res.ok; f++) {
+        while (k < r.log_count && r.log_bytes[k] < frame_end[f]) k++;
+        if (k == r.log_count) break;
+        double lat = (double)(r.log_us[k] - sent_us[f]);
+        total += lat;
+        if (lat > res.lat_max_us) res.lat_max_us = lat;
+    }
+    res.lat_avg_us = total / frames;
+
+    close(client);
+    close(server);
+    free(r.data);
+    free(r.log_bytes);
+    free(r.log_us);
+    free(sent_us);
+    free(frame_end);
+    return res;
+}
+
+// Raw path into a slow client with a small receive buffer
+static void check_slow_reader(uint8_t **jpegs) {
+    enum { FRAMES = 40 };
+    int client, server;
+    connect_pair(&client, &server, 4096);
+    stream_sock_tune(server, 8192);
+
+    size_t cap = 0;
+    for (int f = 0; f < FRAMES; f++) cap += frame_size(f) + 256;
+    reader_t r = {
+        .fd = client, .read_size = 4096, .read_delay_us = 200, .data = malloc(cap), .cap = cap,
+        .log_bytes = malloc(MAX_RECVS * sizeof(size_t)), .log_us = malloc(MAX_RECVS * sizeof(int64_t)),
+    };
+    pthread_t reader;
+    pthread_create(&reader, NULL, reader_main, &r);
+
+    send_stats_t st = {0};
+    bool sent = true;
+    for (int f = 0; f < FRAMES && sent; f++) {
+        sent = send_frame(MODE_RAW, server, f, jpegs[f], &st, 5000) == 0;
+    }
+    shutdown(server, SHUT_WR);
+    pthread_join(reader, NULL);
+
+    size_t frame_end[FRAMES];
+    bool ok = sent && r.len == st.wire_bytes && parse_stream(MODE_RAW, r.data, r.len, FRAMES, frame_end);
+    CHECK(ok, "slow reader: stream corrupted or incomplete");
+    CHECK(st.waits > 0 && st.partial > 0, "slow reader: expected buffer waits and partial sends");
+    printf("slow reader (raw): %d frames intact, %.1f sends/frame, %u partial sends, %u buffer waits\n",
+        FRAMES, (double)st.syscalls / FRAMES, st.partial, st.waits);
+
+    close(client);
+    close(server);
+    free(r.data);
+    free(r.log_bytes);
+    free(r.log_us);
+}
+
+// A client that stops reading must time out, not block forever
+static void check_stalled_reader(uint8_t **jpegs) {
+    int client, server;
+    connect_pair(&client, &server, 4096);
+    stream_sock_tune(server, 8192);
+
+    send_stats_t st = {0};
+    int64_t t0 = now_us();
+    int rc = 0, f = 0;
+    for (; f < 1000 && rc == 0; f++) {
+        rc = send_frame(MODE_RAW, server, f % BULK_FRAMES, jpegs[f % BULK_FRAMES], &st, 200);
+    }
+    int err = errno;
+    double ms = (now_us() - t0) / 1000.0;
+    CHECK(rc != 0 && err == ETIMEDOUT, "stalled reader: send did not time out");
+    CHECK(ms < 1000, "stalled reader: took %.0f ms to give up", ms);
+    printf("stalled reader (raw): gave up after %d frames, %.0f ms, %s\n", f, ms, strerror(err));
+    close(client);
+    close(server);
+}
+
+int main(void) {
+    http_tpl_compile(&part_tpl, HTTP_TPL_MJPEG_PART(BOUNDARY));
+    uint8_t *jpegs[BULK_FRAMES];
+    for (int f = 0; f < BULK_FRAMES; f++) {
+        jpegs[f] = make_frame(f);
+    }
+
+    printf("%-11s %12s %16s %10s %18s\n", "mode", "sends/frame", "overhead B/frame", "bulk MB/s", "paced latency us");
+    for (int m = MODE_CHUNKED3; m <= MODE_RAW; m++) {
+        run_result_t bulk = run(m, BULK_FRAMES, 0, jpegs);
+        run_result_t paced = run(m, PACED_FRAMES, PACE_US, jpegs);
+        CHECK(bulk.ok && paced.ok, "%s: stream corrupted", mode_names[m]);
+        printf("%-11s %12.2f %16.1f %10.0f %11.0f avg %5.0f max\n", mode_names[m],
+            (double)bulk.st.syscalls / BULK_FRAMES,
+            (double)(bulk.st.wire_bytes - bulk.st.jpeg_bytes) / BULK_FRAMES,
+            bulk.mb_per_s, paced.lat_avg_us, paced.lat_max_us);
+    }
+
+    check_slow_reader(jpegs);
+    check_stalled_reader(jpegs);
+
+    for (int f = 0; f < BULK_FRAMES; f++) {
+        free(jpegs[f]);
+    }
+    if (failures) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
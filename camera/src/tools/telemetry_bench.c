@@ -0,0 +1,356 @@
+// Host checks and benchmark for the hub telemetry code (main/hub_telemetry.h).
+//
+// First runs the parser against a frame produced by train/main.py's encoder
+// and against a synthetic stdout stream (frames mixed with text replies, cut
+// into random notification sizes, with corrupted and truncated frames), then
+// hammers the seqlock cell and the history ring from a writer thread while
+// reader threads check every copy for tearing. Exits non-zero on any
+// mismatch, then prints timings.
+//
+//   cc -O2 -Imain tools/telemetry_bench.c -o telemetry_bench -lpthread   (from camera/src)
+//   ./telemetry_bench
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hub_telemetry.h"
+
+#define RING_LEN 256
+#define STREAM_FRAMES 10000
+#define RACE_SECONDS 1
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { failures++; printf("FAIL: " __VA_ARGS__); printf("\n"); } \
+} while (0)
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Same layout as train/main.py's send_telemetry()
+static size_t encode(const hub_telemetry_t *t, uint8_t *out) {
+    uint8_t *p = out + 4;
+    p[0] = t->seq; p[1] = t->seq >> 8;
+    for (int i = 0; i < 4; i++) p[2 + i] = t->hub_ms >> (8 * i);
+    p[6] = t->battery_mv; p[7] = t->battery_mv >> 8;
+    p[8] = (uint16_t)t->battery_ma; p[9] = (uint16_t)t->battery_ma >> 8;
+    p[10] = (uint8_t)t->motor_duty;
+    p[11] = t->flags;
+    p[12] = (uint16_t)t->pitch_ddeg; p[13] = (uint16_t)t->pitch_ddeg >> 8;
+    p[14] = (uint16_t)t->roll_ddeg; p[15] = (uint16_t)t->roll_ddeg >> 8;
+    p[16] = t->loop_avg_ms; p[17] = t->loop_avg_ms >> 8;
+    p[18] = t->loop_max_ms; p[19] = t->loop_max_ms >> 8;
+    out[0] = HUB_TLM_MAGIC0;
+    out[1] = HUB_TLM_MAGIC1;
+    out[2] = HUB_TLM_VERSION;
+    out[3] = HUB_TLM_PAYLOAD_V1;
+    uint16_t crc = hub_tlm_crc16(p, HUB_TLM_PAYLOAD_V1);
+    out[4 + HUB_TLM_PAYLOAD_V1] = crc;
+    out[5 + HUB_TLM_PAYLOAD_V1] = crc >> 8;
+    return 4 + HUB_TLM_PAYLOAD_V1 + 2;
+}
+
+static hub_telemetry_t make_frame(uint32_t i) {
+    hub_telemetry_t t = {
+        .seq = (uint16_t)i,
+        .hub_ms = i * 500,
+        .battery_mv = (uint16_t)(7000 + i % 1000),
+        .battery_ma = (int16_t)(i % 600) - 100,
+        .motor_duty = (int8_t)((i % 3) * 30 - 30),
+        .flags = i & 1,
+        .pitch_ddeg = (int16_t)(i % 3600) - 1800,
+        .roll_ddeg = (int16_t)(1800 - i % 3600),
+        .loop_avg_ms = (uint16_t)(50 + i % 5),
+        .loop_max_ms = (uint16_t)(60 + i % 40),
+    };
+    return t;
+}
+
+static bool frame_equal(const hub_telemetry_t *a, const hub_telemetry_t *b) {
+    return a->seq == b->seq && a->hub_ms == b->hub_ms && a->battery_mv == b->battery_mv &&
+        a->battery_ma == b->battery_ma && a->motor_duty == b->motor_duty && a->flags == b->flags &&
+        a->pitch_ddeg == b->pitch_ddeg && a->roll_ddeg == b->roll_ddeg &&
+        a->loop_avg_ms == b->loop_avg_ms && a->loop_max_ms == b->loop_max_ms;
+}
+
+// A frame as written by MicroPython's ustruct.pack in train/main.py
+static void check_reference_frame(void) {
+    static const uint8_t ref[] = {
+        0xa5, 0x5a, 0x01, 0x14, 0x01, 0x02, 0x40, 0xe2, 0x01, 0x00, 0x84, 0x1e, 0x0b, 0xff,
+        0xe2, 0x01, 0x83, 0xff, 0x25, 0x00, 0x34, 0x00, 0x3f, 0x00, 0xb2, 0xb9,
+    };
+    hub_telemetry_t want = {
+        .seq = 513, .hub_ms = 123456, .battery_mv = 7812, .battery_ma = -245, .motor_duty = -30,
+        .flags = HUB_TLM_FLAG_TILT, .pitch_ddeg = -125, .roll_ddeg = 37, .loop_avg_ms = 52, .loop_max_ms = 63,
+    };
+    CHECK(hub_tlm_crc16((const uint8_t *)"123456789", 9) == 0x29B1, "CRC-16/CCITT-FALSE check value");
+
+    hub_rx_t rx;
+    hub_rx_init(&rx);
+    int frames = 0;
+    for (size_t i = 0; i < sizeof(ref); i++) {
+        frames += hub_rx_feed(&rx, ref[i]) == HUB_RX_FRAME;
+    }
+    CHECK(frames == 1 && frame_equal(&rx.frame, &want), "reference frame from main.py");
+
+    uint8_t enc[32];
+    hub_telemetry_t t = want;
+    CHECK(encode(&t, enc) == sizeof(ref) && memcmp(enc, ref, sizeof(ref)) == 0, "encoder matches main.py");
+}
+
+// Frames interleaved with text replies, fed in random notification sizes,
+// every 97th frame corrupted and every 89th truncated
+static void check_stream(void) {
+    static const char *lines[] = { "FWD", "STP", "BWD", "TLM 5" };
+    size_t cap = STREAM_FRAMES * 40;
+    uint8_t *stream = malloc(cap);
+    bool *expect = calloc(STREAM_FRAMES, sizeof(bool));
+    size_t len = 0;
+    int want_lines = 0, want_corrupt = 0;
+
+    for (uint32_t i = 0; i < STREAM_FRAMES; i++) {
+        hub_telemetry_t t = make_frame(i);
+        uint8_t frame[32];
+        size_t n = encode(&t, frame);
+        if (i % 97 == 5) {
+            frame[10] ^= 0x10;
+            want_corrupt++;
+        } else if (i % 89 == 7) {
+            n -= 6;   // The hub restarted mid-frame
+        } else {
+            expect[i] = true;
+        }
+        memcpy(stream + len, frame, n);
+        len += n;
+        if (i % 7 == 0) {
+            len += sprintf((char *)stream + len, "%s\r\n", lines[i % 4]);
+            want_lines++;
+        }
+    }
+
+    hub_rx_t rx;
+    hub_rx_init(&rx);
+    int got_lines = 0, wrong = 0;
+    uint32_t expected_frames = 0, matched = 0;
+    for (uint32_t i = 0; i < STREAM_FRAMES; i++) {
+        expected_frames += expect[i];
+    }
+
+    srand(1);
+    double t0 = now_s();
+    size_t pos = 0;
+    while (pos < len) {
+        size_t chunk = 1 + rand() % 20;   // Notification payload sizes
+        if (chunk > len - pos) chunk = len - pos;
+        for (size_t i = 0; i < chunk; i++) {
+            hub_rx_event_t ev = hub_rx_feed(&rx, stream[pos + i]);
+            if (ev == HUB_RX_FRAME) {
+                // seq wraps at 16 bits; the stream is shorter than that
+                hub_telemetry_t want = make_frame(rx.frame.seq);
+                if (rx.frame.seq < STREAM_FRAMES && expect[rx.frame.seq] && frame_equal(&rx.frame, &want)) {
+                    matched++;
+                } else {
+                    wrong++;
+                }
+            } else if (ev == HUB_RX_LINE) {
+                got_lines += rx.line[0] != '\0';
+            }
+        }
+        pos += chunk;
+    }
+    double dt = now_s() - t0;
+
+    // A truncated frame swallows the start of the next one
+    uint32_t truncated = STREAM_FRAMES / 89 + 1;
+    CHECK(wrong == 0, "%d frames decoded with wrong contents", wrong);
+    CHECK(matched + truncated >= expected_frames, "decoded %u of %u intact frames", matched, expected_frames);
+    CHECK(got_lines + (int)truncated >= want_lines, "got %d of %d text lines", got_lines, want_lines);
+    CHECK(rx.crc_errors >= (uint32_t)want_corrupt, "crc errors %u, corrupted %d", rx.crc_errors, want_corrupt);
+
+    printf("parser: %u/%u intact frames, %d/%d lines, %u crc errors, %u bad frames; %.1f MB/s\n",
+        matched, expected_frames, got_lines, want_lines, rx.crc_errors, rx.bad_frames, len / dt / 1e6);
+    free(stream);
+    free(expect);
+}
+
+static void check_bad_header(void) {
+    hub_rx_t rx;
+    hub_rx_init(&rx);
+    hub_telemetry_t t = make_frame(3);
+    uint8_t frame[32];
+    size_t n = encode(&t, frame);
+
+    frame[2] = 9;   // Unknown version with a valid CRC
+    for (size_t i = 0; i < n; i++) hub_rx_feed(&rx, frame[i]);
+    CHECK(rx.bad_frames == 1 && rx.frames == 0, "unknown version rejected");
+
+    const uint8_t bad_len[] = { 0xA5, 0x5A, 0x01, 0x00 };
+    for (size_t i = 0; i < sizeof(bad_len); i++) hub_rx_feed(&rx, bad_len[i]);
+    CHECK(rx.bad_frames == 2, "zero length rejected");
+
+    // A reconnect drops the half-received frame
+    frame[2] = HUB_TLM_VERSION;
+    for (size_t i = 0; i < n / 2; i++) hub_rx_feed(&rx, frame[i]);
+    hub_rx_resync(&rx);
+
+    int frames = 0;
+    for (size_t i = 0; i < n; i++) frames += hub_rx_feed(&rx, frame[i]) == HUB_RX_FRAME;
+    CHECK(frames == 1 && rx.frame.seq == 3, "parser resyncs after bad headers");
+}
+
+// ---------------------------------------------------------------------------
+// Concurrency: every sample is derived from one counter, so a torn copy
+// shows up as fields that disagree
+
+static hub_tlm_latest_t race_cell;
+static hub_tlm_ring_t race_ring;
+static hub_tlm_sample_t race_slots[RING_LEN];
+static volatile int race_stop;
+
+static hub_tlm_sample_t make_sample(uint32_t i) {
+    hub_tlm_sample_t s = { .rx_us = (int64_t)i + 1, .value = make_frame(i) };
+    return s;
+}
+
+static bool sample_ok(const hub_tlm_sample_t *s) {
+    hub_tlm_sample_t want = make_sample((uint32_t)(s->rx_us - 1));
+    return frame_equal(&s->value, &want.value);
+}
+
+static void *race_writer(void *arg) {
+    uint64_t *writes = arg;
+    uint32_t i = 0;
+    while (!race_stop) {
+        hub_tlm_sample_t s = make_sample(i++);
+        hub_tlm_latest_write(&race_cell, &s);
+        hub_tlm_ring_push(&race_ring, &s);
+    }
+    *writes = i;
+    return NULL;
+}
+
+typedef struct {
+    uint64_t reads;
+    uint64_t ring_reads;
+    uint64_t samples;
+    uint64_t torn;
+} race_result_t;
+
+static void *race_reader(void *arg) {
+    race_result_t *r = arg;
+    hub_tlm_sample_t out[RING_LEN];
+    int64_t last = 0;
+    while (!race_stop) {
+        hub_tlm_sample_t s;
+        if (hub_tlm_latest_read(&race_cell, &s)) {
+            r->torn += !sample_ok(&s) || s.rx_us < last;
+            last = s.rx_us;
+            r->reads++;
+        }
+        if ((r->reads & 63) == 0) {
+            uint32_t n = hub_tlm_ring_read(&race_ring, out, RING_LEN);
+            for (uint32_t j = 0; j < n; j++) {
+                r->torn += !sample_ok(&out[j]) || (j > 0 && out[j].rx_us != out[j - 1].rx_us + 1);
+            }
+            r->samples += n;
+            r->ring_reads++;
+        }
+    }
+    return NULL;
+}
+
+static void check_race(void) {
+    enum { READERS = 2 };
+    pthread_t writer, readers[READERS];
+    race_result_t results[READERS] = {0};
+    uint64_t writes = 0;
+
+    hub_tlm_ring_init(&race_ring, race_slots, RING_LEN);
+    race_stop = 0;
+    pthread_create(&writer, NULL, race_writer, &writes);
+    for (int i = 0; i < READERS; i++) {
+        pthread_create(&readers[i], NULL, race_reader, &results[i]);
+    }
+    struct timespec ts = { .tv_sec = RACE_SECONDS };
+    nanosleep(&ts, NULL);
+    race_stop = 1;
+    pthread_join(writer, NULL);
+
+    uint64_t torn = 0, reads = 0, ring_reads = 0, samples = 0;
+    for (int i = 0; i < READERS; i++) {
+        pthread_join(readers[i], NULL);
+        torn += results[i].torn;
+        reads += results[i].reads;
+        ring_reads += results[i].ring_reads;
+        samples += results[i].samples;
+    }
+    CHECK(torn == 0, "%llu torn or out-of-order samples", (unsigned long long)torn);
+    printf("race: %llu writes, %llu latest reads, %llu ring reads (avg %.0f samples), %llu torn\n",
+        (unsigned long long)writes, (unsigned long long)reads, (unsigned long long)ring_reads,
+        ring_reads ? (double)samples / ring_reads : 0.0, (unsigned long long)torn);
+}
+
+// ---------------------------------------------------------------------------
+// Uncontended timings
+
+static void bench(void) {
+    enum { N = 10000000 };
+    static hub_tlm_sample_t slots[RING_LEN];
+    hub_tlm_ring_t ring;
+    hub_tlm_latest_t cell = {0};
+    hub_tlm_ring_init(&ring, slots, RING_LEN);
+    hub_tlm_sample_t s = make_sample(1), out[RING_LEN];
+    volatile int64_t sink = 0;
+
+    double t0 = now_s();
+    for (uint32_t i = 0; i < N; i++) {
+        s.rx_us = i;
+        hub_tlm_ring_push(&ring, &s);
+    }
+    double push = (now_s() - t0) / N * 1e9;
+
+    t0 = now_s();
+    for (uint32_t i = 0; i < N; i++) {
+        s.rx_us = i;
+        hub_tlm_latest_write(&cell, &s);
+    }
+    double write = (now_s() - t0) / N * 1e9;
+
+    t0 = now_s();
+    for (uint32_t i = 0; i < N; i++) {
+        hub_tlm_latest_read(&cell, &s);
+        sink += s.rx_us;
+    }
+    double read = (now_s() - t0) / N * 1e9;
+
+    enum { R = 200000 };
+    t0 = now_s();
+    for (uint32_t i = 0; i < R; i++) {
+        sink += hub_tlm_ring_read(&ring, out, RING_LEN);
+    }
+    double ring_read = (now_s() - t0) / R * 1e9;
+
+    printf("bench: ring push %.1f ns, latest write %.1f ns, latest read %.1f ns, ring read of %d %.0f ns (%zu bytes/sample)\n",
+        push, write, read, RING_LEN, ring_read, sizeof(hub_tlm_sample_t));
+}
+
+int main(void) {
+    check_reference_frame();
+    check_bad_header();
+    check_stream();
+    check_race();
+    bench();
+    if (failures) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
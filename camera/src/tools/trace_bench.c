@@ -0,0 +1,580 @@
+// Host checks and benchmark for the execution tracer (main/trace_ring.h).
+//
+// Checks the ring on its own (wrap-around, the time filter), then races
+// writer threads that hop between the two rings against a reader that
+// keeps taking snapshots and checks every event it copies for tearing.
+// Then checks the exporter. The JSON must parse, every end must follow its
+// begin on the same thread, ends whose begin was overwritten are dropped,
+// and tasks land on the process of the core they are pinned to. Exits
+// non-zero on any failure, then prints the cost of one event for one
+// writer, one writer per ring and four writers on one ring, and the export
+// speed.
+//
+//   cc -O2 -Imain tools/trace_bench.c -o trace_bench -lpthread   (from camera/src)
+//   ./trace_bench
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "trace_ring.h"
+
+#define RING_LEN 2048
+#define RACE_WRITERS 4
+#define RACE_SECONDS 1
+#define BENCH_EVENTS 20000000u
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { failures++; printf("FAIL: " __VA_ARGS__); printf("\n"); } \
+} while (0)
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static const trace_point_t pt_work = { "work", "test", "bytes" };
+static const trace_point_t pt_send = { "send", "test", "bytes" };
+static const trace_point_t pt_mark = { "mark", "test", NULL };
+
+// ---------------------------------------------------------------------------
+// Minimal JSON checker. Records "ph" and "tid" of each traceEvents entry.
+
+typedef struct {
+    char ph;
+    int tid, pid;
+    char name[32];
+} json_event_t;
+
+typedef struct {
+    const char *p, *end;
+    bool ok;
+    int depth;
+    json_event_t *events;
+    int count, max;
+    bool in_events;
+} json_t;
+
+static void json_ws(json_t *j) {
+    while (j->p < j->end && (*j->p == ' ' || *j->p == '\n' || *j->p == '\t' || *j->p == '\r')) j->p++;
+}
+
+static bool json_string(json_t *j, char *out, size_t cap) {
+    if (j->p >= j->end || *j->p != '"') return false;
+    j->p++;
+    size_t n = 0;
+    while (j->p < j->end && *j->p != '"') {
+        if ((unsigned char)*j->p < 0x20) return false;
+        if (*j->p == '\\') {
+            j->p++;
+            if (j->p >= j->end || !strchr("\"\\/bfnrtu", *j->p)) return false;
+        }
+        if (out && n + 1 < cap) out[n++] = *j->p;
+        j->p++;
+    }
+    if (j->p >= j->end) return false;
+    j->p++;
+    if (out) out[n] = '\0';
+    return true;
+}
+
+static bool json_value(json_t *j, json_event_t *ev, const char *key);
+
+static bool json_object(json_t *j) {
+    json_event_t ev = { 0 };
+    bool is_event = j->in_events && j->depth == 2;
+    j->p++;
+    j->depth++;
+    json_ws(j);
+    if (j->p < j->end && *j->p == '}') {
+        j->p++;
+        j->depth--;
+        return true;
+    }
+    while (true) {
+        char key[32];
+        json_ws(j);
+        if (!json_string(j, key, sizeof(key))) return false;
+        json_ws(j);
+        if (j->p >= j->end || *j->p++ != ':') return false;
+        json_ws(j);
+        bool was_events = j->in_events;
+        if (j->depth == 1 && strcmp(key, "traceEvents") == 0) j->in_events = true;
+        if (!json_value(j, is_event ? &ev : NULL, key)) return false;
+        if (j->depth == 1) j->in_events = was_events;
+        json_ws(j);
+        if (j->p < j->end && *j->p == ',') { j->p++; continue; }
+        if (j->p < j->end && *j->p == '}') { j->p++; break; }
+        return false;
+    }
+    j->depth--;
+    if (is_event && j->count < j->max) {
+        j->events[j->count++] = ev;
+    }
+    return true;
+}
+
+static bool json_array(json_t *j) {
+    j->p++;
+    j->depth++;
+    json_ws(j);
+    if (j->p < j->end && *j->p == ']') {
+        j->p++;
+        j->depth--;
+        return true;
+    }
+    while (true) {
+        json_ws(j);
+        if (!json_value(j, NULL, NULL)) return false;
+        json_ws(j);
+        if (j->p < j->end && *j->p == ',') { j->p++; continue; }
+        if (j->p < j->end && *j->p == ']') { j->p++; break; }
+        return false;
+    }
+    j->depth--;
+    return true;
+}
+
+static bool json_value(json_t *j, json_event_t *ev, const char *key) {
+    if (j->p >= j->end) return false;
+    char c = *j->p;
+    if (c == '{') return json_object(j);
+    if (c == '[') return json_array(j);
+    if (c == '"') {
+        char s[32];
+        if (!json_string(j, s, sizeof(s))) return false;
+        if (ev && strcmp(key, "ph") == 0) ev->ph = s[0];
+        if (ev && strcmp(key, "name") == 0) snprintf(ev->name, sizeof(ev->name), "%s", s);
+        return true;
+    }
+    if (c == '-' || (c >= '0' && c <= '9')) {
+        char *e;
+        long v = strtol(j->p, &e, 10);
+        if (e == j->p) return false;
+        j->p = e;
+        if (ev && strcmp(key, "tid") == 0) ev->tid = (int)v;
+        if (ev && strcmp(key, "pid") == 0) ev->pid = (int)v;
+        return true;
+    }
+    for (const char *lit = (c == 't' ? "true" : c == 'f' ? "false" : "null"); *lit; lit++) {
+        if (j->p >= j->end || *j->p++ != *lit) return false;
+    }
+    return true;
+}
+
+// Parse `text`; fills `events` with the traceEvents entries
+static int json_check(const char *text, size_t len, json_event_t *events, int max) {
+    json_t j = { .p = text, .end = text + len, .events = events, .max = max };
+    json_ws(&j);
+    if (j.p >= j.end || *j.p != '{' || !json_object(&j)) return -1;
+    json_ws(&j);
+    return j.p == j.end ? j.count : -1;
+}
+
+// ---------------------------------------------------------------------------
+// Export into memory
+
+typedef struct {
+    char *buf;
+    size_t len, cap;
+    int writes, fail_after;
+} mem_out_t;
+
+static bool mem_write(void *arg, const char *data, size_t len) {
+    mem_out_t *m = arg;
+    if (m->fail_after && ++m->writes > m->fail_after) return false;
+    if (m->len + len > m->cap) {
+        m->cap = (m->len + len) * 2;
+        m->buf = realloc(m->buf, m->cap);
+    }
+    memcpy(m->buf + m->len, data, len);
+    m->len += len;
+    return true;
+}
+
+static trace_out_t out;
+
+static bool export_mem(trace_event_t *ev, uint32_t n, const trace_task_t *tasks, int task_count,
+                       const trace_snapshot_info_t *info, mem_out_t *m) {
+    trace_sort(ev, n);
+    trace_out_init(&out, mem_write, m);
+    return trace_export(&out, ev, n, tasks, task_count, 2, info, 123);
+}
+
+// Every E follows a B on the same thread; returns the open begins left
+static int check_nesting(const json_event_t *ev, int n, int *ends) {
+    int depth[TRACE_MAX_TASKS + 1] = { 0 }, open = 0;
+    *ends = 0;
+    for (int i = 0; i < n; i++) {
+        if (ev[i].ph != 'B' && ev[i].ph != 'E') continue;
+        int t = ev[i].tid;
+        CHECK(t >= 1 && t <= TRACE_MAX_TASKS, "tid %d out of range", t);
+        if (t < 1 || t > TRACE_MAX_TASKS) continue;
+        if (ev[i].ph == 'B') {
+            depth[t]++;
+        } else {
+            CHECK(depth[t] > 0, "end without a begin on tid %d (event %d)", t, i);
+            depth[t]--;
+            (*ends)++;
+        }
+    }
+    for (int t = 0; t <= TRACE_MAX_TASKS; t++) open += depth[t];
+    return open;
+}
+
+// ---------------------------------------------------------------------------
+
+static void test_ring(void) {
+    static trace_event_t ev[8], snap[16];
+    trace_ring_t r;
+    CHECK(!trace_ring_init(&r, ev, 6), "ring of 6 accepted");
+    CHECK(trace_ring_init(&r, ev, 8), "ring of 8 refused");
+
+    int task = 0;
+    for (uint32_t i = 0; i < 5; i++) {
+        trace_ring_put(&r, 100 + i, TRACE_PH_INSTANT, &pt_mark, &task, i);
+    }
+    trace_snapshot_info_t info;
+    uint32_t n = trace_snapshot(&r, 1, 0, snap, 16, &info);
+    CHECK(n == 5 && info.overwritten == 0 && info.skipped == 0, "5 events: got %u", n);
+    for (uint32_t i = 0; i < n; i++) {
+        CHECK(snap[i].arg == i && snap[i].ts_us == 100 + i, "event %u out of order", i);
+    }
+
+    for (uint32_t i = 5; i < 15; i++) {
+        trace_ring_put(&r, 100 + i, TRACE_PH_INSTANT, &pt_mark, &task, i);
+    }
+    n = trace_snapshot(&r, 1, 0, snap, 16, &info);
+    CHECK(n == 8 && info.overwritten == 7, "after a lap: %u events, %u overwritten", n, info.overwritten);
+    CHECK(snap[0].arg == 7 && snap[7].arg == 14, "after a lap: kept %u..%u, want 7..14", snap[0].arg, snap[7].arg);
+    CHECK(info.first_us == 107 && info.last_us == 114, "span %llu..%llu",
+        (unsigned long long)info.first_us, (unsigned long long)info.last_us);
+
+    n = trace_snapshot(&r, 1, 112, snap, 16, &info);
+    CHECK(n == 3 && snap[0].arg == 12, "since filter: %u events from %u", n, n ? snap[0].arg : 0);
+
+    n = trace_snapshot(&r, 1, 0, snap, 4, &info);
+    CHECK(n == 4 && snap[0].arg == 7, "room for 4: %u events", n);
+
+    // Head wrap-around at 2^32: for a lap, only the events since the wrap
+    r.head = UINT32_MAX - 3;
+    for (uint32_t i = 0; i < 8; i++) {
+        trace_ring_put(&r, 200 + i, TRACE_PH_INSTANT, &pt_mark, &task, i);
+    }
+    n = trace_snapshot(&r, 1, 0, snap, 16, &info);
+    CHECK(n == 4 && info.skipped == 0 && snap[0].arg == 4 && snap[3].arg == 7,
+        "across the 2^32 wrap: %u events, %u skipped", n, info.skipped);
+    for (uint32_t i = 8; i < 12; i++) {
+        trace_ring_put(&r, 200 + i, TRACE_PH_INSTANT, &pt_mark, &task, i);
+    }
+    n = trace_snapshot(&r, 1, 0, snap, 16, &info);
+    CHECK(n == 8 && snap[0].arg == 4 && snap[7].arg == 11, "a lap after the wrap: %u events", n);
+}
+
+// ---------------------------------------------------------------------------
+// Race: writers hop between two rings, as tasks moving cores would
+
+static trace_ring_t race_rings[2];
+static trace_event_t race_ev[2][1024];
+static volatile int race_stop;
+static int race_ids[RACE_WRITERS];
+static uint64_t race_written[RACE_WRITERS];
+
+static uint32_t race_check(int writer, uint64_t k) {
+    uint64_t x = (k + 1) * 0x9E3779B97F4A7C15ull ^ (uint64_t)writer * 0xC2B2AE3D27D4EB4Full;
+    return (uint32_t)(x >> 32);
+}
+
+static void *race_writer(void *arg) {
+    int w = *(int *)arg;
+    uint64_t k = 0;
+    while (!race_stop) {
+        trace_ring_t *r = &race_rings[((k >> 5) + w) & 1];
+        trace_ring_put(r, k, (k & 1) ? TRACE_PH_END : TRACE_PH_BEGIN, w & 1 ? &pt_send : &pt_work,
+            &race_ids[w], race_check(w, k));
+        k++;
+    }
+    race_written[w] = k;
+    return NULL;
+}
+
+static void test_race(void) {
+    static trace_event_t snap[2048];
+    for (int c = 0; c < 2; c++) {
+        trace_ring_init(&race_rings[c], race_ev[c], 1024);
+    }
+    pthread_t th[RACE_WRITERS];
+    race_stop = 0;
+    for (int w = 0; w < RACE_WRITERS; w++) {
+        race_ids[w] = w;
+        pthread_create(&th[w], NULL, race_writer, &race_ids[w]);
+    }
+
+    uint64_t snapshots = 0, checked = 0, skipped = 0;
+    int torn = 0, disorder = 0;
+    double end = now_s() + RACE_SECONDS;
+    while (now_s() < end) {
+        trace_snapshot_info_t info;
+        uint32_t n = trace_snapshot(race_rings, 2, 0, snap, 2048, &info);
+        // Per writer and ring, reservation order is the writer's own order
+        uint64_t last[2][RACE_WRITERS];
+        memset(last, 0xff, sizeof(last));
+        for (uint32_t i = 0; i < n; i++) {
+            const trace_event_t *e = &snap[i];
+            int w = *(const int *)e->task;
+            bool ok = w >= 0 && w < RACE_WRITERS && e->arg == race_check(w, e->ts_us)
+                && e->point == (w & 1 ? &pt_send : &pt_work)
+                && e->phase == ((e->ts_us & 1) ? TRACE_PH_END : TRACE_PH_BEGIN);
+            torn += !ok;
+            if (ok) {
+                if (last[e->core][w] != UINT64_MAX && e->ts_us <= last[e->core][w]) {
+                    disorder++;
+                }
+                last[e->core][w] = e->ts_us;
+            }
+        }
+        snapshots++;
+        checked += n;
+        skipped += info.skipped;
+    }
+    race_stop = 1;
+    uint64_t written = 0;
+    for (int w = 0; w < RACE_WRITERS; w++) {
+        pthread_join(th[w], NULL);
+        written += race_written[w];
+    }
+    uint64_t heads = (uint64_t)race_rings[0].head + race_rings[1].head;
+    CHECK(torn == 0, "%d torn events", torn);
+    CHECK(disorder == 0, "%d events out of writer order", disorder);
+    CHECK(heads == written, "heads %llu, events written %llu", (unsigned long long)heads, (unsigned long long)written);
+    CHECK(checked > 0, "reader copied nothing");
+    printf("race: %d writers, %.1f M events, %llu snapshots, %.1f M events checked, %.3f%% skipped\n",
+        RACE_WRITERS, written / 1e6, (unsigned long long)snapshots, checked / 1e6,
+        checked + skipped ? 100.0 * skipped / (checked + skipped) : 0.0);
+}
+
+// ---------------------------------------------------------------------------
+
+static void test_export(void) {
+    static trace_event_t ring_ev[2][16], snap[32];
+    static json_event_t parsed[256];
+    trace_ring_t rings[2];
+    trace_ring_init(&rings[0], ring_ev[0], 16);
+    trace_ring_init(&rings[1], ring_ev[1], 16);
+
+    int a = 0, b = 0, c = 0;
+    trace_task_t tasks[] = {
+        { .task = &a, .name = "stream", .core = 1, .priority = 5 },
+        { .task = &b, .name = "bad\"name\\", .core = -1, .priority = 3 },
+    };
+    // a on core 1: nested work/send
+    trace_ring_put(&rings[1], 10, TRACE_PH_BEGIN, &pt_work, &a, 1000);
+    trace_ring_put(&rings[1], 11, TRACE_PH_BEGIN, &pt_send, &a, 0);
+    trace_ring_put(&rings[1], 15, TRACE_PH_END, &pt_send, &a, 900);
+    trace_ring_put(&rings[1], 15, TRACE_PH_END, &pt_work, &a, 1000);
+    // b moves cores mid-slice; its first event is an end whose begin is gone
+    trace_ring_put(&rings[0], 5, TRACE_PH_END, &pt_work, &b, 0);
+    trace_ring_put(&rings[0], 12, TRACE_PH_BEGIN, &pt_work, &b, 7);
+    trace_ring_put(&rings[1], 13, TRACE_PH_INSTANT, &pt_mark, &b, 0);
+    trace_ring_put(&rings[1], 14, TRACE_PH_END, &pt_work, &b, 7);
+    // c is not in the task table, and its slice is still open
+    trace_ring_put(&rings[0], 20, TRACE_PH_BEGIN, &pt_send, &c, 1);
+
+    trace_snapshot_info_t info;
+    uint32_t n = trace_snapshot(rings, 2, 0, snap, 32, &info);
+    CHECK(n == 9, "export snapshot: %u events", n);
+    mem_out_t m = { 0 };
+    CHECK(export_mem(snap, n, tasks, 2, &info, &m), "export failed");
+    int count = json_check(m.buf, m.len, parsed, 256);
+    CHECK(count > 0, "export is not valid JSON:\n%.*s", (int)m.len, m.buf);
+
+    int ends, open = check_nesting(parsed, count, &ends);
+    CHECK(open == 1 && ends == 3, "small export: %d open, %d ends (want 1, 3)", open, ends);
+    int meta = 0, stream_pid = -1, bad_pid = -1, unknown_pid = -1;
+    for (int i = 0; i < count; i++) {
+        meta += parsed[i].ph == 'M';
+    }
+    CHECK(strstr(m.buf, "\"args\":{\"name\":\"stream\"}") != NULL, "stream task not named");
+    CHECK(strstr(m.buf, "\"args\":{\"name\":\"bad_name_\"}") != NULL, "quote in a task name not replaced");
+    CHECK(strstr(m.buf, "\"args\":{\"name\":\"task 3\"}") != NULL, "unknown task not named task 3");
+    CHECK(strstr(m.buf, "\"ph\":\"i\",\"s\":\"t\"") != NULL, "instant without thread scope");
+    CHECK(strstr(m.buf, "\"event_ns\":123") != NULL, "event_ns missing");
+    // Threads are numbered in time order: b (its dropped end), a, c
+    for (int i = 0; i < count; i++) {
+        if (parsed[i].ph == 'B' && strcmp(parsed[i].name, "work") == 0 && parsed[i].tid == 2) stream_pid = parsed[i].pid;
+        if (parsed[i].ph == 'B' && strcmp(parsed[i].name, "work") == 0 && parsed[i].tid == 1) bad_pid = parsed[i].pid;
+        if (parsed[i].ph == 'B' && strcmp(parsed[i].name, "send") == 0 && parsed[i].tid == 3) unknown_pid = parsed[i].pid;
+    }
+    CHECK(stream_pid == 1 && bad_pid == 2 && unknown_pid == 2, "pids: pinned %d, unpinned %d, unknown %d (want 1, 2, 2)",
+        stream_pid, bad_pid, unknown_pid);
+    CHECK(meta == 6 + 6, "%d metadata events (want 6 process + 6 thread)", meta);
+
+    // A writer that fails stops the export
+    mem_out_t failing = { .fail_after = 1 };
+    static trace_event_t many[4096];
+    for (uint32_t i = 0; i < 4096; i++) {
+        many[i] = (trace_event_t){ .seq = i + 1, .ts_us = i, .point = &pt_mark, .task = &a, .phase = TRACE_PH_INSTANT };
+    }
+    trace_snapshot_info_t many_info = { .events = 4096, .last_us = 4095 };
+    CHECK(!export_mem(many, 4096, tasks, 2, &many_info, &failing), "failed write did not stop the export");
+    CHECK(failing.writes == 2, "export kept writing after a failure (%d writes)", failing.writes);
+    free(m.buf);
+    free(failing.buf);
+}
+
+// Random nested slices over two small rings that lap many times
+static void test_export_lapped(void) {
+    static trace_event_t ring_ev[2][256], snap[512];
+    static json_event_t parsed[4096];
+    trace_ring_t rings[2];
+    trace_ring_init(&rings[0], ring_ev[0], 256);
+    trace_ring_init(&rings[1], ring_ev[1], 256);
+    int task_ids[6];
+    int depth[6] = { 0 };
+    trace_task_t tasks[6];
+    for (int t = 0; t < 6; t++) {
+        tasks[t] = (trace_task_t){ .task = &task_ids[t], .core = t % 3 == 2 ? -1 : t % 3, .priority = t };
+        snprintf(tasks[t].name, sizeof(tasks[t].name), "task%d", t);
+    }
+    srand(7);
+    uint64_t ts = 0;
+    for (int i = 0; i < 20000; i++) {
+        int t = rand() % 6;
+        int core = tasks[t].core >= 0 ? tasks[t].core : rand() % 2;
+        ts += rand() % 3;
+        int op = rand() % 5;
+        if (op < 2 && depth[t] < 4) {
+            trace_ring_put(&rings[core], ts, TRACE_PH_BEGIN, &pt_work, &task_ids[t], i);
+            depth[t]++;
+        } else if (op < 4 && depth[t] > 0) {
+            trace_ring_put(&rings[core], ts, TRACE_PH_END, &pt_work, &task_ids[t], i);
+            depth[t]--;
+        } else {
+            trace_ring_put(&rings[core], ts, TRACE_PH_INSTANT, &pt_mark, &task_ids[t], i);
+        }
+    }
+    trace_snapshot_info_t info;
+    uint32_t n = trace_snapshot(rings, 2, 0, snap, 512, &info);
+    mem_out_t m = { 0 };
+    CHECK(export_mem(snap, n, tasks, 6, &info, &m), "lapped export failed");
+    int count = json_check(m.buf, m.len, parsed, 4096);
+    CHECK(count > 0, "lapped export is not valid JSON");
+    int ends;
+    check_nesting(parsed, count, &ends);
+    CHECK(info.overwritten == 20000 - 512, "lapped: %u overwritten", info.overwritten);
+    free(m.buf);
+}
+
+// ---------------------------------------------------------------------------
+// Overhead
+
+// Heads on their own cache lines, as on separate cores
+typedef struct {
+    trace_ring_t r;
+} __attribute__((aligned(64))) bench_ring_t;
+
+static bench_ring_t bench_rings[4];
+static trace_event_t bench_ev[4][RING_LEN];
+
+typedef struct {
+    trace_ring_t *ring;
+    int id;
+    bool clock;
+    double ns;
+} bench_arg_t;
+
+static void *bench_writer(void *p) {
+    bench_arg_t *a = p;
+    double start = now_s();
+    if (a->clock) {
+        for (uint32_t i = 0; i < BENCH_EVENTS; i++) {
+            trace_ring_put(a->ring, now_us(), TRACE_PH_INSTANT, &pt_mark, &a->id, i);
+        }
+    } else {
+        for (uint32_t i = 0; i < BENCH_EVENTS; i++) {
+            trace_ring_put(a->ring, i, TRACE_PH_INSTANT, &pt_mark, &a->id, i);
+        }
+    }
+    a->ns = (now_s() - start) * 1e9 / BENCH_EVENTS;
+    return NULL;
+}
+
+static double bench(int writers, bool shared, bool clock) {
+    pthread_t th[4];
+    bench_arg_t args[4];
+    for (int r = 0; r < 4; r++) {
+        trace_ring_init(&bench_rings[r].r, bench_ev[r], RING_LEN);
+    }
+    for (int w = 0; w < writers; w++) {
+        args[w] = (bench_arg_t){ .ring = &bench_rings[shared ? 0 : w].r, .id = w, .clock = clock };
+        pthread_create(&th[w], NULL, bench_writer, &args[w]);
+    }
+    double worst = 0;
+    for (int w = 0; w < writers; w++) {
+        pthread_join(th[w], NULL);
+        worst = args[w].ns > worst ? args[w].ns : worst;
+    }
+    return worst;
+}
+
+static void bench_export(void) {
+    static trace_event_t snap[2 * RING_LEN];
+    int ids[8];
+    trace_task_t tasks[8];
+    for (int t = 0; t < 8; t++) {
+        tasks[t] = (trace_task_t){ .task = &ids[t], .core = t % 3 - 1, .priority = t };
+        snprintf(tasks[t].name, sizeof(tasks[t].name), "task%d", t);
+    }
+    for (int c = 0; c < 2; c++) {
+        trace_ring_init(&bench_rings[c].r, bench_ev[c], RING_LEN);
+        for (uint32_t i = 0; i < 3 * RING_LEN; i++) {
+            int t = (i / 2) % 4 + 4 * c;
+            trace_ring_put(&bench_rings[c].r, i * 10 + c, i & 1 ? TRACE_PH_END : TRACE_PH_BEGIN, &pt_send, &ids[t], i);
+        }
+    }
+    int reps = 50;
+    size_t bytes = 0;
+    double start = now_s();
+    for (int i = 0; i < reps; i++) {
+        trace_snapshot_info_t info;
+        trace_ring_t rings[2] = { bench_rings[0].r, bench_rings[1].r };
+        uint32_t n = trace_snapshot(rings, 2, 0, snap, 2 * RING_LEN, &info);
+        mem_out_t m = { 0 };
+        export_mem(snap, n, tasks, 8, &info, &m);
+        bytes = m.len;
+        free(m.buf);
+    }
+    double per = (now_s() - start) / reps;
+    printf("export: %d events in %.2f ms (snapshot, sort, JSON), %zu bytes, %.0f bytes/event\n",
+        2 * RING_LEN, per * 1e3, bytes, (double)bytes / (2 * RING_LEN));
+}
+
+int main(void) {
+    test_ring();
+    test_race();
+    test_export();
+    test_export_lapped();
+    if (failures) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n\n");
+
+    printf("event cost (ns, slowest writer):\n");
+    printf("  1 writer                      %6.1f   with clock read %6.1f\n", bench(1, false, false), bench(1, false, true));
+    printf("  2 writers, own ring each      %6.1f   with clock read %6.1f\n", bench(2, false, false), bench(2, false, true));
+    printf("  4 writers on one ring         %6.1f   with clock read %6.1f\n", bench(4, true, false), bench(4, true, true));
+    bench_export();
+    return 0;
+}
@@ -0,0 +1,385 @@
+// Host simulation of the hub connection table (main/train_hub_table.h).
+//
+// Each scenario is a script of GAP/GATT events from several hubs, fed to
+// the table the way train_ble.h does: advertisements go through
+// train_hub_match() and start a connection into the slot it picks, connect
+// and disconnect events carry connection handles, and init work captures
+// the connection generation when it starts and hands it back when it ends.
+// The tool checks:
+//
+//   - slot matching by name and address, with and without a hub list:
+//     the slot picked for each advertiser, none while an attempt is in
+//     flight or for a hub that is already connected
+//   - that the generation goes up by one on every connect and disconnect,
+//     and never otherwise
+//   - that init work begun on an earlier connection is discarded, whether
+//     the hub is gone, reconnecting or initializing again
+//   - after every event: one attempt in flight at most, no two live slots on
+//     one address or connection handle, free slots without a handle, and
+//     live slots matching their list entry
+//
+// Also checks the hub list and address parsing.
+//
+//   cc -O2 -Imain tools/train_hub_table_sim.c -o train_hub_table_sim   (from camera/src)
+//   ./train_hub_table_sim        # add -v for every event
+//
+// Script: "<event>; ..." with event one of
+//
+//   adv <name|-> <addr> [svc]    advertisement, "-" without a name
+//   ok <handle> | fail           outcome of the attempt in flight
+//   drop <handle>                disconnect
+//   init <slot>                  init work starts: token k, counting from 1
+//   alive <k> | done <k>         init work k polls, or finishes
+//
+// Each event logs its outcome, "adv 0; ok 0; init 1; done ready; ...",
+// which must match the expected log. Exits non-zero if a check fails.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "train_hub_table.h"
+
+#define MAX_INITS 16
+
+typedef struct {
+    const char *name;
+    const char *hubs;           // CONFIG_TRAIN_BLE_HUBS
+    int max_hubs;               // CONFIG_TRAIN_BLE_MAX_HUBS
+    const char *script;
+    const char *expect;
+    const char *states;         // Final display state per slot
+} scenario_t;
+
+#define A "90:84:2b:01:02:03"
+#define B "90:84:2b:0a:0b:0c"
+#define C "a4:c1:38:00:00:01"
+#define D "a4:c1:38:00:00:02"
+
+static const scenario_t scenarios[] = {
+    // Any Pybricks hub takes the first free slot, one attempt at a time
+    { "any hub", "", 2,
+      "adv Pybricks_Hub " A "; adv Pybricks_Hub " B "; ok 1; adv Pybricks_Hub " A "; adv Speaker " C "; "
+      "adv - " C " svc; ok 2; adv City_Hub " D,
+      "adv 0; adv -; ok 0; adv -; adv -; adv 1; ok 1; adv -",
+      "discovering discovering" },
+    // The list pins entry N to slot N, by exact name or by address
+    { "by name and address", "City_Hub, " A, 3,
+      "adv Pybricks_Hub " A "; ok 1; adv City_Hubx " B "; adv city_hub " B "; adv City_Hub " B "; "
+      "ok 2; adv - " A "; adv City_Hub " C,
+      "adv 1; ok 1; adv -; adv -; adv 0; ok 0; adv -; adv -",
+      "discovering discovering" },
+    // A listed address wins over a listed name for the same advertiser
+    { "address before name", A ",Pybricks_Hub", 2,
+      "adv Pybricks_Hub " A "; ok 1; adv Pybricks_Hub " B "; ok 2; init 0; init 1; done 1; done 2",
+      "adv 0; ok 0; adv 1; ok 1; init 1; init 2; done ready; done ready",
+      "ready ready" },
+    // Init work from the first link finds its hub gone
+    { "drop during init", "", 1,
+      "adv Pybricks_Hub " A "; ok 1; init 0; drop 1; alive 1; done 1",
+      "adv 0; ok 0; init 1; drop 0; alive no; done stale",
+      "disconnected" },
+    // ... or back and still discovering on a new link
+    { "reconnect before init", "", 1,
+      "adv Pybricks_Hub " A "; ok 1; init 0; drop 1; adv Pybricks_Hub " A "; ok 7; done 1",
+      "adv 0; ok 0; init 1; drop 0; adv 0; ok 0; done stale",
+      "discovering" },
+    // ... or initializing again: only the new work may mark it ready
+    { "reinit race", "", 1,
+      "adv Pybricks_Hub " A "; ok 1; init 0; drop 1; adv Pybricks_Hub " A "; ok 2; init 0; "
+      "alive 1; alive 2; done 1; done 2",
+      "adv 0; ok 0; init 1; drop 0; adv 0; ok 0; init 2; alive no; alive yes; done stale; done ready",
+      "ready" },
+    // Two hubs: a drop on one leaves the other's init work alone
+    { "independent slots", "", 2,
+      "adv Pybricks_Hub " A "; ok 1; adv Pybricks_Hub " B "; ok 2; init 0; init 1; drop 1; done 2; done 1",
+      "adv 0; ok 0; adv 1; ok 1; init 1; init 2; drop 0; done ready; done stale",
+      "disconnected ready" },
+    // A failed attempt frees the slot without a new generation
+    { "failed connect", "", 1,
+      "adv Pybricks_Hub " A "; fail; adv Pybricks_Hub " A "; ok 3; init 0; done 1",
+      "adv 0; fail 0; adv 0; ok 0; init 1; done ready",
+      "ready" },
+    // Outcomes nobody waits for change nothing
+    { "stray events", "", 2,
+      "ok 1; fail; drop 5; adv Pybricks_Hub " A "; ok 1; drop 9; init 0; done 1",
+      "ok -; fail -; drop -; adv 0; ok 0; drop -; init 1; done ready",
+      "ready disconnected" },
+    // Without a list a slot forgets its hub on a drop; with one it keeps the entry
+    { "slot reuse", "", 1,
+      "adv Pybricks_Hub " A "; ok 1; drop 1; adv City_Hub " B "; ok 2",
+      "adv 0; ok 0; drop 0; adv 0; ok 0",
+      "discovering" },
+    { "listed slot reuse", "City_Hub", 1,
+      "adv City_Hub " A "; ok 1; drop 1; adv City_Hub " B "; ok 2",
+      "adv 0; ok 0; drop 0; adv 0; ok 0",
+      "discovering" },
+};
+
+typedef struct {
+    int slot;
+    uint32_t generation;
+} init_work_t;
+
+static int failures = 0;
+
+static void fail(const char *scenario, const char *what) {
+    fprintf(stderr, "FAIL: %s: %s\n", scenario, what);
+    failures++;
+}
+
+static void log_event(char *buf, size_t cap, const char *event, const char *result) {
+    size_t len = strlen(buf);
+    snprintf(buf + len, cap - len, "%s%s %s", len ? "; " : "", event, result);
+}
+
+// Invariants that hold after every event
+static void check_table(const scenario_t *sc, const train_hub_table_t *t) {
+    int connecting = 0;
+    for (int i = 0; i < t->count; i++) {
+        const train_hub_t *hub = &t->hubs[i];
+        bool free_slot = train_hub_is_free(hub);
+        if (hub->state == TRAIN_BLE_CONNECTING) {
+            connecting++;
+            if (t->connecting != i) {
+                fail(sc->name, "connecting slot is not the attempt in flight");
+            }
+        }
+        if (free_slot && hub->conn_handle != TRAIN_HUB_CONN_NONE) {
+            fail(sc->name, "free slot keeps a connection handle");
+        }
+        if (!free_slot && hub->state != TRAIN_BLE_CONNECTING && hub->conn_handle == TRAIN_HUB_CONN_NONE) {
+            fail(sc->name, "connected slot without a handle");
+        }
+        if (!free_slot && t->filter_count > 0) {
+            const train_hub_filter_t *f = &t->filters[i];
+            if (f->by_addr ? memcmp(f->addr, hub->addr, 6) != 0 : strcmp(f->name, hub->name) != 0) {
+                fail(sc->name, "slot holds a hub its list entry does not name");
+            }
+        }
+        for (int j = i + 1; j < t->count && !free_slot; j++) {
+            const train_hub_t *other = &t->hubs[j];
+            if (train_hub_is_free(other)) {
+                continue;
+            }
+            if (memcmp(hub->addr, other->addr, 6) == 0) {
+                fail(sc->name, "two slots on one address");
+            }
+            if (hub->state != TRAIN_BLE_CONNECTING && other->state != TRAIN_BLE_CONNECTING &&
+                hub->conn_handle == other->conn_handle) {
+                fail(sc->name, "two slots on one connection handle");
+            }
+        }
+    }
+    int free_slots = 0, ready = 0;
+    train_ble_state_t most = TRAIN_BLE_DISCONNECTED;
+    for (int i = 0; i < t->count; i++) {
+        free_slots += train_hub_is_free(&t->hubs[i]);
+        ready += t->hubs[i].state == TRAIN_BLE_READY;
+        most = t->hubs[i].state > most ? t->hubs[i].state : most;
+    }
+    if (train_hub_free_slots(t) != free_slots || train_hub_ready_count(t) != ready ||
+        train_hub_summary_state(t) != most) {
+        fail(sc->name, "free, ready or summary counts wrong");
+    }
+    if (connecting > 1 || (t->connecting >= 0 && connecting == 0)) {
+        fail(sc->name, "more than one attempt in flight, or a lost one");
+    }
+}
+
+static uint32_t generations(const train_hub_table_t *t) {
+    uint32_t n = 0;
+    for (int i = 0; i < t->count; i++) {
+        n += t->hubs[i].generation;
+    }
+    return n;
+}
+
+static void run(const scenario_t *sc, bool verbose) {
+    // Names in scripts use '_' for spaces
+    char spec[128];
+    snprintf(spec, sizeof(spec), "%s", sc->hubs);
+    for (char *p = spec; *p; p++) {
+        *p = *p == '_' ? ' ' : *p;
+    }
+    train_hub_table_t t;
+    train_hub_table_init(&t, spec, sc->max_hubs, 0);
+
+    init_work_t inits[MAX_INITS];
+    int init_count = 0;
+    char got[1024] = "";
+    int events = 0;
+    int64_t now = 0;
+    const char *s = sc->script;
+    while (*s) {
+        char line[96];
+        size_t n = strcspn(s, ";");
+        snprintf(line, sizeof(line), "%.*s", (int)n, s);
+        s += n;
+        s += strspn(s, "; ");
+        now += 100000;
+        events++;
+
+        char event[8] = "", a[32] = "", b[32] = "", c[8] = "";
+        int fields = sscanf(line, " %7s %31s %31s %7s", event, a, b, c);
+        uint32_t before[TRAIN_HUB_MAX];
+        for (int i = 0; i < t.count; i++) {
+            before[i] = t.hubs[i].generation;
+        }
+        int slot = -1;
+        char result[16];
+        if (!strcmp(event, "adv") && fields >= 3) {
+            uint8_t addr[6];
+            if (!train_hub_parse_addr(b, addr)) {
+                fail(sc->name, "bad address in script");
+                return;
+            }
+            for (char *p = a; *p; p++) {
+                *p = *p == '_' ? ' ' : *p;
+            }
+            const char *name = strcmp(a, "-") ? a : NULL;
+            slot = train_hub_match(&t, name, addr, fields == 4 && !strcmp(c, "svc"));
+            if (slot >= 0) {
+                train_hub_connect_started(&t, slot, name, addr, now);
+            }
+        } else if (!strcmp(event, "ok") && fields == 2) {
+            slot = train_hub_connect_done(&t, true, (uint16_t)atoi(a), now);
+        } else if (!strcmp(event, "fail")) {
+            slot = train_hub_connect_done(&t, false, TRAIN_HUB_CONN_NONE, now);
+        } else if (!strcmp(event, "drop") && fields == 2) {
+            slot = train_hub_disconnected(&t, (uint16_t)atoi(a), now);
+        } else if (!strcmp(event, "init") && fields == 2 && init_count < MAX_INITS) {
+            // train_hub_begin_init(), then the hub task picks up the start
+            slot = atoi(a);
+            train_hub_set_state(&t, slot, TRAIN_BLE_INITIALIZING, now);
+            inits[init_count++] = (init_work_t){ slot, t.hubs[slot].generation };
+            snprintf(result, sizeof(result), "%d", init_count);
+        } else if ((!strcmp(event, "alive") || !strcmp(event, "done")) && fields == 2 &&
+                   atoi(a) >= 1 && atoi(a) <= init_count) {
+            init_work_t *w = &inits[atoi(a) - 1];
+            if (!strcmp(event, "alive")) {
+                snprintf(result, sizeof(result), "%s",
+                    train_hub_init_current(&t, w->slot, w->generation) ? "yes" : "no");
+            } else {
+                train_ble_state_t was = t.hubs[w->slot].state;
+                bool ok = train_hub_init_done(&t, w->slot, w->generation, now);
+                snprintf(result, sizeof(result), "%s", ok ? "ready" : "stale");
+                if (!ok && t.hubs[w->slot].state != was) {
+                    fail(sc->name, "stale init work changed the hub state");
+                }
+            }
+        } else {
+            fail(sc->name, "bad event in script");
+            return;
+        }
+        if (strcmp(event, "init") && strcmp(event, "alive") && strcmp(event, "done")) {
+            if (slot >= 0) {
+                snprintf(result, sizeof(result), "%d", slot);
+            } else {
+                snprintf(result, sizeof(result), "-");
+            }
+        }
+        log_event(got, sizeof(got), event, result);
+
+        // The generation moves on every connect and disconnect, by one, and only then
+        bool link_changed = slot >= 0 && (!strcmp(event, "ok") || !strcmp(event, "drop"));
+        for (int i = 0; i < t.count; i++) {
+            uint32_t expected = before[i] + (link_changed && i == slot ? 1 : 0);
+            if (t.hubs[i].generation != expected) {
+                fail(sc->name, "generation did not move by one on a link change, or moved otherwise");
+            }
+        }
+        check_table(sc, &t);
+
+        if (verbose) {
+            printf("  %-34s -> %-6s", line, result);
+            for (int i = 0; i < t.count; i++) {
+                printf(" [%d %s g%lu]", i, train_hub_state_str(t.hubs[i].state),
+                    (unsigned long)t.hubs[i].generation);
+            }
+            printf("\n");
+        }
+    }
+
+    if (strcmp(got, sc->expect) != 0) {
+        char what[2200];
+        snprintf(what, sizeof(what), "log \"%s\", expected \"%s\"", got, sc->expect);
+        fail(sc->name, what);
+    }
+    char states[128] = "";
+    for (int i = 0; i < t.count; i++) {
+        size_t len = strlen(states);
+        snprintf(states + len, sizeof(states) - len, "%s%s", i ? " " : "",
+            train_hub_state_str(train_hub_display_state(&t, i)));
+    }
+    if (strcmp(states, sc->states) != 0) {
+        char what[300];
+        snprintf(what, sizeof(what), "final states \"%s\", expected \"%s\"", states, sc->states);
+        fail(sc->name, what);
+    }
+    printf("%-22s %d slot(s) %3d events, %lu generations\n", sc->name, t.count, events,
+        (unsigned long)generations(&t));
+}
+
+static void check_parsing(void) {
+    train_hub_table_t t;
+    const char *sc = "hub list";
+    if (train_hub_table_init(&t, "  City Hub , ,90:84:2B:01:02:03,Technic Hub", 4, 0) != 3 ||
+        strcmp(t.filters[0].name, "City Hub") || !t.filters[1].by_addr || t.filters[1].name[0] ||
+        t.filters[1].addr[0] != 0x03 || t.filters[1].addr[5] != 0x90 || strcmp(t.filters[2].name, "Technic Hub") ||
+        strcmp(t.hubs[0].name, "City Hub") || !t.hubs[1].have_addr || t.hubs[0].have_addr) {
+        fail(sc, "list entries not trimmed, skipped or parsed");
+    }
+    if (train_hub_table_init(&t, "a,b,c,d,e,f", 9, 0) != TRAIN_HUB_MAX ||
+        train_hub_table_init(&t, "", 9, 0) != TRAIN_HUB_MAX || train_hub_table_init(&t, "a,b,c", 2, 0) != 2 ||
+        train_hub_table_init(&t, NULL, 1, 0) != 1) {
+        fail(sc, "slot count not limited to the list or TRAIN_HUB_MAX");
+    }
+    train_hub_table_init(&t, "A hub name well over the twenty-four bytes", 1, 0);
+    if (strlen(t.filters[0].name) != TRAIN_HUB_NAME_LEN - 1) {
+        fail(sc, "long name not truncated");
+    }
+    for (int i = 0; i < t.count; i++) {
+        if (t.hubs[i].state != TRAIN_BLE_DISCONNECTED || t.hubs[i].conn_handle != TRAIN_HUB_CONN_NONE ||
+            t.connecting != -1) {
+            fail(sc, "slots not reset");
+        }
+    }
+
+    uint8_t addr[6];
+    char text[18];
+    const char *good[] = { "90:84:2b:01:02:03", "00:00:00:00:00:00", "ff:ff:ff:ff:ff:ff" };
+    for (size_t i = 0; i < sizeof(good) / sizeof(good[0]); i++) {
+        if (!train_hub_parse_addr(good[i], addr)) {
+            fail("address", "valid address refused");
+            continue;
+        }
+        train_hub_format_addr(addr, text, sizeof(text));
+        if (strcmp(text, good[i])) {
+            fail("address", "address does not print back as parsed");
+        }
+    }
+    const char *bad[] = { "90:84:2b:01:02", "90:84:2b:01:02:03:04", "90-84-2b-01-02-03", "City Hub", "" };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        if (train_hub_parse_addr(bad[i], addr)) {
+            fail("address", "invalid address taken");
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    bool verbose = argc > 1 && !strcmp(argv[1], "-v");
+    check_parsing();
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        if (verbose) {
+            printf("%s\n", scenarios[i].name);
+        }
+        run(&scenarios[i], verbose);
+    }
+    if (failures) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all scenarios ok\n");
+    return 0;
+}
@@ -0,0 +1,453 @@
+"""Chunked JPEG-over-UDP protocol used by the camera (camera/src/main/udp.h).
+
+Each datagram is an 8-byte little-endian header followed by a slice of the JPEG:
+
+    uint16 frame_id       same for all chunks of a frame, wraps at 65536
+    uint16 packet_id      chunk index within the frame
+    uint16 total_packets  number of chunks in the frame
+    uint16 chunk_size     length of every chunk of the frame but the last
+
+The chunk size can differ from frame to frame and between receivers. A
+datagram with total_packets = 0 and no payload is a keep-alive: the camera
+left the frame out because it matched the last one it sent, and the
+receiver should keep showing that one.
+
+/rtp/probe sends path probes: total_packets 0, packet_id 0xFFFF and
+chunk_size the length of the whole datagram, in sizes from 1472 down to
+508. best_datagram() picks the largest that arrived whole without being
+fragmented on the way, and /rtp/probe?size= sets it for the session.
+
+With proto=gcm (camera/src/main/chunk_crypt.h) the header grows by the
+nonce prefix and the payload is sealed with AES-GCM under a pre-shared key:
+
+    uint16 epoch          times frame_id wrapped since the camera booted
+    bytes6 salt           random per boot
+    ciphertext + 16-byte tag
+
+The nonce is salt || epoch || frame_id || packet_id (0xFFFF for a
+keep-alive), with chunk_size XORed into the first two salt bytes, and the
+16 header bytes are the additional data. Probes are never sealed. Pass the key
+to FrameAssembler and it takes sealed datagrams instead of plain ones.
+
+    python chunk_protocol.py     check the sealed format against known answers
+"""
+
+import hashlib
+import os
+import socket
+import struct
+import sys
+import time
+
+HEADER_FORMAT = '<HHHH'
+HEADER_SIZE = struct.calcsize(HEADER_FORMAT)
+CHUNK_SIZE = 1400  # The camera's default; udp_chunk on /config changes it live
+MAX_DATAGRAM = 65507
+
+PROBE_ID = 0xFFFF
+PROBE_MIN = 508
+PROBE_MAX = 1472  # One 1500-byte Ethernet frame
+PROBE_WAIT = 0.5  # Seconds of quiet after the camera answers /rtp/probe
+IP_RECVFRAGSIZE = getattr(socket, 'IP_RECVFRAGSIZE', 25)  # Linux 4.10, not in every Python
+
+FRAME_ID_MOD = 1 << 16
+RESTART_THRESHOLD = 64  # Frame ids this far in the past mean the sender restarted
+
+CRYPT_HEADER_FORMAT = '<HHHHH6s'
+CRYPT_HEADER_SIZE = struct.calcsize(CRYPT_HEADER_FORMAT)
+TAG_SIZE = 16
+CRYPT_CHUNK_SIZE = PROBE_MAX - CRYPT_HEADER_SIZE - TAG_SIZE  # The camera caps sealed chunks here
+KEEPALIVE_NONCE_ID = 0xFFFF
+KEY_ENV = 'TRAIN_UDP_KEY'
+
+
+def frame_id_diff(a, b):
+    """Signed distance from frame id b to a, accounting for wrap-around."""
+    d = (a - b) % FRAME_ID_MOD
+    return d - FRAME_ID_MOD if d >= FRAME_ID_MOD // 2 else d
+
+
+def open_receiver(port, group=None, bind='', rcvbuf=4 * 1024 * 1024):
+    """UDP socket for a camera stream. With a multicast group the socket joins
+    it (IGMP) and shares the port, so several receivers can run on one host."""
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, rcvbuf)
+    if group:
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        if hasattr(socket, 'SO_REUSEPORT'):
+            sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEPORT, 1)
+        sock.bind((group, port))
+        interface = socket.inet_aton(bind or '0.0.0.0')
+        sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, socket.inet_aton(group) + interface)
+    else:
+        sock.bind((bind, port))
+    return sock
+
+
+def parse_header(packet):
+    if len(packet) < HEADER_SIZE:
+        return None
+    return struct.unpack_from(HEADER_FORMAT, packet)
+
+
+def pack_chunks(frame_id, jpeg, chunk_size=CHUNK_SIZE):
+    """Split a JPEG into datagrams (used by the load generator)."""
+    total = (len(jpeg) + chunk_size - 1) // chunk_size
+    for packet_id in range(total):
+        offset = packet_id * chunk_size
+        yield struct.pack(HEADER_FORMAT, frame_id, packet_id, total, chunk_size) + jpeg[offset:offset + chunk_size]
+
+
+def is_probe(packet):
+    header = parse_header(packet)
+    return header is not None and header[1] == PROBE_ID and header[2] == 0 and header[3] == len(packet)
+
+
+def pack_probes(rounds=2):
+    """The camera's probe ladder (udp_probe() in udp.h): 8-byte steps down to
+    1280, then 64-byte steps, the whole ladder `rounds` times."""
+    seq = 0
+    for _ in range(rounds):
+        size = PROBE_MAX
+        while size >= PROBE_MIN:
+            yield struct.pack(HEADER_FORMAT, seq % FRAME_ID_MOD, PROBE_ID, 0, size) + bytes(size - HEADER_SIZE)
+            seq += 1
+            size -= 8 if size > 1280 else 64
+
+
+def report_fragments(sock):
+    """Ask the kernel to flag datagrams it reassembled from IP fragments.
+    Returns False where it cannot (not Linux), and then a fragmented probe
+    looks whole to best_datagram()."""
+    try:
+        sock.setsockopt(socket.IPPROTO_IP, IP_RECVFRAGSIZE, 1)
+        return True
+    except (OSError, AttributeError):
+        return False
+
+
+def recv_probe(sock):
+    """recvmsg() for a socket with report_fragments(). Returns the datagram
+    and whether it arrived in fragments."""
+    packet, ancillary, _, _ = sock.recvmsg(MAX_DATAGRAM, socket.CMSG_SPACE(4))
+    fragmented = any(level == socket.IPPROTO_IP and kind == IP_RECVFRAGSIZE for level, kind, _ in ancillary)
+    return packet, fragmented
+
+
+def collect_probes(sock, wait=PROBE_WAIT):
+    """Drain the probes waiting on a blocking socket with report_fragments(),
+    until none came for `wait` seconds. Stream packets are dropped."""
+    probes = []
+    timeout = sock.gettimeout()
+    sock.settimeout(wait)
+    try:
+        while True:
+            packet, fragmented = recv_probe(sock)
+            if is_probe(packet):
+                probes.append((packet, fragmented))
+    except socket.timeout:
+        pass
+    finally:
+        sock.settimeout(timeout)
+    return probes
+
+
+def best_datagram(probes):
+    """Largest probe size that arrived whole and unfragmented, from
+    (datagram, fragmented) pairs, or None if no probe came through."""
+    sizes = [len(p) for p, fragmented in probes if not fragmented and is_probe(p)]
+    return max(sizes) if sizes else None
+
+
+def parse_key(text):
+    """AES key from 32 or 64 hex digits (CONFIG_TRAIN_UDP_KEY)."""
+    try:
+        key = bytes.fromhex(text)
+    except ValueError:
+        key = b''
+    if len(key) not in (16, 32):
+        raise ValueError('the key must be 32 or 64 hex digits')
+    return key
+
+
+def key_argument(parser):
+    """Add --key to a tool's arguments, defaulting to $TRAIN_UDP_KEY so the key
+    need not show up in the process list."""
+    parser.add_argument('--key', type=parse_key, default=os.environ.get(KEY_ENV) or None,
+                        help='pre-shared key (hex) for the encrypted stream, proto=gcm (default: $%s)' % KEY_ENV)
+
+
+class ChunkCipher:
+    """Seals and opens datagrams of the encrypted chunked protocol.
+
+    open() checks the tag and returns the plain datagram (8-byte header and
+    JPEG slice) for FrameAssembler, or None. Within one boot of the camera
+    (one salt) it also turns away packets more than RESTART_THRESHOLD frames
+    older than the newest, so recorded packets cannot be played back into
+    the stream. A new salt is taken as a reboot.
+    """
+
+    def __init__(self, key):
+        from cryptography.hazmat.primitives.ciphers.aead import AESGCM
+        self.aead = AESGCM(key)
+        self.salt = None
+        self.newest = None  # epoch << 16 | frame_id
+        self.rejected = 0
+        self.replayed = 0
+
+    @staticmethod
+    def nonce(header):
+        frame_id, packet_id, total, chunk_size, epoch, salt = struct.unpack_from(CRYPT_HEADER_FORMAT, header)
+        salt = bytes((salt[0] ^ chunk_size & 0xFF, salt[1] ^ chunk_size >> 8)) + salt[2:]
+        return salt + struct.pack('<HHH', epoch, frame_id, packet_id if total else KEEPALIVE_NONCE_ID)
+
+    def seal(self, frame_id, packet_id, total, chunk_size, payload, epoch, salt):
+        header = struct.pack(CRYPT_HEADER_FORMAT, frame_id, packet_id, total, chunk_size, epoch, salt)
+        return header + self.aead.encrypt(self.nonce(header), payload, header)
+
+    def seal_chunks(self, frame_id, jpeg, epoch, salt, chunk_size=CRYPT_CHUNK_SIZE):
+        """pack_chunks() for the sealed protocol; an empty jpeg gives a keep-alive."""
+        total = (len(jpeg) + chunk_size - 1) // chunk_size
+        if total == 0:
+            yield self.seal(frame_id, 0, 0, 0, b'', epoch, salt)
+        for packet_id in range(total):
+            offset = packet_id * chunk_size
+            yield self.seal(frame_id, packet_id, total, chunk_size, jpeg[offset:offset + chunk_size], epoch, salt)
+
+    def open(self, packet):
+        if len(packet) < CRYPT_HEADER_SIZE + TAG_SIZE:
+            self.rejected += 1
+            return None
+        header = bytes(packet[:CRYPT_HEADER_SIZE])
+        try:
+            plain = self.aead.decrypt(self.nonce(header), bytes(packet[CRYPT_HEADER_SIZE:]), header)
+        except Exception:  # cryptography's InvalidTag
+            self.rejected += 1
+            return None
+        frame_id, _, _, _, epoch, salt = struct.unpack_from(CRYPT_HEADER_FORMAT, header)
+        seq = epoch << 16 | frame_id
+        if salt != self.salt:
+            self.salt, self.newest = salt, seq
+        elif seq < self.newest - RESTART_THRESHOLD:
+            self.replayed += 1
+            return None
+        else:
+            self.newest = max(self.newest, seq)
+        return header[:HEADER_SIZE] + plain
+
+
+class FrameAssembler:
+    """Reassembles frames from chunks, tolerating reordering and loss.
+
+    Frames are emitted as soon as all of their chunks are present. A partial
+    frame is abandoned once a frame `window` ids newer has started, or after
+    `timeout` seconds. Loss is counted from gaps in the ids of completed
+    frames. A keep-alive emits the last completed frame again (the same
+    bytes object) and counts as completed, not lost. Every chunk but the
+    last must be as long as the header's chunk_size says. Probes that
+    arrive after probing are counted and dropped. With a key, datagrams are
+    opened with ChunkCipher first, and those that fail count as bad.
+    """
+
+    def __init__(self, window=3, timeout=1.0, key=None):
+        self.window = window
+        self.timeout = timeout
+        self.cipher = ChunkCipher(key) if key else None
+        self.pending = {}  # frame_id -> [total, {packet_id: data}, first_seen, chunk_size]
+        self.newest = None
+        self.last_completed = None
+        self.last_frame = None
+        self.frames_completed = 0
+        self.frames_repeated = 0
+        self.frames_lost = 0
+        self.packets = 0
+        self.bytes = 0
+        self.bad_packets = 0
+        self.probes = 0
+
+    def push(self, packet, now=None):
+        """Feed one datagram. Returns the completed JPEG bytes, or None."""
+        if is_probe(packet):
+            self.probes += 1
+            return None
+        if self.cipher:
+            packet = self.cipher.open(packet)
+            if packet is None:
+                self.bad_packets += 1
+                return None
+        header = parse_header(packet)
+        if header is None:
+            self.bad_packets += 1
+            return None
+        frame_id, packet_id, total, chunk_size = header
+        if total == 0 and packet_id == 0 and len(packet) == HEADER_SIZE:
+            return self._keepalive(frame_id)
+        size = len(packet) - HEADER_SIZE
+        if total == 0 or packet_id >= total or size > chunk_size or (packet_id < total - 1 and size != chunk_size):
+            self.bad_packets += 1
+            return None
+
+        now = time.monotonic() if now is None else now
+        self.packets += 1
+        self.bytes += len(packet)
+
+        if self.last_completed is not None:
+            age = frame_id_diff(frame_id, self.last_completed)
+            if age < -RESTART_THRESHOLD:
+                # Far behind what we delivered: the camera rebooted
+                self.last_completed = self.newest = None
+                self.pending.clear()
+            elif age <= 0:
+                return None  # Late chunk of a frame we already delivered or dropped
+
+        if self.newest is None or frame_id_diff(frame_id, self.newest) > 0:
+            self.newest = frame_id
+            self._expire(now)
+
+        entry = self.pending.get(frame_id)
+        if entry is None:
+            entry = self.pending[frame_id] = [total, {}, now, chunk_size]
+        elif entry[0] != total or entry[3] != chunk_size:
+            self.bad_packets += 1
+            return None
+        entry[1][packet_id] = packet[HEADER_SIZE:]
+
+        if len(entry[1]) < entry[0]:
+            return None
+
+        del self.pending[frame_id]
+        self._complete(frame_id)
+        chunks = entry[1]
+        self.last_frame = b''.join(chunks[i] for i in range(entry[0]))
+        return self.last_frame
+
+    def _keepalive(self, frame_id):
+        self.packets += 1
+        self.bytes += HEADER_SIZE
+        if self.last_frame is None:
+            return None  # Nothing to repeat yet; the camera refreshes soon
+        age = frame_id_diff(frame_id, self.last_completed)
+        if age <= 0:
+            if age < -RESTART_THRESHOLD:
+                self.last_completed = self.newest = self.last_frame = None
+                self.pending.clear()
+            return None
+        if frame_id_diff(frame_id, self.newest) > 0:
+            self.newest = frame_id
+        self._complete(frame_id)
+        self.frames_repeated += 1
+        return self.last_frame
+
+    def _complete(self, frame_id):
+        # Every frame id between two completed frames was lost, whether we
+        # saw some of its chunks or none at all
+        if self.last_completed is not None:
+            self.frames_lost += frame_id_diff(frame_id, self.last_completed) - 1
+        self.last_completed = frame_id
+        self.frames_completed += 1
+        for fid in [fid for fid in self.pending if frame_id_diff(fid, frame_id) < 0]:
+            del self.pending[fid]
+
+    def _expire(self, now):
+        for fid, entry in list(self.pending.items()):
+            if frame_id_diff(self.newest, fid) >= self.window or now - entry[2] > self.timeout:
+                del self.pending[fid]
+
+    def loss_ratio(self):
+        total = self.frames_completed + self.frames_lost
+        return self.frames_lost / total if total else 0.0
+
+
+def jpeg_dimensions(jpeg):
+    """Width and height from the SOF marker of a JPEG, or None."""
+    i = 2
+    n = len(jpeg)
+    while i + 9 < n:
+        if jpeg[i] != 0xFF:
+            i += 1
+            continue
+        marker = jpeg[i + 1]
+        if marker in (0xC0, 0xC1, 0xC2):
+            height, width = struct.unpack_from('>HH', jpeg, i + 5)
+            return width, height
+        if marker == 0xD8 or 0xD0 <= marker <= 0xD7 or marker == 0xFF:
+            i += 1 if marker == 0xFF else 2
+            continue
+        length = struct.unpack_from('>H', jpeg, i + 2)[0]
+        i += 2 + length
+    return None
+
+
+# Known answer shared with camera/src/tools/chunk_crypt_bench.c: a test frame
+# sealed by the camera's code must give these bytes exactly
+TEST_KEY = bytes(range(16))
+TEST_SALT = bytes(range(0xA0, 0xA6))
+TEST_EPOCH = 1
+TEST_FRAME_ID = 0xFFFE
+TEST_FRAME = bytes((i * 7 + 3) & 0xFF for i in range(5000))
+TEST_SHA256 = 'da4bdb670d55fcc198c19f184b8e3e98aded2fb4c49289709c7590c320465322'
+
+
+def test_packets(cipher):
+    """The test frame in sealed datagrams, then a keep-alive for the next id."""
+    packets = list(cipher.seal_chunks(TEST_FRAME_ID, TEST_FRAME, TEST_EPOCH, TEST_SALT))
+    return packets + list(cipher.seal_chunks(TEST_FRAME_ID + 1, b'', TEST_EPOCH, TEST_SALT))
+
+
+def selftest():
+    failures = []
+
+    def check(ok, what):
+        print('%-4s %s' % ('ok' if ok else 'FAIL', what))
+        if not ok:
+            failures.append(what)
+
+    cipher = ChunkCipher(TEST_KEY)
+    packets = test_packets(cipher)
+    digest = hashlib.sha256(b''.join(packets)).hexdigest()
+    check(digest == TEST_SHA256, 'known answer %s' % digest[:16])
+    check(all(len(p) <= 1472 for p in packets), 'datagrams fit one Ethernet frame')
+
+    rx = FrameAssembler(key=TEST_KEY)
+    out = [rx.push(p) for p in packets]
+    check(out[3] == TEST_FRAME and out[4] is out[3], 'frame and keep-alive reassembled')
+
+    rx = FrameAssembler(key=TEST_KEY)
+    for i in range(len(packets[0])):
+        bad = bytearray(packets[0])
+        bad[i] ^= 0x01
+        rx.push(bytes(bad))
+    check(rx.cipher.rejected == len(packets[0]) and rx.frames_completed == 0, 'every flipped bit rejected')
+    check(FrameAssembler(key=bytes(16)).push(packets[-1]) is None, 'wrong key rejected')
+
+    # Later frames of the same boot, then the test frame played back
+    rx = FrameAssembler(key=TEST_KEY)
+    for frame_id in range(100):
+        for p in cipher.seal_chunks(frame_id, TEST_FRAME[:100], TEST_EPOCH + 1, TEST_SALT):
+            rx.push(p)
+    late = [rx.push(p) for p in packets]
+    check(rx.cipher.replayed == len(packets) and late[3] is None, 'old packets of the same boot dropped')
+    rebooted = [rx.push(p) for p in cipher.seal_chunks(0, TEST_FRAME, 0, bytes(6))]
+    check(rebooted[-1] == TEST_FRAME, 'new salt taken as a reboot')
+
+    # Chunk sizes change between frames, as after /rtp/probe?size=
+    rx = FrameAssembler()
+    out = [rx.push(p) for size in (1000, 1464) for p in pack_chunks(size, TEST_FRAME, size)]
+    check(out.count(TEST_FRAME) == 2 and rx.bad_packets == 0, 'frames in different chunk sizes reassembled')
+    short = list(pack_chunks(7, TEST_FRAME, 1000))
+    short[1] = short[1][:-1]
+    check([rx.push(p) for p in short][-1] is None and rx.bad_packets == 1, 'short chunk rejected')
+
+    probes = [(p, len(p) > 1400) for p in pack_probes() if len(p) != 1392]
+    check(best_datagram(probes) == 1400, 'largest unfragmented probe picked')
+    check(best_datagram([(p, False) for p in pack_probes()][1:]) == PROBE_MAX, 'one lost probe of two rounds')
+    rx = FrameAssembler(key=TEST_KEY)
+    [rx.push(p) for p, _ in probes]
+    check(rx.probes == len(probes) and rx.bad_packets == 0, 'probes ignored by the assembler')
+
+    print('%d failures' % len(failures))
+    return 1 if failures else 0
+
+
+if __name__ == '__main__':
+    sys.exit(selftest())
@@ -0,0 +1,423 @@
+#!/usr/bin/env python3
+"""Quantize a small CNN for the camera's animal detector and write the blob
+that the firmware loads from its "model" partition (camera/src/main/nn_model.h).
+
+Takes float weights (an .npz with Keras layouts: "<i>/kernel" as HWIO for conv,
+HWC1 for depthwise and IO for dense, "<i>/bias"), an architecture (built-in
+default or JSON), and calibration frames. It quantizes the model the way
+TensorFlow Lite's int8 post-training quantization does:
+
+  - per-channel symmetric int8 weights
+  - int32 biases
+  - activation ranges from the calibration frames
+  - pixels in [0, 1] as (level - 128) at scale 1/255
+
+Class 0 means "nothing there".
+
+`random` writes the default architecture with random weights, for bring-up
+and benchmarks. `--vectors` also runs an int8 reference of its own on the
+calibration inputs and stores inputs and outputs. tools/nn_bench.c checks
+the firmware kernels against them bit for bit.
+
+    python detector_model.py random -o model.bin --vectors vectors.bin
+    python detector_model.py export --weights fomo.npz --labels nothing,deer,fox \\
+        --calib frames/ -o model.bin
+    parttool.py write_partition --partition-name model --input model.bin
+"""
+
+import argparse
+import glob
+import json
+import math
+import os
+import struct
+import sys
+import zlib
+
+import numpy as np
+
+MAGIC = b'NNQ8'
+VERSION = 1
+LABEL_LEN = 16
+MAX_CLASSES = 8
+OPS = {'conv': 1, 'dwconv': 2, 'maxpool': 3, 'avgpool': 4, 'fc': 5}
+PARTITION_SIZE = 0x80000
+
+# FOMO-style grid detector: 96x96 gray in, 12x12 cells of class scores out
+DEFAULT_ARCH = {
+    'input': [96, 96, 1],
+    'layers': [
+        {'op': 'conv', 'k': 3, 'stride': 2, 'out': 8, 'relu': True},
+        {'op': 'dwconv', 'k': 3, 'relu': True},
+        {'op': 'conv', 'k': 1, 'out': 16, 'relu': True},
+        {'op': 'dwconv', 'k': 3, 'stride': 2, 'relu': True},
+        {'op': 'conv', 'k': 1, 'out': 32, 'relu': True},
+        {'op': 'dwconv', 'k': 3, 'stride': 2, 'relu': True},
+        {'op': 'conv', 'k': 1, 'out': 32, 'relu': True},
+        {'op': 'conv', 'k': 1, 'out': 'classes'},
+    ],
+}
+
+
+def layer_spec(layer, classes):
+    spec = {'k': 1, 'stride': 1, 'pad': 'same', 'relu': False}
+    spec.update(layer)
+    if spec.get('out') == 'classes':
+        spec['out'] = classes
+    if spec['op'] == 'fc':
+        spec['pad'] = 'valid'
+    return spec
+
+
+def out_shape(spec, shape):
+    h, w, c = shape
+    if spec['op'] == 'fc':
+        return (1, 1, spec['out'])
+    k, s = spec['k'], spec['stride']
+    if spec.get('global'):
+        return (1, 1, c)
+    if spec['pad'] == 'same':
+        oh, ow = -(-h // s), -(-w // s)
+    else:
+        oh, ow = (h - k) // s + 1, (w - k) // s + 1
+    return (oh, ow, spec['out'] if spec['op'] == 'conv' else c)
+
+
+def kernel_size(spec, shape):
+    return (shape[0], shape[1]) if spec.get('global') else (spec['k'], spec['k'])
+
+
+def windows(x, kh, kw, stride, pad, fill):
+    """Yield (ky, kx, slice) over the kernel taps of an HWC tensor, padded
+    TFLite-style with `fill`."""
+    h, w, _ = x.shape
+    if pad == 'same':
+        oh, ow = -(-h // stride), -(-w // stride)
+        ph, pw = max((oh - 1) * stride + kh - h, 0), max((ow - 1) * stride + kw - w, 0)
+        x = np.pad(x, ((ph // 2, ph - ph // 2), (pw // 2, pw - pw // 2), (0, 0)), constant_values=fill)
+    else:
+        oh, ow = (h - kh) // stride + 1, (w - kw) // stride + 1
+    for ky in range(kh):
+        for kx in range(kw):
+            yield ky, kx, x[ky:ky + (oh - 1) * stride + 1:stride, kx:kx + (ow - 1) * stride + 1:stride]
+
+
+def valid_counts(shape, kh, kw, stride, pad):
+    ones = np.ones(shape[:2] + (1,), dtype=np.int64)
+    return sum(win for _, _, win in windows(ones, kh, kw, stride, pad, 0))
+
+
+# ---------------------------------------------------------------------------
+# Float model
+
+def float_layer(spec, x, kernel, bias):
+    kh, kw = kernel_size(spec, x.shape)
+    op, stride, pad = spec['op'], spec['stride'], spec['pad'] if not spec.get('global') else 'valid'
+    if op == 'conv':
+        y = sum(np.tensordot(win, kernel[ky, kx], axes=([2], [0])) for ky, kx, win in windows(x, kh, kw, stride, pad, 0))
+    elif op == 'dwconv':
+        y = sum(win * kernel[ky, kx, :, 0] for ky, kx, win in windows(x, kh, kw, stride, pad, 0))
+    elif op == 'maxpool':
+        y = np.max([win for _, _, win in windows(x, kh, kw, stride, pad, -np.inf)], axis=0)
+    elif op == 'avgpool':
+        y = sum(win for _, _, win in windows(x, kh, kw, stride, pad, 0)) / valid_counts(x.shape, kh, kw, stride, pad)
+    else:
+        y = (x.reshape(-1) @ kernel).reshape(1, 1, -1)
+    if bias is not None:
+        y = y + bias
+    return np.maximum(y, 0) if spec['relu'] else y
+
+
+def float_forward(specs, weights, image):
+    x, outs = image, []
+    for i, spec in enumerate(specs):
+        kernel, bias = weights.get('%d/kernel' % i), weights.get('%d/bias' % i)
+        x = float_layer(spec, x, kernel, bias)
+        outs.append(x)
+    return outs
+
+
+# ---------------------------------------------------------------------------
+# Quantization (TFLite int8)
+
+def quantize_multiplier(m):
+    """Q31 multiplier and shift with m = q * 2^shift, as TFLite."""
+    if m == 0:
+        return 0, 0
+    q, shift = math.frexp(m)
+    q_fixed = int(math.floor(q * (1 << 31) + 0.5))
+    if q_fixed == 1 << 31:
+        q_fixed //= 2
+        shift += 1
+    if shift < -31:
+        return 0, 0
+    return q_fixed, shift
+
+
+def activation_quant(lo, hi):
+    lo, hi = min(lo, 0.0), max(hi, 0.0)
+    scale = max((hi - lo) / 255.0, 1e-8)
+    zero = int(np.clip(round(-128 - lo / scale), -128, 127))
+    return scale, zero
+
+
+def quantize(arch, weights, calib, classes):
+    specs = [layer_spec(layer, classes) for layer in arch['layers']]
+    ranges = [[np.inf, -np.inf] for _ in specs]
+    for image in calib:
+        for r, y in zip(ranges, float_forward(specs, weights, image)):
+            r[0], r[1] = min(r[0], float(y.min())), max(r[1], float(y.max()))
+
+    in_scale, in_zero = 1 / 255.0, -128
+    shape, scale, zero = tuple(arch['input']), in_scale, in_zero
+    layers = []
+    for i, spec in enumerate(specs):
+        q = {'spec': spec, 'in_shape': shape, 'in_zero': zero}
+        kh, kw = kernel_size(spec, shape)
+        q['kh'], q['kw'] = kh, kw
+        if spec['op'] in ('maxpool', 'avgpool'):
+            q['out_scale'], q['out_zero'] = scale, zero
+        else:
+            kernel = weights['%d/kernel' % i].astype(np.float64)
+            bias = weights.get('%d/bias' % i)
+            if spec['op'] == 'conv':
+                w = kernel.transpose(3, 0, 1, 2)            # HWIO -> OHWI
+            elif spec['op'] == 'dwconv':
+                w = kernel[:, :, :, 0].transpose(2, 0, 1)   # Per channel, for the scales
+            else:
+                w = kernel.T                                # IO -> OI
+            w_scale = np.abs(w.reshape(w.shape[0], -1)).max(axis=1) / 127.0
+            w_scale[w_scale == 0] = 1.0
+            wq = np.clip(np.round(w / w_scale.reshape((-1,) + (1,) * (w.ndim - 1))), -127, 127).astype(np.int8)
+            if spec['op'] == 'dwconv':
+                wq = wq.transpose(1, 2, 0)                  # C,H,W -> HWC
+            out_scale, out_zero = activation_quant(*ranges[i])
+            q['weights'] = wq
+            q['bias'] = None if bias is None else np.round(bias / (scale * w_scale)).astype(np.int32)
+            mult_shift = [quantize_multiplier(scale * s / out_scale) for s in w_scale]
+            q['mult'] = np.array([m for m, _ in mult_shift], dtype=np.int32)
+            q['shift'] = np.array([s for _, s in mult_shift], dtype=np.int32)
+            q['out_scale'], q['out_zero'] = out_scale, out_zero
+        q['act_min'] = max(-128, q['out_zero']) if spec['relu'] else -128
+        q['act_max'] = 127
+        layers.append(q)
+        shape, scale, zero = out_shape(spec, shape), q['out_scale'], q['out_zero']
+    return {'input': tuple(arch['input']), 'in_scale': in_scale, 'in_zero': in_zero, 'layers': layers}
+
+
+# ---------------------------------------------------------------------------
+# Int8 reference, written apart from the C kernels
+
+def srdhm(a, b):
+    ab = a.astype(np.int64) * b.astype(np.int64)
+    q = ab + np.where(ab >= 0, 1 << 30, 1 - (1 << 30))
+    return np.where(q >= 0, q >> 31, -((-q) >> 31))
+
+
+def rdbpot(x, exponent):
+    mask = (np.int64(1) << exponent) - 1
+    remainder = x & mask
+    threshold = (mask >> 1) + (x < 0)
+    return (x >> exponent) + (remainder > threshold)
+
+
+def requantize(acc, mult, shift):
+    left, right = np.maximum(shift, 0), np.maximum(-shift, 0)
+    v = acc.astype(np.int64) << left
+    v = (v + (1 << 31)) % (1 << 32) - (1 << 31)     # int32 wrap, as the C shift
+    return rdbpot(srdhm(v, mult), right)
+
+
+def int_layer(q, x):
+    spec = q['spec']
+    op, stride = spec['op'], spec['stride']
+    pad = 'valid' if spec.get('global') else spec['pad']
+    kh, kw = q['kh'], q['kw']
+    zero = q['in_zero']
+    xi = x.astype(np.int64)
+    if op in ('conv', 'dwconv', 'fc'):
+        if op == 'conv':
+            w = q['weights'].astype(np.int64)        # OHWI
+            acc = sum(np.tensordot(win - zero, w[:, ky, kx, :], axes=([2], [1]))
+                      for ky, kx, win in windows(xi, kh, kw, stride, pad, zero))
+        elif op == 'dwconv':
+            w = q['weights'].astype(np.int64)        # HWC
+            acc = sum((win - zero) * w[ky, kx] for ky, kx, win in windows(xi, kh, kw, stride, pad, zero))
+        else:
+            acc = (q['weights'].astype(np.int64) @ (xi.reshape(-1) - zero)).reshape(1, 1, -1)
+        if q['bias'] is not None:
+            acc = acc + q['bias']
+        y = requantize(acc, q['mult'], q['shift']) + q['out_zero']
+    elif op == 'maxpool':
+        y = np.max([win for _, _, win in windows(xi, kh, kw, stride, pad, -1000)], axis=0)
+    else:
+        total = sum(win for _, _, win in windows(xi, kh, kw, stride, pad, 0))
+        count = valid_counts(x.shape, kh, kw, stride, pad)
+        y = np.where(total > 0, (total + count // 2) // count, -((-total + count // 2) // count))
+    return np.clip(y, q['act_min'], q['act_max']).astype(np.int8)
+
+
+def int_forward(model, qinput):
+    x = qinput
+    for q in model['layers']:
+        x = int_layer(q, x)
+    return x
+
+
+def quantize_input(model, image):
+    q = np.round(image / model['in_scale']) + model['in_zero']
+    return np.clip(q, -128, 127).astype(np.int8)
+
+
+# ---------------------------------------------------------------------------
+# Blob
+
+def write_blob(model, labels):
+    layers = model['layers']
+    last = layers[-1]
+    h, w, c = model['input']
+    header = MAGIC + struct.pack('<HHHHHHfifiII', VERSION, len(layers), h, w, c, len(labels),
+                                 model['in_scale'], model['in_zero'], last['out_scale'], last['out_zero'], 0, 0)
+    label_bytes = b''.join(label.encode()[:LABEL_LEN - 1].ljust(LABEL_LEN, b'\0') for label in labels)
+    data_at = len(header) + len(label_bytes) + 36 * len(layers)
+    data = bytearray()
+
+    def put(array):
+        if array is None:
+            return 0
+        while (data_at + len(data)) % 4:
+            data.append(0)
+        offset = data_at + len(data)
+        data.extend(np.ascontiguousarray(array).astype(array.dtype.newbyteorder('<')).tobytes())
+        return offset
+
+    records = b''
+    for q in layers:
+        spec = q['spec']
+        stride = 1 if spec.get('global') else spec['stride']
+        pad = 0 if spec.get('global') or spec['pad'] == 'valid' else 1
+        out_c = spec.get('out', 0) if spec['op'] in ('conv', 'fc') else 0
+        offsets = [put(q.get(k)) for k in ('weights', 'bias', 'mult', 'shift')]
+        records += struct.pack('<BBBBBbbBHHiiIIII', OPS[spec['op']], q['kh'], q['kw'], stride, pad,
+                               q['act_min'], q['act_max'], 0, out_c, 0, q['in_zero'], q['out_zero'], *offsets)
+    blob = bytearray(header + label_bytes + records + data)
+    struct.pack_into('<I', blob, 32, len(blob) + 4)
+    return bytes(blob) + struct.pack('<I', zlib.crc32(blob))
+
+
+def write_vectors(path, model, inputs):
+    with open(path, 'wb') as f:
+        first = int_forward(model, inputs[0])
+        f.write(b'NNV1' + struct.pack('<III', len(inputs), inputs[0].size, first.size))
+        for qinput in inputs:
+            f.write(qinput.tobytes() + int_forward(model, qinput).tobytes())
+
+
+# ---------------------------------------------------------------------------
+
+def synthetic_frames(shape, count, rng):
+    """Smooth random frames with a few bright and dark blobs."""
+    h, w, c = shape
+    frames = []
+    yy, xx = np.mgrid[0:h, 0:w]
+    for _ in range(count):
+        img = np.full((h, w), rng.uniform(0.2, 0.8))
+        for _ in range(rng.integers(1, 5)):
+            cy, cx, r = rng.uniform(0, h), rng.uniform(0, w), rng.uniform(4, h / 3)
+            img += rng.uniform(-0.5, 0.5) * np.exp(-((yy - cy) ** 2 + (xx - cx) ** 2) / (2 * r * r))
+        img += rng.normal(0, 0.03, img.shape)
+        frames.append(np.repeat(np.clip(img, 0, 1)[:, :, None], c, axis=2))
+    return frames
+
+
+def load_frames(directory, shape, limit):
+    import cv2
+    h, w, c = shape
+    frames = []
+    for path in sorted(glob.glob(os.path.join(directory, '*.jp*g')))[:limit]:
+        img = cv2.imread(path, cv2.IMREAD_GRAYSCALE if c == 1 else cv2.IMREAD_COLOR)
+        img = cv2.resize(img, (w, h), interpolation=cv2.INTER_AREA)
+        img = img[:, :, None] if c == 1 else cv2.cvtColor(img, cv2.COLOR_BGR2RGB)
+        frames.append(img.astype(np.float64) / 255.0)
+    return frames
+
+
+def random_weights(arch, classes, rng):
+    weights, shape = {}, tuple(arch['input'])
+    for i, layer in enumerate(arch['layers']):
+        spec = layer_spec(layer, classes)
+        k, c = spec['k'], shape[2]
+        if spec['op'] == 'conv':
+            weights['%d/kernel' % i] = rng.normal(0, math.sqrt(2 / (k * k * c)), (k, k, c, spec['out']))
+        elif spec['op'] == 'dwconv':
+            weights['%d/kernel' % i] = rng.normal(0, math.sqrt(2 / (k * k)), (k, k, c, 1))
+        elif spec['op'] == 'fc':
+            weights['%d/kernel' % i] = rng.normal(0, math.sqrt(2 / np.prod(shape)), (int(np.prod(shape)), spec['out']))
+        if spec['op'] in ('conv', 'dwconv', 'fc'):
+            weights['%d/bias' % i] = rng.normal(0, 0.1, spec['out'] if spec['op'] != 'dwconv' else c)
+        shape = out_shape(spec, shape)
+    return weights
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('mode', choices=['random', 'export'])
+    parser.add_argument('-o', '--output', required=True, help='model blob to write')
+    parser.add_argument('--weights', help='float weights (.npz), for export')
+    parser.add_argument('--arch', help='architecture JSON (default: built-in 96x96 grid detector)')
+    parser.add_argument('--labels', default='nothing,animal', help='comma-separated classes, class 0 first')
+    parser.add_argument('--calib', metavar='DIR', help='JPEG frames for activation ranges')
+    parser.add_argument('--calib-count', type=int, default=200, help='calibration frames to use')
+    parser.add_argument('--vectors', help='also write int8 reference test vectors here')
+    parser.add_argument('--vector-count', type=int, default=8)
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+
+    labels = args.labels.split(',')
+    if not 2 <= len(labels) <= MAX_CLASSES:
+        parser.error('need 2-%d labels' % MAX_CLASSES)
+    arch = json.load(open(args.arch)) if args.arch else DEFAULT_ARCH
+    rng = np.random.default_rng(args.seed)
+    if args.mode == 'random':
+        weights = random_weights(arch, len(labels), rng)
+    elif args.weights:
+        weights = dict(np.load(args.weights))
+    else:
+        parser.error('export needs --weights')
+
+    shape = tuple(arch['input'])
+    if args.calib:
+        calib = load_frames(args.calib, shape, args.calib_count)
+        if not calib:
+            parser.error('no JPEGs in %s' % args.calib)
+    else:
+        if args.mode == 'export':
+            print('warning: no --calib, activation ranges come from synthetic frames', file=sys.stderr)
+        calib = synthetic_frames(shape, min(args.calib_count, 32), rng)
+
+    model = quantize(arch, weights, calib, len(labels))
+    blob = write_blob(model, labels)
+    if len(blob) > PARTITION_SIZE:
+        print('model is %d bytes, the partition holds %d' % (len(blob), PARTITION_SIZE), file=sys.stderr)
+        return 1
+    with open(args.output, 'wb') as f:
+        f.write(blob)
+
+    specs = [q['spec'] for q in model['layers']]
+    agree = 0
+    for image in calib:
+        out = int_forward(model, quantize_input(model, image))
+        ref = float_forward(specs, weights, image)[-1]
+        agree += np.array_equal(np.argmax(out, axis=2), np.argmax(ref, axis=2))
+    print('%s: %d layers, %d bytes, input %s, classes %s' % (args.output, len(specs), len(blob), shape, labels))
+    print('int8 and float agree on the top class of every cell for %d of %d calibration frames' % (agree, len(calib)))
+
+    if args.vectors:
+        inputs = [quantize_input(model, image) for image in calib[:args.vector_count]]
+        write_vectors(args.vectors, model, inputs)
+        print('%s: %d vectors' % (args.vectors, len(inputs)))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
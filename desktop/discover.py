@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+"""List every train camera on the network and its stream capabilities.
+
+Browses the cameras' DNS-SD services (_wstrain._udp and _mjpeg._tcp) for a
+couple of seconds and prints one line per camera from the TXT records, with
+no HTTP probing.
+
+    python discover.py
+    python discover.py --timeout 5 --json
+"""
+
+import argparse
+import json
+import sys
+import time
+
+from zeroconf import ServiceBrowser, ServiceListener, Zeroconf
+
+SERVICES = ['_wstrain._udp.local.', '_mjpeg._tcp.local.']
+
+
+class Collector(ServiceListener):
+    def __init__(self):
+        self.cameras = {}  # server hostname -> merged info
+
+    def add_service(self, zc, type_, name):
+        info = zc.get_service_info(type_, name, timeout=2000)
+        if info is None:
+            return
+        txt = {k.decode(): (v.decode() if v is not None else '') for k, v in info.properties.items()}
+        camera = self.cameras.setdefault(info.server, {
+            'host': info.server.rstrip('.'),
+            'name': name.split('.')[0],
+            'addresses': info.parsed_addresses(),
+        })
+        if type_.startswith('_mjpeg'):
+            camera['mjpeg'] = 'http://%s:%d%s' % (camera['host'], info.port, txt.get('path', '/stream'))
+        else:
+            camera['udp_port'] = info.port
+            camera['api'] = 'http://%s:%s/' % (camera['host'], txt.get('api', '80'))
+        camera.update(txt)
+
+    def update_service(self, zc, type_, name):
+        self.add_service(zc, type_, name)
+
+    def remove_service(self, zc, type_, name):
+        pass
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--timeout', type=float, default=3, help='seconds to browse')
+    parser.add_argument('--json', action='store_true', help='print JSON instead of a table')
+    args = parser.parse_args()
+
+    zc = Zeroconf()
+    collector = Collector()
+    browsers = [ServiceBrowser(zc, service, collector) for service in SERVICES]
+    time.sleep(args.timeout)
+    for browser in browsers:
+        browser.cancel()
+    zc.close()
+
+    cameras = sorted(collector.cameras.values(), key=lambda c: c['host'])
+    if args.json:
+        print(json.dumps(cameras, indent=2))
+        return 0
+
+    if not cameras:
+        print('No cameras found')
+        return 1
+    print('%-22s %-15s %-10s %4s %4s %-8s %-13s %-22s' % (
+        'host', 'address', 'framesize', 'fps', 'q', 'preset', 'ble', 'multicast'))
+    for c in cameras:
+        print('%-22s %-15s %-10s %4s %4s %-8s %-13s %-22s' % (
+            c['host'], (c['addresses'] or ['?'])[0], c.get('framesize', '?'), c.get('fps', '?'),
+            c.get('quality', '?'), c.get('preset', '?'), c.get('ble', '?'), c.get('mcast', '-')))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
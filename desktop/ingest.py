@@ -0,0 +1,335 @@
+#!/usr/bin/env python3
+"""Multi-camera UDP ingest service.
+
+One receive thread per camera reassembles chunked JPEG frames and hands them
+to (a) a per-camera recorder that appends the JPEGs unchanged to rolling
+MJPEG AVI files and (b) a shared bounded queue feeding a pool of decode
+workers. The decode queue drops the oldest frame when full, so a slow
+decoder never stalls reception. libjpeg-turbo (PyTurboJPEG) is used when
+available, otherwise OpenCV; both release the GIL while decoding, so the
+workers run in parallel.
+
+    python ingest.py --camera front:5005 --camera rear:5006 --record recordings/
+    python ingest.py --ports 5005-5012 --workers 8 --stats-port 8090
+    python ingest.py --camera train:5005 --group 239.255.42.1
+    TRAIN_UDP_KEY=<hex> python ingest.py --camera train:5005   (encrypted stream)
+"""
+
+import argparse
+import collections
+import json
+import socket
+import sys
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+from chunk_protocol import FrameAssembler, MAX_DATAGRAM, key_argument, open_receiver
+from mjpeg_avi import RollingAviWriter
+
+RECV_BUF_SIZE = 4 * 1024 * 1024  # 4 MB per socket to ride out scheduling hiccups
+
+
+class DropOldestQueue:
+    """Bounded queue that discards the oldest item instead of blocking.
+
+    deque.append/popleft are atomic under the GIL, so producers never take a
+    lock; the semaphore only wakes consumers. Drops leave surplus permits,
+    which consumers absorb as empty wake-ups.
+    """
+
+    def __init__(self, maxlen):
+        self.items = collections.deque(maxlen=maxlen)
+        self.available = threading.Semaphore(0)
+        self.dropped = 0
+
+    def put(self, item):
+        if len(self.items) == self.items.maxlen:
+            self.dropped += 1
+        self.items.append(item)
+        self.available.release()
+
+    def get(self, timeout=None):
+        while self.available.acquire(timeout=timeout):
+            try:
+                return self.items.popleft()
+            except IndexError:
+                continue  # Permit left over from a dropped item
+        return None
+
+    def __len__(self):
+        return len(self.items)
+
+
+def make_decoder():
+    try:
+        from turbojpeg import TurboJPEG
+        tj = TurboJPEG()
+        return 'libjpeg-turbo', tj.decode
+    except Exception:
+        pass
+    import cv2
+    import numpy as np
+    return 'opencv', lambda data: cv2.imdecode(np.frombuffer(data, np.uint8), cv2.IMREAD_COLOR)
+
+
+class CameraStats:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.frames = 0
+        self.bytes = 0
+        self.decoded = 0
+        self.decode_failed = 0
+        self.decode_times = collections.deque(maxlen=512)
+        self.window_start = time.monotonic()
+        self.window_frames = 0
+        self.window_bytes = 0
+        self.fps = 0.0
+        self.bitrate = 0.0
+
+    def frame(self, size):
+        with self.lock:
+            self.frames += 1
+            self.bytes += size
+            self.window_frames += 1
+            self.window_bytes += size
+            now = time.monotonic()
+            if now - self.window_start >= 1.0:
+                self.fps = self.window_frames / (now - self.window_start)
+                self.bitrate = 8 * self.window_bytes / (now - self.window_start)
+                self.window_start = now
+                self.window_frames = 0
+                self.window_bytes = 0
+
+    def rates(self):
+        with self.lock:
+            if time.monotonic() - self.window_start > 2.0:
+                return 0.0, 0.0  # Stream stopped
+            return self.fps, self.bitrate
+
+    def decode(self, seconds, ok):
+        with self.lock:
+            if ok:
+                self.decoded += 1
+                self.decode_times.append(seconds)
+            else:
+                self.decode_failed += 1
+
+    def decode_ms(self):
+        with self.lock:
+            times = sorted(self.decode_times)
+        if not times:
+            return 0.0, 0.0
+        p95 = times[min(len(times) - 1, int(len(times) * 0.95))]
+        return 1000 * sum(times) / len(times), 1000 * p95
+
+
+class Camera:
+    def __init__(self, name, port, args, decode_queue):
+        self.name = name
+        self.port = port
+        self.decode_queue = decode_queue
+        self.assembler = FrameAssembler(key=args.key)
+        self.stats = CameraStats()
+        self.latest = None  # Most recent decoded image, for display
+        self.running = True
+
+        self.sock = open_receiver(port, args.group, args.bind, RECV_BUF_SIZE)
+        self.sock.settimeout(0.5)
+
+        self.recorder = None
+        self.record_queue = None
+        if args.record:
+            self.recorder = RollingAviWriter(args.record, name, fps=args.fps)
+            self.record_queue = DropOldestQueue(256)
+
+    def start(self):
+        threading.Thread(target=self.receive_loop, name='rx-' + self.name, daemon=True).start()
+        if self.recorder:
+            threading.Thread(target=self.record_loop, name='rec-' + self.name, daemon=True).start()
+
+    def receive_loop(self):
+        recv = self.sock.recv
+        push = self.assembler.push
+        last = None
+        while self.running:
+            try:
+                packet = recv(MAX_DATAGRAM)
+            except socket.timeout:
+                continue
+            except OSError:
+                break
+            jpeg = push(packet)
+            if jpeg is None:
+                continue
+            # A keep-alive repeats the last frame: record it again to keep
+            # the timing, but there is nothing new to decode
+            repeat = jpeg is last
+            last = jpeg
+            self.stats.frame(0 if repeat else len(jpeg))
+            if self.record_queue is not None:
+                self.record_queue.put(jpeg)
+            if self.decode_queue is not None and not repeat:
+                self.decode_queue.put((self, jpeg))
+
+    def record_loop(self):
+        while self.running or len(self.record_queue):
+            jpeg = self.record_queue.get(timeout=0.5)
+            if jpeg is not None:
+                self.recorder.write(jpeg)
+        self.recorder.close()
+
+    def snapshot(self):
+        s = self.stats
+        avg_ms, p95_ms = s.decode_ms()
+        fps, bitrate = s.rates()
+        return {
+            'name': self.name,
+            'port': self.port,
+            'fps': round(fps, 2),
+            'frames': s.frames,
+            'frames_repeated': self.assembler.frames_repeated,
+            'frames_lost': self.assembler.frames_lost,
+            'loss': round(self.assembler.loss_ratio(), 4),
+            'bad_packets': self.assembler.bad_packets,
+            'mbit_s': round(bitrate / 1e6, 2),
+            'decoded': s.decoded,
+            'decode_failed': s.decode_failed,
+            'decode_ms_avg': round(avg_ms, 2),
+            'decode_ms_p95': round(p95_ms, 2),
+            'record_dropped': self.record_queue.dropped if self.record_queue is not None else 0,
+        }
+
+
+def decode_worker(queue, decode, running):
+    while running.is_set():
+        item = queue.get(timeout=0.5)
+        if item is None:
+            continue
+        camera, jpeg = item
+        start = time.perf_counter()
+        try:
+            image = decode(jpeg)
+        except Exception:
+            image = None
+        camera.stats.decode(time.perf_counter() - start, image is not None)
+        if image is not None:
+            camera.latest = image
+
+
+def parse_cameras(args):
+    cameras = []
+    for spec in args.camera or []:
+        name, _, port = spec.rpartition(':')
+        cameras.append((name or 'cam%s' % port, int(port)))
+    if args.ports:
+        first, _, last = args.ports.partition('-')
+        for port in range(int(first), int(last or first) + 1):
+            cameras.append(('cam%d' % port, port))
+    if not cameras:
+        cameras.append(('cam5005', 5005))
+    return cameras
+
+
+def serve_stats(port, report):
+    class Handler(BaseHTTPRequestHandler):
+        def do_GET(self):
+            body = json.dumps(report()).encode()
+            self.send_response(200)
+            self.send_header('Content-Type', 'application/json')
+            self.send_header('Content-Length', str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+
+        def log_message(self, *args):
+            pass
+
+    server = ThreadingHTTPServer(('', port), Handler)
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--camera', action='append', metavar='NAME:PORT', help='camera to ingest (repeatable)')
+    parser.add_argument('--ports', metavar='FIRST-LAST', help='ingest a range of ports, one camera each')
+    parser.add_argument('--bind', default='', help='address to bind (default: all)')
+    parser.add_argument('--group', help='join this multicast group on every port')
+    parser.add_argument('--record', metavar='DIR', help='write MJPEG AVI segments to DIR')
+    parser.add_argument('--fps', type=float, default=15, help='nominal frame rate stored in AVI headers')
+    parser.add_argument('--workers', type=int, default=4, help='decode worker threads')
+    parser.add_argument('--queue', type=int, default=64, help='decode queue depth (oldest dropped when full)')
+    parser.add_argument('--no-decode', action='store_true', help='record/measure only, skip decoding')
+    parser.add_argument('--display', action='store_true', help='show decoded streams with OpenCV')
+    parser.add_argument('--stats-interval', type=float, default=5, help='seconds between stats lines')
+    parser.add_argument('--stats-port', type=int, help='serve JSON stats over HTTP on this port')
+    key_argument(parser)
+    args = parser.parse_args()
+
+    running = threading.Event()
+    running.set()
+
+    decode_queue = None
+    if not args.no_decode:
+        decoder_name, decode = make_decoder()
+        decode_queue = DropOldestQueue(args.queue)
+        for i in range(args.workers):
+            threading.Thread(target=decode_worker, args=(decode_queue, decode, running),
+                             name='decode-%d' % i, daemon=True).start()
+        print('Decoding with %s on %d workers' % (decoder_name, args.workers))
+
+    cameras = [Camera(name, port, args, decode_queue) for name, port in parse_cameras(args)]
+    for camera in cameras:
+        camera.start()
+        print('Listening for %s on UDP port %d%s' % (
+            camera.name, camera.port, ' (group %s)' % args.group if args.group else ''))
+
+    def report():
+        return {
+            'cameras': [c.snapshot() for c in cameras],
+            'decode_queue': len(decode_queue) if decode_queue is not None else 0,
+            'decode_dropped': decode_queue.dropped if decode_queue is not None else 0,
+        }
+
+    if args.stats_port:
+        serve_stats(args.stats_port, report)
+        print('Stats at http://localhost:%d/' % args.stats_port)
+
+    if args.display:
+        import cv2
+
+    try:
+        next_stats = time.monotonic() + args.stats_interval
+        while True:
+            if args.display:
+                for camera in cameras:
+                    if camera.latest is not None:
+                        cv2.imshow(camera.name, camera.latest)
+                if cv2.waitKey(10) & 0xFF == ord('q'):
+                    break
+            else:
+                time.sleep(0.1)
+
+            if time.monotonic() >= next_stats:
+                next_stats += args.stats_interval
+                r = report()
+                for c in r['cameras']:
+                    print('%-10s fps %5.1f  loss %5.1f%%  %6.2f Mbit/s  decode %5.2f ms (p95 %5.2f)  rec-drop %d' % (
+                        c['name'], c['fps'], 100 * c['loss'], c['mbit_s'],
+                        c['decode_ms_avg'], c['decode_ms_p95'], c['record_dropped']))
+                if decode_queue is not None:
+                    print('decode queue %d, dropped %d' % (r['decode_queue'], r['decode_dropped']))
+    except KeyboardInterrupt:
+        pass
+    finally:
+        running.clear()
+        for camera in cameras:
+            camera.running = False
+        time.sleep(1)  # Let recorders flush and finalize their AVI indexes
+        if args.display:
+            cv2.destroyAllWindows()
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,1191 @@
+#!/usr/bin/env python3
+"""Lossless recompression of recorded camera JPEGs for the archive.
+
+The camera's JPEGs are baseline Huffman-coded. This tool decodes each scan
+back to its quantized DCT coefficients and codes them again with adaptive
+context models and an interleaved rANS coder (a form of arithmetic coding),
+which spends fewer bits than the JPEG's fixed Huffman codes. Unpacking
+re-encodes the coefficients with the file's own Huffman tables and gives
+back the original bytes exactly: every frame is re-encoded and compared
+while packing, and a frame that would not come back identical (progressive,
+arithmetic-coded, damaged, odd padding) is stored unchanged instead.
+
+Frames are coded in batches (--batch frames). A batch is the unit of
+parallelism and of random access: the models learn across the frames of a
+batch and start over with the next. Batches go to a process pool, one per
+core by default.
+
+Inputs are the MJPEG AVI files that ingest.py records, or single JPEG files.
+An archive restores its input byte for byte, AVI container included.
+
+    python jpeg_archive.py pack recordings/*.avi -o archive/
+    python jpeg_archive.py unpack archive/*.wsja -o restored/
+    python jpeg_archive.py bench recordings/front_0000.avi --jobs 1
+    python jpeg_archive.py test
+"""
+
+import argparse
+import contextlib
+import io
+import os
+import re
+import struct
+import sys
+import time
+import zlib
+from concurrent.futures import ProcessPoolExecutor
+
+import numpy as np
+
+MAGIC = b'WSJA'
+VERSION = 1
+CONTAINER_JPEG = 0
+CONTAINER_AVI = 1
+
+FRAME_CODED = 0
+FRAME_STORED = 1
+
+DEFAULT_BATCH = 32
+LANES = 2048            # Interleaved rANS states at most; each costs 4 bytes per batch
+LANE_SYMBOLS = 2048     # Fewer lanes for small batches: one per this many symbols
+
+PROB_BITS = 12          # Model frequencies sum to 4096
+PROB_SCALE = 1 << PROB_BITS
+RANS_LOW = 1 << 16      # States live in [2^16, 2^32) and move 16 bits at a time
+COUNT_INC = 16          # Weight of a new observation
+COUNT_LIMIT = 1 << 16   # Halve a context's counts when they reach this
+
+# Zig-zag index -> natural (row, column) position in the 8x8 block
+ZIGZAG = [
+    0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63]
+_NATURAL_TO_ZZ = {n: k for k, n in enumerate(ZIGZAG)}
+# For each zig-zag position, the one above and the one to the left in the
+# block (earlier in zig-zag order), or 0 (the DC, never a context) at an edge
+ZZ_UP = np.array([_NATURAL_TO_ZZ[n - 8] if n >= 8 else 0 for n in ZIGZAG])
+ZZ_LEFT = np.array([_NATURAL_TO_ZZ[n - 1] if n % 8 else 0 for n in ZIGZAG])
+
+# Number of bits of |v|, the JPEG "category"
+CAT = np.array([0] + [int(v).bit_length() for v in range(1, 1 << 12)], dtype=np.int64)
+
+# Context buckets
+NZ_BUCKET = np.array([0, 1, 2, 3, 4, 5, 5, 6, 6, 7, 7, 7, 8, 8, 8, 8] + [9] * 5 + [10] * 7 + [11] * 36)
+NZ_CONTEXTS = 13                    # 12 buckets + "first row"
+DC_NZ_BUCKET = np.array([0, 1, 1, 2, 2, 2, 3, 3, 3, 3, 3] + [4] * 53)
+DC_CAT_BUCKET = np.array([0, 1, 2, 3, 3] + [4] * 11)
+AC_BAND = np.array([0, 0, 1, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 4, 5, 5, 5, 5, 5, 5]
+                   + [6] * 7 + [7] * 8 + [8] * 28)
+AC_REM_BUCKET = np.array([0, 0, 1, 2, 3, 3, 4, 4, 4, 4] + [5] * 54)
+AC_LOCAL_BUCKET = np.array([0, 1, 2, 3, 4, 4] + [5] * 26)
+AC_ACTIVITY_BUCKET = np.array([0, 0, 1, 1, 1, 2, 2, 2, 2, 2] + [3] * 54)
+
+
+# ---------------------------------------------------------------------------
+# JPEG structure
+
+class Layout:
+    """What the scan needs from the headers: geometry, tables, restarts."""
+
+    def __init__(self):
+        self.width = self.height = 0
+        self.components = []    # [id, h, v] per frame component
+        self.scan = []          # (component index, DC table, AC table) per scan component
+        self.huffman = {}       # (class, id) -> (code lengths, symbols)
+        self.restart = 0
+        self.header_end = 0     # Offset of the entropy-coded data
+
+
+def parse_headers(data):
+    """Read the markers up to the first scan. Returns a Layout, or a reason
+    the frame cannot be recompressed."""
+    if data[:2] != b'\xff\xd8':
+        return 'no SOI'
+    lay = Layout()
+    pos = 2
+    sof = False
+    while pos + 4 <= len(data):
+        if data[pos] != 0xFF:
+            return 'bad marker'
+        marker = data[pos + 1]
+        if marker == 0xFF:
+            pos += 1            # Fill byte
+            continue
+        length = struct.unpack_from('>H', data, pos + 2)[0]
+        body = data[pos + 4:pos + 2 + length]
+        if len(body) != length - 2:
+            return 'truncated header'
+        if marker in (0xC0, 0xC1):
+            if body[0] != 8:
+                return '%d-bit samples' % body[0]
+            lay.height, lay.width, n = struct.unpack_from('>HHB', body, 1)
+            for i in range(n):
+                cid, hv = body[6 + 3 * i], body[7 + 3 * i]
+                lay.components.append([cid, hv >> 4, hv & 15])
+            if not lay.width or not lay.height or any(not h or not v for _, h, v in lay.components):
+                return 'bad frame header'
+            sof = True
+        elif 0xC2 <= marker <= 0xCF and marker not in (0xC4, 0xC8, 0xCC):
+            return 'not baseline (SOF%d)' % (marker - 0xC0)
+        elif marker == 0xC4:
+            p = 0
+            while p < len(body):
+                tc_th = body[p]
+                lengths = list(body[p + 1:p + 17])
+                count = sum(lengths)
+                lay.huffman[(tc_th >> 4, tc_th & 15)] = (lengths, list(body[p + 17:p + 17 + count]))
+                p += 17 + count
+        elif marker == 0xDD:
+            lay.restart = struct.unpack_from('>H', body)[0]
+        elif marker == 0xDA:
+            if not sof:
+                return 'scan before frame header'
+            ids = [c[0] for c in lay.components]
+            for i in range(body[0]):
+                cid, tables = body[1 + 2 * i], body[2 + 2 * i]
+                if cid not in ids:
+                    return 'unknown scan component'
+                dc, ac = (0, tables >> 4), (1, tables & 15)
+                if dc not in lay.huffman or ac not in lay.huffman:
+                    return 'missing Huffman table'
+                lay.scan.append((ids.index(cid), tables >> 4, tables & 15))
+            if tuple(body[-3:]) != (0, 63, 0):
+                return 'not a sequential scan'
+            lay.header_end = pos + 2 + length
+            return lay
+        pos += 2 + length
+    return 'no scan'
+
+
+def scan_end(data, start):
+    """Offset of the marker that ends the entropy-coded data."""
+    pos = start
+    while True:
+        pos = data.find(b'\xff', pos)
+        if pos < 0 or pos + 1 >= len(data):
+            return len(data)
+        nxt = data[pos + 1]
+        if nxt == 0 or 0xD0 <= nxt <= 0xD7:
+            pos += 2
+        else:
+            return pos
+
+
+def block_grid(lay):
+    """Blocks per row and column for each scan component, and the MCU
+    layout: (MCUs across, MCUs down, [(scan index, block offsets)])."""
+    hmax = max(c[1] for c in lay.components)
+    vmax = max(c[2] for c in lay.components)
+    if len(lay.scan) == 1:
+        ci = lay.scan[0][0]
+        _, h, v = lay.components[ci]
+        bw = -(-(-(-lay.width * h // hmax)) // 8)
+        bh = -(-(-(-lay.height * v // vmax)) // 8)
+        return [(bw, bh)], (bw, bh, [(0, [(0, 0)])])
+    mx = -(-lay.width // (8 * hmax))
+    my = -(-lay.height // (8 * vmax))
+    grids, mcu = [], []
+    for si, (ci, _, _) in enumerate(lay.scan):
+        _, h, v = lay.components[ci]
+        grids.append((mx * h, my * v))
+        mcu.append((si, [(y, x) for y in range(v) for x in range(h)]))
+    return grids, (mx, my, mcu)
+
+
+def scan_order(lay):
+    """Scan index and block index of every block in coding order."""
+    grids, (mx, my, mcu) = block_grid(lay)
+    ys, xs = np.mgrid[0:my, 0:mx]
+    ys, xs = ys.ravel(), xs.ravel()
+    comp, index = [], []
+    for si, offsets in mcu:
+        bw = grids[si][0]
+        h = max(x for _, x in offsets) + 1
+        v = max(y for y, _ in offsets) + 1
+        for y, x in offsets:
+            comp.append(np.full(ys.size, si))
+            index.append((ys * v + y) * bw + xs * h + x)
+    # Blocks of one MCU are consecutive: order by MCU, then position in it
+    comp = np.stack(comp, axis=1).ravel()
+    index = np.stack(index, axis=1).ravel()
+    return comp, index, len(comp) // (mx * my)
+
+
+# ---------------------------------------------------------------------------
+# Huffman decoding (pure Python, the slow part of packing)
+
+_lookup_cache = {}
+
+
+def huffman_lookup(lengths, symbols):
+    """65536-entry table: next 16 bits -> symbol << 5 | code length."""
+    key = (tuple(lengths), tuple(symbols))
+    table = _lookup_cache.get(key)
+    if table is None:
+        table = [0] * 65536
+        code = 0
+        k = 0
+        for length in range(1, 17):
+            for _ in range(lengths[length - 1]):
+                shift = 16 - length
+                table[code << shift:(code + 1) << shift] = [symbols[k] << 5 | length] * (1 << shift)
+                code += 1
+                k += 1
+            code <<= 1
+        _lookup_cache[key] = table
+    return table
+
+
+def _windows(segment):
+    """32-bit big-endian window starting at every byte of the segment."""
+    b = np.frombuffer(segment + b'\0\0\0\0', dtype=np.uint8).astype(np.uint32)
+    return ((b[:-3] << 24) | (b[1:-2] << 16) | (b[2:-1] << 8) | b[3:]).tolist()
+
+
+def decode_scan(lay, scan):
+    """Quantized coefficients (blocks, 64) in zig-zag order for each scan
+    component, with DC as values rather than differences."""
+    grids, (mx, my, mcu) = block_grid(lay)
+    mcus = mx * my
+    restart = lay.restart or mcus
+    segments = re.split(rb'\xff[\xd0-\xd7]', scan)
+    if len(segments) != -(-mcus // restart):
+        raise ValueError('restart markers do not match the interval')
+
+    dc_tables = [huffman_lookup(*lay.huffman[(0, td)]) for _, td, _ in lay.scan]
+    ac_tables = [huffman_lookup(*lay.huffman[(1, ta)]) for _, _, ta in lay.scan]
+    plan = []                   # Per block of an MCU: where it goes in its component and its tables
+    for si, offsets in mcu:
+        bw = grids[si][0]
+        h = max(x for _, x in offsets) + 1
+        v = max(y for y, _ in offsets) + 1
+        for y, x in offsets:
+            plan.append((si, v * bw, h, y * bw + x, dc_tables[si], ac_tables[si]))
+
+    idx = [[] for _ in lay.scan]
+    val = [[] for _ in lay.scan]
+    dc = [[0] * (g[0] * g[1]) for g in grids]
+    m = 0
+    for segment in segments:
+        w = _windows(segment.replace(b'\xff\x00', b'\xff'))
+        nbits = (len(w) - 4) * 8 + 32
+        p = 0
+        pred = [0] * len(lay.scan)
+        for m in range(m, min(m + restart, mcus)):
+            my_, mx_ = divmod(m, mx)
+            for si, row_step, h, off, dct, act in plan:
+                block = my_ * row_step + mx_ * h + off
+                e = dct[(w[p >> 3] >> (16 - (p & 7))) & 0xFFFF]
+                if not e:
+                    raise ValueError('bad DC code')
+                p += e & 31
+                s = e >> 5
+                diff = 0
+                if s:
+                    diff = (w[p >> 3] >> (32 - (p & 7) - s)) & ((1 << s) - 1)
+                    if diff < 1 << (s - 1):
+                        diff -= (1 << s) - 1
+                    p += s
+                pred[si] += diff
+                dc[si][block] = pred[si]
+                base = block * 64
+                ia, va = idx[si].append, val[si].append
+                k = 1
+                while k < 64:
+                    e = act[(w[p >> 3] >> (16 - (p & 7))) & 0xFFFF]
+                    if not e:
+                        raise ValueError('bad AC code')
+                    p += e & 31
+                    rs = e >> 5
+                    s = rs & 15
+                    if not s:
+                        if rs != 0xF0:
+                            break           # EOB
+                        k += 16
+                        continue
+                    k += rs >> 4
+                    if k > 63:
+                        raise ValueError('run past the block')
+                    x = (w[p >> 3] >> (32 - (p & 7) - s)) & ((1 << s) - 1)
+                    if x < 1 << (s - 1):
+                        x -= (1 << s) - 1
+                    p += s
+                    ia(base + k)
+                    va(x)
+                    k += 1
+                if k > 64:
+                    raise ValueError('run past the block')
+        m += 1
+        if p > nbits:
+            raise ValueError('scan data ends early')
+
+    coefs = []
+    for si, (bw, bh) in enumerate(grids):
+        c = np.zeros((bw * bh, 64), dtype=np.int32)
+        c.ravel()[np.array(idx[si], dtype=np.int64)] = val[si]
+        c[:, 0] = dc[si]
+        coefs.append(c)
+    return coefs
+
+
+# ---------------------------------------------------------------------------
+# Huffman encoding (numpy)
+
+def huffman_codes(lengths, symbols):
+    codes = np.zeros(256, dtype=np.int64)
+    sizes = np.zeros(256, dtype=np.int64)
+    code = k = 0
+    for length in range(1, 17):
+        for _ in range(lengths[length - 1]):
+            codes[symbols[k]] = code
+            sizes[symbols[k]] = length
+            code += 1
+            k += 1
+        code <<= 1
+    return codes, sizes
+
+
+def pack_bits(values, sizes):
+    """Concatenate values of the given bit sizes (each at most 32) into bytes,
+    returning the bytes and the number of bits."""
+    total = int(sizes.sum())
+    if total == 0:
+        return np.zeros(0, dtype=np.uint8), 0
+    bits = np.unpackbits(values.astype('>u4').view(np.uint8)).reshape(-1, 32)
+    # Row-major selection keeps the low `size` bits of each value, in order
+    return np.packbits(bits[np.arange(32)[None, :] >= 32 - sizes[:, None]]), total
+
+
+def read_bits(data, offsets, sizes):
+    """Values of the given sizes (at most 24 bits) at bit offsets of data."""
+    b = np.frombuffer(bytes(data) + b'\0\0\0\0', dtype=np.uint8).astype(np.int64)
+    byte = offsets >> 3
+    w = (b[byte] << 24) | (b[byte + 1] << 16) | (b[byte + 2] << 8) | b[byte + 3]
+    return (w >> (32 - (offsets & 7) - sizes)) & ((1 << sizes) - 1)
+
+
+def extra_bits(v, cat):
+    """JPEG additional bits: v for positive, v - 1 in cat bits for negative."""
+    return np.where(v >= 0, v, v + (1 << cat) - 1)
+
+
+def from_extra_bits(e, cat):
+    return np.where(e >= (1 << np.maximum(cat - 1, 0)), e, e - (1 << cat) + 1) * (cat > 0)
+
+
+def encode_scan(lay, coefs, pad):
+    """Baseline entropy-coded data for the coefficients, with restart markers
+    and byte stuffing, padding each segment with `pad` bits."""
+    comp, index, per_mcu = scan_order(lay)
+    blocks = np.concatenate([coefs[si] for si in range(len(lay.scan))])
+    first = np.cumsum([0] + [len(c) for c in coefs])[:-1]
+    rows = blocks[first[comp] + index]
+    n = len(rows)
+    mcus = n // per_mcu
+    restart = lay.restart or mcus
+    segment = np.arange(n) // per_mcu // restart
+
+    # DC differences within each component, restarting at every segment
+    dc = rows[:, 0].astype(np.int64)
+    prev = np.zeros(n, dtype=np.int64)
+    for si in range(len(lay.scan)):
+        where = np.flatnonzero(comp == si)
+        p = np.concatenate([[0], dc[where[:-1]]])
+        p[np.r_[True, segment[where[1:]] != segment[where[:-1]]]] = 0
+        prev[where] = p
+    diff = dc - prev
+
+    dc_codes = [huffman_codes(*lay.huffman[(0, td)]) for _, td, _ in lay.scan]
+    ac_codes = [huffman_codes(*lay.huffman[(1, ta)]) for _, _, ta in lay.scan]
+    dcc = np.stack([c for c, _ in dc_codes])
+    dcs = np.stack([s for _, s in dc_codes])
+    acc = np.stack([c for c, _ in ac_codes])
+    acs = np.stack([s for _, s in ac_codes])
+
+    # Items: (block, order key, code, code size, extra bits, extra size)
+    cat = CAT[np.abs(diff)]
+    keys = [np.arange(n) * 4096]
+    codes = [dcc[comp, cat]]
+    csizes = [dcs[comp, cat]]
+    extras = [extra_bits(diff, cat)]
+    esizes = [cat]
+    if (csizes[0] == 0).any():
+        raise ValueError('DC symbol not in table')
+
+    ac = rows[:, 1:].astype(np.int64)
+    b, k = np.nonzero(ac)
+    k = k + 1
+    v = ac[b, k - 1]
+    prev_k = np.zeros_like(k)
+    same = np.flatnonzero(b[1:] == b[:-1]) + 1
+    prev_k[same] = k[same - 1]
+    run = k - prev_k - 1
+    zrl = run >> 4
+    c = CAT[np.abs(v)]
+    sym = ((run & 15) << 4) | c
+    keys.append(b * 4096 + k * 32 + 31)
+    codes.append(acc[comp[b], sym])
+    csizes.append(acs[comp[b], sym])
+    extras.append(extra_bits(v, c))
+    esizes.append(c)
+    # ZRLs before a coefficient that follows 16 or more zeros
+    if zrl.any():
+        zb = np.repeat(np.arange(len(zrl)), zrl)
+        nth = np.arange(len(zb)) - np.repeat(np.cumsum(zrl) - zrl, zrl)
+        keys.append(b[zb] * 4096 + k[zb] * 32 + nth)
+        codes.append(acc[comp[b[zb]], 0xF0])
+        csizes.append(acs[comp[b[zb]], 0xF0])
+        extras.append(np.zeros(len(zb), dtype=np.int64))
+        esizes.append(np.zeros(len(zb), dtype=np.int64))
+    # EOB unless the last coefficient is nonzero
+    last = np.zeros(n, dtype=np.int64)
+    last[b] = k                 # Ascending, so the last write per block wins
+    eob = np.flatnonzero(last < 63)
+    keys.append(eob * 4096 + 64 * 32)
+    codes.append(acc[comp[eob], 0])
+    csizes.append(acs[comp[eob], 0])
+    extras.append(np.zeros(len(eob), dtype=np.int64))
+    esizes.append(np.zeros(len(eob), dtype=np.int64))
+
+    keys = np.concatenate(keys)
+    order = np.argsort(keys, kind='stable')
+    csize = np.concatenate(csizes)[order]
+    if (csize == 0).any():
+        raise ValueError('AC symbol not in table')
+    esize = np.concatenate(esizes)[order]
+    values = (np.concatenate(codes)[order] << esize) | np.concatenate(extras)[order]
+    sizes = csize + esize
+    item_segment = segment[keys[order] // 4096]
+
+    # Pad every segment to a byte
+    seg_bits = np.bincount(item_segment, weights=sizes, minlength=segment[-1] + 1).astype(np.int64)
+    pad_sizes = -seg_bits % 8
+    seg_ends = np.searchsorted(item_segment, np.arange(len(seg_bits)), side='right')
+    values = np.insert(values, seg_ends, ((1 << pad_sizes) - 1) * pad)
+    sizes = np.insert(sizes, seg_ends, pad_sizes)
+    packed, total = pack_bits(values, sizes)
+
+    out = []
+    start = 0
+    for i, bits in enumerate(seg_bits + pad_sizes):
+        chunk = packed[start:start + bits // 8]
+        start += bits // 8
+        ff = np.flatnonzero(chunk == 0xFF)
+        out.append(np.insert(chunk, ff + 1, 0).tobytes())
+        if i + 1 < len(seg_bits):
+            out.append(bytes([0xFF, 0xD0 + i % 8]))
+    return b''.join(out)
+
+
+# ---------------------------------------------------------------------------
+# Context models and interleaved rANS
+
+def normalize(counts):
+    """Frequencies summing to PROB_SCALE, at least 1 each, and their cumulative sums."""
+    rows, alphabet = counts.shape
+    total = counts.sum(axis=1, keepdims=True)
+    f = 1 + counts * (PROB_SCALE - alphabet) // total
+    f[np.arange(rows), counts.argmax(axis=1)] += PROB_SCALE - f.sum(axis=1)
+    cum = np.zeros((rows, alphabet + 1), dtype=np.int64)
+    np.cumsum(f, axis=1, out=cum[:, 1:])
+    return f, cum
+
+
+class Model:
+    """Adaptive symbol counts per context. Coder and decoder update them the
+    same way after each step, so they stay identical."""
+
+    def __init__(self, contexts, alphabet, decay, weight):
+        self.alphabet = alphabet
+        # Start from `weight` counts falling by `decay` per symbol: small
+        # categories and counts are the common ones, so early frames cost less
+        prior = decay ** np.arange(alphabet)
+        prior = np.maximum(1, np.round(weight * prior / prior.sum())).astype(np.int64)
+        self.counts = np.tile(prior, (contexts, 1))
+        self.f, self.cum = normalize(self.counts)
+
+    def tables(self):
+        return self.f, self.cum
+
+    def update(self, ctx, sym):
+        seen = np.bincount(ctx * self.alphabet + sym, minlength=self.counts.size).reshape(self.counts.shape)
+        rows = np.flatnonzero(seen.any(axis=1))
+        counts = self.counts[rows] + COUNT_INC * seen[rows]
+        full = counts.sum(axis=1) > COUNT_LIMIT
+        counts[full] = (counts[full] + 1) >> 1
+        self.counts[rows] = counts
+        # Only the contexts this step used change
+        self.f[rows], self.cum[rows] = normalize(counts)
+
+
+def new_models():
+    return {
+        'nz': Model(2 * NZ_CONTEXTS, 64, 0.9, 256),
+        'dc': Model(2 * 25, 16, 0.6, 64),
+        'ac': Model(2 * 9 * 6 * 6 * 4, 16, 0.4, 512),
+    }
+
+
+class FrameGeometry:
+    """Blocks of all scan components in one list, with their neighbours."""
+
+    def __init__(self, grids):
+        cls, row, col, first = [], [], [], []
+        start = 0
+        for si, (bw, bh) in enumerate(grids):
+            r, c = np.divmod(np.arange(bw * bh), bw)
+            cls.append(np.full(bw * bh, min(si, 1)))
+            row.append(r)
+            col.append(c)
+            first.append(start)
+            start += bw * bh
+        self.n = start
+        self.cls = np.concatenate(cls)
+        self.row = np.concatenate(row)
+        self.col = np.concatenate(col)
+        width = np.concatenate([np.full(bw * bh, bw) for bw, bh in grids])
+        height = np.concatenate([np.full(bw * bh, bh) for bw, bh in grids])
+        idx = np.arange(self.n)
+        has_up = self.row > 0
+        self.up = np.where(has_up, idx - width, idx)
+        self.up_left = np.where(has_up & (self.col > 0), self.up - 1, self.up)
+        self.up_right = np.where(has_up & (self.col < width - 1), self.up + 1, self.up)
+        self.left = np.where(self.col > 0, idx - 1, idx)
+        self.right = np.where(self.col < width - 1, idx + 1, idx)
+        self.down = np.where(self.row < height - 1, idx + width, idx)
+        self.has_up = has_up
+        # Row steps: every component's row r together
+        order = np.lexsort((self.col, np.concatenate([np.full(bw * bh, si) for si, (bw, bh) in enumerate(grids)]),
+                            self.row))
+        bounds = np.searchsorted(self.row[order], np.arange(max(bh for _, bh in grids) + 1))
+        self.rows = [order[bounds[r]:bounds[r + 1]] for r in range(len(bounds) - 1)]
+
+
+def nz_context(g, nz, lanes):
+    above = (2 * nz[g.up[lanes]] + nz[g.up_left[lanes]] + nz[g.up_right[lanes]]) // 4
+    b = np.where(g.has_up[lanes], NZ_BUCKET[above], NZ_CONTEXTS - 1)
+    return g.cls[lanes] * NZ_CONTEXTS + b
+
+
+def dc_context(g, nz, rescat, lanes):
+    above = np.where(g.has_up[lanes], rescat[g.up[lanes]], 0)
+    return (g.cls[lanes] * 5 + DC_NZ_BUCKET[nz[lanes]]) * 5 + DC_CAT_BUCKET[above]
+
+
+def ac_context(g, k, rem, cats, activity, lanes):
+    local = cats[lanes, ZZ_UP[k]] + cats[lanes, ZZ_LEFT[k]]
+    ctx = (g.cls[lanes] * 9 + AC_BAND[k]) * 6 + AC_REM_BUCKET[rem[lanes]]
+    ctx = ctx * 6 + AC_LOCAL_BUCKET[local]
+    return ctx * 4 + AC_ACTIVITY_BUCKET[activity[lanes]]
+
+
+def neighbour_activity(g, nz):
+    return (nz[g.up] + nz[g.down] + nz[g.left] + nz[g.right]) // 4
+
+
+class RansEncoder:
+    """Collects (frequency, cumulative) pairs in coding order; encodes them
+    backwards at the end, one symbol per lane at a time."""
+
+    def __init__(self):
+        self.freq = []
+        self.cum = []
+
+    def put(self, f, cum, ctx, sym):
+        self.freq.append(f[ctx, sym])
+        self.cum.append(cum[ctx, sym])
+
+    def finish(self):
+        f = np.concatenate(self.freq) if self.freq else np.zeros(0, dtype=np.int64)
+        c = np.concatenate(self.cum) if self.cum else np.zeros(0, dtype=np.int64)
+        f = f.astype(np.uint64)
+        c = c.astype(np.uint64)
+        lanes = min(LANES, max(1, len(f) // LANE_SYMBOLS))
+        state = np.full(lanes, RANS_LOW, dtype=np.uint64)
+        words = []
+        for start in range(len(f) // lanes * lanes, -1, -lanes):
+            end = min(start + lanes, len(f))
+            if end <= start:
+                continue
+            fs, cs = f[start:end], c[start:end]
+            x = state[:end - start]
+            out = x >= (fs << np.uint64(32 - PROB_BITS))
+            words.append(((x[out] & np.uint64(0xFFFF)).astype(np.uint16))[::-1])
+            x[out] >>= np.uint64(16)
+            state[:end - start] = ((x // fs) << np.uint64(PROB_BITS)) + x % fs + cs
+        stream = np.concatenate(words)[::-1] if words else np.zeros(0, dtype=np.uint16)
+        return stream.astype('<u2').tobytes(), state.astype('<u4').tobytes()
+
+
+class RansDecoder:
+    def __init__(self, words, states):
+        self.words = np.frombuffer(words, dtype='<u2').astype(np.uint64)
+        self.state = np.frombuffer(states, dtype='<u4').astype(np.uint64)
+        self.ptr = 0
+        self.lanes = len(self.state)
+        self.j = 0              # Symbols decoded so far; symbol j uses lane j % lanes
+
+    def get(self, f, cum, ctx):
+        out = np.empty(len(ctx), dtype=np.int64)
+        done = 0
+        while done < len(ctx):
+            lane = self.j % self.lanes
+            n = min(len(ctx) - done, self.lanes - lane)
+            c = ctx[done:done + n]
+            x = self.state[lane:lane + n]
+            slot = (x & np.uint64(PROB_SCALE - 1)).astype(np.int64)
+            sym = (cum[c, 1:] <= slot[:, None]).sum(axis=1)
+            x = (f[c, sym].astype(np.uint64) * (x >> np.uint64(PROB_BITS))
+                 + (slot - cum[c, sym]).astype(np.uint64))
+            low = np.flatnonzero(x < RANS_LOW)
+            if len(low):
+                x[low] = (x[low] << np.uint64(16)) | self.words[self.ptr:self.ptr + len(low)]
+                self.ptr += len(low)
+            self.state[lane:lane + n] = x
+            out[done:done + n] = sym
+            done += n
+            self.j += n
+        return out
+
+
+def code_frame(models, rans, grids, coefs, decode=False):
+    """Run the model over one frame's coefficients. Coding: feeds every
+    symbol to `rans` (a RansEncoder) and returns the additional bits.
+    Decoding (`rans` a RansDecoder, `coefs` the additional bits): returns
+    the coefficients."""
+    g = FrameGeometry(grids)
+    if decode:
+        raw = coefs
+        blocks = np.zeros((g.n, 64), dtype=np.int64)
+        nz = np.zeros(g.n, dtype=np.int64)
+    else:
+        blocks = np.concatenate(coefs).astype(np.int64)
+        nz = np.count_nonzero(blocks[:, 1:], axis=1)
+    rescat = np.zeros(g.n, dtype=np.int64)
+    dc_res = np.zeros(g.n, dtype=np.int64)
+    extra_order = []            # (block, position) of every additional-bits field, in order
+    extra_cat = []
+
+    # Row steps: nonzero count, then the DC against the block above
+    for lanes in g.rows:
+        f, cum = models['nz'].tables()
+        ctx = nz_context(g, nz, lanes)
+        if decode:
+            nz[lanes] = rans.get(f, cum, ctx)
+        else:
+            rans.put(f, cum, ctx, nz[lanes])
+        models['nz'].update(ctx, nz[lanes])
+
+        f, cum = models['dc'].tables()
+        ctx = dc_context(g, nz, rescat, lanes)
+        if decode:
+            rescat[lanes] = rans.get(f, cum, ctx)
+        else:
+            dc_res[lanes] = blocks[lanes, 0] - np.where(g.has_up[lanes], blocks[g.up[lanes], 0], 0)
+            rescat[lanes] = CAT[np.abs(dc_res[lanes])]
+            rans.put(f, cum, ctx, rescat[lanes])
+        models['dc'].update(ctx, rescat[lanes])
+        extra_order.append(np.stack([lanes, np.zeros_like(lanes)], axis=1))
+        extra_cat.append(rescat[lanes])
+
+    # Coefficient steps: zig-zag position k of every block that has nonzeros left
+    cats = np.zeros((g.n, 64), dtype=np.int64)
+    rem = nz.copy()
+    activity = np.minimum(neighbour_activity(g, nz), 63)
+    for k in range(1, 64):
+        lanes = np.flatnonzero(rem)
+        if not len(lanes):
+            break
+        f, cum = models['ac'].tables()
+        ctx = ac_context(g, k, rem, cats, activity, lanes)
+        if decode:
+            sym = rans.get(f, cum, ctx)
+        else:
+            sym = CAT[np.abs(blocks[lanes, k])]
+            rans.put(f, cum, ctx, sym)
+        models['ac'].update(ctx, sym)
+        cats[lanes, k] = sym
+        rem[lanes] -= sym > 0
+        hit = lanes[sym > 0]
+        extra_order.append(np.stack([hit, np.full_like(hit, k)], axis=1))
+        extra_cat.append(sym[sym > 0])
+
+    where = np.concatenate(extra_order)
+    sizes = np.concatenate(extra_cat)
+    if not decode:
+        v = np.where(where[:, 1] == 0, dc_res[where[:, 0]], blocks[where[:, 0], where[:, 1]])
+        packed, _ = pack_bits(extra_bits(v, sizes), sizes)
+        return packed.tobytes()
+
+    offsets = np.cumsum(sizes) - sizes
+    v = from_extra_bits(read_bits(raw, offsets, sizes), sizes)
+    is_dc = where[:, 1] == 0
+    dc_res[where[is_dc, 0]] = v[is_dc]
+    blocks[where[~is_dc, 0], where[~is_dc, 1]] = v[~is_dc]
+    # DC: running sum down each column of each component
+    out = []
+    start = 0
+    for bw, bh in grids:
+        b = blocks[start:start + bw * bh]
+        b[:, 0] = np.cumsum(dc_res[start:start + bw * bh].reshape(bh, bw), axis=0).ravel()
+        out.append(b.astype(np.int32))
+        start += bw * bh
+    return out
+
+
+# ---------------------------------------------------------------------------
+# Batches
+
+def analyze(jpeg):
+    """(layout, coefficients, trailer offset, pad bit) if the frame can be
+    recompressed and comes back identical, else a reason string."""
+    try:
+        lay = parse_headers(jpeg)
+        if isinstance(lay, str):
+            return lay
+        end = scan_end(jpeg, lay.header_end)
+        scan = jpeg[lay.header_end:end]
+        coefs = decode_scan(lay, scan)
+        # DC values of an 8-bit JPEG are within +-2047; damaged data may not be
+        if max(int(np.abs(c).max(initial=0)) for c in coefs) > 2047:
+            return 'coefficients out of range'
+        for pad in (1, 0):
+            if encode_scan(lay, coefs, pad) == scan:
+                return lay, coefs, end, pad
+    except IndexError:
+        return 'scan data ends early'
+    except (ValueError, KeyError, struct.error) as e:
+        return str(e)
+    return 'does not re-encode identically'
+
+
+def _table_index(table, lookup, value):
+    i = lookup.get(value)
+    if i is None:
+        i = lookup[value] = len(table)
+        table.append(value)
+    return i
+
+
+def pack_batch(frames):
+    """Compress a list of JPEGs into one batch blob. Returns (blob, stats)."""
+    models = new_models()
+    rans = RansEncoder()
+    headers, trailers, records, bits, stored = [], [], [], [], []
+    hlookup, tlookup = {}, {}
+    reasons = {}
+    for jpeg in frames:
+        result = analyze(jpeg)
+        if isinstance(result, str):
+            reasons[result] = reasons.get(result, 0) + 1
+            records.append(struct.pack('<BBHHI', FRAME_STORED, 0, 0, 0, len(jpeg)))
+            stored.append(jpeg)
+            continue
+        lay, coefs, end, pad = result
+        grids, _ = block_grid(lay)
+        extra = code_frame(models, rans, grids, coefs)
+        h = _table_index(headers, hlookup, jpeg[:lay.header_end])
+        t = _table_index(trailers, tlookup, jpeg[end:])
+        records.append(struct.pack('<BBHHI', FRAME_CODED, pad, h, t, len(extra)))
+        bits.append(extra)
+
+    words, states = rans.finish()
+    side = io.BytesIO()
+    for table in (headers, trailers):
+        side.write(struct.pack('<H', len(table)))
+        for item in table:
+            side.write(struct.pack('<I', len(item)) + item)
+    side.write(b''.join(records))
+    side = zlib.compress(side.getvalue(), 9)
+    blob = b''.join([struct.pack('<HIII', len(frames), len(side), len(words), len(states)), side, words, states]
+                    + bits + stored)
+    return blob, reasons
+
+
+def unpack_batch(blob):
+    """The JPEGs of a batch blob, byte for byte."""
+    n, side_len, words_len, states_len = struct.unpack_from('<HIII', blob)
+    pos = struct.calcsize('<HIII')
+    side = zlib.decompress(blob[pos:pos + side_len])
+    pos += side_len
+    rans = RansDecoder(blob[pos:pos + words_len], blob[pos + words_len:pos + words_len + states_len])
+    pos += words_len + states_len
+
+    tables = []
+    p = 0
+    for _ in range(2):
+        count = struct.unpack_from('<H', side, p)[0]
+        p += 2
+        items = []
+        for _ in range(count):
+            length = struct.unpack_from('<I', side, p)[0]
+            items.append(side[p + 4:p + 4 + length])
+            p += 4 + length
+        tables.append(items)
+    headers, trailers = tables
+    records = [struct.unpack_from('<BBHHI', side, p + 10 * i) for i in range(n)]
+
+    # The coded frames' additional bits come first, then the stored frames
+    stored = pos + sum(length for kind, _, _, _, length in records if kind == FRAME_CODED)
+    models = new_models()
+    frames = []
+    for kind, pad, h, t, length in records:
+        if kind == FRAME_STORED:
+            frames.append(blob[stored:stored + length])
+            stored += length
+            continue
+        lay = parse_headers(headers[h])
+        grids, _ = block_grid(lay)
+        coefs = code_frame(models, rans, grids, blob[pos:pos + length], decode=True)
+        pos += length
+        frames.append(headers[h] + encode_scan(lay, coefs, pad) + trailers[t])
+    return frames
+
+
+# ---------------------------------------------------------------------------
+# Containers
+
+def split_avi(data):
+    """JPEG frames of an MJPEG AVI and the offsets they came from, or None."""
+    if data[:4] != b'RIFF' or data[8:12] != b'AVI ':
+        return None
+    frames = []
+    pos = 12
+    while pos + 8 <= len(data):
+        fourcc, size = data[pos:pos + 4], struct.unpack_from('<I', data, pos + 4)[0]
+        if fourcc == b'LIST':
+            if data[pos + 8:pos + 12] == b'movi':
+                p = pos + 12
+                end = min(pos + 8 + size, len(data))
+                while p + 8 <= end:
+                    cc, sz = data[p:p + 4], struct.unpack_from('<I', data, p + 4)[0]
+                    if cc[2:] in (b'dc', b'db') and data[p + 8:p + 10] == b'\xff\xd8':
+                        frames.append((p + 8, min(sz, len(data) - p - 8)))
+                    p += 8 + sz + (sz & 1)
+            pos += 12 if data[pos + 8:pos + 12] == b'hdrl' else 8 + size + (size & 1)
+            continue
+        pos += 8 + size + (size & 1)
+    return frames
+
+
+def split_input(data):
+    """(container, frames, skeleton): the skeleton is the input without the
+    frames, so the frames can be put back in place."""
+    avi = split_avi(data)
+    if avi is None:
+        return CONTAINER_JPEG, [data], b''
+    skeleton = io.BytesIO()
+    skeleton.write(struct.pack('<I', len(avi)))
+    pos = 0
+    gaps = []
+    for offset, length in avi:
+        gaps.append(data[pos:offset])
+        skeleton.write(struct.pack('<QI', offset, length))
+        pos = offset + length
+    gaps.append(data[pos:])
+    skeleton.write(b''.join(gaps))
+    return CONTAINER_AVI, [data[o:o + n] for o, n in avi], skeleton.getvalue()
+
+
+def join_output(container, frames, skeleton):
+    if container == CONTAINER_JPEG:
+        return frames[0]
+    count = struct.unpack_from('<I', skeleton)[0]
+    entries = [struct.unpack_from('<QI', skeleton, 4 + 12 * i) for i in range(count)]
+    rest = skeleton[4 + 12 * count:]
+    out = io.BytesIO()
+    src = 0
+    for (offset, length), frame in zip(entries, frames):
+        gap = offset - out.tell()
+        out.write(rest[src:src + gap])
+        src += gap
+        out.write(frame)
+    out.write(rest[src:])
+    return out.getvalue()
+
+
+def _map(pool, fn, items):
+    return list(pool.map(fn, items) if pool else map(fn, items))
+
+
+def _pack_job(frames):
+    t0 = time.process_time()
+    blob, reasons = pack_batch(frames)
+    return blob, reasons, time.process_time() - t0
+
+
+def _unpack_job(blob):
+    t0 = time.process_time()
+    frames = unpack_batch(blob)
+    return frames, time.process_time() - t0
+
+
+def pack(data, batch, pool=None):
+    """Archive bytes for one input file, with stats."""
+    container, frames, skeleton = split_input(data)
+    batches = [frames[i:i + batch] for i in range(0, len(frames), batch)]
+    results = _map(pool, _pack_job, batches)
+    stats = {'frames': len(frames), 'reasons': {}, 'cpu': 0.0}
+    out = io.BytesIO()
+    out.write(MAGIC + struct.pack('<BBQI', VERSION, container, len(data), zlib.crc32(data)))
+    skeleton = zlib.compress(skeleton, 9)
+    out.write(struct.pack('<II', len(skeleton), len(batches)) + skeleton)
+    for blob, reasons, cpu in results:
+        out.write(struct.pack('<I', len(blob)) + blob)
+        stats['cpu'] += cpu
+        for r, n in reasons.items():
+            stats['reasons'][r] = stats['reasons'].get(r, 0) + n
+    return out.getvalue(), stats
+
+
+def unpack(archive, pool=None):
+    """The original file of an archive, with the CPU seconds it took."""
+    if archive[:4] != MAGIC:
+        raise ValueError('not a frame archive')
+    version, container, size, crc = struct.unpack_from('<BBQI', archive, 4)
+    if version != VERSION:
+        raise ValueError('archive version %d' % version)
+    pos = 4 + struct.calcsize('<BBQI')
+    skel_len, count = struct.unpack_from('<II', archive, pos)
+    pos += 8
+    skeleton = zlib.decompress(archive[pos:pos + skel_len])
+    pos += skel_len
+    blobs = []
+    for _ in range(count):
+        length = struct.unpack_from('<I', archive, pos)[0]
+        blobs.append(archive[pos + 4:pos + 4 + length])
+        pos += 4 + length
+    frames, cpu = [], 0.0
+    for batch, seconds in _map(pool, _unpack_job, blobs):
+        frames += batch
+        cpu += seconds
+    data = join_output(container, frames, skeleton)
+    if len(data) != size or zlib.crc32(data) != crc:
+        raise ValueError('restored data does not match the original')
+    return data, cpu
+
+
+# ---------------------------------------------------------------------------
+# Commands
+
+def _pool(jobs):
+    """Worker processes, or None to work in this one."""
+    return ProcessPoolExecutor(max_workers=jobs) if jobs != 1 else contextlib.nullcontext()
+
+
+def cmd_pack(args):
+    os.makedirs(args.output, exist_ok=True)
+    with _pool(args.jobs) as pool:
+        for path in args.files:
+            with open(path, 'rb') as f:
+                data = f.read()
+            t0 = time.monotonic()
+            archive, stats = pack(data, args.batch, pool)
+            out = os.path.join(args.output, os.path.basename(path) + '.wsja')
+            with open(out, 'wb') as f:
+                f.write(archive)
+            stored = sum(stats['reasons'].values())
+            print('%s: %d frames, %d -> %d bytes (%.1f%% saved), %d stored as-is, %.1f s'
+                  % (path, stats['frames'], len(data), len(archive), 100 * (1 - len(archive) / max(len(data), 1)),
+                     stored, time.monotonic() - t0))
+            for reason, n in sorted(stats['reasons'].items()):
+                print('  %d stored: %s' % (n, reason))
+
+
+def cmd_unpack(args):
+    os.makedirs(args.output, exist_ok=True)
+    with _pool(args.jobs) as pool:
+        for path in args.files:
+            with open(path, 'rb') as f:
+                data, _ = unpack(f.read(), pool)
+            name = os.path.basename(path)
+            out = os.path.join(args.output, name[:-5] if name.endswith('.wsja') else name + '.out')
+            with open(out, 'wb') as f:
+                f.write(data)
+            print('%s -> %s (%d bytes)' % (path, out, len(data)))
+
+
+def synthetic_scene(rng, width, height, t):
+    """A frame from a moving train: sky, a hill line, trees and grass that
+    slide by, sensor noise."""
+    yy, xx = np.mgrid[0:height, 0:width].astype(np.float64)
+    shift = 7.0 * t
+    horizon = height * (0.45 + 0.08 * np.sin((xx + shift) / 97.0) + 0.03 * np.sin((xx + shift) / 23.0))
+    sky = 200 - 60 * yy / height
+    ground = 90 + 25 * np.sin((xx + 3 * shift) / 5.0) * np.sin(yy / 3.0) + 20 * np.sin((xx + 3 * shift) / 41.0)
+    grey = np.where(yy < horizon, sky, ground)
+    for i in range(6):
+        cx = (i * 173 + 2.5 * shift) % (width + 120) - 60
+        trunk = (np.abs(xx - cx) < 5) & (yy > horizon - 80) & (yy < horizon + 10)
+        crown = (xx - cx) ** 2 + (yy - (horizon - 90)) ** 2 < 45 ** 2
+        grey = np.where(crown, 60 + 20 * np.sin(xx / 3.0 + yy / 4.0), grey)
+        grey = np.where(trunk, 50, grey)
+    grey = grey + rng.normal(0, 3, grey.shape)
+    img = np.stack([grey * 0.9, grey, grey * 0.8 + 20 * (yy < horizon)], axis=2)
+    return np.clip(img, 0, 255).astype(np.uint8)
+
+
+def encode_jpeg(img, quality=60, subsampling='4:2:2', optimize=False, progressive=False, restart=0):
+    """Encode an RGB frame with OpenCV, or Pillow if OpenCV is missing."""
+    try:
+        import cv2
+        params = [cv2.IMWRITE_JPEG_QUALITY, quality, cv2.IMWRITE_JPEG_OPTIMIZE, int(optimize),
+                  cv2.IMWRITE_JPEG_PROGRESSIVE, int(progressive), cv2.IMWRITE_JPEG_RST_INTERVAL, restart]
+        factor = {'4:4:4': 0x111111, '4:2:2': 0x211111, '4:2:0': 0x221111}[subsampling]
+        params += [cv2.IMWRITE_JPEG_SAMPLING_FACTOR, factor]
+        if img.ndim == 2:
+            ok, data = cv2.imencode('.jpg', img, params)
+        else:
+            ok, data = cv2.imencode('.jpg', img[:, :, ::-1], params)
+        return data.tobytes()
+    except ImportError:
+        from PIL import Image
+        out = io.BytesIO()
+        kw = {'quality': quality, 'optimize': optimize, 'progressive': progressive}
+        if img.ndim == 3:
+            kw['subsampling'] = subsampling
+        if restart:
+            kw['restart_marker_blocks'] = restart
+        Image.fromarray(img).save(out, 'JPEG', **kw)
+        return out.getvalue()
+
+
+def load_frames(paths):
+    frames = []
+    for path in paths:
+        with open(path, 'rb') as f:
+            data = f.read()
+        frames += split_input(data)[1]
+    return frames
+
+
+def cmd_bench(args):
+    if args.files:
+        frames = load_frames(args.files)
+        source = ', '.join(args.files)
+    else:
+        rng = np.random.default_rng(1)
+        frames = [encode_jpeg(synthetic_scene(rng, args.width, args.height, t), args.quality)
+                  for t in range(args.frames)]
+        source = '%d synthetic %dx%d frames at quality %d' % (len(frames), args.width, args.height, args.quality)
+    total = sum(len(f) for f in frames)
+    batches = [frames[i:i + args.batch] for i in range(0, len(frames), args.batch)]
+    with _pool(args.jobs) as pool:
+        t0 = time.monotonic()
+        packed = _map(pool, _pack_job, batches)
+        pack_wall = time.monotonic() - t0
+        t0 = time.monotonic()
+        unpacked = _map(pool, _unpack_job, [b for b, _, _ in packed])
+        unpack_wall = time.monotonic() - t0
+
+    size = sum(len(b) + 4 for b, _, _ in packed)
+    restored = [f for batch, _ in unpacked for f in batch]
+    mismatches = sum(a != b for a, b in zip(frames, restored)) + abs(len(frames) - len(restored))
+    reasons = {}
+    for _, r, _ in packed:
+        for k, v in r.items():
+            reasons[k] = reasons.get(k, 0) + v
+    pack_cpu = sum(c for _, _, c in packed)
+    unpack_cpu = sum(c for _, c in unpacked)
+    mb = total / 1e6
+    print('%s: %d frames, %.2f MB, %d per batch' % (source, len(frames), mb, args.batch))
+    print('ratio %.3f (%.1f%% saved), %d stored as-is%s' % (
+        size / total, 100 * (1 - size / total), sum(reasons.values()),
+        ''.join('\n  %d: %s' % (v, k) for k, v in sorted(reasons.items()))))
+    print('pack   %.2f MB/s per core, %.2f MB/s on %d workers' % (mb / pack_cpu, mb / pack_wall,
+                                                                args.jobs or os.cpu_count()))
+    print('unpack %.2f MB/s per core, %.2f MB/s on %d workers' % (mb / unpack_cpu, mb / unpack_wall,
+                                                                  args.jobs or os.cpu_count()))
+    print('round trip: %s' % ('%d frames differ' % mismatches if mismatches else 'all frames identical'))
+    return 1 if mismatches else 0
+
+
+def cmd_test(args):
+    """Round trips that must come back byte for byte."""
+    from mjpeg_avi import MjpegAviWriter
+    import tempfile
+    rng = np.random.default_rng(2)
+    failures = 0
+
+    def check(name, frames, want_stored=0):
+        nonlocal failures
+        blob, reasons = pack_batch(frames)
+        back = unpack_batch(blob)
+        stored = sum(reasons.values())
+        ok = back == frames and stored == want_stored
+        failures += not ok
+        print('%-34s %s  %6d -> %6d bytes, %d stored%s' % (
+            name, 'ok  ' if ok else 'FAIL', sum(map(len, frames)), len(blob), stored,
+            ''.join(' (%s)' % r for r in reasons)))
+
+    scenes = [synthetic_scene(rng, 320, 240, t) for t in range(4)]
+    odd = synthetic_scene(rng, 203, 117, 0)
+    for sub in ('4:2:2', '4:2:0', '4:4:4'):
+        check('%s quality 60' % sub, [encode_jpeg(s, 60, sub) for s in scenes])
+    check('quality 95, odd size', [encode_jpeg(odd, 95, '4:2:0')])
+    check('quality 10', [encode_jpeg(s, 10) for s in scenes[:2]])
+    check('optimized Huffman tables', [encode_jpeg(s, 75, optimize=True) for s in scenes[:2]])
+    check('restart markers', [encode_jpeg(s, 60, restart=3) for s in scenes[:2]])
+    check('greyscale', [encode_jpeg(s[:, :, 1], 60) for s in scenes[:2]])
+    flat = np.full((64, 64, 3), 128, dtype=np.uint8)
+    check('flat frame', [encode_jpeg(flat, 50)])
+    noise = rng.integers(0, 256, (64, 96, 3), dtype=np.uint8)
+    check('noise at quality 100', [encode_jpeg(noise, 100, '4:4:4')])
+    base = encode_jpeg(scenes[0], 60)
+    check('junk after EOI', [base + b'\0' * 37, base + b'\xff\xd9junk'])
+    check('progressive (stored)', [encode_jpeg(scenes[0], 60, progressive=True)], 1)
+    check('truncated (stored)', [base[:len(base) // 2]], 1)
+    check('not a JPEG (stored)', [b'hello'], 1)
+    check('mixed batch', [base, base[:100], encode_jpeg(odd, 40, '4:4:4'), base], 1)
+    check('empty batch', [])
+
+    with tempfile.TemporaryDirectory() as tmp:
+        path = os.path.join(tmp, 'rec.avi')
+        writer = MjpegAviWriter(path, fps=15)
+        for i, s in enumerate(scenes):
+            jpeg = encode_jpeg(s, 60)
+            # One odd-sized frame, so the chunk pad byte is covered
+            writer.write(jpeg + b'\0' * (i == 0 and len(jpeg) % 2 == 0))
+        writer.close()
+        with open(path, 'rb') as f:
+            data = f.read()
+        archive, stats = pack(data, 3)
+        ok = unpack(archive)[0] == data and stats['frames'] == len(scenes) and not stats['reasons']
+        failures += not ok
+        print('%-34s %s  %6d -> %6d bytes' % ('AVI container, 2 batches', 'ok  ' if ok else 'FAIL', len(data),
+                                                len(archive)))
+    print('all round trips identical' if not failures else '%d check(s) failed' % failures)
+    return 1 if failures else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest='command', required=True)
+    p = sub.add_parser('pack', help='compress AVI recordings or JPEG files into archives')
+    p.add_argument('files', nargs='+')
+    p.add_argument('-o', '--output', required=True, help='directory for the .wsja archives')
+    p = sub.add_parser('unpack', help='restore the original files from archives')
+    p.add_argument('files', nargs='+')
+    p.add_argument('-o', '--output', required=True, help='directory for the restored files')
+    p = sub.add_parser('bench', help='compression ratio and MB/s per core, with a round-trip check')
+    p.add_argument('files', nargs='*', help='AVI recordings or JPEGs (default: synthetic frames)')
+    p.add_argument('--frames', type=int, default=64, help='synthetic frames')
+    p.add_argument('--width', type=int, default=800)
+    p.add_argument('--height', type=int, default=600)
+    p.add_argument('--quality', type=int, default=60)
+    p = sub.add_parser('test', help='round-trip checks on generated frames')
+    for name in ('pack', 'unpack', 'bench'):
+        sp = sub.choices[name]
+        sp.add_argument('--jobs', type=int, default=0, help='worker processes (default: one per core)')
+    for name in ('pack', 'bench'):
+        sub.choices[name].add_argument('--batch', type=int, default=DEFAULT_BATCH, help='frames per batch')
+    args = parser.parse_args()
+    if getattr(args, 'jobs', 1) == 0:
+        args.jobs = os.cpu_count()
+
+    return {'pack': cmd_pack, 'unpack': cmd_unpack, 'bench': cmd_bench, 'test': cmd_test}[args.command](args)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
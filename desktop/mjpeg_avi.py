@@ -0,0 +1,129 @@
+"""Minimal MJPEG AVI writer.
+
+Stores the camera's JPEGs as-is in an AVI 1.0 container (no re-encoding),
+so any player that handles MJPEG can open the recording. Files are rolled
+over before they reach the AVI 1.0 size limit.
+"""
+
+import os
+import struct
+
+from chunk_protocol import jpeg_dimensions
+
+MAX_FILE_BYTES = 1 << 30  # Stay well under the 2 GB AVI 1.0 limit
+AVIIF_KEYFRAME = 0x10
+
+
+class MjpegAviWriter:
+    def __init__(self, path, fps=15):
+        self.path = path
+        self.fps = fps
+        self.file = open(path, 'wb')
+        self.index = []
+        self.width = 0
+        self.height = 0
+        self.max_frame = 0
+        self._write_headers()
+
+    def _write_headers(self):
+        f = self.file
+        f.write(b'RIFF\0\0\0\0AVI ')
+        # hdrl: avih + strl(strh, strf), patched on close
+        f.write(b'LIST' + struct.pack('<I', 4 + 64 + 12 + 64 + 48) + b'hdrl')
+        self._avih_pos = f.tell()
+        f.write(b'avih' + struct.pack('<I', 56) + bytes(56))
+        f.write(b'LIST' + struct.pack('<I', 4 + 64 + 48) + b'strl')
+        self._strh_pos = f.tell()
+        f.write(b'strh' + struct.pack('<I', 56) + bytes(56))
+        self._strf_pos = f.tell()
+        f.write(b'strf' + struct.pack('<I', 40) + bytes(40))
+        self._movi_pos = f.tell()
+        f.write(b'LIST\0\0\0\0movi')
+
+    def size(self):
+        return self.file.tell()
+
+    def write(self, jpeg):
+        if not self.width:
+            dims = jpeg_dimensions(jpeg)
+            if dims:
+                self.width, self.height = dims
+        f = self.file
+        # idx1 offsets are relative to the 'movi' fourcc
+        offset = f.tell() - (self._movi_pos + 8)
+        f.write(b'00dc' + struct.pack('<I', len(jpeg)))
+        f.write(jpeg)
+        if len(jpeg) & 1:
+            f.write(b'\0')
+        self.index.append((offset, len(jpeg)))
+        self.max_frame = max(self.max_frame, len(jpeg))
+
+    def close(self):
+        f = self.file
+        movi_end = f.tell()
+        f.write(b'idx1' + struct.pack('<I', 16 * len(self.index)))
+        for offset, length in self.index:
+            f.write(b'00dc' + struct.pack('<III', AVIIF_KEYFRAME, offset, length))
+        end = f.tell()
+
+        frames = len(self.index)
+        usec_per_frame = int(1000000 / self.fps) if self.fps else 0
+        f.seek(4)
+        f.write(struct.pack('<I', end - 8))
+        f.seek(self._movi_pos + 4)
+        f.write(struct.pack('<I', movi_end - self._movi_pos - 8))
+
+        f.seek(self._avih_pos + 8)
+        f.write(struct.pack('<IIIIIIIIII16x',
+            usec_per_frame,                      # dwMicroSecPerFrame
+            self.max_frame * max(int(self.fps), 1),  # dwMaxBytesPerSec
+            0,                                   # dwPaddingGranularity
+            0x10,                                # dwFlags: AVIF_HASINDEX
+            frames,                              # dwTotalFrames
+            0,                                   # dwInitialFrames
+            1,                                   # dwStreams
+            self.max_frame,                      # dwSuggestedBufferSize
+            self.width, self.height))
+
+        f.seek(self._strh_pos + 8)
+        f.write(b'vids' + b'MJPG' + struct.pack('<IHHIIIIIIIIhhhh',
+            0, 0, 0, 0,                          # flags, priority, language, initial frames
+            1, max(int(self.fps), 1),            # dwScale, dwRate
+            0, frames,                           # dwStart, dwLength
+            self.max_frame, 0xFFFFFFFF, 0,       # buffer size, quality, sample size
+            0, 0, self.width, self.height))      # rcFrame
+
+        f.seek(self._strf_pos + 8)
+        f.write(struct.pack('<IiiHH4sIiiII',
+            40, self.width, self.height, 1, 24, b'MJPG',
+            self.width * self.height * 3, 0, 0, 0, 0))
+
+        f.close()
+
+
+class RollingAviWriter:
+    """Writes numbered AVI segments (name_0000.avi, ...) to a directory."""
+
+    def __init__(self, directory, name, fps=15, max_bytes=MAX_FILE_BYTES):
+        os.makedirs(directory, exist_ok=True)
+        self.directory = directory
+        self.name = name
+        self.fps = fps
+        self.max_bytes = max_bytes
+        self.segment = 0
+        self.writer = None
+
+    def write(self, jpeg):
+        if self.writer and self.writer.size() + len(jpeg) > self.max_bytes:
+            self.writer.close()
+            self.writer = None
+            self.segment += 1
+        if self.writer is None:
+            path = os.path.join(self.directory, '%s_%04d.avi' % (self.name, self.segment))
+            self.writer = MjpegAviWriter(path, self.fps)
+        self.writer.write(jpeg)
+
+    def close(self):
+        if self.writer:
+            self.writer.close()
+            self.writer = None
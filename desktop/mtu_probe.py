@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+"""Find the largest UDP datagram that reaches this host unfragmented, and
+have the camera size its chunks for it.
+
+Subscribes to the camera's chunked stream, asks it for path probes
+(/rtp/probe), and reports which probe sizes arrived whole, fragmented or not
+at all. With --apply it sets the best size on the session (/rtp/probe?size=)
+and starts it playing, so a receiver on --port gets the resized stream;
+otherwise the session is torn down again. IP fragments are detected with
+IP_RECVFRAGSIZE, which needs Linux 4.10 or later.
+
+    python mtu_probe.py --camera train.local --port 5005
+    python mtu_probe.py --camera train.local --port 5005 --proto gcm --apply
+"""
+
+import argparse
+import json
+import sys
+import urllib.request
+
+from chunk_protocol import (HEADER_SIZE, PROBE_MAX, PROBE_MIN, PROBE_WAIT, best_datagram, collect_probes,
+                            open_receiver, report_fragments)
+
+API_TIMEOUT = 5.0
+
+
+def probe_session(api, session, sock, wait=PROBE_WAIT):
+    """Probe the path of a session whose stream arrives on sock, a blocking
+    socket with report_fragments(). Returns the best datagram size (None if
+    no probe came through) and the (datagram, fragmented) pairs received."""
+    api('/rtp/probe?session=%d' % session)
+    probes = collect_probes(sock, wait)
+    return best_datagram(probes), probes
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--camera', default='train.local', help='camera hostname or address')
+    parser.add_argument('--api-port', type=int, default=80)
+    parser.add_argument('--port', type=int, default=5005, help='local UDP port for the stream')
+    parser.add_argument('--proto', choices=('chunk', 'gcm'), default='chunk')
+    parser.add_argument('--apply', action='store_true', help='set the size found and play the session')
+    args = parser.parse_args()
+
+    def api(path):
+        url = 'http://%s:%d%s' % (args.camera, args.api_port, path)
+        return json.load(urllib.request.urlopen(url, timeout=API_TIMEOUT))
+
+    sock = open_receiver(args.port)
+    if not report_fragments(sock):
+        print('warning: no IP_RECVFRAGSIZE here, fragmented probes will look whole', file=sys.stderr)
+    session = api('/rtp/setup?port=%d&proto=%s' % (args.port, args.proto))['session']
+    try:
+        best, probes = probe_session(api, session, sock)
+    except BaseException:
+        api('/rtp/teardown?session=%d' % session)
+        raise
+
+    def sizes(fragmented):
+        found = sorted({len(p) for p, f in probes if f == fragmented}, reverse=True)
+        return ', '.join(map(str, found[:6])) + (' ...' if len(found) > 6 else '') if found else '-'
+
+    print('session %d: %d probes of %d..%d bytes received' % (session, len(probes), PROBE_MIN, PROBE_MAX))
+    print('  whole:      %s' % sizes(False))
+    print('  fragmented: %s' % sizes(True))
+    if best is None:
+        print('no probe arrived unfragmented; the camera keeps udp_chunk')
+    else:
+        print('best datagram: %d bytes (%d bytes of JPEG per chunked packet)' % (best, best - HEADER_SIZE))
+
+    if args.apply and best is not None:
+        api('/rtp/probe?session=%d&size=%d' % (session, best))
+        api('/rtp/play?session=%d' % session)
+        print('session %d playing to port %d; /rtp/teardown?session=%d stops it' % (session, args.port, session))
+    else:
+        api('/rtp/teardown?session=%d' % session)
+    return 0 if best is not None else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,311 @@
+#!/usr/bin/env python3
+"""Goodput of the chunked UDP stream across path MTUs, with fixed and
+probed chunk sizes.
+
+Builds a small network in Linux namespaces: a fake camera, a router, and a
+receiver behind a rate-limited link whose MTU the test varies. No root is
+needed; the test re-runs itself under `unshare -rn`. The fake camera speaks
+the camera's API (/rtp/setup, /rtp/probe, /rtp/play, /rtp/teardown) and
+sends like lwIP does, without DF, so a datagram larger than the path MTU is
+fragmented by the router. For each MTU the receiver takes the stream
+twice: once with the camera's default datagram (udp_chunk 1400, 1408 bytes)
+and once with the size found by probing (mtu_probe.py). "frag-drop" runs
+add a router that drops IP fragments, as some firewalls and tunnels do.
+Prints goodput (JPEG bytes of complete frames) and frame loss per run.
+
+    python mtu_test.py
+    python mtu_test.py --mtu 1500 1400 1280 --fps 30 --seconds 5
+"""
+
+import argparse
+import json
+import os
+import shutil
+import socket
+import subprocess
+import sys
+import threading
+import time
+import urllib.parse
+import urllib.request
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+from chunk_protocol import (CHUNK_SIZE, FRAME_ID_MOD, HEADER_SIZE, PROBE_MAX, PROBE_MIN, FrameAssembler,
+                            open_receiver, pack_chunks, pack_probes, report_fragments)
+from mtu_probe import probe_session
+
+NS_ENV = 'MTU_TEST_NS'
+CAMERA_IP = '10.77.1.2'
+API_PORT = 8080
+STREAM_PORT = 5005
+IP_MTU_DISCOVER = getattr(socket, 'IP_MTU_DISCOVER', 10)
+IP_PMTUDISC_DONT = getattr(socket, 'IP_PMTUDISC_DONT', 0)
+
+
+# ---------------------------------------------------------------------------
+# Fake camera (camera namespace)
+
+class FakeCamera:
+    """The camera's UDP sessions, chunked protocol only."""
+
+    def __init__(self, fps, frame_bytes):
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        # lwIP never sets DF: let routers fragment
+        self.sock.setsockopt(socket.IPPROTO_IP, IP_MTU_DISCOVER, IP_PMTUDISC_DONT)
+        self.sessions = {}  # id -> {'addr', 'datagram', 'playing'}
+        self.next_session = 1
+        self.lock = threading.Lock()
+        self.fps = fps
+        self.frame = os.urandom(frame_bytes)
+
+    def request(self, path, client):
+        url = urllib.parse.urlsplit(path)
+        query = dict(urllib.parse.parse_qsl(url.query))
+        with self.lock:
+            if url.path == '/rtp/setup':
+                session = self.next_session
+                self.next_session += 1
+                addr = (query.get('host', client), int(query['port']))
+                self.sessions[session] = {'addr': addr, 'datagram': 0, 'playing': False}
+                return {'session': session, 'proto': 'chunk'}
+            s = self.sessions.get(int(query.get('session', -1)))
+            if s is None:
+                return None
+            if url.path == '/rtp/play':
+                s['playing'] = True
+            elif url.path == '/rtp/teardown':
+                del self.sessions[int(query['session'])]
+            elif url.path == '/rtp/probe' and 'size' in query:
+                size = int(query['size'])
+                if size and not PROBE_MIN <= size <= PROBE_MAX:
+                    return None
+                s['datagram'] = size
+                return {'session': int(query['session']), 'datagram': size}
+            elif url.path == '/rtp/probe':
+                addr = s['addr']
+            else:
+                return None
+        if url.path != '/rtp/probe':
+            return {'session': int(query['session']), 'result': 'ok'}
+        # udp_probe(): the ladder, paced
+        sent = 0
+        for sent, probe in enumerate(pack_probes(), 1):
+            self.sock.sendto(probe, addr)
+            if sent % 4 == 0:
+                time.sleep(0.001)
+        return {'session': int(query['session']), 'probes': sent, 'min': PROBE_MIN, 'max': PROBE_MAX}
+
+    def stream(self):
+        frame_id = 0
+        next_frame = time.monotonic()
+        while True:
+            with self.lock:
+                targets = [(s['addr'], s['datagram'] or CHUNK_SIZE + HEADER_SIZE)
+                           for s in self.sessions.values() if s['playing']]
+            for addr, datagram in targets:
+                for packet in pack_chunks(frame_id, self.frame, datagram - HEADER_SIZE):
+                    self.sock.sendto(packet, addr)
+            frame_id = (frame_id + 1) % FRAME_ID_MOD
+            next_frame += 1.0 / self.fps
+            time.sleep(max(0.0, next_frame - time.monotonic()))
+
+
+def run_camera(args):
+    camera = FakeCamera(args.fps, args.frame_kb * 1024)
+
+    class Handler(BaseHTTPRequestHandler):
+        def do_GET(self):
+            reply = camera.request(self.path, self.client_address[0])
+            body = json.dumps(reply).encode() if reply else b'Unknown session'
+            self.send_response(200 if reply else 404)
+            self.send_header('Content-Type', 'application/json')
+            self.send_header('Content-Length', str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+
+        def log_message(self, *args):
+            pass
+
+    threading.Thread(target=camera.stream, daemon=True).start()
+    ThreadingHTTPServer((CAMERA_IP, API_PORT), Handler).serve_forever()
+
+
+# ---------------------------------------------------------------------------
+# Receiver (receiver namespace)
+
+def run_receiver(args):
+    def api(path):
+        url = 'http://%s:%d%s' % (CAMERA_IP, API_PORT, path)
+        return json.load(urllib.request.urlopen(url, timeout=5))
+
+    sock = open_receiver(STREAM_PORT)
+    report_fragments(sock)
+    session = api('/rtp/setup?port=%d' % STREAM_PORT)['session']
+    datagram = CHUNK_SIZE + HEADER_SIZE
+    if args.probe:
+        best, _ = probe_session(api, session, sock)
+        if best:
+            api('/rtp/probe?session=%d&size=%d' % (session, best))
+            datagram = best
+    api('/rtp/play?session=%d' % session)
+
+    rx = FrameAssembler()
+    sock.settimeout(0.2)
+    # Count from half a second in, once the stream has settled
+    start = time.monotonic() + 0.5
+    deadline = start + args.seconds
+    base = None
+    jpeg_bytes = 0
+    while time.monotonic() < deadline:
+        if base is None and time.monotonic() >= start:
+            base = (rx.frames_completed, rx.frames_lost)
+        try:
+            jpeg = rx.push(sock.recv(65535))
+        except socket.timeout:
+            continue
+        if jpeg is not None and base is not None:
+            jpeg_bytes += len(jpeg)
+    api('/rtp/teardown?session=%d' % session)
+    print(json.dumps({'datagram': datagram, 'frames': rx.frames_completed - base[0], 'lost': rx.frames_lost - base[1],
+                      'goodput': jpeg_bytes * 8 / args.seconds / 1e6}))
+
+
+# ---------------------------------------------------------------------------
+# Topology (router namespace)
+
+def sh(*cmd):
+    subprocess.run(cmd, check=True, stdout=subprocess.DEVNULL)
+
+
+class Network:
+    """camera (10.77.1.2) -- router -- receiver (10.77.2.2). The router's
+    link to the receiver carries the MTU and the rate limit."""
+
+    def __init__(self):
+        self.holders = []
+        self.camera = self.namespace()
+        self.receiver = self.namespace()
+        for name, pid, subnet in (('cam', self.camera, 1), ('rx', self.receiver, 2)):
+            sh('ip', 'link', 'add', name + '0', 'type', 'veth', 'peer', 'name', name + '1')
+            sh('ip', 'link', 'set', name + '1', 'netns', str(pid))
+            sh('ip', 'addr', 'add', '10.77.%d.1/24' % subnet, 'dev', name + '0')
+            sh('ip', 'link', 'set', name + '0', 'up')
+            inside = self.enter(pid)
+            sh(*inside, 'ip', 'addr', 'add', '10.77.%d.2/24' % subnet, 'dev', name + '1')
+            sh(*inside, 'ip', 'link', 'set', name + '1', 'up')
+            sh(*inside, 'ip', 'link', 'set', 'lo', 'up')
+            sh(*inside, 'ip', 'route', 'add', 'default', 'via', '10.77.%d.1' % subnet)
+        with open('/proc/sys/net/ipv4/ip_forward', 'w') as f:
+            f.write('1')
+
+    def namespace(self):
+        holder = subprocess.Popen(['unshare', '-n', 'sleep', 'infinity'])
+        self.holders.append(holder)
+        for _ in range(100):
+            if os.readlink('/proc/%d/ns/net' % holder.pid) != os.readlink('/proc/self/ns/net'):
+                return holder.pid
+            time.sleep(0.01)
+        raise RuntimeError('namespace did not come up')
+
+    @staticmethod
+    def enter(pid):
+        return ['nsenter', '-t', str(pid), '-n']
+
+    def shape(self, mtu, rate_mbit, queue, drop_fragments):
+        """Router to receiver: MTU, an HTB rate limit with a queue of `queue`
+        packets, and optionally a class that starves first fragments (MF set)
+        so their datagrams never arrive."""
+        sh('ip', 'link', 'set', 'rx0', 'mtu', str(mtu))
+        subprocess.run(['tc', 'qdisc', 'del', 'dev', 'rx0', 'root'], stderr=subprocess.DEVNULL)
+        sh('tc', 'qdisc', 'add', 'dev', 'rx0', 'root', 'handle', '1:', 'htb', 'default', '10')
+        sh('tc', 'class', 'add', 'dev', 'rx0', 'parent', '1:', 'classid', '1:10', 'htb',
+           'rate', '%gmbit' % rate_mbit)
+        sh('tc', 'qdisc', 'add', 'dev', 'rx0', 'parent', '1:10', 'pfifo', 'limit', str(queue))
+        if drop_fragments:
+            sh('tc', 'class', 'add', 'dev', 'rx0', 'parent', '1:', 'classid', '1:99', 'htb', 'rate', '8bit',
+               'quantum', '1514')
+            sh('tc', 'qdisc', 'add', 'dev', 'rx0', 'parent', '1:99', 'pfifo', 'limit', '1')
+            sh('tc', 'filter', 'add', 'dev', 'rx0', 'parent', '1:', 'protocol', 'ip', 'u32',
+               'match', 'u16', '0x2000', '0x2000', 'at', '6', 'flowid', '1:99')
+
+    def close(self):
+        for holder in self.holders:
+            holder.kill()
+            holder.wait()
+
+
+def role_args(args):
+    return ['--fps', str(args.fps), '--frame-kb', str(args.frame_kb), '--seconds', str(args.seconds)]
+
+
+def run_test(args):
+    for tool in ('ip', 'tc', 'nsenter', 'unshare'):
+        if not shutil.which(tool):
+            print('%s not found' % tool, file=sys.stderr)
+            return 2
+    net = Network()
+    script = os.path.abspath(__file__)
+    camera = subprocess.Popen(net.enter(net.camera) + [sys.executable, script, '--role', 'camera'] + role_args(args))
+    try:
+        time.sleep(0.5)
+        offered = args.frame_kb * 1024 * 8 * args.fps / 1e6
+        print('%d KB frames at %g fps (%.1f Mbit/s of JPEG), %g Mbit/s link, %d-packet queue'
+              % (args.frame_kb, args.fps, offered, args.rate, args.queue))
+        print('%-14s %-7s %9s %9s %7s %11s' % ('path', 'chunks', 'datagram', 'frames', 'lost', 'goodput'))
+        failures = 0
+        for mtu in args.mtu:
+            for drop_fragments in (False, True):
+                if drop_fragments and mtu >= CHUNK_SIZE + HEADER_SIZE + 28:
+                    continue  # Nothing is fragmented: same as the plain run
+                net.shape(mtu, args.rate, args.queue, drop_fragments)
+                path = '%d%s' % (mtu, ' frag-drop' if drop_fragments else '')
+                results = {}
+                for mode in ('fixed', 'probed'):
+                    cmd = [sys.executable, script, '--role', 'receive'] + role_args(args)
+                    if mode == 'probed':
+                        cmd.append('--probe')
+                    out = subprocess.run(net.enter(net.receiver) + cmd, check=True, capture_output=True, text=True)
+                    r = results[mode] = json.loads(out.stdout.splitlines()[-1])
+                    total = r['frames'] + r['lost']
+                    print('%-14s %-7s %9d %9d %6.1f%% %6.2f Mbit/s' % (path, mode, r['datagram'], r['frames'],
+                          100.0 * r['lost'] / total if total else 100.0, r['goodput']))
+                # Probing must land on the rung of the ladder just below the
+                # path MTU, and never do worse than the default
+                fixed, probed = results['fixed'], results['probed']
+                limit, size = min(mtu - 28, PROBE_MAX), probed['datagram']
+                rung = size > limit or size + (8 if size >= 1280 else 64) <= limit
+                if rung or probed['goodput'] < 0.95 * fixed['goodput']:
+                    print('FAIL: probing on a %s path' % path)
+                    failures += 1
+        return 1 if failures else 0
+    finally:
+        camera.kill()
+        camera.wait()
+        net.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--mtu', type=int, nargs='+', default=[1500, 1400, 1280], help='path MTUs to test')
+    parser.add_argument('--rate', type=float, default=8, help='link rate, Mbit/s')
+    parser.add_argument('--queue', type=int, default=64, help="router queue, packets")
+    parser.add_argument('--fps', type=float, default=25)
+    parser.add_argument('--frame-kb', type=int, default=30, help='JPEG size, KB')
+    parser.add_argument('--seconds', type=float, default=3, help='length of each run')
+    parser.add_argument('--role', choices=('camera', 'receive'), help=argparse.SUPPRESS)
+    parser.add_argument('--probe', action='store_true', help=argparse.SUPPRESS)
+    args = parser.parse_args()
+
+    if args.role == 'camera':
+        return run_camera(args)
+    if args.role == 'receive':
+        return run_receiver(args)
+    if os.environ.get(NS_ENV) != '1':
+        # Fresh user and network namespaces: this process becomes the router
+        os.environ[NS_ENV] = '1'
+        os.execvp('unshare', ['unshare', '-rn', sys.executable, os.path.abspath(__file__)] + sys.argv[1:])
+    return run_test(args)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
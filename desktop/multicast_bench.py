@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+"""Unicast vs. multicast fan-out benchmark on one host.
+
+Runs a simulated camera sender and N receivers over loopback (or any
+interface), first sending a separate unicast copy to each receiver as the
+camera does for subscribed targets, then sending once to a multicast group
+all receivers have joined. Reports the sender's CPU time and bytes sent
+(a proxy for airtime on the camera's WiFi link) per viewer count.
+
+    python multicast_bench.py --viewers 1 2 4 8 --fps 15 --seconds 5
+"""
+
+import argparse
+import socket
+import sys
+import threading
+import time
+
+from chunk_protocol import FrameAssembler, FRAME_ID_MOD, open_receiver, pack_chunks
+
+
+def receiver(sock, stop, results, index):
+    assembler = FrameAssembler()
+    sock.settimeout(0.2)
+    while not stop.is_set():
+        try:
+            packet = sock.recv(65536)
+        except socket.timeout:
+            continue
+        assembler.push(packet)
+    results[index] = assembler
+    sock.close()
+
+
+def run(viewers, multicast, args, jpeg):
+    stop = threading.Event()
+    results = [None] * viewers
+    threads = []
+    targets = []
+    for i in range(viewers):
+        if multicast:
+            sock = open_receiver(args.port, args.group)
+        else:
+            sock = open_receiver(args.port + i)
+            targets.append(('127.0.0.1', args.port + i))
+        t = threading.Thread(target=receiver, args=(sock, stop, results, i), daemon=True)
+        t.start()
+        threads.append(t)
+    if multicast:
+        targets = [(args.group, args.port)]
+
+    sender = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sender.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 1)
+    sender.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_LOOP, 1)
+
+    chunks = list(pack_chunks(0, jpeg))
+    interval = 1.0 / args.fps
+    frames = int(args.seconds * args.fps)
+    sent_bytes = 0
+    cpu_start = time.thread_time()
+    next_frame = time.monotonic()
+    for frame_id in range(frames):
+        id_bytes = (frame_id % FRAME_ID_MOD).to_bytes(2, 'little')
+        for target in targets:
+            for chunk in chunks:
+                sent_bytes += sender.sendto(id_bytes + chunk[2:], target)
+        next_frame += interval
+        delay = next_frame - time.monotonic()
+        if delay > 0:
+            time.sleep(delay)
+    cpu = time.thread_time() - cpu_start
+
+    time.sleep(0.3)
+    stop.set()
+    for t in threads:
+        t.join()
+    sender.close()
+
+    received = min(r.frames_completed for r in results)
+    return cpu / args.seconds, sent_bytes / args.seconds, received, frames
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--viewers', type=int, nargs='+', default=[1, 2, 4, 8])
+    parser.add_argument('--group', default='239.255.42.1')
+    parser.add_argument('--port', type=int, default=5105)
+    parser.add_argument('--fps', type=float, default=15)
+    parser.add_argument('--seconds', type=float, default=3)
+    parser.add_argument('--jpeg', help='JPEG file to send (default: 25 KB of filler)')
+    args = parser.parse_args()
+
+    jpeg = open(args.jpeg, 'rb').read() if args.jpeg else b'\xff\xd8' + bytes(25000) + b'\xff\xd9'
+
+    print('%-8s %-10s %10s %12s %10s' % ('viewers', 'mode', 'sender CPU', 'sent Mbit/s', 'received'))
+    for viewers in args.viewers:
+        for multicast in (False, True):
+            cpu, rate, received, frames = run(viewers, multicast, args, jpeg)
+            print('%-8d %-10s %9.1f%% %12.2f %5d/%-5d' % (
+                viewers, 'multicast' if multicast else 'unicast', 100 * cpu, rate * 8 / 1e6, received, frames))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
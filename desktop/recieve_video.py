@@ -7,9 +7,9 @@ import struct
 import sys
 
 PORT = 5005
-HEADER_FORMAT = '<HHH'
-CHUNK_SIZE = 1400
+HEADER_FORMAT = '<HHHH'
 HEADER_SIZE = struct.calcsize(HEADER_FORMAT)
+MAX_PACKET = 2048  # Chunks are 1400 bytes by default, up to 1464 (udp_chunk on /config)
 
 # Large receive buffer to avoid OS-level packet drops
 RECV_BUF_SIZE = 4 * 1024 * 1024  # 4 MB
@@ -24,7 +24,7 @@ print(f"Listening for frames on UDP port {PORT}...")
 def recv_packet():
     """Blocking receive with timeout."""
     try:
-        return sock.recv(CHUNK_SIZE + HEADER_SIZE + 64)
+        return sock.recv(MAX_PACKET)
     except socket.timeout:
         return None
 
@@ -34,7 +34,7 @@ def drain_to_latest():
     latest = None
     try:
         while True:
-            latest = sock.recv(CHUNK_SIZE + HEADER_SIZE + 64)
+            latest = sock.recv(MAX_PACKET)
     except BlockingIOError:
         pass
     sock.settimeout(2.0)
@@ -50,9 +50,9 @@ while True:
         continue
 
     while True:
-        frame_id, chunk_id, total_chunks = struct.unpack(HEADER_FORMAT, packet[:HEADER_SIZE])
-        if chunk_id == 0:
-            break
+        frame_id, chunk_id, total_chunks, chunk_size = struct.unpack(HEADER_FORMAT, packet[:HEADER_SIZE])
+        if chunk_id == 0 and total_chunks > 0:
+            break  # Not a keep-alive or probe (total 0): the window keeps the last frame
         packet = recv_packet()
         if packet is None:
             break
@@ -67,7 +67,7 @@ while True:
         data = packet[HEADER_SIZE:]
         data_len = len(data)
 
-        if i < total_chunks - 1 and data_len != CHUNK_SIZE:
+        if i < total_chunks - 1 and data_len != chunk_size:
             success = False
             break
 
@@ -78,7 +78,7 @@ while True:
             if packet is None:
                 success = False
                 break
-            fid, cid, tc = struct.unpack(HEADER_FORMAT, packet[:HEADER_SIZE])
+            fid, cid, tc, cs = struct.unpack(HEADER_FORMAT, packet[:HEADER_SIZE])
             if fid != frame_id or cid != i + 1:
                 # Frame got interrupted — abandon and start over
                 success = False
@@ -0,0 +1,833 @@
+#!/usr/bin/env python3
+"""Stream relay: one connection to the camera, any number of viewers.
+
+The camera's stream server takes only a couple of clients, and every one
+costs it frame rate. The relay pulls a single stream from the camera (the
+MJPEG stream on port 81, or the chunked UDP stream) and serves it to
+viewers over HTTP, in the camera's own MJPEG format, and over WebSocket,
+as one binary message per JPEG. /train requests are passed through to the
+camera's API server, at most --api-concurrency at a time.
+
+Everything runs in one epoll loop. Each frame is received once and shared:
+every viewer sends from the same bytes object, and the MJPEG part header or
+WebSocket header goes in front with a scatter-gather send, so nothing is
+copied per viewer. A frame is freed when the last viewer is done with it.
+A viewer that cannot keep up never has more than one frame waiting: a newer
+frame replaces the waiting one (drop to latest). Slow viewers fall behind
+on their own and never delay the others or grow the relay's memory.
+
+    python relay.py --camera train.local
+    python relay.py --camera train.local --udp 5005 --listen :8080
+    python relay_loadtest.py --clients 10 100 300
+
+Viewer endpoints:
+    /stream, /  MJPEG (multipart/x-mixed-replace), as on the camera's port 81
+    /ws         WebSocket, one binary message per frame
+    /capture    the latest frame
+    /status     relay stats (JSON)
+    /train?...  passed through to http://<camera>/train?...
+"""
+
+import argparse
+import base64
+import collections
+import errno
+import hashlib
+import json
+import resource
+import selectors
+import socket
+import sys
+import threading
+import time
+import urllib.request
+import weakref
+
+from chunk_protocol import (PROBE_WAIT, FrameAssembler, MAX_DATAGRAM, best_datagram, is_probe, key_argument,
+                            open_receiver, recv_probe, report_fragments)
+
+BOUNDARY = b'frame'
+WS_GUID = b'258EAFA5-E914-47DA-95CA-C5AB0DC85B11'
+MAX_REQUEST = 8192              # Request header bytes before a viewer is dropped
+MAX_WS_INPUT = 65536            # Viewers only send control frames
+SOURCE_TIMEOUT = 5.0            # Seconds without a frame before reconnecting
+RECONNECT_MAX = 10.0            # Longest wait between reconnects
+API_TIMEOUT = 5.0               # Seconds for the camera to answer a /train request
+TICK = 0.5                      # Housekeeping interval
+
+
+class Frame:
+    """One JPEG, shared by every viewer that sends it."""
+
+    __slots__ = ('jpeg', 'received', 'heads', '__weakref__')
+
+    def __init__(self, jpeg):
+        self.jpeg = jpeg
+        self.received = time.monotonic()
+        self.heads = {
+            'mjpeg': b'\r\n--%s\r\nContent-Type: image/jpeg\r\nContent-Length: %d\r\n\r\n' % (BOUNDARY, len(jpeg)),
+            'ws': ws_header(0x2, len(jpeg)),
+        }
+
+
+def ws_header(opcode, length):
+    """Server-to-client WebSocket frame header (final, unmasked)."""
+    if length < 126:
+        return bytes([0x80 | opcode, length])
+    if length < 65536:
+        return bytes([0x80 | opcode, 126]) + length.to_bytes(2, 'big')
+    return bytes([0x80 | opcode, 127]) + length.to_bytes(8, 'big')
+
+
+def http_response(status, body=b'', content_type='text/plain'):
+    return ('HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %d\r\nAccess-Control-Allow-Origin: *\r\n'
+            'Cache-Control: no-cache\r\nConnection: close\r\n\r\n' % (status, content_type, len(body))
+            ).encode() + body
+
+
+def parse_head(head):
+    """The three parts of the first line (method, target, version or
+    version, status, reason) and the headers of a request or response
+    head, or None."""
+    lines = head.decode('latin-1').split('\r\n')
+    parts = lines[0].split(' ', 2)
+    if len(parts) != 3:
+        return None
+    headers = {}
+    for line in lines[1:]:
+        name, sep, value = line.partition(':')
+        if sep:
+            headers[name.strip().lower()] = value.strip()
+    return parts[0], parts[1], parts[2], headers
+
+
+class Viewer:
+    """A connection from a browser or player.
+
+    Starts by reading a request. /stream and /ws viewers then stay and get
+    frames; everything else gets one response and is closed. Outgoing
+    control data (response headers, WebSocket pongs) waits in `out` and only
+    goes between frames.
+    """
+
+    def __init__(self, relay, sock):
+        self.relay = relay
+        self.sock = sock
+        self.kind = None            # 'mjpeg', 'ws', or None for a one-shot response
+        self.routed = False
+        self.inbuf = bytearray()
+        self.out = collections.deque()
+        self.frame = None           # Being sent
+        self.offset = 0             # Into the frame's header + JPEG
+        self.pending = None         # Newest frame not started yet
+        self.closing = False        # Close once `out` is sent
+        self.writing = False
+        self.progress = time.monotonic()
+        self.bytes_sent = 0
+
+    # Events
+
+    def on_event(self, mask):
+        if mask & selectors.EVENT_READ:
+            self.on_readable()
+        if self.sock is not None and mask & selectors.EVENT_WRITE:
+            self.pump()
+
+    def on_readable(self):
+        try:
+            data = self.sock.recv(65536)
+        except BlockingIOError:
+            return
+        except OSError:
+            data = b''
+        if not data:
+            self.close()
+            return
+        if self.kind == 'mjpeg':
+            return                  # Nothing to read on a stream
+        self.inbuf += data
+        if self.kind == 'ws':
+            self.ws_input()
+        elif not self.routed:
+            end = self.inbuf.find(b'\r\n\r\n')
+            if end >= 0:
+                self.routed = True
+                self.relay.route(self, parse_head(bytes(self.inbuf[:end])))
+            elif len(self.inbuf) > MAX_REQUEST:
+                self.reply('431 Request Header Fields Too Large')
+
+    def ws_input(self):
+        buf = self.inbuf
+        while len(buf) >= 2:
+            opcode, length, masked = buf[0] & 0x0F, buf[1] & 0x7F, buf[1] & 0x80
+            pos = 2 + {126: 2, 127: 8}.get(length, 0)
+            if len(buf) < pos + (4 if masked else 0):
+                break
+            if length >= 126:
+                length = int.from_bytes(buf[2:pos], 'big')
+            mask = buf[pos:pos + 4] if masked else b'\0\0\0\0'
+            pos += 4 if masked else 0
+            if len(buf) < pos + length:
+                break
+            payload = bytes(b ^ mask[i & 3] for i, b in enumerate(buf[pos:pos + min(length, 125)]))
+            del buf[:pos + length]
+            if opcode == 0x8:
+                self.send(ws_header(0x8, len(payload[:2])) + payload[:2], close=True)
+            elif opcode == 0x9:
+                self.send(ws_header(0xA, len(payload)) + payload)
+        if len(buf) > MAX_WS_INPUT:
+            self.close()
+
+    # Output
+
+    def send(self, data, close=False):
+        self.out.append(memoryview(data))
+        self.closing = self.closing or close
+        self.pump()
+
+    def reply(self, status, body=b'', content_type='text/plain'):
+        self.send(http_response(status, body, content_type), close=True)
+
+    def offer(self, frame):
+        """A new frame: send it now if idle, else make it the waiting one."""
+        if self.closing:
+            return
+        if self.pending is not None:
+            self.relay.frames_dropped += 1
+        self.pending = frame
+        if not self.writing:
+            self.pump()
+
+    def pump(self):
+        """Send until the socket is full or there is nothing left."""
+        sock = self.sock
+        sent = self.bytes_sent
+        try:
+            while sock is not None:
+                if self.frame is None:
+                    if self.out:
+                        data = self.out[0]
+                        n = sock.send(data)
+                        self.bytes_sent += n
+                        if n < len(data):
+                            self.out[0] = data[n:]
+                            break
+                        self.out.popleft()
+                        continue
+                    if self.closing:
+                        self.close()
+                        return
+                    if self.pending is None:
+                        break
+                    self.frame, self.pending, self.offset = self.pending, None, 0
+                head = self.frame.heads[self.kind]
+                jpeg = self.frame.jpeg
+                if self.offset < len(head):
+                    parts = [memoryview(head)[self.offset:], jpeg]
+                else:
+                    parts = [memoryview(jpeg)[self.offset - len(head):]]
+                n = sock.sendmsg(parts)
+                self.offset += n
+                self.bytes_sent += n
+                self.relay.bytes_sent += n
+                if self.offset < len(head) + len(jpeg):
+                    break
+                self.frame = None
+                self.relay.frames_sent += 1
+        except BlockingIOError:
+            pass
+        except OSError:
+            self.close()
+            return
+        if self.sock is None:
+            return
+        if self.bytes_sent != sent or not self.writing:
+            self.progress = time.monotonic()
+        busy = self.frame is not None or bool(self.out)
+        if busy != self.writing:
+            self.writing = busy
+            self.relay.watch(self, write=busy)
+
+    def stalled(self, now, limit):
+        return self.writing and now - self.progress > limit
+
+    def close(self):
+        if self.sock is None:
+            return
+        self.relay.forget(self)
+        self.sock.close()
+        self.sock = None
+        self.frame = self.pending = None
+
+
+class ApiRequest:
+    """A /train request passed to the camera's API server.
+
+    The camera's HTTP server may keep the connection open after answering,
+    so the response is read up to its end (Content-Length or chunked) rather
+    than to EOF, then handed to the viewer as it came.
+    """
+
+    def __init__(self, relay, viewer, path):
+        self.relay = relay
+        self.viewer = viewer
+        self.path = path
+        self.sock = None
+        self.request = b''
+        self.buf = bytearray()
+        self.deadline = 0.0
+
+    def start(self, addr, host):
+        self.deadline = time.monotonic() + API_TIMEOUT
+        self.request = ('GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n' % (self.path, host)).encode()
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.sock.setblocking(False)
+        self.sock.connect_ex(addr)
+        self.relay.sel.register(self.sock, selectors.EVENT_WRITE, self)
+
+    def on_event(self, mask):
+        if mask & selectors.EVENT_WRITE:
+            if self.sock.getsockopt(socket.SOL_SOCKET, socket.SO_ERROR):
+                self.finish(None)
+                return
+            try:
+                self.sock.send(self.request)   # A few dozen bytes: goes out whole
+            except OSError:
+                self.finish(None)
+                return
+            self.relay.sel.modify(self.sock, selectors.EVENT_READ, self)
+            return
+        try:
+            data = self.sock.recv(65536)
+        except BlockingIOError:
+            return
+        except OSError:
+            data = b''
+        self.buf += data
+        end = self.response_end()
+        if end is not None:
+            self.finish(bytes(self.buf[:end]))
+        elif not data:
+            # Closed: complete if the body had no length, else cut short
+            self.finish(bytes(self.buf) if self.buf.find(b'\r\n\r\n') >= 0 else None)
+
+    def response_end(self):
+        head = self.buf.find(b'\r\n\r\n')
+        if head < 0:
+            return None
+        _, _, _, headers = parse_head(bytes(self.buf[:head])) or ('', '', '', {})
+        body = head + 4
+        if 'content-length' in headers:
+            end = body + int(headers['content-length'])
+            return end if len(self.buf) >= end else None
+        if 'chunked' in headers.get('transfer-encoding', ''):
+            end = self.buf.find(b'\r\n0\r\n\r\n', body - 2)
+            return end + 7 if end >= 0 else None
+        return None                 # Until EOF
+
+    def timed_out(self, now):
+        return now > self.deadline
+
+    def finish(self, response):
+        if self.sock is not None:
+            self.relay.sel.unregister(self.sock)
+            self.sock.close()
+            self.sock = None
+        self.relay.api_done(self, response)
+
+
+class MjpegSource:
+    """Pulls http://<camera>:81/stream and cuts it into JPEGs."""
+
+    kind = 'mjpeg'
+
+    def __init__(self, relay, host, port):
+        self.relay = relay
+        self.host = host
+        self.port = port
+        self.sock = None
+        self.connected = False
+        self.reconnects = 0
+        self.backoff = 1.0
+        self.retry_at = 0.0
+        self.last_frame = 0.0
+
+    def describe(self):
+        return 'http://%s:%d/stream' % (self.host, self.port)
+
+    def start(self):
+        self.buf = bytearray()
+        self.boundary = None
+        self.length = None          # Content-Length of the part being read
+        self.connected = False
+        self.last_frame = time.monotonic()
+        try:
+            addr = self.relay.resolve(self.port)
+        except OSError as e:
+            self.fail('cannot resolve %s: %s' % (self.host, e))
+            return
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 1 << 20)
+        self.sock.setblocking(False)
+        self.sock.connect_ex(addr)
+        self.relay.sel.register(self.sock, selectors.EVENT_WRITE, self)
+
+    def on_event(self, mask):
+        if not self.connected:
+            err = self.sock.getsockopt(socket.SOL_SOCKET, socket.SO_ERROR)
+            if err:
+                self.fail('connect: %s' % errno.errorcode.get(err, err))
+                return
+            try:
+                self.sock.send(b'GET /stream HTTP/1.1\r\nHost: %s\r\n\r\n' % self.host.encode())
+            except OSError as e:
+                self.fail(str(e))
+                return
+            self.relay.sel.modify(self.sock, selectors.EVENT_READ, self)
+            self.connected = True
+            return
+        try:
+            data = self.sock.recv(1 << 18)
+        except BlockingIOError:
+            return
+        except OSError as e:
+            self.fail(str(e))
+            return
+        if not data:
+            self.fail('camera closed the stream')
+            return
+        self.buf += data
+        self.parse()
+
+    def parse(self):
+        buf = self.buf
+        if self.boundary is None:
+            end = buf.find(b'\r\n\r\n')
+            if end < 0:
+                return
+            _, code, _, headers = parse_head(bytes(buf[:end])) or ('', '', '', {})
+            content_type = headers.get('content-type', '')
+            if code != '200' or 'boundary=' not in content_type:
+                self.fail('not an MJPEG stream (%s %s)' % (code, content_type))
+                return
+            self.boundary = b'--' + content_type.split('boundary=')[1].strip().strip('"').encode()
+            del buf[:end + 4]
+        while True:
+            if self.length is None:
+                start = buf.find(self.boundary)
+                if start < 0:
+                    del buf[:max(0, len(buf) - len(self.boundary))]
+                    return
+                end = buf.find(b'\r\n\r\n', start)
+                if end < 0:
+                    return
+                self.length = -1
+                for line in bytes(buf[start:end]).split(b'\r\n'):
+                    name, _, value = line.partition(b':')
+                    if name.strip().lower() == b'content-length':
+                        self.length = int(value.strip())    # The camera pads it with spaces
+                del buf[:end + 4]
+            if self.length >= 0:
+                if len(buf) < self.length:
+                    return
+                jpeg = bytes(buf[:self.length])
+                del buf[:self.length]
+            else:
+                end = buf.find(b'\r\n' + self.boundary)
+                if end < 0:
+                    return
+                jpeg = bytes(buf[:end])
+                del buf[:end]
+            self.length = None
+            self.last_frame = time.monotonic()
+            self.backoff = 1.0
+            self.relay.publish(jpeg)
+
+    def fail(self, reason):
+        print('source: %s, reconnecting in %.0f s' % (reason, self.backoff), flush=True)
+        self.stop()
+        self.reconnects += 1
+        self.retry_at = time.monotonic() + self.backoff
+        self.backoff = min(self.backoff * 2, RECONNECT_MAX)
+
+    def tick(self, now):
+        if self.sock is None and now >= self.retry_at:
+            self.start()
+        elif self.sock is not None and now - self.last_frame > SOURCE_TIMEOUT:
+            self.fail('no frame for %.0f s' % SOURCE_TIMEOUT)
+
+    def stop(self):
+        if self.sock is not None:
+            self.relay.sel.unregister(self.sock)
+            self.sock.close()
+            self.sock = None
+        self.connected = False
+
+
+class UdpSource:
+    """Receives the camera's chunked UDP stream (see chunk_protocol.py).
+
+    Unless --no-subscribe, the relay subscribes itself on the camera's API
+    (/rtp/setup, /rtp/play) and subscribes again if the frames stop, for
+    instance after the camera restarted. That runs on a thread, so the loop
+    keeps serving. With a key it asks for the encrypted stream (proto=gcm).
+    With probe, each subscription first has the camera probe the path
+    (/rtp/probe) and takes the largest datagram that arrived unfragmented.
+    """
+
+    kind = 'udp'
+
+    def __init__(self, relay, host, api_port, port, group, subscribe, key, probe):
+        self.relay = relay
+        self.host = host
+        self.api_port = api_port
+        self.port = port
+        self.group = group
+        self.subscribe = subscribe and not group
+        self.proto = 'gcm' if key else 'chunk'
+        self.assembler = FrameAssembler(key=key)
+        self.probe = probe and self.subscribe
+        self.probes = None          # (datagram, fragmented) while probing
+        self.sock = None
+        self.session = None
+        self.subscribing = False
+        self.reconnects = 0
+        self.last_frame = 0.0
+        self.last = None
+
+    @property
+    def connected(self):
+        return time.monotonic() - self.last_frame < SOURCE_TIMEOUT
+
+    def describe(self):
+        return 'udp://%s:%d' % (self.group or '', self.port)
+
+    def start(self):
+        self.sock = open_receiver(self.port, self.group)
+        self.sock.setblocking(False)
+        if self.probe and not report_fragments(self.sock):
+            print('source: fragments cannot be detected here, probing may pick too large a size', flush=True)
+        self.relay.sel.register(self.sock, selectors.EVENT_READ, self)
+        self.last_frame = time.monotonic()
+        if self.subscribe:
+            self.resubscribe()
+
+    def api(self, path):
+        url = 'http://%s:%d%s' % (self.host, self.api_port, path)
+        return json.load(urllib.request.urlopen(url, timeout=API_TIMEOUT))
+
+    def resubscribe(self):
+        def run():
+            try:
+                session = self.api('/rtp/setup?port=%d&proto=%s' % (self.port, self.proto))['session']
+                if self.probe:
+                    self.probes = []
+                    self.api('/rtp/probe?session=%d' % session)
+                    time.sleep(PROBE_WAIT)
+                    best, self.probes = best_datagram(self.probes), None
+                    if best:
+                        self.api('/rtp/probe?session=%d&size=%d' % (session, best))
+                    print('source: path probed, %s' % ('%d-byte datagrams' % best if best else 'no probe arrived'),
+                          flush=True)
+                self.api('/rtp/play?session=%d' % session)
+                self.session = session
+                print('source: subscribed to %s as session %d' % (self.host, session), flush=True)
+            except (OSError, ValueError, KeyError) as e:
+                print('source: subscribing to %s failed: %s' % (self.host, e), flush=True)
+            self.subscribing = False
+        self.subscribing = True
+        self.reconnects += 1
+        threading.Thread(target=run, daemon=True).start()
+
+    def on_event(self, mask):
+        push = self.assembler.push
+        for _ in range(256):        # Bounded, so viewers get a turn under a flood
+            probes = self.probes
+            try:
+                if probes is None:
+                    packet = self.sock.recv(MAX_DATAGRAM)
+                else:
+                    packet, fragmented = recv_probe(self.sock)
+            except BlockingIOError:
+                return
+            if probes is not None and is_probe(packet):
+                probes.append((packet, fragmented))
+                continue
+            jpeg = push(packet)
+            if jpeg is None:
+                continue
+            self.last_frame = time.monotonic()
+            if jpeg is not self.last:  # A keep-alive repeats the last frame
+                self.last = jpeg
+                self.relay.publish(jpeg)
+
+    def tick(self, now):
+        if self.subscribe and not self.subscribing and now - self.last_frame > SOURCE_TIMEOUT:
+            self.last_frame = now
+            self.resubscribe()
+
+    def stop(self):
+        if self.session is not None:
+            try:
+                self.api('/rtp/teardown?session=%d' % self.session)
+            except (OSError, ValueError):
+                pass
+        if self.sock is not None:
+            self.relay.sel.unregister(self.sock)
+            self.sock.close()
+            self.sock = None
+
+
+class Relay:
+    def __init__(self, args):
+        self.args = args
+        self.sel = selectors.EpollSelector() if hasattr(selectors, 'EpollSelector') else selectors.DefaultSelector()
+        self.viewers = set()        # Streaming viewers
+        self.connections = set()    # Every open viewer connection
+        self.latest = None
+        self.live = weakref.WeakSet()   # Frames some viewer still holds
+        self.frames_in = 0
+        self.frames_sent = 0
+        self.frames_dropped = 0
+        self.bytes_sent = 0
+        self.viewers_stalled = 0
+        self.window = collections.deque(maxlen=64)  # Recent frame arrival times, for fps
+        self.api_queue = collections.deque()
+        self.api_active = set()
+        self.api_proxied = 0
+        self.api_failed = 0
+        self.api_addr = None
+
+        host, _, port = args.listen.rpartition(':')
+        self.server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.server.bind((host, int(port)))
+        self.server.listen(512)
+        self.server.setblocking(False)
+        self.sel.register(self.server, selectors.EVENT_READ, self)
+
+        if args.udp:
+            self.source = UdpSource(self, args.camera, args.api_port, args.udp, args.group, not args.no_subscribe,
+                                    args.key, args.probe)
+        else:
+            self.source = MjpegSource(self, args.camera, args.stream_port)
+
+    def resolve(self, port):
+        """Camera address. Blocking, but only when (re)connecting."""
+        addr = socket.getaddrinfo(self.args.camera, port, socket.AF_INET, socket.SOCK_STREAM)[0][4]
+        self.api_addr = (addr[0], self.args.api_port)
+        return addr
+
+    # Listening socket
+
+    def on_event(self, mask):
+        while True:
+            try:
+                sock, _ = self.server.accept()
+            except BlockingIOError:
+                return
+            except OSError as e:
+                print('accept: %s' % e, flush=True)  # Out of descriptors: the backlog waits
+                return
+            sock.setblocking(False)
+            sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+            # A small send buffer keeps the drop-to-latest queue in the relay,
+            # where old frames are dropped, not in the kernel
+            sock.setsockopt(socket.SOL_SOCKET, socket.SO_SNDBUF, self.args.sndbuf)
+            viewer = Viewer(self, sock)
+            self.connections.add(viewer)
+            self.sel.register(sock, selectors.EVENT_READ, viewer)
+
+    def watch(self, viewer, write):
+        events = selectors.EVENT_READ | (selectors.EVENT_WRITE if write else 0)
+        self.sel.modify(viewer.sock, events, viewer)
+
+    def forget(self, viewer):
+        self.sel.unregister(viewer.sock)
+        self.connections.discard(viewer)
+        self.viewers.discard(viewer)
+
+    # Requests
+
+    def route(self, viewer, request):
+        if request is None:
+            viewer.reply('400 Bad Request')
+            return
+        method, target, _, headers = request
+        path = target.split('?')[0]
+        if method != 'GET':
+            viewer.reply('405 Method Not Allowed')
+        elif path in ('/stream', '/ws', '/'):
+            if len(self.viewers) >= self.args.max_viewers:
+                viewer.reply('503 Service Unavailable', b'too many viewers')
+                return
+            if path == '/ws':
+                key = headers.get('sec-websocket-key')
+                if not key or headers.get('upgrade', '').lower() != 'websocket':
+                    viewer.reply('400 Bad Request', b'WebSocket upgrade expected')
+                    return
+                accept = base64.b64encode(hashlib.sha1(key.encode() + WS_GUID).digest()).decode()
+                viewer.kind = 'ws'
+                viewer.send(('HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n'
+                             'Sec-WebSocket-Accept: %s\r\n\r\n' % accept).encode())
+            else:
+                viewer.kind = 'mjpeg'
+                viewer.send(('HTTP/1.1 200 OK\r\nContent-Type: multipart/x-mixed-replace;boundary=%s\r\n'
+                             'Cache-Control: no-cache\r\nAccess-Control-Allow-Origin: *\r\n\r\n'
+                             % BOUNDARY.decode()).encode())
+            viewer.inbuf.clear()
+            self.viewers.add(viewer)
+            if self.latest is not None:
+                viewer.offer(self.latest)   # Show something at once
+        elif path == '/capture':
+            if self.latest is None:
+                viewer.reply('503 Service Unavailable', b'no frame yet')
+            else:
+                viewer.reply('200 OK', self.latest.jpeg, 'image/jpeg')
+        elif path == '/status':
+            viewer.reply('200 OK', json.dumps(self.status()).encode(), 'application/json')
+        elif path == '/train':
+            request = ApiRequest(self, viewer, target)
+            self.api_queue.append(request)
+            self.api_next()
+        else:
+            viewer.reply('404 Not Found')
+
+    def api_next(self):
+        while self.api_queue and len(self.api_active) < self.args.api_concurrency:
+            request = self.api_queue.popleft()
+            if request.viewer.sock is None:
+                continue            # Viewer left while waiting
+            if self.api_addr is None:
+                try:
+                    self.resolve(self.args.api_port)
+                except OSError:
+                    self.api_done(request, None)
+                    continue
+            self.api_active.add(request)
+            request.start(self.api_addr, self.args.camera)
+
+    def api_done(self, request, response):
+        self.api_active.discard(request)
+        if response is None:
+            self.api_failed += 1
+            request.viewer.reply('504 Gateway Timeout', b'camera did not answer')
+        else:
+            self.api_proxied += 1
+            request.viewer.send(response, close=True)
+        self.api_next()
+
+    # Frames
+
+    def publish(self, jpeg):
+        self.frames_in += 1
+        frame = Frame(jpeg)
+        self.latest = frame
+        self.live.add(frame)
+        self.window.append(frame.received)
+        for viewer in list(self.viewers):
+            viewer.offer(frame)
+
+    def status(self):
+        kinds = collections.Counter(v.kind for v in self.viewers)
+        window = self.window
+        fps = (len(window) - 1) / (window[-1] - window[0]) if len(window) > 1 and window[-1] > window[0] else 0.0
+        if window and time.monotonic() - window[-1] > SOURCE_TIMEOUT:
+            fps = 0.0
+        live = list(self.live)
+        return {
+            'source': {
+                'kind': self.source.kind,
+                'url': self.source.describe(),
+                'connected': self.source.connected,
+                'reconnects': self.source.reconnects,
+                'frames': self.frames_in,
+                'fps': round(fps, 2),
+            },
+            'viewers': {'mjpeg': kinds['mjpeg'], 'ws': kinds['ws'], 'connections': len(self.connections)},
+            'frames_sent': self.frames_sent,
+            'frames_dropped': self.frames_dropped,
+            'viewers_stalled': self.viewers_stalled,
+            'bytes_sent': self.bytes_sent,
+            'frames_held': len(live),
+            'bytes_held': sum(len(f.jpeg) for f in live),
+            'train': {'proxied': self.api_proxied, 'failed': self.api_failed,
+                      'queued': len(self.api_queue), 'active': len(self.api_active)},
+        }
+
+    # Loop
+
+    def tick(self, now):
+        self.source.tick(now)
+        for viewer in list(self.connections):
+            if viewer.stalled(now, self.args.stall):
+                self.viewers_stalled += 1
+                viewer.close()
+        for request in list(self.api_active):
+            if request.timed_out(now):
+                request.finish(None)
+
+    def run(self):
+        self.source.start()
+        print('relaying %s on %s' % (self.source.describe(), self.args.listen), flush=True)
+        next_tick = next_stats = time.monotonic()
+        last_sent = 0
+        try:
+            while True:
+                for key, mask in self.sel.select(TICK):
+                    key.data.on_event(mask)
+                now = time.monotonic()
+                if now >= next_tick:
+                    self.tick(now)
+                    next_tick = now + TICK
+                if self.args.stats_interval and now >= next_stats:
+                    s = self.status()
+                    print('%5.1f fps in, %d mjpeg + %d ws viewers, %.1f Mbit/s out, %d frames dropped, '
+                          '%d held, %d train requests' % (
+                              s['source']['fps'], s['viewers']['mjpeg'], s['viewers']['ws'],
+                              8 * (self.bytes_sent - last_sent) / self.args.stats_interval / 1e6,
+                              self.frames_dropped, s['frames_held'], self.api_proxied), flush=True)
+                    last_sent = self.bytes_sent
+                    next_stats = now + self.args.stats_interval
+        except KeyboardInterrupt:
+            pass
+        finally:
+            self.source.stop()
+
+
+def raise_fd_limit():
+    """Each viewer is a descriptor; the usual soft limit is 1024."""
+    soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    if soft < hard:
+        resource.setrlimit(resource.RLIMIT_NOFILE, (hard, hard))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--camera', default='train.local', help='camera hostname or address')
+    parser.add_argument('--stream-port', type=int, default=81, help="camera's MJPEG port")
+    parser.add_argument('--api-port', type=int, default=80, help="camera's API port (/train, /rtp)")
+    parser.add_argument('--udp', type=int, metavar='PORT', help='take the chunked UDP stream on this port instead')
+    parser.add_argument('--group', help='with --udp: join this multicast group instead of subscribing')
+    key_argument(parser)
+    parser.add_argument('--no-subscribe', action='store_true',
+                        help='with --udp: the camera already sends here (default receiver)')
+    parser.add_argument('--probe', action='store_true',
+                        help='with --udp: size the chunks for the path to the relay (/rtp/probe)')
+    parser.add_argument('--listen', default=':8080', help='[ADDR]:PORT for viewers')
+    parser.add_argument('--max-viewers', type=int, default=1000)
+    parser.add_argument('--api-concurrency', type=int, default=1,
+                        help='/train requests in flight to the camera at once')
+    parser.add_argument('--sndbuf', type=int, default=64 * 1024, help='socket send buffer per viewer (bytes)')
+    parser.add_argument('--stall', type=float, default=30.0,
+                        help='drop a viewer that took nothing for this many seconds')
+    parser.add_argument('--stats-interval', type=float, default=5.0, help='seconds between stats lines (0: off)')
+    args = parser.parse_args()
+
+    raise_fd_limit()
+    Relay(args).run()
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,368 @@
+#!/usr/bin/env python3
+"""Load test for relay.py on one host.
+
+Runs a simulated camera (MJPEG stream and /train API), starts the relay
+against it and connects hundreds of viewers, half over MJPEG and half over
+WebSocket, spread over a few worker processes. The camera writes its send
+time into a comment segment of every frame, so each viewer measures the
+latency from the camera to itself through the relay. For each viewer count
+the test reports the relay's CPU and peak memory, frames per viewer,
+latency percentiles, frames the relay dropped, and how long /train requests
+take through it.
+
+--slow viewers read at only --slow-rate KB/s. They should fall behind and
+drop frames without raising anyone else's latency.
+
+    python relay_loadtest.py --clients 10 100 300 --seconds 10
+    python relay_loadtest.py --clients 200 --slow 20
+"""
+
+import argparse
+import json
+import multiprocessing
+import os
+import selectors
+import socket
+import struct
+import subprocess
+import sys
+import threading
+import time
+import urllib.request
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+STAMP = b'relay-ts'             # Comment segment: STAMP + send time (monotonic ns)
+
+
+def stamp(jpeg):
+    """The JPEG with its send time in a COM segment after SOI."""
+    payload = STAMP + struct.pack('>Q', time.monotonic_ns())
+    return jpeg[:2] + b'\xff\xfe' + struct.pack('>H', len(payload) + 2) + payload + jpeg[2:]
+
+
+def sent_at(jpeg):
+    if jpeg[6:6 + len(STAMP)] != STAMP:
+        return None
+    return struct.unpack_from('>Q', jpeg, 6 + len(STAMP))[0]
+
+
+class FakeCamera(ThreadingHTTPServer):
+    """The camera's /stream (port 81) and /train (port 80) on one port."""
+
+    daemon_threads = True
+
+    def __init__(self, jpeg, fps, api_delay):
+        self.jpeg = jpeg
+        self.fps = fps
+        self.api_delay = api_delay
+        self.train_requests = 0
+        super().__init__(('127.0.0.1', 0), CameraHandler)
+
+
+class CameraHandler(BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    def log_message(self, *args):
+        pass
+
+    def do_GET(self):
+        cam = self.server
+        if self.path.startswith('/stream'):
+            self.send_response(200)
+            self.send_header('Content-Type', 'multipart/x-mixed-replace;boundary=frame')
+            self.end_headers()
+            interval = 1.0 / cam.fps
+            next_frame = time.monotonic()
+            try:
+                while True:
+                    jpeg = stamp(cam.jpeg)
+                    # Padded length, as the camera's template writes it
+                    self.wfile.write(b'\r\n--frame\r\nContent-Type: image/jpeg\r\nContent-Length: %-7d\r\n\r\n'
+                                     % len(jpeg) + jpeg)
+                    next_frame += interval
+                    time.sleep(max(0.0, next_frame - time.monotonic()))
+            except OSError:
+                return
+        elif self.path.startswith('/train'):
+            cam.train_requests += 1
+            time.sleep(cam.api_delay)
+            body = b'{"result":"ok","action":"status","connected":true}'
+            self.send_response(200)
+            self.send_header('Content-Type', 'application/json')
+            self.send_header('Content-Length', str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+        else:
+            self.send_error(404)
+
+
+class Client:
+    """One viewer: parses the MJPEG or WebSocket stream it gets."""
+
+    def __init__(self, kind, slow):
+        self.kind = kind
+        self.slow = slow
+        self.buf = bytearray()
+        self.started = False
+        self.frames = 0
+        self.latencies = []         # ms, after the warm-up
+        self.sock = None
+        self.closed = False
+
+    def request(self, port):
+        if self.kind == 'ws':
+            return ('GET /ws HTTP/1.1\r\nHost: 127.0.0.1:%d\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n'
+                    'Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n' % port).encode()
+        return ('GET /stream HTTP/1.1\r\nHost: 127.0.0.1:%d\r\n\r\n' % port).encode()
+
+    def feed(self, data, measuring):
+        buf = self.buf
+        buf += data
+        if not self.started:
+            end = buf.find(b'\r\n\r\n')
+            if end < 0:
+                return
+            del buf[:end + 4]
+            self.started = True
+        while True:
+            if self.kind == 'ws':
+                if len(buf) < 2:
+                    return
+                length, pos = buf[1] & 0x7F, 2
+                if length == 126:
+                    length, pos = int.from_bytes(buf[2:4], 'big'), 4
+                elif length == 127:
+                    length, pos = int.from_bytes(buf[2:10], 'big'), 10
+                if len(buf) < pos + length:
+                    return
+                jpeg = bytes(buf[pos:pos + length])
+                del buf[:pos + length]
+            else:
+                end = buf.find(b'\r\n\r\n')
+                if end < 0:
+                    return
+                length = int(buf[buf.find(b'Content-Length:') + 15:end].strip())
+                if len(buf) < end + 4 + length:
+                    return
+                jpeg = bytes(buf[end + 4:end + 4 + length])
+                del buf[:end + 4 + length]
+            self.frames += measuring
+            t = sent_at(jpeg)
+            if measuring and t is not None:
+                self.latencies.append((time.monotonic_ns() - t) / 1e6)
+
+
+def viewer_worker(port, kinds, slow_flags, warmup, seconds, slow_rate, results):
+    """A process running len(kinds) viewers in its own selector loop."""
+    sel = selectors.DefaultSelector()
+    clients = []
+    for kind, slow in zip(kinds, slow_flags):
+        c = Client(kind, slow)
+        c.sock = socket.create_connection(('127.0.0.1', port))
+        if slow:
+            c.sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 16384)
+        c.sock.sendall(c.request(port))
+        c.sock.setblocking(False)
+        if not slow:
+            sel.register(c.sock, selectors.EVENT_READ, c)
+        clients.append(c)
+    slow_clients = [c for c in clients if c.slow]
+
+    start = time.monotonic()
+    measure_from = start + warmup
+    end = measure_from + seconds
+    last = start
+    errors = 0
+    while True:
+        now = time.monotonic()
+        if now >= end:
+            break
+        measuring = now >= measure_from
+        for key, _ in sel.select(0.02):
+            c = key.data
+            try:
+                data = c.sock.recv(262144)
+            except BlockingIOError:
+                continue
+            except OSError:
+                data = b''
+            if not data:
+                sel.unregister(c.sock)
+                c.closed = True
+                errors += 1
+                continue
+            c.feed(data, measuring)
+        # Slow viewers take only their byte budget each pass
+        budget = int(slow_rate * 1024 * (now - last))
+        last = now
+        for c in slow_clients:
+            if c.closed or budget <= 0:
+                continue
+            try:
+                data = c.sock.recv(budget)
+            except BlockingIOError:
+                continue
+            except OSError:
+                data = b''
+            if not data:
+                c.closed = True
+                errors += 1
+                continue
+            c.feed(data, measuring)
+    for c in clients:
+        c.sock.close()
+    results.put([(c.kind, c.slow, c.frames, c.latencies) for c in clients] + [errors])
+
+
+def cpu_seconds(pid):
+    """User + system CPU seconds of a process, from /proc."""
+    with open('/proc/%d/stat' % pid) as f:
+        fields = f.read().rsplit(')', 1)[1].split()
+    return (int(fields[11]) + int(fields[12])) / os.sysconf('SC_CLK_TCK')
+
+
+def rss_mb(pid):
+    with open('/proc/%d/status' % pid) as f:
+        for line in f:
+            if line.startswith('VmRSS:'):
+                return int(line.split()[1]) / 1024
+    return 0.0
+
+
+def percentile(values, p):
+    if not values:
+        return float('nan')
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p))]
+
+
+def fetch(url, timeout=5):
+    return urllib.request.urlopen(url, timeout=timeout).read()
+
+
+def run(clients, args, camera, relay_port):
+    relay = subprocess.Popen([sys.executable, os.path.join(os.path.dirname(os.path.abspath(__file__)), 'relay.py'),
+                              '--camera', '127.0.0.1', '--stream-port', str(camera.server_port),
+                              '--api-port', str(camera.server_port), '--listen', '127.0.0.1:%d' % relay_port,
+                              '--max-viewers', str(clients + 16), '--stats-interval', '0'],
+                             stdout=subprocess.DEVNULL)
+    try:
+        status_url = 'http://127.0.0.1:%d/status' % relay_port
+        deadline = time.monotonic() + 10
+        while True:
+            try:
+                if json.loads(fetch(status_url))['source']['frames'] > 0:
+                    break
+            except OSError:
+                pass
+            if time.monotonic() > deadline:
+                raise RuntimeError('relay did not start')
+            time.sleep(0.1)
+
+        kinds = ['ws' if i % 2 else 'mjpeg' for i in range(clients)]
+        slow = [i < args.slow for i in range(clients)]
+        results = multiprocessing.Queue()
+        workers = []
+        per = -(-clients // args.workers)
+        for w in range(args.workers):
+            part = slice(w * per, (w + 1) * per)
+            if not kinds[part]:
+                continue
+            p = multiprocessing.Process(target=viewer_worker, args=(
+                relay_port, kinds[part], slow[part], args.warmup, args.seconds, args.slow_rate, results))
+            p.start()
+            workers.append(p)
+
+        time.sleep(args.warmup)
+        before = json.loads(fetch(status_url))
+        cpu0 = cpu_seconds(relay.pid)
+        rss = 0.0
+        train_ms = []
+        train_failed = 0
+        end = time.monotonic() + args.seconds
+        next_train = time.monotonic()
+        while time.monotonic() < end:
+            rss = max(rss, rss_mb(relay.pid))
+            if args.train_rate and time.monotonic() >= next_train:
+                t0 = time.monotonic()
+                try:
+                    fetch('http://127.0.0.1:%d/train?action=status' % relay_port)
+                    train_ms.append(1000 * (time.monotonic() - t0))
+                except OSError:
+                    train_failed += 1
+                next_train += 1.0 / args.train_rate
+            time.sleep(0.05)
+        cpu = (cpu_seconds(relay.pid) - cpu0) / args.seconds
+        after = json.loads(fetch(status_url))
+
+        viewers, errors = [], 0
+        for _ in workers:
+            part = results.get()
+            errors += part.pop()
+            viewers += part
+        for p in workers:
+            p.join()
+    finally:
+        relay.terminate()
+        relay.wait()
+
+    fast = [v for v in viewers if not v[1]]
+    latencies = [ms for v in fast for ms in v[3]]
+    fps = [v[2] / args.seconds for v in fast]
+    slow_latencies = [ms for v in viewers if v[1] for ms in v[3]]
+    return {
+        'cpu': cpu,
+        'rss': rss,
+        'fps_avg': sum(fps) / max(len(fps), 1),
+        'fps_min': min(fps) if fps else 0.0,
+        'p50': percentile(latencies, 0.5),
+        'p95': percentile(latencies, 0.95),
+        'p99': percentile(latencies, 0.99),
+        'max': max(latencies) if latencies else float('nan'),
+        'slow_p50': percentile(slow_latencies, 0.5),
+        'dropped': after['frames_dropped'] - before['frames_dropped'],
+        'frames_in': after['source']['frames'] - before['source']['frames'],
+        'train_ms': sum(train_ms) / len(train_ms) if train_ms else float('nan'),
+        'train_failed': train_failed,
+        'errors': errors,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--clients', type=int, nargs='+', default=[10, 100, 300])
+    parser.add_argument('--seconds', type=float, default=10, help='measured time per run')
+    parser.add_argument('--warmup', type=float, default=2)
+    parser.add_argument('--fps', type=float, default=15)
+    parser.add_argument('--jpeg', help='JPEG file to send (default: 30 KB of filler)')
+    parser.add_argument('--workers', type=int, default=4, help='viewer processes')
+    parser.add_argument('--slow', type=int, default=0, help='viewers that read slowly')
+    parser.add_argument('--slow-rate', type=float, default=100, help='KB/s a slow viewer reads')
+    parser.add_argument('--train-rate', type=float, default=2, help='/train requests per second')
+    parser.add_argument('--api-delay', type=float, default=0.02, help="simulated camera's /train time (s)")
+    parser.add_argument('--port', type=int, default=8180, help='relay port')
+    args = parser.parse_args()
+
+    jpeg = open(args.jpeg, 'rb').read() if args.jpeg else b'\xff\xd8' + bytes(30000) + b'\xff\xd9'
+    camera = FakeCamera(jpeg, args.fps, args.api_delay)
+    threading.Thread(target=camera.serve_forever, daemon=True).start()
+
+    print('%d-byte frames at %g fps, %d viewer processes, %.0f s per run' % (
+        len(jpeg), args.fps, args.workers, args.seconds))
+    print('%-8s %9s %7s %12s %28s %8s %9s %7s' % (
+        'viewers', 'relay CPU', 'RSS MB', 'fps avg/min', 'latency p50/p95/p99/max ms', 'dropped', '/train ms',
+        'errors'))
+    for clients in args.clients:
+        r = run(clients, args, camera, args.port)
+        print('%-8d %8.1f%% %7.1f %6.1f/%-5.1f %6.1f/%6.1f/%6.1f/%7.1f %8d %9.1f %7d' % (
+            clients, 100 * r['cpu'], r['rss'], r['fps_avg'], r['fps_min'], r['p50'], r['p95'], r['p99'], r['max'],
+            r['dropped'], r['train_ms'], r['errors'] + r['train_failed']), flush=True)
+        if args.slow:
+            print('         %d slow viewers at %g KB/s: median latency %.0f ms' % (
+                args.slow, args.slow_rate, r['slow_p50']))
+    camera.shutdown()
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
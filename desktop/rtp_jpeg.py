@@ -0,0 +1,356 @@
+#!/usr/bin/env python3
+"""RTP/JPEG (RFC 2435) receiver and overhead check for the camera's RTP mode.
+
+The camera strips the JPEG headers and sends only the scan, with the
+quantization tables in-band (camera/src/main/rtp_jpeg.h). The depacketizer
+here rebuilds a complete JFIF file from the RTP headers, so frames can be
+decoded, recorded or compared like the chunked protocol's.
+
+    # Round-trip JPEG files through RTP and compare the bytes on the wire
+    # with the chunked protocol
+    python rtp_jpeg.py overhead frame1.jpg frame2.jpg
+
+    # Check the camera's packetizer against this module (see
+    # camera/src/tools/rtp_jpeg_bench.c)
+    python rtp_jpeg.py check rtp.bin
+
+    # Subscribe to a camera and display the RTP stream
+    python rtp_jpeg.py view train.local --port 5004
+
+Standard players can use the camera's SDP instead:
+
+    curl -o train.sdp "http://train.local/rtp/describe?port=5004"
+    curl "http://train.local/rtp/setup?port=5004"        # -> {"session":N,...}
+    curl "http://train.local/rtp/play?session=N"
+    ffplay -protocol_whitelist file,udp,rtp train.sdp
+"""
+
+import argparse
+import json
+import socket
+import struct
+import sys
+import urllib.request
+
+from chunk_protocol import CHUNK_SIZE, HEADER_SIZE, pack_chunks
+
+RTP_HEADER_SIZE = 12
+RTP_PT_JPEG = 26
+MAX_PACKET = CHUNK_SIZE + HEADER_SIZE  # Same datagram size as the chunked protocol
+
+# RFC 2435 Appendix A: tables scaled by Q for Q < 128 (zig-zag order)
+LUMA_QUANTIZER = [
+    16, 11, 12, 14, 12, 10, 16, 14, 13, 14, 18, 17, 16, 19, 24, 40,
+    26, 24, 22, 22, 24, 49, 35, 37, 29, 40, 58, 51, 61, 60, 57, 51,
+    56, 55, 64, 72, 92, 78, 64, 68, 87, 69, 55, 56, 80, 109, 81, 87,
+    95, 98, 103, 104, 103, 62, 77, 113, 121, 112, 100, 120, 92, 101, 103, 99]
+CHROMA_QUANTIZER = [17, 18, 18, 24, 21, 24, 47, 26, 26, 47, 99, 66, 56, 66] + [99] * 50
+
+# Standard Huffman tables (JPEG Annex K.3), assumed by RFC 2435
+LUM_DC_CODELENS = [0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0]
+LUM_DC_SYMBOLS = list(range(12))
+LUM_AC_CODELENS = [0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d]
+LUM_AC_SYMBOLS = [
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa]
+CHM_DC_CODELENS = [0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0]
+CHM_DC_SYMBOLS = list(range(12))
+CHM_AC_CODELENS = [0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77]
+CHM_AC_SYMBOLS = [
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa]
+
+
+def make_qtables(q):
+    """RFC 2435 Appendix A: quantization tables for a Q factor of 1-99."""
+    factor = min(max(q, 1), 99)
+    scale = 5000 // factor if factor < 50 else 200 - factor * 2
+    luma = [min(max((v * scale + 50) // 100, 1), 255) for v in LUMA_QUANTIZER]
+    chroma = [min(max((v * scale + 50) // 100, 1), 255) for v in CHROMA_QUANTIZER]
+    return bytes(luma + chroma)
+
+
+def _segment(marker, body):
+    return struct.pack('>BBH', 0xFF, marker, len(body) + 2) + body
+
+
+def make_headers(jpeg_type, width, height, qtables, restart_interval=0):
+    """RFC 2435 Appendix B: the JFIF headers the sender stripped."""
+    out = bytearray(b'\xff\xd8')
+    for i in range(len(qtables) // 64):
+        out += _segment(0xDB, bytes([i]) + qtables[64 * i:64 * (i + 1)])
+    if restart_interval:
+        out += _segment(0xDD, struct.pack('>H', restart_interval))
+    luma_sampling = 0x21 if jpeg_type & 0x3F == 0 else 0x22
+    chroma_table = 1 if len(qtables) >= 128 else 0
+    out += _segment(0xC0, struct.pack('>BHHB', 8, height, width, 3) +
+                    bytes([1, luma_sampling, 0, 2, 0x11, chroma_table, 3, 0x11, chroma_table]))
+    for cls_id, lens, syms in ((0x00, LUM_DC_CODELENS, LUM_DC_SYMBOLS),
+                               (0x10, LUM_AC_CODELENS, LUM_AC_SYMBOLS),
+                               (0x01, CHM_DC_CODELENS, CHM_DC_SYMBOLS),
+                               (0x11, CHM_AC_CODELENS, CHM_AC_SYMBOLS)):
+        out += _segment(0xC4, bytes([cls_id]) + bytes(lens) + bytes(syms))
+    out += _segment(0xDA, bytes([3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0]))
+    return bytes(out)
+
+
+def parse_jpeg(jpeg):
+    """Split a baseline JPEG like the camera does: (type, w, h, qtables, dri, scan)."""
+    qtables = {}
+    width = height = jpeg_type = None
+    dri = 0
+    i = 2
+    while i + 4 <= len(jpeg):
+        marker = jpeg[i + 1]
+        if marker == 0xFF:
+            i += 1
+            continue
+        length = struct.unpack_from('>H', jpeg, i + 2)[0]
+        body = jpeg[i + 4:i + 2 + length]
+        if marker == 0xDB:
+            j = 0
+            while j < len(body):
+                if body[j] >> 4:
+                    raise ValueError('16-bit quantization tables are not supported')
+                qtables[body[j] & 0x0F] = body[j + 1:j + 65]
+                j += 65
+        elif marker == 0xC0:
+            height, width = struct.unpack_from('>HH', body, 1)
+            sampling = body[7]
+            if body[5] != 3 or sampling not in (0x21, 0x22):
+                raise ValueError('Only YUV 4:2:2 / 4:2:0 JPEGs can be sent as RTP/JPEG')
+            if not 0 < width <= 2040 or not 0 < height <= 2040 or (width | height) & 7:
+                raise ValueError('RTP/JPEG carries sizes in units of 8 pixels, up to 2040')
+            jpeg_type = 0 if sampling == 0x21 else 1
+        elif marker in (0xC1, 0xC2, 0xC3):
+            raise ValueError('Only baseline JPEGs can be sent as RTP/JPEG')
+        elif marker == 0xDD:
+            dri = struct.unpack_from('>H', body)[0]
+        elif marker == 0xDA:
+            end = jpeg.rfind(b'\xff\xd9')
+            scan = jpeg[i + 2 + length:end if end > i else len(jpeg)]
+            tables = b''.join(qtables[k] for k in sorted(qtables))
+            return jpeg_type + (64 if dri else 0), width, height, tables, dri, scan
+        i += 2 + length
+    raise ValueError('No scan found')
+
+
+def packetize(jpeg, seq=0, timestamp=0, ssrc=0x12345678, max_packet=MAX_PACKET):
+    """Python twin of rtp_jpeg_packet(), used to measure overhead."""
+    jpeg_type, width, height, qtables, dri, scan = parse_jpeg(jpeg)
+    packets = []
+    offset = 0
+    while True:
+        hdr = bytearray()
+        hdr += struct.pack('>BBHII', 0x80, RTP_PT_JPEG, seq & 0xFFFF, timestamp, ssrc)
+        hdr += struct.pack('>I', offset)  # Type-specific byte (0) + 24-bit fragment offset
+        hdr += bytes([jpeg_type, 255, width // 8, height // 8])
+        if dri:
+            hdr += struct.pack('>HH', dri, 0xFFFF)
+        if offset == 0:
+            hdr += struct.pack('>BBH', 0, 0, len(qtables)) + qtables
+        data = scan[offset:offset + max_packet - len(hdr)]
+        offset += len(data)
+        if offset >= len(scan):
+            hdr[1] |= 0x80  # Marker: last packet of the frame
+        packets.append(bytes(hdr) + data)
+        seq += 1
+        if offset >= len(scan):
+            return packets
+
+
+class RtpJpegDepacketizer:
+    """Rebuilds JPEG frames from RTP/JPEG packets. Frames with a missing
+    fragment are dropped; loss is counted from sequence number gaps."""
+
+    def __init__(self):
+        self.timestamp = None
+        self.fragments = {}
+        self.qtables = None
+        self.expected_seq = None
+        self.frames = 0
+        self.packets_lost = 0
+        self.frames_dropped = 0
+
+    def push(self, packet):
+        """Feed one datagram. Returns the completed JPEG bytes, or None."""
+        if len(packet) < RTP_HEADER_SIZE + 8 or packet[0] >> 6 != 2 or packet[1] & 0x7F != RTP_PT_JPEG:
+            return None
+        marker = packet[1] & 0x80
+        seq, timestamp = struct.unpack_from('>HI', packet, 2)
+        csrc_count = packet[0] & 0x0F
+        p = RTP_HEADER_SIZE + 4 * csrc_count
+
+        if self.expected_seq is not None and seq != self.expected_seq:
+            self.packets_lost += (seq - self.expected_seq) & 0xFFFF
+        self.expected_seq = (seq + 1) & 0xFFFF
+
+        if timestamp != self.timestamp:
+            if self.fragments:
+                self.frames_dropped += 1  # Previous frame never got its marker
+            self.timestamp = timestamp
+            self.fragments = {}
+            self.qtables = None
+
+        offset = int.from_bytes(packet[p + 1:p + 4], 'big')
+        jpeg_type, q, width, height = packet[p + 4:p + 8]
+        p += 8
+        dri = 0
+        if jpeg_type >= 64:
+            dri = struct.unpack_from('>H', packet, p)[0]
+            p += 4
+        if offset == 0:
+            if q >= 128:
+                length = struct.unpack_from('>H', packet, p + 2)[0]
+                self.qtables = packet[p + 4:p + 4 + length]
+                p += 4 + length
+            else:
+                self.qtables = make_qtables(q)
+        self.fragments[offset] = packet[p:]
+
+        if not marker:
+            return None
+
+        # Fragments must tile the scan exactly
+        scan = bytearray()
+        for off in sorted(self.fragments):
+            if off != len(scan):
+                self.frames_dropped += 1
+                self.fragments = {}
+                return None
+            scan += self.fragments[off]
+        self.fragments = {}
+        if self.qtables is None:
+            self.frames_dropped += 1
+            return None
+        self.frames += 1
+        return make_headers(jpeg_type, width * 8, height * 8, self.qtables, dri) + bytes(scan) + b'\xff\xd9'
+
+
+def overhead(paths):
+    print('%-28s %8s %10s %10s %10s' % ('file', 'jpeg', 'chunk', 'rtp', 'saved'))
+    for path in paths:
+        with open(path, 'rb') as f:
+            jpeg = f.read()
+        chunk_wire = sum(len(p) for p in pack_chunks(0, jpeg))
+        rtp_packets = packetize(jpeg)
+        rtp_wire = sum(len(p) for p in rtp_packets)
+
+        # Round trip: the rebuilt JPEG must carry the identical scan
+        d = RtpJpegDepacketizer()
+        rebuilt = [d.push(p) for p in rtp_packets][-1]
+        if rebuilt is None or parse_jpeg(rebuilt)[5] != parse_jpeg(jpeg)[5]:
+            print('%s: round trip FAILED' % path)
+            return 1
+        print('%-28s %8d %10d %10d %9d B' % (path[-28:], len(jpeg), chunk_wire, rtp_wire, chunk_wire - rtp_wire))
+    return 0
+
+
+def check(path):
+    """Check a dump of camera/src/tools/rtp_jpeg_bench.c against this module:
+    the C packets must match packetize() byte for byte, and the depacketizer
+    must rebuild the same JPEG as the C receiver, with the original scan."""
+    with open(path, 'rb') as f:
+        dump = f.read()
+    frames = []
+    i = 0
+    while i + 5 <= len(dump):
+        kind, length = dump[i:i + 1], struct.unpack_from('>I', dump, i + 1)[0]
+        record = dump[i + 5:i + 5 + length]
+        i += 5 + length
+        if kind == b'J':
+            frames.append((record, [], None))
+        elif kind == b'P' and frames:
+            frames[-1][1].append(record)
+        elif kind == b'R' and frames:
+            frames[-1] = frames[-1][:2] + (record,)
+    d = RtpJpegDepacketizer()
+    failed = 0
+    for n, (jpeg, packets, c_rebuilt) in enumerate(frames):
+        seq, timestamp, ssrc = struct.unpack_from('>HII', packets[0], 2) if packets else (0, 0, 0)
+        expected = packetize(jpeg, seq, timestamp, ssrc, max(len(p) for p in packets) if packets else MAX_PACKET)
+        rebuilt = [d.push(p) for p in packets][-1] if packets else None
+        if packets != expected:
+            print('frame %d: C packets differ from packetize()' % n)
+        elif rebuilt != c_rebuilt:
+            print('frame %d: depacketizer rebuilt a different JPEG than the C receiver' % n)
+        elif parse_jpeg(rebuilt)[5] != parse_jpeg(jpeg)[5]:
+            print('frame %d: scan lost in the round trip' % n)
+        else:
+            continue
+        failed += 1
+    print('%d frames, %d packets, %d failed' % (len(frames), sum(len(f[1]) for f in frames), failed))
+    return 1 if failed or not frames or d.packets_lost or d.frames_dropped else 0
+
+
+def view(host, port, display=True):
+    base = 'http://%s' % host
+    setup = json.load(urllib.request.urlopen('%s/rtp/setup?port=%d' % (base, port)))
+    session = setup['session']
+    urllib.request.urlopen('%s/rtp/play?session=%d' % (base, session)).read()
+    print('Session %d: receiving RTP/JPEG on port %d' % (session, port))
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4 * 1024 * 1024)
+    sock.bind(('', port))
+    depacketizer = RtpJpegDepacketizer()
+    try:
+        import cv2
+        import numpy as np
+        while True:
+            jpeg = depacketizer.push(sock.recv(65536))
+            if jpeg is None:
+                continue
+            frame = cv2.imdecode(np.frombuffer(jpeg, np.uint8), cv2.IMREAD_COLOR)
+            if frame is not None and display:
+                cv2.imshow('RTP/JPEG', frame)
+                if cv2.waitKey(1) & 0xFF == ord('q'):
+                    break
+    except KeyboardInterrupt:
+        pass
+    finally:
+        urllib.request.urlopen('%s/rtp/teardown?session=%d' % (base, session)).read()
+        print('%d frames, %d packets lost, %d frames dropped' % (
+            depacketizer.frames, depacketizer.packets_lost, depacketizer.frames_dropped))
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest='command', required=True)
+    p = sub.add_parser('overhead', help='compare chunked and RTP/JPEG bytes for JPEG files')
+    p.add_argument('files', nargs='+')
+    p = sub.add_parser('check', help='check a packet dump of camera/src/tools/rtp_jpeg_bench.c')
+    p.add_argument('dump')
+    p = sub.add_parser('view', help='subscribe to a camera and display its RTP stream')
+    p.add_argument('host')
+    p.add_argument('--port', type=int, default=5004)
+    args = parser.parse_args()
+
+    if args.command == 'overhead':
+        return overhead(args.files)
+    if args.command == 'check':
+        return check(args.dump)
+    return view(args.host, args.port)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+"""Synthetic camera load generator for benchmarking ingest.py.
+
+Sends chunked JPEG frames to a range of UDP ports, one simulated camera per
+port, at a fixed frame rate. Uses a real JPEG if given, otherwise encodes an
+800x600 test pattern with OpenCV.
+
+    python udp_loadgen.py --streams 8 --fps 15
+    python udp_loadgen.py --host 192.168.1.20 --jpeg sample.jpg --streams 4 --duration 60
+    python udp_loadgen.py --streams 4 --key <hex>    (sealed like proto=gcm)
+"""
+
+import argparse
+import os
+import socket
+import sys
+import threading
+import time
+
+from chunk_protocol import CHUNK_SIZE, CRYPT_CHUNK_SIZE, FRAME_ID_MOD, ChunkCipher, key_argument, pack_chunks
+
+
+def make_test_jpeg(width, height, quality):
+    import cv2
+    import numpy as np
+    # Noise plus gradients gives a size close to a real 800x600 scene
+    rng = np.random.default_rng(0)
+    image = rng.integers(0, 64, (height, width, 3), dtype=np.uint8)
+    image[:, :, 0] += np.linspace(0, 191, width, dtype=np.uint8)[None, :]
+    image[:, :, 1] += np.linspace(0, 191, height, dtype=np.uint8)[:, None]
+    ok, data = cv2.imencode('.jpg', image, [cv2.IMWRITE_JPEG_QUALITY, quality])
+    if not ok:
+        raise RuntimeError('JPEG encode failed')
+    return data.tobytes()
+
+
+def stream(host, port, jpeg, fps, chunk_size, deadline, counters, key):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    # Pre-split once; only the frame id changes between frames. Sealed
+    # frames differ in every byte, so they are sealed as they go out.
+    chunks = list(pack_chunks(0, jpeg, chunk_size))
+    cipher = ChunkCipher(key) if key else None
+    salt, epoch = os.urandom(6), 0
+    interval = 1.0 / fps
+    next_frame = time.monotonic()
+    frame_id = 0
+
+    while time.monotonic() < deadline:
+        if cipher:
+            for packet in cipher.seal_chunks(frame_id, jpeg, epoch, salt, min(chunk_size, CRYPT_CHUNK_SIZE)):
+                sock.sendto(packet, (host, port))
+        else:
+            id_bytes = frame_id.to_bytes(2, 'little')
+            for chunk in chunks:
+                sock.sendto(id_bytes + chunk[2:], (host, port))
+        counters[port] += 1
+        frame_id = (frame_id + 1) % FRAME_ID_MOD
+        epoch += frame_id == 0
+
+        next_frame += interval
+        delay = next_frame - time.monotonic()
+        if delay > 0:
+            time.sleep(delay)
+        else:
+            next_frame = time.monotonic()  # Falling behind: don't burst to catch up
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--host', default='127.0.0.1')
+    parser.add_argument('--port', type=int, default=5005, help='first port')
+    parser.add_argument('--streams', type=int, default=1, help='number of cameras (consecutive ports)')
+    parser.add_argument('--fps', type=float, default=15)
+    parser.add_argument('--jpeg', help='JPEG file to send instead of a generated test pattern')
+    parser.add_argument('--width', type=int, default=800)
+    parser.add_argument('--height', type=int, default=600)
+    parser.add_argument('--quality', type=int, default=80)
+    parser.add_argument('--chunk-size', type=int, default=CHUNK_SIZE)
+    parser.add_argument('--duration', type=float, default=30, help='seconds to run')
+    key_argument(parser)
+    args = parser.parse_args()
+
+    if args.jpeg:
+        with open(args.jpeg, 'rb') as f:
+            jpeg = f.read()
+    else:
+        jpeg = make_test_jpeg(args.width, args.height, args.quality)
+
+    ports = range(args.port, args.port + args.streams)
+    counters = {port: 0 for port in ports}
+    start = time.monotonic()
+    deadline = start + args.duration
+    threads = [threading.Thread(target=stream, daemon=True,
+                                args=(args.host, port, jpeg, args.fps, args.chunk_size, deadline, counters, args.key))
+               for port in ports]
+    for t in threads:
+        t.start()
+
+    print('Sending %d stream(s) of %d-byte frames at %.1f fps to %s:%d-%d' % (
+        args.streams, len(jpeg), args.fps, args.host, ports[0], ports[-1]))
+    try:
+        for t in threads:
+            t.join()
+    except KeyboardInterrupt:
+        pass
+
+    elapsed = time.monotonic() - start
+    frames = sum(counters.values())
+    print('Sent %d frames in %.1f s: %.1f fps per stream, %.1f Mbit/s total' % (
+        frames, elapsed, frames / elapsed / args.streams, frames * len(jpeg) * 8 / elapsed / 1e6))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -3,10 +3,11 @@
 
 from pybricks.hubs import CityHub
 from pybricks.parameters import Color, Port
-from pybricks.tools import wait
+from pybricks.tools import wait, StopWatch
 from pybricks.pupdevices import DCMotor
-from usys import stdin
+from usys import stdin, stdout
 from uselect import poll
+from ustruct import pack
 
 # Initialize the hub and motor
 hub = CityHub()
@@ -16,10 +17,58 @@ train_motor = DCMotor(Port.A)
 keyboard = poll()
 keyboard.register(stdin)
 
+# Telemetry frame (see camera/src/main/hub_telemetry.h):
+# A5 5A, version, payload length, payload, CRC-16 of the payload (little-endian)
+TELEMETRY_VERSION = 1
+telemetry_period = 500  # ms between frames, 0 = off; "T<n>" sets n frames/s
+has_imu = hasattr(hub, "imu")  # The City hub has none
+
+
+def crc16(data):
+    crc = 0xFFFF
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) & 0xFFFF if crc & 0x8000 else (crc << 1) & 0xFFFF
+    return crc
+
+
+def send_telemetry(seq, duty, loop_avg, loop_max):
+    pitch, roll, flags = 0, 0, 0
+    if has_imu:
+        pitch, roll = hub.imu.tilt()
+        flags |= 0x01
+    payload = pack(
+        "<HIHhbBhhHH",
+        seq & 0xFFFF,
+        clock.time(),
+        hub.battery.voltage(),
+        hub.battery.current(),
+        duty,
+        flags,
+        pitch * 10,
+        roll * 10,
+        loop_avg,
+        loop_max,
+    )
+    header = bytes((0xA5, 0x5A, TELEMETRY_VERSION, len(payload)))
+    stdout.buffer.write(header + payload + pack("<H", crc16(payload)))
+
+
 # Signal ready
 hub.light.on(Color.GREEN)
 print("RDY")
 
+clock = StopWatch()
+duty = 0
+rate_pending = False
+seq = 0
+last_telemetry = 0
+loop_start = 0
+loop_total = 0
+loop_count = 0
+loop_max = 0
+
 while True:
     # Check for incoming commands via stdin (from BLE GATT)
     # Use stdin.buffer.read() for raw bytes from BLE
@@ -27,18 +76,44 @@ while True:
         byte = stdin.buffer.read(1)
         if byte:
             cmd = chr(byte[0]).upper()
-            if cmd == "F":
-                train_motor.dc(30)
+            if rate_pending:
+                # Second character of "T<n>": telemetry frames per second
+                rate_pending = False
+                if "0" <= cmd <= "9":
+                    telemetry_period = 1000 // int(cmd) if cmd != "0" else 0
+                    print("TLM", cmd)
+            elif cmd == "F":
+                duty = 30
+                train_motor.dc(duty)
                 hub.light.on(Color.GREEN)
                 print("FWD")
             elif cmd == "B":
-                train_motor.dc(-30)
+                duty = -30
+                train_motor.dc(duty)
                 hub.light.on(Color.BLUE)
                 print("BWD")
             elif cmd == "S":
-                train_motor.dc(0)
+                duty = 0
+                train_motor.dc(duty)
                 hub.light.on(Color.YELLOW)
                 print("STP")
+            elif cmd == "T":
+                rate_pending = True
             # Ignore other characters
 
+    now = clock.time()
+    if telemetry_period and now - last_telemetry >= telemetry_period:
+        send_telemetry(seq, duty, loop_total // max(loop_count, 1), loop_max)
+        seq += 1
+        last_telemetry = now
+        loop_total = loop_count = loop_max = 0
+
     wait(50)
+
+    # Loop timing, including the wait
+    now = clock.time()
+    elapsed = now - loop_start
+    loop_start = now
+    loop_total += elapsed
+    loop_count += 1
+    loop_max = max(loop_max, elapsed)